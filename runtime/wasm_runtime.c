@@ -4,7 +4,12 @@
  * This runtime provides support functions for WASM programs compiled by waq.
  */
 
+#define _DEFAULT_SOURCE  /* _longjmp, sigsetjmp, sigaction, sigaltstack */
+
 #include "wasm_runtime.h"
+
+#include <setjmp.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -19,24 +24,79 @@ static uint32_t memory_pages = 0;
 
 /* ============== Table state ============== */
 
-void** __wasm_table = NULL;
+WasmTableEntry* __wasm_table = NULL;
 uint32_t __wasm_table_size = 0;
 
-/* ============== Integer intrinsics ============== */
+/* ============== CPU feature dispatch ============== */
 
-int32_t __wasm_i32_clz(int32_t x) {
-    if (x == 0) return 32;
-    return __builtin_clz((unsigned int)x);
-}
+/*
+ * The runtime is normally compiled for the baseline ISA, where x86-64 has no
+ * POPCNT, LZCNT, TZCNT or ROUNDSS.  Helpers that gain from those are built
+ * twice, once with __attribute__((target(feature))), and a GNU ifunc resolver
+ * binds the symbol to the best version when the program is loaded; calls then
+ * cost the same as to a plain function.  Builds that already enable a
+ * feature (-march=native) define the fast version directly, and targets
+ * without ifunc (non-ELF, non-x86-64, or -DWAQ_NO_IFUNC) the baseline one.
+ *
+ * Bodies are macros rather than inline functions so the fast version is
+ * compiled with the feature even when this file is built without -O.
+ */
+#if defined(__x86_64__) && defined(__ELF__) && defined(__GNUC__) && !defined(WAQ_NO_IFUNC)
+#define WAQ_IFUNC 1
+#else
+#define WAQ_IFUNC 0
+#endif
+
+#define WAQ_DIRECT(ret, name, type, expr) \
+    ret name(type x) { return expr; }
+
+#if WAQ_IFUNC
+#define WAQ_DISPATCH(ret, name, type, feature, fast, generic) \
+    __attribute__((target(feature))) static ret name##_fast(type x) { return fast; } \
+    static ret name##_generic(type x) { return generic; } \
+    static ret (*name##_resolve(void))(type) { \
+        __builtin_cpu_init(); \
+        return __builtin_cpu_supports(feature) ? name##_fast : name##_generic; \
+    } \
+    ret name(type x) __attribute__((ifunc(#name "_resolve")));
+#else
+#define WAQ_DISPATCH(ret, name, type, feature, fast, generic) \
+    WAQ_DIRECT(ret, name, type, generic)
+#endif
 
-int32_t __wasm_i32_ctz(int32_t x) {
-    if (x == 0) return 32;
-    return __builtin_ctz((unsigned int)x);
-}
+/* ============== Integer intrinsics ============== */
 
-int32_t __wasm_i32_popcnt(int32_t x) {
-    return __builtin_popcount((unsigned int)x);
-}
+#define WAQ_CLZ32(x) ((x) == 0 ? 32 : __builtin_clz((uint32_t)(x)))
+#define WAQ_CLZ64(x) ((x) == 0 ? 64 : __builtin_clzll((uint64_t)(x)))
+#define WAQ_CTZ32(x) ((x) == 0 ? 32 : __builtin_ctz((uint32_t)(x)))
+#define WAQ_CTZ64(x) ((x) == 0 ? 64 : __builtin_ctzll((uint64_t)(x)))
+#define WAQ_POPCNT32(x) __builtin_popcount((uint32_t)(x))
+#define WAQ_POPCNT64(x) __builtin_popcountll((uint64_t)(x))
+
+#if defined(__LZCNT__)
+WAQ_DIRECT(int32_t, __wasm_i32_clz, int32_t, WAQ_CLZ32(x))
+WAQ_DIRECT(int64_t, __wasm_i64_clz, int64_t, WAQ_CLZ64(x))
+#else
+WAQ_DISPATCH(int32_t, __wasm_i32_clz, int32_t, "lzcnt", WAQ_CLZ32(x), WAQ_CLZ32(x))
+WAQ_DISPATCH(int64_t, __wasm_i64_clz, int64_t, "lzcnt", WAQ_CLZ64(x), WAQ_CLZ64(x))
+#endif
+
+/* TZCNT is part of BMI1 */
+#if defined(__BMI__)
+WAQ_DIRECT(int32_t, __wasm_i32_ctz, int32_t, WAQ_CTZ32(x))
+WAQ_DIRECT(int64_t, __wasm_i64_ctz, int64_t, WAQ_CTZ64(x))
+#else
+WAQ_DISPATCH(int32_t, __wasm_i32_ctz, int32_t, "bmi", WAQ_CTZ32(x), WAQ_CTZ32(x))
+WAQ_DISPATCH(int64_t, __wasm_i64_ctz, int64_t, "bmi", WAQ_CTZ64(x), WAQ_CTZ64(x))
+#endif
+
+#if defined(__POPCNT__)
+WAQ_DIRECT(int32_t, __wasm_i32_popcnt, int32_t, WAQ_POPCNT32(x))
+WAQ_DIRECT(int64_t, __wasm_i64_popcnt, int64_t, WAQ_POPCNT64(x))
+#else
+WAQ_DISPATCH(int32_t, __wasm_i32_popcnt, int32_t, "popcnt", WAQ_POPCNT32(x), WAQ_POPCNT32(x))
+WAQ_DISPATCH(int64_t, __wasm_i64_popcnt, int64_t, "popcnt", WAQ_POPCNT64(x), WAQ_POPCNT64(x))
+#endif
 
 int32_t __wasm_i32_rotl(int32_t x, int32_t y) {
     uint32_t ux = (uint32_t)x;
@@ -50,20 +110,6 @@ int32_t __wasm_i32_rotr(int32_t x, int32_t y) {
     return (int32_t)((ux >> shift) | (ux << (32 - shift)));
 }
 
-int64_t __wasm_i64_clz(int64_t x) {
-    if (x == 0) return 64;
-    return __builtin_clzll((unsigned long long)x);
-}
-
-int64_t __wasm_i64_ctz(int64_t x) {
-    if (x == 0) return 64;
-    return __builtin_ctzll((unsigned long long)x);
-}
-
-int64_t __wasm_i64_popcnt(int64_t x) {
-    return __builtin_popcountll((unsigned long long)x);
-}
-
 int64_t __wasm_i64_rotl(int64_t x, int64_t y) {
     uint64_t ux = (uint64_t)x;
     uint64_t shift = (uint64_t)y & 63;
@@ -80,11 +126,6 @@ int64_t __wasm_i64_rotr(int64_t x, int64_t y) {
 
 float __wasm_f32_abs(float x) { return fabsf(x); }
 float __wasm_f32_neg(float x) { return -x; }
-float __wasm_f32_ceil(float x) { return ceilf(x); }
-float __wasm_f32_floor(float x) { return floorf(x); }
-float __wasm_f32_trunc(float x) { return truncf(x); }
-float __wasm_f32_nearest(float x) { return nearbyintf(x); }
-float __wasm_f32_sqrt(float x) { return sqrtf(x); }
 
 float __wasm_f32_min(float x, float y) {
     if (isnan(x)) return x;
@@ -102,11 +143,6 @@ float __wasm_f32_copysign(float x, float y) { return copysignf(x, y); }
 
 double __wasm_f64_abs(double x) { return fabs(x); }
 double __wasm_f64_neg(double x) { return -x; }
-double __wasm_f64_ceil(double x) { return ceil(x); }
-double __wasm_f64_floor(double x) { return floor(x); }
-double __wasm_f64_trunc(double x) { return trunc(x); }
-double __wasm_f64_nearest(double x) { return nearbyint(x); }
-double __wasm_f64_sqrt(double x) { return sqrt(x); }
 
 double __wasm_f64_min(double x, double y) {
     if (isnan(x)) return x;
@@ -122,6 +158,99 @@ double __wasm_f64_max(double x, double y) {
 
 double __wasm_f64_copysign(double x, double y) { return copysign(x, y); }
 
+/* ============== Rounding and square root ============== */
+
+/*
+ * One instruction each on x86-64 (SSE4.1 roundss/roundsd, SSE2 sqrtss/sqrtsd)
+ * and AArch64 (frint*, fsqrt); libm adds a call, an FP environment
+ * save/restore in nearbyint and an errno path in sqrt.  Without SSE4.1 at
+ * compile time the x86-64 rounding functions are dispatched (see above);
+ * other targets keep libm.
+ */
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+/* mode must be a constant: it is an immediate of roundss/roundsd */
+#define WAQ_ROUND_F32(x, mode) \
+    _mm_cvtss_f32(_mm_round_ss(_mm_setzero_ps(), _mm_set_ss(x), (mode) | _MM_FROUND_NO_EXC))
+#define WAQ_ROUND_F64(x, mode) \
+    _mm_cvtsd_f64(_mm_round_sd(_mm_setzero_pd(), _mm_set_sd(x), (mode) | _MM_FROUND_NO_EXC))
+
+float __wasm_f32_sqrt(float x) {
+    return _mm_cvtss_f32(_mm_sqrt_ss(_mm_set_ss(x)));
+}
+
+double __wasm_f64_sqrt(double x) {
+    return _mm_cvtsd_f64(_mm_sqrt_sd(_mm_setzero_pd(), _mm_set_sd(x)));
+}
+#endif
+
+#if defined(__x86_64__) && defined(__SSE4_1__)
+WAQ_DIRECT(float, __wasm_f32_ceil, float, WAQ_ROUND_F32(x, _MM_FROUND_TO_POS_INF))
+WAQ_DIRECT(float, __wasm_f32_floor, float, WAQ_ROUND_F32(x, _MM_FROUND_TO_NEG_INF))
+WAQ_DIRECT(float, __wasm_f32_trunc, float, WAQ_ROUND_F32(x, _MM_FROUND_TO_ZERO))
+WAQ_DIRECT(float, __wasm_f32_nearest, float, WAQ_ROUND_F32(x, _MM_FROUND_TO_NEAREST_INT))
+WAQ_DIRECT(double, __wasm_f64_ceil, double, WAQ_ROUND_F64(x, _MM_FROUND_TO_POS_INF))
+WAQ_DIRECT(double, __wasm_f64_floor, double, WAQ_ROUND_F64(x, _MM_FROUND_TO_NEG_INF))
+WAQ_DIRECT(double, __wasm_f64_trunc, double, WAQ_ROUND_F64(x, _MM_FROUND_TO_ZERO))
+WAQ_DIRECT(double, __wasm_f64_nearest, double, WAQ_ROUND_F64(x, _MM_FROUND_TO_NEAREST_INT))
+
+#elif defined(__x86_64__) && WAQ_IFUNC
+WAQ_DISPATCH(float, __wasm_f32_ceil, float, "sse4.1",
+             WAQ_ROUND_F32(x, _MM_FROUND_TO_POS_INF), ceilf(x))
+WAQ_DISPATCH(float, __wasm_f32_floor, float, "sse4.1",
+             WAQ_ROUND_F32(x, _MM_FROUND_TO_NEG_INF), floorf(x))
+WAQ_DISPATCH(float, __wasm_f32_trunc, float, "sse4.1",
+             WAQ_ROUND_F32(x, _MM_FROUND_TO_ZERO), truncf(x))
+WAQ_DISPATCH(float, __wasm_f32_nearest, float, "sse4.1",
+             WAQ_ROUND_F32(x, _MM_FROUND_TO_NEAREST_INT), nearbyintf(x))
+WAQ_DISPATCH(double, __wasm_f64_ceil, double, "sse4.1",
+             WAQ_ROUND_F64(x, _MM_FROUND_TO_POS_INF), ceil(x))
+WAQ_DISPATCH(double, __wasm_f64_floor, double, "sse4.1",
+             WAQ_ROUND_F64(x, _MM_FROUND_TO_NEG_INF), floor(x))
+WAQ_DISPATCH(double, __wasm_f64_trunc, double, "sse4.1",
+             WAQ_ROUND_F64(x, _MM_FROUND_TO_ZERO), trunc(x))
+WAQ_DISPATCH(double, __wasm_f64_nearest, double, "sse4.1",
+             WAQ_ROUND_F64(x, _MM_FROUND_TO_NEAREST_INT), nearbyint(x))
+
+#elif defined(__aarch64__)
+/* frintn rounds ties to even regardless of FPCR, as WASM nearest requires */
+#define WAQ_A64_UNARY(name, type, insn, reg) \
+    type name(type x) { \
+        type r; \
+        __asm__(insn " %" reg "0, %" reg "1" : "=w"(r) : "w"(x)); \
+        return r; \
+    }
+
+WAQ_A64_UNARY(__wasm_f32_ceil, float, "frintp", "s")
+WAQ_A64_UNARY(__wasm_f32_floor, float, "frintm", "s")
+WAQ_A64_UNARY(__wasm_f32_trunc, float, "frintz", "s")
+WAQ_A64_UNARY(__wasm_f32_nearest, float, "frintn", "s")
+WAQ_A64_UNARY(__wasm_f32_sqrt, float, "fsqrt", "s")
+WAQ_A64_UNARY(__wasm_f64_ceil, double, "frintp", "d")
+WAQ_A64_UNARY(__wasm_f64_floor, double, "frintm", "d")
+WAQ_A64_UNARY(__wasm_f64_trunc, double, "frintz", "d")
+WAQ_A64_UNARY(__wasm_f64_nearest, double, "frintn", "d")
+WAQ_A64_UNARY(__wasm_f64_sqrt, double, "fsqrt", "d")
+
+#else
+float __wasm_f32_ceil(float x) { return ceilf(x); }
+float __wasm_f32_floor(float x) { return floorf(x); }
+float __wasm_f32_trunc(float x) { return truncf(x); }
+float __wasm_f32_nearest(float x) { return nearbyintf(x); }
+
+double __wasm_f64_ceil(double x) { return ceil(x); }
+double __wasm_f64_floor(double x) { return floor(x); }
+double __wasm_f64_trunc(double x) { return trunc(x); }
+double __wasm_f64_nearest(double x) { return nearbyint(x); }
+#endif
+
+#if !defined(__x86_64__) && !defined(__aarch64__)
+float __wasm_f32_sqrt(float x) { return sqrtf(x); }
+double __wasm_f64_sqrt(double x) { return sqrt(x); }
+#endif
+
 /* ============== Saturating truncation ============== */
 
 int32_t __wasm_i32_trunc_sat_f32_s(float x) {
@@ -234,18 +363,22 @@ void __wasm_memory_fill(int32_t dest, int32_t val, int32_t len) {
 
 /* ============== Table operations ============== */
 
-void* __wasm_table_get(int32_t idx) {
+/* Only table 0 exists; the index is part of the call ABI for later tables */
+void* __wasm_table_get(int32_t table, int32_t idx) {
+    (void)table;
     if (idx < 0 || (uint32_t)idx >= __wasm_table_size) {
         __wasm_trap_out_of_bounds();
     }
-    return __wasm_table[idx];
+    return __wasm_table[idx].code;
 }
 
-void __wasm_table_set(int32_t idx, void* val) {
+void __wasm_table_set(int32_t table, int32_t idx, void* val, uint32_t sig) {
+    (void)table;
     if (idx < 0 || (uint32_t)idx >= __wasm_table_size) {
         __wasm_trap_out_of_bounds();
     }
-    __wasm_table[idx] = val;
+    __wasm_table[idx].code = val;
+    __wasm_table[idx].sig = sig;
 }
 
 void __wasm_table_init(int32_t table, int32_t elem, int32_t dest, int32_t src, int32_t len) {
@@ -263,9 +396,9 @@ void __wasm_table_copy(int32_t dest_table, int32_t src_table, int32_t dest, int3
     (void)dest_table; (void)src_table; (void)dest; (void)src; (void)len;
 }
 
-int32_t __wasm_table_grow(int32_t table, void* val, int32_t delta) {
+int32_t __wasm_table_grow(int32_t table, void* val, uint32_t sig, int32_t delta) {
     /* TODO: Implement table grow */
-    (void)table; (void)val; (void)delta;
+    (void)table; (void)val; (void)sig; (void)delta;
     return -1;
 }
 
@@ -274,86 +407,201 @@ int32_t __wasm_table_size_op(int32_t table) {
     return (int32_t)__wasm_table_size;
 }
 
-void __wasm_table_fill(int32_t table, int32_t dest, void* val, int32_t len) {
+void __wasm_table_fill(int32_t table, int32_t dest, void* val, uint32_t sig, int32_t len) {
     /* TODO: Implement table fill */
-    (void)table; (void)dest; (void)val; (void)len;
+    (void)table; (void)dest; (void)val; (void)sig; (void)len;
 }
 
 /* ============== Traps ============== */
 
-void __wasm_trap_unreachable(void) {
-    fprintf(stderr, "wasm trap: unreachable\n");
+/*
+ * Outside __wasm_invoke() a trap prints its message and exits.  Inside it the
+ * trap unwinds to the boundary, which returns the trap code.
+ */
+
+static const char* const trap_messages[WASM_TRAP_COUNT] = {
+    [WASM_TRAP_NONE] = "no trap",
+    [WASM_TRAP_UNREACHABLE] = "unreachable",
+    [WASM_TRAP_DIV_BY_ZERO] = "integer divide by zero",
+    [WASM_TRAP_INTEGER_OVERFLOW] = "integer overflow",
+    [WASM_TRAP_INVALID_CONVERSION] = "invalid conversion to integer",
+    [WASM_TRAP_OUT_OF_BOUNDS] = "out of bounds memory access",
+    [WASM_TRAP_NULL_REFERENCE] = "null reference",
+    [WASM_TRAP_CAST_FAILURE] = "ref.cast failed",
+    [WASM_TRAP_UNCAUGHT_EXCEPTION] = "unhandled exception",
+    [WASM_TRAP_OUT_OF_MEMORY] = "out of memory",
+    [WASM_TRAP_MEMORY_FAULT] = "memory fault",
+    [WASM_TRAP_UNDEFINED_ELEMENT] = "undefined element",
+    [WASM_TRAP_UNINITIALIZED_ELEMENT] = "uninitialized element",
+    [WASM_TRAP_INDIRECT_CALL_MISMATCH] = "indirect call type mismatch",
+};
+
+const char* __wasm_trap_message(int32_t code) {
+    if (code < 0 || code >= WASM_TRAP_COUNT) return "unknown trap";
+    return trap_messages[code];
+}
+
+typedef struct TrapBoundary {
+    sigjmp_buf env;
+    struct TrapBoundary* prev;
+    void* handlers;  /* Exception handler stack on entry */
+} TrapBoundary;
+
+static __thread TrapBoundary* trap_boundary = NULL;
+
+static void __attribute__((noreturn)) trap(int32_t code) {
+    if (trap_boundary) {
+        siglongjmp(trap_boundary->env, code);
+    }
+    fprintf(stderr, "wasm trap: %s\n", __wasm_trap_message(code));
     exit(1);
 }
 
+void __wasm_trap_unreachable(void) {
+    trap(WASM_TRAP_UNREACHABLE);
+}
+
 void __wasm_trap_div_by_zero(void) {
-    fprintf(stderr, "wasm trap: integer divide by zero\n");
-    exit(1);
+    trap(WASM_TRAP_DIV_BY_ZERO);
 }
 
 void __wasm_trap_integer_overflow(void) {
-    fprintf(stderr, "wasm trap: integer overflow\n");
-    exit(1);
+    trap(WASM_TRAP_INTEGER_OVERFLOW);
 }
 
 void __wasm_trap_invalid_conversion(void) {
-    fprintf(stderr, "wasm trap: invalid conversion to integer\n");
-    exit(1);
+    trap(WASM_TRAP_INVALID_CONVERSION);
 }
 
 void __wasm_trap_out_of_bounds(void) {
-    fprintf(stderr, "wasm trap: out of bounds memory access\n");
-    exit(1);
+    trap(WASM_TRAP_OUT_OF_BOUNDS);
 }
 
 void __wasm_trap_null_reference(void) {
-    fprintf(stderr, "wasm trap: null reference\n");
-    exit(1);
+    trap(WASM_TRAP_NULL_REFERENCE);
+}
+
+void __wasm_trap_undefined_element(void) {
+    trap(WASM_TRAP_UNDEFINED_ELEMENT);
+}
+
+/* sig is the failing slot's id; 0 means the slot is null */
+void __wasm_trap_indirect_call(uint32_t sig) {
+    trap(sig == 0 ? WASM_TRAP_UNINITIALIZED_ELEMENT : WASM_TRAP_INDIRECT_CALL_MISMATCH);
 }
 
 /* ============== Exception handling ============== */
 
-/* Simple exception handler stack */
-#define MAX_EXCEPTION_HANDLERS 256
-static void* exception_handlers[MAX_EXCEPTION_HANDLERS];
-static int exception_handler_count = 0;
-static void* current_exception = NULL;
+/*
+ * Compiled code arms each try itself with
+ *     code = _setjmp(__wasm_push_exception_handler(payload));
+ * where payload is a buffer in the catching frame.  A throw stores its values
+ * into __wasm_exception_payload() and calls __wasm_throw(), which resumes the
+ * innermost handler with code = tag + 1 (popping it).
+ */
 
-void __wasm_push_exception_handler(void* label) {
-    if (exception_handler_count >= MAX_EXCEPTION_HANDLERS) {
-        fprintf(stderr, "wasm trap: exception handler stack overflow\n");
-        exit(1);
+typedef struct ExceptionFrame {
+    jmp_buf env;  /* Must stay first */
+    struct ExceptionFrame* prev;
+    uint8_t* payload;
+} ExceptionFrame;
+
+static ExceptionFrame* exception_stack = NULL;
+static ExceptionFrame* exception_free = NULL;
+
+void* __wasm_push_exception_handler(void* payload) {
+    ExceptionFrame* frame = exception_free;
+    if (frame) {
+        exception_free = frame->prev;
+    } else {
+        frame = malloc(sizeof(ExceptionFrame));
+        if (!frame) {
+            trap(WASM_TRAP_OUT_OF_MEMORY);
+        }
     }
-    exception_handlers[exception_handler_count++] = label;
+    frame->prev = exception_stack;
+    frame->payload = payload;
+    exception_stack = frame;
+    return frame;
 }
 
 void __wasm_pop_exception_handler(void) {
-    if (exception_handler_count > 0) {
-        exception_handler_count--;
+    ExceptionFrame* frame = exception_stack;
+    if (frame) {
+        exception_stack = frame->prev;
+        frame->prev = exception_free;
+        exception_free = frame;
     }
 }
 
-void __wasm_throw(int32_t tag, void* values) {
-    (void)tag;
-    current_exception = values;
-    if (exception_handler_count > 0) {
-        /* In a real implementation, we'd longjmp to the handler */
-        fprintf(stderr, "wasm trap: unhandled exception (tag=%d)\n", tag);
-        exit(1);
+static ExceptionFrame* exception_target(int32_t tag) {
+    /* Handlers outside the current instance boundary never catch */
+    if (exception_stack == (trap_boundary ? trap_boundary->handlers : NULL)) {
+        if (!trap_boundary) {
+            fprintf(stderr, "wasm trap: unhandled exception (tag=%d)\n", tag);
+            exit(1);
+        }
+        trap(WASM_TRAP_UNCAUGHT_EXCEPTION);
     }
-    fprintf(stderr, "wasm trap: unhandled exception (tag=%d)\n", tag);
-    exit(1);
+    return exception_stack;
 }
 
-void __wasm_rethrow(void) {
-    fprintf(stderr, "wasm trap: rethrow with no exception\n");
-    exit(1);
+static void __attribute__((noreturn)) exception_deliver(ExceptionFrame* frame, int32_t tag) {
+    exception_stack = frame->prev;
+    frame->prev = exception_free;
+    exception_free = frame;
+    _longjmp(frame->env, tag + 1);
+}
+
+void* __wasm_exception_payload(int32_t tag) {
+    return exception_target(tag)->payload;
+}
+
+void __wasm_throw(int32_t tag) {
+    exception_deliver(exception_target(tag), tag);
 }
 
-void* __wasm_get_exception(void) {
-    return current_exception;
+void __wasm_rethrow(int32_t tag, void* payload, int64_t size) {
+    ExceptionFrame* frame = exception_target(tag);
+    if (size > 0 && payload != frame->payload) {
+        memmove(frame->payload, payload, (size_t)size);
+    }
+    exception_deliver(frame, tag);
 }
 
+/* exnref: a caught exception boxed as a value (never freed) */
+typedef struct {
+    int32_t tag;
+    int32_t size;
+    uint8_t payload[];
+} ExnRef;
+
+void* __wasm_exn_new(int32_t tag, void* payload, int64_t size) {
+    ExnRef* exn = malloc(sizeof(ExnRef) + (size_t)size);
+    if (!exn) {
+        trap(WASM_TRAP_OUT_OF_MEMORY);
+    }
+    exn->tag = tag;
+    exn->size = (int32_t)size;
+    if (payload && size > 0) {
+        memcpy(exn->payload, payload, (size_t)size);
+    }
+    return exn;
+}
+
+void* __wasm_exn_payload(void* exn) {
+    return ((ExnRef*)exn)->payload;
+}
+
+void __wasm_throw_ref(void* ref) {
+    ExnRef* exn = ref;
+    if (!exn) {
+        trap(WASM_TRAP_NULL_REFERENCE);
+    }
+    __wasm_rethrow(exn->tag, exn->payload, exn->size);
+}
+
+
 /* ============== GC operations ============== */
 
 /* Simple header for GC objects */
@@ -366,8 +614,7 @@ void* __wasm_struct_new(int32_t type_idx, int32_t num_fields) {
     size_t size = sizeof(GCHeader) + (size_t)num_fields * sizeof(int64_t);
     GCHeader* obj = calloc(1, size);
     if (!obj) {
-        fprintf(stderr, "wasm trap: out of memory\n");
-        exit(1);
+        trap(WASM_TRAP_OUT_OF_MEMORY);
     }
     obj->type_idx = type_idx;
     obj->length = num_fields;
@@ -382,8 +629,7 @@ void* __wasm_array_new(int32_t type_idx, int32_t init_value, int32_t length) {
     size_t size = sizeof(GCHeader) + (size_t)length * sizeof(int64_t);
     GCHeader* obj = malloc(size);
     if (!obj) {
-        fprintf(stderr, "wasm trap: out of memory\n");
-        exit(1);
+        trap(WASM_TRAP_OUT_OF_MEMORY);
     }
     obj->type_idx = type_idx;
     obj->length = length;
@@ -400,8 +646,7 @@ void* __wasm_array_new_default(int32_t type_idx, int32_t length) {
     size_t size = sizeof(GCHeader) + (size_t)length * sizeof(int64_t);
     GCHeader* obj = calloc(1, size);
     if (!obj) {
-        fprintf(stderr, "wasm trap: out of memory\n");
-        exit(1);
+        trap(WASM_TRAP_OUT_OF_MEMORY);
     }
     obj->type_idx = type_idx;
     obj->length = length;
@@ -445,8 +690,7 @@ void* __wasm_ref_cast(void* ref, int32_t type_idx) {
     }
     GCHeader* header = ((GCHeader*)ref) - 1;
     if (header->type_idx != type_idx) {
-        fprintf(stderr, "wasm trap: ref.cast failed\n");
-        exit(1);
+        trap(WASM_TRAP_CAST_FAILURE);
     }
     return ref;
 }
@@ -455,8 +699,7 @@ void* __wasm_ref_cast_null(void* ref, int32_t type_idx) {
     if (!ref) return NULL;
     GCHeader* header = ((GCHeader*)ref) - 1;
     if (header->type_idx != type_idx) {
-        fprintf(stderr, "wasm trap: ref.cast failed\n");
-        exit(1);
+        trap(WASM_TRAP_CAST_FAILURE);
     }
     return ref;
 }
@@ -477,7 +720,7 @@ void __wasm_init(int32_t initial_pages) {
 
     /* Initialize table (default size) */
     __wasm_table_size = 64;
-    __wasm_table = calloc(__wasm_table_size, sizeof(void*));
+    __wasm_table = calloc(__wasm_table_size, sizeof(WasmTableEntry));
 }
 
 void __wasm_fini(void) {
@@ -490,3 +733,152 @@ void __wasm_fini(void) {
     __wasm_table = NULL;
     __wasm_table_size = 0;
 }
+
+/* ============== Profile-guided optimization ============== */
+
+/*
+ * Counters of a module compiled with --instrument=pgo, written at exit to
+ * $WAQ_PROFILE_FILE or default.waqprof (see waq.compiler.profile).
+ */
+#define WASM_PROF_SITE_TARGETS 4
+#define WASM_PROF_SITE_SLOTS (2 * WASM_PROF_SITE_TARGETS + 1)
+
+static uint64_t *__wasm_prof_counters_at = NULL;
+static const char *__wasm_prof_names_at = NULL;
+
+/* Count a call through table index idx at an indirect call site.  The site
+ * holds (idx + 1, calls) pairs for the first four indices seen, then the
+ * calls to any other index. */
+void __wasm_prof_icall(uint64_t *site, uint32_t idx) {
+    uint64_t key = (uint64_t)idx + 1;
+    for (int i = 0; i < WASM_PROF_SITE_TARGETS; i++) {
+        if (site[2 * i] == key || site[2 * i] == 0) {
+            site[2 * i] = key;
+            site[2 * i + 1]++;
+            return;
+        }
+    }
+    site[2 * WASM_PROF_SITE_TARGETS]++;
+}
+
+static void __wasm_prof_write(void) {
+    const char *path = getenv("WAQ_PROFILE_FILE");
+    if (!path || !*path) {
+        path = "default.waqprof";
+    }
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "waq: cannot write profile %s\n", path);
+        return;
+    }
+    fprintf(out, "waqprof 1\n");
+    const uint64_t *counter = __wasm_prof_counters_at;
+    for (const char *line = __wasm_prof_names_at; *line; ) {
+        const char *end = strchr(line, '\n');
+        int len = (int)(end - line);
+        if (line[0] == 'i') {
+            for (int i = 0; i < WASM_PROF_SITE_TARGETS; i++) {
+                if (counter[2 * i]) {
+                    fprintf(out, "%.*s\t%llu\t%llu\n", len, line,
+                            (unsigned long long)(counter[2 * i] - 1),
+                            (unsigned long long)counter[2 * i + 1]);
+                }
+            }
+            counter += WASM_PROF_SITE_SLOTS;
+        } else {
+            fprintf(out, "%.*s\t%llu\n", len, line, (unsigned long long)*counter);
+            counter++;
+        }
+        line = end + 1;
+    }
+    fclose(out);
+}
+
+/* Called by __wasm_memory_init of an instrumented module */
+void __wasm_prof_register(uint64_t *counters, const char *names) {
+    if (!__wasm_prof_counters_at) {
+        atexit(__wasm_prof_write);
+    }
+    __wasm_prof_counters_at = counters;
+    __wasm_prof_names_at = names;
+}
+
+/* ============== Instance boundary ============== */
+
+/*
+ * __wasm_invoke(entry, arg) runs entry(arg) - a host thunk that calls one
+ * export - and returns WASM_TRAP_NONE or the code of the trap that ended it.
+ * SIGFPE/SIGSEGV/SIGBUS raised inside the boundary are reported as traps; an
+ * alternate signal stack makes stack overflow recoverable as well.  After a
+ * trap the instance state is whatever the export left behind, so reinstantiate:
+ *     __wasm_instance_reset(); __wasm_init(pages); __wasm_memory_init();
+ */
+
+#define SIGNAL_STACK_SIZE (64 * 1024)
+
+static __thread void* signal_stack = NULL;
+
+static void fault_handler(int sig, siginfo_t* info, void* uctx) {
+    (void)uctx;
+    if (!trap_boundary) {
+        signal(sig, SIG_DFL);  /* Not ours: refault with the default action */
+        return;
+    }
+    int32_t code = WASM_TRAP_MEMORY_FAULT;
+    if (sig == SIGFPE) {
+        code = info->si_code == FPE_INTOVF ? WASM_TRAP_INTEGER_OVERFLOW
+                                           : WASM_TRAP_DIV_BY_ZERO;
+    }
+    siglongjmp(trap_boundary->env, code);
+}
+
+static void install_fault_handlers(void) {
+    static int installed = 0;
+    if (!signal_stack) {
+        stack_t ss;
+        ss.ss_sp = malloc(SIGNAL_STACK_SIZE);
+        ss.ss_size = SIGNAL_STACK_SIZE;
+        ss.ss_flags = 0;
+        if (ss.ss_sp && sigaltstack(&ss, NULL) == 0) {
+            signal_stack = ss.ss_sp;
+        } else {
+            free(ss.ss_sp);
+        }
+    }
+    if (!installed) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = fault_handler;
+        sa.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_NODEFER;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGFPE, &sa, NULL);
+        sigaction(SIGSEGV, &sa, NULL);
+        sigaction(SIGBUS, &sa, NULL);
+        installed = 1;
+    }
+}
+
+int32_t __wasm_invoke(void (*entry)(void*), void* arg) {
+    TrapBoundary boundary;
+    install_fault_handlers();
+    boundary.prev = trap_boundary;
+    boundary.handlers = exception_stack;
+
+    /* Save the signal mask: a fault handler may be what unwinds here */
+    int32_t code = sigsetjmp(boundary.env, 1);
+    if (code == 0) {
+        trap_boundary = &boundary;
+        entry(arg);
+    } else {
+        /* Drop handlers of try blocks the trap unwound through */
+        while (exception_stack != boundary.handlers) {
+            __wasm_pop_exception_handler();
+        }
+    }
+    trap_boundary = boundary.prev;
+    return code;
+}
+
+void __wasm_instance_reset(void) {
+    __wasm_fini();
+}
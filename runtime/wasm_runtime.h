@@ -23,8 +23,15 @@
 extern uint8_t* __wasm_memory;
 extern uint32_t __wasm_memory_size;  /* in bytes */
 
-/* Table exports */
-extern void** __wasm_table;
+/* Table exports.  A slot pairs the code pointer with the canonical
+ * signature id of its function type, which call_indirect checks inline;
+ * null slots have id 0. */
+typedef struct {
+    void* code;
+    uint32_t sig;
+} WasmTableEntry;
+
+extern WasmTableEntry* __wasm_table;
 extern uint32_t __wasm_table_size;
 
 /* ============== Integer intrinsics ============== */
@@ -87,14 +94,14 @@ void __wasm_memory_fill(int32_t dest, int32_t val, int32_t len);
 
 /* ============== Table operations ============== */
 
-void* __wasm_table_get(int32_t idx);
-void __wasm_table_set(int32_t idx, void* val);
+void* __wasm_table_get(int32_t table, int32_t idx);
+void __wasm_table_set(int32_t table, int32_t idx, void* val, uint32_t sig);
 void __wasm_table_init(int32_t table, int32_t elem, int32_t dest, int32_t src, int32_t len);
 void __wasm_elem_drop(int32_t elem);
 void __wasm_table_copy(int32_t dest_table, int32_t src_table, int32_t dest, int32_t src, int32_t len);
-int32_t __wasm_table_grow(int32_t table, void* val, int32_t delta);
+int32_t __wasm_table_grow(int32_t table, void* val, uint32_t sig, int32_t delta);
 int32_t __wasm_table_size_op(int32_t table);
-void __wasm_table_fill(int32_t table, int32_t dest, void* val, int32_t len);
+void __wasm_table_fill(int32_t table, int32_t dest, void* val, uint32_t sig, int32_t len);
 
 /* ============== Traps ============== */
 
@@ -104,14 +111,51 @@ void __wasm_trap_integer_overflow(void) __attribute__((noreturn));
 void __wasm_trap_invalid_conversion(void) __attribute__((noreturn));
 void __wasm_trap_out_of_bounds(void) __attribute__((noreturn));
 void __wasm_trap_null_reference(void) __attribute__((noreturn));
+void __wasm_trap_undefined_element(void) __attribute__((noreturn));
+void __wasm_trap_indirect_call(uint32_t sig) __attribute__((noreturn));
+
+/* ============== Profile-guided optimization ============== */
+
+void __wasm_prof_register(uint64_t* counters, const char* names);
+void __wasm_prof_icall(uint64_t* site, uint32_t idx);
+
+/* ============== Instance boundary ============== */
+
+/* Trap codes returned by __wasm_invoke() */
+enum {
+    WASM_TRAP_NONE = 0,
+    WASM_TRAP_UNREACHABLE,
+    WASM_TRAP_DIV_BY_ZERO,
+    WASM_TRAP_INTEGER_OVERFLOW,
+    WASM_TRAP_INVALID_CONVERSION,
+    WASM_TRAP_OUT_OF_BOUNDS,
+    WASM_TRAP_NULL_REFERENCE,
+    WASM_TRAP_CAST_FAILURE,
+    WASM_TRAP_UNCAUGHT_EXCEPTION,
+    WASM_TRAP_OUT_OF_MEMORY,
+    WASM_TRAP_MEMORY_FAULT,  /* SIGSEGV/SIGBUS, e.g. stack overflow */
+    WASM_TRAP_UNDEFINED_ELEMENT,
+    WASM_TRAP_UNINITIALIZED_ELEMENT,
+    WASM_TRAP_INDIRECT_CALL_MISMATCH,
+    WASM_TRAP_COUNT
+};
+
+/* Run entry(arg); traps inside it return their code instead of exiting */
+int32_t __wasm_invoke(void (*entry)(void* arg), void* arg);
+const char* __wasm_trap_message(int32_t code);
+/* Release instance state after a trap (then __wasm_init + __wasm_memory_init) */
+void __wasm_instance_reset(void);
 
 /* ============== Exception handling ============== */
 
-void __wasm_push_exception_handler(void* label);
+void* __wasm_push_exception_handler(void* payload);
 void __wasm_pop_exception_handler(void);
-void __wasm_throw(int32_t tag, void* values) __attribute__((noreturn));
-void __wasm_rethrow(void) __attribute__((noreturn));
-void* __wasm_get_exception(void);
+void* __wasm_exception_payload(int32_t tag);
+void __wasm_throw(int32_t tag) __attribute__((noreturn));
+void __wasm_rethrow(int32_t tag, void* payload, int64_t size) __attribute__((noreturn));
+void* __wasm_exn_new(int32_t tag, void* payload, int64_t size);
+void* __wasm_exn_payload(void* exn);
+void __wasm_throw_ref(void* exn) __attribute__((noreturn));
 
 /* ============== GC operations ============== */
 
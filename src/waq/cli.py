@@ -7,12 +7,27 @@ import platform
 import subprocess
 import sys
 import tempfile
+import warnings
 from pathlib import Path
 
 from waq.compiler import compile_module
-from waq.errors import CompileError, ParseError, ValidationError
+from waq.compiler.baseline import compile_baseline
+from waq.compiler.llvm import TRIPLES, emit_llvm
+from waq.compiler.passes import OPT_LEVELS
+from waq.compiler.profile import load_profile
+from waq.errors import (
+    CompileError,
+    CompileWarning,
+    ParseError,
+    ProfileError,
+    ValidationError,
+)
 from waq.parser.module import parse_module
-from waq.runtime import RUNTIME_C_SOURCE
+from waq.runtime.library import runtime_library
+
+# --cpu models: the runtime is either portable (helpers pick CPU-specific
+# variants at load time) or compiled for the build machine
+CPU_MODELS = ("baseline", "native")
 
 
 def detect_target() -> str:
@@ -39,7 +54,7 @@ def main(argv: list[str] | None = None) -> int:
     """Main entry point for the CLI."""
     parser = argparse.ArgumentParser(
         prog="waq",
-        description="Compile WebAssembly to native code via QBE",
+        description="Compile WebAssembly to native code via QBE or LLVM",
     )
 
     parser.add_argument(
@@ -66,11 +81,70 @@ def main(argv: list[str] | None = None) -> int:
 
     parser.add_argument(
         "--emit",
-        choices=["qbe", "asm", "obj", "exe"],
+        choices=["qbe", "llvm", "asm", "obj", "exe"],
         default="qbe",
         help="Output format (default: qbe)",
     )
 
+    parser.add_argument(
+        "--backend",
+        choices=["qbe", "llvm", "baseline"],
+        default="qbe",
+        help="Code generator for asm, obj and exe output: qbe, llvm to "
+        "compile through clang -O3, which needs clang 15 or newer, or "
+        "baseline for fast single-pass unoptimized x86-64 obj and exe "
+        "output (default: qbe)",
+    )
+
+    parser.add_argument(
+        "-O",
+        dest="opt_level",
+        type=int,
+        choices=OPT_LEVELS,
+        default=1,
+        help="Optimization level: 0 (none), 1 (cleanups), 2 (all) (default: 1)",
+    )
+
+    parser.add_argument(
+        "--lto",
+        action="store_true",
+        help="Inline hot runtime helpers (table.get, i31, saturating "
+        "truncation) into the compiled code; needs -O1 or higher, and the "
+        "output only links against this version's runtime",
+    )
+
+    parser.add_argument(
+        "--instrument",
+        choices=["pgo"],
+        help="Add profile counters; the program writes them at exit to "
+        "$WAQ_PROFILE_FILE or default.waqprof, for --profile-use",
+    )
+
+    parser.add_argument(
+        "--profile-use",
+        type=Path,
+        action="append",
+        metavar="PROFILE",
+        help="Optimize with the counts in a .waqprof file from an "
+        "--instrument=pgo build; repeat to add up several runs",
+    )
+
+    parser.add_argument(
+        "--deterministic",
+        action="store_true",
+        help="Make float results bit-identical across targets: canonical NaNs "
+        "and the deterministic results of relaxed SIMD",
+    )
+
+    parser.add_argument(
+        "--cpu",
+        "-mcpu",
+        choices=CPU_MODELS,
+        default="baseline",
+        help="CPU the exe runtime is compiled for: baseline runs anywhere, "
+        "native uses every feature of this machine (default: baseline)",
+    )
+
     parser.add_argument(
         "--entry",
         default="main",
@@ -98,9 +172,24 @@ def main(argv: list[str] | None = None) -> int:
 
     args = parser.parse_args(argv)
 
+    # The runtime helpers are inlined by an -O1 pass
+    if args.lto and args.opt_level == 0:
+        parser.error("--lto needs -O1 or higher")
+
+    # The baseline backend writes ELF objects for amd64_sysv and nothing else
+    use_baseline = args.backend == "baseline" and args.emit in ("asm", "obj", "exe")
+    if use_baseline and args.emit == "asm":
+        parser.error("--backend=baseline writes obj and exe output only")
+    if use_baseline and args.target != "amd64_sysv":
+        parser.error("--backend=baseline only supports the amd64_sysv target")
+    if use_baseline and (args.lto or args.instrument or args.profile_use):
+        parser.error("--backend=baseline doesn't support --lto or PGO")
+    if use_baseline and args.deterministic:
+        parser.error("--backend=baseline doesn't support --deterministic")
+
     # Determine output file with appropriate extension
     if args.output is None:
-        ext_map = {"qbe": ".ssa", "asm": ".s", "obj": ".o", "exe": ""}
+        ext_map = {"qbe": ".ssa", "llvm": ".ll", "asm": ".s", "obj": ".o", "exe": ""}
         args.output = args.input.with_suffix(ext_map[args.emit])
 
     try:
@@ -125,18 +214,80 @@ def main(argv: list[str] | None = None) -> int:
             print(f"  Functions: {len(wasm_module.func_types)}")
             print(f"  Exports: {len(wasm_module.exports)}")
 
+        profile = None
+        if args.profile_use:
+            if args.verbose:
+                print(f"Reading profile {', '.join(map(str, args.profile_use))}")
+            profile = load_profile(args.profile_use)
+
         # Compile
-        if args.verbose:
-            print("Compiling to QBE IL")
-        qbe_module = compile_module(wasm_module, target=args.target)
+        if use_baseline:
+            if args.verbose:
+                print("Compiling to x86-64 machine code")
+            obj_bytes = compile_baseline(wasm_module)
+        else:
+            if args.verbose:
+                print("Compiling to QBE IL")
+            with warnings.catch_warnings(record=True) as caught:
+                warnings.simplefilter("always", CompileWarning)
+                qbe_module = compile_module(
+                    wasm_module,
+                    target=args.target,
+                    opt_level=args.opt_level,
+                    lto=args.lto,
+                    instrument=args.instrument == "pgo",
+                    profile=profile,
+                    deterministic=args.deterministic,
+                )
+            for warning in caught:
+                print(f"Warning: {warning.message}", file=sys.stderr)
 
         # Write output
         if args.verbose:
             print(f"Writing {args.output}")
 
-        if args.emit == "qbe":
+        if use_baseline:
+            if args.emit == "obj":
+                args.output.write_bytes(obj_bytes)
+            else:
+                link_executable(
+                    obj_bytes,
+                    args.output,
+                    args.entry,
+                    args.target,
+                    args.verbose,
+                    print_result=not args.no_print,
+                    cpu=args.cpu,
+                )
+        elif args.emit == "qbe":
             output_text = qbe_module.emit()
             args.output.write_text(output_text)
+        elif args.emit == "llvm":
+            args.output.write_text(emit_llvm(qbe_module, args.target))
+        elif args.backend == "llvm":
+            if args.verbose:
+                print("Lowering to LLVM IR")
+            llvm_ir = emit_llvm(qbe_module, args.target)
+            cflags = runtime_cflags(args.target, args.cpu)
+            if args.emit == "asm":
+                asm_code = run_clang(
+                    llvm_ir, args.target, args.verbose, assemble=False, cflags=cflags
+                )
+                args.output.write_bytes(asm_code)
+            else:
+                obj_bytes = run_clang(llvm_ir, args.target, args.verbose, cflags=cflags)
+                if args.emit == "obj":
+                    args.output.write_bytes(obj_bytes)
+                else:
+                    link_executable(
+                        obj_bytes,
+                        args.output,
+                        args.entry,
+                        args.target,
+                        args.verbose,
+                        print_result=not args.no_print,
+                        cpu=args.cpu,
+                    )
         elif args.emit == "asm":
             qbe_il = qbe_module.emit()
             asm_code = run_qbe(qbe_il, args.target, args.verbose)
@@ -157,6 +308,7 @@ def main(argv: list[str] | None = None) -> int:
                 args.target,
                 args.verbose,
                 print_result=not args.no_print,
+                cpu=args.cpu,
             )
 
         if args.verbose:
@@ -173,6 +325,9 @@ def main(argv: list[str] | None = None) -> int:
     except CompileError as e:
         print(f"Compile error: {e}", file=sys.stderr)
         return 1
+    except ProfileError as e:
+        print(f"Profile error: {e}", file=sys.stderr)
+        return 1
     except FileNotFoundError as e:
         print(f"File not found: {e}", file=sys.stderr)
         return 1
@@ -214,6 +369,54 @@ def run_qbe(qbe_il: str, target: str, verbose: bool = False) -> str:
         ) from e
 
 
+def run_clang(
+    llvm_ir: str,
+    target: str,
+    verbose: bool = False,
+    *,
+    assemble: bool = True,
+    cflags: list[str] | None = None,
+) -> bytes:
+    """Compile LLVM IR with ``clang -O3`` to an object file, or to assembly.
+
+    ``cflags`` are the ``--cpu`` flags from ``runtime_cflags``, so a native
+    build tunes the module's code as well as the runtime's.
+    Uses TemporaryDirectory for reliable cleanup even on process termination.
+    """
+    try:
+        with tempfile.TemporaryDirectory(prefix="waq_") as tmpdir:
+            temp_ll_path = Path(tmpdir) / "input.ll"
+            temp_out_path = Path(tmpdir) / ("output.o" if assemble else "output.s")
+            temp_ll_path.write_text(llvm_ir, encoding="utf-8")
+
+            if verbose:
+                print(f"Running clang -O3 for {TRIPLES[target]}")
+
+            cmd = [
+                "clang",
+                "-O3",
+                "-fPIC",
+                "-target",
+                TRIPLES[target],
+                *(cflags or []),
+                "-c" if assemble else "-S",
+                "-x",
+                "ir",
+                str(temp_ll_path),
+                "-o",
+                str(temp_out_path),
+            ]
+            subprocess.run(cmd, capture_output=True, text=True, check=True)
+            return temp_out_path.read_bytes()
+
+    except subprocess.CalledProcessError as e:
+        raise RuntimeError(f"clang compilation failed: {e.stderr}") from e
+    except FileNotFoundError as e:
+        raise RuntimeError(
+            "clang not found. The LLVM backend needs clang 15 or newer in your PATH."
+        ) from e
+
+
 def run_assembler(asm_code: str, target: str, verbose: bool = False) -> bytes:
     """Run the assembler to convert assembly to object file.
 
@@ -304,6 +507,26 @@ int main(void) {{
 """
 
 
+def runtime_cflags(target: str, cpu: str) -> list[str]:
+    """C compiler flags that build the runtime for ``cpu`` on ``target``.
+
+    ``baseline`` needs none: on x86-64 the runtime binds POPCNT, LZCNT, TZCNT
+    and SSE4.1 helper variants through ifunc resolvers at load time.
+    ``native`` lets the C compiler use everything the build machine has, so
+    the executable may not run on older CPUs.  QBE output is unaffected
+    either way, since QBE only emits baseline instructions; with
+    ``--backend=llvm`` clang gets the same flags for the module's code.
+    """
+    if cpu == "baseline":
+        return []
+    if target.startswith("arm64"):
+        return ["-mcpu=native"]
+    if target.startswith("amd64"):
+        return ["-march=native"]
+    # RISC-V compilers have no portable native detection; stay on baseline
+    return []
+
+
 def link_executable(
     obj_bytes: bytes,
     output_path: Path,
@@ -312,9 +535,12 @@ def link_executable(
     verbose: bool = False,
     *,
     print_result: bool = True,
+    cpu: str = "baseline",
 ) -> None:
     """Link object file with runtime to create executable.
 
+    The runtime comes from the cached ``libwaq_rt.a`` (see
+    ``waq.runtime.library``), built on first use for this compiler and CPU.
     Uses TemporaryDirectory for reliable cleanup even on process termination.
     """
     try:
@@ -333,7 +559,12 @@ def link_executable(
             if verbose:
                 print(f"Linking executable with entry function: {entry_function}")
 
-            # Compile and link everything together
+            # Link against the prebuilt runtime; the linker drops the
+            # runtime functions the module never calls
+            cc = "clang" if "apple" in target else "gcc"
+            runtime_lib = runtime_library(
+                cc, runtime_cflags(target, cpu), verbose=verbose
+            )
             if "apple" in target:
                 cmd = [
                     "clang",
@@ -341,8 +572,9 @@ def link_executable(
                     str(output_path),
                     str(temp_obj_path),
                     str(temp_main_path),
-                    str(RUNTIME_C_SOURCE),
+                    str(runtime_lib),
                     "-lm",  # Link math library
+                    "-Wl,-dead_strip",
                 ]
             else:
                 cmd = [
@@ -351,8 +583,9 @@ def link_executable(
                     str(output_path),
                     str(temp_obj_path),
                     str(temp_main_path),
-                    str(RUNTIME_C_SOURCE),
+                    str(runtime_lib),
                     "-lm",
+                    "-Wl,--gc-sections",
                 ]
 
             subprocess.run(cmd, capture_output=True, text=True, check=True)
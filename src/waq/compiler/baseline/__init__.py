@@ -0,0 +1,7 @@
+"""Baseline backend: WASM straight to an x86-64 object, in one pass."""
+
+from __future__ import annotations
+
+from .codegen import compile_baseline
+
+__all__ = ["compile_baseline"]
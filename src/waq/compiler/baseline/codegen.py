@@ -0,0 +1,1890 @@
+"""Single-pass compiler from WASM bytecode to x86-64 machine code.
+
+The baseline backend skips the IL, QBE and the assembler: it walks each
+function body once, writing the machine code for every instruction as it
+reads it, and packs the result into an ELF object (``elf.py``).  There is no
+IR and no optimization beyond keeping the top of the value stack in
+registers:
+
+* Each value stack entry is a constant, a register, or in memory: in its
+  home, the frame slot that stack position ``i`` owns, or still in the slot
+  of the local it was read from.  ``local.get`` emits nothing, and
+  ``local.set``/``local.tee`` first send home the entries reading the local
+  they change.  Operations take operands wherever they are and leave their
+  result in a register; when registers run out, the deepest register entry
+  goes home.
+* At block boundaries every register entry and local read goes home, so all
+  the paths into a label agree on where values are: a branch stores the
+  values it carries into the homes of the target's stack positions.
+* Calls send every register entry home as well, since the allocatable
+  registers are all caller-saved, then load the arguments per System V.
+
+An i32 in a register always has its upper 32 bits clear, as every 32-bit
+x86 instruction leaves them, so it doubles as a 64-bit memory offset.
+
+The output follows the QBE backend's conventions (symbol names, out-pointers
+for extra results, globals, data segments, table entries and
+``__wasm_memory_init``), so it links against the same runtime and main stub.
+Integer division tests its divisor and calls ``__wasm_trap_div_by_zero``
+(and ``__wasm_trap_integer_overflow`` for the most negative number divided
+by -1) where the QBE backend leaves it to the hardware; like the QBE
+backend, the non-saturating float to int conversions don't check their
+range.
+"""
+
+from __future__ import annotations
+
+import functools
+import struct
+
+from waq.errors import CompileError, ParseError
+from waq.parser.binary import BinaryReader
+from waq.parser.code import skip_unreachable
+from waq.parser.module import ExportKind, ImportKind, WasmModule
+from waq.parser.types import FuncType, ValueType
+
+from ..codegen import eval_init_expr
+from ..context import ModuleContext
+from . import elf
+from .x86 import (
+    ADD,
+    AND,
+    CC_A,
+    CC_AE,
+    CC_B,
+    CC_BE,
+    CC_E,
+    CC_G,
+    CC_GE,
+    CC_L,
+    CC_LE,
+    CC_NE,
+    CC_NP,
+    CC_O,
+    CC_P,
+    CC_S,
+    CMP,
+    OR,
+    R8,
+    R9,
+    R10,
+    R11,
+    R12,
+    R13,
+    R14,
+    RAX,
+    RBP,
+    RBX,
+    RCX,
+    RDI,
+    RDX,
+    RSI,
+    ROL,
+    ROR,
+    RSP,
+    SAR,
+    SHL,
+    SHR,
+    SUB,
+    XOR,
+    Assembler,
+    Label,
+    Mem,
+    fits_i32,
+)
+
+# Value classes: integers in general-purpose registers, floats in SSE ones.
+# References are pointers, so they are I64.
+I32, I64, F32, F64 = 0, 1, 2, 3
+_SIZES = (4, 8, 4, 8)
+# Mandatory prefix of the scalar SSE instructions, by class
+_SSE = (0, 0, 0xF3, 0xF2)
+
+_CLASSES = {
+    ValueType.I32: I32,
+    ValueType.I64: I64,
+    ValueType.F32: F32,
+    ValueType.F64: F64,
+    ValueType.FUNCREF: I64,
+    ValueType.EXTERNREF: I64,
+}
+
+# Where a value stack entry is: (class, kind, register / constant bits /
+# stack position).  A MEM entry's position is its own, or that of a local
+# read in place: negative, so that ``home`` finds the local's slot.
+REG, CONST, MEM = 0, 1, 2
+
+# Allocatable registers, allocated from the end; R11 and XMM15 are scratch
+_GPRS = (R10, R9, R8, RDI, RSI, RDX, RCX, RAX)
+_XMMS = tuple(range(14, -1, -1))
+XMM0, XMM15 = 0, 15
+_INT_ARGS = (RDI, RSI, RDX, RCX, R8, R9)
+
+# The linear memory's base address, loaded for every access
+_MEMORY_BASE = Mem(symbol="__wasm_memory")
+
+# Control frame kinds
+_BLOCK, _LOOP, _IF, _FUNCTION = range(4)
+
+# Integer comparisons 0x46-0x4F and 0x51-0x5A: eq ne lt_s lt_u gt_s gt_u
+# le_s le_u ge_s ge_u
+_INT_CONDITIONS = (CC_E, CC_NE, CC_L, CC_B, CC_G, CC_A, CC_LE, CC_BE, CC_GE, CC_AE)
+
+# Loads 0x28-0x35: (class, bytes, sign-extended)
+_LOADS = (
+    (I32, 4, False),
+    (I64, 8, False),
+    (F32, 4, False),
+    (F64, 8, False),
+    (I32, 1, True),
+    (I32, 1, False),
+    (I32, 2, True),
+    (I32, 2, False),
+    (I64, 1, True),
+    (I64, 1, False),
+    (I64, 2, True),
+    (I64, 2, False),
+    (I64, 4, True),
+    (I64, 4, False),
+)
+
+# Stores 0x36-0x3E: (class, bytes)
+_STORES = (
+    (I32, 4),
+    (I64, 8),
+    (F32, 4),
+    (F64, 8),
+    (I32, 1),
+    (I32, 2),
+    (I64, 1),
+    (I64, 2),
+    (I64, 4),
+)
+
+# 0xFC 0-7: saturating truncations, done by the runtime
+_TRUNC_SAT = (
+    (F32, I32, "__wasm_i32_trunc_sat_f32_s"),
+    (F32, I32, "__wasm_i32_trunc_sat_f32_u"),
+    (F64, I32, "__wasm_i32_trunc_sat_f64_s"),
+    (F64, I32, "__wasm_i32_trunc_sat_f64_u"),
+    (F32, I64, "__wasm_i64_trunc_sat_f32_s"),
+    (F32, I64, "__wasm_i64_trunc_sat_f32_u"),
+    (F64, I64, "__wasm_i64_trunc_sat_f64_s"),
+    (F64, I64, "__wasm_i64_trunc_sat_f64_u"),
+)
+
+# Constant expression operators: opcode -> (class, ALU operation or None
+# for multiplication)
+_CONST_EXPR_OPS = {
+    0x6A: (I32, ADD),
+    0x6B: (I32, SUB),
+    0x6C: (I32, None),
+    0x7C: (I64, ADD),
+    0x7D: (I64, SUB),
+    0x7E: (I64, None),
+}
+
+
+def _signed(bits: int, cls: int) -> int:
+    """Constant ``bits`` of class ``cls`` as a signed integer."""
+    if _SIZES[cls] == 4:
+        return bits - (1 << 32) if bits >= 1 << 31 else bits
+    return bits - (1 << 64) if bits >= 1 << 63 else bits
+
+
+@functools.cache
+def _frame_slot(slot: int) -> Mem:
+    """Frame slot ``slot``, below RBP; shared, as its encoding is cached."""
+    return Mem(RBP, -8 * (slot + 1))
+
+
+@functools.lru_cache(maxsize=4096)
+def _memory_operand(offset: int, index: int) -> Mem:
+    """``[R11 + index + offset]``: linear memory at R11, address in ``index``."""
+    return Mem(R11, offset, index=index)
+
+
+def _value_class(vtype: ValueType) -> int:
+    if vtype not in _CLASSES:
+        raise CompileError(f"{vtype.name.lower()} values are not supported")
+    return _CLASSES[vtype]
+
+
+class _Block:
+    """A control frame."""
+
+    __slots__ = ("else_label", "height", "kind", "label", "params", "results", "used")
+
+    def __init__(
+        self,
+        kind: int,
+        height: int,
+        params: tuple[int, ...],
+        results: tuple[int, ...],
+    ) -> None:
+        self.kind = kind
+        self.height = height  # Stack height below the parameters
+        self.params = params
+        self.results = results
+        self.label = Label()  # Branch target: loop header or block end
+        self.else_label: Label | None = None
+        self.used = False  # Whether any branch targets the label
+
+    @property
+    def arity(self) -> tuple[int, ...]:
+        """Classes of the values a branch to this frame carries."""
+        return self.params if self.kind == _LOOP else self.results
+
+
+class ModuleCompiler:
+    """Compiles a module into the contents of an ELF object."""
+
+    def __init__(self, module: WasmModule) -> None:
+        self.module = module
+        self.mod_ctx = ModuleContext(module=module)
+        self.asm = Assembler()
+        self.obj = elf.ObjectFile()
+        self.num_imports = module.num_imported_funcs()
+        # Type index of each function, imported and defined
+        self.func_types = [
+            imp.desc for imp in module.imports if imp.kind == ImportKind.FUNC
+        ] + list(module.func_types)
+        self.global_classes = [
+            _value_class(glob.value_type) for glob in module.all_global_types()
+        ]
+        self.global_names = [
+            self.mod_ctx.get_global_name(idx) for idx in range(len(self.global_classes))
+        ]
+        # Offset of each defined function in .text, and the direct calls to
+        # patch with them: (rel32 field offset, callee)
+        self.func_offsets: dict[int, int] = {}
+        self.call_fixups: list[tuple[int, int]] = []
+
+    def compile(self) -> bytes:
+        self._check_module()
+        exported = {
+            exp.index for exp in self.module.exports if exp.kind == ExportKind.FUNC
+        }
+        for i, body in enumerate(self.module.code):
+            func_idx = self.num_imports + i
+            self.asm.align(16)
+            start = len(self.asm.code)
+            self.func_offsets[func_idx] = start
+            name = self.mod_ctx.get_func_name(func_idx)
+            try:
+                _FunctionCompiler(
+                    self, func_idx, body.all_locals(), body.code
+                ).compile()
+            except CompileError as e:
+                if e.func_idx is not None:
+                    raise
+                raise CompileError(
+                    str(e), func_idx=func_idx, func_name=name
+                ) from e
+            self.obj.define(
+                elf.Symbol(
+                    name,
+                    elf.TEXT,
+                    start,
+                    len(self.asm.code) - start,
+                    is_global=func_idx in exported,
+                    is_function=True,
+                )
+            )
+        self._compile_globals()
+        self._compile_data_segments()
+        self._compile_memory_init()
+
+        code = self.asm.code
+        for field_offset, callee in self.call_fixups:
+            target = self.func_offsets[callee]
+            self.asm.patch_i32(field_offset, target - field_offset - 4)
+        self.obj.text = code
+        self.obj.text_relocations = self.asm.relocations
+        return self.obj.to_bytes()
+
+    def _check_module(self) -> None:
+        """Reject the module features the baseline backend has no code for."""
+        module = self.module
+        memories = module.num_imported_memories() + len(module.memories)
+        if memories > 1:
+            raise CompileError("multiple memories are not supported")
+        if any(memory.is_memory64 for memory in module.memories):
+            raise CompileError("64-bit memories are not supported")
+        if any(seg.table_idx > 0 for seg in module.elements):
+            raise CompileError("element segments for tables other than 0")
+
+    def func_type(self, func_idx: int) -> FuncType:
+        type_def = self.module.types[self.func_types[func_idx]]
+        assert isinstance(type_def, FuncType)
+        return type_def
+
+    def block_type(self, block_type: object) -> tuple[tuple[int, ...], tuple[int, ...]]:
+        """(params, results) classes of a block type."""
+        if block_type is None:
+            return (), ()
+        if isinstance(block_type, ValueType):
+            return (), (_value_class(block_type),)
+        func_type = self.module.types[block_type]
+        assert isinstance(func_type, FuncType)
+        return (
+            tuple(_value_class(t) for t in func_type.params),
+            tuple(_value_class(t) for t in func_type.results),
+        )
+
+    def _compile_globals(self) -> None:
+        """Global data with the initial values known at compile time."""
+        data = self.obj.data
+        evaluated: dict[int, int | float | None] = {}
+        num_imports = self.module.num_imported_globals()
+        for i, glob in enumerate(self.module.globals):
+            global_idx = num_imports + i
+            value = eval_init_expr(glob.init_expr, self.mod_ctx, evaluated)
+            evaluated[global_idx] = value
+            data += b"\0" * (-len(data) % 8)
+            self.obj.define(
+                elf.Symbol(
+                    self.global_names[global_idx],
+                    elf.DATA,
+                    len(data),
+                    _SIZES[self.global_classes[global_idx]],
+                )
+            )
+            data += _global_bits(self.global_classes[global_idx], value)
+
+    def _compile_data_segments(self) -> None:
+        for i, segment in enumerate(self.module.data):
+            if segment.memory_idx == -1:
+                continue  # Passive: only memory.init reads it
+            self.obj.define(
+                elf.Symbol(
+                    f"__wasm_data_{i}",
+                    elf.RODATA,
+                    len(self.obj.rodata),
+                    len(segment.data),
+                )
+            )
+            self.obj.rodata += segment.data
+
+    def _compile_memory_init(self) -> None:
+        """``__wasm_memory_init``: globals, memory, data, table, start.
+
+        The same steps as the QBE backend's; element segments are static
+        arrays of (code, signature) pairs that a loop hands to the runtime.
+        """
+        asm, module, mod_ctx = self.asm, self.module, self.mod_ctx
+        asm.align(16)
+        start = len(asm.code)
+        asm.push(RBP)
+        asm.mov(RBP, RSP)
+        for reg in (RBX, R12, R13, R14):
+            asm.push(reg)
+
+        # Running the initializer again after __wasm_instance_reset() must
+        # yield a fresh instance, so mutable globals are restored as well
+        evaluated: dict[int, int | float | None] = {}
+        num_imports = module.num_imported_globals()
+        for i, glob in enumerate(module.globals):
+            global_idx = num_imports + i
+            value = eval_init_expr(glob.init_expr, mod_ctx, evaluated)
+            evaluated[global_idx] = value
+            cls = self.global_classes[global_idx]
+            target = Mem(symbol=self.global_names[global_idx])
+            if glob.type.value_type.is_reference():
+                continue
+            if value is None:
+                self._emit_init_expr(glob.init_expr)
+                asm.store(target, RAX, _SIZES[cls])
+            elif glob.type.mutable:
+                bits = int.from_bytes(_global_bits(cls, value), "little")
+                asm.mov_imm(RAX, bits)
+                asm.store(target, RAX, _SIZES[cls])
+
+        if module.memories and module.memories[0].limits.min > 0:
+            asm.mov_imm(RDI, module.memories[0].limits.min, 4)
+            asm.call_symbol("__wasm_memory_grow")
+
+        for i, segment in enumerate(module.data):
+            if segment.memory_idx == -1 or not segment.data:
+                continue
+            self._emit_offset(segment.offset_expr, RAX)
+            asm.load(RDI, Mem(symbol="__wasm_memory"))
+            asm.alu(ADD, RDI, RAX)
+            asm.lea(RSI, Mem(symbol=f"__wasm_data_{i}"))
+            asm.mov_imm(RDX, len(segment.data))
+            asm.call_symbol("memcpy")
+
+        if module.tables and module.tables[0].limits.min > 0:
+            asm.mov_imm(RDI, 0, 4)
+            asm.mov_imm(RSI, 0)
+            asm.mov_imm(RDX, 0, 4)
+            asm.mov_imm(RCX, module.tables[0].limits.min, 4)
+            asm.call_symbol("__wasm_table_grow")
+
+        for k, segment in enumerate(module.elements):
+            if segment.table_idx < 0 or not segment.func_indices:
+                continue  # Passive segments only reach the table via table.init
+            self._compile_element_array(k, segment.func_indices)
+            self._emit_offset(segment.offset_expr, R14)
+            asm.lea(R12, Mem(symbol=f"__wasm_elem_{k}"))
+            asm.mov_imm(R13, len(segment.func_indices), 4)
+            asm.mov_imm(RBX, 0, 4)
+            loop = Label()
+            asm.bind(loop)
+            asm.mov_imm(RDI, segment.table_idx, 4)
+            asm.lea(RSI, Mem(R14, index=RBX))
+            asm.load(RDX, Mem(R12))
+            asm.load(RCX, Mem(R12, 8), 4)
+            asm.call_symbol("__wasm_table_set")
+            asm.alu_imm(ADD, R12, 16)
+            asm.alu_imm(ADD, RBX, 1, 4)
+            asm.alu(CMP, RBX, R13, 4)
+            asm.jcc(CC_B, loop)
+
+        if module.start is not None:
+            self.emit_direct_call(module.start)
+
+        for reg in (R14, R13, R12, RBX, RBP):
+            asm.pop(reg)
+        asm.ret()
+        self.obj.define(
+            elf.Symbol(
+                "__wasm_memory_init",
+                elf.TEXT,
+                start,
+                len(asm.code) - start,
+                is_global=True,
+                is_function=True,
+            )
+        )
+
+    def _compile_element_array(self, k: int, func_indices: list[int]) -> None:
+        """``__wasm_elem_k``: the segment's (code, signature) pairs."""
+        data = self.obj.data
+        data += b"\0" * (-len(data) % 8)
+        self.obj.define(
+            elf.Symbol(f"__wasm_elem_{k}", elf.DATA, len(data), 16 * len(func_indices))
+        )
+        for func_idx in func_indices:
+            self.obj.data_relocations.append(
+                (len(data), self.mod_ctx.get_func_name(func_idx), 1, 0)
+            )
+            sig = self.mod_ctx.signature_id(self.func_types[func_idx])
+            data += struct.pack("<QII", 0, sig, 0)
+
+    def _emit_offset(self, expr: bytes, reg: int) -> None:
+        """Put a segment offset, zero-extended, in ``reg``."""
+        offset = eval_init_expr(expr, self.mod_ctx)
+        if offset is None:
+            self._emit_init_expr(expr)
+            self.asm.mov(reg, RAX, 4)
+        else:
+            self.asm.mov_imm(reg, int(offset) & 0xFFFFFFFF, 4)
+
+    def _emit_init_expr(self, expr: bytes) -> None:
+        """Compute a constant expression into RAX, on the machine stack.
+
+        For the expressions ``eval_init_expr`` can't evaluate, which read
+        imported globals.  Floats are handled as their bits.
+        """
+        asm = self.asm
+        reader = BinaryReader(expr)
+        while not reader.at_end:
+            opcode = reader.read_byte()
+            if opcode == 0x0B:  # end
+                break
+            if opcode == 0x41:  # i32.const
+                asm.mov_imm(RAX, reader.read_s32_leb128() & 0xFFFFFFFF, 4)
+            elif opcode == 0x42:  # i64.const
+                asm.mov_imm(RAX, reader.read_s64_leb128() & (1 << 64) - 1)
+            elif opcode in (0x43, 0x44):  # f32.const, f64.const
+                size = 4 if opcode == 0x43 else 8
+                asm.mov_imm(RAX, int.from_bytes(reader.read_bytes(size), "little"))
+            elif opcode == 0x23:  # global.get
+                global_idx = reader.read_u32_leb128()
+                asm.load(
+                    RAX,
+                    Mem(symbol=self.global_names[global_idx]),
+                    _SIZES[self.global_classes[global_idx]],
+                )
+            elif opcode in _CONST_EXPR_OPS:
+                cls, op = _CONST_EXPR_OPS[opcode]
+                asm.pop(RCX)
+                asm.pop(RAX)
+                if op is None:
+                    asm.imul(RAX, RCX, _SIZES[cls])
+                else:
+                    asm.alu(op, RAX, RCX, _SIZES[cls])
+            else:
+                raise CompileError(
+                    f"unsupported opcode 0x{opcode:02x} in constant expression"
+                )
+            asm.push(RAX)
+        asm.pop(RAX)
+
+    def emit_direct_call(self, func_idx: int) -> None:
+        """Call a function by index: imports through the PLT, others direct."""
+        if func_idx < self.num_imports:
+            self.asm.call_symbol(self.mod_ctx.get_func_name(func_idx))
+        else:
+            self.call_fixups.append((self.asm.call_rel32(), func_idx))
+
+
+def _global_bits(cls: int, value: int | float | None) -> bytes:
+    """Initial contents of a global of class ``cls``."""
+    if value is None:
+        value = 0  # Set by __wasm_memory_init
+    if cls == F32:
+        return struct.pack("<f", value)
+    if cls == F64:
+        return struct.pack("<d", value)
+    return (int(value) & (1 << 8 * _SIZES[cls]) - 1).to_bytes(_SIZES[cls], "little")
+
+
+class _FunctionCompiler:
+    """Compiles one function body into the module's code buffer."""
+
+    def __init__(
+        self,
+        module: ModuleCompiler,
+        func_idx: int,
+        locals_: list[ValueType],
+        code: bytes,
+    ) -> None:
+        self.module = module
+        self.asm = module.asm
+        self.func_idx = func_idx
+        func_type = module.func_type(func_idx)
+        self.params = tuple(_value_class(t) for t in func_type.params)
+        self.results = tuple(_value_class(t) for t in func_type.results)
+        self.locals = self.params + tuple(_value_class(t) for t in locals_)
+        # Frame: locals, then the out-pointers for results 1.., then homes
+        self.slots = len(self.locals) + max(len(self.results) - 1, 0)
+        self.depth = 0  # Homes used
+        self.reader = BinaryReader(code)
+        self.stack: list[tuple[int, int, int]] = []
+        self.blocks: list[_Block] = []
+        self.gprs = list(_GPRS)
+        self.xmms = list(_XMMS)
+        self.reachable = True
+        # Out-of-line trap calls, by runtime function
+        self.traps: dict[str, Label] = {}
+
+    # -- frame and registers ------------------------------------------------
+
+    def home(self, pos: int) -> Mem:
+        """The frame slot owned by value stack position ``pos``.
+
+        The locals' slots come first, at the negative positions.
+        """
+        if pos >= self.depth:
+            self.depth = pos + 1
+        return _frame_slot(self.slots + pos)
+
+    @staticmethod
+    def local(idx: int) -> Mem:
+        return _frame_slot(idx)
+
+    def alloc_gpr(self) -> int:
+        if self.gprs:
+            return self.gprs.pop()
+        return self._spill_first(float_=False)
+
+    def alloc_xmm(self) -> int:
+        if self.xmms:
+            return self.xmms.pop()
+        return self._spill_first(float_=True)
+
+    def _spill_first(self, *, float_: bool) -> int:
+        """Free the register of the deepest register entry of a class."""
+        for pos, (cls, kind, reg) in enumerate(self.stack):
+            if kind == REG and (cls >= F32) == float_:
+                self.store_entry(self.home(pos), self.stack[pos])
+                self.stack[pos] = (cls, MEM, pos)
+                return reg
+        raise CompileError("out of registers")
+
+    def free(self, entry: tuple[int, int, int]) -> None:
+        cls, kind, reg = entry
+        if kind == REG:
+            (self.xmms if cls >= F32 else self.gprs).append(reg)
+
+    def claim(self, reg: int) -> None:
+        """Take ``reg`` from the free list, or from the stack entry holding it."""
+        if reg in self.gprs:
+            self.gprs.remove(reg)
+            return
+        for pos, (cls, kind, value) in enumerate(self.stack):
+            if kind == REG and cls < F32 and value == reg:
+                self.store_entry(self.home(pos), self.stack[pos])
+                self.stack[pos] = (cls, MEM, pos)
+                return
+        raise CompileError(f"register {reg} is not held by the stack")
+
+    def push(self, cls: int, reg: int) -> None:
+        self.stack.append((cls, REG, reg))
+
+    def to_gpr(self, entry: tuple[int, int, int]) -> int:
+        """A register holding an integer entry's value, owned by the caller."""
+        cls, kind, value = entry
+        if kind == REG:
+            return value
+        gprs = self.gprs
+        reg = gprs.pop() if gprs else self._spill_first(float_=False)
+        if kind == CONST:
+            self.asm.mov_imm(reg, value, _SIZES[cls])
+        else:
+            self.asm.load(reg, self.home(value), _SIZES[cls])
+        return reg
+
+    def to_xmm(self, entry: tuple[int, int, int], reg: int | None = None) -> int:
+        """An SSE register holding a float entry's value, owned by the caller."""
+        cls, kind, value = entry
+        if kind == REG and reg is None:
+            return value
+        if reg is None:
+            reg = self.alloc_xmm()
+        if kind == REG:
+            self.asm.movaps(reg, value)
+        elif kind == CONST:
+            self.load_float_bits(reg, value, cls)
+        else:
+            self.asm.sse(_SSE[cls], 0x10, reg, self.home(value))
+        return reg
+
+    def load_float_bits(self, reg: int, bits: int, cls: int) -> None:
+        if bits == 0:
+            self.asm.sse(0, 0x57, reg, reg)  # xorps
+        else:
+            self.asm.mov_imm(R11, bits)
+            self.asm.movd_to_xmm(reg, R11, _SIZES[cls])
+
+    def store_entry(self, mem: Mem, entry: tuple[int, int, int]) -> None:
+        """Store an entry's value to ``mem``; uses XMM15, never R11."""
+        cls, kind, value = entry
+        size = _SIZES[cls]
+        if kind == REG:
+            if cls >= F32:
+                self.asm.sse(_SSE[cls], 0x11, value, mem)
+            else:
+                self.asm.store(mem, value, size)
+        elif kind == CONST:
+            if size == 4 or fits_i32(_signed(value, cls)):
+                self.asm.store_imm(mem, _signed(value, cls), size)
+            else:
+                self.asm.store_imm(mem, value & 0xFFFFFFFF, 4)
+                high = Mem(mem.base, mem.disp + 4, mem.index, mem.scale, mem.symbol)
+                self.asm.store_imm(high, value >> 32, 4)
+        else:
+            prefix = 0xF3 if size == 4 else 0xF2
+            self.asm.sse(prefix, 0x10, XMM15, self.home(value))
+            self.asm.sse(prefix, 0x11, XMM15, mem)
+
+    def spill_all(self) -> None:
+        """Send every register entry home."""
+        stack = self.stack
+        for pos, entry in enumerate(stack):
+            if entry[1] == REG:
+                self.store_entry(self.home(pos), entry)
+                self.free(entry)
+                stack[pos] = (entry[0], MEM, pos)
+
+    def flush(self, start: int) -> None:
+        """Send every register entry and local read home, and the constants
+        from ``start``.
+
+        A local read left below the block would be sent home on the paths
+        that set the local and not on the others.
+        """
+        self.spill_all()
+        stack = self.stack
+        for pos, entry in enumerate(stack):
+            if (entry[1] == MEM and entry[2] < 0) or (
+                entry[1] == CONST and pos >= start
+            ):
+                self.store_entry(self.home(pos), entry)
+                stack[pos] = (entry[0], MEM, pos)
+
+    def own_local(self, idx: int) -> None:
+        """Send home the entries reading local ``idx``, before it changes."""
+        ref = idx - self.slots
+        stack = self.stack
+        if (self.locals[idx], MEM, ref) not in stack:
+            return
+        for pos, entry in enumerate(stack):
+            if entry[2] == ref and entry[1] == MEM:
+                self.store_entry(self.home(pos), entry)
+                stack[pos] = (entry[0], MEM, pos)
+
+    def reset(self, height: int, classes: tuple[int, ...]) -> None:
+        """The stack at a label: ``height`` entries, then ``classes`` at home.
+
+        No register entries are left below a block's height, so every
+        register is free again.
+        """
+        del self.stack[height:]
+        self.stack += [(cls, MEM, height + k) for k, cls in enumerate(classes)]
+        self.gprs = list(_GPRS)
+        self.xmms = list(_XMMS)
+
+    def trap(self, function: str) -> Label:
+        """Label of an out-of-line call to a runtime trap function."""
+        if function not in self.traps:
+            self.traps[function] = Label()
+        return self.traps[function]
+
+    def error(self, message: str) -> CompileError:
+        return CompileError(message, func_idx=self.func_idx)
+
+    # -- function -----------------------------------------------------------
+
+    def compile(self) -> None:
+        asm = self.asm
+        asm.push(RBP)
+        asm.mov(RBP, RSP)
+        asm.code += b"\x48\x81\xec"  # sub rsp, imm32
+        frame_size_field = len(asm.code)
+        asm.code += b"\0\0\0\0"
+        self._store_params()
+
+        self.blocks.append(_Block(_FUNCTION, 0, (), self.results))
+        # The hot loop: one iteration per instruction, so the opcode is
+        # read inline
+        dispatch = _DISPATCH
+        reader = self.reader
+        data, end = reader.data, len(reader.data)
+        blocks = self.blocks
+        while blocks:
+            pos = reader.pos
+            if pos >= end:
+                raise ParseError("unexpected end of data", pos)
+            reader.pos = pos + 1
+            entry = dispatch[data[pos]]
+            if entry is None:
+                raise self.error(f"unsupported instruction 0x{data[pos]:02x}")
+            handler, args = entry
+            handler(self, *args)
+
+        for function, label in self.traps.items():
+            asm.bind(label)
+            if function == "__wasm_trap_indirect_call":
+                # Reached with RAX at the table slot
+                asm.load(RDI, Mem(RAX, 8), 4)
+            asm.call_symbol(function)
+
+        frame = 8 * (self.slots + self.depth)
+        asm.patch_i32(frame_size_field, frame + (-frame % 16))
+
+    def _store_params(self) -> None:
+        """Copy the arguments into the local slots and zero the other locals."""
+        asm = self.asm
+        ints = floats = stacked = 0
+        # The out-pointers for results 1.. follow the WASM parameters
+        classes = self.params + (I64,) * max(len(self.results) - 1, 0)
+        for idx, cls in enumerate(classes):
+            slot = self.local(idx)
+            if cls >= F32 and floats < 8:
+                asm.sse(_SSE[cls], 0x11, floats, slot)
+                floats += 1
+            elif cls < F32 and ints < len(_INT_ARGS):
+                asm.store(slot, _INT_ARGS[ints], _SIZES[cls])
+                ints += 1
+            else:
+                asm.sse(0xF2, 0x10, XMM15, Mem(RBP, 16 + 8 * stacked))
+                asm.sse(0xF2, 0x11, XMM15, slot)
+                stacked += 1
+
+        first, count = len(self.params), len(self.locals) - len(self.params)
+        if count > 8:
+            asm.lea(RDI, self.local(len(self.locals) - 1))
+            asm.mov_imm(RCX, count, 4)
+            asm.mov_imm(RAX, 0, 4)
+            asm.rep_stosq()
+        else:
+            for idx in range(first, first + count):
+                asm.store_imm(self.local(idx), 0)
+
+    def emit_return(self) -> None:
+        """Return the values on top of the stack."""
+        asm = self.asm
+        results = self.stack[len(self.stack) - len(self.results) :]
+        for k, entry in enumerate(results[1:]):
+            asm.load(R11, self.local(len(self.locals) + k))
+            self.store_entry(Mem(R11), entry)
+        if results:
+            cls, kind, value = results[0]
+            if cls >= F32:
+                if kind != REG or value != XMM0:
+                    self.to_xmm(results[0], XMM0)
+            elif kind == REG:
+                asm.mov(RAX, value, _SIZES[cls])
+            elif kind == CONST:
+                asm.mov_imm(RAX, value, _SIZES[cls])
+            else:
+                asm.load(RAX, self.home(value), _SIZES[cls])
+        asm.leave_ret()
+
+    def dead(self) -> None:
+        """Skip the code after an unconditional transfer of control."""
+        self.reachable = False
+        skip_unreachable(self.reader)
+
+    # -- control flow -------------------------------------------------------
+
+    def op_unreachable(self) -> None:
+        self.asm.call_symbol("__wasm_trap_unreachable")
+        self.dead()
+
+    def op_nop(self) -> None:
+        pass
+
+    def enter(self, kind: int) -> _Block:
+        params, results = self.module.block_type(self.reader.read_block_type())
+        height = len(self.stack) - len(params)
+        if kind == _IF:
+            height -= 1
+        block = _Block(kind, height, params, results)
+        self.blocks.append(block)
+        return block
+
+    def op_block(self) -> None:
+        block = self.enter(_BLOCK)
+        self.flush(block.height)
+
+    def op_loop(self) -> None:
+        block = self.enter(_LOOP)
+        self.flush(block.height)
+        self.asm.bind(block.label)
+
+    def op_if(self) -> None:
+        block = self.enter(_IF)
+        cond = self.stack.pop()
+        self.flush(block.height)
+        block.else_label = Label()
+        self.jump_if_zero(cond, block.else_label)
+
+    def jump_if_zero(
+        self, cond: tuple[int, int, int], label: Label, cc: int = CC_E
+    ) -> None:
+        """Test an i32 entry and jump to ``label`` on ``cc`` (zero by default)."""
+        _, kind, value = cond
+        if kind == CONST:
+            if (value == 0) == (cc == CC_E):
+                self.asm.jmp(label)
+            return
+        if kind == REG:
+            self.asm.test(value, value, 4)
+            self.free(cond)
+        else:
+            self.asm.alu_imm(CMP, self.home(value), 0, 4)
+        self.asm.jcc(cc, label)
+
+    def merge(self, height: int) -> None:
+        """Send the entries from ``height`` up home, as a label expects."""
+        stack = self.stack
+        for pos in range(height, len(stack)):
+            entry = stack[pos]
+            if entry[1] != MEM or entry[2] != pos:
+                self.store_entry(self.home(pos), entry)
+                self.free(entry)
+                stack[pos] = (entry[0], MEM, pos)
+
+    def op_else(self) -> None:
+        block = self.blocks[-1]
+        if self.reachable:
+            self.merge(block.height)
+            self.asm.jmp(block.label)
+            block.used = True
+        self.asm.bind(block.else_label)
+        block.else_label = None
+        self.reset(block.height, block.params)
+        self.reachable = True
+
+    def op_end(self) -> None:
+        block = self.blocks.pop()
+        if block.kind == _FUNCTION:
+            if self.reachable:
+                self.emit_return()
+            return
+        if block.kind == _LOOP:
+            if not self.reachable:
+                skip_unreachable(self.reader)
+            return
+        if block.else_label is not None:
+            # An if without else: its false edge arrives here with the
+            # parameters, which are its results
+            if self.reachable:
+                self.merge(block.height)
+            self.asm.bind(block.else_label)
+            block.used = True
+        elif not block.used:
+            if not self.reachable:
+                skip_unreachable(self.reader)
+            return
+        elif self.reachable:
+            self.merge(block.height)
+        self.asm.bind(block.label)
+        self.reset(block.height, block.results)
+        self.reachable = True
+
+    def branch_moves(self, block: _Block) -> None:
+        """Store the values a branch carries into the target's homes."""
+        stack = self.stack
+        count = len(block.arity)
+        source = len(stack) - count
+        for k in range(count):
+            entry = stack[source + k]
+            if entry[1] != MEM or entry[2] != block.height + k:
+                self.store_entry(self.home(block.height + k), entry)
+
+    def in_place(self, block: _Block) -> bool:
+        """Whether a branch to ``block`` finds its values already home."""
+        count = len(block.arity)
+        source = len(self.stack) - count
+        if block.kind == _FUNCTION or source != block.height:
+            return False
+        return all(
+            entry[1] == MEM and entry[2] == source + k
+            for k, entry in enumerate(self.stack[source:])
+        )
+
+    def branch(self, block: _Block) -> None:
+        if block.kind == _FUNCTION:
+            self.emit_return()
+            return
+        self.branch_moves(block)
+        self.asm.jmp(block.label)
+        block.used = True
+
+    def op_br(self) -> None:
+        self.branch(self.blocks[-1 - self.reader.read_u32_leb128()])
+        self.dead()
+
+    def op_br_if(self) -> None:
+        block = self.blocks[-1 - self.reader.read_u32_leb128()]
+        cond = self.stack.pop()
+        if cond[1] == CONST:
+            if cond[2]:
+                self.branch(block)
+                self.dead()
+            return
+        count = len(block.arity)
+        source = len(self.stack) - count
+        if block.kind != _FUNCTION and source == block.height:
+            # The values are where the target wants them once stored home,
+            # which the fallthrough doesn't mind
+            self.branch_moves(block)
+            self.jump_if_zero(cond, block.label, CC_NE)
+            block.used = True
+            return
+        skip = Label()
+        self.jump_if_zero(cond, skip)
+        self.branch(block)
+        self.asm.bind(skip)
+
+    def op_br_table(self) -> None:
+        reader = self.reader
+        depths = [reader.read_u32_leb128() for _ in range(reader.read_u32_leb128())]
+        default = reader.read_u32_leb128()
+        index = self.stack.pop()
+        if index[1] == CONST:
+            depth = depths[index[2]] if index[2] < len(depths) else default
+            self.branch(self.blocks[-1 - depth])
+            self.dead()
+            return
+
+        asm = self.asm
+        count = len(self.blocks[-1 - default].arity)
+        self.merge(len(self.stack) - count)
+        # A label per distinct target: its own when the values are in
+        # place, else a stub that moves them first
+        stubs: dict[int, Label] = {}
+        targets: dict[int, Label] = {}
+        for depth in {*depths, default}:
+            block = self.blocks[-1 - depth]
+            if self.in_place(block):
+                targets[depth] = block.label
+                block.used = True
+            else:
+                targets[depth] = stubs[depth] = Label()
+
+        reg = self.to_gpr(index)
+        asm.alu_imm(CMP, reg, len(depths), 4)
+        asm.jcc(CC_AE, targets[default])
+        table = Label()
+        asm.lea_label(R11, table)
+        asm.load_extend(reg, Mem(R11, index=reg, scale=4), 4, signed=True, w=True)
+        asm.alu(ADD, R11, reg)
+        asm.jmp_reg(R11)
+        asm.bind(table)
+        for depth in depths:
+            asm.table_entry(targets[depth], table.pos)
+        self.gprs.append(reg)
+        for depth, stub in stubs.items():
+            asm.bind(stub)
+            self.branch(self.blocks[-1 - depth])
+        self.dead()
+
+    def op_return(self) -> None:
+        self.emit_return()
+        self.dead()
+
+    # -- calls --------------------------------------------------------------
+
+    def op_call(self) -> None:
+        func_idx = self.reader.read_u32_leb128()
+        func_type = self.module.func_type(func_idx)
+        self.emit_call(
+            tuple(_value_class(t) for t in func_type.params),
+            tuple(_value_class(t) for t in func_type.results),
+            lambda: self.module.emit_direct_call(func_idx),
+        )
+
+    def op_call_indirect(self) -> None:
+        type_idx = self.reader.read_u32_leb128()
+        if self.reader.read_u32_leb128() != 0:
+            raise self.error("call_indirect through tables other than 0")
+        params, results = self.module.block_type(type_idx)
+        sig = self.module.mod_ctx.signature_id(type_idx)
+        # The index waits at home while the arguments are loaded
+        index = self.stack.pop()
+        position = len(self.stack)
+        if index[1] != MEM or index[2] != position:
+            self.store_entry(self.home(position), index)
+            self.free(index)
+        asm = self.asm
+
+        def call() -> None:
+            asm.load(RAX, self.home(position), 4)
+            asm.alu(CMP, RAX, Mem(symbol="__wasm_table_size"), 4)
+            asm.jcc(CC_AE, self.trap("__wasm_trap_undefined_element"))
+            asm.shift_imm(SHL, RAX, 4)
+            asm.alu(ADD, RAX, Mem(symbol="__wasm_table"))
+            asm.alu_imm(CMP, Mem(RAX, 8), sig, 4)
+            asm.jcc(CC_NE, self.trap("__wasm_trap_indirect_call"))
+            asm.call_reg(Mem(RAX))
+
+        self.emit_call(params, results, call)
+
+    def call_helper(
+        self, function: str, params: tuple[int, ...], results: tuple[int, ...]
+    ) -> None:
+        self.emit_call(params, results, lambda: self.asm.call_symbol(function))
+
+    def emit_call(
+        self, params: tuple[int, ...], results: tuple[int, ...], call
+    ) -> None:
+        """Call with the arguments on top of the stack; ``call`` emits the call."""
+        asm = self.asm
+        self.spill_all()
+        base = len(self.stack) - len(params)
+        args = self.stack[base:]
+
+        int_args: list[tuple[int, tuple[int, int, int] | int]] = []
+        float_args: list[tuple[int, tuple[int, int, int]]] = []
+        stacked: list[tuple[int, int, int] | int] = []
+        for entry in args:
+            if entry[0] >= F32 and len(float_args) < 8:
+                float_args.append((len(float_args), entry))
+            elif entry[0] < F32 and len(int_args) < len(_INT_ARGS):
+                int_args.append((_INT_ARGS[len(int_args)], entry))
+            else:
+                stacked.append(entry)
+        # Out-pointers for results 1.. into their homes, as stack positions
+        for k in range(1, len(results)):
+            if len(int_args) < len(_INT_ARGS):
+                int_args.append((_INT_ARGS[len(int_args)], base + k))
+            else:
+                stacked.append(base + k)
+
+        padding = 8 * (len(stacked) % 2)
+        if padding:
+            asm.alu_imm(SUB, RSP, 8)
+        for arg in reversed(stacked):
+            if isinstance(arg, int):
+                asm.lea(R11, self.home(arg))
+            elif arg[1] == CONST:
+                asm.mov_imm(R11, arg[2])
+            else:
+                asm.load(R11, self.home(arg[2]))
+            asm.push(R11)
+        for reg, arg in int_args:
+            if isinstance(arg, int):
+                asm.lea(reg, self.home(arg))
+            elif arg[1] == CONST:
+                asm.mov_imm(reg, arg[2], _SIZES[arg[0]])
+            else:
+                asm.load(reg, self.home(arg[2]), _SIZES[arg[0]])
+        for reg, arg in float_args:
+            self.to_xmm(arg, reg)
+
+        call()
+        if stacked:
+            asm.alu_imm(ADD, RSP, 8 * len(stacked) + padding)
+
+        del self.stack[base:]
+        if results:
+            if results[0] >= F32:
+                self.xmms.remove(XMM0)
+                self.push(results[0], XMM0)
+            else:
+                self.gprs.remove(RAX)
+                if results[0] == I32:
+                    asm.mov(RAX, RAX, 4)
+                self.push(results[0], RAX)
+            self.stack += [(cls, MEM, base + k) for k, cls in enumerate(results) if k]
+
+    # -- parametric and variables -------------------------------------------
+
+    def op_drop(self) -> None:
+        self.free(self.stack.pop())
+
+    def op_select(self) -> None:
+        cond = self.stack.pop()
+        second = self.stack.pop()
+        first = self.stack.pop()
+        if cond[1] == CONST:
+            keep, other = (first, second) if cond[2] else (second, first)
+            self.free(other)
+            self.stack.append(keep)
+            return
+        asm = self.asm
+        cls = first[0]
+        if cls >= F32:
+            reg = self.to_xmm(first)
+            other = self.to_xmm(second)
+            keep = Label()
+            self.jump_if_zero(cond, keep, CC_NE)
+            asm.movaps(reg, other)
+            asm.bind(keep)
+            self.xmms.append(other)
+        else:
+            reg = self.to_gpr(first)
+            if second[1] == CONST:
+                asm.mov_imm(R11, second[2], _SIZES[cls])
+                source: int | Mem = R11
+            elif second[1] == REG:
+                source = second[2]
+            else:
+                source = self.home(second[2])
+            if cond[1] == REG:
+                asm.test(cond[2], cond[2], 4)
+                self.free(cond)
+            else:
+                asm.alu_imm(CMP, self.home(cond[2]), 0, 4)
+            asm.cmov(CC_E, reg, source, _SIZES[cls])
+            self.free(second)
+        self.push(cls, reg)
+
+    def op_select_typed(self) -> None:
+        for _ in range(self.reader.read_u32_leb128()):
+            self.reader.read_u32_leb128()
+        self.op_select()
+
+    def op_local_get(self) -> None:
+        # Read in place, where the value is used
+        idx = self.reader.read_u32_leb128()
+        self.stack.append((self.locals[idx], MEM, idx - self.slots))
+
+    def op_local_set(self) -> None:
+        entry = self.stack.pop()
+        idx = self.reader.read_u32_leb128()
+        cls, kind, value = entry
+        if kind == MEM and value == idx - self.slots:
+            return
+        self.own_local(idx)
+        if kind == REG and cls < F32:
+            self.asm.store(_frame_slot(idx), value, _SIZES[cls])
+            self.gprs.append(value)
+            return
+        self.store_entry(_frame_slot(idx), entry)
+        self.free(entry)
+
+    def op_local_tee(self) -> None:
+        entry = self.stack[-1]
+        idx = self.reader.read_u32_leb128()
+        if entry[1] == MEM and entry[2] == idx - self.slots:
+            return
+        self.own_local(idx)
+        self.store_entry(_frame_slot(idx), entry)
+
+    def op_global_get(self) -> None:
+        idx = self.reader.read_u32_leb128()
+        cls = self.module.global_classes[idx]
+        symbol = Mem(symbol=self.module.global_names[idx])
+        if cls >= F32:
+            reg = self.alloc_xmm()
+            self.asm.sse(_SSE[cls], 0x10, reg, symbol)
+        else:
+            reg = self.alloc_gpr()
+            self.asm.load(reg, symbol, _SIZES[cls])
+        self.push(cls, reg)
+
+    def op_global_set(self) -> None:
+        idx = self.reader.read_u32_leb128()
+        entry = self.stack.pop()
+        self.store_entry(Mem(symbol=self.module.global_names[idx]), entry)
+        self.free(entry)
+
+    # -- memory -------------------------------------------------------------
+
+    def memarg(self) -> int:
+        """Read a memarg; returns the offset."""
+        align = self.reader.read_u32_leb128()
+        if align & 0x40:
+            raise self.error("multiple memories are not supported")
+        return self.reader.read_u32_leb128()
+
+    def address(
+        self, entry: tuple[int, int, int], offset: int, reg: int | None
+    ) -> tuple[Mem, int | None]:
+        """The memory operand for ``entry + offset``, with the base in R11.
+
+        Returns the operand and the register it indexes by, owned by the
+        caller; ``reg`` is a register to use for a constant address that
+        doesn't fit the displacement.
+        """
+        asm = self.asm
+        if entry[1] == CONST:
+            address = entry[2] + offset
+            if address <= 0x7FFFFFFF:
+                asm.load(R11, _MEMORY_BASE)
+                return Mem(R11, address), None
+            if reg is None:
+                reg = self.alloc_gpr()
+            asm.mov_imm(reg, address)
+            offset = 0
+        else:
+            reg = self.to_gpr(entry)
+            if offset > 0x7FFFFFFF:
+                asm.mov_imm(R11, offset)
+                asm.alu(ADD, reg, R11)
+                offset = 0
+        asm.load(R11, _MEMORY_BASE)
+        return _memory_operand(offset, reg), reg
+
+    def op_load(self, cls: int, size: int, signed: bool) -> None:
+        offset = self.memarg()
+        entry = self.stack.pop()
+        asm = self.asm
+        if cls >= F32:
+            mem, index = self.address(entry, offset, None)
+            reg = self.alloc_xmm()
+            asm.sse(_SSE[cls], 0x10, reg, mem)
+            if index is not None:
+                self.gprs.append(index)
+        else:
+            reg = self.alloc_gpr() if entry[1] == CONST else None
+            mem, index = self.address(entry, offset, reg)
+            if reg is None:
+                reg = index
+            if size == _SIZES[cls]:
+                asm.load(reg, mem, size)
+            else:
+                asm.load_extend(reg, mem, size, signed=signed, w=cls == I64)
+        self.push(cls, reg)
+
+    def op_store(self, cls: int, size: int) -> None:
+        offset = self.memarg()
+        value = self.stack.pop()
+        entry = self.stack.pop()
+        asm = self.asm
+        bits_cls = I32 if size == 4 else I64
+        if value[1] == CONST and (size < 8 or fits_i32(_signed(value[2], I64))):
+            source: int | None = None
+        elif value[1] == REG:
+            source = value[2]
+        else:
+            source = self.to_gpr((bits_cls, value[1], value[2]))
+            value = (bits_cls, REG, source)
+        mem, index = self.address(entry, offset, None)
+        if source is None:
+            asm.store_imm(mem, _signed(value[2], bits_cls), size)
+        elif value[0] >= F32:
+            asm.sse(_SSE[value[0]], 0x11, source, mem)
+        else:
+            asm.store(mem, source, size)
+        self.free(value)
+        if index is not None:
+            self.gprs.append(index)
+
+    def op_memory_size(self) -> None:
+        self.reader.read_u32_leb128()
+        reg = self.alloc_gpr()
+        self.asm.load(reg, Mem(symbol="__wasm_memory_size_pages"), 4)
+        self.push(I32, reg)
+
+    def op_memory_grow(self) -> None:
+        self.reader.read_u32_leb128()
+        self.call_helper("__wasm_memory_grow", (I32,), (I32,))
+
+    # -- constants ----------------------------------------------------------
+
+    def op_i32_const(self) -> None:
+        self.stack.append((I32, CONST, self.reader.read_s32_leb128() & 0xFFFFFFFF))
+
+    def op_i64_const(self) -> None:
+        self.stack.append((I64, CONST, self.reader.read_s64_leb128() & (1 << 64) - 1))
+
+    def op_f32_const(self) -> None:
+        bits = int.from_bytes(self.reader.read_bytes(4), "little")
+        self.stack.append((F32, CONST, bits))
+
+    def op_f64_const(self) -> None:
+        bits = int.from_bytes(self.reader.read_bytes(8), "little")
+        self.stack.append((F64, CONST, bits))
+
+    # -- integer arithmetic -------------------------------------------------
+
+    def int_operand(self, entry: tuple[int, int, int], cls: int) -> int | Mem | None:
+        """Second ALU operand: a register, a home, or None for an immediate."""
+        kind, value = entry[1], entry[2]
+        if kind == REG:
+            return value
+        if kind == MEM:
+            return self.home(value)
+        if cls == I32 or fits_i32(_signed(value, cls)):
+            return None
+        self.asm.mov_imm(R11, value)
+        return R11
+
+    def op_eqz(self, cls: int) -> None:
+        reg = self.to_gpr(self.stack.pop())
+        self.asm.test(reg, reg, _SIZES[cls])
+        self.asm.setcc(CC_E, reg)
+        self.asm.movzx_byte(reg, reg)
+        self.push(I32, reg)
+
+    def op_compare(self, cls: int, cc: int) -> None:
+        second = self.stack.pop()
+        reg = self.to_gpr(self.stack.pop())
+        operand = self.int_operand(second, cls)
+        if operand is None:
+            self.asm.alu_imm(CMP, reg, _signed(second[2], cls), _SIZES[cls])
+        else:
+            self.asm.alu(CMP, reg, operand, _SIZES[cls])
+        self.free(second)
+        self.asm.setcc(cc, reg)
+        self.asm.movzx_byte(reg, reg)
+        self.push(I32, reg)
+
+    def op_alu(self, cls: int, op: int, commutative: bool) -> None:
+        stack = self.stack
+        second = stack.pop()
+        first = stack.pop()
+        if commutative and first[1] == CONST and second[1] != CONST:
+            first, second = second, first
+        reg = self.to_gpr(first)
+        if second[1] == REG:
+            # The common case, without the operand dispatch
+            self.asm.alu(op, reg, second[2], _SIZES[cls])
+            self.gprs.append(second[2])
+            stack.append((cls, REG, reg))
+            return
+        operand = self.int_operand(second, cls)
+        if operand is None:
+            self.asm.alu_imm(op, reg, _signed(second[2], cls), _SIZES[cls])
+        else:
+            self.asm.alu(op, reg, operand, _SIZES[cls])
+        self.free(second)
+        self.push(cls, reg)
+
+    def op_mul(self, cls: int) -> None:
+        second = self.stack.pop()
+        first = self.stack.pop()
+        if first[1] == CONST and second[1] != CONST:
+            first, second = second, first
+        reg = self.to_gpr(first)
+        operand = self.int_operand(second, cls)
+        if operand is None:
+            self.asm.imul_imm(reg, reg, _signed(second[2], cls), _SIZES[cls])
+        else:
+            self.asm.imul(reg, operand, _SIZES[cls])
+        self.free(second)
+        self.push(cls, reg)
+
+    def op_shift(self, cls: int, op: int) -> None:
+        count = self.stack.pop()
+        first = self.stack.pop()
+        asm = self.asm
+        size = _SIZES[cls]
+        reg = self.to_gpr(first)
+        if count[1] == CONST:
+            asm.shift_imm(op, reg, count[2], size)
+            self.push(cls, reg)
+            return
+        if reg == RCX:
+            reg = self.alloc_gpr()
+            asm.mov(reg, RCX)
+            self.gprs.append(RCX)
+        if count[1] != REG or count[2] != RCX:
+            self.claim(RCX)
+            if count[1] == REG:
+                asm.mov(RCX, count[2])
+            else:
+                asm.load(RCX, self.home(count[2]), 4)
+            self.free(count)
+        asm.shift(op, reg, size)
+        self.gprs.append(RCX)
+        self.push(cls, reg)
+
+    def op_divide(self, cls: int, signed: bool, remainder: bool) -> None:
+        """Division and remainder: dividend in RDX:RAX, divisor anywhere else."""
+        second = self.stack.pop()
+        first = self.stack.pop()
+        asm = self.asm
+        size = _SIZES[cls]
+        if second[1] == REG and second[2] not in (RAX, RDX):
+            divisor = second[2]
+        else:
+            divisor = R11
+            if second[1] == REG:
+                asm.mov(R11, second[2])
+            elif second[1] == CONST:
+                asm.mov_imm(R11, second[2], size)
+            else:
+                asm.load(R11, self.home(second[2]), size)
+            self.free(second)
+        if first[1] == REG and first[2] == RAX:
+            pass
+        else:
+            self.claim(RAX)
+            if first[1] == REG:
+                asm.mov(RAX, first[2])
+            elif first[1] == CONST:
+                asm.mov_imm(RAX, first[2], size)
+            else:
+                asm.load(RAX, self.home(first[2]), size)
+            self.free(first)
+        self.claim(RDX)
+
+        asm.test(divisor, divisor, size)
+        asm.jcc(CC_E, self.trap("__wasm_trap_div_by_zero"))
+        done = Label()
+        if signed:
+            # x / -1 overflows for the most negative x; x % -1 is always 0
+            divide = Label()
+            asm.alu_imm(CMP, divisor, -1, size)
+            asm.jcc(CC_NE, divide)
+            if remainder:
+                asm.mov_imm(RDX, 0, 4)
+            else:
+                asm.neg(RAX, size)
+                asm.jcc(CC_O, self.trap("__wasm_trap_integer_overflow"))
+            asm.jmp(done)
+            asm.bind(divide)
+            asm.sign_extend_rax(size)
+        else:
+            asm.mov_imm(RDX, 0, 4)
+        asm.div(divisor, size, signed=signed)
+        asm.bind(done)
+
+        if divisor != R11:
+            self.gprs.append(divisor)
+        if remainder:
+            self.gprs.append(RAX)
+            self.push(cls, RDX)
+        else:
+            self.gprs.append(RDX)
+            self.push(cls, RAX)
+
+    def op_clz(self, cls: int) -> None:
+        reg = self.to_gpr(self.stack.pop())
+        size = _SIZES[cls]
+        asm = self.asm
+        # BSR gives the highest set bit's index, and nothing for zero
+        asm.bit_scan(reg, reg, size, reverse=True)
+        asm.mov_imm(R11, 2 * 8 * size - 1, 4)
+        asm.cmov(CC_E, reg, R11, size)
+        asm.alu_imm(XOR, reg, 8 * size - 1, size)
+        self.push(cls, reg)
+
+    def op_ctz(self, cls: int) -> None:
+        reg = self.to_gpr(self.stack.pop())
+        size = _SIZES[cls]
+        self.asm.bit_scan(reg, reg, size, reverse=False)
+        self.asm.mov_imm(R11, 8 * size, 4)
+        self.asm.cmov(CC_E, reg, R11, size)
+        self.push(cls, reg)
+
+    def op_popcnt(self, cls: int) -> None:
+        name = "__wasm_i32_popcnt" if cls == I32 else "__wasm_i64_popcnt"
+        self.call_helper(name, (cls,), (cls,))
+
+    def op_extend(self, cls: int, size: int) -> None:
+        """Sign extension from the low ``size`` bytes, in place."""
+        reg = self.to_gpr(self.stack.pop())
+        self.asm.extend(reg, reg, size, w=cls == I64)
+        self.push(cls, reg)
+
+    # -- floating point -----------------------------------------------------
+
+    def float_operand(self, entry: tuple[int, int, int]) -> int | Mem:
+        """Second SSE operand: a register, a home, or a constant in XMM15."""
+        cls, kind, value = entry
+        if kind == REG:
+            return value
+        if kind == MEM:
+            return self.home(value)
+        self.load_float_bits(XMM15, value, cls)
+        return XMM15
+
+    def op_float_binary(self, cls: int, opcode: int) -> None:
+        second = self.stack.pop()
+        reg = self.to_xmm(self.stack.pop())
+        self.asm.sse(_SSE[cls], opcode, reg, self.float_operand(second))
+        self.free(second)
+        self.push(cls, reg)
+
+    def op_min_max(self, cls: int, is_max: bool) -> None:
+        """WASM min/max: NaN if either is, and -0 below +0."""
+        second = self.stack.pop()
+        reg = self.to_xmm(self.stack.pop())
+        other = self.to_xmm(second)
+        asm = self.asm
+        prefix = _SSE[cls]
+        nan, ordered, done = Label(), Label(), Label()
+        asm.sse(0x66 if cls == F64 else 0, 0x2E, reg, other)  # ucomis
+        asm.jcc(CC_P, nan)
+        asm.jcc(CC_NE, ordered)
+        # Equal, possibly zeros of either sign: combine the sign bits
+        asm.sse(0, 0x54 if is_max else 0x56, reg, other)  # andps / orps
+        asm.jmp(done)
+        asm.bind(nan)
+        asm.sse(prefix, 0x58, reg, other)  # adds: a NaN
+        asm.jmp(done)
+        asm.bind(ordered)
+        asm.sse(prefix, 0x5F if is_max else 0x5D, reg, other)
+        asm.bind(done)
+        self.xmms.append(other)
+        self.push(cls, reg)
+
+    def op_float_compare(self, cls: int, cc: int, swap: bool) -> None:
+        second = self.stack.pop()
+        first = self.stack.pop()
+        if swap:
+            first, second = second, first
+        reg = self.to_xmm(first)
+        other = self.to_xmm(second)
+        result = self.alloc_gpr()
+        asm = self.asm
+        asm.sse(0x66 if cls == F64 else 0, 0x2E, reg, other)  # ucomis
+        asm.setcc(cc, result)
+        # Unordered sets ZF too: equality also needs PF clear, and
+        # inequality holds when it's set
+        if cc == CC_E:
+            asm.setcc(CC_NP, R11)
+            asm.and_byte(result, R11)
+        elif cc == CC_NE:
+            asm.setcc(CC_P, R11)
+            asm.and_byte(result, R11, op=OR)
+        asm.movzx_byte(result, result)
+        self.xmms += (reg, other)
+        self.push(I32, result)
+
+    def op_float_bits(self, cls: int, op: int) -> None:
+        """abs (BTR) and neg (BTC) on the sign bit, through R11."""
+        reg = self.to_xmm(self.stack.pop())
+        size = _SIZES[cls]
+        self.asm.movd_from_xmm(R11, reg, size)
+        self.asm.bit_test(op, R11, 8 * size - 1, size)
+        self.asm.movd_to_xmm(reg, R11, size)
+        self.push(cls, reg)
+
+    def op_copysign(self, cls: int) -> None:
+        second = self.stack.pop()
+        reg = self.to_xmm(self.stack.pop())
+        size = _SIZES[cls]
+        asm = self.asm
+        sign = self.alloc_gpr()
+        if second[1] == REG:
+            asm.movd_from_xmm(sign, second[2], size)
+            self.free(second)
+        elif second[1] == CONST:
+            asm.mov_imm(sign, second[2], size)
+        else:
+            asm.load(sign, self.home(second[2]), size)
+        asm.movd_from_xmm(R11, reg, size)
+        asm.bit_test(6, R11, 8 * size - 1, size)  # btr
+        asm.shift_imm(SHR, sign, 8 * size - 1, size)
+        asm.shift_imm(SHL, sign, 8 * size - 1, size)
+        asm.alu(OR, R11, sign, size)
+        asm.movd_to_xmm(reg, R11, size)
+        self.gprs.append(sign)
+        self.push(cls, reg)
+
+    def op_sqrt(self, cls: int) -> None:
+        reg = self.to_xmm(self.stack.pop())
+        self.asm.sse(_SSE[cls], 0x51, reg, reg)
+        self.push(cls, reg)
+
+    def op_float_helper(self, cls: int, name: str) -> None:
+        prefix = "__wasm_f32_" if cls == F32 else "__wasm_f64_"
+        self.call_helper(prefix + name, (cls,), (cls,))
+
+    # -- conversions --------------------------------------------------------
+
+    def op_wrap(self) -> None:
+        reg = self.to_gpr(self.stack.pop())
+        self.asm.mov(reg, reg, 4)
+        self.push(I32, reg)
+
+    def op_extend_i32(self, signed: bool) -> None:
+        entry = self.stack.pop()
+        if entry[1] == CONST and not signed:
+            self.stack.append((I64, CONST, entry[2]))
+            return
+        reg = self.to_gpr(entry)
+        if signed:
+            self.asm.extend(reg, reg, 4, w=True)
+        self.push(I64, reg)
+
+    def op_truncate(self, source: int, cls: int, signed: bool) -> None:
+        """Float to integer, without the range check (see the module doc)."""
+        value = self.to_xmm(self.stack.pop())
+        reg = self.alloc_gpr()
+        asm = self.asm
+        prefix = _SSE[source]
+        if cls == I32:
+            # The unsigned range fits a 64-bit conversion
+            asm.sse(prefix, 0x2C, reg, value, w=not signed)  # cvtts*2si
+            if not signed:
+                asm.mov(reg, reg, 4)
+        elif signed:
+            asm.sse(prefix, 0x2C, reg, value, w=True)
+        else:
+            # Above 2^63, convert x - 2^63 and set the top bit
+            big, done = Label(), Label()
+            limit = 0x5F000000 if source == F32 else 0x43E0000000000000
+            self.load_float_bits(XMM15, limit, source)
+            asm.sse(0x66 if source == F64 else 0, 0x2E, value, XMM15)  # ucomis
+            asm.jcc(CC_AE, big)
+            asm.sse(prefix, 0x2C, reg, value, w=True)
+            asm.jmp(done)
+            asm.bind(big)
+            asm.sse(prefix, 0x5C, value, XMM15)  # subs
+            asm.sse(prefix, 0x2C, reg, value, w=True)
+            asm.bit_test(7, reg, 63)  # btc
+            asm.bind(done)
+        self.xmms.append(value)
+        self.push(cls, reg)
+
+    def op_convert(self, cls: int, source: int, signed: bool) -> None:
+        """Integer to float."""
+        reg = self.to_gpr(self.stack.pop())
+        value = self.alloc_xmm()
+        asm = self.asm
+        prefix = _SSE[cls]
+        if source == I32:
+            # Unsigned i32s are zero-extended, so convert all 64 bits
+            asm.sse(prefix, 0x2A, value, reg, w=not signed)  # cvtsi2s*
+        elif signed:
+            asm.sse(prefix, 0x2A, value, reg, w=True)
+        else:
+            # Above 2^63, halve (keeping the low bit for rounding) and double
+            big, done = Label(), Label()
+            asm.test(reg, reg)
+            asm.jcc(CC_S, big)
+            asm.sse(prefix, 0x2A, value, reg, w=True)
+            asm.jmp(done)
+            asm.bind(big)
+            asm.mov(R11, reg)
+            asm.shift_imm(SHR, R11, 1)
+            asm.alu_imm(AND, reg, 1, 4)
+            asm.alu(OR, R11, reg)
+            asm.sse(prefix, 0x2A, value, R11, w=True)
+            asm.sse(prefix, 0x58, value, value)  # adds
+            asm.bind(done)
+        self.gprs.append(reg)
+        self.push(cls, value)
+
+    def op_float_resize(self, cls: int) -> None:
+        """f32.demote_f64 and f64.promote_f32."""
+        reg = self.to_xmm(self.stack.pop())
+        self.asm.sse(0xF2 if cls == F32 else 0xF3, 0x5A, reg, reg)
+        self.push(cls, reg)
+
+    def op_reinterpret(self, cls: int) -> None:
+        entry = self.stack.pop()
+        if entry[1] == CONST or (entry[1] == MEM and entry[2] >= 0):
+            # Constants and homes hold bits, whatever their class
+            self.stack.append((cls, entry[1], entry[2]))
+            return
+        if entry[1] == MEM:
+            # A local read keeps the local's class, which ``own_local``
+            # looks for: load the bits instead
+            bits = (cls, MEM, entry[2])
+            reg = self.to_xmm(bits) if cls >= F32 else self.to_gpr(bits)
+            self.push(cls, reg)
+            return
+        size = _SIZES[cls]
+        if cls >= F32:
+            reg = self.alloc_xmm()
+            self.asm.movd_to_xmm(reg, entry[2], size)
+        else:
+            reg = self.alloc_gpr()
+            self.asm.movd_from_xmm(reg, entry[2], size)
+        self.free(entry)
+        self.push(cls, reg)
+
+    # -- references ---------------------------------------------------------
+
+    def op_ref_null(self) -> None:
+        self.reader.read_s64_leb128()  # Heap type
+        self.stack.append((I64, CONST, 0))
+
+    def op_ref_func(self) -> None:
+        func_idx = self.reader.read_u32_leb128()
+        reg = self.alloc_gpr()
+        name = self.module.mod_ctx.get_func_name(func_idx)
+        if func_idx < self.module.num_imports:
+            self.asm.load_got(reg, name)
+        else:
+            self.asm.lea(reg, Mem(symbol=name))
+        self.push(I64, reg)
+
+    # -- prefixed -----------------------------------------------------------
+
+    def op_prefix_fc(self) -> None:
+        sub_opcode = self.reader.read_u32_leb128()
+        if sub_opcode < len(_TRUNC_SAT):
+            source, cls, name = _TRUNC_SAT[sub_opcode]
+            self.call_helper(name, (source,), (cls,))
+        elif sub_opcode == 0x0A:  # memory.copy
+            self.reader.read_u32_leb128()
+            self.reader.read_u32_leb128()
+            self.call_helper("__wasm_memory_copy", (I32, I32, I32), ())
+        elif sub_opcode == 0x0B:  # memory.fill
+            self.reader.read_u32_leb128()
+            self.call_helper("__wasm_memory_fill", (I32, I32, I32), ())
+        else:
+            raise self.error(f"unsupported instruction 0xfc 0x{sub_opcode:02x}")
+
+
+def _build_dispatch() -> list[tuple | None]:
+    """(handler, arguments) for each opcode; None where unsupported."""
+    fc = _FunctionCompiler
+    table: list[tuple | None] = [None] * 256
+    simple = {
+        0x00: fc.op_unreachable,
+        0x01: fc.op_nop,
+        0x02: fc.op_block,
+        0x03: fc.op_loop,
+        0x04: fc.op_if,
+        0x05: fc.op_else,
+        0x0B: fc.op_end,
+        0x0C: fc.op_br,
+        0x0D: fc.op_br_if,
+        0x0E: fc.op_br_table,
+        0x0F: fc.op_return,
+        0x10: fc.op_call,
+        0x11: fc.op_call_indirect,
+        0x1A: fc.op_drop,
+        0x1B: fc.op_select,
+        0x1C: fc.op_select_typed,
+        0x20: fc.op_local_get,
+        0x21: fc.op_local_set,
+        0x22: fc.op_local_tee,
+        0x23: fc.op_global_get,
+        0x24: fc.op_global_set,
+        0x3F: fc.op_memory_size,
+        0x40: fc.op_memory_grow,
+        0x41: fc.op_i32_const,
+        0x42: fc.op_i64_const,
+        0x43: fc.op_f32_const,
+        0x44: fc.op_f64_const,
+        0xA7: fc.op_wrap,
+        0xD0: fc.op_ref_null,
+        0xD2: fc.op_ref_func,
+        0xFC: fc.op_prefix_fc,
+    }
+    for opcode, handler in simple.items():
+        table[opcode] = (handler,)
+    for k, (cls, size, signed) in enumerate(_LOADS):
+        table[0x28 + k] = (fc.op_load, cls, size, signed)
+    for k, (cls, size) in enumerate(_STORES):
+        table[0x36 + k] = (fc.op_store, cls, size)
+
+    for cls, base in ((I32, 0x45), (I64, 0x50)):
+        table[base] = (fc.op_eqz, cls)
+        for k, cc in enumerate(_INT_CONDITIONS):
+            table[base + 1 + k] = (fc.op_compare, cls, cc)
+    table[0xD1] = (fc.op_eqz, I64)  # ref.is_null
+    # eq ne lt gt le ge; lt and le compare the other way round
+    float_conditions = (
+        (CC_E, False),
+        (CC_NE, False),
+        (CC_A, True),
+        (CC_A, False),
+        (CC_AE, True),
+        (CC_AE, False),
+    )
+    for cls, base in ((F32, 0x5B), (F64, 0x61)):
+        for k, (cc, swap) in enumerate(float_conditions):
+            table[base + k] = (fc.op_float_compare, cls, cc, swap)
+
+    for cls, base in ((I32, 0x67), (I64, 0x79)):
+        table[base] = (fc.op_clz, cls)
+        table[base + 1] = (fc.op_ctz, cls)
+        table[base + 2] = (fc.op_popcnt, cls)
+        table[base + 3] = (fc.op_alu, cls, ADD, True)
+        table[base + 4] = (fc.op_alu, cls, SUB, False)
+        table[base + 5] = (fc.op_mul, cls)
+        table[base + 6] = (fc.op_divide, cls, True, False)
+        table[base + 7] = (fc.op_divide, cls, False, False)
+        table[base + 8] = (fc.op_divide, cls, True, True)
+        table[base + 9] = (fc.op_divide, cls, False, True)
+        table[base + 10] = (fc.op_alu, cls, AND, True)
+        table[base + 11] = (fc.op_alu, cls, OR, True)
+        table[base + 12] = (fc.op_alu, cls, XOR, True)
+        for k, op in enumerate((SHL, SAR, SHR, ROL, ROR)):
+            table[base + 13 + k] = (fc.op_shift, cls, op)
+
+    for cls, base in ((F32, 0x8B), (F64, 0x99)):
+        table[base] = (fc.op_float_bits, cls, 6)  # abs: btr
+        table[base + 1] = (fc.op_float_bits, cls, 7)  # neg: btc
+        for k, name in enumerate(("ceil", "floor", "trunc", "nearest")):
+            table[base + 2 + k] = (fc.op_float_helper, cls, name)
+        table[base + 6] = (fc.op_sqrt, cls)
+        for k, opcode in enumerate((0x58, 0x5C, 0x59, 0x5E)):  # add sub mul div
+            table[base + 7 + k] = (fc.op_float_binary, cls, opcode)
+        table[base + 11] = (fc.op_min_max, cls, False)
+        table[base + 12] = (fc.op_min_max, cls, True)
+        table[base + 13] = (fc.op_copysign, cls)
+
+    # i32.trunc_f32_s .. i64.trunc_f64_u, f32.convert_i32_s .. f64.convert_i64_u
+    for k, (cls, source) in enumerate(((I32, F32), (I32, F64))):
+        table[0xA8 + 2 * k] = (fc.op_truncate, source, cls, True)
+        table[0xA9 + 2 * k] = (fc.op_truncate, source, cls, False)
+    table[0xAC] = (fc.op_extend_i32, True)
+    table[0xAD] = (fc.op_extend_i32, False)
+    for k, source in enumerate((F32, F64)):
+        table[0xAE + 2 * k] = (fc.op_truncate, source, I64, True)
+        table[0xAF + 2 * k] = (fc.op_truncate, source, I64, False)
+    for cls, base in ((F32, 0xB2), (F64, 0xB7)):
+        for k, (source, signed) in enumerate(
+            ((I32, True), (I32, False), (I64, True), (I64, False))
+        ):
+            table[base + k] = (fc.op_convert, cls, source, signed)
+    table[0xB6] = (fc.op_float_resize, F32)
+    table[0xBB] = (fc.op_float_resize, F64)
+    for k, cls in enumerate((I32, I64, F32, F64)):
+        table[0xBC + k] = (fc.op_reinterpret, cls)
+    for k, (cls, size) in enumerate(((I32, 1), (I32, 2), (I64, 1), (I64, 2), (I64, 4))):
+        table[0xC0 + k] = (fc.op_extend, cls, size)
+    return [entry and (entry[0], entry[1:]) for entry in table]
+
+
+_DISPATCH = _build_dispatch()
+
+
+def compile_baseline(wasm_module: WasmModule) -> bytes:
+    """Compile a WASM module straight to an x86-64 ELF object (System V).
+
+    Covers the MVP with multi-value, sign extension, saturating conversions,
+    ``memory.copy``/``memory.fill`` and the reference instructions short of
+    table access; anything else (SIMD, exceptions, GC, tail calls, table
+    instructions, passive segments, several memories or 64-bit memory)
+    raises ``CompileError``.
+    """
+    return ModuleCompiler(wasm_module).compile()
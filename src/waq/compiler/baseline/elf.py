@@ -0,0 +1,182 @@
+"""ELF64 relocatable object writer for x86-64.
+
+Just enough of the format for the baseline backend's output: a ``.text``,
+``.data`` and ``.rodata`` section, their symbols, and RELA relocations
+against symbols by name.  Names that are referenced but never defined
+become undefined global symbols for the linker to resolve.
+"""
+
+from __future__ import annotations
+
+import struct
+from dataclasses import dataclass, field
+
+# Sections in file order; index 0 is the null section
+TEXT, RELA_TEXT, DATA, RELA_DATA, RODATA = 1, 2, 3, 4, 5
+SYMTAB, STRTAB, SHSTRTAB, NOTE_GNU_STACK = 6, 7, 8, 9
+
+_SECTION_NAMES = (
+    "",
+    ".text",
+    ".rela.text",
+    ".data",
+    ".rela.data",
+    ".rodata",
+    ".symtab",
+    ".strtab",
+    ".shstrtab",
+    ".note.GNU-stack",
+)
+
+# Section types and flags
+_SHT_PROGBITS, _SHT_SYMTAB, _SHT_STRTAB, _SHT_RELA = 1, 2, 3, 4
+_SHF_WRITE, _SHF_ALLOC, _SHF_EXECINSTR, _SHF_INFO_LINK = 0x1, 0x2, 0x4, 0x40
+
+# Symbol bindings and types
+_STB_LOCAL, _STB_GLOBAL = 0, 1
+_STT_NOTYPE, _STT_OBJECT, _STT_FUNC = 0, 1, 2
+
+_EHDR = struct.Struct("<16sHHIQQQIHHHHHH")
+_SHDR = struct.Struct("<IIQQQQIIQQ")
+_SYM = struct.Struct("<IBBHQQ")
+_RELA = struct.Struct("<QQq")
+
+
+@dataclass
+class Symbol:
+    """A symbol defined in the object."""
+
+    name: str
+    section: int
+    offset: int
+    size: int = 0
+    is_global: bool = False
+    is_function: bool = False
+
+
+@dataclass
+class ObjectFile:
+    """Contents of a relocatable object, serialized by ``to_bytes``."""
+
+    text: bytearray = field(default_factory=bytearray)
+    data: bytearray = field(default_factory=bytearray)
+    rodata: bytearray = field(default_factory=bytearray)
+    symbols: list[Symbol] = field(default_factory=list)
+    # (offset, symbol name, type, addend) per section that has relocations
+    text_relocations: list[tuple[int, str, int, int]] = field(default_factory=list)
+    data_relocations: list[tuple[int, str, int, int]] = field(default_factory=list)
+
+    def define(self, symbol: Symbol) -> None:
+        self.symbols.append(symbol)
+
+    def to_bytes(self) -> bytes:
+        """The object file image."""
+        # Locals must come before globals in the symbol table
+        defined = sorted(self.symbols, key=lambda sym: sym.is_global)
+        index = {sym.name: i for i, sym in enumerate(defined, 1)}
+        first_global = next(
+            (i for i, sym in enumerate(defined, 1) if sym.is_global), len(defined) + 1
+        )
+        undefined = []
+        for _, name, _, _ in (*self.text_relocations, *self.data_relocations):
+            if name not in index:
+                index[name] = len(defined) + len(undefined) + 1
+                undefined.append(name)
+
+        strtab = bytearray(b"\0")
+
+        def string(name: str) -> int:
+            offset = len(strtab)
+            strtab.extend(name.encode() + b"\0")
+            return offset
+
+        symtab = bytearray(_SYM.size)  # the null symbol
+        for sym in defined:
+            bind = _STB_GLOBAL if sym.is_global else _STB_LOCAL
+            kind = _STT_FUNC if sym.is_function else _STT_OBJECT
+            symtab += _SYM.pack(
+                string(sym.name), bind << 4 | kind, 0, sym.section, sym.offset, sym.size
+            )
+        for name in undefined:
+            info = _STB_GLOBAL << 4 | _STT_NOTYPE
+            symtab += _SYM.pack(string(name), info, 0, 0, 0, 0)
+
+        def relocations(entries: list[tuple[int, str, int, int]]) -> bytes:
+            return b"".join(
+                _RELA.pack(offset, index[name] << 32 | kind, addend)
+                for offset, name, kind, addend in entries
+            )
+
+        shstrtab = bytearray()
+        name_offsets = []
+        for name in _SECTION_NAMES:
+            name_offsets.append(len(shstrtab))
+            shstrtab += name.encode() + b"\0"
+
+        # (contents, type, flags, link, info, alignment, entry size)
+        sections = [
+            (b"", 0, 0, 0, 0, 0, 0),
+            (self.text, _SHT_PROGBITS, _SHF_ALLOC | _SHF_EXECINSTR, 0, 0, 16, 0),
+            (
+                relocations(self.text_relocations),
+                _SHT_RELA,
+                _SHF_INFO_LINK,
+                SYMTAB,
+                TEXT,
+                8,
+                _RELA.size,
+            ),
+            (self.data, _SHT_PROGBITS, _SHF_ALLOC | _SHF_WRITE, 0, 0, 16, 0),
+            (
+                relocations(self.data_relocations),
+                _SHT_RELA,
+                _SHF_INFO_LINK,
+                SYMTAB,
+                DATA,
+                8,
+                _RELA.size,
+            ),
+            (self.rodata, _SHT_PROGBITS, _SHF_ALLOC, 0, 0, 16, 0),
+            (symtab, _SHT_SYMTAB, 0, STRTAB, first_global, 8, _SYM.size),
+            (strtab, _SHT_STRTAB, 0, 0, 0, 1, 0),
+            (shstrtab, _SHT_STRTAB, 0, 0, 0, 1, 0),
+            (b"", _SHT_PROGBITS, 0, 0, 0, 1, 0),
+        ]
+
+        image = bytearray(_EHDR.size)
+        headers = bytearray()
+        for name_offset, (contents, kind, flags, link, info, align, entsize) in zip(
+            name_offsets, sections, strict=True
+        ):
+            if align > 1:
+                image += b"\0" * (-len(image) % align)
+            offset = len(image) if kind else 0
+            image += contents
+            headers += _SHDR.pack(
+                name_offset, kind, flags, 0, offset, len(contents), link, info,
+                align, entsize,
+            )
+        image += b"\0" * (-len(image) % 8)
+        section_headers = len(image)
+        image += headers
+
+        ident = b"\x7fELF" + bytes([2, 1, 1]) + bytes(9)  # 64-bit, LE, v1
+        _EHDR.pack_into(
+            image,
+            0,
+            ident,
+            1,  # ET_REL
+            62,  # EM_X86_64
+            1,
+            0,
+            0,
+            section_headers,
+            0,
+            _EHDR.size,
+            0,
+            0,
+            _SHDR.size,
+            len(sections),
+            SHSTRTAB,
+        )
+        return bytes(image)
@@ -0,0 +1,465 @@
+"""x86-64 machine code encoder.
+
+Encodes the instruction forms the baseline code generator uses straight
+into a bytearray.  Registers are numbered as in their ModRM encoding;
+general-purpose and SSE registers share the numbers 0-15, the instruction
+decides which file an operand is in.  Jumps go to ``Label`` objects, patched
+when the label is bound, and symbol references become relocations for the
+object writer.
+
+A function uses few distinct register and frame slot combinations, so the
+assembler encodes each (opcode, operands) once and appends the cached bytes
+after that; only immediates and RIP-relative operands are written out every
+time.
+"""
+
+from __future__ import annotations
+
+import struct
+
+# General-purpose registers
+RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI = range(8)
+R8, R9, R10, R11, R12, R13, R14, R15 = range(8, 16)
+
+# Condition codes: the low nibble of Jcc, SETcc and CMOVcc
+CC_O, CC_NO, CC_B, CC_AE, CC_E, CC_NE, CC_BE, CC_A = range(8)
+CC_S, CC_NS, CC_P, CC_NP, CC_L, CC_GE, CC_LE, CC_G = range(8, 16)
+
+# ALU operations: the ModRM reg field of the 0x81/0x83 immediate forms;
+# the register forms are opcode ``op * 8 + 1`` (r/m, reg)
+ADD, OR, ADC, SBB, AND, SUB, XOR, CMP = range(8)
+
+# Shift and rotate operations: the ModRM reg field of 0xC1/0xD3
+ROL, ROR, SHL, SHR, SAR = 0, 1, 4, 5, 7
+
+# ELF relocation types
+R_X86_64_64 = 1
+R_X86_64_PC32 = 2
+R_X86_64_PLT32 = 4
+R_X86_64_REX_GOTPCRELX = 42
+
+_PACK_I32 = struct.Struct("<i").pack
+_PACK_U32 = struct.Struct("<I").pack
+_PACK_Q = struct.Struct("<Q").pack
+_PATCH_I32 = struct.Struct("<i").pack_into
+
+
+class Label:
+    """A code position, possibly not known yet.
+
+    ``fixups`` are the 32-bit fields waiting for it, as (field offset, base):
+    the field receives the label's position minus ``base``.
+    """
+
+    __slots__ = ("fixups", "pos")
+
+    def __init__(self) -> None:
+        self.pos: int | None = None
+        self.fixups: list[tuple[int, int]] = []
+
+
+class Mem:
+    """A memory operand: ``[base + index * scale + disp]``, or a symbol.
+
+    With ``symbol`` set the operand is RIP-relative, and the linker fills
+    in the displacement to ``symbol + disp``.
+    """
+
+    __slots__ = ("base", "disp", "index", "key", "scale", "symbol")
+
+    def __init__(
+        self,
+        base: int | None = None,
+        disp: int = 0,
+        index: int | None = None,
+        scale: int = 1,
+        symbol: str | None = None,
+    ) -> None:
+        self.base = base
+        self.disp = disp
+        self.index = index
+        self.scale = scale
+        self.symbol = symbol
+        # What the encoding depends on, packed for the assembler's cache;
+        # the low bits tell it from a register number.  Symbols only
+        # change the relocation.
+        if symbol is None:
+            index_bits = 16 if index is None else index
+            self.key = (
+                ((disp << 5 | base) << 5 | index_bits) << 2 | _SCALE_BITS[scale]
+            ) << 5 | 16
+        else:
+            self.key = _RIP_KEY
+
+
+_SCALE_BITS = {1: 0, 2: 1, 4: 2, 8: 3}
+_RIP_KEY = 17
+
+# Opcode bytes by value: one-byte, 0F-escaped, and mandatory SSE prefixes
+_BYTES = [bytes([value]) for value in range(256)]
+_OPCODES_0F = [bytes([0x0F, value]) for value in range(256)]
+_SSE_PREFIXES = {0: b"", 0x66: b"\x66", 0xF2: b"\xf2", 0xF3: b"\xf3"}
+
+
+def fits_i32(value: int) -> bool:
+    """Whether ``value`` is a sign-extended 32-bit immediate."""
+    return -0x80000000 <= value <= 0x7FFFFFFF
+
+
+def _encoding(
+    opcode: bytes, reg: int, rm: int | Mem, w: bool, prefix: bytes, byte_regs: bool
+) -> bytes:
+    """``prefix``, REX, ``opcode`` and ModRM (with SIB and displacement).
+
+    A RIP-relative operand's displacement is left to the caller.
+    """
+    rex = 0x48 if w else 0x40
+    if reg & 8:
+        rex |= 4
+    if isinstance(rm, int):
+        if rm & 8:
+            rex |= 1
+        if rex != 0x40 or (byte_regs and (4 <= reg < 8 or 4 <= rm < 8)):
+            prefix += bytes([rex])
+        return prefix + opcode + bytes([0xC0 | (reg & 7) << 3 | rm & 7])
+
+    base, index, disp = rm.base, rm.index, rm.disp
+    if base is not None and base & 8:
+        rex |= 1
+    if index is not None and index & 8:
+        rex |= 2
+    if rex != 0x40 or (byte_regs and 4 <= reg < 8):
+        prefix += bytes([rex])
+    reg_bits = (reg & 7) << 3
+    if base is None:
+        return prefix + opcode + bytes([reg_bits | 5])
+
+    if disp == 0 and base & 7 != RBP:
+        mod, tail = 0x00, b""
+    elif -128 <= disp <= 127:
+        mod, tail = 0x40, bytes([disp & 0xFF])
+    else:
+        mod, tail = 0x80, _PACK_I32(disp)
+    if index is not None:
+        sib = _SCALE_BITS[rm.scale] << 6 | (index & 7) << 3 | base & 7
+        modrm = bytes([mod | reg_bits | 4, sib])
+    elif base & 7 == RSP:
+        modrm = bytes([mod | reg_bits | 4, 0x24])
+    else:
+        modrm = bytes([mod | reg_bits | base & 7])
+    return prefix + opcode + modrm + tail
+
+
+class Assembler:
+    """Machine code buffer with labels and relocations."""
+
+    def __init__(self) -> None:
+        self.code = bytearray()
+        # (offset, symbol, type, addend) for the object writer
+        self.relocations: list[tuple[int, str, int, int]] = []
+        # ``_encoding`` results, by opcode, prefix and packed operands
+        self._encoded: dict[tuple[bytes, bytes, int], bytes] = {}
+
+    # -- encoding core ------------------------------------------------------
+
+    def _emit(
+        self,
+        opcode: bytes,
+        reg: int,
+        rm: int | Mem,
+        *,
+        w: bool = False,
+        prefix: bytes = b"",
+        byte_regs: bool = False,
+        imm: bytes = b"",
+    ) -> None:
+        """Emit ``prefix``, REX, ``opcode``, ModRM for ``reg`` and ``rm``, ``imm``.
+
+        ``byte_regs`` asks for a REX prefix whenever a register operand is
+        SPL/BPL/SIL/DIL, which are AH/CH/DH/BH without one.
+        """
+        operand = rm.key if isinstance(rm, Mem) else rm
+        key = (opcode, prefix, ((operand << 4 | reg) << 1 | w) << 1 | byte_regs)
+        encoded = self._encoded.get(key)
+        if encoded is None:
+            encoded = _encoding(opcode, reg, rm, w, prefix, byte_regs)
+            self._encoded[key] = encoded
+        code = self.code
+        code += encoded
+        if operand == _RIP_KEY and isinstance(rm, Mem):
+            # The displacement counts from the end of the instruction, past
+            # any immediate
+            addend = rm.disp - 4 - len(imm)
+            self.relocations.append((len(code), rm.symbol, R_X86_64_PC32, addend))
+            code += b"\0\0\0\0"
+        if imm:
+            code += imm
+
+    # -- moves --------------------------------------------------------------
+
+    def mov(self, dst: int, src: int, size: int = 8) -> None:
+        """``dst = src`` between registers; 32-bit moves zero the upper half."""
+        self._emit(b"\x89", src, dst, w=size == 8)
+
+    def mov_imm(self, dst: int, value: int, size: int = 8) -> None:
+        """``dst = value``, in the shortest encoding."""
+        if size == 4:
+            value &= 0xFFFFFFFF
+        if value == 0:
+            self._emit(b"\x31", dst, dst)  # xor r32, r32
+        elif 0 <= value <= 0xFFFFFFFF:
+            if dst & 8:
+                self.code.append(0x41)
+            self.code.append(0xB8 | dst & 7)
+            self.code += _PACK_U32(value)
+        elif fits_i32(value - (1 << 64) if value >= 1 << 63 else value):
+            signed = value - (1 << 64) if value >= 1 << 63 else value
+            self._emit(b"\xc7", 0, dst, w=True, imm=_PACK_I32(signed))
+        else:
+            self.code.append(0x49 if dst & 8 else 0x48)
+            self.code.append(0xB8 | dst & 7)
+            self.code += _PACK_Q(value & 0xFFFFFFFFFFFFFFFF)
+
+    def load(self, dst: int, mem: Mem, size: int = 8) -> None:
+        """``dst = [mem]``; 4-byte loads zero the upper half."""
+        self._emit(b"\x8b", dst, mem, w=size == 8)
+
+    def store(self, mem: Mem, src: int, size: int = 8) -> None:
+        """``[mem] = src`` for 1, 2, 4 or 8 bytes."""
+        if size == 1:
+            self._emit(b"\x88", src, mem, byte_regs=True)
+        elif size == 2:
+            self._emit(b"\x89", src, mem, prefix=b"\x66")
+        else:
+            self._emit(b"\x89", src, mem, w=size == 8)
+
+    def store_imm(self, mem: Mem, value: int, size: int = 8) -> None:
+        """``[mem] = value``; 8-byte stores sign-extend a 32-bit ``value``."""
+        if size == 1:
+            self._emit(b"\xc6", 0, mem, imm=_BYTES[value & 0xFF])
+        elif size == 2:
+            imm = (value & 0xFFFF).to_bytes(2, "little")
+            self._emit(b"\xc7", 0, mem, prefix=b"\x66", imm=imm)
+        elif size == 4:
+            self._emit(b"\xc7", 0, mem, imm=_PACK_U32(value & 0xFFFFFFFF))
+        else:
+            self._emit(b"\xc7", 0, mem, w=True, imm=_PACK_I32(value))
+
+    def load_extend(
+        self, dst: int, mem: Mem, size: int, *, signed: bool, w: bool
+    ) -> None:
+        """Load 1, 2 or 4 bytes, sign- or zero-extended to 32 or 64 (``w``) bits."""
+        if size == 4:
+            if signed:
+                self._emit(b"\x63", dst, mem, w=True)  # movsxd
+            else:
+                self._emit(b"\x8b", dst, mem)
+            return
+        opcode = {(1, False): b"\x0f\xb6", (2, False): b"\x0f\xb7",
+                  (1, True): b"\x0f\xbe", (2, True): b"\x0f\xbf"}[size, signed]
+        self._emit(opcode, dst, mem, w=w and signed)
+
+    def extend(self, dst: int, src: int, size: int, *, w: bool) -> None:
+        """Sign-extend the low 1, 2 or 4 bytes of ``src`` to 32 or 64 (``w``) bits."""
+        if size == 4:
+            self._emit(b"\x63", dst, src, w=True)
+        elif size == 2:
+            self._emit(b"\x0f\xbf", dst, src, w=w)
+        else:
+            self._emit(b"\x0f\xbe", dst, src, w=w, byte_regs=True)
+
+    def lea(self, dst: int, mem: Mem) -> None:
+        self._emit(b"\x8d", dst, mem, w=True)
+
+    def lea_label(self, dst: int, label: Label) -> None:
+        """``dst = &label``, RIP-relative."""
+        code = self.code
+        code += bytes([0x4C if dst & 8 else 0x48, 0x8D, (dst & 7) << 3 | 5])
+        self._rel32(label)
+
+    def load_got(self, dst: int, symbol: str) -> None:
+        """``dst = &symbol`` through the GOT, for symbols possibly in a DSO."""
+        code = self.code
+        code.append(0x4C if dst & 8 else 0x48)
+        code += b"\x8b"
+        code.append((dst & 7) << 3 | 5)
+        self.relocations.append((len(code), symbol, R_X86_64_REX_GOTPCRELX, -4))
+        code += b"\0\0\0\0"
+
+    # -- integer arithmetic -------------------------------------------------
+
+    def alu(self, op: int, dst: int, src: int | Mem, size: int = 8) -> None:
+        """``dst = dst <op> src`` for a register or memory ``src``."""
+        self._emit(_BYTES[op * 8 + 3], dst, src, w=size == 8)
+
+    def alu_imm(self, op: int, dst: int | Mem, value: int, size: int = 8) -> None:
+        """``dst = dst <op> value`` for a sign-extended 32-bit ``value``."""
+        if -128 <= value <= 127:
+            self._emit(b"\x83", op, dst, w=size == 8, imm=_BYTES[value & 0xFF])
+        else:
+            self._emit(b"\x81", op, dst, w=size == 8, imm=_PACK_I32(value))
+
+    def imul(self, dst: int, src: int | Mem, size: int = 8) -> None:
+        self._emit(b"\x0f\xaf", dst, src, w=size == 8)
+
+    def imul_imm(self, dst: int, src: int, value: int, size: int = 8) -> None:
+        if -128 <= value <= 127:
+            self._emit(b"\x6b", dst, src, w=size == 8, imm=_BYTES[value & 0xFF])
+        else:
+            self._emit(b"\x69", dst, src, w=size == 8, imm=_PACK_I32(value))
+
+    def div(self, src: int, size: int = 8, *, signed: bool) -> None:
+        """Divide RDX:RAX by ``src``: quotient in RAX, remainder in RDX."""
+        self._emit(b"\xf7", 7 if signed else 6, src, w=size == 8)
+
+    def sign_extend_rax(self, size: int = 8) -> None:
+        """CDQ/CQO: sign-extend RAX into RDX."""
+        if size == 8:
+            self.code.append(0x48)
+        self.code.append(0x99)
+
+    def neg(self, dst: int, size: int = 8) -> None:
+        self._emit(b"\xf7", 3, dst, w=size == 8)
+
+    def shift(self, op: int, dst: int, size: int = 8) -> None:
+        """Shift or rotate ``dst`` by CL (masked by the CPU like WASM)."""
+        self._emit(b"\xd3", op, dst, w=size == 8)
+
+    def shift_imm(self, op: int, dst: int, count: int, size: int = 8) -> None:
+        self._emit(b"\xc1", op, dst, w=size == 8, imm=_BYTES[count & (size * 8 - 1)])
+
+    def bit_test(self, op: int, dst: int, bit: int, size: int = 8) -> None:
+        """BT (4), BTS (5), BTR (6) or BTC (7) of ``bit`` in ``dst``."""
+        self._emit(b"\x0f\xba", op, dst, w=size == 8, imm=_BYTES[bit])
+
+    def bit_scan(self, dst: int, src: int, size: int = 8, *, reverse: bool) -> None:
+        """BSR (``reverse``) or BSF; ZF is set when ``src`` is zero."""
+        self._emit(b"\x0f\xbd" if reverse else b"\x0f\xbc", dst, src, w=size == 8)
+
+    def test(self, a: int, b: int, size: int = 8) -> None:
+        self._emit(b"\x85", b, a, w=size == 8)
+
+    def setcc(self, cc: int, dst: int) -> None:
+        """Set the low byte of ``dst`` to condition ``cc``."""
+        self._emit(_OPCODES_0F[0x90 | cc], 0, dst, byte_regs=True)
+
+    def movzx_byte(self, dst: int, src: int) -> None:
+        """``dst = low byte of src``, zero-extended to 64 bits."""
+        self._emit(b"\x0f\xb6", dst, src, byte_regs=True)
+
+    def and_byte(self, dst: int, src: int, *, op: int = AND) -> None:
+        """``dst = dst <op> src`` on the low bytes."""
+        self._emit(_BYTES[op * 8 + 2], dst, src, byte_regs=True)
+
+    def cmov(self, cc: int, dst: int, src: int | Mem, size: int = 8) -> None:
+        self._emit(_OPCODES_0F[0x40 | cc], dst, src, w=size == 8)
+
+    # -- SSE ----------------------------------------------------------------
+
+    def sse(
+        self, prefix: int, opcode: int, dst: int, src: int | Mem, *, w: bool = False
+    ) -> None:
+        """A two-operand SSE instruction ``0F opcode`` with a mandatory prefix.
+
+        ``prefix`` is 0xF3 (scalar single), 0xF2 (scalar double), 0x66 or 0
+        for none.
+        """
+        self._emit(_OPCODES_0F[opcode], dst, src, w=w, prefix=_SSE_PREFIXES[prefix])
+
+    def movd_to_xmm(self, dst: int, src: int, size: int) -> None:
+        """MOVD/MOVQ from a general-purpose register."""
+        self.sse(0x66, 0x6E, dst, src, w=size == 8)
+
+    def movd_from_xmm(self, dst: int, src: int, size: int) -> None:
+        """MOVD/MOVQ to a general-purpose register."""
+        self.sse(0x66, 0x7E, src, dst, w=size == 8)
+
+    def movaps(self, dst: int, src: int) -> None:
+        self.sse(0, 0x28, dst, src)
+
+    # -- control flow -------------------------------------------------------
+
+    def bind(self, label: Label) -> None:
+        """Place ``label`` here and patch the jumps waiting for it."""
+        pos = label.pos = len(self.code)
+        for field, base in label.fixups:
+            _PATCH_I32(self.code, field, pos - base)
+        label.fixups.clear()
+
+    def _rel32(self, label: Label) -> None:
+        code = self.code
+        field = len(code)
+        code += b"\0\0\0\0"
+        if label.pos is not None:
+            _PATCH_I32(code, field, label.pos - (field + 4))
+        else:
+            label.fixups.append((field, field + 4))
+
+    def jmp(self, label: Label) -> None:
+        if label.pos is not None and -128 <= label.pos - (len(self.code) + 2):
+            self.code += bytes([0xEB, (label.pos - len(self.code) - 2) & 0xFF])
+            return
+        self.code.append(0xE9)
+        self._rel32(label)
+
+    def jcc(self, cc: int, label: Label) -> None:
+        if label.pos is not None and -128 <= label.pos - (len(self.code) + 2):
+            self.code += bytes([0x70 | cc, (label.pos - len(self.code) - 2) & 0xFF])
+            return
+        self.code += bytes([0x0F, 0x80 | cc])
+        self._rel32(label)
+
+    def jmp_reg(self, target: int) -> None:
+        self._emit(b"\xff", 4, target)
+
+    def call_symbol(self, symbol: str) -> None:
+        """Call ``symbol`` through the PLT if it ends up in a DSO."""
+        code = self.code
+        code.append(0xE8)
+        self.relocations.append((len(code), symbol, R_X86_64_PLT32, -4))
+        code += b"\0\0\0\0"
+
+    def call_rel32(self) -> int:
+        """Call with the displacement left to patch; returns the field's offset."""
+        self.code.append(0xE8)
+        self.code += b"\0\0\0\0"
+        return len(self.code) - 4
+
+    def call_reg(self, target: int | Mem) -> None:
+        self._emit(b"\xff", 2, target)
+
+    def table_entry(self, label: Label, base: int) -> None:
+        """A 32-bit jump table entry: ``label``'s offset from ``base``."""
+        code = self.code
+        field = len(code)
+        code += b"\0\0\0\0"
+        if label.pos is not None:
+            _PATCH_I32(code, field, label.pos - base)
+        else:
+            label.fixups.append((field, base))
+
+    def push(self, reg: int) -> None:
+        if reg & 8:
+            self.code.append(0x41)
+        self.code.append(0x50 | reg & 7)
+
+    def pop(self, reg: int) -> None:
+        if reg & 8:
+            self.code.append(0x41)
+        self.code.append(0x58 | reg & 7)
+
+    def leave_ret(self) -> None:
+        self.code += b"\xc9\xc3"
+
+    def ret(self) -> None:
+        self.code.append(0xC3)
+
+    def rep_stosq(self) -> None:
+        self.code += b"\xf3\x48\xab"
+
+    def patch_i32(self, offset: int, value: int) -> None:
+        _PATCH_I32(self.code, offset, value)
+
+    def align(self, boundary: int) -> None:
+        """Pad with INT3 to a multiple of ``boundary``."""
+        self.code += b"\xcc" * (-len(self.code) % boundary)
@@ -2,6 +2,8 @@
 
 from __future__ import annotations
 
+import math
+import struct
 from typing import TYPE_CHECKING
 
 from qbepy import Function, Module
@@ -10,14 +12,17 @@ from qbepy.ir import (
     BinaryOp,
     Branch,
     Call,
+    Conversion,
     D,
     DataDef,
+    FloatConst,
     Global,
     Halt,
     IntConst,
     Jump,
     L,
     Label,
+    Load,
     Phi,
     Return,
     S,
@@ -28,11 +33,18 @@ from qbepy.ir import (
 
 from waq.errors import CompileError
 from waq.parser.binary import BinaryReader
+from waq.parser.code import iter_instructions, skip_unreachable
 from waq.parser.module import ExportKind, WasmModule
 from waq.parser.types import ValueType
 
-from .context import FunctionContext, ModuleContext
-from .instructions.control import compile_control_instruction
+from . import ssa
+from .context import ControlFrame, FunctionContext, ModuleContext
+from .deterministic import canonicalize_nans
+from .instructions.control import (
+    _emit_return,
+    compile_control_instruction,
+    emit_branch_to_depth,
+)
 from .instructions.conversion import (
     compile_conversion_instruction,
     compile_saturating_conversion,
@@ -45,22 +57,55 @@ from .instructions.memory import (
 )
 from .instructions.numeric import compile_numeric_instruction
 from .instructions.reference import compile_reference_instruction
+from .instructions.simd import (
+    alloc_v128,
+    compile_simd_instruction,
+    copy_v128,
+    zero_v128,
+)
 from .instructions.table import (
     compile_table_bulk_instruction,
     compile_table_instruction,
 )
 from .instructions.variable import compile_variable_instruction
+from .passes import ModuleFacts, PassManager
+from .profile import instrument_functions
 from .stack import ValueStack
+from .tailcalls import merge_tail_call_groups
 
 if TYPE_CHECKING:
     from qbepy.ir import Block
 
-
-def compile_module(wasm_module: WasmModule, target: str = "amd64_sysv") -> Module:
-    """Compile a WASM module to a QBE module."""
+    from .profile import Instrumentation, Profile
+
+
+def compile_module(
+    wasm_module: WasmModule,
+    target: str = "amd64_sysv",
+    opt_level: int = 0,
+    *,
+    lto: bool = False,
+    instrument: bool = False,
+    profile: Profile | None = None,
+    deterministic: bool = False,
+) -> Module:
+    """Compile a WASM module to a QBE module.
+
+    ``opt_level`` selects the optimization pipeline run over the compiled
+    functions before they are added to the module (see ``waq.compiler.passes``).
+    ``lto`` inlines the hot runtime helpers, tying the output to this
+    version's runtime.  ``instrument`` adds the PGO counters, and
+    ``profile`` guides the passes with the counts of an instrumented build
+    (see ``waq.compiler.profile``).  ``deterministic`` canonicalizes NaN
+    results and gives relaxed SIMD its deterministic results, so that float
+    bits agree across targets (see ``waq.compiler.deterministic``).
+    """
+    pass_manager = PassManager(opt_level, lto=lto)
     qbe_module = Module()
 
-    mod_ctx = ModuleContext(module=wasm_module, qbe_module=qbe_module)
+    mod_ctx = ModuleContext(
+        module=wasm_module, qbe_module=qbe_module, deterministic=deterministic
+    )
 
     # Compile globals
     _compile_globals(mod_ctx, qbe_module)
@@ -70,9 +115,33 @@ def compile_module(wasm_module: WasmModule, target: str = "amd64_sysv") -> Modul
 
     # Compile functions
     num_imports = wasm_module.num_imported_funcs()
-    for i, body in enumerate(wasm_module.code):
-        func_idx = num_imports + i
-        _compile_function(mod_ctx, qbe_module, func_idx, body)
+    functions = [
+        _compile_function(mod_ctx, num_imports + i, body)
+        for i, body in enumerate(wasm_module.code)
+    ]
+    if instrument:
+        mod_ctx.profile_counters = instrument_functions(functions)
+    if profile is not None:
+        profile = profile.matching(functions)
+    if deterministic:
+        for func in functions:
+            canonicalize_nans(func)
+    merge_tail_call_groups(functions, mod_ctx.tail_calls, _address_taken(mod_ctx))
+    facts = ModuleFacts(
+        roots=_referenced_functions(mod_ctx),
+        table=_static_table(mod_ctx),
+        initial_table=_initial_table(mod_ctx),
+        profile=profile,
+        constant_globals=_constant_globals(mod_ctx),
+        mutable_globals=_mutable_globals(mod_ctx),
+    )
+    pass_manager.run(functions, facts)
+    for func in functions:
+        qbe_module.add_function(func)
+    if mod_ctx.needs_funcref_sig:
+        qbe_module.add_function(_compile_funcref_sig(mod_ctx))
+    if mod_ctx.profile_counters is not None:
+        _compile_profile_counters(mod_ctx.profile_counters, qbe_module)
 
     # Always generate memory/table initialization function
     # (main stub always calls it)
@@ -81,6 +150,162 @@ def compile_module(wasm_module: WasmModule, target: str = "amd64_sysv") -> Modul
     return qbe_module
 
 
+def _referenced_functions(mod_ctx: ModuleContext) -> frozenset[str]:
+    """Functions referenced from outside the compiled function bodies."""
+    module = mod_ctx.module
+    indices = {exp.index for exp in module.exports if exp.kind == ExportKind.FUNC}
+    if module.start is not None:
+        indices.add(module.start)
+    for elem_seg in module.elements:
+        indices.update(elem_seg.func_indices)
+    if mod_ctx.needs_funcref_sig:
+        indices.update(mod_ctx.ref_funcs)
+    return frozenset(mod_ctx.get_func_name(i) for i in indices)
+
+
+def _address_taken(mod_ctx: ModuleContext) -> frozenset[str]:
+    """Functions a table slot or funcref value can point to."""
+    indices = set(mod_ctx.ref_funcs)
+    for elem_seg in mod_ctx.module.elements:
+        indices.update(elem_seg.func_indices)
+    return frozenset(mod_ctx.get_func_name(i) for i in indices)
+
+
+def _static_table(mod_ctx: ModuleContext) -> dict[int, tuple[str, int]] | None:
+    """Table 0's slots as (function name, signature id), if they never change.
+
+    That is when the module's only table is its own (not imported or
+    exported, so the host cannot touch it), no compiled code writes it, and
+    every active element segment has a constant offset.  Slots left empty
+    are missing from the map.
+    """
+    module = mod_ctx.module
+    if (
+        len(module.all_tables()) != 1
+        or not module.tables
+        or mod_ctx.table_written
+        or any(exp.kind == ExportKind.TABLE for exp in module.exports)
+    ):
+        return None
+    return _initial_table(mod_ctx, constant_offsets=True)
+
+
+def _initial_table(
+    mod_ctx: ModuleContext, *, constant_offsets: bool = False
+) -> dict[int, tuple[str, int]] | None:
+    """Table 0's slots as the active element segments fill them.
+
+    With ``constant_offsets``, None if a segment's offset is not known at
+    compile time (it depends on an imported global); otherwise such segments
+    are skipped.
+    """
+    module = mod_ctx.module
+    if not module.all_tables():
+        return {}
+    size = module.all_tables()[0].limits.min
+    slots = {}
+    for elem_seg in module.elements:
+        if elem_seg.table_idx < 0:
+            continue  # Passive segments only reach the table via table.init
+        offset = eval_init_expr(elem_seg.offset_expr, mod_ctx)
+        if offset is None:
+            if constant_offsets:
+                return None
+            continue
+        offset = int(offset)
+        for j, func_idx in enumerate(elem_seg.func_indices):
+            if 0 <= offset + j < size:
+                sig = mod_ctx.signature_id(module.get_func_type_idx(func_idx))
+                slots[offset + j] = (mod_ctx.get_func_name(func_idx), sig)
+    return slots
+
+
+def _constant_globals(mod_ctx: ModuleContext) -> dict[str, int | float]:
+    """Values of the immutable numeric globals, by symbol, where known.
+
+    That is when the initializer evaluates at compile time (it reads no
+    imported global) to a finite value.
+    """
+    module = mod_ctx.module
+    num_imports = module.num_imported_globals()
+    evaluated_globals: dict[int, int | float | None] = {}
+    values = {}
+    for i, glob in enumerate(module.globals):
+        value = eval_init_expr(glob.init_expr, mod_ctx, evaluated_globals)
+        evaluated_globals[i + num_imports] = value
+        vtype = glob.type.value_type
+        if glob.type.mutable or vtype.is_reference() or vtype == ValueType.V128:
+            continue
+        if value is None or (isinstance(value, float) and not math.isfinite(value)):
+            continue
+        values[mod_ctx.get_global_name(i + num_imports)] = value
+    return values
+
+
+def _mutable_globals(mod_ctx: ModuleContext) -> frozenset[str]:
+    """Symbols of the mutable globals, imported or defined."""
+    return frozenset(
+        mod_ctx.get_global_name(idx)
+        for idx, global_type in enumerate(mod_ctx.module.all_global_types())
+        if global_type.mutable
+    )
+
+
+def _compile_profile_counters(counters: Instrumentation, qbe_module: Module) -> None:
+    """Emit the PGO counters and their descriptions (``waq.compiler.profile``)."""
+    data = DataDef("__wasm_prof_counters")
+    data.items.append(("z", [8 * counters.slots]))
+    qbe_module.add_data(data)
+    data = DataDef("__wasm_prof_names")
+    data.items.append(("b", counters.names_data()))
+    qbe_module.add_data(data)
+
+
+def _compile_funcref_sig(mod_ctx: ModuleContext) -> Function:
+    """Generate ``w $__wasm_funcref_sig(l %ref)``: a funcref's signature id.
+
+    Table writes from compiled code (table.set, table.grow, table.fill) store
+    a signature id next to the code pointer.  Only functions in element
+    segments or named by ref.func can be funcref values, so a compare chain
+    over those finds it; null (or anything else) gets 0, which
+    ``call_indirect`` rejects.  The chain is linear, but table writes are
+    rare next to the calls they enable.
+    """
+    module = mod_ctx.module
+    indices = set(mod_ctx.ref_funcs)
+    for elem_seg in module.elements:
+        indices.update(elem_seg.func_indices)
+
+    func = Function("__wasm_funcref_sig", return_type=W, params=[(L, "ref")])
+    block = func.add_block("entry")
+    sig_blocks: dict[int, Label] = {}
+    for k, func_idx in enumerate(sorted(indices)):
+        sig = mod_ctx.signature_id(module.get_func_type_idx(func_idx))
+        if sig not in sig_blocks:
+            sig_blocks[sig] = Label(f"sig{sig}")
+        block.instructions.append(
+            BinaryOp(
+                result=Temporary(f"is{k}"),
+                result_type=W,
+                op="ceql",
+                left=Temporary("ref"),
+                right=Global(mod_ctx.get_func_name(func_idx)),
+            )
+        )
+        following = func.add_block(f"next{k}")
+        block.terminator = Branch(
+            condition=Temporary(f"is{k}"),
+            if_true=sig_blocks[sig],
+            if_false=following.label,
+        )
+        block = following
+    block.terminator = Return(value=IntConst(0))
+
+    for sig, label in sig_blocks.items():
+        func.add_block(label.name).terminator = Return(value=IntConst(sig))
+    return func
+
+
 def _compile_data_segments(mod_ctx: ModuleContext, qbe_module: Module) -> None:
     """Compile data segments as QBE data definitions."""
     for i, segment in enumerate(mod_ctx.module.data):
@@ -107,6 +332,22 @@ def _compile_memory_init(mod_ctx: ModuleContext, qbe_module: Module) -> None:
     init_func = Function("__wasm_memory_init", return_type=None, params=[], export=True)
     entry_block = init_func.add_block("entry")
 
+    # Instrumented builds write their counters at exit
+    if mod_ctx.profile_counters is not None:
+        entry_block.instructions.append(
+            Call(
+                target=Global("__wasm_prof_register"),
+                args=[
+                    (L, Global("__wasm_prof_counters")),
+                    (L, Global("__wasm_prof_names")),
+                ],
+            )
+        )
+
+    # Running the initializer again after __wasm_instance_reset() must yield
+    # a fresh instance, so mutable globals are restored as well
+    _compile_global_reset(mod_ctx, entry_block)
+
     # Initialize memory with initial pages
     if mod_ctx.module.memories:
         mem = mod_ctx.module.memories[0]
@@ -124,13 +365,27 @@ def _compile_memory_init(mod_ctx: ModuleContext, qbe_module: Module) -> None:
         if segment.memory_idx == -1:
             continue  # Skip passive segments
 
-        # Evaluate offset expression
-        offset = _eval_init_expr(segment.offset_expr, mod_ctx)
         data_len = len(segment.data)
 
         if data_len == 0:
             continue
 
+        # Evaluate offset expression, at instantiation if it depends on an
+        # imported global
+        offset = eval_init_expr(segment.offset_expr, mod_ctx)
+        if offset is None:
+            offset_value = _emit_init_expr(
+                segment.offset_expr, mod_ctx, {}, entry_block, f"data_offset_{i}"
+            )
+            offset = Temporary(f"data_offset_{i}")
+            entry_block.instructions.append(
+                Conversion(
+                    op="extuw", result=offset, result_type=L, operand=offset_value
+                )
+            )
+        else:
+            offset = IntConst(int(offset))
+
         # Get memory base pointer
         mem_base = f"mem_base_{i}"
         entry_block.instructions.append(
@@ -150,7 +405,7 @@ def _compile_memory_init(mod_ctx: ModuleContext, qbe_module: Module) -> None:
                 result_type=L,
                 op="add",
                 left=Temporary(mem_base),
-                right=IntConst(int(offset)),
+                right=offset,
             )
         )
 
@@ -175,31 +430,58 @@ def _compile_memory_init(mod_ctx: ModuleContext, qbe_module: Module) -> None:
             entry_block.instructions.append(
                 Call(
                     target=Global("__wasm_table_grow"),
-                    args=[(W, IntConst(initial_size)), (L, IntConst(0))],
+                    args=[
+                        (W, IntConst(0)),
+                        (L, IntConst(0)),
+                        (W, IntConst(0)),
+                        (W, IntConst(initial_size)),
+                    ],
                 )
             )
 
     # Initialize element segments
-    for elem_seg in mod_ctx.module.elements:
+    for k, elem_seg in enumerate(mod_ctx.module.elements):
         if elem_seg.table_idx < 0:
             continue  # Skip passive segments
 
-        # Evaluate offset expression
-        offset = _eval_init_expr(elem_seg.offset_expr, mod_ctx)
+        # Evaluate offset expression, at instantiation if it depends on an
+        # imported global
+        offset = eval_init_expr(elem_seg.offset_expr, mod_ctx)
+        if offset is None:
+            offset = _emit_init_expr(
+                elem_seg.offset_expr, mod_ctx, {}, entry_block, f"elem_offset_{k}"
+            )
 
         # For each function index, set the table entry
         for j, func_idx in enumerate(elem_seg.func_indices):
             # Calculate table index
-            table_idx = int(offset) + j
+            if isinstance(offset, Temporary) and j == 0:
+                table_idx = offset
+            elif isinstance(offset, Temporary):
+                table_idx = Temporary(f"elem_index_{k}_{j}")
+                entry_block.instructions.append(
+                    BinaryOp(
+                        result=table_idx,
+                        result_type=W,
+                        op="add",
+                        left=offset,
+                        right=IntConst(j),
+                    )
+                )
+            else:
+                table_idx = IntConst(int(offset) + j)
             func_name = mod_ctx.get_func_name(func_idx)
+            sig = mod_ctx.signature_id(mod_ctx.module.get_func_type_idx(func_idx))
 
-            # Set table[table_idx] = func_ptr
+            # Set table[table_idx] = (func_ptr, sig)
             entry_block.instructions.append(
                 Call(
                     target=Global("__wasm_table_set"),
                     args=[
-                        (W, IntConst(table_idx)),
+                        (W, IntConst(elem_seg.table_idx)),
+                        (W, table_idx),
                         (L, Global(func_name)),
+                        (W, IntConst(sig)),
                     ],
                 )
             )
@@ -218,13 +500,116 @@ def _compile_memory_init(mod_ctx: ModuleContext, qbe_module: Module) -> None:
     qbe_module.add_function(init_func)
 
 
+def _compile_global_reset(mod_ctx: ModuleContext, block: Block) -> None:
+    """Store the initial value of every mutable numeric global.
+
+    Floats are stored by bit pattern so the value round-trips exactly.
+    Globals whose initializer reads an imported global, mutable or not, are
+    computed here in the first place.
+    """
+    evaluated_globals: dict[int, int | float | None] = {}
+    num_imports = mod_ctx.module.num_imported_globals()
+
+    for i, glob in enumerate(mod_ctx.module.globals):
+        global_idx = i + num_imports
+        init_value = eval_init_expr(glob.init_expr, mod_ctx, evaluated_globals)
+        evaluated_globals[global_idx] = init_value
+        vtype = glob.type.value_type
+        if init_value is None and vtype == ValueType.V128:
+            # The initializer reads an imported v128 global
+            reader = BinaryReader(glob.init_expr[1:])
+            _copy_v128_global(
+                block,
+                mod_ctx.get_global_name(global_idx),
+                mod_ctx.get_global_name(reader.read_u32_leb128()),
+                f"global_{i}",
+            )
+            continue
+        if init_value is None and not vtype.is_reference():
+            value = _emit_init_expr(
+                glob.init_expr, mod_ctx, evaluated_globals, block, f"global_{i}"
+            )
+            block.instructions.append(
+                Store(
+                    store_type=_vtype_to_store_type(vtype),
+                    value=value,
+                    address=Global(mod_ctx.get_global_name(global_idx)),
+                )
+            )
+            continue
+        if not glob.type.mutable:
+            continue
+
+        if vtype == ValueType.I32:
+            store_type, bits = "storew", int(init_value)
+        elif vtype == ValueType.I64:
+            store_type, bits = "storel", int(init_value)
+        elif vtype == ValueType.F32:
+            store_type = "storew"
+            bits = struct.unpack("<i", struct.pack("<f", init_value))[0]
+        elif vtype == ValueType.F64:
+            store_type = "storel"
+            bits = struct.unpack("<q", struct.pack("<d", init_value))[0]
+        elif vtype == ValueType.V128:
+            symbol = Global(mod_ctx.get_global_name(global_idx))
+            high = Temporary(f"global_{i}_high")
+            low_bits, high_bits = _v128_halves(int(init_value))
+            block.instructions += [
+                Store(store_type="storel", value=IntConst(low_bits), address=symbol),
+                BinaryOp(
+                    result=high, result_type=L, op="add", left=symbol, right=IntConst(8)
+                ),
+                Store(store_type="storel", value=IntConst(high_bits), address=high),
+            ]
+            continue
+        else:
+            continue
+
+        block.instructions.append(
+            Store(
+                store_type=store_type,
+                value=IntConst(bits),
+                address=Global(mod_ctx.get_global_name(global_idx)),
+            )
+        )
+
+
+def _copy_v128_global(block: Block, dest: str, source: str, prefix: str) -> None:
+    """Copy the 16 bytes of v128 global ``source`` into ``dest``."""
+    src_high = Temporary(f"{prefix}_src")
+    dst_high = Temporary(f"{prefix}_dst")
+    block.instructions += [
+        BinaryOp(
+            result=src_high,
+            result_type=L,
+            op="add",
+            left=Global(source),
+            right=IntConst(8),
+        ),
+        BinaryOp(
+            result=dst_high,
+            result_type=L,
+            op="add",
+            left=Global(dest),
+            right=IntConst(8),
+        ),
+    ]
+    halves = ((Global(source), Global(dest)), (src_high, dst_high))
+    for half, (src, dst) in enumerate(halves):
+        value = Temporary(f"{prefix}_{half}")
+        block.instructions += [
+            Load(result=value, result_type=L, address=src, load_type="loadl"),
+            Store(store_type="storel", value=value, address=dst),
+        ]
+
+
 def _compile_globals(mod_ctx: ModuleContext, qbe_module: Module) -> None:
     """Compile global variable definitions.
 
     Handles global.get references by evaluating globals in dependency order.
     """
     # Track evaluated global values for handling global.get references
-    evaluated_globals: dict[int, int | float] = {}
+    evaluated_globals: dict[int, int | float | None] = {}
     num_imports = mod_ctx.module.num_imported_globals()
 
     for i, glob in enumerate(mod_ctx.module.globals):
@@ -234,10 +619,12 @@ def _compile_globals(mod_ctx: ModuleContext, qbe_module: Module) -> None:
 
         # Evaluate init expression to get initial value
         # Pass evaluated_globals to handle global.get references
-        init_value = _eval_init_expr(glob.init_expr, mod_ctx, evaluated_globals)
+        init_value = eval_init_expr(glob.init_expr, mod_ctx, evaluated_globals)
 
         # Store the evaluated value for potential references by later globals
         evaluated_globals[global_idx] = init_value
+        if init_value is None:
+            init_value = 0  # Set by __wasm_memory_init (_compile_global_reset)
 
         # Create data definition
         data = DataDef(global_name)
@@ -249,15 +636,37 @@ def _compile_globals(mod_ctx: ModuleContext, qbe_module: Module) -> None:
             data.add_singles(float(init_value))
         elif vtype == ValueType.F64:
             data.add_doubles(float(init_value))
+        elif vtype == ValueType.V128:
+            data.add_longs(*_v128_halves(int(init_value)))
         qbe_module.add_data(data)
 
 
-def _eval_init_expr(
+def _v128_halves(value: int) -> tuple[int, int]:
+    """The low and high 64 bits of a v128 constant, as signed longs."""
+    return _wrap(value, 64), _wrap(value >> 64, 64)
+
+
+# Integer operators of extended constant expressions: opcode -> (op, bits)
+_CONST_EXPR_OPS = {
+    0x6A: ("add", 32),
+    0x6B: ("sub", 32),
+    0x6C: ("mul", 32),
+    0x7C: ("add", 64),
+    0x7D: ("sub", 64),
+    0x7E: ("mul", 64),
+}
+
+
+def eval_init_expr(
     expr: bytes,
     mod_ctx: ModuleContext,
-    evaluated_globals: dict[int, int | float] | None = None,
-) -> int | float:
-    """Evaluate a constant initialization expression.
+    evaluated_globals: dict[int, int | float | None] | None = None,
+) -> int | float | None:
+    """Evaluate a constant expression at compile time.
+
+    Handles extended constant expressions: ``*.const``, ``global.get`` and
+    ``i32``/``i64`` ``add``, ``sub`` and ``mul``, wrapping like WASM.  A
+    ``v128.const`` evaluates to its 128 bits as an unsigned integer.
 
     Args:
         expr: The init expression bytecode
@@ -266,7 +675,9 @@ def _eval_init_expr(
                           (for handling global.get references)
 
     Returns:
-        The evaluated constant value
+        The evaluated constant value, or None when it depends on an imported
+        global (``_emit_init_expr`` computes it at instantiation) or on
+        anything else that is not a number known at compile time
     """
     if not expr:
         return 0
@@ -275,43 +686,133 @@ def _eval_init_expr(
         evaluated_globals = {}
 
     reader = BinaryReader(expr)
-    opcode = reader.read_byte()
+    stack: list[int | float] = []
+    while not reader.at_end:
+        opcode = reader.read_byte()
+        if opcode == 0x0B:  # end
+            break
+        if opcode == 0x41:  # i32.const
+            stack.append(reader.read_s32_leb128())
+        elif opcode == 0x42:  # i64.const
+            stack.append(reader.read_s64_leb128())
+        elif opcode == 0x43:  # f32.const
+            stack.append(reader.read_f32())
+        elif opcode == 0x44:  # f64.const
+            stack.append(reader.read_f64())
+        elif opcode == 0xFD and reader.read_u32_leb128() == 0x0C:  # v128.const
+            stack.append(int.from_bytes(reader.read_bytes(16), "little"))
+        elif opcode == 0x23:  # global.get
+            value = _eval_global(reader.read_u32_leb128(), mod_ctx, evaluated_globals)
+            if value is None:
+                return None
+            stack.append(value)
+        elif opcode in _CONST_EXPR_OPS and len(stack) >= 2:
+            op, bits = _CONST_EXPR_OPS[opcode]
+            right, left = int(stack.pop()), int(stack.pop())
+            stack.append(_wrap(_apply_const_op(op, left, right), bits))
+        else:
+            return None
+    return stack[-1] if len(stack) == 1 else None
 
-    if opcode == 0x41:  # i32.const
-        return reader.read_s32_leb128()
-    if opcode == 0x42:  # i64.const
-        return reader.read_s64_leb128()
-    if opcode == 0x43:  # f32.const
-        return reader.read_f32()
-    if opcode == 0x44:  # f64.const
-        return reader.read_f64()
-    if opcode == 0x23:  # global.get
-        global_idx = reader.read_u32_leb128()
-
-        # Check if we've already evaluated this global
-        if global_idx in evaluated_globals:
-            return evaluated_globals[global_idx]
-
-        # For imported globals, we can't know the value at compile time
-        # Return 0 as a placeholder (runtime will need to handle this)
-        num_imports = mod_ctx.module.num_imported_globals()
-        if global_idx < num_imports:
-            # Imported global - return 0 as placeholder
-            # TODO: Could emit code to load from imported global at runtime
-            return 0
-
-        # For module-defined globals, recursively evaluate their init expr
-        local_idx = global_idx - num_imports
-        if local_idx < len(mod_ctx.module.globals):
-            glob = mod_ctx.module.globals[local_idx]
-            value = _eval_init_expr(glob.init_expr, mod_ctx, evaluated_globals)
-            evaluated_globals[global_idx] = value
-            return value
-
-        # Global index out of bounds
-        return 0
 
-    return 0
+def _eval_global(
+    global_idx: int,
+    mod_ctx: ModuleContext,
+    evaluated_globals: dict[int, int | float | None],
+) -> int | float | None:
+    """The initial value of a global, if known at compile time."""
+    if global_idx in evaluated_globals:
+        return evaluated_globals[global_idx]
+    # Imported globals get their values from the host at link time
+    num_imports = mod_ctx.module.num_imported_globals()
+    local_idx = global_idx - num_imports
+    if not 0 <= local_idx < len(mod_ctx.module.globals):
+        return None
+    glob = mod_ctx.module.globals[local_idx]
+    value = eval_init_expr(glob.init_expr, mod_ctx, evaluated_globals)
+    evaluated_globals[global_idx] = value
+    return value
+
+
+def _apply_const_op(op: str, left: int, right: int) -> int:
+    if op == "add":
+        return left + right
+    if op == "sub":
+        return left - right
+    return left * right
+
+
+def _wrap(value: int, bits: int) -> int:
+    """``value`` as a signed ``bits``-bit integer."""
+    value &= (1 << bits) - 1
+    return value - (1 << bits) if value >> (bits - 1) else value
+
+
+def _emit_init_expr(
+    expr: bytes,
+    mod_ctx: ModuleContext,
+    evaluated_globals: dict[int, int | float | None],
+    block: Block,
+    prefix: str,
+) -> IntConst | FloatConst | Temporary:
+    """Append IL to ``block`` that computes a constant expression.
+
+    For expressions ``eval_init_expr`` cannot evaluate: globals without a
+    known value are loaded from their symbols, which the host defines for
+    imported globals and which earlier initializers have set otherwise.
+    Temporaries are named ``prefix`` and a counter.
+    """
+    global_types = mod_ctx.module.all_global_types()
+    reader = BinaryReader(expr)
+    stack: list[IntConst | FloatConst | Temporary] = []
+    while not reader.at_end:
+        opcode = reader.read_byte()
+        if opcode == 0x0B:  # end
+            break
+        if opcode in (0x41, 0x42):  # i32.const, i64.const
+            stack.append(IntConst(reader.read_s64_leb128()))
+        elif opcode == 0x43:  # f32.const
+            stack.append(FloatConst(reader.read_f32()))
+        elif opcode == 0x44:  # f64.const
+            stack.append(FloatConst(reader.read_f64()))
+        elif opcode == 0x23:  # global.get
+            global_idx = reader.read_u32_leb128()
+            value = _eval_global(global_idx, mod_ctx, evaluated_globals)
+            if value is not None:
+                stack.append(
+                    FloatConst(value) if isinstance(value, float) else IntConst(value)
+                )
+                continue
+            vtype = global_types[global_idx].value_type
+            result = Temporary(f"{prefix}_{len(block.instructions)}")
+            block.instructions.append(
+                Load(
+                    result=result,
+                    result_type=_vtype_to_ir_type(vtype),
+                    address=Global(mod_ctx.get_global_name(global_idx)),
+                    load_type=_vtype_to_load_type(vtype),
+                )
+            )
+            stack.append(result)
+        elif opcode in _CONST_EXPR_OPS:
+            op, bits = _CONST_EXPR_OPS[opcode]
+            right, left = stack.pop(), stack.pop()
+            result = Temporary(f"{prefix}_{len(block.instructions)}")
+            block.instructions.append(
+                BinaryOp(
+                    result=result,
+                    result_type=W if bits == 32 else L,
+                    op=op,
+                    left=left,
+                    right=right,
+                )
+            )
+            stack.append(result)
+        else:
+            raise CompileError(
+                f"unsupported opcode 0x{opcode:02x} in constant expression"
+            )
+    return stack[-1]
 
 
 def _vtype_to_ir_type(vtype: ValueType):
@@ -324,26 +825,13 @@ def _vtype_to_ir_type(vtype: ValueType):
         return S
     if vtype == ValueType.F64:
         return D
+    if vtype == ValueType.V128:
+        return L  # Address of the value's slot
     if vtype.is_reference():
         return L  # All reference types are pointers (64-bit)
     raise ValueError(f"unknown value type: {vtype}")
 
 
-def _vtype_size(vtype: ValueType) -> int:
-    """Get the size in bytes for a WASM value type."""
-    if vtype == ValueType.I32:
-        return 4
-    if vtype == ValueType.I64:
-        return 8
-    if vtype == ValueType.F32:
-        return 4
-    if vtype == ValueType.F64:
-        return 8
-    if vtype.is_reference():
-        return 8  # All reference types are 64-bit pointers
-    raise ValueError(f"unknown value type: {vtype}")
-
-
 def _vtype_to_store_type(vtype: ValueType) -> str:
     """Get the QBE store type for a WASM value type."""
     if vtype == ValueType.I32:
@@ -376,10 +864,9 @@ def _vtype_to_load_type(vtype: ValueType) -> str:
 
 def _compile_function(
     mod_ctx: ModuleContext,
-    qbe_module: Module,
     func_idx: int,
     body,
-) -> None:
+) -> Function:
     """Compile a single function."""
     wasm_module = mod_ctx.module
     func_type = wasm_module.get_func_type(func_idx)
@@ -425,54 +912,103 @@ def _compile_function(
         func_type=func_type,
         locals=locals_list,
         qbe_func=qbe_func,
+        code=body.code,
         stack=ValueStack(),
         mv_out_params=mv_out_params,
         func_name=func_name,
+        deterministic=mod_ctx.deterministic,
     )
 
     # Create entry block
     entry_block = qbe_func.add_block("entry")
+    func_ctx.entry_block = entry_block
 
-    # Allocate stack space for ALL locals (including parameters)
-    # This allows locals to be mutable across loop iterations
-    for i, vtype in enumerate(locals_list):
-        addr_name = f"local_addr{i}"
-        size = _vtype_size(vtype)
-        align = 8 if size == 8 else 4
-        entry_block.instructions.append(
-            Alloc(result=Temporary(addr_name), size=IntConst(size), align=align)
-        )
-        func_ctx.set_local_addr(i, addr_name)
-
-    # Store WASM parameters into their stack slots
-    # (skip out-parameters for multi-value returns)
     num_wasm_params = len(func_type.params)
+    if ssa.uses_ssa_locals(body.code):
+        # Locals are SSA temporaries; parameters start out as themselves
+        func_ctx.local_values = [name for _type, name in params[:num_wasm_params]]
+        func_ctx.local_values += [""] * (len(locals_list) - num_wasm_params)
+        # v128 locals stay in their slots (see instructions/simd.py)
+        for i, vtype in enumerate(locals_list):
+            if vtype == ValueType.V128:
+                alloc_v128(func_ctx, f"local_addr{i}")
+                func_ctx.set_local_addr(i, f"local_addr{i}")
+                func_ctx.local_values[i] = f"local_addr{i}"
+    else:
+        # Functions with a try resume at a catch via longjmp, which restores
+        # callee-saved registers to their values at _setjmp time.  Locals
+        # must therefore stay in memory: carve them out of one frame slot,
+        # which QBE never promotes to registers.
+        _alloc_locals_frame(func_ctx, entry_block, locals_list)
+
     for i in range(num_wasm_params):
-        _qbe_type, param_name = params[i]
-        vtype = locals_list[i]
-        addr_name = func_ctx.get_local_addr(i)
-        store_type = _vtype_to_store_type(vtype)
-        entry_block.instructions.append(
-            Store(
-                store_type=store_type,
-                value=Temporary(param_name),
-                address=Temporary(addr_name),
+        if locals_list[i] == ValueType.V128:
+            # The parameter points to the caller's copy of the value
+            slot = Temporary(func_ctx.get_local_addr(i))
+            copy_v128(func_ctx, entry_block, slot, Temporary(params[i][1]))
+
+    if func_ctx.local_values is None:
+        # Store WASM parameters into their stack slots
+        # (skip out-parameters for multi-value returns)
+        for i in range(num_wasm_params):
+            _qbe_type, param_name = params[i]
+            vtype = locals_list[i]
+            if vtype == ValueType.V128:
+                continue
+            addr_name = func_ctx.get_local_addr(i)
+            store_type = _vtype_to_store_type(vtype)
+            entry_block.instructions.append(
+                Store(
+                    store_type=store_type,
+                    value=Temporary(param_name),
+                    address=Temporary(addr_name),
+                )
             )
+
+    # Self tail calls re-enter the body here, with new parameters and the
+    # other locals zeroed again
+    body_block = entry_block
+    if _has_self_tail_call(body.code, func_idx):
+        tail_label = func_ctx.new_label("tail_entry")
+        entry_block.terminator = Jump(target=Label(tail_label))
+        body_block = qbe_func.add_block(tail_label)
+        func_ctx.tail_frame = ControlFrame(
+            kind="loop",
+            start_depth=0,
+            result_types=(),
+            label_name=tail_label,
+            loop_header=body_block,
         )
+        if func_ctx.local_values is not None:
+            ssa.open_loop(
+                func_ctx,
+                body_block,
+                entry_block.name,
+                func_ctx.tail_frame,
+                set(range(num_wasm_params)),
+            )
 
     # Initialize non-parameter locals to zero
-    for i in range(len(func_type.params), len(locals_list)):
-        vtype = locals_list[i]
-        addr_name = func_ctx.get_local_addr(i)
-        store_type = _vtype_to_store_type(vtype)
-        entry_block.instructions.append(
-            Store(
-                store_type=store_type, value=IntConst(0), address=Temporary(addr_name)
+    if func_ctx.local_values is not None:
+        ssa.emit_zero_locals(func_ctx, body_block, num_wasm_params)
+    else:
+        for i in range(num_wasm_params, len(locals_list)):
+            vtype = locals_list[i]
+            addr_name = func_ctx.get_local_addr(i)
+            if vtype == ValueType.V128:
+                zero_v128(func_ctx, body_block, Temporary(addr_name))
+                continue
+            store_type = _vtype_to_store_type(vtype)
+            body_block.instructions.append(
+                Store(
+                    store_type=store_type,
+                    value=IntConst(0),
+                    address=Temporary(addr_name),
+                )
             )
-        )
 
     # Compile function body
-    current_block = entry_block
+    current_block = body_block
     reader = BinaryReader(body.code)
 
     while not reader.at_end:
@@ -482,6 +1018,9 @@ def _compile_function(
             )
             if new_block is not None:
                 current_block = new_block
+            if current_block.terminator is not None and not reader.at_end:
+                # Code after br/return/throw/unreachable never runs
+                skip_unreachable(reader)
         except CompileError as e:
             # Re-raise with location info if not already present
             if e.func_idx is None:
@@ -490,39 +1029,56 @@ def _compile_function(
 
     # Add implicit return if needed (only if block doesn't already have a terminator)
     if current_block.terminator is None:
-        if not func_type.results:
-            current_block.terminator = Return(value=None)
-        elif len(func_type.results) == 1 and func_ctx.stack.depth > 0:
-            # Single return value
-            value = func_ctx.stack.pop()
-            current_block.terminator = Return(value=Temporary(value.name))
-        elif len(func_type.results) > 1 and func_ctx.stack.depth >= len(
-            func_type.results
-        ):
-            # Multi-value return: pop all values and store additional to out-params
-            values = func_ctx.stack.pop_n(len(func_type.results))
-
-            # Store additional results to out-parameters
-            for i in range(1, len(func_type.results)):
-                vtype = func_type.results[i]
-                value = values[i]
-                out_param = func_ctx.mv_out_params[i - 1]
-                store_type = _vtype_to_store_type(vtype)
-                current_block.instructions.append(
-                    Store(
-                        store_type=store_type,
-                        value=Temporary(value.name),
-                        address=Temporary(out_param),
-                    )
-                )
-
-            # Return first result
-            current_block.terminator = Return(value=Temporary(values[0].name))
+        if func_ctx.stack.depth >= len(func_type.results):
+            _emit_return(func_ctx, current_block)
         else:
             current_block.terminator = Return(value=None)
 
-    # Add function to module
-    qbe_module.add_function(qbe_func)
+    if func_ctx.tail_frame is not None:
+        ssa.seal_loop(body_block, func_ctx.tail_frame)
+
+    return qbe_func
+
+
+def _has_self_tail_call(code: bytes, func_idx: int) -> bool:
+    """Check whether a function body contains ``return_call`` to itself."""
+    return any(
+        instr.opcode == 0x12 and instr.immediates[0] == func_idx
+        for instr in iter_instructions(code)
+    )
+
+
+def _alloc_locals_frame(
+    func_ctx: FunctionContext, entry_block: Block, locals_list: list[ValueType]
+) -> None:
+    """Allocate all locals in a single stack slot (8 bytes per local).
+
+    v128 locals get 16-byte slots of their own.
+    """
+    if not locals_list:
+        return
+    entry_block.instructions.append(
+        Alloc(
+            result=Temporary("locals_frame"),
+            size=IntConst(8 * len(locals_list)),
+            align=8,
+        )
+    )
+    for i, vtype in enumerate(locals_list):
+        addr_name = f"local_addr{i}"
+        func_ctx.set_local_addr(i, addr_name)
+        if vtype == ValueType.V128:
+            alloc_v128(func_ctx, addr_name)
+            continue
+        entry_block.instructions.append(
+            BinaryOp(
+                result=Temporary(addr_name),
+                result_type=L,
+                op="add",
+                left=Temporary("locals_frame"),
+                right=IntConst(8 * i),
+            )
+        )
 
 
 def _compile_instruction(
@@ -552,13 +1108,17 @@ def _compile_instruction(
             return reader.read_f32()
         if kind == "f64":
             return reader.read_f64()
+        if kind == "byte":
+            return reader.read_byte()
         if kind == "block_type":
             return reader.read_block_type()
+        if kind == "v128":
+            return reader.read_bytes(16)
         raise ValueError(f"unknown operand kind: {kind}")
 
-    # Try exception instructions first (0x06-0x09, 0x18-0x19)
+    # Try exception instructions first (0x06-0x0A, 0x18-0x19, 0x1F)
     # These opcodes overlap with control flow range, so check them first
-    if opcode in (0x06, 0x07, 0x08, 0x09, 0x18, 0x19):
+    if opcode in (0x06, 0x07, 0x08, 0x09, 0x0A, 0x18, 0x19, 0x1F):
         exc_result = compile_exception_instruction(
             opcode, func_ctx, mod_ctx, qbe_func, block, read_operand
         )
@@ -711,14 +1271,14 @@ def _compile_instruction(
         )
 
         # Trap block
-        trap_block = qbe_func.add_block(trap_label[1:])
+        trap_block = qbe_func.add_block(trap_label)
         trap_block.instructions.append(
             Call(target=Global("__wasm_trap_null_reference"), args=[])
         )
         trap_block.terminator = Halt()
 
         # Continue block - ref is non-null, push it back
-        cont_block = qbe_func.add_block(cont_label[1:])
+        cont_block = qbe_func.add_block(cont_label)
         func_ctx.stack.push(ref)
         return cont_block
 
@@ -739,7 +1299,6 @@ def _compile_instruction(
             )
         )
 
-        target = func_ctx.get_branch_target(depth)
         branch_label = func_ctx.new_label("br_on_null_branch")
         cont_label = func_ctx.new_label("br_on_null_cont")
 
@@ -750,11 +1309,11 @@ def _compile_instruction(
         )
 
         # Branch block - jump to target
-        branch_block = qbe_func.add_block(branch_label[1:])
-        branch_block.terminator = Jump(target=Label(target.label_name))
+        branch_block = qbe_func.add_block(branch_label)
+        emit_branch_to_depth(func_ctx, branch_block, depth)
 
         # Continue block - ref is non-null, push it back
-        cont_block = qbe_func.add_block(cont_label[1:])
+        cont_block = qbe_func.add_block(cont_label)
         func_ctx.stack.push(ref)
         return cont_block
 
@@ -775,7 +1334,6 @@ def _compile_instruction(
             )
         )
 
-        target = func_ctx.get_branch_target(depth)
         branch_label = func_ctx.new_label("br_on_non_null_branch")
         cont_label = func_ctx.new_label("br_on_non_null_cont")
 
@@ -785,13 +1343,14 @@ def _compile_instruction(
             if_false=Label(cont_label),
         )
 
-        # Branch block - push ref and jump to target
-        branch_block = qbe_func.add_block(branch_label[1:])
-        # Note: When branching, the non-null ref is passed to the target
-        branch_block.terminator = Jump(target=Label(target.label_name))
+        # Branch block - the non-null ref is passed to the target
+        branch_block = qbe_func.add_block(branch_label)
+        func_ctx.stack.push(ref)
+        emit_branch_to_depth(func_ctx, branch_block, depth)
+        func_ctx.stack.pop()
 
         # Continue block - ref was null, don't push anything
-        return qbe_func.add_block(cont_label[1:])
+        return qbe_func.add_block(cont_label)
 
     # 0xFB prefix: GC instructions (struct, array, i31, ref.cast, ref.test)
     if opcode == 0xFB:
@@ -816,5 +1375,12 @@ def _compile_instruction(
             return None
         raise func_ctx.make_error(f"unhandled 0xFC sub-opcode: 0x{sub_opcode:02x}")
 
+    # 0xFD prefix: fixed-width and relaxed SIMD
+    if opcode == 0xFD:
+        sub_opcode = reader.read_u32_leb128()
+        if compile_simd_instruction(sub_opcode, func_ctx, block, read_operand):
+            return None
+        raise func_ctx.make_error(f"unhandled 0xFD sub-opcode: 0x{sub_opcode:02x}")
+
     # Unhandled opcode
     raise func_ctx.make_error(f"unhandled opcode: 0x{opcode:02x}")
@@ -12,26 +12,45 @@ from .stack import ValueStack
 
 if TYPE_CHECKING:
     from qbepy import Block, Function, Module
+    from qbepy.ir import Phi
+
+    from .profile import Instrumentation
 
 
 @dataclass
 class ControlFrame:
     """Represents a control flow structure (block, loop, if, try)."""
 
-    kind: str  # "block", "loop", "if", "try", "catch"
+    kind: str  # "block", "loop", "if", "try", "catch", "try_table"
     start_depth: int  # Stack depth at entry
     result_types: tuple[ValueType, ...]  # Expected result types
     label_name: str  # QBE block label for branch target
     else_label: str | None = None  # For if: the else block label
     end_label: str | None = None  # For if/try: the merge block label
-    # For if/else with results: store values from then branch for phi
-    then_values: list[str] | None = None  # Temp names from then branch
-    then_label: str | None = None  # Label where then branch ends
     # Exception handling fields
-    catch_label: str | None = None  # For try: the catch block label
+    catch_label: str | None = None  # For try: the tag dispatch block label
     catch_all_label: str | None = None  # For try: the catch_all block label
     delegate_depth: int | None = None  # For delegate: outer try depth
     exception_tag: int | None = None  # For catch: the tag being caught
+    # For try: (tag index, catch block label) for each catch clause
+    catches: list[tuple[int, str]] = field(default_factory=list)
+    exc_code: str | None = None  # For try: setjmp result (tag index + 1)
+    exc_payload: str | None = None  # For try: handler-owned payload slots
+    # For try_table: (clause kind, tag index, target frame or None) per clause
+    handlers: list[tuple[int, int | None, ControlFrame | None]] = field(
+        default_factory=list
+    )
+    # Edges into the merge block (or, for a loop, back edges to its header):
+    # (predecessor label, result temps, local values or None)
+    incoming: list[tuple[str, list[str], tuple[str, ...] | None]] = field(
+        default_factory=list
+    )
+    # For if: local values on entry, restored for the else arm
+    entry_locals: tuple[str, ...] | None = None
+    # For loop: header block and its incomplete phis
+    # (local index, phi temp, value on entry, phi)
+    loop_header: Block | None = None
+    loop_phis: list[tuple[int, str, str, Phi]] = field(default_factory=list)
 
 
 @dataclass
@@ -56,6 +75,12 @@ class FunctionContext:
     # Current QBE block
     current_block: Block | None = None
 
+    # Function entry block (where fixed-size stack slots are allocated)
+    entry_block: Block | None = None
+
+    # Raw function body bytecode (for looking ahead with waq.parser.code)
+    code: bytes = b""
+
     # Value stack for SSA conversion
     stack: ValueStack = field(default_factory=ValueStack)
 
@@ -65,6 +90,13 @@ class FunctionContext:
     # Local variable stack addresses (index -> QBE temp holding address)
     local_addrs: dict[int, str] = field(default_factory=dict)
 
+    # SSA locals: the temp currently holding each local (None: locals live in
+    # the stack slots of local_addrs)
+    local_values: list[str] | None = None
+
+    # Target of self tail calls: re-enters the body with new parameters
+    tail_frame: ControlFrame | None = None
+
     # Multi-value return: parameter names for additional results (out-parameters)
     # Index 0 is the first additional result (result[1]), etc.
     mv_out_params: list[str] = field(default_factory=list)
@@ -78,6 +110,9 @@ class FunctionContext:
     # Function name (for error reporting)
     func_name: str | None = None
 
+    # --deterministic: relaxed SIMD takes its deterministic results
+    deterministic: bool = False
+
     def new_label(self, prefix: str = "L") -> str:
         """Generate a new unique block label.
 
@@ -116,6 +151,23 @@ class FunctionContext:
             raise ValueError("control stack underflow")
         return self.control_stack.pop()
 
+    def handlers_above(self, frame: ControlFrame | None) -> int:
+        """Count exception handlers registered inside a control frame.
+
+        These are the try bodies that a branch to ``frame`` leaves, each of
+        which has a handler that must be popped first.  ``None`` counts every
+        handler in the function (used for returns).
+        """
+        count = 0
+        for outer in reversed(self.control_stack):
+            if outer is frame:
+                break
+            if outer.kind == "try" or (
+                outer.kind == "try_table" and outer.exc_code is not None
+            ):
+                count += 1
+        return count
+
     def get_branch_target(self, depth: int) -> ControlFrame:
         """Get the control frame at the given branch depth."""
         if depth >= len(self.control_stack):
@@ -157,49 +209,96 @@ class ModuleContext:
     # Memory size name (no $ prefix - qbepy adds it)
     memory_size: str = "__wasm_memory_size"
 
+    # Function indices used by ref.func; with the element segments, the only
+    # functions a funcref value can point to
+    ref_funcs: set[int] = field(default_factory=set)
+
+    # Set when compiled code calls __wasm_funcref_sig, which is then emitted
+    needs_funcref_sig: bool = False
+
+    # Set when compiled code writes a table (table.set, table.grow,
+    # table.fill, table.copy, table.init)
+    table_written: bool = False
+
+    # (function, block) of each return_call, return_call_indirect and
+    # return_call_ref compiled as call + return, for merge_tail_call_groups
+    tail_calls: set[tuple[str, str]] = field(default_factory=set)
+
+    # PGO counters added by --instrument=pgo
+    profile_counters: Instrumentation | None = None
+
+    # --deterministic: canonical NaNs and deterministic relaxed SIMD
+    deterministic: bool = False
+
+    # Canonical type ids, computed on first use
+    type_ids: list[int] | None = None
+
+    def signature_id(self, type_idx: int) -> int:
+        """Canonical signature id stored in and checked against table slots."""
+        if self.type_ids is None:
+            self.type_ids = self.module.canonical_type_ids()
+        return self.type_ids[type_idx]
+
     def get_func_name(self, func_idx: int) -> str:
         """Get the QBE function name for a WASM function index.
 
+        Every function is named on the first call, in one pass over the
+        imports and exports, so large modules don't rescan them per call.
+
         Note: Do not include $ prefix - qbepy adds it automatically.
         """
+        if not self.func_names:
+            self._name_functions()
         if func_idx in self.func_names:
             return self.func_names[func_idx]
-
-        # Check if it's an imported function
-        num_imports = self.module.num_imported_funcs()
-        if func_idx < num_imports:
-            # Find the import
-            import_idx = 0
-            for imp in self.module.imports:
-                if imp.kind == ImportKind.FUNC:
-                    if import_idx == func_idx:
-                        # Use module$name format for imported functions
-                        # This allows linking with external C functions
-                        name = imp.name
-                        self.func_names[func_idx] = name
-                        return name
-                    import_idx += 1
+        if func_idx < self.module.num_imported_funcs():
             raise ValueError(f"imported function {func_idx} not found")
-
-        # Check if exported
-        for exp in self.module.exports:
-            if exp.kind == ExportKind.FUNC and exp.index == func_idx:
-                # Prefix exported functions with wasm_ to avoid conflicts with C symbols
-                # Exceptions:
-                # - _start is a special WASI entry point
-                # - Names already prefixed with wasm_ or __wasm_ to avoid double-prefixing
-                if exp.name == "_start" or exp.name.startswith(("wasm_", "__wasm_")):
-                    name = exp.name
-                else:
-                    name = f"wasm_{exp.name}"
-                self.func_names[func_idx] = name
-                return name
-
-        # Internal function
-        wasm_name = self.module.get_func_name(func_idx)
-        name = f"__wasm_{wasm_name}"
-        self.func_names[func_idx] = name
-        return name
+        # Past the last defined function: named like one, for error messages
+        return f"__wasm_{self.module.get_func_name(func_idx)}"
+
+    def _name_functions(self) -> None:
+        """Fill ``func_names`` for every imported and defined function."""
+        module = self.module
+        num_imports = 0
+        for imp in module.imports:
+            if imp.kind == ImportKind.FUNC:
+                # Imported functions keep their import name, so they link
+                # with external C functions
+                self.func_names[num_imports] = imp.name
+                num_imports += 1
+
+        for exp in module.exports:
+            if exp.kind != ExportKind.FUNC or exp.index < num_imports:
+                continue
+            # Prefix exported functions with wasm_ to avoid conflicts with C symbols
+            # Exceptions:
+            # - _start is a special WASI entry point
+            # - Names already prefixed with wasm_ or __wasm_ to avoid double-prefixing
+            if exp.name == "_start" or exp.name.startswith(("wasm_", "__wasm_")):
+                name = exp.name
+            else:
+                name = f"wasm_{exp.name}"
+            # A function exported twice is named after its first export
+            self.func_names.setdefault(exp.index, name)
+
+        # Internal functions
+        for func_idx in range(num_imports, num_imports + len(module.func_types)):
+            if func_idx not in self.func_names:
+                wasm_name = module.function_names.get(func_idx, f"func_{func_idx}")
+                self.func_names[func_idx] = f"__wasm_{wasm_name}"
+
+    def exception_payload_size(self) -> int:
+        """Size in bytes of a payload buffer that fits any tag's payload.
+
+        Each payload value occupies one 8-byte slot, so this is eight times
+        the largest tag parameter count in the module.
+        """
+        tags = self.module.all_tags()
+        if not tags:
+            return 0
+        return 8 * max(
+            len(self.module.get_tag_type(idx).params) for idx in range(len(tags))
+        )
 
     def get_global_name(self, global_idx: int) -> str:
         """Get the QBE data name for a WASM global index.
@@ -209,6 +308,16 @@ class ModuleContext:
         if global_idx in self.global_names:
             return self.global_names[global_idx]
 
+        # Imported globals are data symbols the host links in, under their
+        # import name like imported functions
+        imported = [
+            imp for imp in self.module.imports if imp.kind == ImportKind.GLOBAL
+        ]
+        if global_idx < len(imported):
+            name = imported[global_idx].name
+            self.global_names[global_idx] = name
+            return name
+
         # Check if exported
         for exp in self.module.exports:
             if exp.kind == ExportKind.GLOBAL and exp.index == global_idx:
@@ -0,0 +1,306 @@
+"""Deterministic execution: canonical NaNs (``--deterministic``).
+
+WASM leaves the bits of a NaN result open: any quiet NaN will do, and CPUs
+differ in the one they pick.  An x86-64 invalid operation (``0 / 0``,
+``inf - inf``) gives a negative NaN where AArch64 gives a positive one, and
+the two propagate input payloads by different rules, so a module that
+stores or hashes float bits can compute different results on each.  The
+deterministic profile of the spec removes the choice: every NaN an
+operation produces is the canonical one (positive, only the top fraction
+bit set), and each relaxed SIMD operation has a single result, which the
+SIMD lowering picks (see ``instructions.simd``).
+
+The runtime's ``__wasm_canon_nan_f32`` and ``_f64`` do the former as a call
+around every float operation, which spills the live float registers each
+time (they are all caller-saved).  ``canonicalize_nans`` instead rewrites
+each scalar instruction that can produce a NaN to compute into a fresh
+temporary and select the canonical bits branch-free::
+
+    %x =s div %a, %b        %nan0.raw =s div %a, %b
+                            %nan0.flag =w cuos %nan0.raw, %nan0.raw
+                            %nan0.mask =w sub 0, %nan0.flag
+                            %nan0.bits =w cast %nan0.raw
+                            %nan0.diff =w xor %nan0.bits, 2143289344
+                            %nan0.masked =w and %nan0.diff, %nan0.mask
+                            %nan0.picked =w xor %nan0.bits, %nan0.masked
+                            %x =s cast %nan0.picked
+
+Those instructions are float ``add``, ``sub``, ``mul`` and ``div``, the
+rounding and square root helpers, and ``exts``/``truncd`` (promote and
+demote).  ``neg``, ``abs`` and ``copysign`` only touch the sign bit and keep
+the payload, as WASM requires; loads, stores and reinterpretations keep all
+bits.  ``min`` and ``max`` get their NaN from a float ``add``
+(``instructions.numeric``), so they are covered too.
+
+Most float code never sees a NaN, and a range analysis proves it for much
+of it, leaving those instructions alone.  Each float temporary gets the
+facts that hold for all its definitions (the meet over them, iterated to a
+fixed point from the optimistic "everything holds", so loops keep what
+their back edges preserve):
+
+- ``NOT_NAN``: never a NaN;
+- ``FINITE``: a finite number (implies ``NOT_NAN``);
+- ``NONNEG``: never less than zero (a NaN or ``-0`` qualify).
+
+Constants and integer-to-float conversions start the facts, and they carry
+through the arithmetic: ``a + b`` is a number when both are and one is
+finite (``inf - inf`` is the only NaN sum) or both are non-negative,
+``a * b`` when both are finite, ``a / c`` for a nonzero finite constant
+``c``, and ``sqrt(a)`` when ``a`` is a non-negative number.  The pass runs
+before copy propagation, so ``c`` is usually a temporary copied once from
+the constant, which counts as the constant.  Parameters, loads, call
+results and reinterpretations know nothing.
+
+The pass runs at every ``-O`` level, on the IL as ``_compile_function``
+produced it (after PGO instrumentation and profile matching, so profiles
+stay valid with or without the flag), and the optimization passes that
+follow treat the inserted code like any other.
+"""
+
+from __future__ import annotations
+
+import dataclasses
+import math
+from typing import TYPE_CHECKING, Any
+
+from qbepy.ir import (
+    BinaryOp,
+    Call,
+    Comparison,
+    Conversion,
+    Copy,
+    FloatConst,
+    Global,
+    IntConst,
+    L,
+    Phi,
+    Temporary,
+    UnaryOp,
+    W,
+)
+
+from .passes.ir import defined
+
+if TYPE_CHECKING:
+    from qbepy import Function
+
+NOT_NAN = 1
+FINITE = 2
+NONNEG = 4
+_ALL = NOT_NAN | FINITE | NONNEG
+
+# Float class -> (integer class, canonical NaN bits)
+_CANONICAL = {
+    "s": (W, 0x7FC00000),
+    "d": (L, 0x7FF8000000000000),
+}
+
+_ARITHMETIC = frozenset({"add", "sub", "mul", "div"})
+
+# Runtime helpers whose result may be a NaN; all but sqrt only from a NaN
+_ROUNDING = frozenset(
+    f"__wasm_{width}_{op}"
+    for width in ("f32", "f64")
+    for op in ("ceil", "floor", "trunc", "nearest")
+)
+_SQRT = frozenset({"__wasm_f32_sqrt", "__wasm_f64_sqrt"})
+
+# Integer to float conversions: always finite, and non-negative if unsigned
+_INT_TO_FLOAT = {
+    "swtof": NOT_NAN | FINITE,
+    "sltof": NOT_NAN | FINITE,
+    "uwtof": NOT_NAN | FINITE | NONNEG,
+    "ultof": NOT_NAN | FINITE | NONNEG,
+}
+
+
+def canonicalize_nans(func: Function) -> bool:
+    """Canonicalize the NaNs ``func``'s float instructions produce.
+
+    Returns True if ``func`` changed.
+    """
+    facts = float_facts(func)
+    count = 0
+    for block in func.blocks:
+        instructions = []
+        for instr in block.instructions:
+            name = defined(instr)
+            if (
+                name is None
+                or not _may_produce_nan(instr)
+                or facts.get(name, 0) & NOT_NAN
+            ):
+                instructions.append(instr)
+                continue
+            instructions += _canonicalized(instr, f"nan{count}")
+            count += 1
+        block.instructions = instructions
+    return count > 0
+
+
+def float_facts(func: Function) -> dict[str, int]:
+    """The ``NOT_NAN``/``FINITE``/``NONNEG`` facts of each float temporary."""
+    definitions: dict[str, list[Any]] = {}
+    for block in func.blocks:
+        for instr in [*block.phis, *block.instructions]:
+            name = defined(instr)
+            if name is not None and str(instr.result_type) in _CANONICAL:
+                definitions.setdefault(name, []).append(instr)
+
+    # Temporaries only ever copied from one float constant
+    constants = {
+        name: instrs[0].value
+        for name, instrs in definitions.items()
+        if len(instrs) == 1
+        and isinstance(instrs[0], Copy)
+        and isinstance(instrs[0].value, FloatConst)
+    }
+    facts = dict.fromkeys(definitions, _ALL)
+    changed = True
+    while changed:
+        changed = False
+        for name, instrs in definitions.items():
+            value = _ALL
+            for instr in instrs:
+                value &= _transfer(instr, facts, constants)
+            if value != facts[name]:
+                facts[name] = value
+                changed = True
+    return facts
+
+
+def _value_facts(value: Any, facts: dict[str, int]) -> int:
+    if isinstance(value, Temporary):
+        return facts.get(value.name, 0)
+    if isinstance(value, FloatConst):
+        return _const_facts(value.value)
+    return 0
+
+
+def _const_facts(value: float) -> int:
+    if math.isnan(value):
+        return 0
+    sign = NONNEG if value >= 0 else 0
+    return (NOT_NAN | FINITE if math.isfinite(value) else NOT_NAN) | sign
+
+
+def _transfer(
+    instr: Any, facts: dict[str, int], constants: dict[str, FloatConst]
+) -> int:
+    """The facts of the value ``instr`` defines, given its operands'.
+
+    ``constants`` are the temporaries that hold a known float constant.
+    """
+    if isinstance(instr, Copy):
+        return _value_facts(instr.value, facts)
+    if isinstance(instr, Phi):
+        value = _ALL
+        for _label, incoming in instr.incoming:
+            value &= _value_facts(incoming, facts)
+        return value
+    if isinstance(instr, BinaryOp):
+        right = instr.right
+        if isinstance(right, Temporary):
+            right = constants.get(right.name, right)
+        return _arithmetic_facts(
+            instr.op,
+            _value_facts(instr.left, facts),
+            _value_facts(instr.right, facts),
+            right,
+        )
+    if isinstance(instr, UnaryOp):
+        # neg flips the sign
+        operand = _value_facts(instr.operand, facts)
+        return operand & (NOT_NAN | FINITE) if instr.op == "neg" else 0
+    if isinstance(instr, Conversion):
+        operand = _value_facts(instr.operand, facts)
+        if instr.op == "exts":
+            return operand
+        if instr.op == "truncd":
+            # Large doubles round to infinity
+            return operand & ~FINITE
+        return _INT_TO_FLOAT.get(instr.op, 0)
+    if isinstance(instr, Call) and isinstance(instr.target, Global) and instr.args:
+        operand = _value_facts(instr.args[0][1], facts)
+        if instr.target.name in _ROUNDING:
+            return operand
+        if instr.target.name in _SQRT:
+            number = operand & NOT_NAN and operand & NONNEG
+            return NONNEG | (operand & (NOT_NAN | FINITE) if number else 0)
+    return 0
+
+
+def _arithmetic_facts(op: str, a: int, b: int, right: Any) -> int:
+    both = a & b
+    sign = both & NONNEG
+    if op == "add":
+        if both & NOT_NAN and ((a | b) & FINITE or sign):
+            return NOT_NAN | sign
+        return sign
+    if op == "sub":
+        # Only inf - inf is a NaN
+        return NOT_NAN if both & NOT_NAN and (a | b) & FINITE else 0
+    if op == "mul":
+        # Only 0 * inf is a NaN
+        return (NOT_NAN if both & FINITE else 0) | sign
+    if op == "div":
+        # 0 / 0 and inf / inf are the NaNs: divide by a nonzero finite constant
+        divisor = right.value if isinstance(right, FloatConst) else math.nan
+        if a & NOT_NAN and math.isfinite(divisor) and divisor != 0:
+            return NOT_NAN | sign
+        return sign
+    return 0
+
+
+def _may_produce_nan(instr: Any) -> bool:
+    if str(getattr(instr, "result_type", "")) not in _CANONICAL:
+        return False
+    if isinstance(instr, BinaryOp):
+        return instr.op in _ARITHMETIC
+    if isinstance(instr, Conversion):
+        return instr.op in ("exts", "truncd")
+    if isinstance(instr, Call) and isinstance(instr.target, Global):
+        return instr.target.name in _ROUNDING or instr.target.name in _SQRT
+    return False
+
+
+def _canonicalized(instr: Any, prefix: str) -> list[Any]:
+    """``instr`` computing into ``<prefix>.raw``, then the NaN select."""
+    result_type = instr.result_type
+    int_type, canonical = _CANONICAL[str(result_type)]
+
+    def temp(name: str) -> Temporary:
+        return Temporary(f"{prefix}.{name}")
+
+    raw, flag, mask, bits = temp("raw"), temp("flag"), temp("mask"), temp("bits")
+    diff, masked, picked = temp("diff"), temp("masked"), temp("picked")
+    return [
+        dataclasses.replace(instr, result=raw),
+        Comparison(
+            result=flag,
+            result_type=int_type,
+            op=f"cuo{result_type}",
+            left=raw,
+            right=raw,
+        ),
+        BinaryOp(
+            result=mask, result_type=int_type, op="sub", left=IntConst(0), right=flag
+        ),
+        Conversion(op="cast", result=bits, result_type=int_type, operand=raw),
+        # bits ^ ((canonical ^ bits) & mask)
+        BinaryOp(
+            result=diff,
+            result_type=int_type,
+            op="xor",
+            left=bits,
+            right=IntConst(canonical),
+        ),
+        BinaryOp(result=masked, result_type=int_type, op="and", left=diff, right=mask),
+        BinaryOp(
+            result=picked, result_type=int_type, op="xor", left=bits, right=masked
+        ),
+        Conversion(
+            op="cast", result=instr.result, result_type=result_type, operand=picked
+        ),
+    ]
+
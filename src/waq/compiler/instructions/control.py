@@ -9,6 +9,8 @@ from qbepy.ir import (
     Branch,
     Call,
     Comparison,
+    Conversion,
+    Copy,
     Global,
     Halt,
     IntConst,
@@ -23,7 +25,19 @@ from qbepy.ir import (
     W,
 )
 
+from waq.compiler import ssa
 from waq.compiler.context import ControlFrame, ModuleContext
+from waq.compiler.instructions.exceptions import (
+    compile_try_end,
+    compile_try_table_end,
+    emit_handler_pops,
+)
+from waq.compiler.instructions.simd import (
+    V128_RESULT,
+    claim_v128_result,
+    copy_v128,
+)
+from waq.compiler.stack import StackValue
 from waq.parser.types import BlockType, FuncType, ValueType
 
 if TYPE_CHECKING:
@@ -97,15 +111,18 @@ def compile_control_instruction(
         # Jump to loop label
         block.terminator = Jump(target=Label(loop_label))
 
-        # Create loop block (strip @ prefix for add_block)
-        loop_block = func.add_block(loop_label.removeprefix("@"))
+        # Create loop block
+        loop_block = func.add_block(loop_label)
 
         frame = ControlFrame(
             kind="loop",
             start_depth=ctx.stack.depth,
             result_types=result_types,
             label_name=loop_label,  # Branch target is loop start
+            loop_header=loop_block,
         )
+        if ctx.local_values is not None:
+            ssa.open_loop(ctx, loop_block, block.name, frame, ssa.assigned_in_loop(ctx))
         ctx.push_control(frame)
         return loop_block
 
@@ -126,8 +143,8 @@ def compile_control_instruction(
             if_false=Label(else_label),
         )
 
-        # Create then block (strip @ prefix for add_block)
-        then_block = func.add_block(then_label.removeprefix("@"))
+        # Create then block
+        then_block = func.add_block(then_label)
 
         frame = ControlFrame(
             kind="if",
@@ -136,6 +153,7 @@ def compile_control_instruction(
             label_name=end_label,
             else_label=else_label,
             end_label=end_label,
+            entry_locals=ssa.snapshot(ctx),
         )
         ctx.push_control(frame)
         return then_block
@@ -143,32 +161,18 @@ def compile_control_instruction(
     # else
     if opcode == 0x05:
         frame = ctx.control_stack[-1]
-        if frame.kind != "if":
+        if frame.kind != "if" or frame.else_label is None:
             raise ValueError("else without matching if")
 
-        # If we have result types, capture values from then branch for phi
-        if frame.result_types:
-            # Peek the stack values (don't pop - they represent the results)
-            then_values = []
-            for i in range(len(frame.result_types)):
-                # Get value from top of stack (reverse order for peek)
-                val = ctx.stack.peek_at(len(frame.result_types) - 1 - i)
-                then_values.append(val.name)
-            frame.then_values = then_values
-            frame.then_label = block.name  # Current block's name (no @ prefix)
-            # Pop the values - they're consumed, else will push new ones
-            ctx.stack.pop_n(len(frame.result_types))
-
-        # Jump from then block to end
-        assert frame.end_label is not None
-        block.terminator = Jump(target=Label(frame.end_label))
-
-        # Create else block (strip @ prefix for add_block)
-        assert frame.else_label is not None
+        # The then arm flows to the merge block with its results
+        fall_through(ctx, block, frame)
+
+        # Clear else_label so end doesn't create a second else block
         else_label = frame.else_label
-        # Clear else_label so end doesn't try to create a duplicate
         frame.else_label = None
-        return func.add_block(else_label.removeprefix("@"))
+        if frame.entry_locals is not None:
+            ctx.local_values = list(frame.entry_locals)
+        return func.add_block(else_label)
 
     # end (0x0B)
     if opcode == 0x0B:
@@ -178,83 +182,40 @@ def compile_control_instruction(
 
         frame = ctx.pop_control()
 
-        if frame.kind == "if" and frame.else_label:
-            # If without else - else just falls through
-            # Need to emit the else label pointing to end
-            assert frame.end_label is not None
-            block.terminator = Jump(target=Label(frame.end_label))
-            else_label = frame.else_label
-            else_block = func.add_block(else_label.removeprefix("@"))
-            else_block.terminator = Jump(target=Label(frame.end_label))
-
-        # Handle if/else with results using phi nodes
-        if frame.kind == "if" and frame.then_values is not None and frame.result_types:
-            # We had an else branch with results
-            # Capture else branch values and current block label
-            else_values = []
-            for i in range(len(frame.result_types)):
-                val = ctx.stack.peek_at(len(frame.result_types) - 1 - i)
-                else_values.append(val.name)
-            # Strip @ prefix - Label() will add it back
-            else_label_for_phi = block.name  # Use name, not label (no @ prefix)
-
-            # Pop else values from stack
-            ctx.stack.pop_n(len(frame.result_types))
-
-            # Jump to end
-            block.terminator = Jump(target=Label(frame.label_name))
-
-            # Create end block
-            end_block = func.add_block(frame.label_name.removeprefix("@"))
-
-            # Emit phi nodes for each result
-            # then_label is already without @ prefix
-            then_label_for_phi = frame.then_label
-            then_values = frame.then_values
-            assert then_label_for_phi is not None, (
-                "then_label must be set for if/else with results"
-            )
-            assert then_values is not None, (
-                "then_values must be set for if/else with results"
-            )
-            for i, vtype in enumerate(frame.result_types):
-                phi_result = ctx.stack.new_temp(vtype)
-                qbe_type = _vtype_to_ir_type(vtype)
-                incoming = [
-                    (Label(then_label_for_phi), Temporary(then_values[i])),
-                    (Label(else_label_for_phi), Temporary(else_values[i])),
-                ]
-                end_block.phis.append(
-                    Phi(
-                        result=Temporary(phi_result.name),
-                        result_type=qbe_type,
-                        incoming=incoming,
-                    )
-                )
-
-            return end_block
+        if frame.kind in ("try", "catch"):
+            return compile_try_end(ctx, mod_ctx, func, block, frame)
+        if frame.kind == "try_table":
+            return compile_try_table_end(ctx, mod_ctx, func, block, frame)
 
-        # Jump to end label (for block and if without results)
-        if frame.kind != "loop":
-            if block.terminator is None:
-                block.terminator = Jump(target=Label(frame.label_name))
-            label = frame.label_name
-            return func.add_block(label.removeprefix("@"))
+        if frame.kind == "loop":
+            # All back edges are known now
+            assert frame.loop_header is not None
+            ssa.seal_loop(frame.loop_header, frame)
+            # Falling out of a loop just continues in the current block
+            return None
 
-        return None
+        fall_through(ctx, block, frame)
+        if frame.kind == "if" and frame.else_label is not None:
+            # If without else: the else arm is empty and goes to the merge
+            else_block = func.add_block(frame.else_label)
+            else_block.terminator = Jump(target=Label(frame.label_name))
+            # Only valid when the if's params equal its results
+            values = ctx.stack.peek_n(len(frame.result_types))
+            frame.incoming.append(
+                (else_block.name, [v.name for v in values], frame.entry_locals)
+            )
+        return merge_block(ctx, func, frame)
 
     # br
     if opcode == 0x0C:
         depth = read_operand("u32")
-        target = ctx.get_branch_target(depth)
-        _emit_branch(ctx, block, target)
+        emit_branch_to_depth(ctx, block, depth)
         return None
 
     # br_if
     if opcode == 0x0D:
         depth = read_operand("u32")
         cond = ctx.stack.pop()
-        target = ctx.get_branch_target(depth)
 
         cont_label = ctx.new_label("br_if_cont")
         branch_label = ctx.new_label("br_if_branch")
@@ -267,11 +228,11 @@ def compile_control_instruction(
         )
 
         # Branch block
-        branch_block = func.add_block(branch_label.removeprefix("@"))
-        _emit_branch(ctx, branch_block, target)
+        branch_block = func.add_block(branch_label)
+        emit_branch_to_depth(ctx, branch_block, depth)
 
         # Continue block
-        return func.add_block(cont_label.removeprefix("@"))
+        return func.add_block(cont_label)
 
     # br_table
     if opcode == 0x0E:
@@ -281,41 +242,7 @@ def compile_control_instruction(
         default_target = read_operand("u32")
 
         idx = ctx.stack.pop()
-
-        # For now, emit a chain of conditionals
-        # TODO: Generate jump table for dense cases
-        for i, depth in enumerate(targets):
-            target = ctx.get_branch_target(depth)
-            check_label = ctx.new_label(f"br_table_{i}")
-            next_label = ctx.new_label(f"br_table_next_{i}")
-
-            # Check if idx == i
-            cmp_temp = ctx.stack.new_temp_no_push(ValueType.I32)
-            block.instructions.append(
-                Comparison(
-                    result=Temporary(cmp_temp.name),
-                    result_type=W,
-                    op="ceqw",
-                    left=Temporary(idx.name),
-                    right=IntConst(i),
-                )
-            )
-            block.terminator = Branch(
-                condition=Temporary(cmp_temp.name),
-                if_true=Label(check_label),
-                if_false=Label(next_label),
-            )
-
-            # Branch block
-            check_block = func.add_block(check_label.removeprefix("@"))
-            _emit_branch(ctx, check_block, target)
-
-            # Next check
-            block = func.add_block(next_label.removeprefix("@"))
-
-        # Default case
-        default_frame = ctx.get_branch_target(default_target)
-        _emit_branch(ctx, block, default_frame)
+        _emit_br_table(ctx, func, block, idx.name, targets, default_target)
         return None
 
     # return
@@ -333,19 +260,21 @@ def compile_control_instruction(
     if opcode == 0x11:
         type_idx = read_operand("u32")
         _table_idx = read_operand("u32")  # Always 0 in WASM 1.0
-        _emit_call_indirect(ctx, block, type_idx)
-        return None
+        return _emit_call_indirect(ctx, mod_ctx, func, block, type_idx)
 
     # return_call (0x12) - tail call to direct function
     if opcode == 0x12:
         func_idx = read_operand("u32")
+        # A tail call leaves every try body; the callee runs outside them
+        emit_handler_pops(ctx, block, ctx.handlers_above(None))
         return _emit_return_call(ctx, mod_ctx, func, block, func_idx)
 
     # return_call_indirect (0x13) - tail call through table
     if opcode == 0x13:
         type_idx = read_operand("u32")
         _table_idx = read_operand("u32")  # Table index (usually 0)
-        return _emit_return_call_indirect(ctx, func, block, type_idx)
+        emit_handler_pops(ctx, block, ctx.handlers_above(None))
+        return _emit_return_call_indirect(ctx, mod_ctx, func, block, type_idx)
 
     # call_ref (0x14) - call via typed function reference
     if opcode == 0x14:
@@ -355,7 +284,8 @@ def compile_control_instruction(
     # return_call_ref (0x15) - tail call via typed function reference
     if opcode == 0x15:
         type_idx = read_operand("u32")
-        return _emit_return_call_ref(ctx, func, block, type_idx)
+        emit_handler_pops(ctx, block, ctx.handlers_above(None))
+        return _emit_return_call_ref(ctx, mod_ctx, func, block, type_idx)
 
     return None
 
@@ -373,42 +303,202 @@ def _block_type_to_results(
     return func_type.results
 
 
-def _emit_branch(ctx: FunctionContext, block: Block, target: ControlFrame) -> None:
-    """Emit a branch to a control frame."""
-    # For loop, branch goes to start (no results needed at branch point)
-    # For block/if, branch goes to end with results
+def branch_values(ctx: FunctionContext, target: ControlFrame | None) -> list[str]:
+    """Operand stack values carried by a branch to ``target`` (not popped).
+
+    Branches to a loop go to its header and carry nothing; branches to any
+    other frame carry its results; ``None`` is the function body (a return).
+    """
+    if target is None:
+        count = len(ctx.func_type.results)
+    elif target.kind == "loop":
+        count = 0
+    else:
+        count = len(target.result_types)
+    return [v.name for v in ctx.stack.peek_n(count)]
+
+
+def emit_branch(
+    ctx: FunctionContext,
+    block: Block,
+    target: ControlFrame | None,
+    values: list[str],
+) -> None:
+    """Branch from ``block`` to a control frame, passing result ``values``.
+
+    The values (and the current SSA locals) become phi operands in the
+    target's merge block, or its loop header.  A ``None`` target is the
+    function body itself, i.e. a return.
+    """
+    if target is None:
+        _emit_return(ctx, block, values)
+        return
+    # Leaving try bodies: pop their handlers first
+    emit_handler_pops(ctx, block, ctx.handlers_above(target))
+    target.incoming.append((block.name, values, ssa.snapshot(ctx)))
     block.terminator = Jump(target=Label(target.label_name))
 
 
-def _emit_return(ctx: FunctionContext, block: Block) -> None:
-    """Emit a function return."""
+def fall_through(ctx: FunctionContext, block: Block, frame: ControlFrame) -> None:
+    """End the current arm of ``frame`` by jumping to its merge block.
+
+    Does nothing for the values if the arm is unreachable; the operand stack
+    is reset to the frame's entry depth either way.
+    """
+    if block.terminator is None:
+        values = ctx.stack.pop_n(len(frame.result_types))
+        frame.incoming.append((block.name, [v.name for v in values], ssa.snapshot(ctx)))
+        block.terminator = Jump(target=Label(frame.label_name))
+    ctx.stack.truncate(frame.start_depth)
+
+
+def merge_block(ctx: FunctionContext, func: Function, frame: ControlFrame) -> Block:
+    """Create the merge block of ``frame`` and push its results.
+
+    Each result is a phi over every branch and fallthrough into the block;
+    SSA locals get phis where the edges disagree.
+    """
+    end_block = func.add_block(frame.label_name)
+    for i, vtype in enumerate(frame.result_types):
+        result = ctx.stack.new_temp(vtype)
+        qbe_type = _vtype_to_ir_type(vtype)
+        if not frame.incoming:
+            # No arm reaches the merge block; it is dead code
+            end_block.instructions.append(
+                Copy(
+                    result=Temporary(result.name),
+                    result_type=qbe_type,
+                    value=IntConst(0),
+                )
+            )
+            continue
+        end_block.phis.append(
+            Phi(
+                result=Temporary(result.name),
+                result_type=qbe_type,
+                incoming=[
+                    (Label(label), Temporary(values[i]))
+                    for label, values, _locals in frame.incoming
+                ],
+            )
+        )
+    ssa.merge_locals(ctx, end_block, frame)
+    return end_block
+
+
+def _br_table_ranges(targets: list[int], default: int) -> list[tuple[int, int]]:
+    """Cluster a br_table into ``(low, depth)`` ranges.
+
+    Each range runs from its ``low`` index up to the next range's ``low``;
+    the last one (which holds the default) extends to 2**32 - 1.  Adjacent
+    entries with the same depth share a range.
+    """
+    ranges: list[tuple[int, int]] = []
+    for low, depth in enumerate([*targets, default]):
+        if not ranges or ranges[-1][1] != depth:
+            ranges.append((low, depth))
+    return ranges
+
+
+def _emit_br_table(
+    ctx: FunctionContext,
+    func: Function,
+    block: Block,
+    idx: str,
+    targets: list[int],
+    default: int,
+) -> None:
+    """Lower br_table to a balanced binary search over clustered ranges.
+
+    QBE has no indirect jump, so a jump table is not expressible; the search
+    costs O(log r) unsigned compares for r ranges, and an out-of-range index
+    needs no separate bounds check because it falls in the default's range.
+    Each distinct target gets one edge block that carries the branch values.
+    """
+    ranges = _br_table_ranges(targets, default)
+    edges = {depth: ctx.new_label("br_table_to") for _, depth in ranges}
+
+    def search(block: Block, ranges: list[tuple[int, int]]) -> None:
+        mid = len(ranges) // 2
+        cmp_temp = ctx.stack.new_temp_no_push(ValueType.I32)
+        block.instructions.append(
+            Comparison(
+                result=Temporary(cmp_temp.name),
+                result_type=W,
+                op="cultw",
+                left=Temporary(idx),
+                right=IntConst(ranges[mid][0]),
+            )
+        )
+        halves = []
+        for half in (ranges[:mid], ranges[mid:]):
+            if len(half) == 1:
+                halves.append(edges[half[0][1]])
+            else:
+                label = ctx.new_label("br_table_search")
+                halves.append(label)
+                search(func.add_block(label), half)
+        block.terminator = Branch(
+            condition=Temporary(cmp_temp.name),
+            if_true=Label(halves[0]),
+            if_false=Label(halves[1]),
+        )
+
+    if len(ranges) == 1:
+        block.terminator = Jump(target=Label(edges[ranges[0][1]]))
+    else:
+        search(block, ranges)
+
+    for depth, label in edges.items():
+        emit_branch_to_depth(ctx, func.add_block(label), depth)
+
+
+def emit_branch_to_depth(ctx: FunctionContext, block: Block, depth: int) -> None:
+    """Emit ``br depth``; the outermost label is the function body."""
+    target = None
+    if depth < len(ctx.control_stack):
+        target = ctx.get_branch_target(depth)
+    elif depth > len(ctx.control_stack):
+        raise ValueError(f"branch depth {depth} exceeds control stack")
+    emit_branch(ctx, block, target, branch_values(ctx, target))
+
+
+def _emit_return(
+    ctx: FunctionContext, block: Block, values: list[str] | None = None
+) -> None:
+    """Emit a function return of ``values`` (default: the top of the stack)."""
     result_types = ctx.func_type.results
+    if values is None:
+        values = [v.name for v in ctx.stack.pop_n(len(result_types))]
+    emit_handler_pops(ctx, block, ctx.handlers_above(None))
     if not result_types:
         block.terminator = Return(value=None)
-    elif len(result_types) == 1:
-        value = ctx.stack.pop()
-        block.terminator = Return(value=Temporary(value.name))
-    else:
-        # Multi-value return: pop all values (in reverse order)
-        # Values are on stack with last result on top
-        values = ctx.stack.pop_n(len(result_types))
-
-        # Store additional results to out-parameters (indices 1+)
-        for i in range(1, len(result_types)):
-            vtype = result_types[i]
-            value = values[i]
-            out_param = ctx.mv_out_params[i - 1]  # 0-indexed in mv_out_params
-            store_type = _vtype_to_store_type(vtype)
-            block.instructions.append(
-                Store(
-                    store_type=store_type,
-                    value=Temporary(value.name),
-                    address=Temporary(out_param),
-                )
+        return
+
+    # Multi-value return: store additional results to out-parameters
+    for i in range(1, len(result_types)):
+        out_param = ctx.mv_out_params[i - 1]  # 0-indexed in mv_out_params
+        if result_types[i] == ValueType.V128:
+            copy_v128(ctx, block, Temporary(out_param), Temporary(values[i]))
+            continue
+        block.instructions.append(
+            Store(
+                store_type=_vtype_to_store_type(result_types[i]),
+                value=Temporary(values[i]),
+                address=Temporary(out_param),
             )
+        )
 
-        # Return the first result
-        block.terminator = Return(value=Temporary(values[0].name))
+    # Return the first result; a v128 one by way of the thread's buffer
+    if result_types[0] == ValueType.V128:
+        buffer = Temporary(ctx.stack.new_temp_no_push(ValueType.I64).name)
+        block.instructions.append(
+            Call(target=Global(V128_RESULT), args=[], result=buffer, result_type=L)
+        )
+        copy_v128(ctx, block, buffer, Temporary(values[0]))
+        block.terminator = Return(value=buffer)
+        return
+    block.terminator = Return(value=Temporary(values[0]))
 
 
 def _vtype_to_store_type(vtype: ValueType) -> str:
@@ -421,7 +511,7 @@ def _vtype_to_store_type(vtype: ValueType) -> str:
         return "stores"
     if vtype == ValueType.F64:
         return "stored"
-    if vtype in (ValueType.FUNCREF, ValueType.EXTERNREF):
+    if vtype.is_reference():
         return "storel"
     raise ValueError(f"unknown value type: {vtype}")
 
@@ -438,7 +528,9 @@ def _vtype_to_ir_type(vtype: ValueType):
         return S
     if vtype == ValueType.F64:
         return D
-    if vtype in (ValueType.FUNCREF, ValueType.EXTERNREF):
+    if vtype == ValueType.V128:
+        return L  # Address of the value's slot
+    if vtype.is_reference():
         return L  # Reference types are pointers (64-bit)
     raise ValueError(f"unknown value type: {vtype}")
 
@@ -486,7 +578,7 @@ def _emit_call(
             vtype = func_type.results[i]
             slot_name = ctx.stack.new_temp_no_push(ValueType.I64).name
             size = _vtype_size(vtype)
-            align = 8 if size == 8 else 4
+            align = max(size, 4)
             block.instructions.append(
                 Alloc(result=Temporary(slot_name), size=IntConst(size), align=align)
             )
@@ -506,18 +598,9 @@ def _emit_call(
             )
         )
 
-        # Load additional results from stack slots
-        for slot_name, vtype in ret_slots:
-            result = ctx.stack.new_temp(vtype)
-            load_type = _vtype_to_load_type(vtype)
-            block.instructions.append(
-                Load(
-                    result=Temporary(result.name),
-                    result_type=_vtype_to_ir_type(vtype),
-                    address=Temporary(slot_name),
-                    load_type=load_type,
-                )
-            )
+        _push_slot_results(ctx, block, ret_slots)
+
+    claim_v128_result(ctx, block, func_type.results)
 
 
 def _emit_call_ref(
@@ -568,7 +651,7 @@ def _emit_call_ref(
             vtype = func_type.results[i]
             slot_name = ctx.stack.new_temp_no_push(ValueType.I64).name
             size = _vtype_size(vtype)
-            align = 8 if size == 8 else 4
+            align = max(size, 4)
             block.instructions.append(
                 Alloc(result=Temporary(slot_name), size=IntConst(size), align=align)
             )
@@ -587,18 +670,9 @@ def _emit_call_ref(
             )
         )
 
-        # Load additional results from stack slots
-        for slot_name, vtype in ret_slots:
-            result = ctx.stack.new_temp(vtype)
-            load_type = _vtype_to_load_type(vtype)
-            block.instructions.append(
-                Load(
-                    result=Temporary(result.name),
-                    result_type=_vtype_to_ir_type(vtype),
-                    address=Temporary(slot_name),
-                    load_type=load_type,
-                )
-            )
+        _push_slot_results(ctx, block, ret_slots)
+
+    claim_v128_result(ctx, block, func_type.results)
 
 
 def _vtype_size(vtype: ValueType) -> int:
@@ -611,11 +685,33 @@ def _vtype_size(vtype: ValueType) -> int:
         return 4
     if vtype == ValueType.F64:
         return 8
-    if vtype in (ValueType.FUNCREF, ValueType.EXTERNREF):
+    if vtype == ValueType.V128:
+        return 16
+    if vtype.is_reference():
         return 8
     raise ValueError(f"unknown value type: {vtype}")
 
 
+def _push_slot_results(
+    ctx: FunctionContext, block: Block, ret_slots: list[tuple[str, ValueType]]
+) -> None:
+    """Push the results a call left in its out-parameter slots."""
+    for slot_name, vtype in ret_slots:
+        if vtype == ValueType.V128:
+            # The slot is the value's own
+            ctx.stack.push(StackValue(slot_name, vtype))
+            continue
+        result = ctx.stack.new_temp(vtype)
+        block.instructions.append(
+            Load(
+                result=Temporary(result.name),
+                result_type=_vtype_to_ir_type(vtype),
+                address=Temporary(slot_name),
+                load_type=_vtype_to_load_type(vtype),
+            )
+        )
+
+
 def _vtype_to_load_type(vtype: ValueType) -> str:
     """Convert WASM ValueType to QBE load instruction name."""
     if vtype == ValueType.I32:
@@ -626,13 +722,22 @@ def _vtype_to_load_type(vtype: ValueType) -> str:
         return "loads"
     if vtype == ValueType.F64:
         return "loadd"
-    if vtype in (ValueType.FUNCREF, ValueType.EXTERNREF):
+    if vtype.is_reference():
         return "loadl"
     raise ValueError(f"unknown value type: {vtype}")
 
 
-def _emit_call_indirect(ctx: FunctionContext, block: Block, type_idx: int) -> None:
-    """Emit an indirect function call through a table."""
+def _emit_call_indirect(
+    ctx: FunctionContext,
+    mod_ctx: ModuleContext,
+    func: Function,
+    block: Block,
+    type_idx: int,
+) -> Block:
+    """Emit an indirect function call through a table.
+
+    Returns the block after the call (the slot checks branch).
+    """
 
     # Get function type from type index
     func_type = _get_func_type(ctx.module, type_idx)
@@ -649,72 +754,19 @@ def _emit_call_indirect(ctx: FunctionContext, block: Block, type_idx: int) -> No
         qbe_type = _vtype_to_ir_type(ptype)
         call_args.append((qbe_type, Temporary(arg.name)))
 
-    # Load table base pointer
-    table_base = ctx.stack.new_temp_no_push(ValueType.I64)
-    block.instructions.append(
-        Load(
-            result=Temporary(table_base.name),
-            result_type=L,
-            address=Global("__wasm_table"),
-        )
-    )
-
-    # Calculate offset: table_idx * 8 (pointer size)
-    # First extend table_idx to 64-bit
-    from qbepy.ir import Conversion  # noqa: PLC0415
-
-    idx64 = ctx.stack.new_temp_no_push(ValueType.I64)
-    block.instructions.append(
-        Conversion(
-            op="extuw",
-            result=Temporary(idx64.name),
-            result_type=L,
-            operand=Temporary(table_idx.name),
-        )
-    )
-
-    offset = ctx.stack.new_temp_no_push(ValueType.I64)
-    block.instructions.append(
-        BinaryOp(
-            result=Temporary(offset.name),
-            result_type=L,
-            op="mul",
-            left=Temporary(idx64.name),
-            right=IntConst(8),  # sizeof(void*)
-        )
-    )
-
-    # Calculate address: table_base + offset
-    addr = ctx.stack.new_temp_no_push(ValueType.I64)
-    block.instructions.append(
-        BinaryOp(
-            result=Temporary(addr.name),
-            result_type=L,
-            op="add",
-            left=Temporary(table_base.name),
-            right=Temporary(offset.name),
-        )
-    )
-
-    # Load function pointer
-    func_ptr = ctx.stack.new_temp_no_push(ValueType.I64)
-    block.instructions.append(
-        Load(
-            result=Temporary(func_ptr.name),
-            result_type=L,
-            address=Temporary(addr.name),
-        )
+    block, func_ptr = _emit_table_entry(
+        ctx, mod_ctx, func, block, table_idx.name, type_idx
     )
 
     # Emit indirect call
     if not func_type.results:
-        block.instructions.append(Call(target=Temporary(func_ptr.name), args=call_args))
+        block.instructions.append(Call(target=Temporary(func_ptr), args=call_args))
     elif len(func_type.results) == 1:
         result = ctx.stack.new_temp(func_type.results[0])
         qbe_type = _vtype_to_ir_type(func_type.results[0])
         block.instructions.append(
             Call(
-                target=Temporary(func_ptr.name),
+                target=Temporary(func_ptr),
                 args=call_args,
                 result=Temporary(result.name),
                 result_type=qbe_type,
@@ -729,7 +781,7 @@ def _emit_call_indirect(ctx: FunctionContext, block: Block, type_idx: int) -> No
             vtype = func_type.results[i]
             slot_name = ctx.stack.new_temp_no_push(ValueType.I64).name
             size = _vtype_size(vtype)
-            align = 8 if size == 8 else 4
+            align = max(size, 4)
             block.instructions.append(
                 Alloc(result=Temporary(slot_name), size=IntConst(size), align=align)
             )
@@ -741,23 +793,142 @@ def _emit_call_indirect(ctx: FunctionContext, block: Block, type_idx: int) -> No
         qbe_type = _vtype_to_ir_type(func_type.results[0])
         block.instructions.append(
             Call(
-                target=Temporary(func_ptr.name),
+                target=Temporary(func_ptr),
                 args=call_args,
                 result=Temporary(first_result.name),
                 result_type=qbe_type,
             )
         )
 
-        # Load additional results from stack slots
-        for slot_name, vtype in ret_slots:
-            result = ctx.stack.new_temp(vtype)
-            block.instructions.append(
-                Load(
-                    result=Temporary(result.name),
-                    result_type=_vtype_to_ir_type(vtype),
-                    address=Temporary(slot_name),
-                )
-            )
+        _push_slot_results(ctx, block, ret_slots)
+
+    claim_v128_result(ctx, block, func_type.results)
+    return block
+
+
+def _emit_table_entry(
+    ctx: FunctionContext,
+    mod_ctx: ModuleContext,
+    func: Function,
+    block: Block,
+    elem_idx: str,
+    type_idx: int,
+) -> tuple[Block, str]:
+    """Check table slot ``elem_idx`` for a call through ``type_idx``.
+
+    Table slots are 16-byte (code pointer, signature id) pairs.  The index is
+    checked against ``__wasm_table_size`` and the slot's id against the
+    canonical id of ``type_idx``, each with one compare and a branch to a
+    trapping block; a null slot has id 0, so it fails the signature check
+    too.  Returns the block that continues after the checks and the
+    temporary holding the code pointer.
+    """
+    check_label = ctx.new_label("call_indirect_check")
+    ok_label = ctx.new_label("call_indirect_ok")
+    oob_label = ctx.new_label("call_indirect_oob")
+    bad_label = ctx.new_label("call_indirect_bad")
+
+    size = ctx.stack.new_temp_no_push(ValueType.I32).name
+    in_bounds = ctx.stack.new_temp_no_push(ValueType.I32).name
+    block.instructions.extend([
+        Load(
+            result=Temporary(size),
+            result_type=W,
+            address=Global("__wasm_table_size"),
+            load_type="loaduw",
+        ),
+        Comparison(
+            result=Temporary(in_bounds),
+            result_type=W,
+            op="cultw",
+            left=Temporary(elem_idx),
+            right=Temporary(size),
+        ),
+    ])
+    block.terminator = Branch(
+        condition=Temporary(in_bounds),
+        if_true=Label(check_label),
+        if_false=Label(oob_label),
+    )
+
+    # Slot address: __wasm_table + idx * 16
+    base = ctx.stack.new_temp_no_push(ValueType.I64).name
+    idx64 = ctx.stack.new_temp_no_push(ValueType.I64).name
+    offset = ctx.stack.new_temp_no_push(ValueType.I64).name
+    slot = ctx.stack.new_temp_no_push(ValueType.I64).name
+    sig_addr = ctx.stack.new_temp_no_push(ValueType.I64).name
+    sig = ctx.stack.new_temp_no_push(ValueType.I32).name
+    matches = ctx.stack.new_temp_no_push(ValueType.I32).name
+    check_block = func.add_block(check_label)
+    check_block.instructions = [
+        Load(result=Temporary(base), result_type=L, address=Global("__wasm_table")),
+        Conversion(
+            op="extuw",
+            result=Temporary(idx64),
+            result_type=L,
+            operand=Temporary(elem_idx),
+        ),
+        BinaryOp(
+            result=Temporary(offset),
+            result_type=L,
+            op="shl",
+            left=Temporary(idx64),
+            right=IntConst(4),
+        ),
+        BinaryOp(
+            result=Temporary(slot),
+            result_type=L,
+            op="add",
+            left=Temporary(base),
+            right=Temporary(offset),
+        ),
+        BinaryOp(
+            result=Temporary(sig_addr),
+            result_type=L,
+            op="add",
+            left=Temporary(slot),
+            right=IntConst(8),
+        ),
+        Load(
+            result=Temporary(sig),
+            result_type=W,
+            address=Temporary(sig_addr),
+            load_type="loaduw",
+        ),
+        Comparison(
+            result=Temporary(matches),
+            result_type=W,
+            op="ceqw",
+            left=Temporary(sig),
+            right=IntConst(mod_ctx.signature_id(type_idx)),
+        ),
+    ]
+    check_block.terminator = Branch(
+        condition=Temporary(matches),
+        if_true=Label(ok_label),
+        if_false=Label(bad_label),
+    )
+
+    func_ptr = ctx.stack.new_temp_no_push(ValueType.I64).name
+    ok_block = func.add_block(ok_label)
+    ok_block.instructions.append(
+        Load(result=Temporary(func_ptr), result_type=L, address=Temporary(slot))
+    )
+
+    oob_block = func.add_block(oob_label)
+    oob_block.instructions.append(
+        Call(target=Global("__wasm_trap_undefined_element"), args=[])
+    )
+    oob_block.terminator = Halt()
+
+    # The runtime tells a null slot from a signature mismatch by the id
+    bad_block = func.add_block(bad_label)
+    bad_block.instructions.append(
+        Call(target=Global("__wasm_trap_indirect_call"), args=[(W, Temporary(sig))])
+    )
+    bad_block.terminator = Halt()
+
+    return ok_block, func_ptr
 
 
 def _emit_return_call(
@@ -769,8 +940,10 @@ def _emit_return_call(
 ) -> Block | None:
     """Emit a tail call to a direct function.
 
-    For self-recursion, this optimizes to a loop (update params, jump to entry).
-    For other functions, falls back to call + return.
+    For self-recursion, this optimizes to a loop (rebind params, jump back to
+    the top of the body).  For other functions it emits call + return, which
+    ``merge_tail_call_groups`` turns into a jump when the call is part of a
+    tail-call cycle.
     """
     target_func_type = ctx.module.get_func_type(target_func_idx)
 
@@ -779,117 +952,67 @@ def _emit_return_call(
 
     # Check for self-recursion
     if target_func_idx == ctx.func_idx:
-        # Self-tail-call optimization: update parameters and jump to entry
-        # Store new argument values to local parameter stack slots
+        frame = ctx.tail_frame
+        assert frame is not None
         for i, (arg, ptype) in enumerate(
             zip(args, target_func_type.params, strict=True)
         ):
-            addr_name = ctx.get_local_addr(i)
-            store_type = _vtype_to_store_type(ptype)
-            block.instructions.append(
-                Store(
-                    store_type=store_type,
-                    value=Temporary(arg.name),
-                    address=Temporary(addr_name),
+            if ptype == ValueType.V128:
+                slot = Temporary(ctx.get_local_addr(i))
+                copy_v128(ctx, block, slot, Temporary(arg.name))
+        if ctx.local_values is not None:
+            # The parameters' phis at the re-entry point take the arguments
+            for i, (arg, ptype) in enumerate(
+                zip(args, target_func_type.params, strict=True)
+            ):
+                if ptype != ValueType.V128:
+                    ctx.local_values[i] = arg.name
+        else:
+            # Store new argument values to local parameter stack slots
+            for i, (arg, ptype) in enumerate(
+                zip(args, target_func_type.params, strict=True)
+            ):
+                if ptype == ValueType.V128:
+                    continue
+                addr_name = ctx.get_local_addr(i)
+                store_type = _vtype_to_store_type(ptype)
+                block.instructions.append(
+                    Store(
+                        store_type=store_type,
+                        value=Temporary(arg.name),
+                        address=Temporary(addr_name),
+                    )
                 )
-            )
 
-        # Jump back to entry block
-        block.terminator = Jump(target=Label("entry"))
+        # Jump back to the top of the body (past the parameter setup)
+        frame.incoming.append((block.name, [], ssa.snapshot(ctx)))
+        block.terminator = Jump(target=Label(frame.label_name))
         return None
 
-    # Non-self tail call: emit regular call + return
-    # Build argument list for Call instruction
-    call_args = []
-    for arg, ptype in zip(args, target_func_type.params, strict=True):
-        qbe_type = _vtype_to_ir_type(ptype)
-        call_args.append((qbe_type, Temporary(arg.name)))
-
+    call_args = [
+        (_vtype_to_ir_type(ptype), Temporary(arg.name))
+        for arg, ptype in zip(args, target_func_type.params, strict=True)
+    ]
     func_name = mod_ctx.get_func_name(target_func_idx)
-
-    # Emit call and return result
-    if not target_func_type.results:
-        block.instructions.append(Call(target=Global(func_name), args=call_args))
-        block.terminator = Return(value=None)
-    elif len(target_func_type.results) == 1:
-        result = ctx.stack.new_temp_no_push(target_func_type.results[0])
-        qbe_type = _vtype_to_ir_type(target_func_type.results[0])
-        block.instructions.append(
-            Call(
-                target=Global(func_name),
-                args=call_args,
-                result=Temporary(result.name),
-                result_type=qbe_type,
-            )
-        )
-        block.terminator = Return(value=Temporary(result.name))
-    else:
-        # Multi-value return: allocate stack slots, call, then return first value
-        # and store rest to out-params
-        from qbepy.ir import Alloc  # noqa: PLC0415
-
-        ret_slots = []
-        for i in range(1, len(target_func_type.results)):
-            vtype = target_func_type.results[i]
-            slot_name = ctx.stack.new_temp_no_push(ValueType.I64).name
-            size = _vtype_size(vtype)
-            align = 8 if size == 8 else 4
-            block.instructions.append(
-                Alloc(result=Temporary(slot_name), size=IntConst(size), align=align)
-            )
-            call_args.append((L, Temporary(slot_name)))
-            ret_slots.append((slot_name, vtype))
-
-        # Call and get first result
-        first_result = ctx.stack.new_temp_no_push(target_func_type.results[0])
-        qbe_type = _vtype_to_ir_type(target_func_type.results[0])
-        block.instructions.append(
-            Call(
-                target=Global(func_name),
-                args=call_args,
-                result=Temporary(first_result.name),
-                result_type=qbe_type,
-            )
-        )
-
-        # Store additional results to our out-params
-        for i, (slot_name, vtype) in enumerate(ret_slots):
-            loaded_val = ctx.stack.new_temp_no_push(vtype)
-            block.instructions.append(
-                Load(
-                    result=Temporary(loaded_val.name),
-                    result_type=_vtype_to_ir_type(vtype),
-                    address=Temporary(slot_name),
-                )
-            )
-            out_param = ctx.mv_out_params[i]
-            store_type = _vtype_to_store_type(vtype)
-            block.instructions.append(
-                Store(
-                    store_type=store_type,
-                    value=Temporary(loaded_val.name),
-                    address=Temporary(out_param),
-                )
-            )
-
-        block.terminator = Return(value=Temporary(first_result.name))
-
+    _emit_tail_call(
+        ctx, mod_ctx, func, block, Global(func_name), call_args, target_func_type
+    )
     return None
 
 
 def _emit_return_call_indirect(
     ctx: FunctionContext,
+    mod_ctx: ModuleContext,
     func: Function,
     block: Block,
     type_idx: int,
 ) -> Block | None:
     """Emit a tail call through a table.
 
-    Since we can't know the target at compile time, this falls back
-    to an indirect call + return.
+    This is a checked indirect call + return, which ``merge_tail_call_groups``
+    turns into a jump when the slot holds a member of the caller's tail-call
+    group.
     """
-    from qbepy.ir import Conversion  # noqa: PLC0415
-
     func_type = _get_func_type(ctx.module, type_idx)
 
     # Pop table index
@@ -897,142 +1020,31 @@ def _emit_return_call_indirect(
 
     # Pop arguments (in reverse order)
     args = ctx.stack.pop_n(len(func_type.params))
+    call_args = [
+        (_vtype_to_ir_type(ptype), Temporary(arg.name))
+        for arg, ptype in zip(args, func_type.params, strict=True)
+    ]
 
-    # Build argument list
-    call_args = []
-    for arg, ptype in zip(args, func_type.params, strict=True):
-        qbe_type = _vtype_to_ir_type(ptype)
-        call_args.append((qbe_type, Temporary(arg.name)))
-
-    # Load table base pointer
-    table_base = ctx.stack.new_temp_no_push(ValueType.I64)
-    block.instructions.append(
-        Load(
-            result=Temporary(table_base.name),
-            result_type=L,
-            address=Global("__wasm_table"),
-        )
+    block, func_ptr = _emit_table_entry(
+        ctx, mod_ctx, func, block, table_idx.name, type_idx
     )
-
-    # Calculate offset: table_idx * 8
-    idx64 = ctx.stack.new_temp_no_push(ValueType.I64)
-    block.instructions.append(
-        Conversion(
-            op="extuw",
-            result=Temporary(idx64.name),
-            result_type=L,
-            operand=Temporary(table_idx.name),
-        )
+    _emit_tail_call(
+        ctx, mod_ctx, func, block, Temporary(func_ptr), call_args, func_type
     )
-
-    offset = ctx.stack.new_temp_no_push(ValueType.I64)
-    block.instructions.append(
-        BinaryOp(
-            result=Temporary(offset.name),
-            result_type=L,
-            op="mul",
-            left=Temporary(idx64.name),
-            right=IntConst(8),
-        )
-    )
-
-    addr = ctx.stack.new_temp_no_push(ValueType.I64)
-    block.instructions.append(
-        BinaryOp(
-            result=Temporary(addr.name),
-            result_type=L,
-            op="add",
-            left=Temporary(table_base.name),
-            right=Temporary(offset.name),
-        )
-    )
-
-    # Load function pointer
-    func_ptr = ctx.stack.new_temp_no_push(ValueType.I64)
-    block.instructions.append(
-        Load(
-            result=Temporary(func_ptr.name),
-            result_type=L,
-            address=Temporary(addr.name),
-        )
-    )
-
-    # Emit indirect call and return result
-    if not func_type.results:
-        block.instructions.append(Call(target=Temporary(func_ptr.name), args=call_args))
-        block.terminator = Return(value=None)
-    elif len(func_type.results) == 1:
-        result = ctx.stack.new_temp_no_push(func_type.results[0])
-        qbe_type = _vtype_to_ir_type(func_type.results[0])
-        block.instructions.append(
-            Call(
-                target=Temporary(func_ptr.name),
-                args=call_args,
-                result=Temporary(result.name),
-                result_type=qbe_type,
-            )
-        )
-        block.terminator = Return(value=Temporary(result.name))
-    else:
-        # Multi-value return for indirect tail call
-        from qbepy.ir import Alloc  # noqa: PLC0415
-
-        ret_slots = []
-        for i in range(1, len(func_type.results)):
-            vtype = func_type.results[i]
-            slot_name = ctx.stack.new_temp_no_push(ValueType.I64).name
-            size = _vtype_size(vtype)
-            align = 8 if size == 8 else 4
-            block.instructions.append(
-                Alloc(result=Temporary(slot_name), size=IntConst(size), align=align)
-            )
-            call_args.append((L, Temporary(slot_name)))
-            ret_slots.append((slot_name, vtype))
-
-        first_result = ctx.stack.new_temp_no_push(func_type.results[0])
-        qbe_type = _vtype_to_ir_type(func_type.results[0])
-        block.instructions.append(
-            Call(
-                target=Temporary(func_ptr.name),
-                args=call_args,
-                result=Temporary(first_result.name),
-                result_type=qbe_type,
-            )
-        )
-
-        for i, (slot_name, vtype) in enumerate(ret_slots):
-            loaded_val = ctx.stack.new_temp_no_push(vtype)
-            block.instructions.append(
-                Load(
-                    result=Temporary(loaded_val.name),
-                    result_type=_vtype_to_ir_type(vtype),
-                    address=Temporary(slot_name),
-                )
-            )
-            out_param = ctx.mv_out_params[i]
-            store_type = _vtype_to_store_type(vtype)
-            block.instructions.append(
-                Store(
-                    store_type=store_type,
-                    value=Temporary(loaded_val.name),
-                    address=Temporary(out_param),
-                )
-            )
-
-        block.terminator = Return(value=Temporary(first_result.name))
-
-    return None
+    return block
 
 
 def _emit_return_call_ref(
     ctx: FunctionContext,
+    mod_ctx: ModuleContext,
     func: Function,
     block: Block,
     type_idx: int,
 ) -> Block | None:
     """Emit a tail call via typed function reference.
 
-    The function reference is on the stack.
+    The function reference is on the stack.  Like ``return_call_indirect``
+    this is a call + return that becomes a jump to a tail-call group member.
     """
     func_type = _get_func_type(ctx.module, type_idx)
 
@@ -1041,75 +1053,45 @@ def _emit_return_call_ref(
 
     # Pop arguments (in reverse order)
     args = ctx.stack.pop_n(len(func_type.params))
+    call_args = [
+        (_vtype_to_ir_type(ptype), Temporary(arg.name))
+        for arg, ptype in zip(args, func_type.params, strict=True)
+    ]
+    _emit_tail_call(
+        ctx, mod_ctx, func, block, Temporary(func_ref.name), call_args, func_type
+    )
+    return None
 
-    # Build argument list
-    call_args = []
-    for arg, ptype in zip(args, func_type.params, strict=True):
-        qbe_type = _vtype_to_ir_type(ptype)
-        call_args.append((qbe_type, Temporary(arg.name)))
 
-    # Emit call via function reference and return result
+def _emit_tail_call(
+    ctx: FunctionContext,
+    mod_ctx: ModuleContext,
+    func: Function,
+    block: Block,
+    target: Any,
+    call_args: list[tuple[Any, Any]],
+    func_type: FuncType,
+) -> None:
+    """End ``block`` with a call to ``target`` whose result it returns.
+
+    A tail callee has the caller's results, so it gets the caller's own
+    multi-value out-parameters and the call is directly followed by ``ret``,
+    the shape ``merge_tail_call_groups`` looks for.  The block is recorded
+    in ``mod_ctx.tail_calls`` so that a tail call left as a call is reported.
+    """
+    call_args = [*call_args, *((L, Temporary(out)) for out in ctx.mv_out_params)]
+    mod_ctx.tail_calls.add((func.name, block.name))
     if not func_type.results:
-        block.instructions.append(Call(target=Temporary(func_ref.name), args=call_args))
+        block.instructions.append(Call(target=target, args=call_args))
         block.terminator = Return(value=None)
-    elif len(func_type.results) == 1:
-        result = ctx.stack.new_temp_no_push(func_type.results[0])
-        qbe_type = _vtype_to_ir_type(func_type.results[0])
-        block.instructions.append(
-            Call(
-                target=Temporary(func_ref.name),
-                args=call_args,
-                result=Temporary(result.name),
-                result_type=qbe_type,
-            )
-        )
-        block.terminator = Return(value=Temporary(result.name))
-    else:
-        # Multi-value return for ref call
-        from qbepy.ir import Alloc  # noqa: PLC0415
-
-        ret_slots = []
-        for i in range(1, len(func_type.results)):
-            vtype = func_type.results[i]
-            slot_name = ctx.stack.new_temp_no_push(ValueType.I64).name
-            size = _vtype_size(vtype)
-            align = 8 if size == 8 else 4
-            block.instructions.append(
-                Alloc(result=Temporary(slot_name), size=IntConst(size), align=align)
-            )
-            call_args.append((L, Temporary(slot_name)))
-            ret_slots.append((slot_name, vtype))
-
-        first_result = ctx.stack.new_temp_no_push(func_type.results[0])
-        qbe_type = _vtype_to_ir_type(func_type.results[0])
-        block.instructions.append(
-            Call(
-                target=Temporary(func_ref.name),
-                args=call_args,
-                result=Temporary(first_result.name),
-                result_type=qbe_type,
-            )
+        return
+    result = Temporary(ctx.stack.new_temp_no_push(func_type.results[0]).name)
+    block.instructions.append(
+        Call(
+            target=target,
+            args=call_args,
+            result=result,
+            result_type=_vtype_to_ir_type(func_type.results[0]),
         )
-
-        for i, (slot_name, vtype) in enumerate(ret_slots):
-            loaded_val = ctx.stack.new_temp_no_push(vtype)
-            block.instructions.append(
-                Load(
-                    result=Temporary(loaded_val.name),
-                    result_type=_vtype_to_ir_type(vtype),
-                    address=Temporary(slot_name),
-                )
-            )
-            out_param = ctx.mv_out_params[i]
-            store_type = _vtype_to_store_type(vtype)
-            block.instructions.append(
-                Store(
-                    store_type=store_type,
-                    value=Temporary(loaded_val.name),
-                    address=Temporary(out_param),
-                )
-            )
-
-        block.terminator = Return(value=Temporary(first_result.name))
-
-    return None
+    )
+    block.terminator = Return(value=result)
@@ -1,24 +1,75 @@
-"""Exception handling instruction compilation (WASM 3.0 proposal)."""
+"""Exception handling instruction compilation (WASM 3.0 proposal).
+
+Lowering model
+--------------
+Each ``try`` registers a handler frame with the runtime and calls
+``_setjmp`` on it *from the compiled function itself*, so the jump buffer
+describes a live frame.  ``_setjmp`` returns 0 on entry and ``tag + 1`` when
+an exception is delivered, and the try branches on that result straight into
+a per-try tag switch that jumps to the matching ``catch`` block.
+
+Payloads are typed by the tag's signature.  Every try owns a payload buffer
+in its function's stack frame, sized for the module's largest tag (one 8-byte
+slot per value).  ``throw`` asks the runtime for the innermost handler's
+buffer, stores its operands there directly, then unwinds; the catch block
+loads the values back with their declared types.  There is no fixed payload
+cap and no intermediate copy.  Only propagation to an outer handler (no
+matching catch, ``rethrow``, ``delegate``) copies the buffer.
+
+Handlers are popped when control leaves a try body normally (fallthrough,
+``br`` out of it, ``return``) and by the runtime when an exception is
+delivered, so catch blocks run with the enclosing handler installed.
+
+``try_table`` (the final exception handling proposal) lists its catch
+clauses up front, so a ``throw`` that sits lexically inside a matching
+``try_table`` of the same function is resolved at compile time: it becomes a
+plain branch to the clause's label with the payload values as phi operands,
+and never enters the runtime.  A ``try_table`` only registers a runtime
+handler when its body contains a call (``call``, ``call_indirect``,
+``call_ref``), ``throw_ref``, ``rethrow`` or a nested legacy ``try``.  A
+plain ``throw`` never needs one, even with a tag the table does not catch:
+it is either resolved to a clause statically or unwinds to a handler armed
+outside the table.
+"""
 
 from __future__ import annotations
 
 from typing import TYPE_CHECKING, Any
 
 from qbepy.ir import (
+    Alloc,
+    BinaryOp,
+    Branch,
     Call,
+    Comparison,
+    D,
     Global,
     Halt,
     IntConst,
     Jump,
     L,
     Label,
+    Load,
+    S,
+    Store,
     Temporary,
     W,
 )
 
 from waq.compiler.context import ControlFrame
+from waq.compiler.stack import StackValue
 from waq.parser.types import ValueType
 
+# try_table catch clause kinds
+CATCH = 0x00
+CATCH_REF = 0x01
+CATCH_ALL = 0x02
+CATCH_ALL_REF = 0x03
+
+# Opcodes that can raise exceptions the compiler cannot resolve statically:
+# call, call_indirect, call_ref, throw_ref, try, rethrow
+_RUNTIME_THROWERS = frozenset({0x10, 0x11, 0x14, 0x0A, 0x06, 0x09})
+
 if TYPE_CHECKING:
     from collections.abc import Callable
 
@@ -46,104 +97,92 @@ def compile_exception_instruction(
         block_type = read_operand("block_type")
         result_types = _block_type_to_results(block_type, ctx)
 
-        # Create labels for try structure
         try_body_label = ctx.new_label("try_body")
-        catch_label = ctx.new_label("catch")
+        dispatch_label = ctx.new_label("try_dispatch")
         end_label = ctx.new_label("try_end")
 
-        # Jump to try body
-        block.terminator = Jump(target=Label(try_body_label))
-
-        # Create try body block
-        try_block = func.add_block(try_body_label[1:])
+        code, payload_name = _arm_handler(
+            ctx, mod_ctx, block, dispatch_label, try_body_label
+        )
 
-        # Push try control frame
         frame = ControlFrame(
             kind="try",
             start_depth=ctx.stack.depth,
             result_types=result_types,
             label_name=end_label,  # Branch target for br
-            catch_label=catch_label,
+            catch_label=dispatch_label,
             end_label=end_label,
+            exc_code=code,
+            exc_payload=payload_name,
         )
         ctx.push_control(frame)
 
-        # Set up exception handler in runtime
-        # Call __wasm_push_exception_handler(catch_label_addr)
-        handler_id = ctx.stack.new_temp_no_push(ValueType.I32)
-        try_block.instructions.append(
-            Call(
-                target=Global("__wasm_push_exception_handler"),
-                args=[],
-                result=Temporary(handler_id.name),
-                result_type=W,
-            )
-        )
-
-        return try_block
+        return func.add_block(try_body_label)
 
     # catch (0x07)
     if opcode == 0x07:
         tag_idx = read_operand("u32")
+        frame = _current_try(ctx, "catch")
+        _close_arm(ctx, block, frame)
 
-        # Get the try frame
-        if not ctx.control_stack or ctx.control_stack[-1].kind not in ("try", "catch"):
-            raise ValueError("catch without matching try")
-
-        frame = ctx.control_stack[-1]
-
-        # End the previous block (try body or previous catch)
-        if block.terminator is None:
-            # Pop exception handler before leaving try
-            block.instructions.append(
-                Call(target=Global("__wasm_pop_exception_handler"), args=[])
-            )
-            assert frame.end_label is not None, "end_label must be set for try/catch"
-            block.terminator = Jump(target=Label(frame.end_label))
-
-        # Create catch block
-        catch_label = frame.catch_label
-        if frame.kind == "catch":
-            # Multiple catches - need new label
-            catch_label = ctx.new_label("catch")
-
-        assert catch_label is not None, "catch_label must be set"
-        catch_block = func.add_block(catch_label[1:])
-
-        # Update frame to catch mode
+        catch_label = ctx.new_label("catch")
         frame.kind = "catch"
         frame.exception_tag = tag_idx
-        frame.catch_label = ctx.new_label("catch_next")  # For next catch
-
-        # Get exception value from runtime
-        # The exception parameters are pushed to the stack
-        # For now, we'll get the exception object and extract params
-        exc_ref = ctx.stack.new_temp(ValueType.EXTERNREF)
-        catch_block.instructions.append(
-            Call(
-                target=Global("__wasm_get_exception"),
-                args=[],
-                result=Temporary(exc_ref.name),
-                result_type=L,
-            )
-        )
+        frame.catches.append((tag_idx, catch_label))
+        catch_block = func.add_block(catch_label)
+
+        # Push the payload values, typed by the tag's signature
+        params = ctx.module.get_tag_type(tag_idx).params
+        for name, vtype in zip(
+            _load_payload(ctx, catch_block, frame, params), params, strict=True
+        ):
+            ctx.stack.push(StackValue(name, vtype))
 
         return catch_block
 
     # throw (0x08)
     if opcode == 0x08:
         tag_idx = read_operand("u32")
+        tag_type = ctx.module.get_tag_type(tag_idx)
+        values = ctx.stack.pop_n(len(tag_type.params))
+
+        clause = _resolve_local_throw(ctx, tag_idx)
+        if clause is not None:
+            # Caught in this function: branch straight to the catch label
+            kind, _tag, target = clause
+            payload = [v.name for v in values] if kind in (CATCH, CATCH_REF) else []
+            if kind in (CATCH_REF, CATCH_ALL_REF):
+                exn = _emit_exn_new(ctx, mod_ctx, block, tag_idx, None)
+                if values:
+                    dest = ctx.stack.new_temp_no_push(ValueType.I64)
+                    block.instructions.append(
+                        Call(
+                            target=Global("__wasm_exn_payload"),
+                            args=[(L, Temporary(exn))],
+                            result=Temporary(dest.name),
+                            result_type=L,
+                        )
+                    )
+                    _store_payload(ctx, block, dest.name, values, tag_type.params)
+                payload.append(exn)
+            _emit_branch(ctx, block, target, payload)
+            return None
+
+        if values:
+            # Write the payload straight into the receiving handler's slots
+            dest = ctx.stack.new_temp_no_push(ValueType.I64)
+            block.instructions.append(
+                Call(
+                    target=Global("__wasm_exception_payload"),
+                    args=[(W, IntConst(tag_idx))],
+                    result=Temporary(dest.name),
+                    result_type=L,
+                )
+            )
+            _store_payload(ctx, block, dest.name, values, tag_type.params)
 
-        # Pop exception parameters from stack based on tag type
-        # For now, we support simple exceptions without parameters
-        # TODO: Look up tag signature from module and pop appropriate values
-
-        # Call runtime to throw exception
         block.instructions.append(
-            Call(
-                target=Global("__wasm_throw"),
-                args=[(W, IntConst(tag_idx))],
-            )
+            Call(target=Global("__wasm_throw"), args=[(W, IntConst(tag_idx))])
         )
 
         # Throw doesn't return - mark as unreachable
@@ -154,71 +193,517 @@ def compile_exception_instruction(
     if opcode == 0x09:
         depth = read_operand("u32")
 
-        # Find the catch frame at the given depth
         target = ctx.get_branch_target(depth)
         if target.kind != "catch":
             raise ValueError("rethrow target is not a catch block")
 
-        # Call runtime to rethrow
-        block.instructions.append(Call(target=Global("__wasm_rethrow"), args=[]))
-
-        block.terminator = Halt()
+        emit_handler_pops(ctx, block, ctx.handlers_above(target))
+        _emit_propagate(ctx, mod_ctx, block, target)
         return None
 
     # delegate (0x18)
     if opcode == 0x18:
         depth = read_operand("u32")
-
-        # Get the try frame
-        if not ctx.control_stack or ctx.control_stack[-1].kind != "try":
+        frame = _current_try(ctx, "delegate")
+        if frame.kind != "try":
             raise ValueError("delegate without matching try")
+        _close_arm(ctx, block, frame)
+        ctx.pop_control()
+
+        # Exceptions from the body go to the handler of the frame at
+        # 'depth' (or to the caller), skipping any handlers in between
+        if depth < len(ctx.control_stack):
+            pops = ctx.handlers_above(ctx.get_branch_target(depth))
+        else:
+            pops = ctx.handlers_above(None)
+        assert frame.catch_label is not None
+        dispatch_block = func.add_block(frame.catch_label)
+        emit_handler_pops(ctx, dispatch_block, pops)
+        _emit_propagate(ctx, mod_ctx, dispatch_block, frame)
+
+        return _merge_block(ctx, func, frame)
 
-        frame = ctx.pop_control()
+    # catch_all (0x19)
+    if opcode == 0x19:
+        frame = _current_try(ctx, "catch_all")
+        _close_arm(ctx, block, frame)
 
-        # End try body
-        assert frame.end_label is not None, "end_label must be set for try"
-        if block.terminator is None:
-            block.instructions.append(
-                Call(target=Global("__wasm_pop_exception_handler"), args=[])
+        catch_all_label = ctx.new_label("catch_all")
+        frame.kind = "catch"
+        frame.catch_all_label = catch_all_label
+        frame.exception_tag = None  # catch_all catches all tags
+
+        return func.add_block(catch_all_label)
+
+    # throw_ref (0x0A)
+    if opcode == 0x0A:
+        exn = ctx.stack.pop()
+        block.instructions.append(
+            Call(target=Global("__wasm_throw_ref"), args=[(L, Temporary(exn.name))])
+        )
+        block.terminator = Halt()
+        return None
+
+    # try_table (0x1F)
+    if opcode == 0x1F:
+        block_type = read_operand("block_type")
+        result_types = _block_type_to_results(block_type, ctx)
+
+        # Clause labels are relative to the context outside the try_table
+        clauses = []
+        for _ in range(read_operand("u32")):
+            kind = read_operand("byte")
+            tag_idx = read_operand("u32") if kind in (CATCH, CATCH_REF) else None
+            depth = read_operand("u32")
+            target = None
+            if depth < len(ctx.control_stack):
+                target = ctx.get_branch_target(depth)
+            clauses.append((kind, tag_idx, target))
+
+        frame = ControlFrame(
+            kind="try_table",
+            start_depth=ctx.stack.depth,
+            result_types=result_types,
+            label_name=ctx.new_label("try_table_end"),
+            handlers=clauses,
+        )
+
+        new_block = None
+        if _needs_runtime_handler(ctx):
+            dispatch_label = ctx.new_label("try_table_dispatch")
+            body_label = ctx.new_label("try_table_body")
+            frame.catch_label = dispatch_label
+            frame.exc_code, frame.exc_payload = _arm_handler(
+                ctx, mod_ctx, block, dispatch_label, body_label
             )
-            block.terminator = Jump(target=Label(frame.end_label))
+            new_block = func.add_block(body_label)
 
-        # Create end block
-        return func.add_block(frame.end_label[1:])
+        ctx.push_control(frame)
+        return new_block
 
-        # Delegate forwards exceptions to outer handler at 'depth'
-        # This is handled by the runtime - we just mark the delegation
-        # The runtime will pop our handler and re-throw to the outer one
+    # Not an exception instruction
+    return False  # type: ignore[return-value]
 
-    # catch_all (0x19)
-    if opcode == 0x19:
-        # Get the try/catch frame
-        if not ctx.control_stack or ctx.control_stack[-1].kind not in ("try", "catch"):
-            raise ValueError("catch_all without matching try")
 
-        frame = ctx.control_stack[-1]
+def compile_try_end(
+    ctx: FunctionContext,
+    mod_ctx: ModuleContext,
+    func: Function,
+    block: Block,
+    frame: ControlFrame,
+) -> Block:
+    """Compile the ``end`` of a try/catch (the frame is already popped).
 
-        # End the previous block
-        assert frame.end_label is not None, "end_label must be set for try/catch"
-        if block.terminator is None:
-            block.instructions.append(
-                Call(target=Global("__wasm_pop_exception_handler"), args=[])
+    Emits the tag switch for the try and the merge block.
+    """
+    _close_arm(ctx, block, frame)
+
+    assert frame.catch_label is not None
+    assert frame.exc_code is not None
+    current = func.add_block(frame.catch_label)
+    for tag_idx, catch_label in frame.catches:
+        next_label = ctx.new_label("try_dispatch_next")
+        current.terminator = _tag_test(
+            ctx, current, frame, tag_idx, catch_label, next_label
+        )
+        current = func.add_block(next_label)
+
+    if frame.catch_all_label is not None:
+        current.terminator = Jump(target=Label(frame.catch_all_label))
+    else:
+        # No clause matched: hand the exception to the enclosing handler
+        _emit_propagate(ctx, mod_ctx, current, frame)
+
+    return _merge_block(ctx, func, frame)
+
+
+def compile_try_table_end(
+    ctx: FunctionContext,
+    mod_ctx: ModuleContext,
+    func: Function,
+    block: Block,
+    frame: ControlFrame,
+) -> Block:
+    """Compile the ``end`` of a try_table (the frame is already popped).
+
+    If the try_table registered a runtime handler, this also emits its
+    dispatch: each clause, in order, tests the delivered tag and branches to
+    the clause label with the payload loaded from the handler's slots.
+    """
+    _close_arm(ctx, block, frame)
+
+    if frame.exc_code is not None:
+        assert frame.catch_label is not None
+        current = func.add_block(frame.catch_label)
+        caught_all = False
+        for kind, tag_idx, target in frame.handlers:
+            if kind in (CATCH, CATCH_REF):
+                assert tag_idx is not None
+                arm = func.add_block(ctx.new_label("try_table_catch"))
+                next_label = ctx.new_label("try_table_dispatch_next")
+                current.terminator = _tag_test(
+                    ctx, current, frame, tag_idx, arm.name, next_label
+                )
+                params = ctx.module.get_tag_type(tag_idx).params
+                values = _load_payload(ctx, arm, frame, params)
+                if kind == CATCH_REF:
+                    values.append(_emit_exn_new(ctx, mod_ctx, arm, tag_idx, frame))
+                _emit_branch(ctx, arm, target, values)
+                current = func.add_block(next_label)
+                continue
+            # catch_all / catch_all_ref: every remaining tag lands here
+            values = []
+            if kind == CATCH_ALL_REF:
+                values.append(_emit_exn_new(ctx, mod_ctx, current, None, frame))
+            _emit_branch(ctx, current, target, values)
+            caught_all = True
+            break
+        if not caught_all:
+            _emit_propagate(ctx, mod_ctx, current, frame)
+
+    return _merge_block(ctx, func, frame)
+
+
+def emit_handler_pops(ctx: FunctionContext, block: Block, count: int) -> None:
+    """Pop ``count`` exception handlers before control leaves their try bodies."""
+    for _ in range(count):
+        block.instructions.append(
+            Call(target=Global("__wasm_pop_exception_handler"), args=[])
+        )
+
+
+def _current_try(ctx: FunctionContext, what: str) -> ControlFrame:
+    """Get the innermost try frame for a catch/catch_all/delegate."""
+    if not ctx.control_stack or ctx.control_stack[-1].kind not in ("try", "catch"):
+        raise ValueError(f"{what} without matching try")
+    return ctx.control_stack[-1]
+
+
+def _close_arm(ctx: FunctionContext, block: Block, frame: ControlFrame) -> None:
+    """Finish the try body or a catch arm, jumping to the merge block."""
+    from waq.compiler.instructions.control import fall_through  # noqa: PLC0415
+
+    if block.terminator is None and frame.exc_code is not None:
+        if frame.kind in ("try", "try_table"):
+            # Leaving the body normally: its handler is still installed
+            emit_handler_pops(ctx, block, 1)
+    fall_through(ctx, block, frame)
+
+
+def _merge_block(ctx: FunctionContext, func: Function, frame: ControlFrame) -> Block:
+    """Create the merge block of a try/try_table, with phis for its results."""
+    from waq.compiler.instructions.control import merge_block  # noqa: PLC0415
+
+    return merge_block(ctx, func, frame)
+
+
+def _emit_branch(
+    ctx: FunctionContext,
+    block: Block,
+    target: ControlFrame | None,
+    values: list[str],
+) -> None:
+    """Branch to a catch clause label (``None`` is the function body)."""
+    from waq.compiler.instructions.control import emit_branch  # noqa: PLC0415
+
+    emit_branch(ctx, block, target, values)
+
+
+def _arm_handler(
+    ctx: FunctionContext,
+    mod_ctx: ModuleContext,
+    block: Block,
+    dispatch_label: str,
+    body_label: str,
+) -> tuple[str, str | None]:
+    """Register a runtime handler and _setjmp on it in this frame.
+
+    Returns the temps holding the _setjmp result and the payload buffer.
+    """
+    # Payload slots live in the function frame, not in the runtime
+    payload_size = mod_ctx.exception_payload_size()
+    payload: Temporary | IntConst = IntConst(0)
+    payload_name = None
+    if payload_size > 0:
+        payload_name = ctx.stack.new_temp_no_push(ValueType.I64).name
+        assert ctx.entry_block is not None
+        ctx.entry_block.instructions.append(
+            Alloc(
+                result=Temporary(payload_name),
+                size=IntConst(payload_size),
+                align=8,
             )
-            block.terminator = Jump(target=Label(frame.end_label))
+        )
+        payload = Temporary(payload_name)
+
+    handler = ctx.stack.new_temp_no_push(ValueType.I64)
+    code = ctx.stack.new_temp_no_push(ValueType.I32)
+    block.instructions.append(
+        Call(
+            target=Global("__wasm_push_exception_handler"),
+            args=[(L, payload)],
+            result=Temporary(handler.name),
+            result_type=L,
+        )
+    )
+    block.instructions.append(
+        Call(
+            target=Global("_setjmp"),
+            args=[(L, Temporary(handler.name))],
+            result=Temporary(code.name),
+            result_type=W,
+        )
+    )
+    block.terminator = Branch(
+        condition=Temporary(code.name),
+        if_true=Label(dispatch_label),
+        if_false=Label(body_label),
+    )
+    return code.name, payload_name
 
-        # Create catch_all block
-        catch_all_label = ctx.new_label("catch_all")
-        catch_all_block = func.add_block(catch_all_label[1:])
 
-        # Update frame
-        frame.kind = "catch"
-        frame.catch_all_label = catch_all_label
-        frame.exception_tag = None  # catch_all catches all tags
+def _tag_test(
+    ctx: FunctionContext,
+    block: Block,
+    frame: ControlFrame,
+    tag_idx: int,
+    if_true: str,
+    if_false: str,
+) -> Branch:
+    """Compare the delivered tag against ``tag_idx`` and branch on it."""
+    assert frame.exc_code is not None
+    matches = ctx.stack.new_temp_no_push(ValueType.I32)
+    block.instructions.append(
+        Comparison(
+            result=Temporary(matches.name),
+            result_type=W,
+            op="ceqw",
+            left=Temporary(frame.exc_code),
+            right=IntConst(tag_idx + 1),
+        )
+    )
+    return Branch(
+        condition=Temporary(matches.name),
+        if_true=Label(if_true),
+        if_false=Label(if_false),
+    )
 
-        return catch_all_block
 
-    # Not an exception instruction
-    return False  # type: ignore[return-value]
+def _resolve_local_throw(
+    ctx: FunctionContext, tag_idx: int
+) -> tuple[int, int | None, ControlFrame | None] | None:
+    """Find the try_table clause that statically catches a throw, if any.
+
+    Walks outward from the throw.  A legacy ``try`` body in between makes the
+    outcome a runtime matter, as does reaching the function boundary.
+    """
+    for frame in reversed(ctx.control_stack):
+        if frame.kind == "try":
+            return None
+        if frame.kind != "try_table":
+            continue
+        for clause in frame.handlers:
+            kind, clause_tag, _target = clause
+            if kind in (CATCH_ALL, CATCH_ALL_REF) or clause_tag == tag_idx:
+                return clause
+    return None
+
+
+def _needs_runtime_handler(ctx: FunctionContext) -> bool:
+    """Whether the try_table at the current offset can see runtime throws.
+
+    Calls may throw from other functions, ``throw_ref`` and ``rethrow``
+    raise an exception only known at run time, and a nested legacy ``try``
+    unwinds through the runtime.  Plain ``throw`` needs no handler, whatever
+    its tag: ``_resolve_local_throw`` finds the catching clause statically,
+    or the exception goes to a handler armed outside this table.
+    """
+    from waq.parser.code import block_body  # noqa: PLC0415
+
+    return any(
+        instr.opcode in _RUNTIME_THROWERS
+        for instr in block_body(ctx.code, ctx.instr_offset)
+    )
+
+
+def _store_payload(
+    ctx: FunctionContext,
+    block: Block,
+    dest: str,
+    values: list[StackValue],
+    types: tuple[ValueType, ...],
+) -> None:
+    """Store payload values into consecutive 8-byte slots at ``dest``."""
+    _check_payload_types(types)
+    for i, (value, vtype) in enumerate(zip(values, types, strict=True)):
+        block.instructions.append(
+            Store(
+                store_type=_vtype_to_store_type(vtype),
+                value=Temporary(value.name),
+                address=_slot_addr(ctx, block, dest, i),
+            )
+        )
+
+
+def _check_payload_types(types: tuple[ValueType, ...]) -> None:
+    """Payload slots hold 8 bytes: v128 values do not fit."""
+    if ValueType.V128 in types:
+        raise ValueError("v128 exception payloads are not supported")
+
+
+def _load_payload(
+    ctx: FunctionContext,
+    block: Block,
+    frame: ControlFrame,
+    types: tuple[ValueType, ...],
+) -> list[str]:
+    """Load a delivered payload from a handler's slots; returns the temps."""
+    _check_payload_types(types)
+    names = []
+    for i, vtype in enumerate(types):
+        assert frame.exc_payload is not None
+        value = ctx.stack.new_temp_no_push(vtype)
+        block.instructions.append(
+            Load(
+                result=Temporary(value.name),
+                result_type=_vtype_to_ir_type(vtype),
+                address=_slot_addr(ctx, block, frame.exc_payload, i),
+                load_type=_vtype_to_load_type(vtype),
+            )
+        )
+        names.append(value.name)
+    return names
+
+
+def _emit_exn_new(
+    ctx: FunctionContext,
+    mod_ctx: ModuleContext,
+    block: Block,
+    tag_idx: int | None,
+    frame: ControlFrame | None,
+) -> str:
+    """Allocate an exnref for ``catch_ref``/``catch_all_ref``.
+
+    With a handler ``frame`` the exnref captures the delivered exception
+    (tag from the _setjmp result, payload from the handler's slots);
+    otherwise the caller fills in the payload.
+    """
+    tag: Temporary | IntConst
+    if frame is not None and tag_idx is None:
+        assert frame.exc_code is not None
+        tag_temp = ctx.stack.new_temp_no_push(ValueType.I32)
+        block.instructions.append(
+            BinaryOp(
+                result=Temporary(tag_temp.name),
+                result_type=W,
+                op="sub",
+                left=Temporary(frame.exc_code),
+                right=IntConst(1),
+            )
+        )
+        tag = Temporary(tag_temp.name)
+    else:
+        assert tag_idx is not None
+        tag = IntConst(tag_idx)
+
+    payload: Temporary | IntConst = IntConst(0)
+    if frame is not None:
+        if frame.exc_payload is not None:
+            payload = Temporary(frame.exc_payload)
+        size = mod_ctx.exception_payload_size()
+    else:
+        assert tag_idx is not None
+        size = 8 * len(ctx.module.get_tag_type(tag_idx).params)
+
+    exn = ctx.stack.new_temp_no_push(ValueType.EXNREF)
+    block.instructions.append(
+        Call(
+            target=Global("__wasm_exn_new"),
+            args=[(W, tag), (L, payload), (L, IntConst(size))],
+            result=Temporary(exn.name),
+            result_type=L,
+        )
+    )
+    return exn.name
+
+
+def _emit_propagate(
+    ctx: FunctionContext, mod_ctx: ModuleContext, block: Block, frame: ControlFrame
+) -> None:
+    """Re-deliver the exception caught by ``frame`` to the enclosing handler."""
+    assert frame.exc_code is not None
+    tag = ctx.stack.new_temp_no_push(ValueType.I32)
+    block.instructions.append(
+        BinaryOp(
+            result=Temporary(tag.name),
+            result_type=W,
+            op="sub",
+            left=Temporary(frame.exc_code),
+            right=IntConst(1),
+        )
+    )
+    payload = Temporary(frame.exc_payload) if frame.exc_payload else IntConst(0)
+    block.instructions.append(
+        Call(
+            target=Global("__wasm_rethrow"),
+            args=[
+                (W, Temporary(tag.name)),
+                (L, payload),
+                (L, IntConst(mod_ctx.exception_payload_size())),
+            ],
+        )
+    )
+    block.terminator = Halt()
+
+
+def _slot_addr(ctx: FunctionContext, block: Block, base: str, index: int) -> Temporary:
+    """Address of payload slot ``index`` in the buffer at ``base``."""
+    if index == 0:
+        return Temporary(base)
+    addr = ctx.stack.new_temp_no_push(ValueType.I64)
+    block.instructions.append(
+        BinaryOp(
+            result=Temporary(addr.name),
+            result_type=L,
+            op="add",
+            left=Temporary(base),
+            right=IntConst(8 * index),
+        )
+    )
+    return Temporary(addr.name)
+
+
+def _vtype_to_ir_type(vtype: ValueType):
+    """Convert WASM ValueType to qbepy IR type (references are pointers)."""
+    if vtype == ValueType.I32:
+        return W
+    if vtype == ValueType.F32:
+        return S
+    if vtype == ValueType.F64:
+        return D
+    return L
+
+
+def _vtype_to_store_type(vtype: ValueType) -> str:
+    """Convert WASM ValueType to QBE store type."""
+    if vtype == ValueType.I32:
+        return "storew"
+    if vtype == ValueType.F32:
+        return "stores"
+    if vtype == ValueType.F64:
+        return "stored"
+    return "storel"
+
+
+def _vtype_to_load_type(vtype: ValueType) -> str:
+    """Convert WASM ValueType to QBE load instruction name."""
+    if vtype == ValueType.I32:
+        return "loadw"
+    if vtype == ValueType.F32:
+        return "loads"
+    if vtype == ValueType.F64:
+        return "loadd"
+    return "loadl"
 
 
 def _block_type_to_results(block_type, ctx: FunctionContext) -> tuple[ValueType, ...]:
@@ -25,6 +25,7 @@ if TYPE_CHECKING:
     from qbepy.ir import Block
 
     from waq.compiler.context import FunctionContext, ModuleContext
+    from waq.compiler.stack import StackValue
 
 
 def _vtype_to_ir_type(vtype: ValueType):
@@ -87,6 +88,59 @@ def _get_memory_base(
     return base_temp.name
 
 
+def effective_address(
+    ctx: FunctionContext,
+    block: Block,
+    addr: StackValue,
+    offset: int,
+    memory_idx: int = 0,
+) -> str:
+    """Emit ``base + addr + offset`` for an access; the temporary holding it."""
+    base_temp_name = _get_memory_base(ctx, block, memory_idx)
+
+    if _is_memory64(ctx, memory_idx):
+        # Memory64: address is already i64
+        addr64_temp = addr
+    else:
+        # Memory32: extend address to 64-bit (it's i32)
+        addr64_temp = ctx.stack.new_temp_no_push(ValueType.I64)
+        block.instructions.append(
+            Conversion(
+                op="extuw",  # Extend unsigned word to long
+                result=Temporary(addr64_temp.name),
+                result_type=L,
+                operand=Temporary(addr.name),
+            )
+        )
+
+    # Add base + addr
+    eff_addr = ctx.stack.new_temp_no_push(ValueType.I64)
+    block.instructions.append(
+        BinaryOp(
+            result=Temporary(eff_addr.name),
+            result_type=L,
+            op="add",
+            left=Temporary(base_temp_name),
+            right=Temporary(addr64_temp.name),
+        )
+    )
+
+    # Add offset if non-zero
+    if offset > 0:
+        eff_addr2 = ctx.stack.new_temp_no_push(ValueType.I64)
+        block.instructions.append(
+            BinaryOp(
+                result=Temporary(eff_addr2.name),
+                result_type=L,
+                op="add",
+                left=Temporary(eff_addr.name),
+                right=IntConst(offset),
+            )
+        )
+        eff_addr = eff_addr2
+    return eff_addr.name
+
+
 def compile_memory_instruction(
     opcode: int,
     ctx: FunctionContext,
@@ -182,54 +236,7 @@ def _compile_load(
 
     # Pop address from stack
     addr = ctx.stack.pop()
-
-    # Check if this is memory64
-    is_mem64 = _is_memory64(ctx, memory_idx)
-
-    # Calculate effective address: base + addr + offset
-    # Get memory base pointer (handles multiple memories)
-    base_temp_name = _get_memory_base(ctx, block, memory_idx)
-
-    if is_mem64:
-        # Memory64: address is already i64
-        addr64_temp = addr
-    else:
-        # Memory32: extend address to 64-bit (it's i32)
-        addr64_temp = ctx.stack.new_temp_no_push(ValueType.I64)
-        block.instructions.append(
-            Conversion(
-                op="extuw",  # Extend unsigned word to long
-                result=Temporary(addr64_temp.name),
-                result_type=L,
-                operand=Temporary(addr.name),
-            )
-        )
-
-    # Add base + addr
-    eff_addr = ctx.stack.new_temp_no_push(ValueType.I64)
-    block.instructions.append(
-        BinaryOp(
-            result=Temporary(eff_addr.name),
-            result_type=L,
-            op="add",
-            left=Temporary(base_temp_name),
-            right=Temporary(addr64_temp.name),
-        )
-    )
-
-    # Add offset if non-zero
-    if offset > 0:
-        eff_addr2 = ctx.stack.new_temp_no_push(ValueType.I64)
-        block.instructions.append(
-            BinaryOp(
-                result=Temporary(eff_addr2.name),
-                result_type=L,
-                op="add",
-                left=Temporary(eff_addr.name),
-                right=IntConst(offset),
-            )
-        )
-        eff_addr = eff_addr2
+    eff_addr = effective_address(ctx, block, addr, offset, memory_idx)
 
     # Determine load type based on opcode
     load_info = _LOAD_OPCODES.get(opcode)
@@ -244,7 +251,7 @@ def _compile_load(
         Load(
             result=Temporary(result.name),
             result_type=qbe_type,
-            address=Temporary(eff_addr.name),
+            address=Temporary(eff_addr),
             load_type=load_op,
         )
     )
@@ -267,51 +274,7 @@ def _compile_store(
     value = ctx.stack.pop()
     addr = ctx.stack.pop()
 
-    # Check if this is memory64
-    is_mem64 = _is_memory64(ctx, memory_idx)
-
-    # Calculate effective address (same as load)
-    # Get memory base pointer (handles multiple memories)
-    base_temp_name = _get_memory_base(ctx, block, memory_idx)
-
-    if is_mem64:
-        # Memory64: address is already i64
-        addr64_temp = addr
-    else:
-        # Memory32: extend address to 64-bit
-        addr64_temp = ctx.stack.new_temp_no_push(ValueType.I64)
-        block.instructions.append(
-            Conversion(
-                op="extuw",
-                result=Temporary(addr64_temp.name),
-                result_type=L,
-                operand=Temporary(addr.name),
-            )
-        )
-
-    eff_addr = ctx.stack.new_temp_no_push(ValueType.I64)
-    block.instructions.append(
-        BinaryOp(
-            result=Temporary(eff_addr.name),
-            result_type=L,
-            op="add",
-            left=Temporary(base_temp_name),
-            right=Temporary(addr64_temp.name),
-        )
-    )
-
-    if offset > 0:
-        eff_addr2 = ctx.stack.new_temp_no_push(ValueType.I64)
-        block.instructions.append(
-            BinaryOp(
-                result=Temporary(eff_addr2.name),
-                result_type=L,
-                op="add",
-                left=Temporary(eff_addr.name),
-                right=IntConst(offset),
-            )
-        )
-        eff_addr = eff_addr2
+    eff_addr = effective_address(ctx, block, addr, offset, memory_idx)
 
     # Determine store type based on opcode
     store_op = _STORE_OPCODES.get(opcode)
@@ -320,7 +283,7 @@ def _compile_store(
 
     block.instructions.append(
         Store(
-            address=Temporary(eff_addr.name),
+            address=Temporary(eff_addr),
             value=Temporary(value.name),
             store_type=store_op,
         )
@@ -8,6 +8,7 @@ from qbepy.ir import (
     BinaryOp,
     Call,
     Comparison,
+    Conversion,
     Copy,
     D,
     FloatConst,
@@ -193,33 +194,11 @@ def _compile_i32_op(opcode: int, ctx: FunctionContext, block: Block) -> bool:
         )
         return True
 
-    # i32.rotl and i32.rotr (need runtime)
-    if opcode == 0x77:  # i32.rotl
+    # i32.rotl and i32.rotr
+    if opcode in (0x77, 0x78):
         b = stack.pop()
         a = stack.pop()
-        result = stack.new_temp(ValueType.I32)
-        block.instructions.append(
-            Call(
-                target=Global("__wasm_i32_rotl"),
-                args=[(W, Temporary(a.name)), (W, Temporary(b.name))],
-                result=Temporary(result.name),
-                result_type=W,
-            )
-        )
-        return True
-
-    if opcode == 0x78:  # i32.rotr
-        b = stack.pop()
-        a = stack.pop()
-        result = stack.new_temp(ValueType.I32)
-        block.instructions.append(
-            Call(
-                target=Global("__wasm_i32_rotr"),
-                args=[(W, Temporary(a.name)), (W, Temporary(b.name))],
-                result=Temporary(result.name),
-                result_type=W,
-            )
-        )
+        _emit_rotate(ctx, block, ValueType.I32, a, b, left=opcode == 0x77)
         return True
 
     # i32 binary arithmetic
@@ -320,33 +299,11 @@ def _compile_i64_op(opcode: int, ctx: FunctionContext, block: Block) -> bool:
         )
         return True
 
-    # i64.rotl and i64.rotr (need runtime)
-    if opcode == 0x89:  # i64.rotl
-        b = stack.pop()
-        a = stack.pop()
-        result = stack.new_temp(ValueType.I64)
-        block.instructions.append(
-            Call(
-                target=Global("__wasm_i64_rotl"),
-                args=[(L, Temporary(a.name)), (L, Temporary(b.name))],
-                result=Temporary(result.name),
-                result_type=L,
-            )
-        )
-        return True
-
-    if opcode == 0x8A:  # i64.rotr
+    # i64.rotl and i64.rotr
+    if opcode in (0x89, 0x8A):
         b = stack.pop()
         a = stack.pop()
-        result = stack.new_temp(ValueType.I64)
-        block.instructions.append(
-            Call(
-                target=Global("__wasm_i64_rotr"),
-                args=[(L, Temporary(a.name)), (L, Temporary(b.name))],
-                result=Temporary(result.name),
-                result_type=L,
-            )
-        )
+        _emit_rotate(ctx, block, ValueType.I64, a, b, left=opcode == 0x89)
         return True
 
     # i64 binary arithmetic
@@ -395,15 +352,7 @@ def _compile_f32_op(opcode: int, ctx: FunctionContext, block: Block) -> bool:
     # f32 unary operations
     if opcode == 0x8B:  # f32.abs
         a = stack.pop()
-        result = stack.new_temp(ValueType.F32)
-        block.instructions.append(
-            Call(
-                target=Global("__wasm_f32_abs"),
-                args=[(S, Temporary(a.name))],
-                result=Temporary(result.name),
-                result_type=S,
-            )
-        )
+        _emit_abs(ctx, block, ValueType.F32, a)
         return True
 
     if opcode == 0x8C:  # f32.neg
@@ -486,7 +435,20 @@ def _compile_f32_op(opcode: int, ctx: FunctionContext, block: Block) -> bool:
         )
         return True
 
-    # f32 binary operations
+    # f32.min, f32.max and f32.copysign
+    if opcode in (0x96, 0x97):
+        b = stack.pop()
+        a = stack.pop()
+        _emit_min_max(ctx, block, ValueType.F32, a, b, is_max=opcode == 0x97)
+        return True
+
+    if opcode == 0x98:
+        b = stack.pop()
+        a = stack.pop()
+        _emit_copysign(ctx, block, ValueType.F32, a, b)
+        return True
+
+    # f32 binary arithmetic
     if 0x92 <= opcode <= 0x98:
         b = stack.pop()
         a = stack.pop()
@@ -494,26 +456,15 @@ def _compile_f32_op(opcode: int, ctx: FunctionContext, block: Block) -> bool:
         op = _f32_arith_ops.get(opcode)
         if op is None:
             return False
-        if op.startswith("$"):
-            # Runtime function
-            block.instructions.append(
-                Call(
-                    target=Global(op),
-                    args=[(S, Temporary(a.name)), (S, Temporary(b.name))],
-                    result=Temporary(result.name),
-                    result_type=S,
-                )
-            )
-        else:
-            block.instructions.append(
-                BinaryOp(
-                    result=Temporary(result.name),
-                    result_type=S,
-                    op=op,
-                    left=Temporary(a.name),
-                    right=Temporary(b.name),
-                )
+        block.instructions.append(
+            BinaryOp(
+                result=Temporary(result.name),
+                result_type=S,
+                op=op,
+                left=Temporary(a.name),
+                right=Temporary(b.name),
             )
+        )
         return True
 
     return False
@@ -543,15 +494,7 @@ def _compile_f64_op(opcode: int, ctx: FunctionContext, block: Block) -> bool:
     # f64 unary operations
     if opcode == 0x99:  # f64.abs
         a = stack.pop()
-        result = stack.new_temp(ValueType.F64)
-        block.instructions.append(
-            Call(
-                target=Global("__wasm_f64_abs"),
-                args=[(D, Temporary(a.name))],
-                result=Temporary(result.name),
-                result_type=D,
-            )
-        )
+        _emit_abs(ctx, block, ValueType.F64, a)
         return True
 
     if opcode == 0x9A:  # f64.neg
@@ -634,7 +577,20 @@ def _compile_f64_op(opcode: int, ctx: FunctionContext, block: Block) -> bool:
         )
         return True
 
-    # f64 binary operations
+    # f64.min, f64.max and f64.copysign
+    if opcode in (0xA4, 0xA5):
+        b = stack.pop()
+        a = stack.pop()
+        _emit_min_max(ctx, block, ValueType.F64, a, b, is_max=opcode == 0xA5)
+        return True
+
+    if opcode == 0xA6:
+        b = stack.pop()
+        a = stack.pop()
+        _emit_copysign(ctx, block, ValueType.F64, a, b)
+        return True
+
+    # f64 binary arithmetic
     if 0xA0 <= opcode <= 0xA6:
         b = stack.pop()
         a = stack.pop()
@@ -642,31 +598,194 @@ def _compile_f64_op(opcode: int, ctx: FunctionContext, block: Block) -> bool:
         op = _f64_arith_ops.get(opcode)
         if op is None:
             return False
-        if op.startswith("$"):
-            # Runtime function
-            block.instructions.append(
-                Call(
-                    target=Global(op),
-                    args=[(D, Temporary(a.name)), (D, Temporary(b.name))],
-                    result=Temporary(result.name),
-                    result_type=D,
-                )
-            )
-        else:
-            block.instructions.append(
-                BinaryOp(
-                    result=Temporary(result.name),
-                    result_type=D,
-                    op=op,
-                    left=Temporary(a.name),
-                    right=Temporary(b.name),
-                )
+        block.instructions.append(
+            BinaryOp(
+                result=Temporary(result.name),
+                result_type=D,
+                op=op,
+                left=Temporary(a.name),
+                right=Temporary(b.name),
             )
+        )
         return True
 
     return False
 
 
+# Rotates and float sign/ordering operations are expanded inline.  QBE has no
+# rotate or float min/max, but a call would cost more than the expansion:
+# every float register is caller-saved, so the caller spills around it.
+
+
+def _binop(
+    block: Block, result: Any, vtype: ValueType, op: str, left: Any, right: Any
+) -> None:
+    """Append ``result = left op right``; operands are stack values or constants."""
+    block.instructions.append(
+        BinaryOp(
+            result=Temporary(result.name),
+            result_type=_vtype_to_ir_type(vtype),
+            op=op,
+            left=left if isinstance(left, IntConst) else Temporary(left.name),
+            right=right if isinstance(right, IntConst) else Temporary(right.name),
+        )
+    )
+
+
+def _cast(block: Block, result: Any, vtype: ValueType, value: Any) -> None:
+    """Reinterpret ``value`` as ``vtype`` (float <-> same-width integer)."""
+    block.instructions.append(
+        Conversion(
+            op="cast",
+            result=Temporary(result.name),
+            result_type=_vtype_to_ir_type(vtype),
+            operand=Temporary(value.name),
+        )
+    )
+
+
+def _emit_rotate(
+    ctx: FunctionContext,
+    block: Block,
+    vtype: ValueType,
+    a: Any,
+    b: Any,
+    *,
+    left: bool,
+) -> None:
+    """Push ``a`` rotated left or right by ``b``.
+
+    ``rotl(a, b) = (a << b) | (a >> -b)``.  QBE takes shift counts modulo the
+    width, as WASM does for rotates, so no count needs masking and a count of
+    zero shifts both halves by zero.
+    """
+    stack = ctx.stack
+    neg = stack.new_temp_no_push(vtype)
+    high = stack.new_temp_no_push(vtype)
+    low = stack.new_temp_no_push(vtype)
+    result = stack.new_temp(vtype)
+    first, second = ("shl", "shr") if left else ("shr", "shl")
+    _binop(block, neg, vtype, "sub", IntConst(0), b)
+    _binop(block, high, vtype, first, a, b)
+    _binop(block, low, vtype, second, a, neg)
+    _binop(block, result, vtype, "or", high, low)
+
+
+# Float type -> (same-width integer type, sign bit as a signed constant,
+# QBE class suffix)
+_FLOAT_BITS = {
+    ValueType.F32: (ValueType.I32, -0x80000000, "s"),
+    ValueType.F64: (ValueType.I64, -0x8000000000000000, "d"),
+}
+
+
+def _emit_abs(ctx: FunctionContext, block: Block, vtype: ValueType, a: Any) -> None:
+    """Push ``|a|`` by clearing the sign bit (NaN payloads are preserved)."""
+    stack = ctx.stack
+    itype, sign, _ = _FLOAT_BITS[vtype]
+    bits = stack.new_temp_no_push(itype)
+    cleared = stack.new_temp_no_push(itype)
+    _cast(block, bits, itype, a)
+    _binop(block, cleared, itype, "and", bits, IntConst(~sign))
+    _cast(block, stack.new_temp(vtype), vtype, cleared)
+
+
+def _emit_copysign(
+    ctx: FunctionContext, block: Block, vtype: ValueType, a: Any, b: Any
+) -> None:
+    """Push ``a`` with the sign bit of ``b``."""
+    stack = ctx.stack
+    itype, sign, _ = _FLOAT_BITS[vtype]
+    bits_a = stack.new_temp_no_push(itype)
+    bits_b = stack.new_temp_no_push(itype)
+    magnitude = stack.new_temp_no_push(itype)
+    sign_b = stack.new_temp_no_push(itype)
+    combined = stack.new_temp_no_push(itype)
+    _cast(block, bits_a, itype, a)
+    _cast(block, bits_b, itype, b)
+    _binop(block, magnitude, itype, "and", bits_a, IntConst(~sign))
+    _binop(block, sign_b, itype, "and", bits_b, IntConst(sign))
+    _binop(block, combined, itype, "or", magnitude, sign_b)
+    _cast(block, stack.new_temp(vtype), vtype, combined)
+
+
+def _emit_min_max(
+    ctx: FunctionContext,
+    block: Block,
+    vtype: ValueType,
+    a: Any,
+    b: Any,
+    *,
+    is_max: bool,
+) -> None:
+    """Push ``min(a, b)`` or ``max(a, b)`` with WASM's NaN and zero rules.
+
+    Selection is branch-free on the integer view: comparisons produce 0/1 in
+    the integer class and ``0 - flag`` turns that into a mask.
+
+    - ``a <= b`` (``>=`` for max) picks ``a``, otherwise ``b``.
+    - When ``a == b`` the operands only differ for -0 and +0; OR-ing the bits
+      (AND for max) yields -0 for min and +0 for max.
+    - When either is NaN the result is ``a + b``, which is a quiet NaN
+      carrying one of the input payloads.
+    """
+    stack = ctx.stack
+    itype, _, cls = _FLOAT_BITS[vtype]
+    ir_type = _vtype_to_ir_type(itype)
+
+    def temp() -> Any:
+        return stack.new_temp_no_push(itype)
+
+    def compare(op: str) -> Any:
+        flag = temp()
+        block.instructions.append(
+            Comparison(
+                result=Temporary(flag.name),
+                result_type=ir_type,
+                op=f"c{op}{cls}",
+                left=Temporary(a.name),
+                right=Temporary(b.name),
+            )
+        )
+        mask = temp()
+        _binop(block, mask, itype, "sub", IntConst(0), flag)
+        return mask
+
+    def select(mask: Any, if_set: Any, if_clear: Any) -> Any:
+        # if_clear ^ ((if_set ^ if_clear) & mask)
+        diff, masked, picked = temp(), temp(), temp()
+        _binop(block, diff, itype, "xor", if_set, if_clear)
+        _binop(block, masked, itype, "and", diff, mask)
+        _binop(block, picked, itype, "xor", if_clear, masked)
+        return picked
+
+    bits_a, bits_b = temp(), temp()
+    _cast(block, bits_a, itype, a)
+    _cast(block, bits_b, itype, b)
+
+    # Equal operands only differ for -0/+0: min ORs the sign bits in
+    # (bits_a | (bits_b & equal)), max ANDs them (bits_a & (bits_b | ~equal))
+    equal = compare("eq")
+    tie, preferred = temp(), temp()
+    if is_max:
+        not_equal = temp()
+        _binop(block, not_equal, itype, "xor", equal, IntConst(-1))
+        _binop(block, tie, itype, "or", bits_b, not_equal)
+        _binop(block, preferred, itype, "and", bits_a, tie)
+    else:
+        _binop(block, tie, itype, "and", bits_b, equal)
+        _binop(block, preferred, itype, "or", bits_a, tie)
+
+    ordered = select(compare("ge" if is_max else "le"), preferred, bits_b)
+
+    nan = stack.new_temp_no_push(vtype)
+    _binop(block, nan, vtype, "add", a, b)
+    nan_bits = temp()
+    _cast(block, nan_bits, itype, nan)
+    picked = select(compare("uo"), nan_bits, ordered)
+    _cast(block, stack.new_temp(vtype), vtype, picked)
+
+
 # Opcode to QBE instruction mappings
 
 _i32_cmp_ops = [
@@ -696,8 +815,7 @@ _i32_arith_ops = {
     0x74: "shl",  # i32.shl
     0x75: "sar",  # i32.shr_s
     0x76: "shr",  # i32.shr_u
-    # 0x77: i32.rotl - needs runtime
-    # 0x78: i32.rotr - needs runtime
+    # 0x77, 0x78: i32.rotl, i32.rotr - see _emit_rotate
 }
 
 _i64_cmp_ops = [
@@ -727,8 +845,7 @@ _i64_arith_ops = {
     0x86: "shl",  # i64.shl
     0x87: "sar",  # i64.shr_s
     0x88: "shr",  # i64.shr_u
-    # 0x89: i64.rotl - needs runtime
-    # 0x8A: i64.rotr - needs runtime
+    # 0x89, 0x8A: i64.rotl, i64.rotr - see _emit_rotate
 }
 
 _f32_cmp_ops = [
@@ -745,9 +862,7 @@ _f32_arith_ops = {
     0x93: "sub",  # f32.sub
     0x94: "mul",  # f32.mul
     0x95: "div",  # f32.div
-    0x96: "__wasm_f32_min",  # f32.min
-    0x97: "__wasm_f32_max",  # f32.max
-    0x98: "__wasm_f32_copysign",  # f32.copysign
+    # 0x96-0x98: f32.min, f32.max, f32.copysign - see _emit_min_max
 }
 
 _f64_cmp_ops = [
@@ -764,9 +879,7 @@ _f64_arith_ops = {
     0xA1: "sub",  # f64.sub
     0xA2: "mul",  # f64.mul
     0xA3: "div",  # f64.div
-    0xA4: "__wasm_f64_min",  # f64.min
-    0xA5: "__wasm_f64_max",  # f64.max
-    0xA6: "__wasm_f64_copysign",  # f64.copysign
+    # 0xA4-0xA6: f64.min, f64.max, f64.copysign - see _emit_min_max
 }
 
 
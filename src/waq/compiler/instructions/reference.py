@@ -79,6 +79,7 @@ def compile_reference_instruction(
         result = ctx.stack.new_temp(ValueType.FUNCREF)
         # Get function address as a reference
         func_name = mod_ctx.get_func_name(func_idx)
+        mod_ctx.ref_funcs.add(func_idx)
         block.instructions.append(
             Copy(
                 result=Temporary(result.name),
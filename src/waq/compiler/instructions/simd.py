@@ -0,0 +1,694 @@
+"""SIMD instruction compilation (0xFD prefix: fixed-width and relaxed SIMD).
+
+QBE has no vector types, so a v128 value lives in a 16-byte stack slot and
+the temporary on the operand stack holds the slot's address (class ``l``).
+Every instruction that produces a v128 gets a slot of its own, allocated in
+the entry block so the frame stays fixed inside loops.  A slot is not
+overwritten while its value is live: branches to a loop carry no operands,
+so a value only outlives an iteration by way of a local or a global, and
+those are copies.  Locals keep one slot each (``local.get`` copies out of
+it, since a later ``local.set`` rewrites it), and globals are 16-byte data.
+
+The arithmetic is done by the runtime's vector kernels, ``__wasm_<op>`` with
+the dots of the WASM name replaced by underscores.  They take the address of
+the result slot and then those of the operands.  Loads, stores, constants
+and lane accesses are plain loads and stores of the slot, and ``v128.load``
+goes through the same address computation as the scalar loads.
+
+A v128 argument is passed as the address of the caller's slot, which the
+callee copies into its local.  A v128 first result is copied into the
+calling thread's result buffer, whose address ``__wasm_v128_result()``
+gives, and the function returns that address; the caller copies it into a
+slot of its own at once (``claim_v128_result``).
+Later results go to the caller's out-parameter slots like any other.
+"""
+
+from __future__ import annotations
+
+from typing import TYPE_CHECKING, Any
+
+from qbepy.ir import (
+    Alloc,
+    BinaryOp,
+    Call,
+    D,
+    Global,
+    IntConst,
+    L,
+    Load,
+    S,
+    Store,
+    Temporary,
+    W,
+)
+
+from waq.compiler.stack import StackValue
+from waq.parser.types import ValueType
+
+from .memory import effective_address
+
+if TYPE_CHECKING:
+    from collections.abc import Callable
+
+    from qbepy.ir import Block
+
+    from waq.compiler.context import FunctionContext
+
+# Address of the thread's buffer, where a function leaves its v128 first result
+V128_RESULT = "__wasm_v128_result"
+
+_COMPARISONS = ("eq", "ne", "lt_s", "lt_u", "gt_s", "gt_u", "le_s", "le_u", "ge_s")
+_COMPARISONS += ("ge_u",)
+_FLOAT_COMPARISONS = ("eq", "ne", "lt", "gt", "le", "ge")
+
+# Kernels by sub-opcode, grouped by their number of v128 operands
+_UNARY: dict[int, str] = {
+    0x4D: "v128_not",
+    0x5E: "f32x4_demote_f64x2_zero",
+    0x5F: "f64x2_promote_low_f32x4",
+    0x60: "i8x16_abs",
+    0x61: "i8x16_neg",
+    0x62: "i8x16_popcnt",
+    0x67: "f32x4_ceil",
+    0x68: "f32x4_floor",
+    0x69: "f32x4_trunc",
+    0x6A: "f32x4_nearest",
+    0x74: "f64x2_ceil",
+    0x75: "f64x2_floor",
+    0x7A: "f64x2_trunc",
+    0x7C: "i16x8_extadd_pairwise_i8x16_s",
+    0x7D: "i16x8_extadd_pairwise_i8x16_u",
+    0x7E: "i32x4_extadd_pairwise_i16x8_s",
+    0x7F: "i32x4_extadd_pairwise_i16x8_u",
+    0x80: "i16x8_abs",
+    0x81: "i16x8_neg",
+    0x87: "i16x8_extend_low_i8x16_s",
+    0x88: "i16x8_extend_high_i8x16_s",
+    0x89: "i16x8_extend_low_i8x16_u",
+    0x8A: "i16x8_extend_high_i8x16_u",
+    0x94: "f64x2_nearest",
+    0xA0: "i32x4_abs",
+    0xA1: "i32x4_neg",
+    0xA7: "i32x4_extend_low_i16x8_s",
+    0xA8: "i32x4_extend_high_i16x8_s",
+    0xA9: "i32x4_extend_low_i16x8_u",
+    0xAA: "i32x4_extend_high_i16x8_u",
+    0xC0: "i64x2_abs",
+    0xC1: "i64x2_neg",
+    0xC7: "i64x2_extend_low_i32x4_s",
+    0xC8: "i64x2_extend_high_i32x4_s",
+    0xC9: "i64x2_extend_low_i32x4_u",
+    0xCA: "i64x2_extend_high_i32x4_u",
+    0xE0: "f32x4_abs",
+    0xE1: "f32x4_neg",
+    0xE3: "f32x4_sqrt",
+    0xEC: "f64x2_abs",
+    0xED: "f64x2_neg",
+    0xEF: "f64x2_sqrt",
+    0xF8: "i32x4_trunc_sat_f32x4_s",
+    0xF9: "i32x4_trunc_sat_f32x4_u",
+    0xFA: "f32x4_convert_i32x4_s",
+    0xFB: "f32x4_convert_i32x4_u",
+    0xFC: "i32x4_trunc_sat_f64x2_s_zero",
+    0xFD: "i32x4_trunc_sat_f64x2_u_zero",
+    0xFE: "f64x2_convert_low_i32x4_s",
+    0xFF: "f64x2_convert_low_i32x4_u",
+    # Relaxed SIMD
+    0x101: "i32x4_relaxed_trunc_f32x4_s",
+    0x102: "i32x4_relaxed_trunc_f32x4_u",
+    0x103: "i32x4_relaxed_trunc_f64x2_s_zero",
+    0x104: "i32x4_relaxed_trunc_f64x2_u_zero",
+}
+
+_BINARY: dict[int, str] = {
+    0x0E: "i8x16_swizzle",
+    **{0x23 + i: f"i8x16_{op}" for i, op in enumerate(_COMPARISONS)},
+    **{0x2D + i: f"i16x8_{op}" for i, op in enumerate(_COMPARISONS)},
+    **{0x37 + i: f"i32x4_{op}" for i, op in enumerate(_COMPARISONS)},
+    **{0x41 + i: f"f32x4_{op}" for i, op in enumerate(_FLOAT_COMPARISONS)},
+    **{0x47 + i: f"f64x2_{op}" for i, op in enumerate(_FLOAT_COMPARISONS)},
+    0x4E: "v128_and",
+    0x4F: "v128_andnot",
+    0x50: "v128_or",
+    0x51: "v128_xor",
+    0x65: "i8x16_narrow_i16x8_s",
+    0x66: "i8x16_narrow_i16x8_u",
+    0x6E: "i8x16_add",
+    0x6F: "i8x16_add_sat_s",
+    0x70: "i8x16_add_sat_u",
+    0x71: "i8x16_sub",
+    0x72: "i8x16_sub_sat_s",
+    0x73: "i8x16_sub_sat_u",
+    0x76: "i8x16_min_s",
+    0x77: "i8x16_min_u",
+    0x78: "i8x16_max_s",
+    0x79: "i8x16_max_u",
+    0x7B: "i8x16_avgr_u",
+    0x82: "i16x8_q15mulr_sat_s",
+    0x85: "i16x8_narrow_i32x4_s",
+    0x86: "i16x8_narrow_i32x4_u",
+    0x8E: "i16x8_add",
+    0x8F: "i16x8_add_sat_s",
+    0x90: "i16x8_add_sat_u",
+    0x91: "i16x8_sub",
+    0x92: "i16x8_sub_sat_s",
+    0x93: "i16x8_sub_sat_u",
+    0x95: "i16x8_mul",
+    0x96: "i16x8_min_s",
+    0x97: "i16x8_min_u",
+    0x98: "i16x8_max_s",
+    0x99: "i16x8_max_u",
+    0x9B: "i16x8_avgr_u",
+    0x9C: "i16x8_extmul_low_i8x16_s",
+    0x9D: "i16x8_extmul_high_i8x16_s",
+    0x9E: "i16x8_extmul_low_i8x16_u",
+    0x9F: "i16x8_extmul_high_i8x16_u",
+    0xAE: "i32x4_add",
+    0xB1: "i32x4_sub",
+    0xB5: "i32x4_mul",
+    0xB6: "i32x4_min_s",
+    0xB7: "i32x4_min_u",
+    0xB8: "i32x4_max_s",
+    0xB9: "i32x4_max_u",
+    0xBA: "i32x4_dot_i16x8_s",
+    0xBC: "i32x4_extmul_low_i16x8_s",
+    0xBD: "i32x4_extmul_high_i16x8_s",
+    0xBE: "i32x4_extmul_low_i16x8_u",
+    0xBF: "i32x4_extmul_high_i16x8_u",
+    0xCE: "i64x2_add",
+    0xD1: "i64x2_sub",
+    0xD5: "i64x2_mul",
+    0xD6: "i64x2_eq",
+    0xD7: "i64x2_ne",
+    0xD8: "i64x2_lt_s",
+    0xD9: "i64x2_gt_s",
+    0xDA: "i64x2_le_s",
+    0xDB: "i64x2_ge_s",
+    0xDC: "i64x2_extmul_low_i32x4_s",
+    0xDD: "i64x2_extmul_high_i32x4_s",
+    0xDE: "i64x2_extmul_low_i32x4_u",
+    0xDF: "i64x2_extmul_high_i32x4_u",
+    0xE4: "f32x4_add",
+    0xE5: "f32x4_sub",
+    0xE6: "f32x4_mul",
+    0xE7: "f32x4_div",
+    0xE8: "f32x4_min",
+    0xE9: "f32x4_max",
+    0xEA: "f32x4_pmin",
+    0xEB: "f32x4_pmax",
+    0xF0: "f64x2_add",
+    0xF1: "f64x2_sub",
+    0xF2: "f64x2_mul",
+    0xF3: "f64x2_div",
+    0xF4: "f64x2_min",
+    0xF5: "f64x2_max",
+    0xF6: "f64x2_pmin",
+    0xF7: "f64x2_pmax",
+    # Relaxed SIMD
+    0x100: "i8x16_relaxed_swizzle",
+    0x10D: "f32x4_relaxed_min",
+    0x10E: "f32x4_relaxed_max",
+    0x10F: "f64x2_relaxed_min",
+    0x110: "f64x2_relaxed_max",
+    0x111: "i16x8_relaxed_q15mulr_s",
+    0x112: "i16x8_relaxed_dot_i8x16_i7x16_s",
+}
+
+_TERNARY: dict[int, str] = {
+    0x52: "v128_bitselect",
+    # Relaxed SIMD
+    0x105: "f32x4_relaxed_madd",
+    0x106: "f32x4_relaxed_nmadd",
+    0x107: "f64x2_relaxed_madd",
+    0x108: "f64x2_relaxed_nmadd",
+    0x109: "i8x16_relaxed_laneselect",
+    0x10A: "i16x8_relaxed_laneselect",
+    0x10B: "i32x4_relaxed_laneselect",
+    0x10C: "i64x2_relaxed_laneselect",
+    0x113: "i32x4_relaxed_dot_i8x16_i7x16_add_s",
+}
+
+# With --deterministic, relaxed operations take the results the spec's
+# deterministic profile gives them: those of the exact operations, and for
+# the dot products, b's lanes read as signed.  madd and nmadd are a multiply
+# and an add or subtract, rounded separately (_MULTIPLY_ADD).
+_DETERMINISTIC: dict[int, str] = {
+    0x100: "i8x16_swizzle",
+    0x101: "i32x4_trunc_sat_f32x4_s",
+    0x102: "i32x4_trunc_sat_f32x4_u",
+    0x103: "i32x4_trunc_sat_f64x2_s_zero",
+    0x104: "i32x4_trunc_sat_f64x2_u_zero",
+    0x109: "v128_bitselect",
+    0x10A: "v128_bitselect",
+    0x10B: "v128_bitselect",
+    0x10C: "v128_bitselect",
+    0x10D: "f32x4_min",
+    0x10E: "f32x4_max",
+    0x10F: "f64x2_min",
+    0x110: "f64x2_max",
+    0x111: "i16x8_q15mulr_sat_s",
+    0x112: "i16x8_dot_i8x16_i7x16_s",
+    0x113: "i32x4_dot_i8x16_i7x16_add_s",
+}
+
+# Deterministic madd and nmadd: shape and the op that applies c
+_MULTIPLY_ADD: dict[int, tuple[str, str]] = {
+    0x105: ("f32x4", "add"),
+    0x106: ("f32x4", "sub"),
+    0x107: ("f64x2", "add"),
+    0x108: ("f64x2", "sub"),
+}
+
+# Kernels whose float lanes may hold a NaN they produced, which
+# --deterministic canonicalizes (__wasm_<shape>_canon_nan) like the scalar
+# ones (see waq.compiler.deterministic)
+_NAN_RESULTS = frozenset(
+    [
+        f"{shape}_{op}"
+        for shape in ("f32x4", "f64x2")
+        for op in ("ceil", "floor", "trunc", "nearest", "sqrt", "add", "sub")
+        + ("mul", "div", "min", "max")
+    ]
+    + ["f32x4_demote_f64x2_zero", "f64x2_promote_low_f32x4"]
+)
+
+# v128 -> i32
+_TESTS: dict[int, str] = {
+    0x53: "v128_any_true",
+    0x63: "i8x16_all_true",
+    0x64: "i8x16_bitmask",
+    0x83: "i16x8_all_true",
+    0x84: "i16x8_bitmask",
+    0xA3: "i32x4_all_true",
+    0xA4: "i32x4_bitmask",
+    0xC3: "i64x2_all_true",
+    0xC4: "i64x2_bitmask",
+}
+
+# (v128, i32 shift count) -> v128
+_SHIFTS: dict[int, str] = {
+    0x6B: "i8x16_shl",
+    0x6C: "i8x16_shr_s",
+    0x6D: "i8x16_shr_u",
+    0x8B: "i16x8_shl",
+    0x8C: "i16x8_shr_s",
+    0x8D: "i16x8_shr_u",
+    0xAB: "i32x4_shl",
+    0xAC: "i32x4_shr_s",
+    0xAD: "i32x4_shr_u",
+    0xCB: "i64x2_shl",
+    0xCC: "i64x2_shr_s",
+    0xCD: "i64x2_shr_u",
+}
+
+# Scalar -> v128: kernel and the scalar's QBE class
+_SPLATS: dict[int, tuple[str, Any]] = {
+    0x0F: ("i8x16_splat", W),
+    0x10: ("i16x8_splat", W),
+    0x11: ("i32x4_splat", W),
+    0x12: ("i64x2_splat", L),
+    0x13: ("f32x4_splat", S),
+    0x14: ("f64x2_splat", D),
+}
+
+# extract_lane: result type, load and lane size
+_EXTRACT_LANE: dict[int, tuple[ValueType, str, int]] = {
+    0x15: (ValueType.I32, "loadsb", 1),
+    0x16: (ValueType.I32, "loadub", 1),
+    0x18: (ValueType.I32, "loadsh", 2),
+    0x19: (ValueType.I32, "loaduh", 2),
+    0x1B: (ValueType.I32, "loadw", 4),
+    0x1D: (ValueType.I64, "loadl", 8),
+    0x1F: (ValueType.F32, "loads", 4),
+    0x21: (ValueType.F64, "loadd", 8),
+}
+
+# replace_lane: store and lane size
+_REPLACE_LANE: dict[int, tuple[str, int]] = {
+    0x17: ("storeb", 1),
+    0x1A: ("storeh", 2),
+    0x1C: ("storew", 4),
+    0x1E: ("storel", 8),
+    0x20: ("stores", 4),
+    0x22: ("stored", 8),
+}
+
+# v128.loadNxM: the 8 bytes loaded are widened in place by this kernel
+_LOAD_EXTEND: dict[int, str] = {
+    0x01: "i16x8_extend_low_i8x16_s",
+    0x02: "i16x8_extend_low_i8x16_u",
+    0x03: "i32x4_extend_low_i16x8_s",
+    0x04: "i32x4_extend_low_i16x8_u",
+    0x05: "i64x2_extend_low_i32x4_s",
+    0x06: "i64x2_extend_low_i32x4_u",
+}
+
+# v128.loadN_splat: scalar load and splat kernel
+_LOAD_SPLAT: dict[int, tuple[str, int]] = {
+    0x07: ("loadub", 0x0F),
+    0x08: ("loaduh", 0x10),
+    0x09: ("loaduw", 0x11),
+    0x0A: ("loadl", 0x12),
+}
+
+# v128.loadN_lane / v128.storeN_lane: lane size -> (load, store)
+_LANE_ACCESS: dict[int, tuple[str, str]] = {
+    1: ("loadub", "storeb"),
+    2: ("loaduh", "storeh"),
+    4: ("loaduw", "storew"),
+    8: ("loadl", "storel"),
+}
+
+
+def compile_simd_instruction(
+    sub_opcode: int,
+    ctx: FunctionContext,
+    block: Block,
+    read_operand: Callable[[str], Any],
+) -> bool:
+    """Compile a 0xFD-prefixed instruction.
+
+    Returns True if the instruction was handled.
+    """
+    if ctx.deterministic and sub_opcode in _MULTIPLY_ADD:
+        shape, op = _MULTIPLY_ADD[sub_opcode]
+        a, b, c = ctx.stack.pop_n(3)
+        result = new_v128(ctx)
+        _call_kernel(block, f"{shape}_mul", result, [a, b])
+        # nmadd is -(a * b) + c, which is c - a * b exactly
+        addends = [result, c] if op == "add" else [c, result]
+        _call_kernel(block, f"{shape}_{op}", result, addends)
+        _call_kernel(block, f"{shape}_canon_nan", result, [result])
+        return True
+
+    for kernels, arity in ((_UNARY, 1), (_BINARY, 2), (_TERNARY, 3)):
+        if sub_opcode in kernels:
+            operands = ctx.stack.pop_n(arity)
+            result = new_v128(ctx)
+            kernel = kernels[sub_opcode]
+            if ctx.deterministic:
+                kernel = _DETERMINISTIC.get(sub_opcode, kernel)
+            _call_kernel(block, kernel, result, operands)
+            if ctx.deterministic and kernel in _NAN_RESULTS:
+                _call_kernel(block, f"{kernel[:5]}_canon_nan", result, [result])
+            return True
+
+    if sub_opcode in _TESTS:
+        value = ctx.stack.pop()
+        result = ctx.stack.new_temp(ValueType.I32)
+        block.instructions.append(
+            Call(
+                target=Global(f"__wasm_{_TESTS[sub_opcode]}"),
+                args=[(L, Temporary(value.name))],
+                result=Temporary(result.name),
+                result_type=W,
+            )
+        )
+        return True
+
+    if sub_opcode in _SHIFTS:
+        count = ctx.stack.pop()
+        value = ctx.stack.pop()
+        result = new_v128(ctx)
+        _call_kernel(
+            block, _SHIFTS[sub_opcode], result, [value], [(W, Temporary(count.name))]
+        )
+        return True
+
+    if sub_opcode in _SPLATS:
+        kernel, cls = _SPLATS[sub_opcode]
+        value = ctx.stack.pop()
+        result = new_v128(ctx)
+        _call_kernel(block, kernel, result, [], [(cls, Temporary(value.name))])
+        return True
+
+    # i8x16.shuffle: the 16 lane indices are passed as two longs
+    if sub_opcode == 0x0D:
+        lanes = read_operand("v128")
+        b = ctx.stack.pop()
+        a = ctx.stack.pop()
+        result = new_v128(ctx)
+        _call_kernel(
+            block,
+            "i8x16_shuffle",
+            result,
+            [a, b],
+            [(L, IntConst(half)) for half in _halves(lanes)],
+        )
+        return True
+
+    # v128.const
+    if sub_opcode == 0x0C:
+        low, high = _halves(read_operand("v128"))
+        result = new_v128(ctx)
+        _store_halves(ctx, block, Temporary(result.name), IntConst(low), IntConst(high))
+        return True
+
+    if sub_opcode in _EXTRACT_LANE:
+        vtype, load_type, size = _EXTRACT_LANE[sub_opcode]
+        lane = read_operand("byte")
+        value = ctx.stack.pop()
+        address = _lane_address(ctx, block, Temporary(value.name), lane * size)
+        result = ctx.stack.new_temp(vtype)
+        block.instructions.append(
+            Load(
+                result=Temporary(result.name),
+                result_type=_SCALAR_CLASSES[vtype],
+                address=address,
+                load_type=load_type,
+            )
+        )
+        return True
+
+    if sub_opcode in _REPLACE_LANE:
+        store_type, size = _REPLACE_LANE[sub_opcode]
+        lane = read_operand("byte")
+        scalar = ctx.stack.pop()
+        value = ctx.stack.pop()
+        result = new_v128(ctx)
+        copy_v128(ctx, block, Temporary(result.name), Temporary(value.name))
+        address = _lane_address(ctx, block, Temporary(result.name), lane * size)
+        block.instructions.append(
+            Store(store_type=store_type, value=Temporary(scalar.name), address=address)
+        )
+        return True
+
+    return _compile_memory_access(sub_opcode, ctx, block, read_operand)
+
+
+def _compile_memory_access(
+    sub_opcode: int,
+    ctx: FunctionContext,
+    block: Block,
+    read_operand: Callable[[str], Any],
+) -> bool:
+    """Compile the loads and stores (memarg immediate, maybe a lane index)."""
+    if not (0x00 <= sub_opcode <= 0x0B or 0x54 <= sub_opcode <= 0x5D):
+        return False
+    _align = read_operand("u32")
+    offset = read_operand("u32")
+
+    # v128.store / v128.storeN_lane: [address, vector] -> []
+    if sub_opcode == 0x0B or 0x58 <= sub_opcode <= 0x5B:
+        lane = read_operand("byte") if sub_opcode != 0x0B else 0
+        value = ctx.stack.pop()
+        address = Temporary(effective_address(ctx, block, ctx.stack.pop(), offset))
+        if sub_opcode == 0x0B:
+            copy_v128(ctx, block, address, Temporary(value.name))
+            return True
+        size = 1 << (sub_opcode - 0x58)
+        load_type, store_type = _LANE_ACCESS[size]
+        scalar = _scalar_temp(ctx, size)
+        block.instructions += [
+            Load(
+                result=scalar,
+                result_type=L if size == 8 else W,
+                address=_lane_address(ctx, block, Temporary(value.name), lane * size),
+                load_type=load_type,
+            ),
+            Store(store_type=store_type, value=scalar, address=address),
+        ]
+        return True
+
+    # v128.loadN_lane: [address, vector] -> [vector]
+    if 0x54 <= sub_opcode <= 0x57:
+        lane = read_operand("byte")
+        size = 1 << (sub_opcode - 0x54)
+        load_type, store_type = _LANE_ACCESS[size]
+        value = ctx.stack.pop()
+        address = Temporary(effective_address(ctx, block, ctx.stack.pop(), offset))
+        result = new_v128(ctx)
+        copy_v128(ctx, block, Temporary(result.name), Temporary(value.name))
+        scalar = _scalar_temp(ctx, size)
+        block.instructions.append(
+            Load(
+                result=scalar,
+                result_type=L if size == 8 else W,
+                address=address,
+                load_type=load_type,
+            )
+        )
+        block.instructions.append(
+            Store(
+                store_type=store_type,
+                value=scalar,
+                address=_lane_address(
+                    ctx, block, Temporary(result.name), lane * size
+                ),
+            )
+        )
+        return True
+
+    address = Temporary(effective_address(ctx, block, ctx.stack.pop(), offset))
+    result = new_v128(ctx)
+    slot = Temporary(result.name)
+
+    # v128.load
+    if sub_opcode == 0x00:
+        copy_v128(ctx, block, slot, address)
+        return True
+
+    if sub_opcode in _LOAD_SPLAT:
+        load_type, splat = _LOAD_SPLAT[sub_opcode]
+        kernel, cls = _SPLATS[splat]
+        scalar = _scalar_temp(ctx, 8 if cls == L else 4)
+        block.instructions.append(
+            Load(result=scalar, result_type=cls, address=address, load_type=load_type)
+        )
+        _call_kernel(block, kernel, result, [], [(cls, scalar)])
+        return True
+
+    # The other loads fill the low half: v128.loadNxM widen it in place,
+    # v128.load32_zero and v128.load64_zero clear the high half
+    low = _scalar_temp(ctx, 8)
+    block.instructions.append(
+        Load(
+            result=low,
+            result_type=L,
+            address=address,
+            load_type="loaduw" if sub_opcode == 0x5C else "loadl",
+        )
+    )
+    if sub_opcode in _LOAD_EXTEND:
+        block.instructions.append(Store(store_type="storel", value=low, address=slot))
+        _call_kernel(block, _LOAD_EXTEND[sub_opcode], result, [result])
+    else:
+        _store_halves(ctx, block, slot, low, IntConst(0))
+    return True
+
+
+_SCALAR_CLASSES = {
+    ValueType.I32: W,
+    ValueType.I64: L,
+    ValueType.F32: S,
+    ValueType.F64: D,
+}
+
+
+def new_v128(ctx: FunctionContext) -> StackValue:
+    """Push a v128 value with a fresh slot of its own."""
+    result = ctx.stack.new_temp(ValueType.V128)
+    alloc_v128(ctx, result.name)
+    return result
+
+
+def alloc_v128(ctx: FunctionContext, name: str) -> None:
+    """Allocate a 16-byte slot, addressed by temporary ``name``, on entry."""
+    assert ctx.entry_block is not None
+    ctx.entry_block.instructions.append(
+        Alloc(result=Temporary(name), size=IntConst(16), align=16)
+    )
+
+
+def copy_v128(ctx: FunctionContext, block: Block, dest: Any, src: Any) -> None:
+    """Copy the 16 bytes at address ``src`` to address ``dest``."""
+    low = _scalar_temp(ctx, 8)
+    high = _scalar_temp(ctx, 8)
+    block.instructions += [
+        Load(result=low, result_type=L, address=src, load_type="loadl"),
+        Load(
+            result=high,
+            result_type=L,
+            address=_lane_address(ctx, block, src, 8),
+            load_type="loadl",
+        ),
+    ]
+    _store_halves(ctx, block, dest, low, high)
+
+
+def zero_v128(ctx: FunctionContext, block: Block, dest: Any) -> None:
+    """Clear the 16 bytes at address ``dest``."""
+    _store_halves(ctx, block, dest, IntConst(0), IntConst(0))
+
+
+def claim_v128_result(
+    ctx: FunctionContext, block: Block, results: tuple[ValueType, ...]
+) -> None:
+    """Copy a call's v128 first result out of the thread's result buffer.
+
+    The call's results are on top of the stack; the next call would
+    overwrite the buffer, so the first one moves to a slot.
+    """
+    if not results or results[0] != ValueType.V128:
+        return
+    values = ctx.stack.pop_n(len(results))
+    result = new_v128(ctx)
+    copy_v128(ctx, block, Temporary(result.name), Temporary(values[0].name))
+    for value in values[1:]:
+        ctx.stack.push(value)
+
+
+def _call_kernel(
+    block: Block,
+    kernel: str,
+    result: StackValue,
+    operands: list[StackValue],
+    scalars: list[tuple[Any, Any]] = (),  # type: ignore[assignment]
+) -> None:
+    block.instructions.append(
+        Call(
+            target=Global(f"__wasm_{kernel}"),
+            args=[
+                (L, Temporary(result.name)),
+                *[(L, Temporary(value.name)) for value in operands],
+                *scalars,
+            ],
+        )
+    )
+
+
+def _store_halves(
+    ctx: FunctionContext, block: Block, dest: Any, low: Any, high: Any
+) -> None:
+    block.instructions += [
+        Store(store_type="storel", value=low, address=dest),
+        Store(
+            store_type="storel", value=high, address=_lane_address(ctx, block, dest, 8)
+        ),
+    ]
+
+
+def _lane_address(ctx: FunctionContext, block: Block, base: Any, offset: int) -> Any:
+    """``base + offset``, emitting the add unless ``offset`` is 0."""
+    if offset == 0:
+        return base
+    address = _scalar_temp(ctx, 8)
+    block.instructions.append(
+        BinaryOp(
+            result=address, result_type=L, op="add", left=base, right=IntConst(offset)
+        )
+    )
+    return address
+
+
+def _scalar_temp(ctx: FunctionContext, size: int) -> Temporary:
+    vtype = ValueType.I64 if size == 8 else ValueType.I32
+    return Temporary(ctx.stack.new_temp_no_push(vtype).name)
+
+
+def _halves(data: bytes) -> tuple[int, int]:
+    """The low and high 64 bits of a 16-byte immediate, as signed longs."""
+    return (
+        int.from_bytes(data[:8], "little", signed=True),
+        int.from_bytes(data[8:], "little", signed=True),
+    )
@@ -58,6 +58,8 @@ def compile_table_instruction(
         table_idx = read_operand("u32")
         ref = ctx.stack.pop()
         elem_idx = ctx.stack.pop()
+        mod_ctx.table_written = True
+        sig = _emit_ref_sig(ctx, mod_ctx, block, table_idx, ref.name)
         block.instructions.append(
             Call(
                 target=Global("__wasm_table_set"),
@@ -65,6 +67,7 @@ def compile_table_instruction(
                     (W, IntConst(table_idx)),
                     (W, Temporary(elem_idx.name)),
                     (L, Temporary(ref.name)),
+                    (W, sig),
                 ],
             )
         )
@@ -73,6 +76,36 @@ def compile_table_instruction(
     return False
 
 
+def _emit_ref_sig(
+    ctx: FunctionContext,
+    mod_ctx: ModuleContext,
+    block: Block,
+    table_idx: int,
+    ref: str,
+) -> Any:
+    """Signature id to store with ``ref`` in a slot of table ``table_idx``.
+
+    Table slots pair each function with its canonical signature id, which
+    ``call_indirect`` checks.  A funcref value is a bare code pointer, so
+    the id is looked up by ``__wasm_funcref_sig``, which codegen emits for
+    the functions a funcref can point to.  Slots of externref tables are
+    never called and get 0.
+    """
+    if mod_ctx.module.all_tables()[table_idx].elem_type != ValueType.FUNCREF:
+        return IntConst(0)
+    mod_ctx.needs_funcref_sig = True
+    sig = ctx.stack.new_temp_no_push(ValueType.I32)
+    block.instructions.append(
+        Call(
+            target=Global("__wasm_funcref_sig"),
+            args=[(L, Temporary(ref))],
+            result=Temporary(sig.name),
+            result_type=W,
+        )
+    )
+    return Temporary(sig.name)
+
+
 def compile_table_bulk_instruction(
     sub_opcode: int,
     ctx: FunctionContext,
@@ -93,6 +126,7 @@ def compile_table_bulk_instruction(
         length = ctx.stack.pop()
         src = ctx.stack.pop()
         dest = ctx.stack.pop()
+        mod_ctx.table_written = True
 
         block.instructions.append(
             Call(
@@ -128,6 +162,7 @@ def compile_table_bulk_instruction(
         length = ctx.stack.pop()
         src = ctx.stack.pop()
         dest = ctx.stack.pop()
+        mod_ctx.table_written = True
 
         block.instructions.append(
             Call(
@@ -150,6 +185,8 @@ def compile_table_bulk_instruction(
         # Stack: [ref, delta] -> [old_size]
         delta = ctx.stack.pop()
         ref = ctx.stack.pop()
+        mod_ctx.table_written = True
+        sig = _emit_ref_sig(ctx, mod_ctx, block, table_idx, ref.name)
         result = ctx.stack.new_temp(ValueType.I32)
 
         block.instructions.append(
@@ -158,6 +195,7 @@ def compile_table_bulk_instruction(
                 args=[
                     (W, IntConst(table_idx)),
                     (L, Temporary(ref.name)),
+                    (W, sig),
                     (W, Temporary(delta.name)),
                 ],
                 result=Temporary(result.name),
@@ -189,6 +227,8 @@ def compile_table_bulk_instruction(
         length = ctx.stack.pop()
         ref = ctx.stack.pop()
         dest = ctx.stack.pop()
+        mod_ctx.table_written = True
+        sig = _emit_ref_sig(ctx, mod_ctx, block, table_idx, ref.name)
 
         block.instructions.append(
             Call(
@@ -197,6 +237,7 @@ def compile_table_bulk_instruction(
                     (W, IntConst(table_idx)),
                     (W, Temporary(dest.name)),
                     (L, Temporary(ref.name)),
+                    (W, sig),
                     (W, Temporary(length.name)),
                 ],
             )
@@ -15,8 +15,11 @@ from qbepy.ir import (
     W,
 )
 
+from waq.compiler.stack import StackValue
 from waq.parser.types import GlobalType, ValueType
 
+from .simd import copy_v128, new_v128
+
 if TYPE_CHECKING:
     from collections.abc import Callable
 
@@ -81,10 +84,20 @@ def compile_variable_instruction(
 
     Returns True if the instruction was handled.
     """
-    # local.get - load from stack slot
+    # local.get - the local's current SSA value, or a load from its stack slot
     if opcode == 0x20:
         idx = read_operand("u32")
         vtype = ctx.get_local_type(idx)
+        if vtype == ValueType.V128:
+            # A v128 local always lives in its slot, which a later
+            # local.set rewrites: take a copy
+            result = new_v128(ctx)
+            slot = Temporary(ctx.get_local_addr(idx))
+            copy_v128(ctx, block, Temporary(result.name), slot)
+            return True
+        if ctx.local_values is not None:
+            ctx.stack.push(StackValue(ctx.local_values[idx], vtype))
+            return True
         addr_name = ctx.get_local_addr(idx)
         temp = ctx.stack.new_temp(vtype)
         qbe_type = _vtype_to_ir_type(vtype)
@@ -99,10 +112,17 @@ def compile_variable_instruction(
         )
         return True
 
-    # local.set - store to stack slot
+    # local.set - rebind the SSA value, or store to stack slot
     if opcode == 0x21:
         idx = read_operand("u32")
         value = ctx.stack.pop()
+        if ctx.get_local_type(idx) == ValueType.V128:
+            slot = Temporary(ctx.get_local_addr(idx))
+            copy_v128(ctx, block, slot, Temporary(value.name))
+            return True
+        if ctx.local_values is not None:
+            ctx.local_values[idx] = value.name
+            return True
         vtype = ctx.get_local_type(idx)
         addr_name = ctx.get_local_addr(idx)
         store_type = _vtype_to_store_type(vtype)
@@ -115,10 +135,17 @@ def compile_variable_instruction(
         )
         return True
 
-    # local.tee - store to stack slot but keep value on stack
+    # local.tee - like local.set but keep value on stack
     if opcode == 0x22:
         idx = read_operand("u32")
         value = ctx.stack.peek()  # Don't pop, just peek
+        if ctx.get_local_type(idx) == ValueType.V128:
+            slot = Temporary(ctx.get_local_addr(idx))
+            copy_v128(ctx, block, slot, Temporary(value.name))
+            return True
+        if ctx.local_values is not None:
+            ctx.local_values[idx] = value.name
+            return True
         vtype = ctx.get_local_type(idx)
         addr_name = ctx.get_local_addr(idx)
         store_type = _vtype_to_store_type(vtype)
@@ -137,6 +164,10 @@ def compile_variable_instruction(
         global_def = _get_global_def(mod_ctx, idx)
         vtype = global_def.type.value_type
         global_name = mod_ctx.get_global_name(idx)
+        if vtype == ValueType.V128:
+            result = new_v128(ctx)
+            copy_v128(ctx, block, Temporary(result.name), QbeGlobal(global_name))
+            return True
         temp = ctx.stack.new_temp(vtype)
         qbe_type = _vtype_to_ir_type(vtype)
         load_type = _vtype_to_load_type(vtype)
@@ -158,6 +189,9 @@ def compile_variable_instruction(
         global_def = _get_global_def(mod_ctx, idx)
         vtype = global_def.type.value_type
         global_name = mod_ctx.get_global_name(idx)
+        if vtype == ValueType.V128:
+            copy_v128(ctx, block, QbeGlobal(global_name), Temporary(value.name))
+            return True
         store_type = _vtype_to_store_type(vtype)
         # Store to global data
         block.instructions.append(
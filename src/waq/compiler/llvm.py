@@ -0,0 +1,945 @@
+"""LLVM IR backend: the compiled module as textual LLVM IR.
+
+``--backend=llvm`` hands the IR the code generator and passes built (the
+graph of qbepy objects QBE would otherwise get) to ``clang -O3``, for its
+vectorizer, inliner and scheduler.  Functions, blocks and instructions map
+onto LLVM almost one to one; the differences are:
+
+- Temporaries keep their QBE base type (``w`` is i32, ``l`` i64, ``s``
+  float, ``d`` double), except that a ``l`` temporary derived from the
+  linear memory base (``loadl $__wasm_memory``), a stack slot (``alloc``)
+  or a data symbol becomes a ``ptr``, and adding an offset to it a
+  ``getelementptr``.  LLVM's alias analysis and loop passes then see
+  addresses rather than integers.
+- Loads and stores through those pointers are tagged as linear memory or as
+  frame (stack slots and data symbols), both in a TBAA tree and as two
+  ``!alias.scope``/``!noalias`` scopes.  A store to linear memory cannot
+  change a local, a global or the memory base itself, so these stay in
+  registers across it.  Accesses through any other address get no tags.
+- Integer division checks its divisor and traps through the runtime as
+  WASM requires, where QBE relies on the hardware fault; LLVM leaves it
+  undefined.  Shift counts are masked and float-to-int results frozen for
+  the same reason.
+- Functions that call ``_setjmp`` keep their locals in stack slots so that
+  they survive the ``longjmp`` (``waq.compiler.ssa``); their frame
+  accesses are volatile, or LLVM would promote the slots to registers.
+- A temporary assigned more than once gets a stack slot, which LLVM's
+  mem2reg turns back into SSA form.
+"""
+
+from __future__ import annotations
+
+import math
+import struct
+from collections import Counter, defaultdict
+from typing import TYPE_CHECKING, Any
+
+from qbepy.ir import (
+    Alloc,
+    BinaryOp,
+    Branch,
+    Call,
+    Comparison,
+    Conversion,
+    Copy,
+    FloatConst,
+    Global,
+    Halt,
+    IntConst,
+    Jump,
+    Load,
+    Phi,
+    Return,
+    Store,
+    Temporary,
+    UnaryOp,
+)
+
+from waq.errors import CompileError
+
+from .passes.ir import (
+    block_map,
+    calls_setjmp,
+    defined,
+    predecessors,
+    temp_types,
+    to_signed,
+)
+
+if TYPE_CHECKING:
+    from collections.abc import Callable
+
+    from qbepy import Function, Module
+    from qbepy.ir import Block, DataDef
+
+# LLVM target triple of each QBE target
+TRIPLES = {
+    "amd64_sysv": "x86_64-unknown-linux-gnu",
+    "amd64_apple": "x86_64-apple-macosx",
+    "arm64": "aarch64-unknown-linux-gnu",
+    "arm64_apple": "arm64-apple-macosx",
+    "rv64": "riscv64-unknown-linux-gnu",
+}
+
+# Memory classes of an address: linear memory, or the frame (stack slots and
+# data symbols).  Addresses of unknown origin have neither.
+MEMORY = "memory"
+FRAME = "frame"
+
+# Data symbols whose value is the linear memory base, and runtime functions
+# that return it
+_MEMORY_BASES = frozenset({"__wasm_memory"})
+_MEMORY_BASE_CALLS = frozenset({"__wasm_memory_base", "__wasm_memory_base_idx"})
+
+_TYPES = {"w": "i32", "l": "i64", "s": "float", "d": "double"}
+_BITS = {"w": 32, "l": 64}
+
+# Load and store suffixes: memory type and size in bytes
+_ACCESS = {
+    "b": ("i8", 1),
+    "h": ("i16", 2),
+    "w": ("i32", 4),
+    "l": ("i64", 8),
+    "s": ("float", 4),
+    "d": ("double", 8),
+}
+
+_INT_OPS = {
+    "add": "add",
+    "sub": "sub",
+    "mul": "mul",
+    "div": "sdiv",
+    "rem": "srem",
+    "udiv": "udiv",
+    "urem": "urem",
+    "and": "and",
+    "or": "or",
+    "xor": "xor",
+    "sar": "ashr",
+    "shr": "lshr",
+    "shl": "shl",
+}
+_FLOAT_OPS = {"add": "fadd", "sub": "fsub", "mul": "fmul", "div": "fdiv"}
+
+_INT_CONDS = ("eq", "ne", "slt", "sle", "sgt", "sge", "ult", "ule", "ugt", "uge")
+# QBE's float ``cne`` is true for unordered operands, like C's ``!=``
+_FLOAT_CONDS = {
+    "eq": "oeq",
+    "ne": "une",
+    "lt": "olt",
+    "le": "ole",
+    "gt": "ogt",
+    "ge": "oge",
+    "o": "ord",
+    "uo": "uno",
+}
+
+# Conversion: QBE type of the operand and LLVM cast
+_CONVERSIONS = {
+    "extsw": ("w", "sext"),
+    "extuw": ("w", "zext"),
+    "exts": ("s", "fpext"),
+    "truncd": ("d", "fptrunc"),
+    "stosi": ("s", "fptosi"),
+    "stoui": ("s", "fptoui"),
+    "dtosi": ("d", "fptosi"),
+    "dtoui": ("d", "fptoui"),
+    "swtof": ("w", "sitofp"),
+    "uwtof": ("w", "uitofp"),
+    "sltof": ("l", "sitofp"),
+    "ultof": ("l", "uitofp"),
+}
+# Sub-word extensions: width extended from and LLVM cast
+_NARROW_EXTENSIONS = {
+    "extsb": ("i8", "sext"),
+    "extub": ("i8", "zext"),
+    "extsh": ("i16", "sext"),
+    "extuh": ("i16", "zext"),
+}
+# ``cast`` reinterprets the bits of the other class's type of the same size
+_CAST_FROM = {"w": "s", "l": "d", "s": "w", "d": "l"}
+
+# Metadata shared by all functions: a TBAA tree with one scalar type per
+# memory class, and a scope per class in one alias domain.  An access
+# belongs to its class's scope and is noalias with the other's.
+_METADATA = """\
+!0 = !{!"waq"}
+!1 = !{!"wasm memory", !0, i64 0}
+!2 = !{!"frame", !0, i64 0}
+!3 = !{!1, !1, i64 0}
+!4 = !{!2, !2, i64 0}
+!5 = distinct !{!5, !"waq"}
+!6 = distinct !{!6, !5, !"wasm memory"}
+!7 = distinct !{!7, !5, !"frame"}
+!8 = !{!6}
+!9 = !{!7}"""
+_ACCESS_TAGS = {
+    MEMORY: ", !tbaa !3, !alias.scope !8, !noalias !9",
+    FRAME: ", !tbaa !4, !alias.scope !9, !noalias !8",
+    None: "",
+}
+
+# Not yet known to be anything but a pointer (optimistic start of the
+# pointer analysis), and not a pointer
+_TOP = "top"
+_NOT = "not"
+
+
+def emit_llvm(module: Module, target: str = "amd64_sysv") -> str:
+    """Lower a compiled QBE module to the text of an LLVM module."""
+    return _ModuleLowering(module, target).emit()
+
+
+def _int(value: int, qbe_type: str) -> int:
+    """``value`` as a signed integer of ``qbe_type``'s width."""
+    return to_signed(value, _BITS[qbe_type])
+
+
+def _float_bits(value: float, qbe_type: str) -> int:
+    """IEEE bits of ``value`` rounded to ``qbe_type``."""
+    if qbe_type == "d":
+        return struct.unpack("<Q", struct.pack("<d", value))[0]
+    try:
+        return struct.unpack("<I", struct.pack("<f", value))[0]
+    except OverflowError:
+        return struct.unpack("<I", struct.pack("<f", math.copysign(math.inf, value)))[0]
+
+
+def _float_literal(bits: int, qbe_type: str) -> str:
+    """LLVM literal of a float with IEEE bits ``bits``.
+
+    LLVM writes both float and double constants as the hex bits of a
+    double, so a single is widened first, NaN payload included.
+    """
+    if qbe_type == "s":
+        bits &= 0xFFFFFFFF
+        if bits & 0x7F800000 == 0x7F800000 and bits & 0x7FFFFF:
+            sign = bits >> 31
+            bits = sign << 63 | 0x7FF << 52 | (bits & 0x7FFFFF) << 29
+        else:
+            value = struct.unpack("<f", struct.pack("<I", bits))[0]
+            bits = _float_bits(value, "d")
+    return f"0x{bits & 0xFFFFFFFFFFFFFFFF:016X}"
+
+
+def _float_value(value: Any) -> float:
+    """A float data item or constant: a number, ``FloatConst`` or ``d_1.5``."""
+    if isinstance(value, FloatConst):
+        return value.value
+    if isinstance(value, str):
+        text = value.split("_", 1)[-1]
+        try:
+            return float(text)
+        except ValueError:
+            return float.fromhex(text)
+    return float(value)
+
+
+def _is_comparison(op: str) -> bool:
+    """Whether ``op`` is a QBE comparison, like ``csltw`` or ``cuod``."""
+    cond, operand_type = op[1:-1], op[-1:]
+    if not op.startswith("c") or operand_type not in _TYPES:
+        return False
+    return cond in (_FLOAT_CONDS if operand_type in ("s", "d") else _INT_CONDS)
+
+
+def _merge(a: str | None, b: str | None) -> str | None:
+    """Memory class of a pointer that may be either of two."""
+    if a == _TOP:
+        return b
+    if b in (_TOP, a):
+        return a
+    return None
+
+
+def _pointer_classes(
+    func: Function, types: dict[str, str], slots: set[str]
+) -> dict[str, str | None]:
+    """Map each ``l`` temporary that holds a pointer to its memory class.
+
+    A pointer is the linear memory base, a stack slot or data symbol, a copy
+    of a pointer, a pointer plus or minus an integer, or a phi of pointers.
+    Phis start out as pointers and are dropped until nothing changes, so
+    pointer induction variables are found.
+    """
+    defs: dict[str, Any] = {}
+    for block in func.blocks:
+        for instr in [*block.phis, *block.instructions]:
+            name = defined(instr)
+            if name is not None and types.get(name) == "l" and name not in slots:
+                defs[name] = instr
+
+    classes: dict[str, str | None] = dict.fromkeys(defs, _TOP)
+
+    def operand_class(value: Any) -> str | None:
+        if isinstance(value, Global):
+            return FRAME
+        if isinstance(value, Temporary) and value.name in classes:
+            return classes[value.name]
+        return _NOT
+
+    def pointer_class(instr: Any) -> str | None:
+        if isinstance(instr, Load):
+            base = isinstance(instr.address, Global)
+            if base and instr.address.name in _MEMORY_BASES:
+                return MEMORY
+        elif isinstance(instr, Call):
+            target = instr.target
+            if isinstance(target, Global) and target.name in _MEMORY_BASE_CALLS:
+                return MEMORY
+        elif isinstance(instr, Alloc):
+            return FRAME
+        elif isinstance(instr, Copy):
+            return operand_class(instr.value)
+        elif isinstance(instr, BinaryOp) and instr.op in ("add", "sub"):
+            left, right = operand_class(instr.left), operand_class(instr.right)
+            if right == _NOT:
+                return left
+            if left == _NOT and instr.op == "add":
+                return right
+        elif isinstance(instr, Phi):
+            merged: str | None = _TOP
+            for _label, value in instr.incoming:
+                cls = operand_class(value)
+                if cls == _NOT:
+                    return _NOT
+                merged = _merge(merged, cls)
+            return merged
+        return _NOT
+
+    changed = True
+    while changed:
+        changed = False
+        for name, instr in defs.items():
+            if name not in classes:
+                continue
+            cls = pointer_class(instr)
+            if cls == _NOT:
+                del classes[name]
+                changed = True
+            elif cls != classes[name]:
+                classes[name] = cls
+                changed = True
+    return {name: None if cls == _TOP else cls for name, cls in classes.items()}
+
+
+class _ModuleLowering:
+    """Data, functions and the declarations of what they reference."""
+
+    def __init__(self, module: Module, target: str) -> None:
+        self.module = module
+        self.target = target
+        self.defined = {func.name for func in module.functions}
+        self.defined |= {data.name for data in module.data}
+        # Functions called but not defined: return type, parameter types and
+        # attributes, from the first call that gives a return type
+        self.declarations: dict[str, tuple[str, list[str], str]] = {}
+        # Symbols used as addresses but neither defined nor called
+        self.externals: set[str] = set()
+
+    def declare(self, name: str, ret: str, params: list[str], attrs: str = "") -> None:
+        if name in self.defined:
+            return
+        known = self.declarations.get(name)
+        if known is None or (known[0] == "void" and ret != "void"):
+            self.declarations[name] = (ret, params, attrs or (known or ("", [], ""))[2])
+
+    def reference(self, name: str) -> None:
+        if name not in self.defined:
+            self.externals.add(name)
+
+    def emit(self) -> str:
+        functions = [
+            _FunctionLowering(self, func).emit().rstrip("\n")
+            for func in self.module.functions
+        ]
+        externals = sorted(self.externals - set(self.declarations))
+        globals_ = [self._data(data) for data in self.module.data]
+        globals_ += [f"@{name} = external global i8" for name in externals]
+        declarations = [
+            f"declare {ret} @{name}({', '.join(params)}){attrs}"
+            for name, (ret, params, attrs) in sorted(self.declarations.items())
+        ]
+        sections = [
+            f'target triple = "{TRIPLES[self.target]}"',
+            "\n".join(globals_),
+            *functions,
+            "\n".join(declarations),
+        ]
+        if any(" #0" in attrs for _ret, _params, attrs in self.declarations.values()):
+            sections.append("attributes #0 = { returns_twice }")
+        sections.append(_METADATA)
+        return "\n\n".join(section for section in sections if section) + "\n"
+
+    def _data(self, data: DataDef) -> str:
+        """A data definition as a packed struct of byte arrays and pointers."""
+        fields: list[tuple[str, str]] = []
+        pending = bytearray()
+
+        def flush() -> None:
+            if pending:
+                text = "".join(
+                    chr(b) if 32 <= b < 127 and b not in (34, 92) else f"\\{b:02X}"
+                    for b in pending
+                )
+                fields.append((f"[{len(pending)} x i8]", f'c"{text}"'))
+                pending.clear()
+
+        for kind, values in data.items:
+            kind = str(kind)
+            if kind == "z":
+                flush()
+                fields.append((f"[{values[0]} x i8]", "zeroinitializer"))
+                continue
+            size = _ACCESS[kind][1]
+            for value in values:
+                if isinstance(value, Global):
+                    flush()
+                    self.reference(value.name)
+                    fields.append(("ptr", f"@{value.name}"))
+                elif kind in ("s", "d"):
+                    bits = _float_bits(_float_value(value), kind)
+                    pending += bits.to_bytes(size, "little")
+                else:
+                    pending += (int(value) % (1 << 8 * size)).to_bytes(size, "little")
+        flush()
+        linkage = "" if getattr(data, "export", False) else "internal "
+        align = getattr(data, "align", None) or 8
+        types = ", ".join(field_type for field_type, _value in fields)
+        values = ", ".join(f"{field_type} {value}" for field_type, value in fields)
+        return (
+            f"@{data.name} = {linkage}global <{{ {types} }}> <{{ {values} }}>, "
+            f"align {align}"
+        )
+
+
+class _FunctionLowering:
+    """One function's definition."""
+
+    def __init__(self, module: _ModuleLowering, func: Function) -> None:
+        self.module = module
+        self.func = func
+        self.blocks = block_map(func)
+        self.types = temp_types(func)
+        counts = Counter(name for _type, name in func.params)
+        for block in func.blocks:
+            for instr in [*block.phis, *block.instructions]:
+                if (name := defined(instr)) is not None:
+                    counts[name] += 1
+        self.slots = {name for name, count in counts.items() if count > 1}
+        self.pointers = _pointer_classes(func, self.types, self.slots)
+        self.allocs = {
+            instr.result.name
+            for block in func.blocks
+            for instr in block.instructions
+            if isinstance(instr, Alloc)
+        }
+        self.setjmp = calls_setjmp(func)
+        self.counter = 0
+        # Lines of the LLVM entry block (stack slots), and of the rest; phis
+        # are rendered last, once all their incoming values are known
+        self.entry: list[str | Callable[[], str | None]] = []
+        self.lines: list[str | Callable[[], str | None]] = []
+        # Pointer temporaries whose integer form is used
+        self.int_used: set[str] = set()
+        self.out = self.lines
+        self.label = ""
+        self.start = False
+        # Incoming (value, LLVM label) pairs of each phi, by block and index,
+        # filled in as the predecessors' terminators are lowered
+        self.incoming: dict[tuple[str, int], list[tuple[str, str]]] = defaultdict(list)
+        # Trap block of each runtime trap function used
+        self.traps: dict[str, str] = {}
+
+    def fresh(self) -> str:
+        self.counter += 1
+        return f"%.{self.counter}"
+
+    def emit(self) -> str:
+        func = self.func
+        ret = _TYPES[str(func.return_type)] if func.return_type is not None else "void"
+        params = ", ".join(f"{_TYPES[str(t)]} %{name}" for t, name in func.params)
+        linkage = "" if func.export else "internal "
+
+        self.out = self.entry
+        for name in sorted(self.slots):
+            self.add(f"%.s.{name} = alloca {_TYPES[self.types[name]]}")
+        for param_type, name in func.params:
+            if name in self.slots:
+                self.add(f"store {_TYPES[str(param_type)]} %{name}, ptr %.s.{name}")
+        self.out = self.lines
+
+        # LLVM's entry block can have no predecessors; if QBE's is a branch
+        # target, an empty one goes before it
+        first = func.blocks[0]
+        self.start = bool(predecessors(func)[first.name])
+        if self.start:
+            for index in range(len(first.phis)):
+                self.incoming[(first.name, index)].append(("undef", "%start"))
+        for position, block in enumerate(func.blocks):
+            following = func.blocks[position + 1 : position + 2]
+            self.block(block, following[0] if following else None)
+
+        body = self.render(self.lines)
+        if self.start:
+            jump = f"  br label %.L.{first.name}"
+            body[:0] = ["start:", *self.render(self.entry), jump]
+        else:
+            body[1:1] = self.render(self.entry)
+        for function, label in self.traps.items():
+            body += [f"{label[1:]}:", f"  call void @{function}()", "  unreachable"]
+        header = f"define {linkage}{ret} @{func.name}({params}) {{"
+        return "\n".join([header, *body, "}", ""])
+
+    @staticmethod
+    def render(lines: list[str | Callable[[], str | None]]) -> list[str]:
+        """``lines`` with the deferred ones rendered, and the dropped ones gone."""
+        rendered = (line() if callable(line) else line for line in lines)
+        return [line for line in rendered if line is not None]
+
+    # -- values ------------------------------------------------------------
+
+    def add(self, line: str) -> None:
+        self.out.append(f"  {line}")
+
+    def start_block(self, label: str) -> None:
+        self.lines.append(f"{label[1:]}:")
+        self.label = label
+
+    def int_form(self, name: str) -> str:
+        """The ``ptrtoint`` of pointer temporary ``name``, for integer uses."""
+        self.int_used.add(name)
+        return f"%.i.{name}"
+
+    def define_int_form(self, name: str) -> None:
+        """Define ``name``'s integer form, rendered only if something uses it."""
+
+        def render() -> str | None:
+            if name not in self.int_used:
+                return None
+            return f"  %.i.{name} = ptrtoint ptr %{name} to i64"
+
+        self.out.append(render)
+
+    def assign(self, name: str, rhs: str) -> None:
+        """Define temporary ``name`` as ``rhs``."""
+        if name in self.slots:
+            reg = self.fresh()
+            self.add(f"{reg} = {rhs}")
+            self.add(f"store {_TYPES[self.types[name]]} {reg}, ptr %.s.{name}")
+            return
+        self.add(f"%{name} = {rhs}")
+        if name in self.pointers:
+            self.define_int_form(name)
+
+    def operand(self, value: Any, qbe_type: str) -> str:
+        """``value`` as an LLVM operand of ``qbe_type``."""
+        if isinstance(value, IntConst):
+            if qbe_type in _BITS:
+                return str(_int(value.value, qbe_type))
+            return _float_literal(value.value, qbe_type)
+        if isinstance(value, FloatConst):
+            if qbe_type in _BITS:
+                return str(_int(_float_bits(value.value, "d"), qbe_type))
+            return _float_literal(_float_bits(value.value, qbe_type), qbe_type)
+        if isinstance(value, Global):
+            self.module.reference(value.name)
+            return self.coerce(f"ptrtoint (ptr @{value.name} to i64)", "l", qbe_type)
+        if isinstance(value, Temporary):
+            name = value.name
+            have = self.types.get(name)
+            if have is None:
+                return "undef"
+            if name in self.slots:
+                source = self.fresh()
+                self.add(f"{source} = load {_TYPES[have]}, ptr %.s.{name}")
+            elif name in self.pointers:
+                source = self.int_form(name)
+            else:
+                source = f"%{name}"
+            return self.coerce(source, have, qbe_type)
+        raise CompileError(f"LLVM backend: unsupported operand {value!r}")
+
+    def coerce(self, source: str, have: str, want: str) -> str:
+        """Convert ``source`` of QBE type ``have`` to ``want``.
+
+        QBE lets a ``l`` value be used as a ``w`` (its low half), and a
+        ``w`` as a ``l`` with unspecified high bits (zero here).
+        """
+        if have == want:
+            return source
+        reg = self.fresh()
+        if (have, want) == ("l", "w"):
+            self.add(f"{reg} = trunc i64 {source} to i32")
+        elif (have, want) == ("w", "l"):
+            self.add(f"{reg} = zext i32 {source} to i64")
+        elif _CAST_FROM[have] == want:
+            self.add(f"{reg} = bitcast {_TYPES[have]} {source} to {_TYPES[want]}")
+        else:
+            raise CompileError(f"LLVM backend: cannot use a {have} value as {want}")
+        return reg
+
+    def is_pointer(self, value: Any) -> bool:
+        return isinstance(value, Global) or (
+            isinstance(value, Temporary) and value.name in self.pointers
+        )
+
+    def pointer(self, value: Any) -> tuple[str, str | None, bool]:
+        """``value`` as an LLVM pointer.
+
+        Also returns its memory class and whether it is exactly a stack slot
+        or data symbol, and so aligned for any access.
+        """
+        if isinstance(value, Global):
+            self.module.reference(value.name)
+            return f"@{value.name}", FRAME, True
+        if isinstance(value, Temporary) and value.name in self.pointers:
+            name = value.name
+            return f"%{name}", self.pointers[name], name in self.allocs
+        address = self.operand(value, "l")
+        reg = self.fresh()
+        self.add(f"{reg} = inttoptr i64 {address} to ptr")
+        return reg, None, False
+
+    def access(self, value: Any, size: int) -> tuple[str, str, str]:
+        """Pointer, ``volatile `` or not, and alignment and metadata suffix."""
+        address, cls, aligned = self.pointer(value)
+        volatile = ""
+        if self.setjmp and cls != MEMORY and not isinstance(value, Global):
+            volatile = "volatile "
+        tail = f", align {size if aligned else 1}{_ACCESS_TAGS[cls]}"
+        return address, volatile, tail
+
+    # -- blocks ------------------------------------------------------------
+
+    def block(self, block: Block, following: Block | None) -> None:
+        self.start_block(f"%.L.{block.name}")
+        for index, phi in enumerate(block.phis):
+            self.lines.append(self.phi_renderer(block.name, index, phi))
+        for phi in block.phis:
+            name = phi.result.name
+            if name in self.slots:
+                llvm_type = _TYPES[str(phi.result_type)]
+                self.add(f"store {llvm_type} %.p.{name}, ptr %.s.{name}")
+            elif name in self.pointers:
+                self.define_int_form(name)
+        entry = block is self.func.blocks[0] and not self.start
+        for instr in block.instructions:
+            if entry and isinstance(instr, Alloc) and isinstance(instr.size, IntConst):
+                # LLVM only promotes the stack slots of its entry block
+                self.out = self.entry
+                self.alloc(instr)
+                self.out = self.lines
+            else:
+                self.instruction(instr)
+        self.terminator(block, following)
+
+    def phi_renderer(self, block: str, index: int, phi: Phi) -> Callable[[], str]:
+        name = phi.result.name
+        llvm_type = "ptr" if name in self.pointers else _TYPES[str(phi.result_type)]
+        target = f"%.p.{name}" if name in self.slots else f"%{name}"
+
+        def render() -> str:
+            incoming = self.incoming[(block, index)]
+            pairs = ", ".join(f"[ {value}, {label} ]" for value, label in incoming)
+            return f"  {target} = phi {llvm_type} {pairs}"
+
+        return render
+
+    def edge(self, block: Block, succ_name: str) -> None:
+        """Lower the values ``block`` passes to ``succ_name``'s phis."""
+        for index, phi in enumerate(self.blocks[succ_name].phis):
+            values = [
+                value for label, value in phi.incoming if label.name == block.name
+            ]
+            if not values:
+                continue
+            if phi.result.name in self.pointers:
+                lowered = self.pointer(values[0])[0]
+            else:
+                lowered = self.operand(values[0], str(phi.result_type))
+            self.incoming[(succ_name, index)].append((lowered, self.label))
+
+    def terminator(self, block: Block, following: Block | None) -> None:
+        term = block.terminator
+        if term is None:
+            if following is None:
+                self.add("unreachable")
+                return
+            term = Jump(target=following.label)
+        if isinstance(term, Branch) and term.if_true.name == term.if_false.name:
+            term = Jump(target=term.if_true)
+        if isinstance(term, Jump):
+            self.edge(block, term.target.name)
+            self.add(f"br label %.L.{term.target.name}")
+        elif isinstance(term, Branch):
+            cond_type = "w"
+            if isinstance(term.condition, Temporary):
+                cond_type = self.types.get(term.condition.name, "w")
+            cond = self.operand(term.condition, cond_type)
+            test = self.fresh()
+            self.add(f"{test} = icmp ne {_TYPES[cond_type]} {cond}, 0")
+            if_true, if_false = term.if_true.name, term.if_false.name
+            self.edge(block, if_true)
+            self.edge(block, if_false)
+            self.add(f"br i1 {test}, label %.L.{if_true}, label %.L.{if_false}")
+        elif isinstance(term, Return):
+            if self.func.return_type is None:
+                self.add("ret void")
+                return
+            ret_type = str(self.func.return_type)
+            value = (
+                "undef" if term.value is None else self.operand(term.value, ret_type)
+            )
+            self.add(f"ret {_TYPES[ret_type]} {value}")
+        elif isinstance(term, Halt):
+            self.add("unreachable")
+        else:
+            raise CompileError(f"LLVM backend: unsupported terminator {term}")
+
+    # -- instructions ------------------------------------------------------
+
+    def instruction(self, instr: Any) -> None:
+        if isinstance(instr, Copy):
+            self.copy(instr)
+        elif isinstance(instr, BinaryOp):
+            self.binary(instr)
+        elif isinstance(instr, Comparison):
+            self.comparison(instr)
+        elif isinstance(instr, UnaryOp):
+            self.unary(instr)
+        elif isinstance(instr, Conversion):
+            self.conversion(instr)
+        elif isinstance(instr, Load):
+            self.load(instr)
+        elif isinstance(instr, Store):
+            self.store(instr)
+        elif isinstance(instr, Alloc):
+            self.alloc(instr)
+        elif isinstance(instr, Call):
+            self.call(instr)
+        else:
+            raise CompileError(f"LLVM backend: unsupported instruction {instr}")
+
+    def copy(self, instr: Copy) -> None:
+        name = instr.result.name
+        if name in self.pointers:
+            base = self.pointer(instr.value)[0]
+            self.assign(name, f"getelementptr i8, ptr {base}, i64 0")
+            return
+        qbe_type = str(instr.result_type)
+        llvm_type = _TYPES[qbe_type]
+        value = self.operand(instr.value, qbe_type)
+        self.assign(name, f"bitcast {llvm_type} {value} to {llvm_type}")
+
+    def binary(self, instr: BinaryOp) -> None:
+        if _is_comparison(instr.op):
+            self.comparison(instr)
+            return
+        name = instr.result.name
+        qbe_type = str(instr.result_type)
+        llvm_type = _TYPES[qbe_type]
+        if name in self.pointers:
+            left_is_base = self.is_pointer(instr.left)
+            base, offset = (
+                (instr.left, instr.right) if left_is_base else (instr.right, instr.left)
+            )
+            pointer = self.pointer(base)[0]
+            index = self.operand(offset, "l")
+            if instr.op == "sub":
+                negated = self.fresh()
+                self.add(f"{negated} = sub i64 0, {index}")
+                index = negated
+            self.assign(name, f"getelementptr i8, ptr {pointer}, i64 {index}")
+            return
+        left = self.operand(instr.left, qbe_type)
+        right = self.operand(instr.right, qbe_type)
+        if qbe_type in ("s", "d"):
+            op = _FLOAT_OPS.get(instr.op)
+            if op is None:
+                raise CompileError(f"LLVM backend: unsupported float op {instr.op}")
+            self.assign(name, f"{op} {llvm_type} {left}, {right}")
+            return
+        op = _INT_OPS.get(instr.op)
+        if op is None:
+            raise CompileError(f"LLVM backend: unsupported integer op {instr.op}")
+        if instr.op in ("sar", "shr", "shl"):
+            # QBE (like the hardware and WASM) takes the count modulo the width
+            mask = _BITS[qbe_type] - 1
+            if isinstance(instr.right, IntConst):
+                right = str(instr.right.value & mask)
+            else:
+                masked = self.fresh()
+                self.add(f"{masked} = and {llvm_type} {right}, {mask}")
+                right = masked
+        elif instr.op in ("div", "rem", "udiv", "urem"):
+            right = self.checked_divisor(instr, qbe_type, left, right)
+        self.assign(name, f"{op} {llvm_type} {left}, {right}")
+
+    def checked_divisor(
+        self, instr: BinaryOp, qbe_type: str, left: str, right: str
+    ) -> str:
+        """Trap where WASM does before dividing; returns the divisor to use.
+
+        A zero divisor traps, and so does ``INT_MIN / -1``; ``INT_MIN % -1``
+        is 0, computed as ``% 1``.
+        """
+        llvm_type = _TYPES[qbe_type]
+        constant = None
+        if isinstance(instr.right, IntConst):
+            constant = _int(instr.right.value, qbe_type)
+        if not constant:
+            is_zero = self.fresh()
+            self.add(f"{is_zero} = icmp eq {llvm_type} {right}, 0")
+            self.trap_if(is_zero, "__wasm_trap_div_by_zero")
+        if instr.op not in ("div", "rem") or constant not in (None, -1):
+            return right
+        minus_one = self.fresh()
+        self.add(f"{minus_one} = icmp eq {llvm_type} {right}, -1")
+        if instr.op == "rem":
+            divisor = self.fresh()
+            self.add(
+                f"{divisor} = select i1 {minus_one}, {llvm_type} 1, "
+                f"{llvm_type} {right}"
+            )
+            return divisor
+        is_min = self.fresh()
+        overflow = self.fresh()
+        int_min = -(1 << (_BITS[qbe_type] - 1))
+        self.add(f"{is_min} = icmp eq {llvm_type} {left}, {int_min}")
+        self.add(f"{overflow} = and i1 {is_min}, {minus_one}")
+        self.trap_if(overflow, "__wasm_trap_integer_overflow")
+        return right
+
+    def trap_if(self, condition: str, function: str) -> None:
+        """Branch to a call of runtime trap ``function`` if ``condition``."""
+        if function not in self.traps:
+            self.traps[function] = f"%.trap{len(self.traps)}"
+            self.module.declare(function, "void", [], " noreturn")
+        self.counter += 1
+        following = f"%.b{self.counter}"
+        self.add(f"br i1 {condition}, label {self.traps[function]}, label {following}")
+        self.start_block(following)
+
+    def comparison(self, instr: Comparison | BinaryOp) -> None:
+        cond, operand_type = instr.op[1:-1], instr.op[-1]
+        llvm_type = _TYPES[operand_type]
+        left = self.operand(instr.left, operand_type)
+        right = self.operand(instr.right, operand_type)
+        test = self.fresh()
+        if operand_type in ("s", "d"):
+            self.add(f"{test} = fcmp {_FLOAT_CONDS[cond]} {llvm_type} {left}, {right}")
+        elif cond in _INT_CONDS:
+            self.add(f"{test} = icmp {cond} {llvm_type} {left}, {right}")
+        else:
+            raise CompileError(f"LLVM backend: unsupported comparison {instr.op}")
+        result_type = _TYPES[str(instr.result_type)]
+        self.assign(instr.result.name, f"zext i1 {test} to {result_type}")
+
+    def unary(self, instr: UnaryOp) -> None:
+        if instr.op != "neg":
+            raise CompileError(f"LLVM backend: unsupported op {instr.op}")
+        qbe_type = str(instr.result_type)
+        llvm_type = _TYPES[qbe_type]
+        value = self.operand(instr.operand, qbe_type)
+        if qbe_type in ("s", "d"):
+            self.assign(instr.result.name, f"fneg {llvm_type} {value}")
+        else:
+            self.assign(instr.result.name, f"sub {llvm_type} 0, {value}")
+
+    def conversion(self, instr: Conversion) -> None:
+        name = instr.result.name
+        result_type = str(instr.result_type)
+        llvm_type = _TYPES[result_type]
+        op = instr.op
+        if op in _NARROW_EXTENSIONS:
+            narrow, cast = _NARROW_EXTENSIONS[op]
+            value = self.operand(instr.operand, result_type)
+            truncated = self.fresh()
+            self.add(f"{truncated} = trunc {llvm_type} {value} to {narrow}")
+            self.assign(name, f"{cast} {narrow} {truncated} to {llvm_type}")
+            return
+        if op == "cast":
+            operand_type = _CAST_FROM[result_type]
+            value = self.operand(instr.operand, operand_type)
+            self.assign(name, f"bitcast {_TYPES[operand_type]} {value} to {llvm_type}")
+            return
+        if op not in _CONVERSIONS:
+            raise CompileError(f"LLVM backend: unsupported conversion {op}")
+        operand_type, cast = _CONVERSIONS[op]
+        value = self.operand(instr.operand, operand_type)
+        if operand_type == result_type:
+            self.assign(name, f"bitcast {llvm_type} {value} to {llvm_type}")
+        elif cast in ("fptosi", "fptoui"):
+            # Out-of-range inputs are poison in LLVM; the code generator
+            # range-checks them first where WASM traps
+            raw = self.fresh()
+            self.add(f"{raw} = {cast} {_TYPES[operand_type]} {value} to {llvm_type}")
+            self.assign(name, f"freeze {llvm_type} {raw}")
+        else:
+            self.assign(name, f"{cast} {_TYPES[operand_type]} {value} to {llvm_type}")
+
+    def load(self, instr: Load) -> None:
+        name = instr.result.name
+        result_type = str(instr.result_type)
+        suffix = (instr.load_type or f"load{result_type}")[4:] or result_type
+        memory_type, size = _ACCESS[suffix[-1]]
+        address, volatile, tail = self.access(instr.address, size)
+        if name in self.pointers:
+            self.assign(name, f"load {volatile}ptr, ptr {address}{tail}")
+            return
+        llvm_type = _TYPES[result_type]
+        load = f"load {volatile}{memory_type}, ptr {address}{tail}"
+        if memory_type == llvm_type:
+            self.assign(name, load)
+            return
+        raw = self.fresh()
+        self.add(f"{raw} = {load}")
+        # ``loadw`` into a ``l`` is ``loadsw``
+        cast = "zext" if suffix.startswith("u") else "sext"
+        self.assign(name, f"{cast} {memory_type} {raw} to {llvm_type}")
+
+    def store(self, instr: Store) -> None:
+        kind = str(instr.store_type)[5:]
+        memory_type, size = _ACCESS[kind]
+        value_type = kind if kind in _TYPES else "w"
+        value = self.operand(instr.value, value_type)
+        if memory_type != _TYPES[value_type]:
+            narrow = self.fresh()
+            self.add(f"{narrow} = trunc i32 {value} to {memory_type}")
+            value = narrow
+        address, volatile, tail = self.access(instr.address, size)
+        self.add(f"store {volatile}{memory_type} {value}, ptr {address}{tail}")
+
+    def alloc(self, instr: Alloc) -> None:
+        size = self.operand(instr.size, "l")
+        self.assign(instr.result.name, f"alloca i8, i64 {size}, align {instr.align}")
+
+    def call(self, instr: Call) -> None:
+        types = [str(arg_type) for arg_type, _value in instr.args]
+        args = ", ".join(
+            f"{_TYPES[t]} {self.operand(value, t)}"
+            for t, (_arg_type, value) in zip(types, instr.args, strict=True)
+        )
+        ret = _TYPES[str(instr.result_type)] if instr.result is not None else "void"
+        attrs = ""
+        if isinstance(instr.target, Global):
+            callee = f"@{instr.target.name}"
+            if instr.target.name == "_setjmp":
+                attrs = " #0"
+            elif instr.target.name.startswith("__wasm_trap_"):
+                attrs = " noreturn"
+            self.module.declare(
+                instr.target.name, ret, [_TYPES[t] for t in types], attrs
+            )
+        else:
+            callee = self.pointer(instr.target)[0]
+        call = f"call {ret} {callee}({args}){' #0' if attrs == ' #0' else ''}"
+        if instr.result is None:
+            self.add(call)
+        elif instr.result.name in self.pointers:
+            raw = self.fresh()
+            self.add(f"{raw} = {call}")
+            self.assign(instr.result.name, f"inttoptr i64 {raw} to ptr")
+        else:
+            self.assign(instr.result.name, call)
@@ -0,0 +1,186 @@
+"""Optimization passes over the compiled functions of a module.
+
+QBE deliberately stops at a handful of cheap optimizations (copy and constant
+propagation, dead instruction removal, register allocation).  Everything
+else, such as inlining or loop-invariant code motion, has to happen before
+the IL is emitted, on the function graphs the code generator builds (see
+``passes.ir``).
+
+The pipeline for each ``-O`` level:
+
+- ``-O0``: no passes; the IL mirrors the WASM instruction stream.
+- ``-O1``: cheap cleanups, repeated until the function stops changing, and
+  folding of immutable globals.
+- ``-O2``: everything in ``-O1`` plus the more expensive transformations:
+  devirtualization of ``call_indirect`` through an immutable table, then
+  inlining between the module's functions and promotion of mutable globals
+  to temporaries, and per function, hoisting of loop-invariant code and
+  strength reduction of address arithmetic.
+
+``--lto`` additionally inlines the hot runtime helpers that have IL versions
+(``waq.runtime.il``) at ``-O1`` and above.
+
+With a profile (``--profile-use``, see ``waq.compiler.profile``) the
+inliner also takes larger callees at hot call sites and skips cold ones,
+devirtualization also covers the hot targets of any ``call_indirect``, and
+at ``-O1`` and above blocks are laid out along the hot paths.
+"""
+
+from __future__ import annotations
+
+from collections import Counter
+from dataclasses import dataclass, field
+from typing import TYPE_CHECKING
+
+from .cleanup import merge_blocks, propagate_copies, remove_unreachable_blocks
+from .dce import remove_dead_temporaries
+from .devirt import devirtualize_calls
+from .fold import fold_constants
+from .globals import fold_constant_globals, promote_globals
+from .inline import inline_functions, inline_runtime_helpers
+from .layout import lay_out_blocks
+from .licm import hoist_loop_invariants
+from .strength import reduce_strength
+
+if TYPE_CHECKING:
+    from collections.abc import Callable, Mapping
+
+    from qbepy import Function
+
+    from waq.compiler.profile import Profile
+
+OPT_LEVELS = (0, 1, 2)
+
+# Cleanups run to a fixed point; each round is linear in the function size,
+# and real code settles within a handful.  The cap only guards against a
+# pair of passes undoing each other.
+_MAX_CLEANUP_ROUNDS = 16
+
+
+@dataclass(frozen=True, slots=True)
+class Pass:
+    """A function pass: rewrites a function in place, returns whether it
+    changed anything.
+
+    A module pass instead takes the list of functions and the
+    ``ModuleFacts``, and may add or remove functions.  Module passes run
+    after a first cleanup of every function and before the function passes.
+    """
+
+    name: str
+    run: Callable[..., bool]
+    level: int  # Lowest -O level that runs the pass
+    cleanup: bool = False  # Part of the fixed-point cleanup group
+    lto: bool = False  # Only with --lto: bakes in runtime internals
+    module: bool = False  # Runs over the whole list of functions
+
+
+@dataclass(frozen=True, slots=True)
+class ModuleFacts:
+    """What module passes know about the module beyond the function bodies."""
+
+    # Functions referenced from outside the bodies (exports, the start
+    # function, table elements); they must be kept
+    roots: frozenset[str] = frozenset()
+
+    # Slots of table 0 as (function name, signature id), when nothing can
+    # change the table after instantiation; None otherwise
+    table: Mapping[int, tuple[str, int]] | None = None
+
+    # Slots of table 0 as the element segments fill them at instantiation
+    initial_table: Mapping[int, tuple[str, int]] = field(default_factory=dict)
+
+    # Execution counts of the functions, for --profile-use
+    profile: Profile | None = None
+
+    # Values of the immutable globals initialized to a constant, by symbol
+    constant_globals: Mapping[str, int | float] = field(default_factory=dict)
+
+    # Symbols of the mutable globals
+    mutable_globals: frozenset[str] = frozenset()
+
+
+PASSES: list[Pass] = [
+    Pass("unreachable", remove_unreachable_blocks, 1, cleanup=True),
+    Pass("fold", fold_constants, 1, cleanup=True),
+    Pass("copyprop", propagate_copies, 1, cleanup=True),
+    Pass("dce", remove_dead_temporaries, 1, cleanup=True),
+    Pass("merge", merge_blocks, 1, cleanup=True),
+    Pass("const-globals", fold_constant_globals, 1, module=True),
+    Pass("devirt", devirtualize_calls, 2, module=True),
+    Pass("inline", inline_functions, 2, module=True),
+    Pass("promote", promote_globals, 2, module=True),
+    Pass("layout", lay_out_blocks, 1, module=True),
+    Pass("runtime-inline", inline_runtime_helpers, 1, lto=True),
+    Pass("licm", hoist_loop_invariants, 2),
+    Pass("strength", reduce_strength, 2),
+]
+
+
+@dataclass
+class PassManager:
+    """Runs the pipeline for an optimization level over compiled functions."""
+
+    opt_level: int
+    disabled: frozenset[str] = frozenset()
+    lto: bool = False
+    stats: Counter[str] = field(default_factory=Counter)
+
+    def __post_init__(self) -> None:
+        if self.opt_level not in OPT_LEVELS:
+            raise ValueError(f"invalid optimization level: {self.opt_level}")
+
+    @property
+    def passes(self) -> list[Pass]:
+        """The passes enabled at this level, in pipeline order."""
+        return [
+            p
+            for p in PASSES
+            if p.level <= self.opt_level
+            and p.name not in self.disabled
+            and (self.lto or not p.lto)
+        ]
+
+    def run(self, functions: list[Function], facts: ModuleFacts | None = None) -> None:
+        """Optimize ``functions`` in place.
+
+        Module passes may drop any function they make unused that is not
+        one of ``facts.roots``.
+        """
+        facts = facts or ModuleFacts()
+        passes = self.passes
+        if not passes:
+            return
+        cleanups = [p for p in passes if p.cleanup]
+        module_passes = [p for p in passes if p.module]
+        if module_passes:
+            # Judge function sizes after the cheap cleanups
+            for func in functions:
+                self._run_cleanups(func, cleanups)
+            for p in module_passes:
+                if p.run(functions, facts):
+                    self.stats[p.name] += 1
+        for func in functions:
+            self._run_cleanups(func, cleanups)
+            for p in passes:
+                if p.cleanup or p.module:
+                    continue
+                if self._run_pass(func, p):
+                    self._run_cleanups(func, cleanups)
+
+    def _run_cleanups(self, func: Function, cleanups: list[Pass]) -> None:
+        for _ in range(_MAX_CLEANUP_ROUNDS):
+            changed = False
+            for p in cleanups:
+                changed |= self._run_pass(func, p)
+            if not changed:
+                return
+
+    def _run_pass(self, func: Function, p: Pass) -> bool:
+        changed = p.run(func)
+        if changed:
+            self.stats[p.name] += 1
+        return changed
+
+
+__all__ = ["OPT_LEVELS", "PASSES", "ModuleFacts", "Pass", "PassManager"]
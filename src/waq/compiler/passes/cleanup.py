@@ -0,0 +1,183 @@
+"""Cheap cleanups that make later passes and QBE's own work smaller.
+
+Lowering leaves behind blocks that nothing jumps to (code after a ``br`` or
+an unreachable ``else``), copies for every rebinding of a local, phis whose
+incoming values all agree, and chains of blocks joined by unconditional
+jumps (the continuation after every ``block``/``if`` end, and the
+trampoline block ``br_if`` jumps through).
+"""
+
+from __future__ import annotations
+
+from typing import TYPE_CHECKING, Any
+
+from qbepy.ir import Copy, IntConst, Jump, Label, Phi, Temporary
+
+from .fold import wrap_const
+from .ir import (
+    block_map,
+    defined,
+    predecessors,
+    reachable,
+    retarget,
+    rewrite_operands,
+    successors,
+    temp_types,
+)
+
+if TYPE_CHECKING:
+    from qbepy import Function
+    from qbepy.ir import Block
+
+
+def remove_unreachable_blocks(func: Function) -> bool:
+    """Delete blocks that cannot be reached from the entry block.
+
+    Phi operands flowing in from deleted blocks are dropped with them.
+    """
+    live = reachable(func)
+    if len(live) == len(func.blocks):
+        return False
+    func.blocks[:] = [block for block in func.blocks if block.name in live]
+    for block in func.blocks:
+        for i, phi in enumerate(block.phis):
+            incoming = [(lab, value) for lab, value in phi.incoming if lab.name in live]
+            if len(incoming) != len(phi.incoming):
+                block.phis[i] = Phi(
+                    result=phi.result, result_type=phi.result_type, incoming=incoming
+                )
+    return True
+
+
+def propagate_copies(func: Function) -> bool:
+    """Replace uses of copies and single-valued phis with their source.
+
+    A copy is only forwarded when it does not change the value's type: QBE
+    uses ``=w copy`` of a long to truncate, and an integer constant read as a
+    float would be reinterpreted.
+    """
+    types = temp_types(func)
+    forward: dict[str, Any] = {}
+
+    def resolve(value: Any) -> Any:
+        while isinstance(value, Temporary) and value.name in forward:
+            value = forward[value.name]
+        return value
+
+    def bind(instr: Any, source: Any) -> None:
+        result_type = str(instr.result_type)
+        if _same_type(source, result_type, types):
+            if isinstance(source, IntConst):
+                source = wrap_const(source, result_type)
+            forward[instr.result.name] = source
+
+    for block in func.blocks:
+        for phi in block.phis:
+            sources = {resolve(value) for _label, value in phi.incoming}
+            sources.discard(phi.result)
+            if len(sources) == 1:
+                bind(phi, sources.pop())
+        for instr in block.instructions:
+            if isinstance(instr, Copy) and defined(instr) is not None:
+                bind(instr, resolve(instr.value))
+
+    if not forward:
+        return False
+    # Forwarding a phi may expose another phi in an earlier block as
+    # single-valued; the pass manager reruns cleanups until nothing changes
+    rewrite_operands(func, resolve)
+    for block in func.blocks:
+        block.phis = [phi for phi in block.phis if phi.result.name not in forward]
+        block.instructions = [
+            instr for instr in block.instructions if defined(instr) not in forward
+        ]
+    return True
+
+
+def merge_blocks(func: Function) -> bool:
+    """Thread jumps through empty blocks and merge straight-line chains.
+
+    An empty block that only jumps on is bypassed by its predecessors, unless
+    that would give the target's phis two operands for one predecessor.  A
+    block whose only predecessor jumps straight to it is appended to that
+    predecessor; its phis then have a single operand and become copies.  The
+    entry block is never removed or merged into another block.
+    """
+    blocks = block_map(func)
+    preds = {name: set(labels) for name, labels in predecessors(func).items()}
+    entry = func.blocks[0].name
+    removed: set[str] = set()
+
+    for block in func.blocks[1:]:
+        term = block.terminator
+        if block.phis or block.instructions or not isinstance(term, Jump):
+            continue
+        target = blocks[term.target.name]
+        if target.name in (block.name, entry) or not preds[block.name]:
+            continue
+        if target.phis and preds[block.name] & preds[target.name]:
+            continue
+        for pred in preds[block.name]:
+            retarget(blocks[pred], block.name, target.name)
+        for i, phi in enumerate(target.phis):
+            incoming = []
+            for label, value in phi.incoming:
+                if label.name != block.name:
+                    incoming.append((label, value))
+                else:
+                    incoming += [(Label(p), value) for p in sorted(preds[block.name])]
+            target.phis[i] = Phi(
+                result=phi.result, result_type=phi.result_type, incoming=incoming
+            )
+        preds[target.name] |= preds[block.name]
+        preds[target.name].discard(block.name)
+        preds[block.name] = set()
+        removed.add(block.name)
+
+    for block in func.blocks:
+        if block.name in removed:
+            continue
+        while isinstance(block.terminator, Jump):
+            succ = blocks[block.terminator.target.name]
+            if succ.name in (block.name, entry) or preds[succ.name] != {block.name}:
+                break
+            _absorb(block, succ, blocks, preds)
+            removed.add(succ.name)
+
+    if not removed:
+        return False
+    func.blocks[:] = [block for block in func.blocks if block.name not in removed]
+    return True
+
+
+def _absorb(
+    block: Block, succ: Block, blocks: dict[str, Block], preds: dict[str, set[str]]
+) -> None:
+    """Append ``succ``, whose only predecessor is ``block``, to ``block``."""
+    for phi in succ.phis:
+        # Only the operand from ``block`` can remain
+        ((_label, value),) = phi.incoming
+        block.instructions.append(
+            Copy(result=phi.result, result_type=phi.result_type, value=value)
+        )
+    block.instructions.extend(succ.instructions)
+    block.terminator = succ.terminator
+    for name in successors(succ):
+        preds[name].discard(succ.name)
+        preds[name].add(block.name)
+        target = blocks[name]
+        for i, phi in enumerate(target.phis):
+            target.phis[i] = Phi(
+                result=phi.result,
+                result_type=phi.result_type,
+                incoming=[
+                    (Label(block.name) if lab.name == succ.name else lab, value)
+                    for lab, value in phi.incoming
+                ],
+            )
+
+
+def _same_type(value: Any, result_type: str, types: dict[str, str]) -> bool:
+    if isinstance(value, Temporary):
+        return types.get(value.name) == result_type
+    return isinstance(value, IntConst) and result_type in ("w", "l")
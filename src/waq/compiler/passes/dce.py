@@ -0,0 +1,71 @@
+"""Dead temporary elimination.
+
+Mark and sweep over SSA values: terminators and instructions with side
+effects are live, and so is everything they read, transitively.  Phis and
+pure instructions whose results are never read are deleted, including phi
+cycles that only feed each other (a local reassigned in a loop but never
+read after it).
+"""
+
+from __future__ import annotations
+
+from typing import TYPE_CHECKING, Any
+
+from .ir import defined, has_side_effects, is_ssa, uses
+
+if TYPE_CHECKING:
+    from qbepy import Function
+
+
+def remove_dead_temporaries(func: Function) -> bool:
+    """Delete phis and side-effect-free instructions with unused results.
+
+    Liveness is tracked per name, through each temporary's one definition;
+    functions that aren't in SSA form are left alone.
+    """
+    if not is_ssa(func):
+        return False
+    defs: dict[str, Any] = {}
+    live: set[str] = set()
+    worklist: list[str] = []
+
+    def mark(instr: Any) -> None:
+        for name in uses(instr):
+            if name not in live:
+                live.add(name)
+                worklist.append(name)
+
+    for block in func.blocks:
+        for phi in block.phis:
+            defs[phi.result.name] = phi
+        for instr in block.instructions:
+            name = defined(instr)
+            if name is not None:
+                defs[name] = instr
+            if name is None or has_side_effects(instr):
+                mark(instr)
+        if block.terminator is not None:
+            mark(block.terminator)
+
+    while worklist:
+        instr = defs.get(worklist.pop())
+        if instr is not None:
+            mark(instr)
+
+    changed = False
+    for block in func.blocks:
+        phis = [phi for phi in block.phis if phi.result.name in live]
+        instructions = [
+            instr
+            for instr in block.instructions
+            if (name := defined(instr)) is None
+            or name in live
+            or has_side_effects(instr)
+        ]
+        if len(phis) != len(block.phis) or len(instructions) != len(
+            block.instructions
+        ):
+            block.phis = phis
+            block.instructions = instructions
+            changed = True
+    return changed
@@ -0,0 +1,405 @@
+"""Devirtualization of ``call_indirect``.
+
+A ``call_indirect`` site is compiled as a bounds check, a signature check
+and a call through the slot's code pointer (see ``_emit_table_entry``).
+This pass gives sites whose likely targets are known direct calls to them,
+in front of the checked indirect call, which handles every other case.
+
+When nothing can write table 0 after instantiation (it is neither imported
+nor exported, and no function body uses ``table.set``, ``table.grow``,
+``table.fill``, ``table.copy`` or ``table.init``), the active element
+segments fix its contents at compile time; codegen passes them in as
+``ModuleFacts.table``.  The pass then works out which values the index can
+take:
+
+- a constant, or a copy of one;
+- a phi, through phis and copies, whose inputs are all constants;
+- ``x & mask`` with a mask of at most two bits set.
+
+When there are at most ``_MAX_TARGETS`` of them, each value whose slot holds
+a function of the expected signature gets a direct call, selected by a
+compare chain in front of the checks::
+
+    %dv1.is0 =w ceqw %idx, 3
+    jnz %dv1.is0, @dv1.call0, @dv1.test1
+    ...
+    @dv1.generic          bounds check, signature check, indirect call
+
+A constant index that matches folds the chain to a jump, and the cleanups
+then remove the checks altogether.
+
+With a profile (``waq.compiler.profile``), a site whose index is unknown
+gets direct calls to the table indices that took at least 1/_MIN_SHARE of
+its calls.  Through an immutable table these are index compares as above;
+otherwise the slot may have changed since instantiation, so the checked
+code pointer is compared with the function the slot held initially::
+
+    %t12 =l loadl %t8
+    %dv1.is0 =w ceql %t12, $__wasm_func_4
+    jnz %dv1.is0, @dv1.call0, @dv1.indirect
+
+Devirtualized calls are ordinary direct calls, so the inliner, which runs
+next, can inline them.
+"""
+
+from __future__ import annotations
+
+from dataclasses import dataclass
+from typing import TYPE_CHECKING, Any
+
+from qbepy.ir import (
+    BinaryOp,
+    Branch,
+    Call,
+    Comparison,
+    Copy,
+    Global,
+    IntConst,
+    Jump,
+    Load,
+    Phi,
+    Temporary,
+    W,
+)
+
+from .ir import fresh_prefix, rename_predecessor
+
+if TYPE_CHECKING:
+    from collections.abc import Mapping
+
+    from qbepy import Function
+    from qbepy.ir import Block
+
+    from waq.compiler.profile import FunctionProfile
+
+    from . import ModuleFacts
+
+# Most targets one site is expanded into; each costs a compare and a call
+_MAX_TARGETS = 4
+
+# A profiled target must have had at least 1/_MIN_SHARE of the site's calls
+_MIN_SHARE = 4
+
+_MASK32 = 0xFFFFFFFF
+
+
+def devirtualize_calls(functions: list[Function], facts: ModuleFacts) -> bool:
+    """Turn ``call_indirect`` sites with known targets into direct calls."""
+    if facts.table is None and facts.profile is None:
+        return False
+    changed = False
+    for func in functions:
+        profile = facts.profile[func.name] if facts.profile is not None else None
+        # Rewriting adds blocks after the site, which this loop then visits;
+        # the original checks, moved to a new block, are not visited twice
+        rewritten: set[str] = set()
+        i = 0
+        while i < len(func.blocks):
+            block = func.blocks[i]
+            site = None
+            if block.name not in rewritten:
+                site = find_indirect_call(func, block)
+            if site is not None:
+                checks = _devirtualize(func, site, facts, profile)
+                if checks is not None:
+                    rewritten.add(checks.name)
+                    changed = True
+            i += 1
+    return changed
+
+
+@dataclass(slots=True)
+class IndirectCall:
+    """A compiled ``call_indirect``: where its checks and call are."""
+
+    block: Block  # Ends in the bounds check
+    check: int  # Position in ``block`` of the table size load
+    ok: Block  # Loads the code pointer and calls it
+    call: int  # Position in ``ok`` of the call
+    index: Any
+    sig: int  # Signature id the slot must hold
+
+
+def find_indirect_call(func: Function, block: Block) -> IndirectCall | None:
+    """The ``call_indirect`` whose bounds check ends ``block``, if any."""
+    term = block.terminator
+    if not isinstance(term, Branch):
+        return None
+    check = in_bounds = None
+    for at, instr in enumerate(block.instructions):
+        if isinstance(instr, Load) and instr.address == Global("__wasm_table_size"):
+            check = at
+        elif (
+            check is not None
+            and isinstance(instr, Comparison)
+            and instr.op == "cultw"
+            and instr.right == block.instructions[check].result
+            and instr.result == term.condition
+        ):
+            in_bounds = instr
+    if in_bounds is None:
+        return None
+
+    blocks = {b.name: b for b in func.blocks}
+    checked = blocks.get(term.if_true.name)
+    if checked is None or not isinstance(checked.terminator, Branch):
+        return None
+    matches = next(
+        (
+            instr
+            for instr in checked.instructions
+            if isinstance(instr, Comparison)
+            and instr.result == checked.terminator.condition
+        ),
+        None,
+    )
+    if not (
+        matches is not None
+        and matches.op == "ceqw"
+        and isinstance(matches.right, IntConst)
+    ):
+        return None
+
+    ok = blocks.get(checked.terminator.if_true.name)
+    if ok is None:
+        return None
+    loaded = set()
+    for at, instr in enumerate(ok.instructions):
+        if isinstance(instr, Load):
+            loaded.add(instr.result)
+        elif isinstance(instr, Call):
+            if instr.target not in loaded:
+                return None
+            return IndirectCall(
+                block, check, ok, at, in_bounds.left, matches.right.value
+            )
+    return None
+
+
+def _devirtualize(
+    func: Function,
+    site: IndirectCall,
+    facts: ModuleFacts,
+    profile: FunctionProfile | None,
+) -> Block | None:
+    """Add direct calls in front of ``site``; the block now holding its checks."""
+    values = None
+    if facts.table is not None:
+        values = _index_values(func, site.index)
+    calls = profile.targets.get(site.ok.name, {}) if profile is not None else {}
+    if values is None:
+        values = _profiled_indices(calls)
+    if not values:
+        return None
+
+    table = facts.table if facts.table is not None else facts.initial_table
+    targets = [
+        (value, table[value][0])
+        for value in values
+        if value in table and table[value][1] == site.sig
+    ]
+    if not targets:
+        return None
+    by_index = facts.table is not None
+    fallback = _add_direct_calls(func, site, targets, by_index=by_index)
+    if calls:
+        chained = site.block if by_index else site.ok
+        _update_profile(profile, chained, fallback, calls, targets)
+    return fallback
+
+
+def _add_direct_calls(
+    func: Function,
+    site: IndirectCall,
+    targets: list[tuple[int, str]],
+    *,
+    by_index: bool,
+) -> Block:
+    """Rewrite ``site`` to call ``targets`` (index, function) directly.
+
+    The targets are selected by comparing the index (``by_index``) or the
+    checked code pointer.  Returns the block the compare chain falls
+    through to.
+    """
+    prefix = fresh_prefix(func, "dv")
+    ok = site.ok
+    call = ok.instructions[site.call]
+
+    # The rest of the calling block continues after the call, joined by
+    # the indirect and direct calls
+    cont = func.add_block(prefix)
+    cont.instructions = ok.instructions[site.call + 1 :]
+    cont.terminator = ok.terminator
+    rename_predecessor(func, cont, ok.name)
+    ok.instructions = ok.instructions[: site.call + 1]
+    ok.terminator = Jump(target=cont.label)
+
+    directs = []
+    incoming = []
+    for k, (_value, name) in enumerate(targets):
+        direct = func.add_block(f"{prefix}.call{k}")
+        result = Temporary(f"{prefix}.r{k}") if call.result is not None else None
+        direct.instructions = [
+            Call(
+                target=Global(name),
+                args=call.args,
+                result=result,
+                result_type=call.result_type,
+            )
+        ]
+        direct.terminator = Jump(target=cont.label)
+        directs.append(direct)
+        incoming.append((direct.label, result))
+
+    # Compare chain in front of the checks or the indirect call, which move
+    # to the last link
+    if by_index:
+        chained, at = site.block, site.check
+        tests = [(IntConst(value), "ceqw", site.index) for value, _name in targets]
+    else:
+        chained, at = ok, site.call
+        tests = [(Global(name), "ceql", call.target) for _value, name in targets]
+    links = [chained]
+    for k in range(1, len(targets)):
+        links.append(func.add_block(f"{prefix}.test{k}"))
+    fallback = func.add_block(f"{prefix}.generic" if by_index else f"{prefix}.indirect")
+    fallback.instructions = chained.instructions[at:]
+    fallback.terminator = chained.terminator
+    chained.instructions = chained.instructions[:at]
+    rename_predecessor(func, fallback, chained.name)
+    following = [*links[1:], fallback]
+    for k, (link, (operand, op, value)) in enumerate(zip(links, tests, strict=True)):
+        link.instructions.append(
+            Comparison(
+                result=Temporary(f"{prefix}.is{k}"),
+                result_type=W,
+                op=op,
+                left=value,
+                right=operand,
+            )
+        )
+        link.terminator = Branch(
+            condition=Temporary(f"{prefix}.is{k}"),
+            if_true=directs[k].label,
+            if_false=following[k].label,
+        )
+
+    indirect = ok if by_index else fallback
+    if call.result is not None:
+        result = Temporary(f"{prefix}.r")
+        indirect.instructions[-1] = Call(
+            target=call.target,
+            args=call.args,
+            result=result,
+            result_type=call.result_type,
+        )
+        cont.phis = [
+            Phi(
+                result=call.result,
+                result_type=call.result_type,
+                incoming=[(indirect.label, result), *incoming],
+            )
+        ]
+
+    # Layout: the chain after the block it starts in, the direct calls and
+    # the continuation after the indirect call
+    moved = {b.name for b in [*links[1:], fallback, *directs, cont]}
+    rest = [b for b in func.blocks if b.name not in moved]
+    at = rest.index(chained) + 1
+    rest[at:at] = [*links[1:], fallback]
+    at = rest.index(indirect) + 1
+    rest[at:at] = [*directs, cont]
+    func.blocks[:] = rest
+    return fallback
+
+
+def _update_profile(
+    profile: FunctionProfile,
+    chained: Block,
+    fallback: Block,
+    calls: Mapping[int, int],
+    targets: list[tuple[int, str]],
+) -> None:
+    """Count the blocks added by ``_add_direct_calls``, for the block layout.
+
+    ``chained`` is the block the compare chain starts in and ``calls`` the
+    site's profiled calls per table index.
+    """
+    prefix = fallback.name.rsplit(".", 1)[0]
+    remaining = total = sum(calls.values())
+    for k, (value, _name) in enumerate(targets):
+        link = f"{prefix}.test{k}" if k else chained.name
+        if k:
+            profile.blocks[link] = remaining
+        n = calls.get(value, 0)
+        profile.branches[link] = n
+        profile.blocks[f"{prefix}.call{k}"] = n
+        remaining -= n
+    profile.blocks[fallback.name] = remaining
+    profile.blocks[prefix] = total
+
+
+def _profiled_indices(calls: Mapping[int, int]) -> list[int]:
+    """The indices that took at least 1/_MIN_SHARE of a site's calls."""
+    total = sum(calls.values())
+    hot = [index for index, n in calls.items() if n and n * _MIN_SHARE >= total]
+    hot.sort(key=lambda index: -calls[index])
+    return hot[:_MAX_TARGETS]
+
+
+def _index_values(func: Function, index: Any) -> list[int] | None:
+    """The values ``index`` can take, if there are at most ``_MAX_TARGETS``."""
+    defs = {}
+    for block in func.blocks:
+        for instr in [*block.phis, *block.instructions]:
+            result = getattr(instr, "result", None)
+            if isinstance(result, Temporary):
+                defs[result.name] = instr
+
+    visiting: set[str] = set()
+
+    def values(value: Any) -> set[int] | None:
+        if isinstance(value, IntConst):
+            return {value.value & _MASK32}
+        if not isinstance(value, Temporary) or value.name in visiting:
+            return None
+        instr = defs.get(value.name)
+        visiting.add(value.name)
+        try:
+            if isinstance(instr, Copy):
+                return values(instr.value)
+            if isinstance(instr, Phi):
+                found: set[int] = set()
+                for _label, incoming in instr.incoming:
+                    more = values(incoming)
+                    if more is None:
+                        return None
+                    found |= more
+                    if len(found) > _MAX_TARGETS:
+                        return None
+                return found
+            if (
+                isinstance(instr, BinaryOp)
+                and instr.op == "and"
+                and isinstance(instr.right, IntConst)
+            ):
+                return _masked(instr.right.value & _MASK32)
+            return None
+        finally:
+            visiting.discard(value.name)
+
+    found = values(index)
+    if found is None or len(found) > _MAX_TARGETS:
+        return None
+    return sorted(found)
+
+
+def _masked(mask: int) -> set[int] | None:
+    """Every value of ``x & mask``."""
+    bits = [1 << i for i in range(32) if mask >> i & 1]
+    if 1 << len(bits) > _MAX_TARGETS:
+        return None
+    found = {0}
+    for bit in bits:
+        found |= {value | bit for value in found}
+    return found
@@ -0,0 +1,260 @@
+"""Constant folding.
+
+Integer arithmetic, comparisons and extensions whose operands are all
+constants are replaced by a copy of the result, and a handful of identities
+(``x + 0``, ``x * 1``, ``x & 0``, ...) by a copy of the surviving operand or
+constant.  ``jnz`` on a constant becomes ``jmp``.  Copy propagation then
+forwards the results into their uses.
+
+Only integer classes are folded.  Float folding would have to reproduce the
+target's rounding and NaN payloads exactly, and WASM constants are rarely
+float arithmetic in practice.
+"""
+
+from __future__ import annotations
+
+from typing import TYPE_CHECKING, Any
+
+from qbepy.ir import (
+    BinaryOp,
+    Branch,
+    Comparison,
+    Conversion,
+    Copy,
+    IntConst,
+    Jump,
+    Phi,
+    Temporary,
+    UnaryOp,
+)
+
+from .ir import block_map, is_ssa, map_operands, to_signed
+
+if TYPE_CHECKING:
+    from qbepy import Function
+    from qbepy.ir import Block
+
+_BITS = {"w": 32, "l": 64}
+
+# ext ops: (source bits, signed)
+_EXTENSIONS = {
+    "extsb": (8, True),
+    "extub": (8, False),
+    "extsh": (16, True),
+    "extuh": (16, False),
+    "extsw": (32, True),
+    "extuw": (32, False),
+}
+
+# Comparison suffixes in the order QBE spells them: c<cond><class>
+_CONDITIONS = {
+    "eq": lambda a, b: a == b,
+    "ne": lambda a, b: a != b,
+    "slt": lambda a, b: a < b,
+    "sle": lambda a, b: a <= b,
+    "sgt": lambda a, b: a > b,
+    "sge": lambda a, b: a >= b,
+    "ult": lambda a, b: a < b,
+    "ule": lambda a, b: a <= b,
+    "ugt": lambda a, b: a > b,
+    "uge": lambda a, b: a >= b,
+}
+
+
+def fold_constants(func: Function) -> bool:
+    """Fold constant instructions and branches in ``func``.
+
+    Constants are propagated as they are found, so a whole chain of
+    dependent instructions folds in one run; blocks are swept until no more
+    temporaries turn out constant (loops can carry them backwards).  A
+    temporary with several definitions can't be bound to one constant, so
+    functions that aren't in SSA form are left alone.
+    """
+    if not is_ssa(func):
+        return False
+    consts: dict[str, IntConst] = {}
+    changed = False
+
+    def subst(value: Any) -> Any:
+        if isinstance(value, Temporary):
+            return consts.get(value.name, value)
+        return value
+
+    progress = True
+    while progress:
+        progress = False
+        for block in func.blocks:
+            for i, phi in enumerate(block.phis):
+                new = map_operands(phi, subst)
+                if new is not phi:
+                    block.phis[i] = new
+                    progress = True
+                values = {value for _label, value in new.incoming}
+                values.discard(new.result)
+                if len(values) == 1 and _record(consts, new, values.pop()):
+                    progress = True
+            for i, instr in enumerate(block.instructions):
+                new = map_operands(instr, subst)
+                folded = _fold(new)
+                if folded is not None:
+                    new = Copy(
+                        result=new.result, result_type=new.result_type, value=folded
+                    )
+                if new is not instr:
+                    block.instructions[i] = new
+                    progress = True
+                if isinstance(new, Copy) and _record(consts, new, new.value):
+                    progress = True
+            if block.terminator is not None:
+                new = map_operands(block.terminator, subst)
+                if new is not block.terminator:
+                    block.terminator = new
+                    progress = True
+        changed |= progress
+    return _fold_branches(func) or changed
+
+
+def wrap_const(value: IntConst, cls: str) -> IntConst:
+    """``value`` as the signed constant a ``cls`` temporary would hold."""
+    return IntConst(to_signed(value.value, _BITS[cls]))
+
+
+def _record(consts: dict[str, IntConst], instr: Any, value: Any) -> bool:
+    """Note that ``instr`` defines a known integer constant; True if new."""
+    cls = str(instr.result_type)
+    name = instr.result.name
+    if not isinstance(value, IntConst) or cls not in _BITS or name in consts:
+        return False
+    consts[name] = wrap_const(value, cls)
+    return True
+
+
+def _fold(instr: Any) -> Any:
+    """The value ``instr`` always produces, or None."""
+    if isinstance(instr, BinaryOp):
+        cls = str(instr.result_type)
+        if cls not in _BITS:
+            return None
+        left, right = instr.left, instr.right
+        if isinstance(left, IntConst) and isinstance(right, IntConst):
+            value = _binary(instr.op, cls, left.value, right.value)
+            return None if value is None else IntConst(value)
+        return _identity(instr.op, cls, left, right)
+    if isinstance(instr, Comparison):
+        cond, cls = instr.op[1:-1], instr.op[-1]
+        if cls not in _BITS or cond not in _CONDITIONS:
+            return None
+        left, right = instr.left, instr.right
+        if not (isinstance(left, IntConst) and isinstance(right, IntConst)):
+            return None
+        convert = _unsigned if cond[0] == "u" else to_signed
+        a = convert(left.value, _BITS[cls])
+        b = convert(right.value, _BITS[cls])
+        return IntConst(int(_CONDITIONS[cond](a, b)))
+    if isinstance(instr, (Conversion, UnaryOp)) and instr.op in _EXTENSIONS:
+        if not isinstance(instr.operand, IntConst):
+            return None
+        src_bits, signed = _EXTENSIONS[instr.op]
+        value = instr.operand.value
+        value = to_signed(value, src_bits) if signed else _unsigned(value, src_bits)
+        return IntConst(to_signed(value, _BITS[str(instr.result_type)]))
+    return None
+
+
+def _binary(op: str, cls: str, a: int, b: int) -> int | None:
+    bits = _BITS[cls]
+    a, b = to_signed(a, bits), to_signed(b, bits)
+    ua, ub = _unsigned(a, bits), _unsigned(b, bits)
+    if op == "add":
+        result = a + b
+    elif op == "sub":
+        result = a - b
+    elif op == "mul":
+        result = a * b
+    elif op == "and":
+        result = a & b
+    elif op == "or":
+        result = a | b
+    elif op == "xor":
+        result = a ^ b
+    elif op == "shl":
+        result = a << (ub % bits)
+    elif op == "sar":
+        result = a >> (ub % bits)
+    elif op == "shr":
+        result = ua >> (ub % bits)
+    elif op in ("div", "rem"):
+        # A zero divisor or INT_MIN / -1 traps at run time; leave it there
+        if b == 0 or (a == -(1 << (bits - 1)) and b == -1):
+            return None
+        quotient = abs(a) // abs(b)
+        if (a < 0) != (b < 0):
+            quotient = -quotient
+        result = quotient if op == "div" else a - quotient * b
+    elif op in ("udiv", "urem"):
+        if ub == 0:
+            return None
+        result = ua // ub if op == "udiv" else ua % ub
+    else:
+        return None
+    return to_signed(result, bits)
+
+
+def _identity(op: str, cls: str, left: Any, right: Any) -> Any:
+    """Simplify ``left op right`` when one side is a neutral/absorbing constant."""
+    if isinstance(right, IntConst):
+        value = to_signed(right.value, _BITS[cls])
+        if value == 0 and op in ("add", "sub", "or", "xor", "shl", "shr", "sar"):
+            return left
+        if value == 1 and op in ("mul", "div", "udiv"):
+            return left
+        if value == 0 and op in ("mul", "and"):
+            return IntConst(0)
+        if value == -1 and op == "and":
+            return left
+    if isinstance(left, IntConst):
+        value = to_signed(left.value, _BITS[cls])
+        if value == 0 and op in ("add", "or", "xor"):
+            return right
+        if value == 1 and op == "mul":
+            return right
+        if value == 0 and op in ("mul", "and", "shl", "shr", "sar"):
+            return IntConst(0)
+    return None
+
+
+def _fold_branches(func: Function) -> bool:
+    """Turn ``jnz`` on a constant, or to the same block twice, into ``jmp``."""
+    blocks = block_map(func)
+    changed = False
+    for block in func.blocks:
+        term = block.terminator
+        if not isinstance(term, Branch):
+            continue
+        if term.if_true.name == term.if_false.name:
+            block.terminator = Jump(target=term.if_true)
+            changed = True
+            continue
+        if not isinstance(term.condition, IntConst):
+            continue
+        # jnz tests the low word
+        taken, dropped = term.if_true, term.if_false
+        if _unsigned(term.condition.value, 32) == 0:
+            taken, dropped = dropped, taken
+        block.terminator = Jump(target=taken)
+        _drop_phi_edge(blocks[dropped.name], block.name)
+        changed = True
+    return changed
+
+
+def _drop_phi_edge(block: Block, pred: str) -> None:
+    """Remove the phi operands flowing into ``block`` from ``pred``."""
+    for i, phi in enumerate(block.phis):
+        incoming = [(lab, value) for lab, value in phi.incoming if lab.name != pred]
+        block.phis[i] = Phi(
+            result=phi.result, result_type=phi.result_type, incoming=incoming
+        )
+
+
+def _unsigned(value: int, bits: int) -> int:
+    return value & ((1 << bits) - 1)
@@ -0,0 +1,253 @@
+"""Constant folding and register promotion of WASM globals.
+
+Globals are QBE data symbols, and ``global.get``/``global.set`` compile to a
+load or store of the symbol wherever they occur.  Toolchains keep the shadow
+stack pointer in a mutable global (``__stack_pointer``), so nearly every
+non-leaf function reads it, adjusts it and writes it back in its prologue,
+and restores it in its epilogue.
+
+Immutable globals whose initializer is a constant
+(``ModuleFacts.constant_globals``) fold outright: their loads become copies
+of the value.
+
+A mutable global (``ModuleFacts.mutable_globals``) that a function accesses
+more than once is kept in a temporary instead.  The function loads it on
+entry and after each call, since the callee may read or set it; its loads
+become copies of the current value, and its stores only rebind the value.
+Memory is brought up to date where others can see it:
+
+- before each call (trap helpers included) and each ``ret``, when the value
+  was set since memory last held it;
+- at the end of a block whose successor is not known to be out of date
+  along all its other incoming edges, so that state is clean on entry.
+  Inside a loop without calls, an out-of-date successor is allowed, so a
+  global updated on every iteration is written once, after the loop.
+
+The global must be accessed only through such loads and stores, and the
+function must not call ``_setjmp`` (see ``ir.calls_setjmp``).
+"""
+
+from __future__ import annotations
+
+from typing import TYPE_CHECKING, Any
+
+from qbepy.ir import (
+    Call,
+    Copy,
+    D,
+    FloatConst,
+    Global,
+    IntConst,
+    L,
+    Load,
+    Phi,
+    Return,
+    S,
+    Store,
+    Temporary,
+    W,
+)
+
+from .ir import (
+    calls_setjmp,
+    fresh_prefix,
+    is_ssa,
+    operands,
+    predecessors,
+    reverse_postorder,
+    successors,
+)
+from .loops import natural_loops
+
+if TYPE_CHECKING:
+    from qbepy import Function
+    from qbepy.ir import Block
+
+    from . import ModuleFacts
+
+_TYPES = {"w": W, "l": L, "s": S, "d": D}
+
+
+def fold_constant_globals(functions: list[Function], facts: ModuleFacts) -> bool:
+    """Replace loads of immutable globals with their values."""
+    if not facts.constant_globals:
+        return False
+    changed = False
+    for func in functions:
+        for block in func.blocks:
+            for i, instr in enumerate(block.instructions):
+                if (
+                    isinstance(instr, Load)
+                    and isinstance(instr.address, Global)
+                    and instr.address.name in facts.constant_globals
+                ):
+                    value = facts.constant_globals[instr.address.name]
+                    const = (
+                        FloatConst(value)
+                        if isinstance(value, float)
+                        else IntConst(value)
+                    )
+                    block.instructions[i] = Copy(
+                        result=instr.result,
+                        result_type=instr.result_type,
+                        value=const,
+                    )
+                    changed = True
+    return changed
+
+
+def promote_globals(functions: list[Function], facts: ModuleFacts) -> bool:
+    """Keep mutable globals in temporaries within each function."""
+    if not facts.mutable_globals:
+        return False
+    changed = False
+    for func in functions:
+        if not func.blocks or any(b.terminator is None for b in func.blocks):
+            continue
+        if calls_setjmp(func) or not is_ssa(func):
+            continue
+        for name, kind in sorted(_promotable(func, facts.mutable_globals).items()):
+            _promote(func, name, kind, fresh_prefix(func, "gv"))
+            changed = True
+    return changed
+
+
+def _promotable(func: Function, mutable: frozenset[str]) -> dict[str, str]:
+    """The globals of ``func`` worth promoting, with their type letters."""
+    kinds: dict[str, set[str]] = {}
+    accesses: dict[str, int] = {}
+    escaped: set[str] = set()
+    for block in func.blocks:
+        for instr in [*block.phis, *block.instructions, block.terminator]:
+            address = None
+            kind = str(getattr(instr, "result_type", ""))
+            if isinstance(instr, Load) and instr.load_type == f"load{kind}":
+                address = instr.address
+            elif isinstance(instr, Store) and instr.store_type[5:] in _TYPES:
+                address, kind = instr.address, instr.store_type[5:]
+            if isinstance(address, Global) and address.name in mutable:
+                kinds.setdefault(address.name, set()).add(kind)
+                accesses[address.name] = accesses.get(address.name, 0) + 1
+            for value in operands(instr):
+                if isinstance(value, Global) and value is not address:
+                    escaped.add(value.name)
+    return {
+        name: next(iter(kind))
+        for name, kind in kinds.items()
+        if len(kind) == 1 and accesses[name] > 1 and name not in escaped
+    }
+
+
+def _promote(func: Function, name: str, kind: str, prefix: str) -> None:
+    blocks = {block.name: block for block in func.blocks}
+    order = reverse_postorder(func)
+    preds = {
+        label: [p for p in sources if p in blocks and p in order]
+        for label, sources in predecessors(func).items()
+    }
+    entry = order[0]
+    symbol = Global(name)
+    result_type = _TYPES[kind]
+    counter = iter(range(1 << 30))
+
+    def fresh() -> Temporary:
+        return Temporary(f"{prefix}.{next(counter)}")
+
+    # Whether memory may be out of date on entry to each block
+    in_loop = set()
+    for loop in natural_loops(func):
+        if not any(_calls(blocks[label]) for label in loop.blocks):
+            in_loop |= loop.blocks
+    dirty_in = dict.fromkeys(order, False)
+    dirty_out = dict.fromkeys(order, False)
+    changed = True
+    while changed:
+        changed = False
+        for label in order:
+            if label != entry:
+                incoming = [dirty_out[p] for p in preds[label]]
+                merge = any if label in in_loop else all
+                dirty_in[label] = merge(incoming)
+            out = _dirty_after(blocks[label], symbol, dirty_in[label])
+            if out != dirty_out[label]:
+                dirty_out[label] = out
+                changed = True
+
+    # Rewrite each block, with a phi where several values meet
+    phis = {label: fresh() for label in order[1:] if len(preds[label]) > 1}
+    value_out: dict[str, Any] = {}
+    for label in order:
+        block = blocks[label]
+        if label == entry:
+            value = fresh()
+            rewritten = [_load(value, kind, symbol)]
+        elif label in phis:
+            value = phis[label]
+            rewritten = []
+        else:
+            (pred,) = preds[label]
+            value, rewritten = value_out[pred], []
+        dirty = dirty_in[label]
+        for instr in block.instructions:
+            if isinstance(instr, Load) and instr.address == symbol:
+                rewritten.append(
+                    Copy(result=instr.result, result_type=result_type, value=value)
+                )
+            elif isinstance(instr, Store) and instr.address == symbol:
+                value, dirty = instr.value, True
+            elif isinstance(instr, Call):
+                if dirty:
+                    rewritten.append(_store(value, kind, symbol))
+                rewritten.append(instr)
+                dirty = False
+                if not _is_trap(instr):
+                    value = fresh()
+                    rewritten.append(_load(value, kind, symbol))
+            else:
+                rewritten.append(instr)
+        if dirty and (
+            isinstance(block.terminator, Return)
+            or any(not dirty_in[succ] for succ in successors(block))
+        ):
+            rewritten.append(_store(value, kind, symbol))
+        block.instructions = rewritten
+        value_out[label] = value
+
+    for label, result in phis.items():
+        incoming = [(blocks[p].label, value_out[p]) for p in preds[label]]
+        blocks[label].phis.append(
+            Phi(result=result, result_type=result_type, incoming=incoming)
+        )
+
+
+def _dirty_after(block: Block, symbol: Global, dirty: bool) -> bool:
+    """Whether memory may be out of date at the end of ``block``."""
+    for instr in block.instructions:
+        if isinstance(instr, Store) and instr.address == symbol:
+            dirty = True
+        elif isinstance(instr, Call):
+            dirty = False
+    return dirty
+
+
+def _calls(block: Block) -> bool:
+    return any(isinstance(instr, Call) for instr in block.instructions)
+
+
+def _is_trap(call: Call) -> bool:
+    return isinstance(call.target, Global) and call.target.name.startswith(
+        "__wasm_trap_"
+    )
+
+
+def _load(result: Temporary, kind: str, symbol: Global) -> Load:
+    return Load(
+        result=result,
+        result_type=_TYPES[kind],
+        address=symbol,
+        load_type=f"load{kind}",
+    )
+
+
+def _store(value: Any, kind: str, symbol: Global) -> Store:
+    return Store(store_type=f"store{kind}", value=value, address=symbol)
@@ -0,0 +1,298 @@
+"""Inlining of calls whose callee is available as IL.
+
+``inline_call`` splices a callee's blocks into the caller at one call site.
+Callee temporaries and labels are renamed apart under an ``inl<n>.`` prefix,
+parameters become copies of the arguments, and every ``ret`` jumps to a new
+block holding the rest of the calling block, where a phi collects the
+returned value.  The cleanup passes then fold the copies and merge the
+straight-line blocks back together.
+
+Working on the compiled IL rather than on the WASM instruction stream means
+the value stack and block nesting are already resolved: the callee's blocks
+are self-contained, and its results reach the caller as ordinary values.
+Multi-value results keep their out-parameter slots; the caller's ``alloc``
+and loads stay as they are and the inlined stores write into them.
+
+Two users:
+
+- ``inline_functions`` (``-O2``) inlines calls between the module's own
+  functions: small leaf functions (``_LEAF_SIZE``), and functions with a
+  single call site that nothing else references.  With a profile, any
+  callee up to ``_HOT_SIZE`` is inlined at a hot call site, and small leaf
+  functions are not copied into blocks that never ran.  Functions left
+  without callers or other references are removed.
+- ``inline_runtime_helpers`` (``--lto``) inlines the IL versions of hot
+  runtime helpers (``waq.runtime.il``).
+"""
+
+from __future__ import annotations
+
+from collections import Counter
+from typing import TYPE_CHECKING, Any
+
+from qbepy.ir import (
+    Alloc,
+    Call,
+    Copy,
+    Global,
+    Jump,
+    Label,
+    Phi,
+    Return,
+    Temporary,
+)
+
+from waq.runtime.il import RUNTIME_IL
+
+from .ir import calls_setjmp, clone_blocks, fresh_prefix, operands, rename_predecessor
+
+if TYPE_CHECKING:
+    from collections.abc import Iterator
+
+    from qbepy import Function
+    from qbepy.ir import Block
+
+    from . import ModuleFacts
+
+# Size limits, in phis + instructions + terminators.  Leaf functions up to
+# _LEAF_SIZE are getters and small math helpers whose body is about the size
+# of the call sequence; _HOT_SIZE allows for the call overhead saved at a hot
+# call site; a single-call-site function moves rather than being copied, so
+# only very large ones (register pressure) are left alone.  No caller grows
+# past _CALLER_SIZE through inlining.
+_LEAF_SIZE = 24
+_HOT_SIZE = 120
+_SINGLE_SITE_SIZE = 400
+_CALLER_SIZE = 4000
+
+
+def inline_functions(functions: list[Function], facts: ModuleFacts) -> bool:
+    """Inline calls between ``functions``; drop the ones no longer needed.
+
+    ``facts.roots`` are never removed.  Callers are visited bottom-up in the
+    call graph, so a callee has already absorbed its own callees when its
+    size is judged.
+    """
+    by_name = {func.name: func for func in functions}
+    callees = {func.name: list(_direct_calls(func, by_name)) for func in functions}
+    sites = Counter(name for names in callees.values() for name in names)
+    escaped = facts.roots | _address_taken(functions, by_name)
+    recursive = _recursive(callees)
+
+    def removable(callee: Function) -> bool:
+        return sites[callee.name] == 1 and callee.name not in escaped
+
+    def worth_inlining(
+        caller: Function, block: Block, callee: Function, room: int
+    ) -> bool:
+        if callee is caller or callee.name in recursive or not _inlinable(callee):
+            return False
+        size = _size(callee)
+        if size > room:
+            return False
+        if removable(callee):
+            return size <= _SINGLE_SITE_SIZE
+        profile = facts.profile[caller.name] if facts.profile is not None else None
+        if profile is not None and profile.calls:
+            count = profile.count(block.name)
+            if facts.profile.is_hot(count):
+                return size <= _HOT_SIZE
+            if count == 0:
+                return False
+        return size <= _LEAF_SIZE and _is_leaf(callee)
+
+    changed = False
+    inlined: set[str] = set()
+    for caller in _bottom_up(functions, callees):
+        if calls_setjmp(caller):
+            continue
+        room = _CALLER_SIZE - _size(caller)
+        i = 0
+        while i < len(caller.blocks):
+            block = caller.blocks[i]
+            for index, instr in enumerate(block.instructions):
+                callee = _direct_callee(instr, by_name)
+                if callee is not None and worth_inlining(caller, block, callee, room):
+                    room -= _size(callee)
+                    inline_call(caller, block, index, callee)
+                    inlined.add(callee.name)
+                    changed = True
+                    break
+            i += 1
+
+    # Leaf functions inlined at every call site are dead too
+    remaining = Counter(
+        name for func in functions for name in _direct_calls(func, by_name)
+    )
+    dead = {name for name in inlined if not remaining[name] and name not in escaped}
+    if dead:
+        functions[:] = [func for func in functions if func.name not in dead]
+    return changed
+
+
+def inline_runtime_helpers(func: Function) -> bool:
+    """Inline calls to the runtime helpers that have IL versions."""
+    changed = False
+    # Inlining appends the rest of a block as a new block, which this loop
+    # then reaches, so every call is visited once
+    i = 0
+    while i < len(func.blocks):
+        block = func.blocks[i]
+        for index, instr in enumerate(block.instructions):
+            if (
+                isinstance(instr, Call)
+                and isinstance(instr.target, Global)
+                and instr.target.name in RUNTIME_IL
+            ):
+                inline_call(func, block, index, RUNTIME_IL[instr.target.name]())
+                changed = True
+                break
+        i += 1
+    return changed
+
+
+def inline_call(func: Function, block: Block, index: int, callee: Function) -> None:
+    """Replace the call at ``block.instructions[index]`` with ``callee``'s body."""
+    call = block.instructions[index]
+    prefix = fresh_prefix(func, "inl")
+
+    # The rest of the block continues after the call
+    cont = func.add_block(prefix)
+    cont.instructions = block.instructions[index + 1 :]
+    cont.terminator = block.terminator
+    rename_predecessor(func, cont, block.name)
+
+    block.instructions = block.instructions[:index]
+    for (param_type, name), (_arg_type, value) in zip(
+        callee.params, call.args, strict=True
+    ):
+        block.instructions.append(
+            Copy(
+                result=Temporary(f"{prefix}.{name}"),
+                result_type=param_type,
+                value=value,
+            )
+        )
+    block.terminator = Jump(target=Label(f"{prefix}.{callee.blocks[0].name}"))
+
+    returned: list[tuple[Label, Any]] = []
+    clones = clone_blocks(func, callee, prefix)
+    for clone in clones:
+        if isinstance(clone.terminator, Return):
+            returned.append((clone.label, clone.terminator.value))
+            clone.terminator = Jump(target=cont.label)
+
+    if call.result is not None and returned:
+        cont.phis = [
+            Phi(result=call.result, result_type=call.result_type, incoming=returned)
+        ]
+
+    # Keep the layout readable: callee body, then the continuation, right
+    # after the calling block
+    moved = {clone.name for clone in clones} | {cont.name}
+    rest = [b for b in func.blocks if b.name not in moved]
+    at = rest.index(block) + 1
+    func.blocks[:] = [*rest[:at], *clones, cont, *rest[at:]]
+
+
+def _direct_callee(instr: Any, by_name: dict[str, Function]) -> Function | None:
+    if isinstance(instr, Call) and isinstance(instr.target, Global):
+        return by_name.get(instr.target.name)
+    return None
+
+
+def _direct_calls(func: Function, by_name: dict[str, Function]) -> Iterator[str]:
+    """Names of the module functions ``func`` calls, once per call site."""
+    for block in func.blocks:
+        for instr in block.instructions:
+            callee = _direct_callee(instr, by_name)
+            if callee is not None:
+                yield callee.name
+
+
+def _address_taken(functions: list[Function], by_name: dict[str, Function]) -> set[str]:
+    """Functions whose address is used other than as a call target."""
+    taken = set()
+    for func in functions:
+        for block in func.blocks:
+            for instr in [*block.phis, *block.instructions, block.terminator]:
+                if instr is None:
+                    continue
+                values = list(operands(instr))
+                if isinstance(instr, Call):
+                    values = values[1:]
+                taken.update(
+                    value.name
+                    for value in values
+                    if isinstance(value, Global) and value.name in by_name
+                )
+    return taken
+
+
+def _recursive(callees: dict[str, list[str]]) -> set[str]:
+    """Functions that can reach themselves through direct calls."""
+    recursive = set()
+    for start in callees:
+        seen: set[str] = set()
+        stack = list(callees[start])
+        while stack:
+            name = stack.pop()
+            if name == start:
+                recursive.add(start)
+                break
+            if name not in seen:
+                seen.add(name)
+                stack.extend(callees.get(name, ()))
+    return recursive
+
+
+def _bottom_up(
+    functions: list[Function], callees: dict[str, list[str]]
+) -> list[Function]:
+    """``functions`` with callees before their callers (cycles broken)."""
+    by_name = {func.name: func for func in functions}
+    order: list[Function] = []
+    visited: set[str] = set()
+    for root in functions:
+        if root.name in visited:
+            continue
+        visited.add(root.name)
+        stack = [(root.name, iter(callees[root.name]))]
+        while stack:
+            name, pending = stack[-1]
+            for callee in pending:
+                if callee not in visited:
+                    visited.add(callee)
+                    stack.append((callee, iter(callees[callee])))
+                    break
+            else:
+                stack.pop()
+                order.append(by_name[name])
+    return order
+
+
+def _size(func: Function) -> int:
+    return sum(len(b.phis) + len(b.instructions) + 1 for b in func.blocks)
+
+
+def _inlinable(func: Function) -> bool:
+    """Whether ``func``'s body can be spliced into another function.
+
+    An ``alloc`` outside the start block allocates on every execution, so
+    functions with stack slots (memory locals, multi-value call slots) keep
+    their own frame.
+    """
+    return not any(
+        isinstance(instr, Alloc) for b in func.blocks for instr in b.instructions
+    )
+
+
+def _is_leaf(func: Function) -> bool:
+    """Whether ``func`` calls nothing but the trap helpers."""
+    return all(
+        isinstance(instr.target, Global)
+        and instr.target.name.startswith("__wasm_trap_")
+        for b in func.blocks
+        for instr in b.instructions
+        if isinstance(instr, Call)
+    )
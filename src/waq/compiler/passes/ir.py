@@ -0,0 +1,398 @@
+"""Whole-function view of the IR built by the code generator.
+
+The code generator lowers each function to a graph of qbepy objects: blocks
+holding phis, instructions and a terminator, over typed SSA temporaries.
+Nothing is emitted until the whole module is compiled, so this graph doubles
+as the mid-level IR that optimization passes analyse and rewrite.
+
+This module gives passes a uniform way to walk that graph: control-flow
+edges, the values an instruction reads and defines, and operand rewriting.
+Instructions are treated as immutable; rewriting returns a new instruction
+that the caller puts back in place.
+"""
+
+from __future__ import annotations
+
+import dataclasses
+import re
+from typing import TYPE_CHECKING, Any
+
+from qbepy.ir import (
+    Alloc,
+    BinaryOp,
+    Branch,
+    Call,
+    Comparison,
+    Conversion,
+    Copy,
+    Global,
+    Jump,
+    Label,
+    Load,
+    Phi,
+    Return,
+    Store,
+    Temporary,
+    UnaryOp,
+)
+
+if TYPE_CHECKING:
+    from collections.abc import Callable, Iterator
+
+    from qbepy import Function
+    from qbepy.ir import Block
+
+# Operand fields read by each instruction class
+_OPERAND_FIELDS: dict[type, tuple[str, ...]] = {
+    Copy: ("value",),
+    BinaryOp: ("left", "right"),
+    Comparison: ("left", "right"),
+    UnaryOp: ("operand",),
+    Conversion: ("operand",),
+    Load: ("address",),
+    Store: ("value", "address"),
+    Alloc: ("size",),
+    Branch: ("condition",),
+    Return: ("value",),
+}
+
+# Integer division faults on a zero divisor (and on INT_MIN / -1), so an
+# unused quotient must still be computed where WASM would trap
+_TRAPPING_OPS = frozenset({"div", "rem", "udiv", "urem"})
+
+
+def successors(block: Block) -> list[str]:
+    """Labels of the blocks ``block`` can jump to."""
+    term = block.terminator
+    if isinstance(term, Jump):
+        return [term.target.name]
+    if isinstance(term, Branch):
+        return [term.if_true.name, term.if_false.name]
+    return []
+
+
+def predecessors(func: Function) -> dict[str, list[str]]:
+    """Map each block label to the labels of the blocks that jump to it."""
+    preds: dict[str, list[str]] = {block.name: [] for block in func.blocks}
+    for block in func.blocks:
+        for succ in successors(block):
+            preds[succ].append(block.name)
+    return preds
+
+
+def reachable(func: Function) -> set[str]:
+    """Labels of the blocks reachable from the entry block."""
+    if not func.blocks:
+        return set()
+    by_name = block_map(func)
+    seen = {func.blocks[0].name}
+    worklist = [func.blocks[0]]
+    while worklist:
+        for succ in successors(worklist.pop()):
+            if succ not in seen:
+                seen.add(succ)
+                worklist.append(by_name[succ])
+    return seen
+
+
+def reverse_postorder(func: Function) -> list[str]:
+    """Labels of the reachable blocks, each after its forward-edge predecessors."""
+    if not func.blocks:
+        return []
+    by_name = block_map(func)
+    entry = func.blocks[0].name
+    order: list[str] = []
+    seen = {entry}
+    stack = [(entry, iter(successors(by_name[entry])))]
+    while stack:
+        name, pending = stack[-1]
+        for succ in pending:
+            if succ not in seen:
+                seen.add(succ)
+                stack.append((succ, iter(successors(by_name[succ]))))
+                break
+        else:
+            stack.pop()
+            order.append(name)
+    order.reverse()
+    return order
+
+
+def immediate_dominators(func: Function) -> dict[str, str]:
+    """Map each reachable block label to its immediate dominator's.
+
+    The entry block maps to itself.  Cooper, Harvey and Kennedy's iterative
+    algorithm over the reverse postorder.
+    """
+    if not func.blocks:
+        return {}
+    entry = func.blocks[0].name
+    order = reverse_postorder(func)
+    position = {name: i for i, name in enumerate(order)}
+    preds = predecessors(func)
+
+    idom = {entry: entry}
+
+    def intersect(a: str, b: str) -> str:
+        while a != b:
+            while position[a] > position[b]:
+                a = idom[a]
+            while position[b] > position[a]:
+                b = idom[b]
+        return a
+
+    changed = True
+    while changed:
+        changed = False
+        for name in order[1:]:
+            done = [p for p in preds[name] if p in idom]
+            new = done[0]
+            for pred in done[1:]:
+                new = intersect(pred, new)
+            if idom.get(name) != new:
+                idom[name] = new
+                changed = True
+    return idom
+
+
+def dominates(idom: dict[str, str], a: str, b: str) -> bool:
+    """Whether block ``a`` dominates block ``b`` (see ``immediate_dominators``)."""
+    while b != a:
+        parent = idom[b]
+        if parent == b:
+            return False
+        b = parent
+    return True
+
+
+def block_map(func: Function) -> dict[str, Block]:
+    """Map each block label to its block."""
+    return {block.name: block for block in func.blocks}
+
+
+def retarget(block: Block, old: str, new: str) -> None:
+    """Redirect the edges from ``block`` to ``old`` towards ``new``."""
+    term = block.terminator
+    if isinstance(term, Jump) and term.target.name == old:
+        block.terminator = Jump(target=Label(new))
+    elif isinstance(term, Branch):
+        if_true = Label(new) if term.if_true.name == old else term.if_true
+        if_false = Label(new) if term.if_false.name == old else term.if_false
+        block.terminator = Branch(
+            condition=term.condition, if_true=if_true, if_false=if_false
+        )
+
+
+def rename_predecessor(func: Function, block: Block, old: str) -> None:
+    """Point the phis of ``block``'s successors at it instead of ``old``.
+
+    For use after moving the end of block ``old`` into ``block``.
+    """
+    targets = set(successors(block))
+    for target in func.blocks:
+        if target.name not in targets:
+            continue
+        target.phis = [
+            dataclasses.replace(
+                phi,
+                incoming=[
+                    (block.label if label.name == old else label, value)
+                    for label, value in phi.incoming
+                ],
+            )
+            for phi in target.phis
+        ]
+
+
+def defined(instr: Any) -> str | None:
+    """Name of the temporary an instruction defines, if any."""
+    result = getattr(instr, "result", None)
+    return result.name if isinstance(result, Temporary) else None
+
+
+def operands(instr: Any) -> Iterator[Any]:
+    """The values an instruction or terminator reads."""
+    if isinstance(instr, Phi):
+        for _label, value in instr.incoming:
+            yield value
+    elif isinstance(instr, Call):
+        yield instr.target
+        for _type, value in instr.args:
+            yield value
+    else:
+        for name in _OPERAND_FIELDS.get(type(instr), ()):
+            value = getattr(instr, name)
+            if value is not None:
+                yield value
+
+
+def uses(instr: Any) -> Iterator[str]:
+    """Names of the temporaries an instruction or terminator reads."""
+    for value in operands(instr):
+        if isinstance(value, Temporary):
+            yield value.name
+
+
+def map_operands(instr: Any, fn: Callable[[Any], Any]) -> Any:
+    """Return ``instr`` with every operand replaced by ``fn(operand)``.
+
+    ``instr`` itself is returned when nothing changes.
+    """
+    if isinstance(instr, Phi):
+        incoming = [(label, fn(value)) for label, value in instr.incoming]
+        if incoming == instr.incoming:
+            return instr
+        return dataclasses.replace(instr, incoming=incoming)
+    if isinstance(instr, Call):
+        target = fn(instr.target)
+        args = [(arg_type, fn(value)) for arg_type, value in instr.args]
+        if target == instr.target and args == instr.args:
+            return instr
+        return dataclasses.replace(instr, target=target, args=args)
+    changes = {}
+    for name in _OPERAND_FIELDS.get(type(instr), ()):
+        value = getattr(instr, name)
+        if value is not None and (new := fn(value)) != value:
+            changes[name] = new
+    return dataclasses.replace(instr, **changes) if changes else instr
+
+
+def rewrite_operands(func: Function, fn: Callable[[Any], Any]) -> None:
+    """Apply ``map_operands`` to every phi, instruction and terminator."""
+    for block in func.blocks:
+        block.phis = [map_operands(phi, fn) for phi in block.phis]
+        block.instructions = [map_operands(instr, fn) for instr in block.instructions]
+        if block.terminator is not None:
+            block.terminator = map_operands(block.terminator, fn)
+
+
+def clone_blocks(func: Function, source: Function, prefix: str) -> list[Block]:
+    """Append copies of ``source``'s blocks to ``func``.
+
+    Labels and temporaries (including ``source``'s parameters) are renamed
+    to ``<prefix>.<name>``.  Terminators are copied as they are, so the
+    caller decides what a cloned ``ret`` becomes.
+    """
+
+    def rename(value: Any) -> Any:
+        if isinstance(value, Temporary):
+            return Temporary(f"{prefix}.{value.name}")
+        return value
+
+    def relabel(label: Label) -> Label:
+        return Label(f"{prefix}.{label.name}")
+
+    def define(instr: Any) -> Any:
+        instr = map_operands(instr, rename)
+        if isinstance(getattr(instr, "result", None), Temporary):
+            return dataclasses.replace(instr, result=rename(instr.result))
+        return instr
+
+    clones = []
+    for block in source.blocks:
+        clone = func.add_block(f"{prefix}.{block.name}")
+        clone.phis = [
+            dataclasses.replace(
+                define(phi),
+                incoming=[
+                    (relabel(label), rename(value)) for label, value in phi.incoming
+                ],
+            )
+            for phi in block.phis
+        ]
+        clone.instructions = [define(instr) for instr in block.instructions]
+        term = block.terminator
+        if isinstance(term, Jump):
+            clone.terminator = Jump(target=relabel(term.target))
+        elif isinstance(term, Branch):
+            clone.terminator = Branch(
+                condition=rename(term.condition),
+                if_true=relabel(term.if_true),
+                if_false=relabel(term.if_false),
+            )
+        elif term is not None:
+            clone.terminator = map_operands(term, rename)
+        clones.append(clone)
+    return clones
+
+
+def has_side_effects(instr: Any) -> bool:
+    """Whether an instruction must run even if its result is unused.
+
+    Loads count: with bounds checks off, an out-of-bounds load traps through
+    the fault handler, and that trap is observable.  Loads from a data
+    symbol (``$__wasm_memory``, globals) cannot fault.
+    """
+    if isinstance(instr, Load):
+        return not isinstance(instr.address, Global)
+    if isinstance(instr, (Store, Call)):
+        return True
+    if isinstance(instr, BinaryOp):
+        return instr.op in _TRAPPING_OPS and not _is_float(instr.result_type)
+    return False
+
+
+def is_ssa(func: Function) -> bool:
+    """Whether every temporary of ``func`` has a single definition."""
+    names = [name for _type, name in func.params]
+    for block in func.blocks:
+        names += [phi.result.name for phi in block.phis]
+        names += [name for instr in block.instructions if (name := defined(instr))]
+    return len(names) == len(set(names))
+
+
+def calls_setjmp(func: Function) -> bool:
+    """Whether ``func`` arms an exception handler.
+
+    A catch resumes through ``longjmp``, which restores callee-saved
+    registers to their values at ``_setjmp`` time, so anything live across
+    the call has to stay in memory.  Passes that move values into
+    temporaries or across blocks (inlining, LICM, strength reduction,
+    global promotion) therefore leave such functions alone.
+    """
+    return any(
+        isinstance(instr, Call)
+        and isinstance(instr.target, Global)
+        and instr.target.name == "_setjmp"
+        for b in func.blocks
+        for instr in b.instructions
+    )
+
+
+def fresh_prefix(func: Function, stem: str) -> str:
+    """A name prefix ``<stem><n>`` not yet used by ``func``.
+
+    Passes that add blocks or temporaries name them ``<prefix>.<name>``;
+    ``n`` is one more than the highest already taken by a block, parameter
+    or temporary, so repeated runs never collide.
+    """
+    pattern = re.compile(rf"{re.escape(stem)}(\d+)(?:\.|$)")
+    names = [name for _type, name in func.params]
+    for block in func.blocks:
+        names.append(block.name)
+        names += [phi.result.name for phi in block.phis]
+        names += [name for instr in block.instructions if (name := defined(instr))]
+    used = [int(m.group(1)) for name in names if (m := pattern.match(name))]
+    return f"{stem}{max(used, default=0) + 1}"
+
+
+def to_signed(value: int, bits: int) -> int:
+    """The low ``bits`` of ``value``, read as a two's complement integer."""
+    value &= (1 << bits) - 1
+    return value - (1 << bits) if value >> (bits - 1) else value
+
+
+def temp_types(func: Function) -> dict[str, str]:
+    """Map each temporary to its QBE base type (``w``, ``l``, ``s``, ``d``)."""
+    types = {name: str(param_type) for param_type, name in func.params}
+    for block in func.blocks:
+        for instr in [*block.phis, *block.instructions]:
+            name = defined(instr)
+            if name is not None:
+                result_type = getattr(instr, "result_type", "l")
+                types[name] = str(result_type)
+    return types
+
+
+def _is_float(result_type: Any) -> bool:
+    return str(result_type) in ("s", "d")
@@ -0,0 +1,95 @@
+"""Profile-guided block layout.
+
+QBE emits blocks in IL order and only drops jumps to the next block, so the
+order chosen here decides which branches fall through.  With a profile,
+each function is laid out as chains along its hottest edges: starting at
+the entry block, each block is followed by its most frequent successor
+that is not placed yet; when a chain ends, the next unplaced block that
+ran (in the original order) starts another.  Blocks that never ran (trap
+paths, unused cases) go to the end of the function, out of the way of the
+code that runs.
+
+Counts come from the profile by block name.  Devirtualization counts the
+blocks it adds from the site's histogram; other blocks added by earlier
+passes (inlined bodies) take the count of the block before them, which is
+where those passes put them.
+"""
+
+from __future__ import annotations
+
+from typing import TYPE_CHECKING
+
+from qbepy.ir import Branch
+
+from .ir import block_map, successors
+
+if TYPE_CHECKING:
+    from qbepy import Function
+
+    from waq.compiler.profile import FunctionProfile
+
+    from . import ModuleFacts
+
+
+def lay_out_blocks(functions: list[Function], facts: ModuleFacts) -> bool:
+    """Order the blocks of the profiled ``functions`` along their hot paths."""
+    if facts.profile is None:
+        return False
+    changed = False
+    for func in functions:
+        profile = facts.profile[func.name]
+        # A block without a terminator falls through to the next one
+        if (
+            profile is not None
+            and profile.calls
+            and all(b.terminator is not None for b in func.blocks)
+        ):
+            changed |= _lay_out(func, profile)
+    return changed
+
+
+def _lay_out(func: Function, profile: FunctionProfile) -> bool:
+    counts = _block_counts(func, profile)
+    blocks = block_map(func)
+    order = {b.name: i for i, b in enumerate(func.blocks)}
+
+    def weight(block: str, succ: str) -> int:
+        """How often control went from ``block`` to ``succ``."""
+        term = blocks[block].terminator
+        taken = profile.branches.get(block)
+        if isinstance(term, Branch) and taken is not None:
+            if succ == term.if_true.name:
+                return taken
+            return counts[block] - taken
+        return counts[succ]
+
+    layout = []
+    placed: set[str] = set()
+    pending = iter(func.blocks)
+    current: str | None = func.blocks[0].name
+    while current is not None:
+        layout.append(blocks[current])
+        placed.add(current)
+        hot = [s for s in successors(blocks[current]) if s not in placed and counts[s]]
+        if hot:
+            current = max(hot, key=lambda s, b=current: (weight(b, s), -order[s]))
+            continue
+        current = next(
+            (b.name for b in pending if b.name not in placed and counts[b.name]),
+            None,
+        )
+    layout += [b for b in func.blocks if b.name not in placed]
+
+    if [b.name for b in layout] == [b.name for b in func.blocks]:
+        return False
+    func.blocks[:] = layout
+    return True
+
+
+def _block_counts(func: Function, profile: FunctionProfile) -> dict[str, int]:
+    counts = {}
+    previous = profile.calls
+    for block in func.blocks:
+        count = profile.count(block.name)
+        counts[block.name] = previous = previous if count is None else count
+    return counts
@@ -0,0 +1,146 @@
+"""Loop-invariant code motion.
+
+Lowering recomputes everything a WASM instruction needs where it occurs, so
+a loop reloads ``$__wasm_memory`` (and ``$__wasm_memory_size`` with bounds
+checks) for every access, reloads globals, and redoes address arithmetic
+on values that do not change between iterations.  This pass moves such
+instructions into the loop's preheader, where they run once, and merges
+the hoisted instructions that compute the same value.
+
+Loops are the natural loops of the IL (``passes.loops``), not the WASM
+``loop`` frames, so loops that come from inlined callees are covered too.
+Inner loops are done first, and an instruction hoisted into an inner
+preheader can move on out of the enclosing loop.
+
+An instruction is invariant when every temporary it reads is defined
+outside the loop or by an invariant instruction.  Only instructions that
+cannot fault are hoisted, since the loop body may not have run them:
+
+- arithmetic, comparisons and conversions, except integer division;
+- loads from a data symbol (``$__wasm_memory``, globals, table pointers),
+  when the loop contains no store to that symbol and no call, since the
+  callee may grow memory or set globals.  Calls to the trap helpers do not
+  return and do not count.
+
+Functions that call ``_setjmp`` are skipped (see ``ir.calls_setjmp``).
+"""
+
+from __future__ import annotations
+
+import dataclasses
+from typing import TYPE_CHECKING, Any
+
+from qbepy.ir import (
+    BinaryOp,
+    Call,
+    Comparison,
+    Conversion,
+    Copy,
+    Global,
+    Load,
+    Store,
+    UnaryOp,
+)
+
+from .ir import calls_setjmp, defined, fresh_prefix, has_side_effects, is_ssa, uses
+from .loops import ensure_preheader, natural_loops
+
+if TYPE_CHECKING:
+    from qbepy import Function
+
+_PURE = (BinaryOp, Comparison, Conversion, UnaryOp, Copy)
+
+
+def hoist_loop_invariants(func: Function) -> bool:
+    """Move loop-invariant instructions of ``func`` into loop preheaders."""
+    if not func.blocks or any(b.terminator is None for b in func.blocks):
+        return False
+    if calls_setjmp(func) or not is_ssa(func):
+        return False
+    loops = natural_loops(func)
+    changed = False
+    for loop in loops:
+        invariant = _invariants(func, loop.blocks)
+        if not invariant:
+            continue
+        preheader = ensure_preheader(func, loop, loops, fresh_prefix(func, "licm"))
+        moved = {id(instr) for instr in invariant}
+        for block in func.blocks:
+            if block.name in loop.blocks:
+                block.instructions = [
+                    instr for instr in block.instructions if id(instr) not in moved
+                ]
+        preheader.instructions += _merge_duplicates(invariant)
+        changed = True
+    return changed
+
+
+def _merge_duplicates(instructions: list[Any]) -> list[Any]:
+    """``instructions`` with repeats of an earlier computation made copies.
+
+    Lowering loads ``$__wasm_memory`` once per access; hoisted, the loads
+    sit side by side and one is enough.
+    """
+    merged: list[Any] = []
+    seen: list[tuple[Any, Any]] = []  # (instruction without result, result)
+    for instr in instructions:
+        key = dataclasses.replace(instr, result=None)
+        same = next((result for other, result in seen if other == key), None)
+        if same is None:
+            seen.append((key, instr.result))
+            merged.append(instr)
+        else:
+            merged.append(
+                Copy(result=instr.result, result_type=instr.result_type, value=same)
+            )
+    return merged
+
+
+def _invariants(func: Function, body: set[str]) -> list[Any]:
+    """The instructions of the loop ``body`` to hoist, in dependency order."""
+    blocks = [b for b in func.blocks if b.name in body]
+    variant = set()
+    stored: set[str] = set()
+    calls = False
+    for block in blocks:
+        variant.update(phi.result.name for phi in block.phis)
+        for instr in block.instructions:
+            name = defined(instr)
+            if name is not None:
+                variant.add(name)
+            if isinstance(instr, Store) and isinstance(instr.address, Global):
+                stored.add(instr.address.name)
+            elif isinstance(instr, Call) and not _is_trap(instr):
+                calls = True
+
+    def hoistable(instr: Any) -> bool:
+        if isinstance(instr, Load):
+            return (
+                not calls
+                and isinstance(instr.address, Global)
+                and instr.address.name not in stored
+            )
+        return isinstance(instr, _PURE) and not has_side_effects(instr)
+
+    invariant = []
+    changed = True
+    while changed:
+        changed = False
+        for block in blocks:
+            for instr in block.instructions:
+                name = defined(instr)
+                if (
+                    name in variant
+                    and hoistable(instr)
+                    and not any(used in variant for used in uses(instr))
+                ):
+                    variant.discard(name)
+                    invariant.append(instr)
+                    changed = True
+    return invariant
+
+
+def _is_trap(call: Call) -> bool:
+    return isinstance(call.target, Global) and call.target.name.startswith(
+        "__wasm_trap_"
+    )
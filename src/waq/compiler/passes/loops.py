@@ -0,0 +1,103 @@
+"""Natural loops of a function's IL, for the loop passes.
+
+A natural loop is the set of blocks that can reach a back edge (an edge to
+a block that dominates its source) without going through the target, the
+loop header.  Back edges to the same header make one loop.  Loops nest or
+are disjoint; ``natural_loops`` lists inner loops before the loops that
+contain them.
+"""
+
+from __future__ import annotations
+
+from dataclasses import dataclass
+from typing import TYPE_CHECKING
+
+from qbepy.ir import Jump, Label, Phi, Temporary
+
+from .ir import (
+    block_map,
+    dominates,
+    immediate_dominators,
+    predecessors,
+    retarget,
+)
+
+if TYPE_CHECKING:
+    from qbepy import Function
+    from qbepy.ir import Block
+
+
+@dataclass(slots=True)
+class Loop:
+    """A natural loop: its header, its blocks and the sources of its back edges."""
+
+    header: str
+    blocks: set[str]
+    latches: list[str]
+
+
+def natural_loops(func: Function) -> list[Loop]:
+    """The natural loops of ``func``, innermost first.
+
+    Loops headed by the entry block are left out: there is no room for a
+    preheader in front of it.
+    """
+    idom = immediate_dominators(func)
+    preds = predecessors(func)
+    entry = func.blocks[0].name
+    loops: dict[str, Loop] = {}
+    for name in idom:
+        for pred in preds[name]:
+            if pred not in idom or name == entry or not dominates(idom, name, pred):
+                continue
+            loop = loops.setdefault(name, Loop(name, {name}, []))
+            loop.latches.append(pred)
+            stack = [pred]
+            while stack:
+                block = stack.pop()
+                if block not in loop.blocks and block in idom:
+                    loop.blocks.add(block)
+                    stack.extend(preds[block])
+    return sorted(loops.values(), key=lambda loop: len(loop.blocks))
+
+
+def ensure_preheader(
+    func: Function, loop: Loop, loops: list[Loop], name: str
+) -> Block:
+    """The block that enters ``loop``, added as ``name`` if there is none.
+
+    A preheader is the only predecessor of the header outside the loop,
+    and only jumps to it.  An added one takes over the entering values of
+    the header's phis and becomes part of the ``loops`` around ``loop``.
+    """
+    blocks = block_map(func)
+    outside = [p for p in predecessors(func)[loop.header] if p not in loop.blocks]
+    if len(outside) == 1 and isinstance(blocks[outside[0]].terminator, Jump):
+        return blocks[outside[0]]
+
+    preheader = func.add_block(name)
+    preheader.terminator = Jump(target=Label(loop.header))
+    for pred in outside:
+        retarget(blocks[pred], loop.header, name)
+    header = blocks[loop.header]
+    for i, phi in enumerate(header.phis):
+        entering = [(label, v) for label, v in phi.incoming if label.name in outside]
+        staying = [(label, v) for label, v in phi.incoming if label.name not in outside]
+        if len(entering) == 1:
+            value = entering[0][1]
+        else:
+            value = Temporary(f"{name}.{phi.result.name}")
+            preheader.phis.append(
+                Phi(result=value, result_type=phi.result_type, incoming=entering)
+            )
+        header.phis[i] = Phi(
+            result=phi.result,
+            result_type=phi.result_type,
+            incoming=[(preheader.label, value), *staying],
+        )
+    func.blocks.remove(preheader)
+    func.blocks.insert(func.blocks.index(header), preheader)
+    for other in loops:
+        if other is not loop and loop.header in other.blocks:
+            other.blocks.add(name)
+    return preheader
@@ -0,0 +1,500 @@
+"""Strength reduction of address arithmetic in loops.
+
+A WASM access ``a[i]`` in a loop lowers to ``base + extuw(i * 4 + off)``:
+a multiply (or shift), adds and a 32-to-64-bit extension on every
+iteration.  This pass finds the basic induction variables of each natural
+loop (``passes.loops``), header phis that the single back edge advances by
+a constant step, and the 32-bit affine expressions ``scale * iv + offset``
+(``+ inv`` for one loop-invariant temporary) built from them with
+``add``, ``sub``, ``mul`` and ``shl`` by constants.  Two rewrites follow:
+
+- An affine operand of ``extuw`` with a scale other than 1 becomes a
+  derived induction variable: a new header phi advanced by
+  ``scale * step`` each iteration, so the multiply and adds leave the loop.
+  Arithmetic modulo 2**32 makes this exact whatever the values.
+- ``base + extuw(e)``, with an invariant base and affine ``e`` without
+  ``inv``, becomes a 64-bit pointer advanced by ``scale * step``, which
+  also drops the extension.  That is only exact while ``e`` does not wrap
+  around 2**32, so the range of the induction variable must be known: a
+  constant start, and a test that every iteration passes (a block that
+  dominates the back edge) comparing it with a constant bound, such that
+  it cannot wrap either.
+
+Accesses with the same scale share one derived variable or pointer, and
+the others add the difference in offsets.  Functions that call ``_setjmp``
+are skipped (see ``ir.calls_setjmp``).
+"""
+
+from __future__ import annotations
+
+import re
+from dataclasses import dataclass, replace
+from typing import TYPE_CHECKING, Any
+
+from qbepy.ir import (
+    BinaryOp,
+    Branch,
+    Comparison,
+    Conversion,
+    Copy,
+    IntConst,
+    L,
+    Phi,
+    Temporary,
+    W,
+)
+
+from .fold import wrap_const
+from .ir import (
+    block_map,
+    calls_setjmp,
+    defined,
+    dominates,
+    fresh_prefix,
+    immediate_dominators,
+    is_ssa,
+    successors,
+    to_signed,
+)
+from .loops import Loop, ensure_preheader, natural_loops
+
+if TYPE_CHECKING:
+    from qbepy import Function
+    from qbepy.ir import Block
+
+_MASK32 = 0xFFFFFFFF
+
+# Affine terms past this size come from code that overflows anyway
+_MAX_TERM = 1 << 40
+
+# Operand order swapped: a < b is b > a
+_MIRRORED = {
+    "slt": "sgt",
+    "sle": "sge",
+    "sgt": "slt",
+    "sge": "sle",
+    "ult": "ugt",
+    "ule": "uge",
+    "ugt": "ult",
+    "uge": "ule",
+    "eq": "eq",
+    "ne": "ne",
+}
+
+# Condition negated, for a test that leaves the loop when it holds
+_NEGATED = {
+    "slt": "sge",
+    "sle": "sgt",
+    "sgt": "sle",
+    "sge": "slt",
+    "ult": "uge",
+    "ule": "ugt",
+    "ugt": "ule",
+    "uge": "ult",
+    "eq": "ne",
+    "ne": "eq",
+}
+
+
+@dataclass(frozen=True, slots=True)
+class _Affine:
+    """``scale * iv + offset (+ invariant)`` in 32-bit arithmetic."""
+
+    iv: str
+    scale: int
+    offset: int
+    invariant: Temporary | None = None
+
+
+def reduce_strength(func: Function) -> bool:
+    """Turn affine address arithmetic in ``func``'s loops into increments."""
+    if not func.blocks or any(b.terminator is None for b in func.blocks):
+        return False
+    if calls_setjmp(func) or not is_ssa(func):
+        return False
+    idom = immediate_dominators(func)
+    loops = natural_loops(func)
+    changed = False
+    for loop in loops:
+        if len(loop.latches) == 1:
+            changed |= _reduce_loop(func, loop, loops, idom)
+    return changed
+
+
+def _reduce_loop(
+    func: Function, loop: Loop, loops: list[Loop], idom: dict[str, str]
+) -> bool:
+    blocks = block_map(func)
+    header = blocks[loop.header]
+    latch = blocks[loop.latches[0]]
+    body = [b for b in func.blocks if b.name in loop.blocks]
+    defs: dict[str, Any] = {}
+    for block in body:
+        for phi in block.phis:
+            defs[phi.result.name] = phi
+        for instr in block.instructions:
+            if (name := defined(instr)) is not None:
+                defs[name] = instr
+
+    # Basic induction variables: name -> (start, step)
+    ivs: dict[str, tuple[Any, int]] = {}
+    for phi in header.phis:
+        entering = [v for label, v in phi.incoming if label.name not in loop.blocks]
+        back = [v for label, v in phi.incoming if label.name == latch.name]
+        if (
+            str(phi.result_type) != "w"
+            or not entering
+            or any(v != entering[0] for v in entering)
+            or len(back) != 1
+        ):
+            continue
+        step = _step(defs.get(getattr(back[0], "name", None)), phi.result.name)
+        if step is not None:
+            ivs[phi.result.name] = (entering[0], step)
+    if not ivs:
+        return False
+
+    affine = _affine_forms(defs, ivs)
+    pointers: dict[tuple, list[tuple[Block, int, _Affine]]] = {}
+    offsets: dict[tuple, list[tuple[Block, int, _Affine]]] = {}
+    reduced: set[str] = set()
+    ranges: dict[str, tuple[int, int] | None] = {}
+    for block in body:
+        for at, instr in enumerate(block.instructions):
+            form = _pointer_form(instr, defs, affine)
+            if form is None:
+                continue
+            base, extended, form = form
+            if form.iv not in ranges:
+                ranges[form.iv] = _iv_range(loop, form.iv, ivs, defs, blocks, idom)
+            if _fits(form, ranges[form.iv]):
+                key = (base.name, form.iv, form.scale)
+                pointers.setdefault(key, []).append((block, at, form))
+                reduced.add(extended)
+    extended = {
+        instr.operand.name
+        for block in body
+        for instr in block.instructions
+        if isinstance(instr, Conversion)
+        and instr.op == "extuw"
+        and instr.result.name not in reduced
+        and isinstance(instr.operand, Temporary)
+    }
+    for block in body:
+        for at, instr in enumerate(block.instructions):
+            form = affine.get(defined(instr))
+            if form is not None and form.scale != 1 and instr.result.name in extended:
+                key = (form.iv, form.scale, form.invariant)
+                offsets.setdefault(key, []).append((block, at, form))
+    if not pointers and not offsets:
+        return False
+
+    prefix = fresh_prefix(func, "iv")
+    preheader = ensure_preheader(func, loop, loops, prefix)
+    count = 0
+    for (base, iv, scale), sites in pointers.items():
+        start, step = ivs[iv]
+        first = sites[0][2].offset
+        name = f"{prefix}.p{count}"
+        count += 1
+        initial = Temporary(f"{name}.0")
+        preheader.instructions.append(
+            BinaryOp(
+                result=initial,
+                result_type=L,
+                op="add",
+                left=Temporary(base),
+                # Exact: the range check covers the first iteration
+                right=IntConst((scale * start.value + first) & _MASK32),
+            )
+        )
+        _add_induction(header, latch, preheader, name, L, initial, scale * step)
+        for block, at, form in sites:
+            block.instructions[at] = _offset_from(
+                block.instructions[at].result, L, Temporary(name), form.offset - first
+            )
+    for (iv, scale, invariant), sites in offsets.items():
+        start, step = ivs[iv]
+        first = sites[0][2].offset
+        name = f"{prefix}.e{count}"
+        count += 1
+        initial = _initial_offset(preheader, name, start, scale, first, invariant)
+        _add_induction(header, latch, preheader, name, W, initial, scale * step)
+        for block, at, form in sites:
+            block.instructions[at] = _offset_from(
+                block.instructions[at].result, W, Temporary(name), form.offset - first
+            )
+    return True
+
+
+def _step(instr: Any, iv: str) -> int | None:
+    """The constant ``instr`` adds to ``iv``, if it is ``iv + c`` or ``iv - c``."""
+    if not isinstance(instr, BinaryOp) or instr.op not in ("add", "sub"):
+        return None
+    left, right = instr.left, instr.right
+    if instr.op == "add" and isinstance(left, IntConst):
+        left, right = right, left
+    if not (
+        isinstance(left, Temporary) and left.name == iv and isinstance(right, IntConst)
+    ):
+        return None
+    step = to_signed(right.value, 32)
+    step = -step if instr.op == "sub" else step
+    return step or None
+
+
+def _affine_forms(
+    defs: dict[str, Any], ivs: dict[str, tuple[Any, int]]
+) -> dict[str, _Affine]:
+    """The loop temporaries that are affine in an induction variable."""
+    forms: dict[str, _Affine | None] = {}
+
+    def form(value: Any) -> _Affine | None:
+        if not isinstance(value, Temporary) or value.name not in defs:
+            return None
+        name = value.name
+        if name in ivs:
+            return _Affine(name, 1, 0)
+        if name in forms:
+            return forms[name]
+        forms[name] = None  # Cycles through phis are not affine
+        forms[name] = _form_of(defs[name], form, defs)
+        return forms[name]
+
+    for name in defs:
+        form(Temporary(name))
+    return {name: f for name, f in forms.items() if f is not None} | {
+        name: _Affine(name, 1, 0) for name in ivs
+    }
+
+
+def _form_of(instr: Any, form: Any, defs: dict[str, Any]) -> _Affine | None:
+    if isinstance(instr, Copy):
+        return form(instr.value)
+    if not isinstance(instr, BinaryOp) or str(instr.result_type) != "w":
+        return None
+    left, right = instr.left, instr.right
+    if instr.op in ("add", "mul") and form(left) is None:
+        left, right = right, left
+    inner = form(left)
+    if inner is None:
+        return None
+    if isinstance(right, IntConst):
+        k = to_signed(right.value, 32)
+        if instr.op == "add":
+            result = replace(inner, offset=inner.offset + k)
+        elif instr.op == "sub":
+            result = replace(inner, offset=inner.offset - k)
+        elif instr.op in ("mul", "shl") and inner.invariant is None:
+            factor = k if instr.op == "mul" else 1 << (k & 31)
+            result = replace(
+                inner, scale=inner.scale * factor, offset=inner.offset * factor
+            )
+        else:
+            return None
+    elif (
+        instr.op == "add"
+        and isinstance(right, Temporary)
+        and right.name not in defs
+        and inner.invariant is None
+    ):
+        result = replace(inner, invariant=right)
+    else:
+        return None
+    if abs(result.scale) > _MAX_TERM or abs(result.offset) > _MAX_TERM:
+        return None
+    return result
+
+
+def _pointer_form(
+    instr: Any, defs: dict[str, Any], affine: dict[str, _Affine]
+) -> tuple[Temporary, str, _Affine] | None:
+    """(base, extension, form) for ``base + extuw(e)`` with affine ``e``."""
+    if not (
+        isinstance(instr, BinaryOp)
+        and instr.op == "add"
+        and str(instr.result_type) == "l"
+    ):
+        return None
+    for base, offset in ((instr.left, instr.right), (instr.right, instr.left)):
+        if not (
+            isinstance(base, Temporary)
+            and base.name not in defs
+            and isinstance(offset, Temporary)
+        ):
+            continue
+        extension = defs.get(offset.name)
+        if (
+            isinstance(extension, Conversion)
+            and extension.op == "extuw"
+            and isinstance(extension.operand, Temporary)
+        ):
+            form = affine.get(extension.operand.name)
+            if form is not None and form.invariant is None:
+                return base, offset.name, form
+    return None
+
+
+def _iv_range(
+    loop: Loop,
+    iv: str,
+    ivs: dict[str, tuple[Any, int]],
+    defs: dict[str, Any],
+    blocks: dict[str, Block],
+    idom: dict[str, str],
+) -> tuple[int, int] | None:
+    """Exact bounds of ``iv`` inside the loop, if a loop test implies them."""
+    start, step = ivs[iv]
+    if not isinstance(start, IntConst):
+        return None
+    latch = loop.latches[0]
+    for name in loop.blocks:
+        term = blocks[name].terminator
+        if not isinstance(term, Branch) or not dominates(idom, name, latch):
+            continue
+        inside = [s in loop.blocks for s in successors(blocks[name])]
+        test = defs.get(getattr(term.condition, "name", None))
+        if inside.count(True) != 1 or not isinstance(test, Comparison):
+            continue
+        bounds = _test_bounds(test, iv, defs, start, step, stays=inside[0])
+        if bounds is not None:
+            return bounds
+    return None
+
+
+def _test_bounds(
+    test: Comparison,
+    iv: str,
+    defs: dict[str, Any],
+    start: IntConst,
+    step: int,
+    *,
+    stays: bool,
+) -> tuple[int, int] | None:
+    """Bounds of ``iv`` if the loop only goes on while ``test`` is ``stays``."""
+    match = re.fullmatch(r"c(s?[lg][te]|u[lg][te]|eq|ne)w", test.op)
+    if match is None:
+        return None
+    op = match.group(1)
+    left, right = test.left, test.right
+    if isinstance(left, IntConst):
+        left, right, op = right, left, _MIRRORED[op]
+    if not isinstance(right, IntConst) or not isinstance(left, Temporary):
+        return None
+    # The value tested is the variable (shift 0) or its next value
+    if left.name == iv:
+        shift = step
+    elif _step(defs.get(left.name), iv) == step:
+        shift = 0
+    else:
+        return None
+    if not stays:
+        op = _NEGATED[op]
+
+    signed = not op.startswith("u")
+    low, high = (-(1 << 31), (1 << 31) - 1) if signed else (0, _MASK32)
+    first = to_signed(start.value, 32) if signed else start.value & _MASK32
+    bound = to_signed(right.value, 32) if signed else right.value & _MASK32
+    kind = op.lstrip("su")
+    if kind in ("lt", "le") and step > 0:
+        hi = max(first, (bound - 1 if kind == "lt" else bound) + shift)
+        lo = first
+    elif kind in ("gt", "ge") and step < 0:
+        lo = min(first, (bound + 1 if kind == "gt" else bound) + shift)
+        hi = first
+    elif kind == "ne" and (bound - first) % step == 0 and (bound - first) * step >= 0:
+        # Runs until the variable hits the bound exactly
+        if shift == 0 and bound == first:
+            return None
+        lo, hi = sorted((first, bound - step + shift))
+    else:
+        return None
+    if lo + min(step, 0) < low or hi + max(step, 0) > high:
+        return None
+    return lo, hi
+
+
+def _fits(form: _Affine, bounds: tuple[int, int] | None) -> bool:
+    """Whether ``form`` stays within 0 .. 2**32 - 1 for the variable in ``bounds``."""
+    if bounds is None:
+        return False
+    ends = [form.scale * bound + form.offset for bound in bounds]
+    return min(ends) >= 0 and max(ends) <= _MASK32
+
+
+def _initial_offset(
+    preheader: Block,
+    name: str,
+    start: Any,
+    scale: int,
+    offset: int,
+    invariant: Temporary | None,
+) -> Any:
+    """Emit ``scale * start + offset (+ invariant)`` into the preheader."""
+    scaled = Temporary(f"{name}.s")
+    value = Temporary(f"{name}.0")
+    preheader.instructions += [
+        BinaryOp(
+            result=scaled,
+            result_type=W,
+            op="mul",
+            left=start,
+            right=wrap_const(IntConst(scale), "w"),
+        ),
+        BinaryOp(
+            result=value,
+            result_type=W,
+            op="add",
+            left=scaled,
+            right=wrap_const(IntConst(offset), "w"),
+        ),
+    ]
+    if invariant is None:
+        return value
+    total = Temporary(f"{name}.i")
+    preheader.instructions.append(
+        BinaryOp(result=total, result_type=W, op="add", left=value, right=invariant)
+    )
+    return total
+
+
+def _add_induction(
+    header: Block,
+    latch: Block,
+    preheader: Block,
+    name: str,
+    cls: Any,
+    initial: Any,
+    step: int,
+) -> None:
+    """Add the induction variable ``name``: ``initial``, then ``+= step``."""
+    following = Temporary(f"{name}.next")
+    header.phis.append(
+        Phi(
+            result=Temporary(name),
+            result_type=cls,
+            incoming=[(preheader.label, initial), (latch.label, following)],
+        )
+    )
+    latch.instructions.append(
+        BinaryOp(
+            result=following,
+            result_type=cls,
+            op="add",
+            left=Temporary(name),
+            right=wrap_const(IntConst(step), str(cls)),
+        )
+    )
+
+
+def _offset_from(result: Temporary, cls: Any, base: Temporary, delta: int) -> Any:
+    """``result = base + delta``, as a copy when ``delta`` is 0."""
+    if delta == 0:
+        return Copy(result=result, result_type=cls, value=base)
+    return BinaryOp(
+        result=result,
+        result_type=cls,
+        op="add",
+        left=base,
+        right=wrap_const(IntConst(delta), str(cls)),
+    )
@@ -0,0 +1,282 @@
+"""Profile-guided optimization: instrumentation and ``.waqprof`` profiles.
+
+PGO takes two compilations of the same module::
+
+    waq --instrument=pgo --emit exe app.wasm -o app    # counts on exit
+    ./app                                              # writes default.waqprof
+    waq --profile-use default.waqprof -O2 app.wasm     # optimized rebuild
+
+Both builds refer to the IL as ``_compile_function`` produced it, before any
+pass runs, so a profile taken at one ``-O`` level applies at another.  The
+instrumented build adds, to every function:
+
+- a counter at the start of every block (the entry block's doubles as the
+  function's call count);
+- for each ``jnz``, a counter of the times it took its first target;
+- after each ``call_indirect``, a histogram of the table indices called
+  (``__wasm_prof_icall``), keyed by the site's ``call_indirect_ok`` block.
+
+Counters live in ``$__wasm_prof_counters`` (one 64-bit word each, an
+indirect call site takes ``_SITE_SLOTS``), described by one tab-separated
+line each in ``$__wasm_prof_names``.  ``__wasm_memory_init`` registers them
+with the runtime, which writes the profile at exit to ``$WAQ_PROFILE_FILE``
+or ``default.waqprof``::
+
+    waqprof 1
+    f	<function>	<checksum>	<entry block>	<calls>
+    b	<function>	<block>	<count>
+    e	<function>	<block>	<count of first-target jumps>
+    i	<function>	<block>	<table index>	<calls>
+
+A function's checksum covers its block names and sizes; a function whose
+IL changed since the profile was taken is treated as unprofiled.
+"""
+
+from __future__ import annotations
+
+import copy
+import zlib
+from dataclasses import dataclass, field
+from typing import TYPE_CHECKING, Any
+
+from qbepy.ir import (
+    BinaryOp,
+    Branch,
+    Call,
+    Comparison,
+    Conversion,
+    Global,
+    IntConst,
+    L,
+    Load,
+    Store,
+    Temporary,
+    W,
+)
+
+from waq.errors import ProfileError
+
+from .passes.devirt import find_indirect_call
+
+if TYPE_CHECKING:
+    from collections.abc import Iterable
+    from pathlib import Path
+
+    from qbepy import Function
+
+    from .passes.devirt import IndirectCall
+
+PROFILE_VERSION = 1
+
+# An indirect call site's histogram: (table index + 1, calls) for up to
+# _SITE_TARGETS indices, then a count of the calls to any other index
+_SITE_TARGETS = 4
+_SITE_SLOTS = 2 * _SITE_TARGETS + 1
+
+# A block is hot when it ran at least 1/_HOT_RATIO as often as the hottest
+# block in the profile
+_HOT_RATIO = 1000
+
+
+@dataclass
+class FunctionProfile:
+    """Execution counts of one function's blocks."""
+
+    checksum: int
+    calls: int = 0
+    blocks: dict[str, int] = field(default_factory=dict)
+    # Times each block's jnz went to its first target
+    branches: dict[str, int] = field(default_factory=dict)
+    # call_indirect_ok block -> table index -> calls
+    targets: dict[str, dict[int, int]] = field(default_factory=dict)
+
+    def count(self, block: str) -> int | None:
+        """How often ``block`` ran, if it is in the profile."""
+        return self.blocks.get(block)
+
+
+@dataclass
+class Profile:
+    """Execution counts from one or more runs of an instrumented build."""
+
+    functions: dict[str, FunctionProfile] = field(default_factory=dict)
+
+    def __getitem__(self, func: str) -> FunctionProfile | None:
+        return self.functions.get(func)
+
+    @property
+    def max_count(self) -> int:
+        return max(
+            (n for fp in self.functions.values() for n in fp.blocks.values()),
+            default=0,
+        )
+
+    def is_hot(self, count: int | None) -> bool:
+        return bool(count) and count * _HOT_RATIO >= self.max_count
+
+    def matching(self, functions: Iterable[Function]) -> Profile:
+        """Copies of the profiles of ``functions`` that still match their IL.
+
+        Passes update the copies' counts as they add blocks.
+        """
+        current = {func.name: checksum(func) for func in functions}
+        return Profile({
+            name: copy.deepcopy(fp)
+            for name, fp in self.functions.items()
+            if current.get(name) == fp.checksum
+        })
+
+
+def checksum(func: Function) -> int:
+    """Fingerprint of ``func``'s blocks, to detect stale profiles."""
+    shape = ";".join(
+        f"{b.name}:{len(b.phis)}:{len(b.instructions)}" for b in func.blocks
+    )
+    return zlib.crc32(shape.encode())
+
+
+def load_profile(paths: Iterable[Path]) -> Profile:
+    """Read ``.waqprof`` files, summing the counts of the runs they record."""
+    profile = Profile()
+    for path in paths:
+        _read_profile(path, profile)
+    return profile
+
+
+def _read_profile(path: Path, profile: Profile) -> None:
+    lines = path.read_text(encoding="utf-8").splitlines()
+    if not lines or lines[0] != f"waqprof {PROFILE_VERSION}":
+        raise ProfileError(f"{path}: not a waq profile (version {PROFILE_VERSION})")
+    for lineno, line in enumerate(lines[1:], start=2):
+        fields = line.split("\t")
+        try:
+            kind, func = fields[0], fields[1]
+            if kind == "f":
+                fp = _function(profile, func, int(fields[2]), path)
+                fp.calls += int(fields[4])
+                _add(fp.blocks, fields[3], int(fields[4]))
+                continue
+            fp = profile.functions.get(func)
+            if fp is None:
+                raise ProfileError(f"{path}:{lineno}: block before its function")
+            if kind == "b":
+                _add(fp.blocks, fields[2], int(fields[3]))
+            elif kind == "e":
+                _add(fp.branches, fields[2], int(fields[3]))
+            elif kind == "i":
+                site = fp.targets.setdefault(fields[2], {})
+                _add(site, int(fields[3]), int(fields[4]))
+            else:
+                raise ProfileError(f"{path}:{lineno}: unknown record {kind!r}")
+        except (IndexError, ValueError) as e:
+            raise ProfileError(f"{path}:{lineno}: malformed record") from e
+
+
+def _function(profile: Profile, func: str, sig: int, path: Path) -> FunctionProfile:
+    fp = profile.functions.get(func)
+    if fp is None:
+        fp = profile.functions[func] = FunctionProfile(sig)
+    elif fp.checksum != sig:
+        raise ProfileError(f"{path}: {func} differs from the other profiles")
+    return fp
+
+
+def _add(counts: dict, key: str | int, n: int) -> None:
+    counts[key] = counts.get(key, 0) + n
+
+
+@dataclass
+class Instrumentation:
+    """The counters added to a module by ``instrument_functions``."""
+
+    names: list[str] = field(default_factory=list)  # One line per counter
+    slots: int = 0  # 64-bit words in $__wasm_prof_counters
+
+    def counter(self, name: str, slots: int = 1) -> int:
+        """Allocate a counter; its first slot."""
+        self.names.append(name)
+        self.slots += slots
+        return self.slots - slots
+
+    def names_data(self) -> list[int]:
+        """Bytes of ``$__wasm_prof_names``."""
+        return [*"".join(f"{name}\n" for name in self.names).encode(), 0]
+
+
+def instrument_functions(functions: list[Function]) -> Instrumentation:
+    """Add profile counters to ``functions`` (see the module docstring)."""
+    counters = Instrumentation()
+    for func in functions:
+        entry = func.blocks[0]
+        calls = f"f\t{func.name}\t{checksum(func)}\t{entry.name}"
+        for block in func.blocks:
+            name = calls if block is entry else f"b\t{func.name}\t{block.name}"
+            slot = counters.counter(name)
+            block.instructions[:0] = _increment(slot, IntConst(1))
+
+            term = block.terminator
+            if isinstance(term, Branch):
+                slot = counters.counter(f"e\t{func.name}\t{block.name}")
+                taken = Temporary(f"prof{slot}.c")
+                step = Temporary(f"prof{slot}.s")
+                block.instructions += [
+                    Comparison(
+                        result=taken,
+                        result_type=W,
+                        op="cnew",
+                        left=term.condition,
+                        right=IntConst(0),
+                    ),
+                    Conversion(op="extuw", result=step, result_type=L, operand=taken),
+                    *_increment(slot, step),
+                ]
+
+            site = find_indirect_call(func, block)
+            if site is not None:
+                _count_targets(func, site, counters)
+    return counters
+
+
+def _count_targets(
+    func: Function, site: IndirectCall, counters: Instrumentation
+) -> None:
+    """Record the table index after the indirect call of ``site``."""
+    slot = counters.counter(f"i\t{func.name}\t{site.ok.name}", _SITE_SLOTS)
+    code, address = _counter_address(slot)
+    site.ok.instructions[site.call + 1 : site.call + 1] = [
+        *code,
+        Call(
+            target=Global("__wasm_prof_icall"),
+            args=[(L, address), (W, site.index)],
+        ),
+    ]
+
+
+def _counter_address(slot: int) -> tuple[list[Any], Any]:
+    """Instructions computing the address of counter ``slot``, and the address."""
+    counters = Global("__wasm_prof_counters")
+    if slot == 0:
+        return [], counters
+    address = Temporary(f"prof{slot}.a")
+    return [
+        BinaryOp(
+            result=address,
+            result_type=L,
+            op="add",
+            left=counters,
+            right=IntConst(8 * slot),
+        )
+    ], address
+
+
+def _increment(slot: int, step: Any) -> list[Any]:
+    """Instructions adding ``step`` to counter ``slot``."""
+    code, address = _counter_address(slot)
+    value = Temporary(f"prof{slot}.v")
+    total = Temporary(f"prof{slot}.n")
+    return [
+        *code,
+        Load(result=value, result_type=L, address=address, load_type="loadl"),
+        BinaryOp(result=total, result_type=L, op="add", left=value, right=step),
+        Store(store_type="storel", value=total, address=address),
+    ]
@@ -0,0 +1,172 @@
+"""SSA construction for WASM locals.
+
+Locals live in QBE temporaries instead of stack slots.  While the body is
+compiled, ``FunctionContext.local_values`` holds the temporary that currently
+defines each local; ``local.set`` simply rebinds it.  Phis are built where
+control flow merges, following Braun et al., "Simple and Efficient
+Construction of Static Single Assignment Form" (CC 2013), specialised to
+WASM's structured control flow:
+
+- Every edge into a block/if merge point is known by the time its ``end`` is
+  reached, so merge blocks are sealed on creation and only get phis for
+  locals whose incoming values differ.
+- A loop header is entered before its back edges are seen.  It gets an
+  incomplete phi for each local the loop assigns, sealed at the loop's
+  ``end``; a phi that turns out trivial becomes a copy, which QBE folds.
+
+Functions that arm a setjmp exception handler keep their locals in memory
+(see ``uses_ssa_locals``).
+"""
+
+from __future__ import annotations
+
+from typing import TYPE_CHECKING
+
+from qbepy.ir import Copy, FloatConst, IntConst, Label, Phi, Temporary
+
+from waq.parser.code import block_body, contains_opcode
+from waq.parser.types import ValueType
+
+if TYPE_CHECKING:
+    from qbepy.ir import Block
+
+    from .context import ControlFrame, FunctionContext
+
+
+# local.set, local.tee
+_LOCAL_WRITES = frozenset({0x21, 0x22})
+
+
+def uses_ssa_locals(code: bytes) -> bool:
+    """Whether a function body can keep its locals in SSA temporaries.
+
+    A catch resumes through longjmp, which restores callee-saved registers to
+    their values at _setjmp time, so functions containing ``try`` or
+    ``try_table`` keep locals in memory.
+    """
+    return not contains_opcode(code, 0x06, 0x1F)
+
+
+def snapshot(ctx: FunctionContext) -> tuple[str, ...] | None:
+    """The current value of every local, for recording a control edge."""
+    if ctx.local_values is None:
+        return None
+    return tuple(ctx.local_values)
+
+
+def emit_zero_locals(ctx: FunctionContext, block: Block, first: int) -> None:
+    """Define locals ``first`` and up as zero in ``block``."""
+    from .instructions.control import _vtype_to_ir_type  # noqa: PLC0415
+    from .instructions.simd import zero_v128  # noqa: PLC0415
+
+    assert ctx.local_values is not None
+    for i in range(first, len(ctx.locals)):
+        vtype = ctx.locals[i]
+        if vtype == ValueType.V128:
+            zero_v128(ctx, block, Temporary(ctx.local_values[i]))
+            continue
+        temp = ctx.stack.new_temp_no_push(vtype)
+        if vtype in (ValueType.F32, ValueType.F64):
+            zero = FloatConst(0.0)
+        else:
+            zero = IntConst(0)
+        block.instructions.append(
+            Copy(
+                result=Temporary(temp.name),
+                result_type=_vtype_to_ir_type(vtype),
+                value=zero,
+            )
+        )
+        ctx.local_values[i] = temp.name
+
+
+def open_loop(
+    ctx: FunctionContext,
+    header: Block,
+    pred_label: str,
+    frame: ControlFrame,
+    assigned: set[int],
+) -> None:
+    """Give ``header`` an incomplete phi for each local in ``assigned``.
+
+    The only known predecessor is ``pred_label``; back edges are added by
+    ``seal_loop``.  v128 locals need none: they stay in their slots.
+    """
+    from .instructions.control import _vtype_to_ir_type  # noqa: PLC0415
+
+    assert ctx.local_values is not None
+    for i in sorted(assigned):
+        if ctx.locals[i] == ValueType.V128:
+            continue
+        temp = ctx.stack.new_temp_no_push(ctx.locals[i])
+        entry = ctx.local_values[i]
+        phi = Phi(
+            result=Temporary(temp.name),
+            result_type=_vtype_to_ir_type(ctx.locals[i]),
+            incoming=[(Label(pred_label), Temporary(entry))],
+        )
+        header.phis.append(phi)
+        frame.loop_phis.append((i, temp.name, entry, phi))
+        ctx.local_values[i] = temp.name
+
+
+def assigned_in_loop(ctx: FunctionContext) -> set[int]:
+    """Locals written inside the loop starting at the current instruction."""
+    return {
+        instr.immediates[0]
+        for instr in block_body(ctx.code, ctx.instr_offset)
+        if instr.opcode in _LOCAL_WRITES
+    }
+
+
+def seal_loop(header: Block, frame: ControlFrame) -> None:
+    """Add the back edges of ``frame`` to its header phis.
+
+    A phi whose operands are all itself or one other value is trivial.  That
+    value can only be the one flowing in from before the loop, which dominates
+    the header, so the phi is replaced by a copy of it.
+    """
+    for i, name, entry, phi in frame.loop_phis:
+        operands = {entry}
+        for label, _values, local_values in frame.incoming:
+            assert local_values is not None
+            phi.incoming.append((Label(label), Temporary(local_values[i])))
+            operands.add(local_values[i])
+        operands.discard(name)
+        if len(operands) == 1:
+            header.phis.remove(phi)
+            header.instructions.insert(
+                0,
+                Copy(
+                    result=Temporary(name),
+                    result_type=phi.result_type,
+                    value=Temporary(entry),
+                ),
+            )
+
+
+def merge_locals(ctx: FunctionContext, block: Block, frame: ControlFrame) -> None:
+    """Bind each local at the sealed merge ``block`` of ``frame``."""
+    from .instructions.control import _vtype_to_ir_type  # noqa: PLC0415
+
+    if ctx.local_values is None or not frame.incoming:
+        return
+    for i, vtype in enumerate(ctx.locals):
+        values = [local_values[i] for _label, _values, local_values in frame.incoming]
+        if all(value == values[0] for value in values):
+            ctx.local_values[i] = values[0]
+            continue
+        temp = ctx.stack.new_temp_no_push(vtype)
+        block.phis.append(
+            Phi(
+                result=Temporary(temp.name),
+                result_type=_vtype_to_ir_type(vtype),
+                incoming=[
+                    (Label(label), Temporary(value))
+                    for (label, _values, _locals), value in zip(
+                        frame.incoming, values, strict=True
+                    )
+                ],
+            )
+        )
+        ctx.local_values[i] = temp.name
@@ -47,10 +47,20 @@ class ValueStack:
         """Pop n values from the stack (in order: first popped is last in list)."""
         if len(self._stack) < n:
             raise CompileError(f"stack underflow: need {n}, have {len(self._stack)}")
+        if n == 0:
+            return []
         result = self._stack[-n:]
         self._stack = self._stack[:-n]
         return result
 
+    def peek_n(self, n: int) -> list[StackValue]:
+        """Peek at the top n values without removing them (same order as pop_n)."""
+        if len(self._stack) < n:
+            raise CompileError(f"stack underflow: need {n}, have {len(self._stack)}")
+        if n == 0:
+            return []
+        return self._stack[-n:]
+
     def peek(self) -> StackValue:
         """Peek at the top value without removing it."""
         if not self._stack:
@@ -0,0 +1,439 @@
+"""Guaranteed tail calls between functions.
+
+QBE has no tail-call guarantee: a ``call`` followed by ``ret`` keeps the
+caller's frame alive, so mutually recursive functions that hand control
+back and forth with ``return_call`` (state machines, CPS-compiled code)
+grow the native stack without bound.  Self tail calls are already loops
+(see ``_emit_return_call``); this module handles cycles through several
+functions.
+
+Every strongly connected component of the tail-call graph with more
+than one function is merged into one QBE function::
+
+    function $__wasm_tail_group_0(w %sel, <parameter slots>) {
+    @entry          dispatch on %sel to the member's head block
+    @m0.head        phis binding member 0's parameters
+    @m0.entry ...   member 0's body, renamed apart
+    @m1.head ...
+    }
+
+A tail call from one member to another becomes a jump to the target's head
+block, whose phis take the arguments, so the cycle runs in a single frame.
+Parameters travel in slots shared by class: a group whose members take at
+most two ``w`` and one ``d`` parameter has slots ``w0``, ``w1`` and ``d0``.
+Each member keeps its name as a wrapper that calls the group, so ordinary
+calls, exports and table entries are unaffected.
+
+Each member's ``alloc``s (memory locals, call results returned through
+memory, exception handler state) move to the group's entry block, so they
+run once per frame however often the member is re-entered.  A tail call
+first pops the caller's exception handlers, so no member's ``_setjmp``
+handler is armed across a jump and members with ``try`` merge like the rest.
+
+A tail call is a ``call`` whose result is immediately returned, which is
+how ``return_call`` to another function is compiled (and also how a plain
+``call`` in tail position looks).  ``return_call_indirect`` and
+``return_call_ref`` are an indirect call + ``ret``; they have an edge to each
+address-taken function of their signature, and in a group they compare the
+code pointer with those members' and jump to the one it matches, keeping
+the call for any other target::
+
+    %m0.L4.is0 =w ceql %m0.t9, $f
+    jnz %m0.L4.is0, @m1.head, @m0.L4.next0
+    @m0.L4.next0
+    %m0.t10 =w call %m0.t9(...)
+
+A function whose indirect tail calls can reach itself is a group of one.
+
+A ``return_call*`` left as a call gets a ``CompileWarning``: a direct one to
+an imported function, and an indirect one with no group member to jump to.
+Direct tail calls to a function outside the caller's group are not
+reported: that function never tail-calls back, so such chains are no
+deeper than the call graph.
+"""
+
+from __future__ import annotations
+
+import warnings
+from typing import TYPE_CHECKING, Any
+
+from qbepy import Function
+from qbepy.ir import (
+    Alloc,
+    Branch,
+    Call,
+    Comparison,
+    FloatConst,
+    Global,
+    IntConst,
+    Jump,
+    Label,
+    Phi,
+    Return,
+    Temporary,
+    W,
+)
+
+from waq.errors import CompileWarning
+
+from .passes.ir import clone_blocks
+
+if TYPE_CHECKING:
+    from collections.abc import Container, Iterator
+
+    from qbepy.ir import Block
+
+_SLOT_CLASSES = ("w", "l", "s", "d")
+
+
+def merge_tail_call_groups(
+    functions: list[Function],
+    guaranteed: Container[tuple[str, str]] = frozenset(),
+    address_taken: Container[str] = frozenset(),
+) -> None:
+    """Merge the tail-call cycles among ``functions`` in place.
+
+    ``guaranteed`` holds the (function, block) of each ``return_call*``, and
+    ``address_taken`` the functions a table slot or funcref can point to.
+    Each merged group is added to ``functions`` after its last member.
+    """
+    by_name = {func.name: func for func in functions}
+    targets = [func for func in functions if func.name in address_taken]
+    edges = {}
+    for func in functions:
+        callees = {callee for callee, _block in _tail_calls(func, by_name)}
+        callees.discard(func.name)
+        for call, _block in _indirect_tail_calls(func, guaranteed):
+            callees.update(
+                target.name for target in targets if _accepts(target, call)
+            )
+        edges[func.name] = callees
+
+    groups = [
+        scc
+        for scc in _strongly_connected(edges)
+        if len(scc) > 1 or next(iter(scc)) in edges[next(iter(scc))]
+    ]
+    _report_kept_calls(functions, groups, guaranteed, address_taken)
+    for k, names in enumerate(groups):
+        members = [func for func in functions if func.name in names]
+        sites = {
+            f"m{i}.{block.name}"
+            for i, member in enumerate(members)
+            for _call, block in _indirect_tail_calls(member, guaranteed)
+        }
+        group = _merge(f"__wasm_tail_group_{k}", members, sites, address_taken)
+        for index, member in enumerate(members):
+            _make_wrapper(member, group, index)
+        last = max(functions.index(member) for member in members)
+        functions.insert(last + 1, group)
+
+
+def _returned_calls(func: Function) -> Iterator[tuple[Call, Block]]:
+    """(call, block) for each block that returns the result of its last call."""
+    for block in func.blocks:
+        term = block.terminator
+        if not isinstance(term, Return) or not block.instructions:
+            continue
+        call = block.instructions[-1]
+        if isinstance(call, Call) and term.value == call.result:
+            yield call, block
+
+
+def _tail_calls(
+    func: Function, targets: Container[str]
+) -> Iterator[tuple[str, Block]]:
+    """(callee, block) for each block ending in a tail call to ``targets``."""
+    for call, block in _returned_calls(func):
+        if isinstance(call.target, Global) and call.target.name in targets:
+            yield call.target.name, block
+
+
+def _indirect_tail_calls(
+    func: Function, guaranteed: Container[tuple[str, str]]
+) -> Iterator[tuple[Call, Block]]:
+    """(call, block) for each ``return_call_indirect``/``_ref`` in ``func``."""
+    for call, block in _returned_calls(func):
+        if (
+            isinstance(call.target, Temporary)
+            and (func.name, block.name) in guaranteed
+        ):
+            yield call, block
+
+
+def _accepts(func: Function, call: Call) -> bool:
+    """True if ``func`` takes ``call``'s arguments and returns its result."""
+    params = [str(param_type) for param_type, _name in func.params]
+    args = [str(arg_type) for arg_type, _value in call.args]
+    return params == args and str(func.return_type) == str(call.result_type)
+
+
+def _report_kept_calls(
+    functions: list[Function],
+    groups: list[set[str]],
+    guaranteed: Container[tuple[str, str]],
+    address_taken: Container[str],
+) -> None:
+    """Warn about each ``return_call*`` that will stay call + return."""
+    # The members an indirect tail call in each function can jump to
+    jump_targets: dict[str, list[Function]] = {}
+    for names in groups:
+        members = [
+            func
+            for func in functions
+            if func.name in names and func.name in address_taken
+        ]
+        jump_targets.update(dict.fromkeys(names, members))
+
+    defined = {func.name for func in functions}
+    for func in functions:
+        for call, block in _returned_calls(func):
+            if (func.name, block.name) not in guaranteed:
+                continue
+            if isinstance(call.target, Global):
+                if call.target.name not in defined:
+                    warnings.warn(
+                        f"${func.name}: tail call to the imported "
+                        f"${call.target.name} is compiled as call + return",
+                        CompileWarning,
+                        stacklevel=3,
+                    )
+            elif not any(
+                _accepts(member, call) for member in jump_targets.get(func.name, [])
+            ):
+                warnings.warn(
+                    f"${func.name}: indirect tail call with no target in a "
+                    "tail-call group is compiled as call + return",
+                    CompileWarning,
+                    stacklevel=3,
+                )
+
+
+def _strongly_connected(edges: dict[str, set[str]]) -> list[set[str]]:
+    """Tarjan's algorithm, iterative so deep call chains are fine."""
+    index: dict[str, int] = {}
+    low: dict[str, int] = {}
+    stack: list[str] = []
+    on_stack: set[str] = set()
+    sccs: list[set[str]] = []
+
+    for root in edges:
+        if root in index:
+            continue
+        work = [(root, iter(sorted(edges[root])))]
+        index[root] = low[root] = len(index)
+        stack.append(root)
+        on_stack.add(root)
+        while work:
+            node, pending = work[-1]
+            for succ in pending:
+                if succ not in index:
+                    index[succ] = low[succ] = len(index)
+                    stack.append(succ)
+                    on_stack.add(succ)
+                    work.append((succ, iter(sorted(edges[succ]))))
+                    break
+                if succ in on_stack:
+                    low[node] = min(low[node], index[succ])
+            else:
+                work.pop()
+                if work:
+                    parent = work[-1][0]
+                    low[parent] = min(low[parent], low[node])
+                if low[node] == index[node]:
+                    scc = set()
+                    while True:
+                        member = stack.pop()
+                        on_stack.discard(member)
+                        scc.add(member)
+                        if member == node:
+                            break
+                    sccs.append(scc)
+    return sccs
+
+
+def _slots(members: list[Function]) -> list[tuple[Any, str]]:
+    """Shared parameter slots: for each class, as many as any member needs."""
+    types = {}
+    counts = dict.fromkeys(_SLOT_CLASSES, 0)
+    for member in members:
+        used = dict.fromkeys(_SLOT_CLASSES, 0)
+        for param_type, _name in member.params:
+            cls = str(param_type)
+            types[cls] = param_type
+            used[cls] += 1
+        for cls in _SLOT_CLASSES:
+            counts[cls] = max(counts[cls], used[cls])
+    return [
+        (types[cls], f"{cls}{k}") for cls in _SLOT_CLASSES for k in range(counts[cls])
+    ]
+
+
+def _slot_names(member: Function) -> list[str]:
+    """The slot each of ``member``'s parameters travels in."""
+    used = dict.fromkeys(_SLOT_CLASSES, 0)
+    names = []
+    for param_type, _name in member.params:
+        cls = str(param_type)
+        names.append(f"{cls}{used[cls]}")
+        used[cls] += 1
+    return names
+
+
+def _merge(
+    name: str,
+    members: list[Function],
+    sites: Container[str],
+    address_taken: Container[str],
+) -> Function:
+    """The group of ``members``; ``sites`` label their indirect tail calls."""
+    group = Function(
+        name,
+        return_type=members[0].return_type,
+        params=[(W, "sel"), *_slots(members)],
+    )
+    member_index = {member.name: i for i, member in enumerate(members)}
+
+    # Dispatch: compare %sel against each member in turn
+    heads = [Label(f"m{i}.head") for i in range(len(members))]
+    entries: list[Label] = []  # Block that enters each member's head
+    block = group.add_block("entry")
+    for i in range(len(members) - 1):
+        block.instructions.append(
+            Comparison(
+                result=Temporary(f"is{i}"),
+                result_type=W,
+                op="ceqw",
+                left=Temporary("sel"),
+                right=IntConst(i),
+            )
+        )
+        following = Label(f"dispatch{i + 1}")
+        block.terminator = Branch(
+            condition=Temporary(f"is{i}"), if_true=heads[i], if_false=following
+        )
+        entries.append(block.label)
+        block = group.add_block(following.name)
+    block.terminator = Jump(target=heads[-1])
+    entries.append(block.label)
+
+    head_blocks = []
+    for i, member in enumerate(members):
+        head = group.add_block(heads[i].name)
+        head.phis = [
+            Phi(
+                result=Temporary(f"m{i}.{param}"),
+                result_type=param_type,
+                incoming=[(entries[i], Temporary(slot))],
+            )
+            for (param_type, param), slot in zip(
+                member.params, _slot_names(member), strict=True
+            )
+        ]
+        head.terminator = Jump(target=Label(f"m{i}.{member.blocks[0].name}"))
+        head_blocks.append(head)
+        clone_blocks(group, member, f"m{i}")
+
+    # Tail calls within the group jump to the callee's head
+    for callee, clone in list(_tail_calls(group, member_index)):
+        call = clone.instructions.pop()
+        j = member_index[callee]
+        clone.terminator = Jump(target=heads[j])
+        _bind(head_blocks[j], clone.label, call.args)
+
+    # Indirect ones test the code pointer against each member they may reach
+    for clone in [block for block in group.blocks if block.name in sites]:
+        _dispatch_indirect(group, clone, members, heads, head_blocks, address_taken)
+
+    # Stack slots are allocated once per frame, not on each entry to a member
+    allocs = []
+    for block in group.blocks[1:]:
+        allocs += [instr for instr in block.instructions if isinstance(instr, Alloc)]
+        block.instructions = [
+            instr for instr in block.instructions if not isinstance(instr, Alloc)
+        ]
+    group.blocks[0].instructions[:0] = allocs
+    return group
+
+
+def _bind(head: Block, label: Label, args: list[tuple[Any, Any]]) -> None:
+    """Add the edge from ``label`` passing ``args`` to a member's head phis."""
+    head.phis = [
+        Phi(
+            result=phi.result,
+            result_type=phi.result_type,
+            incoming=[*phi.incoming, (label, value)],
+        )
+        for phi, (_type, value) in zip(head.phis, args, strict=True)
+    ]
+
+
+def _dispatch_indirect(
+    group: Function,
+    clone: Block,
+    members: list[Function],
+    heads: list[Label],
+    head_blocks: list[Block],
+    address_taken: Container[str],
+) -> None:
+    """Jump to the member an indirect tail call's code pointer matches."""
+    call = clone.instructions[-1]
+    matches = [
+        j
+        for j, member in enumerate(members)
+        if member.name in address_taken and _accepts(member, call)
+    ]
+    if not matches:
+        return
+    clone.instructions.pop()
+    ret = clone.terminator
+    block = clone
+    for k, j in enumerate(matches):
+        test = Temporary(f"{clone.name}.is{k}")
+        block.instructions.append(
+            Comparison(
+                result=test,
+                result_type=W,
+                op="ceql",
+                left=call.target,
+                right=Global(members[j].name),
+            )
+        )
+        following = group.add_block(f"{clone.name}.next{k}")
+        block.terminator = Branch(
+            condition=test, if_true=heads[j], if_false=following.label
+        )
+        _bind(head_blocks[j], block.label, call.args)
+        block = following
+    # Any other target is called
+    block.instructions.append(call)
+    block.terminator = ret
+
+
+def _make_wrapper(member: Function, group: Function, index: int) -> None:
+    """Replace ``member``'s body with a call into its group."""
+    own = dict(zip(_slot_names(member), member.params, strict=True))
+    args: list[tuple[Any, Any]] = [(W, IntConst(index))]
+    for slot_type, slot in group.params[1:]:
+        if slot in own:
+            args.append((slot_type, Temporary(own[slot][1])))
+        elif str(slot_type) in ("s", "d"):
+            args.append((slot_type, FloatConst(0.0)))
+        else:
+            args.append((slot_type, IntConst(0)))
+
+    member.blocks.clear()
+    entry = member.add_block("entry")
+    if member.return_type is None:
+        entry.instructions = [Call(target=Global(group.name), args=args)]
+        entry.terminator = Return(value=None)
+    else:
+        entry.instructions = [
+            Call(
+                target=Global(group.name),
+                args=args,
+                result=Temporary("result"),
+                result_type=member.return_type,
+            )
+        ]
+        entry.terminator = Return(value=Temporary("result"))
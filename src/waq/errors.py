@@ -55,9 +55,17 @@ class CompileError(WasmError):
         super().__init__(message)
 
 
+class CompileWarning(UserWarning):
+    """Code that compiles, but not with the guarantees WASM asks for."""
+
+
 class TrapError(WasmError):
     """Runtime trap condition detected at compile time."""
 
     def __init__(self, trap_type: str, message: str = "") -> None:
         self.trap_type = trap_type
         super().__init__(f"{trap_type}: {message}" if message else trap_type)
+
+
+class ProfileError(WasmError):
+    """Malformed or inconsistent ``.waqprof`` profile."""
@@ -125,6 +125,11 @@ class BinaryReader:
 
     def read_u32_leb128(self) -> int:
         """Read an unsigned 32-bit LEB128 integer."""
+        # Most indices and immediates fit a single byte
+        pos = self.pos
+        if pos < len(self.data) and self.data[pos] < 0x80:
+            self.pos = pos + 1
+            return self.data[pos]
         result = 0
         shift = 0
         while True:
@@ -139,6 +144,11 @@ class BinaryReader:
 
     def read_s32_leb128(self) -> int:
         """Read a signed 32-bit LEB128 integer."""
+        pos = self.pos
+        if pos < len(self.data) and self.data[pos] < 0x80:
+            self.pos = pos + 1
+            byte = self.data[pos]
+            return byte - 0x80 if byte & 0x40 else byte
         result = 0
         shift = 0
         while True:
@@ -152,7 +162,9 @@ class BinaryReader:
                 break
             if shift >= 35:
                 raise ParseError("LEB128 integer too large", self.pos)
-        # Convert to signed 32-bit
+        # Convert to signed 32-bit (a 5-byte encoding is not sign-extended
+        # above, its last byte carries the sign in bit 31)
+        result &= 0xFFFFFFFF
         if result >= 0x80000000:
             result -= 0x100000000
         return result
@@ -172,6 +184,10 @@ class BinaryReader:
                 break
             if shift >= 70:
                 raise ParseError("LEB128 integer too large", self.pos)
+        # Convert to signed 64-bit, as for read_s32_leb128
+        result &= 0xFFFFFFFFFFFFFFFF
+        if result >= 0x8000000000000000:
+            result -= 0x10000000000000000
         return result
 
     def read_f32(self) -> float:
@@ -214,7 +230,7 @@ class BinaryReader:
         if byte == 0x40:
             self.read_byte()
             return None
-        if byte in (0x7F, 0x7E, 0x7D, 0x7C, 0x70, 0x6F):
+        if byte in (0x7F, 0x7E, 0x7D, 0x7C, 0x70, 0x6F, 0x69):
             return self.read_value_type()
         # Type index (signed LEB128 for negative values)
         return self.read_s32_leb128()
@@ -270,6 +286,10 @@ class BinaryReader:
             shift += 7
             if shift >= 70:
                 raise ParseError("LEB128 integer too large", self.pos)
+        # Convert to signed 64-bit, as for read_s32_leb128
+        result &= 0xFFFFFFFFFFFFFFFF
+        if result >= 0x8000000000000000:
+            result -= 0x10000000000000000
         return result
 
     def read_table_type(self) -> TableType:
@@ -0,0 +1,247 @@
+"""Instruction decoder for function bodies.
+
+The code generator translates a function in a single forward pass.  Some
+lowering decisions need to know what is *ahead* in the body (for example,
+whether a function contains a ``try`` at all), so this module walks raw
+bytecode one instruction at a time and decodes immediates without compiling
+anything.
+
+Immediates are read exactly as the code generator reads them, so instruction
+boundaries always agree between the two.
+"""
+
+from __future__ import annotations
+
+from dataclasses import dataclass
+from typing import TYPE_CHECKING, Any
+
+from .binary import BinaryReader
+
+if TYPE_CHECKING:
+    from collections.abc import Iterator
+
+
+@dataclass(frozen=True, slots=True)
+class Instruction:
+    """A decoded instruction."""
+
+    offset: int  # Byte offset of the opcode within the body
+    opcode: int  # First opcode byte (0xFB/0xFC/0xFD for prefixed instructions)
+    sub_opcode: int | None  # Sub-opcode for prefixed instructions
+    immediates: tuple[Any, ...]
+
+
+# Immediate layouts for single-byte opcodes.  Anything not listed has no
+# immediates.
+_BLOCK = ("block_type",)
+_U32 = ("u32",)
+_U32_U32 = ("u32", "u32")
+_MEMARG = ("u32", "u32")
+
+_IMMEDIATES: dict[int, tuple[str, ...]] = {
+    0x02: _BLOCK,  # block
+    0x03: _BLOCK,  # loop
+    0x04: _BLOCK,  # if
+    0x06: _BLOCK,  # try
+    0x07: _U32,  # catch
+    0x08: _U32,  # throw
+    0x09: _U32,  # rethrow
+    0x0C: _U32,  # br
+    0x0D: _U32,  # br_if
+    0x10: _U32,  # call
+    0x11: _U32_U32,  # call_indirect
+    0x12: _U32,  # return_call
+    0x13: _U32_U32,  # return_call_indirect
+    0x14: _U32,  # call_ref
+    0x15: _U32,  # return_call_ref
+    0x18: _U32,  # delegate
+    0x20: _U32,  # local.get
+    0x21: _U32,  # local.set
+    0x22: _U32,  # local.tee
+    0x23: _U32,  # global.get
+    0x24: _U32,  # global.set
+    0x25: _U32,  # table.get
+    0x26: _U32,  # table.set
+    0x3F: _U32,  # memory.size
+    0x40: _U32,  # memory.grow
+    0x41: ("s32",),  # i32.const
+    0x42: ("s64",),  # i64.const
+    0x43: ("f32",),  # f32.const
+    0x44: ("f64",),  # f64.const
+    0xD0: _U32,  # ref.null
+    0xD2: _U32,  # ref.func
+    0xD5: _U32,  # br_on_null
+    0xD6: _U32,  # br_on_non_null
+}
+_IMMEDIATES.update(dict.fromkeys(range(0x28, 0x3F), _MEMARG))  # loads/stores
+
+# 0xFC prefix: saturating conversions, bulk memory and bulk table operations
+_FC_IMMEDIATES: dict[int, tuple[str, ...]] = {
+    0x08: _U32_U32,  # memory.init
+    0x09: _U32,  # data.drop
+    0x0A: _U32_U32,  # memory.copy
+    0x0B: _U32,  # memory.fill
+    0x0C: _U32_U32,  # table.init
+    0x0D: _U32,  # elem.drop
+    0x0E: _U32_U32,  # table.copy
+    0x0F: _U32,  # table.grow
+    0x10: _U32,  # table.size
+    0x11: _U32,  # table.fill
+}
+
+# 0xFB prefix: GC instructions
+_FB_IMMEDIATES: dict[int, tuple[str, ...]] = {
+    0x00: _U32,  # struct.new
+    0x01: _U32,  # struct.new_default
+    0x02: _U32_U32,  # struct.get
+    0x03: _U32_U32,  # struct.get_s
+    0x04: _U32_U32,  # struct.get_u
+    0x05: _U32_U32,  # struct.set
+    0x06: _U32,  # array.new
+    0x07: _U32,  # array.new_default
+    0x08: _U32_U32,  # array.new_fixed
+    0x09: _U32_U32,  # array.new_data
+    0x0A: _U32_U32,  # array.new_elem
+    0x0B: _U32,  # array.get
+    0x0C: _U32,  # array.get_s
+    0x0D: _U32,  # array.get_u
+    0x0E: _U32,  # array.set
+    0x10: _U32,  # array.fill
+    0x11: _U32_U32,  # array.copy
+    0x12: _U32_U32,  # array.init_data
+    0x13: _U32_U32,  # array.init_elem
+    0x14: _U32,  # ref.test
+    0x15: _U32,  # ref.test null
+    0x16: _U32,  # ref.cast
+    0x17: _U32,  # ref.cast null
+    0x18: ("byte", "u32", "u32", "u32"),  # br_on_cast
+    0x19: ("byte", "u32", "u32", "u32"),  # br_on_cast_fail
+}
+
+# 0xFD prefix: fixed-width and relaxed SIMD.  Memory accesses take a memarg,
+# the lane accesses a lane index after it.
+_FD_IMMEDIATES: dict[int, tuple[str, ...]] = {
+    0x0C: ("v128",),  # v128.const
+    0x0D: ("v128",),  # i8x16.shuffle
+}
+_FD_IMMEDIATES.update(dict.fromkeys(range(0x00, 0x0C), _MEMARG))  # loads/store
+_FD_IMMEDIATES.update(dict.fromkeys(range(0x15, 0x23), ("byte",)))  # lanes
+_FD_IMMEDIATES.update(dict.fromkeys(range(0x54, 0x5C), ("u32", "u32", "byte")))
+_FD_IMMEDIATES.update(dict.fromkeys((0x5C, 0x5D), _MEMARG))  # load32/64_zero
+
+_PREFIX_TABLES: dict[int, dict[int, tuple[str, ...]]] = {
+    0xFB: _FB_IMMEDIATES,
+    0xFC: _FC_IMMEDIATES,
+    0xFD: _FD_IMMEDIATES,
+}
+
+
+def _read_immediate(reader: BinaryReader, kind: str) -> Any:
+    """Read one immediate operand."""
+    if kind == "u32":
+        return reader.read_u32_leb128()
+    if kind == "s32":
+        return reader.read_s32_leb128()
+    if kind == "s64":
+        return reader.read_s64_leb128()
+    if kind == "f32":
+        return reader.read_f32()
+    if kind == "f64":
+        return reader.read_f64()
+    if kind == "byte":
+        return reader.read_byte()
+    if kind == "block_type":
+        return reader.read_block_type()
+    if kind == "v128":
+        return reader.read_bytes(16)
+    raise ValueError(f"unknown immediate kind: {kind}")
+
+
+def decode_instruction(reader: BinaryReader) -> Instruction:
+    """Decode the instruction at the reader's position and advance past it."""
+    offset = reader.pos
+    opcode = reader.read_byte()
+
+    if opcode in _PREFIX_TABLES:
+        sub_opcode = reader.read_u32_leb128()
+        layout = _PREFIX_TABLES[opcode].get(sub_opcode, ())
+        immediates = tuple(_read_immediate(reader, kind) for kind in layout)
+        return Instruction(offset, opcode, sub_opcode, immediates)
+
+    if opcode == 0x0E:  # br_table
+        count = reader.read_u32_leb128()
+        labels = tuple(reader.read_u32_leb128() for _ in range(count))
+        default = reader.read_u32_leb128()
+        return Instruction(offset, opcode, None, (labels, default))
+
+    if opcode == 0x1F:  # try_table
+        block_type = reader.read_block_type()
+        clauses = []
+        for _ in range(reader.read_u32_leb128()):
+            kind = reader.read_byte()
+            tag = reader.read_u32_leb128() if kind in (0x00, 0x01) else None
+            clauses.append((kind, tag, reader.read_u32_leb128()))
+        return Instruction(offset, opcode, None, (block_type, tuple(clauses)))
+
+    if opcode == 0x1C:  # typed select
+        count = reader.read_u32_leb128()
+        types = tuple(reader.read_u32_leb128() for _ in range(count))
+        return Instruction(offset, opcode, None, (types,))
+
+    layout = _IMMEDIATES.get(opcode, ())
+    immediates = tuple(_read_immediate(reader, kind) for kind in layout)
+    return Instruction(offset, opcode, None, immediates)
+
+
+def iter_instructions(code: bytes) -> Iterator[Instruction]:
+    """Iterate over the decoded instructions of a function body."""
+    reader = BinaryReader(code)
+    while not reader.at_end:
+        yield decode_instruction(reader)
+
+
+# Structured instructions that open / close a nesting level
+_OPENERS = frozenset({0x02, 0x03, 0x04, 0x06, 0x1F})  # block loop if try try_table
+_CLOSERS = frozenset({0x0B, 0x18})  # end, delegate
+
+
+def block_body(code: bytes, offset: int) -> Iterator[Instruction]:
+    """Iterate over the instructions nested in the structured instruction at
+    ``offset``, up to (not including) its matching ``end``/``delegate``.
+    """
+    reader = BinaryReader(code)
+    reader.skip(offset)
+    decode_instruction(reader)  # the block instruction itself
+    depth = 0
+    while not reader.at_end:
+        instr = decode_instruction(reader)
+        if instr.opcode in _CLOSERS:
+            if depth == 0:
+                return
+            depth -= 1
+        elif instr.opcode in _OPENERS:
+            depth += 1
+        yield instr
+
+
+def skip_unreachable(reader: BinaryReader) -> None:
+    """Advance past dead code after an unconditional branch.
+
+    Stops at the next ``else``/``catch``/``catch_all``/``end``/``delegate``
+    that belongs to the enclosing block, leaving the reader positioned on it.
+    """
+    depth = 0
+    while not reader.at_end:
+        opcode = reader.peek_byte()
+        if depth == 0 and opcode in (0x05, 0x07, 0x19, 0x0B, 0x18):
+            return
+        instr = decode_instruction(reader)
+        if instr.opcode in _CLOSERS:
+            depth -= 1
+        elif instr.opcode in _OPENERS:
+            depth += 1
+
+
+def contains_opcode(code: bytes, *opcodes: int) -> bool:
+    """Check whether a function body contains any of the given opcodes."""
+    return any(instr.opcode in opcodes for instr in iter_instructions(code))
@@ -36,6 +36,7 @@ class SectionId(IntEnum):
     CODE = 10
     DATA = 11
     DATA_COUNT = 12
+    TAG = 13
 
 
 class ExportKind(IntEnum):
@@ -45,6 +46,7 @@ class ExportKind(IntEnum):
     TABLE = 1
     MEMORY = 2
     GLOBAL = 3
+    TAG = 4
 
 
 class ImportKind(IntEnum):
@@ -54,6 +56,18 @@ class ImportKind(IntEnum):
     TABLE = 1
     MEMORY = 2
     GLOBAL = 3
+    TAG = 4
+
+
+@dataclass
+class Tag:
+    """Exception tag (exception handling proposal).
+
+    The tag's function type gives the payload carried by a thrown exception:
+    its params are the payload values, its results are always empty.
+    """
+
+    type_idx: int
 
 
 @dataclass
@@ -67,7 +81,8 @@ class Import:
     # For TABLE: TableType
     # For MEMORY: MemoryType
     # For GLOBAL: GlobalType
-    desc: int | TableType | MemoryType | GlobalType
+    # For TAG: Tag
+    desc: int | TableType | MemoryType | GlobalType | Tag
 
 
 @dataclass
@@ -139,6 +154,9 @@ class WasmModule:
     # Memory section
     memories: list[MemoryType] = field(default_factory=list)
 
+    # Tag section (exception tags)
+    tags: list[Tag] = field(default_factory=list)
+
     # Global section
     globals: list[Global] = field(default_factory=list)
 
@@ -179,8 +197,49 @@ class WasmModule:
         """Count of imported globals."""
         return sum(1 for imp in self.imports if imp.kind == ImportKind.GLOBAL)
 
-    def get_func_type(self, func_idx: int) -> FuncType:
-        """Get function type by function index."""
+    def num_imported_tags(self) -> int:
+        """Count of imported tags."""
+        return sum(1 for imp in self.imports if imp.kind == ImportKind.TAG)
+
+    def all_tags(self) -> list[Tag]:
+        """All tags in tag index order (imports first, then defined)."""
+        imported = [
+            imp.desc
+            for imp in self.imports
+            if imp.kind == ImportKind.TAG and isinstance(imp.desc, Tag)
+        ]
+        return imported + self.tags
+
+    def all_tables(self) -> list[TableType]:
+        """All tables in table index order (imports first, then defined)."""
+        imported = [
+            imp.desc
+            for imp in self.imports
+            if imp.kind == ImportKind.TABLE and isinstance(imp.desc, TableType)
+        ]
+        return imported + self.tables
+
+    def all_global_types(self) -> list[GlobalType]:
+        """All global types in global index order (imports first, then defined)."""
+        imported = [
+            imp.desc
+            for imp in self.imports
+            if imp.kind == ImportKind.GLOBAL and isinstance(imp.desc, GlobalType)
+        ]
+        return imported + [glob.type for glob in self.globals]
+
+    def get_tag_type(self, tag_idx: int) -> FuncType:
+        """Get the payload signature of a tag by tag index."""
+        tags = self.all_tags()
+        if tag_idx >= len(tags):
+            raise ValueError(f"tag {tag_idx} not found")
+        type_def = self.types[tags[tag_idx].type_idx]
+        if not isinstance(type_def, FuncType):
+            raise ValueError(f"type {tags[tag_idx].type_idx} is not a function type")
+        return type_def
+
+    def get_func_type_idx(self, func_idx: int) -> int:
+        """Get the type index of a function by function index."""
         num_imports = self.num_imported_funcs()
         if func_idx < num_imports:
             # Imported function
@@ -189,23 +248,42 @@ class WasmModule:
                 if imp.kind == ImportKind.FUNC:
                     if import_idx == func_idx:
                         assert isinstance(imp.desc, int)
-                        type_def = self.types[imp.desc]
-                        if not isinstance(type_def, FuncType):
-                            raise ValueError(f"type {imp.desc} is not a function type")
-                        return type_def
+                        return imp.desc
                     import_idx += 1
             raise ValueError(f"import function {func_idx} not found")
         # Defined function
         local_idx = func_idx - num_imports
         if local_idx >= len(self.func_types):
             raise ValueError(f"function {func_idx} not found")
-        type_def = self.types[self.func_types[local_idx]]
+        return self.func_types[local_idx]
+
+    def get_func_type(self, func_idx: int) -> FuncType:
+        """Get function type by function index."""
+        type_idx = self.get_func_type_idx(func_idx)
+        type_def = self.types[type_idx]
         if not isinstance(type_def, FuncType):
-            raise ValueError(
-                f"type {self.func_types[local_idx]} is not a function type"
-            )
+            raise ValueError(f"type {type_idx} is not a function type")
         return type_def
 
+    def canonical_type_ids(self) -> list[int]:
+        """Canonical id of each type index, for runtime signature checks.
+
+        Equivalent types get the same id, so ``call_indirect`` through one
+        type index accepts a function declared with an equivalent type at
+        another.  Ids start at 1; 0 is left for null table slots.
+
+        Equivalence is decided per recursion group.  The type section is
+        read without explicit ``rec`` groups, so each type is a group of its
+        own: two types are equivalent when they are structurally equal once
+        references to earlier types are replaced by those types' ids.
+        """
+        ids: list[int] = []
+        canonical: dict[object, int] = {}
+        for type_idx, type_def in enumerate(self.types):
+            key = _canonical_key(type_def, type_idx, ids)
+            ids.append(canonical.setdefault(key, len(canonical) + 1))
+        return ids
+
     def get_struct_type(self, type_idx: int) -> StructType:
         """Get struct type by type index."""
         if type_idx >= len(self.types):
@@ -235,6 +313,29 @@ class WasmModule:
         return f"func_{func_idx}"
 
 
+def _canonical_key(type_def: CompositeType, type_idx: int, ids: list[int]) -> object:
+    """Structure of ``type_def`` with type indices made group-independent."""
+
+    def storage(value: ValueType | int) -> object:
+        if isinstance(value, ValueType):
+            return value
+        if value == type_idx:
+            return ("self",)
+        if value < type_idx:
+            return ("type", ids[value])
+        return ("index", value)  # Invalid forward reference; keep it distinct
+
+    if isinstance(type_def, FuncType):
+        return ("func", type_def.params, type_def.results)
+    if isinstance(type_def, StructType):
+        return (
+            "struct",
+            tuple((storage(f.storage_type), f.mutable) for f in type_def.fields),
+        )
+    element = type_def.element_type
+    return ("array", storage(element.storage_type), element.mutable)
+
+
 def parse_module(
     data: bytes, limits: ParserLimits | None = None
 ) -> WasmModule:
@@ -310,6 +411,8 @@ def _parse_section(
             _parse_code_section(module, reader)
         case SectionId.DATA:
             _parse_data_section(module, reader)
+        case SectionId.TAG:
+            _parse_tag_section(module, reader)
         case SectionId.DATA_COUNT:
             # Just validation, we don't need to store this
             _count = reader.read_u32_leb128()
@@ -367,6 +470,8 @@ def _parse_import_section(module: WasmModule, reader: BinaryReader) -> None:
                 desc = reader.read_memory_type()
             case ImportKind.GLOBAL:
                 desc = reader.read_global_type()
+            case ImportKind.TAG:
+                desc = _read_tag(reader)
 
         module.imports.append(Import(mod_name, field_name, kind, desc))
 
@@ -386,6 +491,19 @@ def _parse_memory_section(module: WasmModule, reader: BinaryReader) -> None:
     module.memories = reader.read_vector(reader.read_memory_type)
 
 
+def _read_tag(reader: BinaryReader) -> Tag:
+    """Read a tag type (attribute byte + type index)."""
+    attribute = reader.read_byte()
+    if attribute != 0:
+        raise ParseError(f"unsupported tag attribute: {attribute}", reader.pos)
+    return Tag(reader.read_u32_leb128())
+
+
+def _parse_tag_section(module: WasmModule, reader: BinaryReader) -> None:
+    """Parse tag section (exception handling proposal)."""
+    module.tags = reader.read_vector(lambda: _read_tag(reader))
+
+
 def _parse_global_section(module: WasmModule, reader: BinaryReader) -> None:
     """Parse global section."""
     count = reader.read_u32_leb128()
@@ -527,6 +645,9 @@ def _read_init_expr(reader: BinaryReader) -> bytes:
             reader.read_byte()  # reftype
         elif opcode == 0xD2:  # ref.func
             reader.read_u32_leb128()
+        elif opcode == 0xFD:  # SIMD prefix
+            if reader.read_u32_leb128() == 0x0C:  # v128.const
+                reader.read_bytes(16)
         # Other opcodes in init expressions are not common
     end = reader.pos
     # Return the expression bytes
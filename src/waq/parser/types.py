@@ -19,7 +19,7 @@ class ValueType(IntEnum):
     # Reference types (WASM 2.0+)
     FUNCREF = 0x70
     EXTERNREF = 0x6F
-    # SIMD (not supported in QBE)
+    # SIMD
     V128 = 0x7B
     # GC reference types (WASM GC proposal)
     ANYREF = 0x6E
@@ -30,6 +30,9 @@ class ValueType(IntEnum):
     NULLFUNCREF = 0x73
     NULLEXTERNREF = 0x72
     NULLREF = 0x71
+    # Exception references (exception handling proposal)
+    EXNREF = 0x69
+    NULLEXNREF = 0x74
     # Packed types for struct/array fields
     I8 = 0x78
     I16 = 0x77
@@ -56,8 +59,12 @@ class ValueType(IntEnum):
                 | ValueType.NULLFUNCREF
                 | ValueType.NULLEXTERNREF
                 | ValueType.NULLREF
+                | ValueType.EXNREF
+                | ValueType.NULLEXNREF
             ):
                 return "l"  # All reference types are pointers
+            case ValueType.V128:
+                return "l"  # Address of the 16-byte slot holding the value
             case ValueType.I8:
                 return "b"  # byte
             case ValueType.I16:
@@ -79,6 +86,8 @@ class ValueType(IntEnum):
             ValueType.NULLFUNCREF,
             ValueType.NULLEXTERNREF,
             ValueType.NULLREF,
+            ValueType.EXNREF,
+            ValueType.NULLEXNREF,
         )
 
     def __str__(self) -> str:
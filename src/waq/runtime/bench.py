@@ -0,0 +1,169 @@
+"""Microbenchmark of the runtime's SIMD kernels.
+
+Times each relaxed-SIMD kernel next to the exact operation it relaxes, in a
+runtime built for the baseline ISA without CPU dispatch and in the default
+build, whose ifunc resolvers pick the best version for this CPU::
+
+    python -m waq.runtime.bench [--cc gcc] [--iterations N] [--cflags=-march=native]
+
+Each figure is the cost of one call from compiled code, in nanoseconds, with
+the operands in memory as the compiler leaves them.
+"""
+
+from __future__ import annotations
+
+import argparse
+import subprocess
+import tempfile
+from pathlib import Path
+from typing import TYPE_CHECKING
+
+from .library import runtime_library
+
+if TYPE_CHECKING:
+    from collections.abc import Sequence
+
+# (kernel, number of v128 operands): relaxed kernels after the exact ones they
+# relax, where there are any
+KERNELS: tuple[tuple[str, int], ...] = (
+    ("i8x16_swizzle", 2),
+    ("i8x16_relaxed_swizzle", 2),
+    ("v128_bitselect", 3),
+    ("i8x16_relaxed_laneselect", 3),
+    ("i16x8_relaxed_laneselect", 3),
+    ("i32x4_relaxed_laneselect", 3),
+    ("i64x2_relaxed_laneselect", 3),
+    ("f32x4_min", 2),
+    ("f32x4_relaxed_min", 2),
+    ("f32x4_max", 2),
+    ("f32x4_relaxed_max", 2),
+    ("f64x2_min", 2),
+    ("f64x2_relaxed_min", 2),
+    ("f64x2_max", 2),
+    ("f64x2_relaxed_max", 2),
+    ("f32x4_relaxed_madd", 3),
+    ("f32x4_relaxed_nmadd", 3),
+    ("f64x2_relaxed_madd", 3),
+    ("f64x2_relaxed_nmadd", 3),
+    ("i32x4_trunc_sat_f32x4_s", 1),
+    ("i32x4_relaxed_trunc_f32x4_s", 1),
+    ("i32x4_trunc_sat_f32x4_u", 1),
+    ("i32x4_relaxed_trunc_f32x4_u", 1),
+    ("i32x4_trunc_sat_f64x2_s_zero", 1),
+    ("i32x4_relaxed_trunc_f64x2_s_zero", 1),
+    ("i32x4_trunc_sat_f64x2_u_zero", 1),
+    ("i32x4_relaxed_trunc_f64x2_u_zero", 1),
+    ("i16x8_q15mulr_sat_s", 2),
+    ("i16x8_relaxed_q15mulr_s", 2),
+    ("i16x8_relaxed_dot_i8x16_i7x16_s", 2),
+    ("i32x4_dot_i16x8_s", 2),
+    ("i32x4_relaxed_dot_i8x16_i7x16_add_s", 3),
+)
+
+# Runtime builds to compare: the baseline ISA without dispatch, then the
+# default build
+CONFIGURATIONS: tuple[tuple[str, tuple[str, ...]], ...] = (
+    ("baseline", ("-DWAQ_NO_IFUNC",)),
+    ("dispatch", ()),
+)
+
+
+def harness_source(kernels: Sequence[tuple[str, int]]) -> str:
+    """C program that prints ``name ns_per_call`` for each of ``kernels``.
+
+    Operands hold the bits of 1.5f in every 32-bit lane, which are normal
+    numbers as f32 and f64 and in range for the truncations and the i7
+    operand of the dot products.
+    """
+    declarations = []
+    loops = []
+    for name, arity in kernels:
+        params = ", ".join(["v128_t *"] + ["const v128_t *"] * arity)
+        args = ", ".join(["&r", "&a", "&b", "&c"][: arity + 1])
+        declarations.append(f"void __wasm_{name}({params});")
+        loops.append(
+            f"    start = now();\n"
+            f"    for (long i = 0; i < n; i++) __wasm_{name}({args});\n"
+            f'    printf("{name} %.3f\\n", (now() - start) * 1e9 / n);'
+        )
+    return "\n".join([
+        "#include <stdio.h>",
+        "#include <stdlib.h>",
+        "#include <string.h>",
+        "#include <time.h>",
+        "",
+        "typedef struct { _Alignas(16) unsigned char bytes[16]; } v128_t;",
+        "",
+        *declarations,
+        "",
+        "static double now(void) {",
+        "    struct timespec ts;",
+        "    clock_gettime(CLOCK_MONOTONIC, &ts);",
+        "    return ts.tv_sec + ts.tv_nsec * 1e-9;",
+        "}",
+        "",
+        "int main(int argc, char **argv) {",
+        "    long n = argc > 1 ? strtol(argv[1], NULL, 10) : 10000000;",
+        "    float lanes[4] = {1.5f, 1.5f, 1.5f, 1.5f};",
+        "    v128_t r, a, b, c;",
+        "    double start;",
+        "    memcpy(&a, lanes, 16);",
+        "    b = c = a;",
+        *loops,
+        "    return 0;",
+        "}",
+        "",
+    ])
+
+
+def run_benchmark(
+    cc: str = "gcc",
+    iterations: int = 10_000_000,
+    cflags: Sequence[str] = (),
+    kernels: Sequence[tuple[str, int]] = KERNELS,
+) -> dict[str, dict[str, float]]:
+    """Nanoseconds per call of each kernel, by configuration name."""
+    results: dict[str, dict[str, float]] = {}
+    with tempfile.TemporaryDirectory(prefix="waq_bench_") as tmpdir:
+        source = Path(tmpdir) / "bench.c"
+        source.write_text(harness_source(kernels))
+        for config, config_flags in CONFIGURATIONS:
+            library = runtime_library(cc, [*config_flags, *cflags])
+            exe = Path(tmpdir) / f"bench_{config}"
+            subprocess.run(
+                [cc, "-O2", str(source), str(library), "-lm", "-o", str(exe)],
+                capture_output=True,
+                text=True,
+                check=True,
+            )
+            output = subprocess.run(
+                [str(exe), str(iterations)], capture_output=True, text=True, check=True
+            ).stdout
+            lines = (line.split() for line in output.splitlines())
+            results[config] = {name: float(ns) for name, ns in lines}
+    return results
+
+
+def main(argv: Sequence[str] | None = None) -> None:
+    parser = argparse.ArgumentParser(
+        prog="python -m waq.runtime.bench", description=__doc__.split("\n")[0]
+    )
+    parser.add_argument("--cc", default="gcc", help="C compiler (default: gcc)")
+    parser.add_argument(
+        "--iterations", type=int, default=10_000_000, help="calls per kernel"
+    )
+    parser.add_argument(
+        "--cflags", action="append", default=[], help="extra runtime flag (repeatable)"
+    )
+    args = parser.parse_args(argv)
+
+    results = run_benchmark(args.cc, args.iterations, args.cflags)
+    configs = [config for config, _ in CONFIGURATIONS]
+    print(f"{'kernel (ns/call)':<40}" + "".join(f"{c:>10}" for c in configs))
+    for name, _ in KERNELS:
+        row = "".join(f"{results[c].get(name, float('nan')):>10.2f}" for c in configs)
+        print(f"{name:<40}{row}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,259 @@
+"""IL versions of hot runtime helpers.
+
+QBE emits assembly, so a call into ``waq_runtime.c`` can never be inlined by
+the C compiler or the linker.  The small helpers that sit on hot paths are
+therefore also written here as QBE functions, which the ``--lto`` pass
+(``waq.compiler.passes.inline``) splices into the compiled code in place of
+the call.  Each builder must match its C counterpart exactly, including
+which runtime globals it reads: inlined code bakes in the runtime's data
+layout, which is why ``--lto`` is opt-in.
+"""
+
+from __future__ import annotations
+
+from typing import TYPE_CHECKING
+
+from qbepy import Function
+from qbepy.ir import (
+    BinaryOp,
+    Branch,
+    Call,
+    Comparison,
+    Conversion,
+    Copy,
+    D,
+    FloatConst,
+    Global,
+    Halt,
+    IntConst,
+    L,
+    Load,
+    Return,
+    S,
+    Temporary,
+    W,
+)
+
+if TYPE_CHECKING:
+    from collections.abc import Callable
+
+
+def _table_get() -> Function:
+    """``void *__wasm_table_get(int32_t table, int32_t idx)``; table 0 only.
+
+    Slots are 16-byte ``WasmTableEntry`` pairs with the code pointer first.
+    """
+    func = Function(
+        "__wasm_table_get", return_type=L, params=[(W, "table"), (W, "idx")]
+    )
+    start = func.add_block("start")
+    trap = func.add_block("oob")
+    load = func.add_block("load")
+
+    start.instructions = [
+        Load(
+            result=Temporary("size"),
+            result_type=W,
+            address=Global("__wasm_table_size"),
+            load_type="loaduw",
+        ),
+        Comparison(
+            result=Temporary("ok"),
+            result_type=W,
+            op="cultw",
+            left=Temporary("idx"),
+            right=Temporary("size"),
+        ),
+    ]
+    start.terminator = Branch(
+        condition=Temporary("ok"), if_true=load.label, if_false=trap.label
+    )
+
+    trap.instructions = [Call(target=Global("__wasm_trap_out_of_bounds"), args=[])]
+    trap.terminator = Halt()
+
+    load.instructions = [
+        Load(result=Temporary("base"), result_type=L, address=Global("__wasm_table")),
+        Conversion(
+            result=Temporary("index"),
+            result_type=L,
+            op="extuw",
+            operand=Temporary("idx"),
+        ),
+        BinaryOp(
+            result=Temporary("offset"),
+            result_type=L,
+            op="shl",
+            left=Temporary("index"),
+            right=IntConst(4),
+        ),
+        BinaryOp(
+            result=Temporary("slot"),
+            result_type=L,
+            op="add",
+            left=Temporary("base"),
+            right=Temporary("offset"),
+        ),
+        Load(result=Temporary("ref"), result_type=L, address=Temporary("slot")),
+    ]
+    load.terminator = Return(value=Temporary("ref"))
+    return func
+
+
+def _ref_i31() -> Function:
+    """``int64_t __wasm_ref_i31(int32_t value)``: ``(value << 1) | 1``, 31 bits."""
+    func = Function("__wasm_ref_i31", return_type=L, params=[(W, "value")])
+    start = func.add_block("start")
+    start.instructions = [
+        # The shift drops bit 31, and the zero extension keeps it dropped
+        BinaryOp(
+            result=Temporary("shifted"),
+            result_type=W,
+            op="shl",
+            left=Temporary("value"),
+            right=IntConst(1),
+        ),
+        BinaryOp(
+            result=Temporary("tagged"),
+            result_type=W,
+            op="or",
+            left=Temporary("shifted"),
+            right=IntConst(1),
+        ),
+        Conversion(
+            result=Temporary("ref"),
+            result_type=L,
+            op="extuw",
+            operand=Temporary("tagged"),
+        ),
+    ]
+    start.terminator = Return(value=Temporary("ref"))
+    return func
+
+
+def _i31_get(signed: bool) -> Callable[[], Function]:
+    """``int32_t __wasm_i31_get_{s,u}(int64_t ref)``: drop the tag bit."""
+    name = "__wasm_i31_get_s" if signed else "__wasm_i31_get_u"
+
+    def build() -> Function:
+        func = Function(name, return_type=W, params=[(L, "ref")])
+        start = func.add_block("start")
+        # The payload sits in bits 1..31, so a 32-bit shift of the low word
+        # yields it sign- or zero-extended
+        start.instructions = [
+            BinaryOp(
+                result=Temporary("value"),
+                result_type=W,
+                op="sar" if signed else "shr",
+                left=Temporary("ref"),
+                right=IntConst(1),
+            )
+        ]
+        start.terminator = Return(value=Temporary("value"))
+        return func
+
+    return build
+
+
+def _trunc_sat(
+    src: str, dst: str, signed: bool
+) -> tuple[str, Callable[[], Function]]:
+    """``__wasm_{i32,i64}_trunc_sat_{f32,f64}_{s,u}``.
+
+    NaN gives 0 and out-of-range inputs clamp to the integer range, as in
+    the C versions; in-range inputs use the plain truncating conversion.
+    """
+    int_name = {"w": "i32", "l": "i64"}[dst]
+    float_name = {"s": "f32", "d": "f64"}[src]
+    name = f"__wasm_{int_name}_trunc_sat_{float_name}_{'s' if signed else 'u'}"
+    ftype, itype = {"s": S, "d": D}[src], {"w": W, "l": L}[dst]
+    bits = 32 if dst == "w" else 64
+    if signed:
+        low, high = -(2 ** (bits - 1)), 2 ** (bits - 1)
+        low_value, high_value = low, high - 1
+    else:
+        # -1 is the all-ones maximum in either class
+        low, high = 0, 2**bits
+        low_value, high_value = 0, -1
+
+    def build() -> Function:
+        func = Function(name, return_type=itype, params=[(ftype, "x")])
+        start = func.add_block("start")
+        nan = func.add_block("nan")
+        check_high = func.add_block("check_high")
+        above = func.add_block("above")
+        check_low = func.add_block("check_low")
+        below = func.add_block("below")
+        convert = func.add_block("convert")
+
+        start.instructions = [
+            Comparison(
+                result=Temporary("unordered"),
+                result_type=W,
+                op=f"cuo{src}",
+                left=Temporary("x"),
+                right=Temporary("x"),
+            )
+        ]
+        start.terminator = Branch(
+            condition=Temporary("unordered"),
+            if_true=nan.label,
+            if_false=check_high.label,
+        )
+        nan.terminator = Return(value=IntConst(0))
+
+        for block, bound, op, hit, miss in (
+            (check_high, high, "cge", above, check_low),
+            (check_low, low, "cle", below, convert),
+        ):
+            block.instructions = [
+                Copy(
+                    result=Temporary(f"{block.name}_bound"),
+                    result_type=ftype,
+                    value=FloatConst(float(bound)),
+                ),
+                Comparison(
+                    result=Temporary(f"{block.name}_hit"),
+                    result_type=W,
+                    op=f"{op}{src}",
+                    left=Temporary("x"),
+                    right=Temporary(f"{block.name}_bound"),
+                ),
+            ]
+            block.terminator = Branch(
+                condition=Temporary(f"{block.name}_hit"),
+                if_true=hit.label,
+                if_false=miss.label,
+            )
+        above.terminator = Return(value=IntConst(high_value))
+        below.terminator = Return(value=IntConst(low_value))
+
+        convert.instructions = [
+            Conversion(
+                result=Temporary("result"),
+                result_type=itype,
+                op=f"{src}to{'s' if signed else 'u'}i",
+                operand=Temporary("x"),
+            )
+        ]
+        convert.terminator = Return(value=Temporary("result"))
+        return func
+
+    return name, build
+
+
+# Helper name -> builder of a fresh Function (inlining renames the copy)
+RUNTIME_IL: dict[str, Callable[[], Function]] = {
+    "__wasm_table_get": _table_get,
+    "__wasm_ref_i31": _ref_i31,
+    "__wasm_i31_get_s": _i31_get(signed=True),
+    "__wasm_i31_get_u": _i31_get(signed=False),
+    **dict(
+        _trunc_sat(src, dst, signed)
+        for dst in ("w", "l")
+        for src in ("s", "d")
+        for signed in (True, False)
+    ),
+}
+
+__all__ = ["RUNTIME_IL"]
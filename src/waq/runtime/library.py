@@ -0,0 +1,91 @@
+"""Prebuilt runtime library.
+
+``--emit exe`` links against ``libwaq_rt.a`` instead of compiling
+``waq_runtime.c`` into every executable.  The archive is built once per
+runtime source, C compiler and flag set, with optimization and one section
+per function so the linker's ``--gc-sections`` (``-dead_strip`` on macOS)
+drops the helpers a program never calls, and cached in the user cache
+directory.  Set ``WAQ_CACHE_DIR`` to use another directory.
+"""
+
+from __future__ import annotations
+
+import hashlib
+import os
+import subprocess
+import sys
+import tempfile
+from pathlib import Path
+from typing import TYPE_CHECKING
+
+from . import RUNTIME_C_SOURCE
+
+if TYPE_CHECKING:
+    from collections.abc import Sequence
+
+RUNTIME_CFLAGS = ("-O2", "-ffunction-sections", "-fdata-sections")
+
+
+def cache_dir() -> Path:
+    """Directory the prebuilt runtime libraries are kept in."""
+    override = os.environ.get("WAQ_CACHE_DIR")
+    if override:
+        return Path(override)
+    if sys.platform == "darwin":
+        return Path.home() / "Library" / "Caches" / "waq"
+    xdg = os.environ.get("XDG_CACHE_HOME")
+    return (Path(xdg) if xdg else Path.home() / ".cache") / "waq"
+
+
+def runtime_library(
+    cc: str, cflags: Sequence[str] = (), *, verbose: bool = False
+) -> Path:
+    """Path of ``libwaq_rt.a`` built by ``cc`` with ``cflags``.
+
+    The archive is built on first use.  Its cache key covers the runtime
+    source, the compiler's version banner and every flag, so editing the
+    runtime or upgrading the compiler rebuilds it.  A finished archive is
+    renamed into place, so concurrent links never see a partial one.
+    """
+    flags = [*RUNTIME_CFLAGS, *cflags]
+    key = hashlib.sha256(RUNTIME_C_SOURCE.read_bytes())
+    key.update("\0".join([cc, _compiler_version(cc), *flags]).encode())
+    directory = cache_dir()
+    library = directory / f"libwaq_rt-{key.hexdigest()[:16]}.a"
+    if library.exists():
+        return library
+
+    if verbose:
+        print(f"Building runtime library {library}")
+    directory.mkdir(parents=True, exist_ok=True)
+    try:
+        with tempfile.TemporaryDirectory(prefix="waq_rt_", dir=directory) as tmpdir:
+            obj = Path(tmpdir) / "waq_runtime.o"
+            archive = Path(tmpdir) / "libwaq_rt.a"
+            subprocess.run(
+                [cc, *flags, "-c", str(RUNTIME_C_SOURCE), "-o", str(obj)],
+                capture_output=True,
+                text=True,
+                check=True,
+            )
+            subprocess.run(
+                ["ar", "rcs", str(archive), str(obj)],
+                capture_output=True,
+                text=True,
+                check=True,
+            )
+            archive.replace(library)
+    except subprocess.CalledProcessError as e:
+        raise RuntimeError(f"Building the runtime library failed: {e.stderr}") from e
+    return library
+
+
+def _compiler_version(cc: str) -> str:
+    try:
+        result = subprocess.run(
+            [cc, "--version"], capture_output=True, text=True, check=True
+        )
+    except (OSError, subprocess.CalledProcessError):
+        # Let the build itself report a missing or broken compiler
+        return ""
+    return result.stdout
@@ -116,37 +116,78 @@ void __wasm_store_f64(uint64_t addr, double val) {
 
 #endif /* WAQ_RUNTIME_BOUNDS_CHECK */
 
-/* Integer intrinsics */
+/*
+ * CPU feature dispatch.
+ *
+ * The runtime is normally compiled for the baseline ISA, where x86-64 has no
+ * POPCNT, LZCNT, TZCNT or ROUNDSS.  Helpers that gain from those are built
+ * twice, once with __attribute__((target(feature))), and a GNU ifunc resolver
+ * binds the symbol to the best version when the program is loaded; calls then
+ * cost the same as to a plain function.  Builds that already enable a
+ * feature (waq --cpu=native) define the fast version directly, and targets
+ * without ifunc (non-ELF, non-x86-64, or -DWAQ_NO_IFUNC) the baseline one.
+ *
+ * Bodies are macros rather than inline functions so the fast version is
+ * compiled with the feature even when this file is built without -O.
+ */
+#if defined(__x86_64__) && defined(__ELF__) && defined(__GNUC__) && !defined(WAQ_NO_IFUNC)
+#define WAQ_IFUNC 1
+#else
+#define WAQ_IFUNC 0
+#endif
 
-int32_t __wasm_i32_clz(int32_t x) {
-    if (x == 0) return 32;
-    return __builtin_clz((uint32_t)x);
-}
+#define WAQ_DIRECT(ret, name, type, expr) \
+    ret name(type x) { return expr; }
+
+#if WAQ_IFUNC
+#define WAQ_DISPATCH(ret, name, type, feature, fast, generic) \
+    __attribute__((target(feature))) static ret name##_fast(type x) { return fast; } \
+    static ret name##_generic(type x) { return generic; } \
+    static ret (*name##_resolve(void))(type) { \
+        __builtin_cpu_init(); \
+        return __builtin_cpu_supports(feature) ? name##_fast : name##_generic; \
+    } \
+    ret name(type x) __attribute__((ifunc(#name "_resolve")));
+#else
+#define WAQ_DISPATCH(ret, name, type, feature, fast, generic) \
+    WAQ_DIRECT(ret, name, type, generic)
+#endif
 
-int32_t __wasm_i32_ctz(int32_t x) {
-    if (x == 0) return 32;
-    return __builtin_ctz((uint32_t)x);
-}
+/* Integer intrinsics */
 
-int32_t __wasm_i32_popcnt(int32_t x) {
-    return __builtin_popcount((uint32_t)x);
-}
+#define WAQ_CLZ32(x) ((x) == 0 ? 32 : __builtin_clz((uint32_t)(x)))
+#define WAQ_CLZ64(x) ((x) == 0 ? 64 : __builtin_clzll((uint64_t)(x)))
+#define WAQ_CTZ32(x) ((x) == 0 ? 32 : __builtin_ctz((uint32_t)(x)))
+#define WAQ_CTZ64(x) ((x) == 0 ? 64 : __builtin_ctzll((uint64_t)(x)))
+#define WAQ_POPCNT32(x) __builtin_popcount((uint32_t)(x))
+#define WAQ_POPCNT64(x) __builtin_popcountll((uint64_t)(x))
 
-int64_t __wasm_i64_clz(int64_t x) {
-    if (x == 0) return 64;
-    return __builtin_clzll((uint64_t)x);
-}
+#if defined(__LZCNT__)
+WAQ_DIRECT(int32_t, __wasm_i32_clz, int32_t, WAQ_CLZ32(x))
+WAQ_DIRECT(int64_t, __wasm_i64_clz, int64_t, WAQ_CLZ64(x))
+#else
+WAQ_DISPATCH(int32_t, __wasm_i32_clz, int32_t, "lzcnt", WAQ_CLZ32(x), WAQ_CLZ32(x))
+WAQ_DISPATCH(int64_t, __wasm_i64_clz, int64_t, "lzcnt", WAQ_CLZ64(x), WAQ_CLZ64(x))
+#endif
 
-int64_t __wasm_i64_ctz(int64_t x) {
-    if (x == 0) return 64;
-    return __builtin_ctzll((uint64_t)x);
-}
+/* TZCNT is part of BMI1 */
+#if defined(__BMI__)
+WAQ_DIRECT(int32_t, __wasm_i32_ctz, int32_t, WAQ_CTZ32(x))
+WAQ_DIRECT(int64_t, __wasm_i64_ctz, int64_t, WAQ_CTZ64(x))
+#else
+WAQ_DISPATCH(int32_t, __wasm_i32_ctz, int32_t, "bmi", WAQ_CTZ32(x), WAQ_CTZ32(x))
+WAQ_DISPATCH(int64_t, __wasm_i64_ctz, int64_t, "bmi", WAQ_CTZ64(x), WAQ_CTZ64(x))
+#endif
 
-int64_t __wasm_i64_popcnt(int64_t x) {
-    return __builtin_popcountll((uint64_t)x);
-}
+#if defined(__POPCNT__)
+WAQ_DIRECT(int32_t, __wasm_i32_popcnt, int32_t, WAQ_POPCNT32(x))
+WAQ_DIRECT(int64_t, __wasm_i64_popcnt, int64_t, WAQ_POPCNT64(x))
+#else
+WAQ_DISPATCH(int32_t, __wasm_i32_popcnt, int32_t, "popcnt", WAQ_POPCNT32(x), WAQ_POPCNT32(x))
+WAQ_DISPATCH(int64_t, __wasm_i64_popcnt, int64_t, "popcnt", WAQ_POPCNT64(x), WAQ_POPCNT64(x))
+#endif
 
-/* Rotate operations */
+/* Rotate operations (generated code inlines these; kept for older objects) */
 
 int32_t __wasm_i32_rotl(int32_t x, int32_t y) {
     uint32_t ux = (uint32_t)x;
@@ -176,32 +217,12 @@ int64_t __wasm_i64_rotr(int64_t x, int64_t y) {
     return (int64_t)((ux >> shift) | (ux << (64 - shift)));
 }
 
-/* Float intrinsics - f32 */
+/* Float intrinsics - f32 (abs, min, max and copysign are inlined by the compiler) */
 
 float __wasm_f32_abs(float x) {
     return fabsf(x);
 }
 
-float __wasm_f32_ceil(float x) {
-    return ceilf(x);
-}
-
-float __wasm_f32_floor(float x) {
-    return floorf(x);
-}
-
-float __wasm_f32_trunc(float x) {
-    return truncf(x);
-}
-
-float __wasm_f32_nearest(float x) {
-    return nearbyintf(x);
-}
-
-float __wasm_f32_sqrt(float x) {
-    return sqrtf(x);
-}
-
 float __wasm_f32_min(float a, float b) {
     if (isnan(a) || isnan(b)) return NAN;
     return fminf(a, b);
@@ -222,65 +243,273 @@ double __wasm_f64_abs(double x) {
     return fabs(x);
 }
 
-double __wasm_f64_ceil(double x) {
-    return ceil(x);
+double __wasm_f64_min(double a, double b) {
+    if (isnan(a) || isnan(b)) return NAN;
+    return fmin(a, b);
 }
 
-double __wasm_f64_floor(double x) {
-    return floor(x);
+double __wasm_f64_max(double a, double b) {
+    if (isnan(a) || isnan(b)) return NAN;
+    return fmax(a, b);
 }
 
-double __wasm_f64_trunc(double x) {
-    return trunc(x);
+double __wasm_f64_copysign(double a, double b) {
+    return copysign(a, b);
 }
 
-double __wasm_f64_nearest(double x) {
-    return nearbyint(x);
+/*
+ * Rounding and square root.
+ *
+ * Each of these is one instruction on x86-64 (SSE4.1 roundss/roundsd, SSE2
+ * sqrtss/sqrtsd) and AArch64 (frint*, fsqrt), but the libm entry points cost
+ * more than that: an out-of-line call, an FP environment save/restore in
+ * nearbyint, and an errno path in sqrt that WASM has no use for.  Without
+ * SSE4.1 at compile time the x86-64 rounding functions are dispatched (see
+ * above); other targets keep libm.
+ */
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+/* mode must be a constant: it is an immediate of roundss/roundsd */
+#define WAQ_ROUND_F32(x, mode) \
+    _mm_cvtss_f32(_mm_round_ss(_mm_setzero_ps(), _mm_set_ss(x), (mode) | _MM_FROUND_NO_EXC))
+#define WAQ_ROUND_F64(x, mode) \
+    _mm_cvtsd_f64(_mm_round_sd(_mm_setzero_pd(), _mm_set_sd(x), (mode) | _MM_FROUND_NO_EXC))
+
+float __wasm_f32_sqrt(float x) {
+    return _mm_cvtss_f32(_mm_sqrt_ss(_mm_set_ss(x)));
 }
 
 double __wasm_f64_sqrt(double x) {
-    return sqrt(x);
+    return _mm_cvtsd_f64(_mm_sqrt_sd(_mm_setzero_pd(), _mm_set_sd(x)));
 }
+#endif
 
-double __wasm_f64_min(double a, double b) {
-    if (isnan(a) || isnan(b)) return NAN;
-    return fmin(a, b);
+#if defined(__x86_64__) && defined(__SSE4_1__)
+WAQ_DIRECT(float, __wasm_f32_ceil, float, WAQ_ROUND_F32(x, _MM_FROUND_TO_POS_INF))
+WAQ_DIRECT(float, __wasm_f32_floor, float, WAQ_ROUND_F32(x, _MM_FROUND_TO_NEG_INF))
+WAQ_DIRECT(float, __wasm_f32_trunc, float, WAQ_ROUND_F32(x, _MM_FROUND_TO_ZERO))
+WAQ_DIRECT(float, __wasm_f32_nearest, float, WAQ_ROUND_F32(x, _MM_FROUND_TO_NEAREST_INT))
+WAQ_DIRECT(double, __wasm_f64_ceil, double, WAQ_ROUND_F64(x, _MM_FROUND_TO_POS_INF))
+WAQ_DIRECT(double, __wasm_f64_floor, double, WAQ_ROUND_F64(x, _MM_FROUND_TO_NEG_INF))
+WAQ_DIRECT(double, __wasm_f64_trunc, double, WAQ_ROUND_F64(x, _MM_FROUND_TO_ZERO))
+WAQ_DIRECT(double, __wasm_f64_nearest, double, WAQ_ROUND_F64(x, _MM_FROUND_TO_NEAREST_INT))
+
+#elif defined(__x86_64__) && WAQ_IFUNC
+WAQ_DISPATCH(float, __wasm_f32_ceil, float, "sse4.1",
+             WAQ_ROUND_F32(x, _MM_FROUND_TO_POS_INF), ceilf(x))
+WAQ_DISPATCH(float, __wasm_f32_floor, float, "sse4.1",
+             WAQ_ROUND_F32(x, _MM_FROUND_TO_NEG_INF), floorf(x))
+WAQ_DISPATCH(float, __wasm_f32_trunc, float, "sse4.1",
+             WAQ_ROUND_F32(x, _MM_FROUND_TO_ZERO), truncf(x))
+WAQ_DISPATCH(float, __wasm_f32_nearest, float, "sse4.1",
+             WAQ_ROUND_F32(x, _MM_FROUND_TO_NEAREST_INT), nearbyintf(x))
+WAQ_DISPATCH(double, __wasm_f64_ceil, double, "sse4.1",
+             WAQ_ROUND_F64(x, _MM_FROUND_TO_POS_INF), ceil(x))
+WAQ_DISPATCH(double, __wasm_f64_floor, double, "sse4.1",
+             WAQ_ROUND_F64(x, _MM_FROUND_TO_NEG_INF), floor(x))
+WAQ_DISPATCH(double, __wasm_f64_trunc, double, "sse4.1",
+             WAQ_ROUND_F64(x, _MM_FROUND_TO_ZERO), trunc(x))
+WAQ_DISPATCH(double, __wasm_f64_nearest, double, "sse4.1",
+             WAQ_ROUND_F64(x, _MM_FROUND_TO_NEAREST_INT), nearbyint(x))
+
+#elif defined(__aarch64__)
+/* frintn rounds ties to even regardless of FPCR, as WASM nearest requires */
+#define WAQ_A64_UNARY(name, type, insn, reg) \
+    type name(type x) { \
+        type r; \
+        __asm__(insn " %" reg "0, %" reg "1" : "=w"(r) : "w"(x)); \
+        return r; \
+    }
+
+WAQ_A64_UNARY(__wasm_f32_ceil, float, "frintp", "s")
+WAQ_A64_UNARY(__wasm_f32_floor, float, "frintm", "s")
+WAQ_A64_UNARY(__wasm_f32_trunc, float, "frintz", "s")
+WAQ_A64_UNARY(__wasm_f32_nearest, float, "frintn", "s")
+WAQ_A64_UNARY(__wasm_f32_sqrt, float, "fsqrt", "s")
+WAQ_A64_UNARY(__wasm_f64_ceil, double, "frintp", "d")
+WAQ_A64_UNARY(__wasm_f64_floor, double, "frintm", "d")
+WAQ_A64_UNARY(__wasm_f64_trunc, double, "frintz", "d")
+WAQ_A64_UNARY(__wasm_f64_nearest, double, "frintn", "d")
+WAQ_A64_UNARY(__wasm_f64_sqrt, double, "fsqrt", "d")
+
+#else
+float __wasm_f32_ceil(float x) { return ceilf(x); }
+float __wasm_f32_floor(float x) { return floorf(x); }
+float __wasm_f32_trunc(float x) { return truncf(x); }
+float __wasm_f32_nearest(float x) { return nearbyintf(x); }
+
+double __wasm_f64_ceil(double x) { return ceil(x); }
+double __wasm_f64_floor(double x) { return floor(x); }
+double __wasm_f64_trunc(double x) { return trunc(x); }
+double __wasm_f64_nearest(double x) { return nearbyint(x); }
+#endif
+
+#if !defined(__x86_64__) && !defined(__aarch64__)
+float __wasm_f32_sqrt(float x) { return sqrtf(x); }
+double __wasm_f64_sqrt(double x) { return sqrt(x); }
+#endif
+
+/* ============================================================================
+ * SATURATING TRUNCATION
+ * ============================================================================
+ * NaN converts to 0 and out-of-range values clamp to the integer range.
+ * waq.runtime.il has IL versions that --lto inlines; keep the two in step.
+ */
+
+int32_t __wasm_i32_trunc_sat_f32_s(float x) {
+    if (isnan(x)) return 0;
+    if (x >= (float)INT32_MAX) return INT32_MAX;
+    if (x <= (float)INT32_MIN) return INT32_MIN;
+    return (int32_t)x;
 }
 
-double __wasm_f64_max(double a, double b) {
-    if (isnan(a) || isnan(b)) return NAN;
-    return fmax(a, b);
+uint32_t __wasm_i32_trunc_sat_f32_u(float x) {
+    if (isnan(x) || x <= 0.0f) return 0;
+    if (x >= (float)UINT32_MAX) return UINT32_MAX;
+    return (uint32_t)x;
 }
 
-double __wasm_f64_copysign(double a, double b) {
-    return copysign(a, b);
+int32_t __wasm_i32_trunc_sat_f64_s(double x) {
+    if (isnan(x)) return 0;
+    if (x >= (double)INT32_MAX) return INT32_MAX;
+    if (x <= (double)INT32_MIN) return INT32_MIN;
+    return (int32_t)x;
 }
 
-/* Trap handlers */
+uint32_t __wasm_i32_trunc_sat_f64_u(double x) {
+    if (isnan(x) || x <= 0.0) return 0;
+    if (x >= (double)UINT32_MAX) return UINT32_MAX;
+    return (uint32_t)x;
+}
 
-void __wasm_trap_unreachable(void) {
-    fprintf(stderr, "wasm trap: unreachable\n");
+int64_t __wasm_i64_trunc_sat_f32_s(float x) {
+    if (isnan(x)) return 0;
+    if (x >= (float)INT64_MAX) return INT64_MAX;
+    if (x <= (float)INT64_MIN) return INT64_MIN;
+    return (int64_t)x;
+}
+
+uint64_t __wasm_i64_trunc_sat_f32_u(float x) {
+    if (isnan(x) || x <= 0.0f) return 0;
+    if (x >= (float)UINT64_MAX) return UINT64_MAX;
+    return (uint64_t)x;
+}
+
+int64_t __wasm_i64_trunc_sat_f64_s(double x) {
+    if (isnan(x)) return 0;
+    if (x >= (double)INT64_MAX) return INT64_MAX;
+    if (x <= (double)INT64_MIN) return INT64_MIN;
+    return (int64_t)x;
+}
+
+uint64_t __wasm_i64_trunc_sat_f64_u(double x) {
+    if (isnan(x) || x <= 0.0) return 0;
+    if (x >= (double)UINT64_MAX) return UINT64_MAX;
+    return (uint64_t)x;
+}
+
+/* ============================================================================
+ * TRAPS AND THE INSTANCE BOUNDARY
+ * ============================================================================
+ * Without a boundary a trap prints its message and aborts the process.
+ * Inside __wasm_invoke() a trap instead unwinds to the boundary, which returns
+ * the trap code; the host can then call __wasm_instance_reset() followed by
+ * __wasm_memory_init() and keep using the process.
+ */
+
+#include <setjmp.h>
+#include <signal.h>
+
+/* Trap codes returned by __wasm_invoke() */
+enum {
+    WASM_TRAP_NONE = 0,
+    WASM_TRAP_UNREACHABLE,
+    WASM_TRAP_DIV_BY_ZERO,
+    WASM_TRAP_INTEGER_OVERFLOW,
+    WASM_TRAP_INVALID_CONVERSION,
+    WASM_TRAP_OUT_OF_BOUNDS,
+    WASM_TRAP_NULL_REFERENCE,
+    WASM_TRAP_CAST_FAILURE,
+    WASM_TRAP_UNCAUGHT_EXCEPTION,
+    WASM_TRAP_OUT_OF_MEMORY,
+    WASM_TRAP_MEMORY_FAULT,  /* SIGSEGV/SIGBUS, e.g. stack overflow */
+    WASM_TRAP_UNDEFINED_ELEMENT,
+    WASM_TRAP_UNINITIALIZED_ELEMENT,
+    WASM_TRAP_INDIRECT_CALL_MISMATCH,
+    WASM_TRAP_COUNT
+};
+
+static const char *const __wasm_trap_messages[WASM_TRAP_COUNT] = {
+    [WASM_TRAP_NONE] = "no trap",
+    [WASM_TRAP_UNREACHABLE] = "unreachable",
+    [WASM_TRAP_DIV_BY_ZERO] = "integer divide by zero",
+    [WASM_TRAP_INTEGER_OVERFLOW] = "integer overflow",
+    [WASM_TRAP_INVALID_CONVERSION] = "invalid conversion to integer",
+    [WASM_TRAP_OUT_OF_BOUNDS] = "out of bounds memory access",
+    [WASM_TRAP_NULL_REFERENCE] = "null reference",
+    [WASM_TRAP_CAST_FAILURE] = "cast failure",
+    [WASM_TRAP_UNCAUGHT_EXCEPTION] = "uncaught exception",
+    [WASM_TRAP_OUT_OF_MEMORY] = "out of memory",
+    [WASM_TRAP_MEMORY_FAULT] = "memory fault",
+    [WASM_TRAP_UNDEFINED_ELEMENT] = "undefined element",
+    [WASM_TRAP_UNINITIALIZED_ELEMENT] = "uninitialized element",
+    [WASM_TRAP_INDIRECT_CALL_MISMATCH] = "indirect call type mismatch",
+};
+
+const char *__wasm_trap_message(int32_t code) {
+    if (code < 0 || code >= WASM_TRAP_COUNT) return "unknown trap";
+    return __wasm_trap_messages[code];
+}
+
+/* One active __wasm_invoke() call; boundaries nest */
+typedef struct WasmTrapBoundary {
+    sigjmp_buf env;
+    struct WasmTrapBoundary *prev;
+    void *handlers;  /* Exception handler stack on entry */
+} WasmTrapBoundary;
+
+static __thread WasmTrapBoundary *__wasm_trap_boundary = NULL;
+
+static void __wasm_trap(int32_t code) __attribute__((noreturn));
+static void __wasm_trap(int32_t code) {
+    if (__wasm_trap_boundary) {
+        siglongjmp(__wasm_trap_boundary->env, code);
+    }
+    fprintf(stderr, "wasm trap: %s\n", __wasm_trap_message(code));
     abort();
 }
 
+void __wasm_trap_unreachable(void) {
+    __wasm_trap(WASM_TRAP_UNREACHABLE);
+}
+
 void __wasm_trap_div_by_zero(void) {
-    fprintf(stderr, "wasm trap: integer divide by zero\n");
-    abort();
+    __wasm_trap(WASM_TRAP_DIV_BY_ZERO);
 }
 
 void __wasm_trap_integer_overflow(void) {
-    fprintf(stderr, "wasm trap: integer overflow\n");
-    abort();
+    __wasm_trap(WASM_TRAP_INTEGER_OVERFLOW);
 }
 
 void __wasm_trap_invalid_conversion(void) {
-    fprintf(stderr, "wasm trap: invalid conversion to integer\n");
-    abort();
+    __wasm_trap(WASM_TRAP_INVALID_CONVERSION);
 }
 
 void __wasm_trap_out_of_bounds(void) {
-    fprintf(stderr, "wasm trap: out of bounds memory access\n");
-    abort();
+    __wasm_trap(WASM_TRAP_OUT_OF_BOUNDS);
+}
+
+/* call_indirect index past the end of the table */
+void __wasm_trap_undefined_element(void) {
+    __wasm_trap(WASM_TRAP_UNDEFINED_ELEMENT);
+}
+
+/* call_indirect signature check failed; sig is the slot's id (0 = null) */
+void __wasm_trap_indirect_call(uint32_t sig) {
+    __wasm_trap(sig == 0 ? WASM_TRAP_UNINITIALIZED_ELEMENT
+                         : WASM_TRAP_INDIRECT_CALL_MISMATCH);
 }
 
 /* Memory operations */
@@ -342,11 +571,20 @@ void __wasm_runtime_cleanup(void) {
 /* Table support */
 #define WASM_MAX_TABLE_SIZE 65536
 
+/* A table slot: the code pointer and the canonical signature id of its
+ * function type, assigned by the compiler.  call_indirect compares the id
+ * inline; null slots have id 0, which no signature uses. */
+typedef struct {
+    void *code;
+    uint32_t sig;
+} WasmTableEntry;
+
 /* Exported table pointer - accessed by compiled WASM code */
-void **__wasm_table = NULL;
+WasmTableEntry *__wasm_table = NULL;
 uint32_t __wasm_table_size = 0;
 
-int32_t __wasm_table_grow(int32_t delta, void *init_val) {
+int32_t __wasm_table_grow(int32_t table, void *init_val, uint32_t sig, int32_t delta) {
+    (void)table;
     if (delta < 0) return -1;
 
     uint32_t old_size = __wasm_table_size;
@@ -361,14 +599,15 @@ int32_t __wasm_table_grow(int32_t delta, void *init_val) {
     if (new_size > WASM_MAX_TABLE_SIZE) return -1;
 
     /* Check for allocation size overflow */
-    if (new_size > SIZE_MAX / sizeof(void *)) return -1;
+    if (new_size > SIZE_MAX / sizeof(WasmTableEntry)) return -1;
 
-    void **new_table = realloc(__wasm_table, new_size * sizeof(void *));
+    WasmTableEntry *new_table = realloc(__wasm_table, new_size * sizeof(WasmTableEntry));
     if (new_table == NULL && new_size > 0) return -1;
 
     /* Initialize new entries */
     for (uint32_t i = old_size; i < new_size; i++) {
-        new_table[i] = init_val;
+        new_table[i].code = init_val;
+        new_table[i].sig = sig;
     }
 
     __wasm_table = new_table;
@@ -377,160 +616,164 @@ int32_t __wasm_table_grow(int32_t delta, void *init_val) {
     return (int32_t)old_size;
 }
 
-int32_t __wasm_table_size_op(void) {
+int32_t __wasm_table_size_op(int32_t table) {
+    (void)table;
     return (int32_t)__wasm_table_size;
 }
 
-void *__wasm_table_get(int32_t idx) {
+/* Only table 0 exists; the index is part of the call ABI for later tables */
+void *__wasm_table_get(int32_t table, int32_t idx) {
+    (void)table;
     if (idx < 0 || (uint32_t)idx >= __wasm_table_size) {
         __wasm_trap_out_of_bounds();
     }
-    return __wasm_table[idx];
+    return __wasm_table[idx].code;
 }
 
-void __wasm_table_set(int32_t idx, void *val) {
+void __wasm_table_set(int32_t table, int32_t idx, void *val, uint32_t sig) {
+    (void)table;
     if (idx < 0 || (uint32_t)idx >= __wasm_table_size) {
         __wasm_trap_out_of_bounds();
     }
-    __wasm_table[idx] = val;
+    __wasm_table[idx].code = val;
+    __wasm_table[idx].sig = sig;
 }
 
 /* ============================================================================
  * EXCEPTION HANDLING (WASM 3.0)
  * ============================================================================
  * Uses setjmp/longjmp for stack unwinding.
+ *
+ * Compiled code arms each try itself:
+ *
+ *     frame = __wasm_push_exception_handler(payload);
+ *     code  = _setjmp(frame);      // 0 on entry, tag + 1 on delivery
+ *
+ * so the jump buffer always describes a live frame.  The payload buffer is
+ * owned by the catching function (one 8-byte slot per value, sized by the
+ * compiler for the module's largest tag).  A throw writes its values straight
+ * into the innermost handler's buffer via __wasm_exception_payload() and then
+ * calls __wasm_throw(); the runtime never stages or bounds the payload.
+ * Delivering an exception pops the handler it lands in.
  */
 
-#include <setjmp.h>
-
-/* Maximum exception payload size */
-#define WASM_EXCEPTION_PAYLOAD_MAX 64
-
-/* Exception data structure */
-typedef struct {
-    uint32_t tag_index;
-    uint8_t payload[WASM_EXCEPTION_PAYLOAD_MAX];
-    size_t payload_size;
-} WasmException;
-
 /* Exception handler frame */
 typedef struct WasmExceptionFrame {
-    jmp_buf env;
+    jmp_buf env;  /* Must stay first: compiled code passes the frame to _setjmp */
     struct WasmExceptionFrame *prev;
-    WasmException exception;
-    int caught;
+    uint8_t *payload;  /* Handler-owned payload slots */
 } WasmExceptionFrame;
 
-/* Thread-local exception handler stack */
+/* Thread-local handler stack, plus a free list so try entry avoids malloc */
 static __thread WasmExceptionFrame *__wasm_exception_stack = NULL;
-static __thread WasmException __wasm_current_exception;
+static __thread WasmExceptionFrame *__wasm_exception_free = NULL;
 
-/* Push a new exception handler frame */
-int32_t __wasm_push_exception_handler(void) {
-    /* Allocate frame on heap (could optimize with stack allocation) */
-    WasmExceptionFrame *frame = malloc(sizeof(WasmExceptionFrame));
-    if (!frame) {
-        fprintf(stderr, "wasm trap: out of memory for exception handler\n");
-        abort();
+/* Push a new exception handler frame; the caller must _setjmp() on it */
+void *__wasm_push_exception_handler(void *payload) {
+    WasmExceptionFrame *frame = __wasm_exception_free;
+    if (frame) {
+        __wasm_exception_free = frame->prev;
+    } else {
+        frame = malloc(sizeof(WasmExceptionFrame));
+        if (!frame) {
+            __wasm_trap(WASM_TRAP_OUT_OF_MEMORY);
+        }
     }
     frame->prev = __wasm_exception_stack;
-    frame->caught = 0;
+    frame->payload = payload;
     __wasm_exception_stack = frame;
-
-    /* Return result of setjmp (0 = normal, non-zero = exception caught) */
-    if (setjmp(frame->env) != 0) {
-        /* Exception was caught - copy exception data */
-        __wasm_current_exception = frame->exception;
-        return 1;
-    }
-    return 0;
+    return frame;
 }
 
 /* Pop the current exception handler */
 void __wasm_pop_exception_handler(void) {
-    if (__wasm_exception_stack) {
-        WasmExceptionFrame *frame = __wasm_exception_stack;
+    WasmExceptionFrame *frame = __wasm_exception_stack;
+    if (frame) {
         __wasm_exception_stack = frame->prev;
-        free(frame);
+        frame->prev = __wasm_exception_free;
+        __wasm_exception_free = frame;
     }
 }
 
-/* Throw an exception with the given tag */
-void __wasm_throw(int32_t tag_index) {
-    if (!__wasm_exception_stack) {
-        fprintf(stderr, "wasm trap: uncaught exception (tag %d)\n", tag_index);
-        abort();
+/* Innermost handler, or trap if the exception is uncaught.  Handlers pushed
+ * outside the current instance boundary never catch. */
+static WasmExceptionFrame *__wasm_exception_target(int32_t tag_index) {
+    void *outside = __wasm_trap_boundary ? __wasm_trap_boundary->handlers : NULL;
+    if (__wasm_exception_stack == outside) {
+        if (!__wasm_trap_boundary) {
+            fprintf(stderr, "wasm trap: uncaught exception (tag %d)\n", tag_index);
+            abort();
+        }
+        __wasm_trap(WASM_TRAP_UNCAUGHT_EXCEPTION);
     }
-
-    WasmExceptionFrame *frame = __wasm_exception_stack;
-    frame->exception.tag_index = tag_index;
-    frame->exception.payload_size = 0;
-    frame->caught = 1;
-
-    longjmp(frame->env, 1);
+    return __wasm_exception_stack;
 }
 
-/* Throw an exception with payload */
-void __wasm_throw_with_payload(int32_t tag_index, void *payload, size_t size) {
-    if (!__wasm_exception_stack) {
-        fprintf(stderr, "wasm trap: uncaught exception (tag %d)\n", tag_index);
-        abort();
-    }
+/* Pop the target handler and resume at its _setjmp with tag + 1 */
+static void __wasm_exception_deliver(WasmExceptionFrame *frame, int32_t tag_index)
+    __attribute__((noreturn));
+static void __wasm_exception_deliver(WasmExceptionFrame *frame, int32_t tag_index) {
+    __wasm_exception_stack = frame->prev;
+    frame->prev = __wasm_exception_free;
+    __wasm_exception_free = frame;
+    _longjmp(frame->env, tag_index + 1);
+}
 
-    WasmExceptionFrame *frame = __wasm_exception_stack;
-    frame->exception.tag_index = tag_index;
-    if (size > WASM_EXCEPTION_PAYLOAD_MAX) {
-        size = WASM_EXCEPTION_PAYLOAD_MAX;
-    }
-    if (payload && size > 0) {
-        memcpy(frame->exception.payload, payload, size);
-    }
-    frame->exception.payload_size = size;
-    frame->caught = 1;
+/* Payload slots of the handler that will receive the next throw */
+void *__wasm_exception_payload(int32_t tag_index) {
+    return __wasm_exception_target(tag_index)->payload;
+}
 
-    longjmp(frame->env, 1);
+/* Throw an exception; its payload is already in the handler's slots */
+void __wasm_throw(int32_t tag_index) {
+    __wasm_exception_deliver(__wasm_exception_target(tag_index), tag_index);
 }
 
-/* Rethrow the current exception */
-void __wasm_rethrow(void) {
-    if (!__wasm_exception_stack) {
-        fprintf(stderr, "wasm trap: rethrow without exception\n");
-        abort();
+/* Re-deliver a caught exception to the (new) innermost handler */
+void __wasm_rethrow(int32_t tag_index, void *payload, int64_t size) {
+    WasmExceptionFrame *frame = __wasm_exception_target(tag_index);
+    if (size > 0 && payload != frame->payload) {
+        memmove(frame->payload, payload, (size_t)size);
     }
+    __wasm_exception_deliver(frame, tag_index);
+}
 
-    /* Find the previous handler and throw to it */
-    WasmExceptionFrame *current = __wasm_exception_stack;
-    WasmException exc = current->exception;
-
-    /* Pop current handler */
-    __wasm_exception_stack = current->prev;
-    free(current);
-
-    if (!__wasm_exception_stack) {
-        fprintf(stderr, "wasm trap: uncaught rethrown exception (tag %u)\n", exc.tag_index);
-        abort();
+/* A caught exception as a first-class value (exnref).  Like GC objects these
+ * are never freed. */
+typedef struct {
+    int32_t tag_index;
+    int32_t size;
+    uint8_t payload[];
+} WasmExnRef;
+
+/* Box an exception; copies ``size`` payload bytes unless payload is NULL */
+void *__wasm_exn_new(int32_t tag_index, void *payload, int64_t size) {
+    WasmExnRef *exn = malloc(sizeof(WasmExnRef) + (size_t)size);
+    if (!exn) {
+        __wasm_trap(WASM_TRAP_OUT_OF_MEMORY);
+    }
+    exn->tag_index = tag_index;
+    exn->size = (int32_t)size;
+    if (payload && size > 0) {
+        memcpy(exn->payload, payload, (size_t)size);
     }
-
-    /* Throw to the outer handler */
-    __wasm_exception_stack->exception = exc;
-    __wasm_exception_stack->caught = 1;
-    longjmp(__wasm_exception_stack->env, 1);
+    return exn;
 }
 
-/* Get the current exception reference */
-void *__wasm_get_exception(void) {
-    return &__wasm_current_exception;
+/* Payload slots of a boxed exception */
+void *__wasm_exn_payload(void *exn) {
+    return ((WasmExnRef *)exn)->payload;
 }
 
-/* Get the tag index of the current exception */
-int32_t __wasm_get_exception_tag(void) {
-    return (int32_t)__wasm_current_exception.tag_index;
+/* throw_ref: re-deliver a boxed exception */
+void __wasm_throw_ref(void *ref) {
+    WasmExnRef *exn = ref;
+    if (!exn) {
+        __wasm_trap(WASM_TRAP_NULL_REFERENCE);
+    }
+    __wasm_rethrow(exn->tag_index, exn->payload, exn->size);
 }
 
-/* Get pointer to exception payload */
-void *__wasm_get_exception_payload(void) {
-    return __wasm_current_exception.payload;
-}
 
 /* ============================================================================
  * GARBAGE COLLECTION (WASM GC)
@@ -559,8 +802,7 @@ void __wasm_gc_init(void) {
     if (!__wasm_gc_heap) {
         __wasm_gc_heap = malloc(WASM_GC_HEAP_SIZE);
         if (!__wasm_gc_heap) {
-            fprintf(stderr, "wasm trap: failed to initialize GC heap\n");
-            abort();
+            __wasm_trap(WASM_TRAP_OUT_OF_MEMORY);
         }
         __wasm_gc_heap_ptr = 0;
         __wasm_gc_heap_size = WASM_GC_HEAP_SIZE;
@@ -581,8 +823,7 @@ void *__wasm_gc_alloc(size_t size) {
         size_t new_size = __wasm_gc_heap_size * 2;
         uint8_t *new_heap = realloc(__wasm_gc_heap, new_size);
         if (!new_heap) {
-            fprintf(stderr, "wasm trap: GC heap exhausted\n");
-            abort();
+            __wasm_trap(WASM_TRAP_OUT_OF_MEMORY);
         }
         __wasm_gc_heap = new_heap;
         __wasm_gc_heap_size = new_size;
@@ -715,12 +956,10 @@ int32_t __wasm_ref_test_null(int64_t ref, int32_t type_idx) {
 int64_t __wasm_ref_cast(int64_t ref, int32_t type_idx) {
     if (ref == 0) {
         /* null cast to non-nullable type traps */
-        fprintf(stderr, "wasm trap: null reference in ref.cast\n");
-        abort();
+        __wasm_trap(WASM_TRAP_NULL_REFERENCE);
     }
     if (!__wasm_ref_test(ref, type_idx)) {
-        fprintf(stderr, "wasm trap: ref.cast failed (expected type %d)\n", type_idx);
-        abort();
+        __wasm_trap(WASM_TRAP_CAST_FAILURE);
     }
     return ref;
 }
@@ -729,22 +968,19 @@ int64_t __wasm_ref_cast(int64_t ref, int32_t type_idx) {
 int64_t __wasm_ref_cast_null(int64_t ref, int32_t type_idx) {
     if (ref == 0) return 0;  /* null is ok for nullable */
     if (!__wasm_ref_test(ref, type_idx)) {
-        fprintf(stderr, "wasm trap: ref.cast failed (expected type %d)\n", type_idx);
-        abort();
+        __wasm_trap(WASM_TRAP_CAST_FAILURE);
     }
     return ref;
 }
 
 /* Null reference trap */
 void __wasm_trap_null_reference(void) {
-    fprintf(stderr, "wasm trap: null reference\n");
-    abort();
+    __wasm_trap(WASM_TRAP_NULL_REFERENCE);
 }
 
 /* Cast failure trap */
 void __wasm_trap_cast_failure(void) {
-    fprintf(stderr, "wasm trap: cast failure\n");
-    abort();
+    __wasm_trap(WASM_TRAP_CAST_FAILURE);
 }
 
 /* ============================================================================
@@ -848,15 +1084,16 @@ void __wasm_table_copy(int32_t dest_table, int32_t src_table, int32_t dest, int3
     (void)dest_table;
     (void)src_table;
     if (!__wasm_table) return;
-    memmove(&__wasm_table[dest], &__wasm_table[src], len * sizeof(void *));
+    memmove(&__wasm_table[dest], &__wasm_table[src], len * sizeof(WasmTableEntry));
 }
 
-void __wasm_table_fill(int32_t table_idx, int32_t dest, void *val, int32_t len) {
+void __wasm_table_fill(int32_t table_idx, int32_t dest, void *val, uint32_t sig, int32_t len) {
     (void)table_idx;
     if (!__wasm_table) return;
     for (int32_t i = 0; i < len; i++) {
         if ((uint32_t)(dest + i) < __wasm_table_size) {
-            __wasm_table[dest + i] = val;
+            __wasm_table[dest + i].code = val;
+            __wasm_table[dest + i].sig = sig;
         }
     }
 }
@@ -866,6 +1103,210 @@ void __wasm_elem_drop(int32_t elem_idx) {
     /* TODO: Mark element segment as dropped */
 }
 
+/* ============================================================================
+ * INSTANCE BOUNDARY
+ * ============================================================================
+ * __wasm_invoke() runs entry(arg) - typically a host thunk that calls one
+ * export - and returns WASM_TRAP_NONE, or the trap code if it trapped.
+ * Hardware faults (SIGFPE, SIGSEGV, SIGBUS) inside the boundary are reported
+ * the same way; an alternate signal stack lets stack overflow be caught too.
+ * Faults outside any boundary go to the handlers the host had installed
+ * before the first call, and a thread that already has an alternate signal
+ * stack keeps it.
+ *
+ * A trap leaves memory, tables and globals in whatever state the export got
+ * them to.  To serve the next request from a clean instance:
+ *
+ *     if (__wasm_invoke(thunk, &req) != 0) {
+ *         __wasm_instance_reset();
+ *         __wasm_memory_init();
+ *     }
+ */
+
+#define WASM_SIGNAL_STACK_SIZE (64 * 1024)
+
+static __thread void *__wasm_signal_stack = NULL;
+
+/* The signals we take over, and the actions the host had for them; faults
+ * outside a boundary go to those */
+static const int __wasm_fault_signals[] = {SIGFPE, SIGSEGV, SIGBUS};
+static struct sigaction __wasm_host_actions[3];
+
+static struct sigaction *__wasm_host_action(int sig) {
+    for (int i = 0; i < 3; i++) {
+        if (__wasm_fault_signals[i] == sig) return &__wasm_host_actions[i];
+    }
+    return NULL;
+}
+
+/* Hand a fault that is not ours to the host: call its handler, or put its
+ * action back and raise the signal again (a default action then kills the
+ * process as it would have without the runtime) */
+static void __wasm_chain_fault(int sig, siginfo_t *info, void *uctx) {
+    struct sigaction *host = __wasm_host_action(sig);
+    if (host->sa_flags & SA_SIGINFO) {
+        host->sa_sigaction(sig, info, uctx);
+    } else if (host->sa_handler != SIG_DFL && host->sa_handler != SIG_IGN) {
+        host->sa_handler(sig);
+    } else {
+        sigaction(sig, host, NULL);
+        raise(sig);
+    }
+}
+
+static void __wasm_fault_handler(int sig, siginfo_t *info, void *uctx) {
+    if (!__wasm_trap_boundary) {
+        __wasm_chain_fault(sig, info, uctx);
+        return;
+    }
+    int32_t code = WASM_TRAP_MEMORY_FAULT;
+    if (sig == SIGFPE) {
+        code = info->si_code == FPE_INTOVF ? WASM_TRAP_INTEGER_OVERFLOW
+                                           : WASM_TRAP_DIV_BY_ZERO;
+    }
+    siglongjmp(__wasm_trap_boundary->env, code);
+}
+
+/* Install the fault handlers, keeping the host's to chain to, and give this
+ * thread an alternate signal stack unless the host already gave it one */
+static void __wasm_install_fault_handlers(void) {
+    static int installed = 0;
+    if (!__wasm_signal_stack) {
+        stack_t current;
+        if (sigaltstack(NULL, &current) == 0 && !(current.ss_flags & SS_DISABLE)) {
+            __wasm_signal_stack = current.ss_sp;
+        } else {
+            stack_t ss;
+            ss.ss_sp = malloc(WASM_SIGNAL_STACK_SIZE);
+            ss.ss_size = WASM_SIGNAL_STACK_SIZE;
+            ss.ss_flags = 0;
+            if (ss.ss_sp && sigaltstack(&ss, NULL) == 0) {
+                __wasm_signal_stack = ss.ss_sp;
+            } else {
+                free(ss.ss_sp);
+            }
+        }
+    }
+    if (!installed) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = __wasm_fault_handler;
+        sa.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_NODEFER;
+        sigemptyset(&sa.sa_mask);
+        for (int i = 0; i < 3; i++) {
+            sigaction(__wasm_fault_signals[i], &sa, &__wasm_host_actions[i]);
+        }
+        installed = 1;
+    }
+}
+
+int32_t __wasm_invoke(void (*entry)(void *), void *arg) {
+    WasmTrapBoundary boundary;
+    __wasm_install_fault_handlers();
+    boundary.prev = __wasm_trap_boundary;
+    boundary.handlers = __wasm_exception_stack;
+
+    /* Restore the signal mask too: a fault handler may be the one unwinding */
+    int32_t code = sigsetjmp(boundary.env, 1);
+    if (code == 0) {
+        __wasm_trap_boundary = &boundary;
+        entry(arg);
+    } else {
+        /* Drop the handlers of try blocks the trap unwound through */
+        while (__wasm_exception_stack != boundary.handlers) {
+            __wasm_pop_exception_handler();
+        }
+    }
+    __wasm_trap_boundary = boundary.prev;
+    return code;
+}
+
+/* Release memory, tables and GC objects so __wasm_memory_init() can
+ * instantiate the module again */
+void __wasm_instance_reset(void) {
+    __wasm_runtime_cleanup();
+    free(__wasm_table);
+    __wasm_table = NULL;
+    __wasm_table_size = 0;
+    __wasm_gc_heap_ptr = 0;
+    for (int i = 0; i < __wasm_data_segment_count; i++) {
+        __wasm_data_segments[i].dropped = 0;
+    }
+}
+
+/* ============================================================================
+ * PROFILE-GUIDED OPTIMIZATION
+ * ============================================================================
+ * A module compiled with --instrument=pgo counts block executions, branch
+ * directions and indirect call targets in one array of 64-bit counters,
+ * each described by a line of a names string (see waq.compiler.profile).
+ * At exit they are written to $WAQ_PROFILE_FILE, or default.waqprof, for
+ * waq --profile-use.
+ */
+
+#define WASM_PROF_SITE_TARGETS 4
+#define WASM_PROF_SITE_SLOTS (2 * WASM_PROF_SITE_TARGETS + 1)
+
+static uint64_t *__wasm_prof_counters_at = NULL;
+static const char *__wasm_prof_names_at = NULL;
+
+/* Count a call through table index idx at an indirect call site.  The site
+ * holds (idx + 1, calls) pairs for the first four indices seen, then the
+ * calls to any other index. */
+void __wasm_prof_icall(uint64_t *site, uint32_t idx) {
+    uint64_t key = (uint64_t)idx + 1;
+    for (int i = 0; i < WASM_PROF_SITE_TARGETS; i++) {
+        if (site[2 * i] == key || site[2 * i] == 0) {
+            site[2 * i] = key;
+            site[2 * i + 1]++;
+            return;
+        }
+    }
+    site[2 * WASM_PROF_SITE_TARGETS]++;
+}
+
+static void __wasm_prof_write(void) {
+    const char *path = getenv("WAQ_PROFILE_FILE");
+    if (!path || !*path) {
+        path = "default.waqprof";
+    }
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "waq: cannot write profile %s\n", path);
+        return;
+    }
+    fprintf(out, "waqprof 1\n");
+    const uint64_t *counter = __wasm_prof_counters_at;
+    for (const char *line = __wasm_prof_names_at; *line; ) {
+        const char *end = strchr(line, '\n');
+        int len = (int)(end - line);
+        if (line[0] == 'i') {
+            for (int i = 0; i < WASM_PROF_SITE_TARGETS; i++) {
+                if (counter[2 * i]) {
+                    fprintf(out, "%.*s\t%llu\t%llu\n", len, line,
+                            (unsigned long long)(counter[2 * i] - 1),
+                            (unsigned long long)counter[2 * i + 1]);
+                }
+            }
+            counter += WASM_PROF_SITE_SLOTS;
+        } else {
+            fprintf(out, "%.*s\t%llu\n", len, line, (unsigned long long)*counter);
+            counter++;
+        }
+        line = end + 1;
+    }
+    fclose(out);
+}
+
+/* Called by __wasm_memory_init of an instrumented module */
+void __wasm_prof_register(uint64_t *counters, const char *names) {
+    if (!__wasm_prof_counters_at) {
+        atexit(__wasm_prof_write);
+    }
+    __wasm_prof_counters_at = counters;
+    __wasm_prof_names_at = names;
+}
+
 /* ============================================================================
  * WASI (WebAssembly System Interface) Preview 1
  * ============================================================================
@@ -1779,10 +2220,18 @@ double __wasm_f64_max_deterministic(double a, double b) {
 }
 
 /* ============================================================================
- * RELAXED SIMD - SCALAR FALLBACK
+ * SIMD128
  * ============================================================================
- * QBE has no SIMD support, so we implement v128 operations with scalar code.
- * All v128 values are passed by reference (pointer to 16-byte aligned memory).
+ * QBE has no vector types: the compiler keeps each v128 value in a 16-byte
+ * stack slot and calls these kernels with the address of the result slot
+ * and of the operands.  Operands are read before the result is written, so
+ * the result may be one of them.  Slots are 16-byte aligned, but v128
+ * globals and host buffers need not be, so kernels go through memcpy.
+ *
+ * Kernels are written with GCC vector extensions, which compile to SSE2 on
+ * x86-64 and NEON on AArch64, with intrinsics where an instruction does
+ * more than the extensions express (saturation, narrowing, rounding).
+ * Those that gain from SSE4.1 are dispatched like the scalar helpers above.
  */
 
 typedef union {
@@ -1798,209 +2247,862 @@ typedef union {
     double   f64[2];
 } v128_t;
 
-/* ---- Lane Selection and Swizzle ---- */
+/* Where a function leaves its v128 first result for the caller to copy;
+ * one per thread, like the trap boundary and the exception stack */
+static __thread v128_t waq_v128_result;
+
+v128_t *__wasm_v128_result(void) {
+    return &waq_v128_result;
+}
+
+typedef int8_t   waq_i8x16 __attribute__((vector_size(16)));
+typedef uint8_t  waq_u8x16 __attribute__((vector_size(16)));
+typedef int16_t  waq_i16x8 __attribute__((vector_size(16)));
+typedef uint16_t waq_u16x8 __attribute__((vector_size(16)));
+typedef int32_t  waq_i32x4 __attribute__((vector_size(16)));
+typedef uint32_t waq_u32x4 __attribute__((vector_size(16)));
+typedef int64_t  waq_i64x2 __attribute__((vector_size(16)));
+typedef uint64_t waq_u64x2 __attribute__((vector_size(16)));
+typedef float    waq_f32x4 __attribute__((vector_size(16)));
+typedef double   waq_f64x2 __attribute__((vector_size(16)));
+
+/* Low halves, for widening */
+typedef int8_t   waq_i8x8 __attribute__((vector_size(8)));
+typedef uint8_t  waq_u8x8 __attribute__((vector_size(8)));
+typedef int16_t  waq_i16x4 __attribute__((vector_size(8)));
+typedef uint16_t waq_u16x4 __attribute__((vector_size(8)));
+typedef int32_t  waq_i32x2 __attribute__((vector_size(8)));
+typedef uint32_t waq_u32x2 __attribute__((vector_size(8)));
+typedef float    waq_f32x2 __attribute__((vector_size(8)));
 
-void __wasm_i8x16_relaxed_swizzle(v128_t *result, v128_t *a, v128_t *s) {
-    for (int i = 0; i < 16; i++) {
-        int idx = s->u8[i];
-        /* Relaxed: undefined for idx >= 16, we just mask */
-        result->i8[i] = a->i8[idx & 15];
-    }
-}
+typedef union {
+    waq_i8x16 i8;
+    waq_u8x16 u8;
+    waq_i16x8 i16;
+    waq_u16x8 u16;
+    waq_i32x4 i32;
+    waq_u32x4 u32;
+    waq_i64x2 i64;
+    waq_u64x2 u64;
+    waq_f32x4 f32;
+    waq_f64x2 f64;
+#if defined(__x86_64__)
+    __m128i m;
+    __m128 mf;
+    __m128d md;
+#endif
+} waq_v128;
 
-void __wasm_i8x16_relaxed_laneselect(v128_t *result, v128_t *a, v128_t *b, v128_t *m) {
-    for (int i = 0; i < 16; i++) {
-        result->i8[i] = (m->i8[i] & 0x80) ? b->i8[i] : a->i8[i];
-    }
-}
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
-void __wasm_i16x8_relaxed_laneselect(v128_t *result, v128_t *a, v128_t *b, v128_t *m) {
-    for (int i = 0; i < 8; i++) {
-        result->i16[i] = (m->i16[i] < 0) ? b->i16[i] : a->i16[i];
-    }
+static inline waq_v128 waq_v128_load(const v128_t *p) {
+    waq_v128 v;
+    memcpy(&v, p, 16);
+    return v;
 }
 
-void __wasm_i32x4_relaxed_laneselect(v128_t *result, v128_t *a, v128_t *b, v128_t *m) {
-    for (int i = 0; i < 4; i++) {
-        result->i32[i] = (m->i32[i] < 0) ? b->i32[i] : a->i32[i];
-    }
+static inline void waq_v128_store(v128_t *p, waq_v128 v) {
+    memcpy(p, &v, 16);
 }
 
-void __wasm_i64x2_relaxed_laneselect(v128_t *result, v128_t *a, v128_t *b, v128_t *m) {
-    for (int i = 0; i < 2; i++) {
-        result->i64[i] = (m->i64[i] < 0) ? b->i64[i] : a->i64[i];
+/* A waq_v128 with member `lane` set to vector expression e */
+#define WAQ_V(lane, e) ((waq_v128){.lane = (e)})
+
+/* Lanes of x where mask m is set, else of y (all as lane type `lane`) */
+#define WAQ_SELECT(lane, m, x, y) \
+    WAQ_V(lane, ((__typeof__(x))(m) & (x)) | (~(__typeof__(x))(m) & (y)))
+
+/* The low or high half of a, as an 8-byte vector of type t */
+#define WAQ_HALF(t, a, high) \
+    __extension__({ t h_; memcpy(&h_, (const char *)&(a) + ((high) ? 8 : 0), 8); h_; })
+
+/* Kernels of one, two or three v128 operands returning a v128 */
+#define WAQ_V128_PARAMS1 (v128_t *r, const v128_t *pa)
+#define WAQ_V128_PARAMS2 (v128_t *r, const v128_t *pa, const v128_t *pb)
+#define WAQ_V128_PARAMS3 (v128_t *r, const v128_t *pa, const v128_t *pb, const v128_t *pc)
+#define WAQ_V128_LOAD1 waq_v128 a = waq_v128_load(pa);
+#define WAQ_V128_LOAD2 WAQ_V128_LOAD1 waq_v128 b = waq_v128_load(pb);
+#define WAQ_V128_LOAD3 WAQ_V128_LOAD2 waq_v128 c = waq_v128_load(pc);
+
+#define WAQ_V128_DEFINE(n, fn, expr) \
+    void fn WAQ_V128_PARAMS##n { \
+        WAQ_V128_LOAD##n \
+        waq_v128_store(r, expr); \
     }
+
+#define WAQ_V128_UNARY(name, expr) WAQ_V128_DEFINE(1, __wasm_##name, expr)
+#define WAQ_V128_BINARY(name, expr) WAQ_V128_DEFINE(2, __wasm_##name, expr)
+#define WAQ_V128_TERNARY(name, expr) WAQ_V128_DEFINE(3, __wasm_##name, expr)
+
+/* A kernel bound at load time to `fast`, built for `feature`, or `generic` */
+#define WAQ_V128_IFUNC(n, name, feature, fast, generic) \
+    __attribute__((target(feature))) static WAQ_V128_DEFINE(n, name##_fast, fast) \
+    static WAQ_V128_DEFINE(n, name##_generic, generic) \
+    static void (*name##_resolve(void)) WAQ_V128_PARAMS##n { \
+        __builtin_cpu_init(); \
+        return __builtin_cpu_supports(feature) ? name##_fast : name##_generic; \
+    } \
+    void __wasm_##name WAQ_V128_PARAMS##n __attribute__((ifunc(#name "_resolve")));
+
+/*
+ * A kernel with an SSE4.1 version (which may use SSSE3 as well).  Often
+ * fast and generic are the same expression, compiled once for each ISA.
+ */
+#if defined(__x86_64__) && defined(__SSE4_1__)
+#define WAQ_V128_SSE41(n, name, fast, generic) WAQ_V128_DEFINE(n, __wasm_##name, fast)
+#elif defined(__x86_64__) && WAQ_IFUNC
+#define WAQ_V128_SSE41(n, name, fast, generic) \
+    WAQ_V128_IFUNC(n, name, "sse4.1", fast, generic)
+#else
+#define WAQ_V128_SSE41(n, name, fast, generic) WAQ_V128_DEFINE(n, __wasm_##name, generic)
+#endif
+
+/* Lane-by-lane fallbacks: x.dst[i] = expr for i < count */
+#define WAQ_V128_LANES(dst, count, expr) \
+    __extension__({ \
+        waq_v128 x; \
+        for (int i = 0; i < (count); i++) x.dst[i] = (expr); \
+        x; \
+    })
+
+#define WAQ_CLAMP(v, lo, hi) ((v) < (lo) ? (lo) : (v) > (hi) ? (hi) : (v))
+
+static inline int waq_v128_is_zero(waq_v128 v) {
+    return (v.u64[0] | v.u64[1]) == 0;
 }
 
-/* ---- Relaxed Min/Max ---- */
+/* ---- Constructors and lanes ---- */
 
-void __wasm_f32x4_relaxed_min(v128_t *result, v128_t *a, v128_t *b) {
-    for (int i = 0; i < 4; i++) {
-        /* Relaxed NaN behavior - just use fminf */
-        result->f32[i] = fminf(a->f32[i], b->f32[i]);
-    }
+void __wasm_i8x16_splat(v128_t *r, int32_t x) {
+    waq_v128_store(r, WAQ_V(i8, (waq_i8x16){0} + (int8_t)x));
 }
 
-void __wasm_f32x4_relaxed_max(v128_t *result, v128_t *a, v128_t *b) {
-    for (int i = 0; i < 4; i++) {
-        result->f32[i] = fmaxf(a->f32[i], b->f32[i]);
-    }
+void __wasm_i16x8_splat(v128_t *r, int32_t x) {
+    waq_v128_store(r, WAQ_V(i16, (waq_i16x8){0} + (int16_t)x));
 }
 
-void __wasm_f64x2_relaxed_min(v128_t *result, v128_t *a, v128_t *b) {
-    for (int i = 0; i < 2; i++) {
-        result->f64[i] = fmin(a->f64[i], b->f64[i]);
-    }
+void __wasm_i32x4_splat(v128_t *r, int32_t x) {
+    waq_v128_store(r, WAQ_V(i32, (waq_i32x4){0} + x));
 }
 
-void __wasm_f64x2_relaxed_max(v128_t *result, v128_t *a, v128_t *b) {
-    for (int i = 0; i < 2; i++) {
-        result->f64[i] = fmax(a->f64[i], b->f64[i]);
-    }
+void __wasm_i64x2_splat(v128_t *r, int64_t x) {
+    waq_v128_store(r, WAQ_V(i64, (waq_i64x2){0} + x));
 }
 
-/* ---- Fused Multiply-Add ---- */
+void __wasm_f32x4_splat(v128_t *r, float x) {
+    waq_v128_store(r, WAQ_V(f32, ((waq_f32x4){x, x, x, x})));
+}
 
-void __wasm_f32x4_relaxed_madd(v128_t *result, v128_t *a, v128_t *b, v128_t *c) {
-    for (int i = 0; i < 4; i++) {
-#ifdef FP_FAST_FMAF
-        result->f32[i] = fmaf(a->f32[i], b->f32[i], c->f32[i]);
+void __wasm_f64x2_splat(v128_t *r, double x) {
+    waq_v128_store(r, WAQ_V(f64, ((waq_f64x2){x, x})));
+}
+
+/* Indices of 16 or more select 0 */
+static inline waq_v128 waq_swizzle_generic(waq_v128 a, waq_v128 s) {
+#if defined(__aarch64__)
+    return WAQ_V(u8, (waq_u8x16)vqtbl1q_u8((uint8x16_t)a.u8, (uint8x16_t)s.u8));
 #else
-        result->f32[i] = a->f32[i] * b->f32[i] + c->f32[i];
+    return WAQ_V128_LANES(u8, 16, s.u8[i] < 16 ? a.u8[s.u8[i]] : 0);
 #endif
-    }
 }
 
-void __wasm_f32x4_relaxed_nmadd(v128_t *result, v128_t *a, v128_t *b, v128_t *c) {
-    for (int i = 0; i < 4; i++) {
-#ifdef FP_FAST_FMAF
-        result->f32[i] = fmaf(-a->f32[i], b->f32[i], c->f32[i]);
+/* pshufb zeroes lanes whose index has bit 7 set: push 16 and up there */
+WAQ_V128_SSE41(2, i8x16_swizzle,
+               WAQ_V(m, _mm_shuffle_epi8(a.m, _mm_adds_epu8(b.m, _mm_set1_epi8(0x70)))),
+               waq_swizzle_generic(a, b))
+
+/* lo and hi hold the 16 lane indices, 0-15 from a and 16-31 from b */
+void __wasm_i8x16_shuffle(v128_t *r, const v128_t *pa, const v128_t *pb,
+                          uint64_t lo, uint64_t hi) {
+    waq_v128 a = waq_v128_load(pa), b = waq_v128_load(pb), s;
+    s.u64[0] = lo;
+    s.u64[1] = hi;
+#if defined(__aarch64__)
+    uint8x16x2_t t = {{(uint8x16_t)a.u8, (uint8x16_t)b.u8}};
+    waq_v128_store(r, WAQ_V(u8, (waq_u8x16)vqtbl2q_u8(t, (uint8x16_t)s.u8)));
 #else
-        result->f32[i] = -(a->f32[i] * b->f32[i]) + c->f32[i];
+    uint8_t ab[32];
+    memcpy(ab, &a, 16);
+    memcpy(ab + 16, &b, 16);
+    waq_v128_store(r, WAQ_V128_LANES(u8, 16, ab[s.u8[i] & 31]));
 #endif
-    }
 }
 
-void __wasm_f64x2_relaxed_madd(v128_t *result, v128_t *a, v128_t *b, v128_t *c) {
-    for (int i = 0; i < 2; i++) {
-#ifdef FP_FAST_FMA
-        result->f64[i] = fma(a->f64[i], b->f64[i], c->f64[i]);
+/* ---- Bitwise ---- */
+
+WAQ_V128_UNARY(v128_not, WAQ_V(u64, ~a.u64))
+WAQ_V128_BINARY(v128_and, WAQ_V(u64, a.u64 & b.u64))
+WAQ_V128_BINARY(v128_andnot, WAQ_V(u64, a.u64 & ~b.u64))
+WAQ_V128_BINARY(v128_or, WAQ_V(u64, a.u64 | b.u64))
+WAQ_V128_BINARY(v128_xor, WAQ_V(u64, a.u64 ^ b.u64))
+WAQ_V128_TERNARY(v128_bitselect, WAQ_V(u64, (a.u64 & c.u64) | (b.u64 & ~c.u64)))
+
+int32_t __wasm_v128_any_true(const v128_t *pa) {
+    return !waq_v128_is_zero(waq_v128_load(pa));
+}
+
+/* ---- Comparisons (all-ones lanes where true) ---- */
+
+#define WAQ_V128_INT_COMPARISONS(shape, s, u) \
+    WAQ_V128_BINARY(shape##_eq, WAQ_V(s, a.s == b.s)) \
+    WAQ_V128_BINARY(shape##_ne, WAQ_V(s, a.s != b.s)) \
+    WAQ_V128_BINARY(shape##_lt_s, WAQ_V(s, a.s < b.s)) \
+    WAQ_V128_BINARY(shape##_lt_u, WAQ_V(s, a.u < b.u)) \
+    WAQ_V128_BINARY(shape##_gt_s, WAQ_V(s, a.s > b.s)) \
+    WAQ_V128_BINARY(shape##_gt_u, WAQ_V(s, a.u > b.u)) \
+    WAQ_V128_BINARY(shape##_le_s, WAQ_V(s, a.s <= b.s)) \
+    WAQ_V128_BINARY(shape##_le_u, WAQ_V(s, a.u <= b.u)) \
+    WAQ_V128_BINARY(shape##_ge_s, WAQ_V(s, a.s >= b.s)) \
+    WAQ_V128_BINARY(shape##_ge_u, WAQ_V(s, a.u >= b.u))
+
+WAQ_V128_INT_COMPARISONS(i8x16, i8, u8)
+WAQ_V128_INT_COMPARISONS(i16x8, i16, u16)
+WAQ_V128_INT_COMPARISONS(i32x4, i32, u32)
+
+/* pcmpeqq is SSE4.1 */
+WAQ_V128_SSE41(2, i64x2_eq, WAQ_V(i64, a.i64 == b.i64), WAQ_V(i64, a.i64 == b.i64))
+WAQ_V128_SSE41(2, i64x2_ne, WAQ_V(i64, a.i64 != b.i64), WAQ_V(i64, a.i64 != b.i64))
+WAQ_V128_BINARY(i64x2_lt_s, WAQ_V(i64, a.i64 < b.i64))
+WAQ_V128_BINARY(i64x2_gt_s, WAQ_V(i64, a.i64 > b.i64))
+WAQ_V128_BINARY(i64x2_le_s, WAQ_V(i64, a.i64 <= b.i64))
+WAQ_V128_BINARY(i64x2_ge_s, WAQ_V(i64, a.i64 >= b.i64))
+
+#define WAQ_V128_FLOAT_COMPARISONS(shape, f, mask) \
+    WAQ_V128_BINARY(shape##_eq, WAQ_V(mask, a.f == b.f)) \
+    WAQ_V128_BINARY(shape##_ne, WAQ_V(mask, a.f != b.f)) \
+    WAQ_V128_BINARY(shape##_lt, WAQ_V(mask, a.f < b.f)) \
+    WAQ_V128_BINARY(shape##_gt, WAQ_V(mask, a.f > b.f)) \
+    WAQ_V128_BINARY(shape##_le, WAQ_V(mask, a.f <= b.f)) \
+    WAQ_V128_BINARY(shape##_ge, WAQ_V(mask, a.f >= b.f))
+
+WAQ_V128_FLOAT_COMPARISONS(f32x4, f32, i32)
+WAQ_V128_FLOAT_COMPARISONS(f64x2, f64, i64)
+
+/* ---- Lane tests ---- */
+
+#define WAQ_V128_ALL_TRUE(shape, s) \
+    int32_t __wasm_##shape##_all_true(const v128_t *pa) { \
+        waq_v128 a = waq_v128_load(pa); \
+        return waq_v128_is_zero(WAQ_V(s, a.s == 0)); \
+    }
+
+WAQ_V128_ALL_TRUE(i8x16, i8)
+WAQ_V128_ALL_TRUE(i16x8, i16)
+WAQ_V128_ALL_TRUE(i32x4, i32)
+WAQ_V128_ALL_TRUE(i64x2, i64)
+
+/* Bit i of the result is the sign bit of lane i */
+#if defined(__x86_64__)
+#define WAQ_BITMASK(s, count, sse) \
+    __extension__({ (void)(count); (sse); })
 #else
-        result->f64[i] = a->f64[i] * b->f64[i] + c->f64[i];
+#define WAQ_BITMASK(s, count, sse) \
+    __extension__({ \
+        int32_t m_ = 0; \
+        for (int i = 0; i < (count); i++) m_ |= (int32_t)(a.s[i] < 0) << i; \
+        m_; \
+    })
 #endif
-    }
-}
 
-void __wasm_f64x2_relaxed_nmadd(v128_t *result, v128_t *a, v128_t *b, v128_t *c) {
-    for (int i = 0; i < 2; i++) {
-#ifdef FP_FAST_FMA
-        result->f64[i] = fma(-a->f64[i], b->f64[i], c->f64[i]);
+#define WAQ_V128_BITMASK(shape, s, count, sse) \
+    int32_t __wasm_##shape##_bitmask(const v128_t *pa) { \
+        waq_v128 a = waq_v128_load(pa); \
+        return WAQ_BITMASK(s, count, sse); \
+    }
+
+WAQ_V128_BITMASK(i8x16, i8, 16, _mm_movemask_epi8(a.m))
+WAQ_V128_BITMASK(i16x8, i16, 8, _mm_movemask_epi8(_mm_packs_epi16(a.m, _mm_setzero_si128())))
+WAQ_V128_BITMASK(i32x4, i32, 4, _mm_movemask_ps(a.mf))
+WAQ_V128_BITMASK(i64x2, i64, 2, _mm_movemask_pd(a.md))
+
+/* ---- Integer arithmetic ---- */
+
+/* Shift counts are taken modulo the lane width */
+#define WAQ_V128_SHIFTS(shape, s, u, bits) \
+    void __wasm_##shape##_shl(v128_t *r, const v128_t *pa, int32_t n) { \
+        waq_v128 a = waq_v128_load(pa); \
+        waq_v128_store(r, WAQ_V(u, a.u << (n & (bits - 1)))); \
+    } \
+    void __wasm_##shape##_shr_s(v128_t *r, const v128_t *pa, int32_t n) { \
+        waq_v128 a = waq_v128_load(pa); \
+        waq_v128_store(r, WAQ_V(s, a.s >> (n & (bits - 1)))); \
+    } \
+    void __wasm_##shape##_shr_u(v128_t *r, const v128_t *pa, int32_t n) { \
+        waq_v128 a = waq_v128_load(pa); \
+        waq_v128_store(r, WAQ_V(u, a.u >> (n & (bits - 1)))); \
+    }
+
+WAQ_V128_SHIFTS(i8x16, i8, u8, 8)
+WAQ_V128_SHIFTS(i16x8, i16, u16, 16)
+WAQ_V128_SHIFTS(i32x4, i32, u32, 32)
+WAQ_V128_SHIFTS(i64x2, i64, u64, 64)
+
+/* Wrapping arithmetic is done on the unsigned lanes */
+#define WAQ_V128_WRAPPING(shape, u) \
+    WAQ_V128_BINARY(shape##_add, WAQ_V(u, a.u + b.u)) \
+    WAQ_V128_BINARY(shape##_sub, WAQ_V(u, a.u - b.u)) \
+    WAQ_V128_UNARY(shape##_neg, WAQ_V(u, -a.u))
+
+WAQ_V128_WRAPPING(i8x16, u8)
+WAQ_V128_WRAPPING(i16x8, u16)
+WAQ_V128_WRAPPING(i32x4, u32)
+WAQ_V128_WRAPPING(i64x2, u64)
+
+WAQ_V128_BINARY(i16x8_mul, WAQ_V(u16, a.u16 * b.u16))
+WAQ_V128_SSE41(2, i32x4_mul, WAQ_V(u32, a.u32 * b.u32), WAQ_V(u32, a.u32 * b.u32))
+WAQ_V128_BINARY(i64x2_mul, WAQ_V(u64, a.u64 * b.u64))
+
+/* |x| as (x ^ sign) - sign; the minimum value stays itself */
+#define WAQ_ABS(s, u, bits, a) \
+    WAQ_V(u, ((a).u ^ (__typeof__((a).u))((a).s >> (bits - 1))) - \
+              (__typeof__((a).u))((a).s >> (bits - 1)))
+
+WAQ_V128_SSE41(1, i8x16_abs, WAQ_V(m, _mm_abs_epi8(a.m)), WAQ_ABS(i8, u8, 8, a))
+WAQ_V128_SSE41(1, i16x8_abs, WAQ_V(m, _mm_abs_epi16(a.m)), WAQ_ABS(i16, u16, 16, a))
+WAQ_V128_SSE41(1, i32x4_abs, WAQ_V(m, _mm_abs_epi32(a.m)), WAQ_ABS(i32, u32, 32, a))
+WAQ_V128_UNARY(i64x2_abs, WAQ_ABS(i64, u64, 64, a))
+
+/* Integer min/max: SSE2 has them for i16 and u8 only */
+#define WAQ_V128_MIN_MAX(shape, lane, cmp) \
+    WAQ_V128_SSE41(2, shape##_min_##lane, \
+                   WAQ_SELECT(cmp, a.cmp < b.cmp, a.cmp, b.cmp), \
+                   WAQ_SELECT(cmp, a.cmp < b.cmp, a.cmp, b.cmp)) \
+    WAQ_V128_SSE41(2, shape##_max_##lane, \
+                   WAQ_SELECT(cmp, a.cmp > b.cmp, a.cmp, b.cmp), \
+                   WAQ_SELECT(cmp, a.cmp > b.cmp, a.cmp, b.cmp))
+
+WAQ_V128_MIN_MAX(i8x16, s, i8)
+WAQ_V128_MIN_MAX(i8x16, u, u8)
+WAQ_V128_MIN_MAX(i16x8, s, i16)
+WAQ_V128_MIN_MAX(i16x8, u, u16)
+WAQ_V128_MIN_MAX(i32x4, s, i32)
+WAQ_V128_MIN_MAX(i32x4, u, u32)
+
+/* Rounding average: (a + b + 1) >> 1 without overflow */
+#if defined(__x86_64__)
+WAQ_V128_BINARY(i8x16_avgr_u, WAQ_V(m, _mm_avg_epu8(a.m, b.m)))
+WAQ_V128_BINARY(i16x8_avgr_u, WAQ_V(m, _mm_avg_epu16(a.m, b.m)))
 #else
-        result->f64[i] = -(a->f64[i] * b->f64[i]) + c->f64[i];
+WAQ_V128_BINARY(i8x16_avgr_u, WAQ_V(u8, (a.u8 | b.u8) - ((a.u8 ^ b.u8) >> 1)))
+WAQ_V128_BINARY(i16x8_avgr_u, WAQ_V(u16, (a.u16 | b.u16) - ((a.u16 ^ b.u16) >> 1)))
 #endif
-    }
-}
 
-/* ---- Relaxed Truncations ---- */
+/* Saturating add and subtract */
+#if defined(__x86_64__)
+WAQ_V128_BINARY(i8x16_add_sat_s, WAQ_V(m, _mm_adds_epi8(a.m, b.m)))
+WAQ_V128_BINARY(i8x16_add_sat_u, WAQ_V(m, _mm_adds_epu8(a.m, b.m)))
+WAQ_V128_BINARY(i8x16_sub_sat_s, WAQ_V(m, _mm_subs_epi8(a.m, b.m)))
+WAQ_V128_BINARY(i8x16_sub_sat_u, WAQ_V(m, _mm_subs_epu8(a.m, b.m)))
+WAQ_V128_BINARY(i16x8_add_sat_s, WAQ_V(m, _mm_adds_epi16(a.m, b.m)))
+WAQ_V128_BINARY(i16x8_add_sat_u, WAQ_V(m, _mm_adds_epu16(a.m, b.m)))
+WAQ_V128_BINARY(i16x8_sub_sat_s, WAQ_V(m, _mm_subs_epi16(a.m, b.m)))
+WAQ_V128_BINARY(i16x8_sub_sat_u, WAQ_V(m, _mm_subs_epu16(a.m, b.m)))
+#elif defined(__aarch64__)
+#define WAQ_NEON2(lane, t, insn) \
+    WAQ_V(lane, (__typeof__(a.lane))insn((t)a.lane, (t)b.lane))
+WAQ_V128_BINARY(i8x16_add_sat_s, WAQ_NEON2(i8, int8x16_t, vqaddq_s8))
+WAQ_V128_BINARY(i8x16_add_sat_u, WAQ_NEON2(u8, uint8x16_t, vqaddq_u8))
+WAQ_V128_BINARY(i8x16_sub_sat_s, WAQ_NEON2(i8, int8x16_t, vqsubq_s8))
+WAQ_V128_BINARY(i8x16_sub_sat_u, WAQ_NEON2(u8, uint8x16_t, vqsubq_u8))
+WAQ_V128_BINARY(i16x8_add_sat_s, WAQ_NEON2(i16, int16x8_t, vqaddq_s16))
+WAQ_V128_BINARY(i16x8_add_sat_u, WAQ_NEON2(u16, uint16x8_t, vqaddq_u16))
+WAQ_V128_BINARY(i16x8_sub_sat_s, WAQ_NEON2(i16, int16x8_t, vqsubq_s16))
+WAQ_V128_BINARY(i16x8_sub_sat_u, WAQ_NEON2(u16, uint16x8_t, vqsubq_u16))
+#else
+#define WAQ_SAT(s, count, op, lo, hi) \
+    WAQ_V128_LANES(s, count, WAQ_CLAMP((int32_t)a.s[i] op (int32_t)b.s[i], lo, hi))
+WAQ_V128_BINARY(i8x16_add_sat_s, WAQ_SAT(i8, 16, +, INT8_MIN, INT8_MAX))
+WAQ_V128_BINARY(i8x16_add_sat_u, WAQ_SAT(u8, 16, +, 0, UINT8_MAX))
+WAQ_V128_BINARY(i8x16_sub_sat_s, WAQ_SAT(i8, 16, -, INT8_MIN, INT8_MAX))
+WAQ_V128_BINARY(i8x16_sub_sat_u, WAQ_SAT(u8, 16, -, 0, UINT8_MAX))
+WAQ_V128_BINARY(i16x8_add_sat_s, WAQ_SAT(i16, 8, +, INT16_MIN, INT16_MAX))
+WAQ_V128_BINARY(i16x8_add_sat_u, WAQ_SAT(u16, 8, +, 0, UINT16_MAX))
+WAQ_V128_BINARY(i16x8_sub_sat_s, WAQ_SAT(i16, 8, -, INT16_MIN, INT16_MAX))
+WAQ_V128_BINARY(i16x8_sub_sat_u, WAQ_SAT(u16, 8, -, 0, UINT16_MAX))
+#endif
 
-void __wasm_i32x4_relaxed_trunc_f32x4_s(v128_t *result, v128_t *a) {
-    for (int i = 0; i < 4; i++) {
-        /* Relaxed: behavior on overflow/NaN is implementation-defined */
-        float val = a->f32[i];
-        if (isnan(val)) {
-            result->i32[i] = 0;
-        } else if (val >= 2147483648.0f) {
-            result->i32[i] = 2147483647;
-        } else if (val < -2147483648.0f) {
-            result->i32[i] = -2147483648;
-        } else {
-            result->i32[i] = (int32_t)val;
-        }
-    }
+/* Q15 multiply: (a * b + 0x4000) >> 15, saturated (only -1 * -1 overflows) */
+static inline waq_v128 waq_q15mulr_generic(waq_v128 a, waq_v128 b) {
+#if defined(__aarch64__)
+    return WAQ_NEON2(i16, int16x8_t, vqrdmulhq_s16);
+#else
+    return WAQ_V128_LANES(
+        i16, 8, WAQ_CLAMP(((int32_t)a.i16[i] * b.i16[i] + 0x4000) >> 15, INT16_MIN, INT16_MAX));
+#endif
 }
 
-void __wasm_i32x4_relaxed_trunc_f32x4_u(v128_t *result, v128_t *a) {
-    for (int i = 0; i < 4; i++) {
-        float val = a->f32[i];
-        if (isnan(val) || val < 0.0f) {
-            result->u32[i] = 0;
-        } else if (val >= 4294967296.0f) {
-            result->u32[i] = 4294967295U;
-        } else {
-            result->u32[i] = (uint32_t)val;
-        }
-    }
-}
+/* pmulhrsw is SSSE3; it gives 0x8000 for the overflow, which is flipped */
+#define WAQ_Q15MULR_SSSE3(a, b) \
+    __extension__({ \
+        __m128i p_ = _mm_mulhrs_epi16((a).m, (b).m); \
+        WAQ_V(m, _mm_xor_si128(p_, _mm_cmpeq_epi16(p_, _mm_set1_epi16(INT16_MIN)))); \
+    })
 
-void __wasm_i32x4_relaxed_trunc_f64x2_s_zero(v128_t *result, v128_t *a) {
-    for (int i = 0; i < 2; i++) {
-        double val = a->f64[i];
-        if (isnan(val)) {
-            result->i32[i] = 0;
-        } else if (val >= 2147483648.0) {
-            result->i32[i] = 2147483647;
-        } else if (val < -2147483648.0) {
-            result->i32[i] = -2147483648;
-        } else {
-            result->i32[i] = (int32_t)val;
-        }
-    }
-    result->i32[2] = 0;
-    result->i32[3] = 0;
-}
+WAQ_V128_SSE41(2, i16x8_q15mulr_sat_s, WAQ_Q15MULR_SSSE3(a, b), waq_q15mulr_generic(a, b))
 
-void __wasm_i32x4_relaxed_trunc_f64x2_u_zero(v128_t *result, v128_t *a) {
-    for (int i = 0; i < 2; i++) {
-        double val = a->f64[i];
-        if (isnan(val) || val < 0.0) {
-            result->u32[i] = 0;
-        } else if (val >= 4294967296.0) {
-            result->u32[i] = 4294967295U;
-        } else {
-            result->u32[i] = (uint32_t)val;
-        }
-    }
-    result->u32[2] = 0;
-    result->u32[3] = 0;
+/* Population count of each byte */
+static inline waq_v128 waq_popcnt(waq_v128 a) {
+#if defined(__aarch64__)
+    return WAQ_V(u8, (waq_u8x16)vcntq_u8((uint8x16_t)a.u8));
+#else
+    waq_u8x16 x = a.u8 - ((a.u8 >> 1) & 0x55);
+    x = (x & 0x33) + ((x >> 2) & 0x33);
+    return WAQ_V(u8, (x + (x >> 4)) & 0x0F);
+#endif
 }
 
+WAQ_V128_UNARY(i8x16_popcnt, waq_popcnt(a))
+
+/* Dot product of signed i16 pairs; only -32768 * -32768 twice wraps */
+#if defined(__x86_64__)
+WAQ_V128_BINARY(i32x4_dot_i16x8_s, WAQ_V(m, _mm_madd_epi16(a.m, b.m)))
+#else
+WAQ_V128_BINARY(i32x4_dot_i16x8_s,
+                WAQ_V(u32, (waq_u32x4)(((a.i32 << 16) >> 16) * ((b.i32 << 16) >> 16)) +
+                           (waq_u32x4)((a.i32 >> 16) * (b.i32 >> 16))))
+#endif
+
+/* ---- Widening and narrowing ---- */
+
+/* The low or high half of a, widened lane by lane */
+#define WAQ_EXTEND(to, from, a, high) \
+    __builtin_convertvector(WAQ_HALF(from, a, high), __typeof__(((waq_v128 *)0)->to))
+
+/* Compiled for SSE4.1 these become pmovsx/pmovzx */
+#define WAQ_V128_EXTENDS(shape, from_shape, to_s, to_u, half_s, half_u) \
+    WAQ_V128_SSE41(1, shape##_extend_low_##from_shape##_s, \
+                   WAQ_V(to_s, WAQ_EXTEND(to_s, half_s, a, 0)), \
+                   WAQ_V(to_s, WAQ_EXTEND(to_s, half_s, a, 0))) \
+    WAQ_V128_SSE41(1, shape##_extend_high_##from_shape##_s, \
+                   WAQ_V(to_s, WAQ_EXTEND(to_s, half_s, a, 1)), \
+                   WAQ_V(to_s, WAQ_EXTEND(to_s, half_s, a, 1))) \
+    WAQ_V128_SSE41(1, shape##_extend_low_##from_shape##_u, \
+                   WAQ_V(to_u, WAQ_EXTEND(to_u, half_u, a, 0)), \
+                   WAQ_V(to_u, WAQ_EXTEND(to_u, half_u, a, 0))) \
+    WAQ_V128_SSE41(1, shape##_extend_high_##from_shape##_u, \
+                   WAQ_V(to_u, WAQ_EXTEND(to_u, half_u, a, 1)), \
+                   WAQ_V(to_u, WAQ_EXTEND(to_u, half_u, a, 1))) \
+    WAQ_V128_BINARY(shape##_extmul_low_##from_shape##_s, \
+                    WAQ_V(to_u, (__typeof__(a.to_u))(WAQ_EXTEND(to_s, half_s, a, 0) * \
+                                                     WAQ_EXTEND(to_s, half_s, b, 0)))) \
+    WAQ_V128_BINARY(shape##_extmul_high_##from_shape##_s, \
+                    WAQ_V(to_u, (__typeof__(a.to_u))(WAQ_EXTEND(to_s, half_s, a, 1) * \
+                                                     WAQ_EXTEND(to_s, half_s, b, 1)))) \
+    WAQ_V128_BINARY(shape##_extmul_low_##from_shape##_u, \
+                    WAQ_V(to_u, WAQ_EXTEND(to_u, half_u, a, 0) * WAQ_EXTEND(to_u, half_u, b, 0))) \
+    WAQ_V128_BINARY(shape##_extmul_high_##from_shape##_u, \
+                    WAQ_V(to_u, WAQ_EXTEND(to_u, half_u, a, 1) * WAQ_EXTEND(to_u, half_u, b, 1)))
+
+WAQ_V128_EXTENDS(i16x8, i8x16, i16, u16, waq_i8x8, waq_u8x8)
+WAQ_V128_EXTENDS(i32x4, i16x8, i32, u32, waq_i16x4, waq_u16x4)
+WAQ_V128_EXTENDS(i64x2, i32x4, i64, u64, waq_i32x2, waq_u32x2)
+
+/* Sums of adjacent lane pairs: the even lane sign- or zero-extended in place */
+WAQ_V128_UNARY(i16x8_extadd_pairwise_i8x16_s,
+               WAQ_V(i16, ((a.i16 << 8) >> 8) + (a.i16 >> 8)))
+WAQ_V128_UNARY(i16x8_extadd_pairwise_i8x16_u,
+               WAQ_V(u16, (a.u16 & 0xFF) + (a.u16 >> 8)))
+WAQ_V128_UNARY(i32x4_extadd_pairwise_i16x8_s,
+               WAQ_V(i32, ((a.i32 << 16) >> 16) + (a.i32 >> 16)))
+WAQ_V128_UNARY(i32x4_extadd_pairwise_i16x8_u,
+               WAQ_V(u32, (a.u32 & 0xFFFF) + (a.u32 >> 16)))
+
+/* Narrowing with signed or unsigned saturation: a fills the low half */
+#define WAQ_NARROW(dst, src, count, lo, hi) \
+    WAQ_V128_LANES(dst, count, \
+                   WAQ_CLAMP(i < (count) / 2 ? a.src[i] : b.src[i - (count) / 2], lo, hi))
+
+#if defined(__x86_64__)
+WAQ_V128_BINARY(i8x16_narrow_i16x8_s, WAQ_V(m, _mm_packs_epi16(a.m, b.m)))
+WAQ_V128_BINARY(i8x16_narrow_i16x8_u, WAQ_V(m, _mm_packus_epi16(a.m, b.m)))
+WAQ_V128_BINARY(i16x8_narrow_i32x4_s, WAQ_V(m, _mm_packs_epi32(a.m, b.m)))
+WAQ_V128_SSE41(2, i16x8_narrow_i32x4_u, WAQ_V(m, _mm_packus_epi32(a.m, b.m)),
+               WAQ_NARROW(u16, i32, 8, 0, UINT16_MAX))
+#elif defined(__aarch64__)
+#define WAQ_NARROW_NEON(dst, src, t, insn, combine) \
+    WAQ_V(dst, (__typeof__(a.dst))combine(insn((t)a.src), insn((t)b.src)))
+WAQ_V128_BINARY(i8x16_narrow_i16x8_s,
+                WAQ_NARROW_NEON(i8, i16, int16x8_t, vqmovn_s16, vcombine_s8))
+WAQ_V128_BINARY(i8x16_narrow_i16x8_u,
+                WAQ_NARROW_NEON(u8, i16, int16x8_t, vqmovun_s16, vcombine_u8))
+WAQ_V128_BINARY(i16x8_narrow_i32x4_s,
+                WAQ_NARROW_NEON(i16, i32, int32x4_t, vqmovn_s32, vcombine_s16))
+WAQ_V128_BINARY(i16x8_narrow_i32x4_u,
+                WAQ_NARROW_NEON(u16, i32, int32x4_t, vqmovun_s32, vcombine_u16))
+#else
+WAQ_V128_BINARY(i8x16_narrow_i16x8_s, WAQ_NARROW(i8, i16, 16, INT8_MIN, INT8_MAX))
+WAQ_V128_BINARY(i8x16_narrow_i16x8_u, WAQ_NARROW(u8, i16, 16, 0, UINT8_MAX))
+WAQ_V128_BINARY(i16x8_narrow_i32x4_s, WAQ_NARROW(i16, i32, 8, INT16_MIN, INT16_MAX))
+WAQ_V128_BINARY(i16x8_narrow_i32x4_u, WAQ_NARROW(u16, i32, 8, 0, UINT16_MAX))
+#endif
+
+/* ---- Floating point ---- */
+
+/* Sign operations work on the bits, as for scalars */
+WAQ_V128_UNARY(f32x4_neg, WAQ_V(u32, a.u32 ^ 0x80000000u))
+WAQ_V128_UNARY(f32x4_abs, WAQ_V(u32, a.u32 & 0x7FFFFFFFu))
+WAQ_V128_UNARY(f64x2_neg, WAQ_V(u64, a.u64 ^ 0x8000000000000000u))
+WAQ_V128_UNARY(f64x2_abs, WAQ_V(u64, a.u64 & 0x7FFFFFFFFFFFFFFFu))
+
+WAQ_V128_BINARY(f32x4_add, WAQ_V(f32, a.f32 + b.f32))
+WAQ_V128_BINARY(f32x4_sub, WAQ_V(f32, a.f32 - b.f32))
+WAQ_V128_BINARY(f32x4_mul, WAQ_V(f32, a.f32 * b.f32))
+WAQ_V128_BINARY(f32x4_div, WAQ_V(f32, a.f32 / b.f32))
+WAQ_V128_BINARY(f64x2_add, WAQ_V(f64, a.f64 + b.f64))
+WAQ_V128_BINARY(f64x2_sub, WAQ_V(f64, a.f64 - b.f64))
+WAQ_V128_BINARY(f64x2_mul, WAQ_V(f64, a.f64 * b.f64))
+WAQ_V128_BINARY(f64x2_div, WAQ_V(f64, a.f64 / b.f64))
+
+#if defined(__x86_64__)
+WAQ_V128_UNARY(f32x4_sqrt, WAQ_V(mf, _mm_sqrt_ps(a.mf)))
+WAQ_V128_UNARY(f64x2_sqrt, WAQ_V(md, _mm_sqrt_pd(a.md)))
+#elif defined(__aarch64__)
+WAQ_V128_UNARY(f32x4_sqrt, WAQ_V(f32, (waq_f32x4)vsqrtq_f32((float32x4_t)a.f32)))
+WAQ_V128_UNARY(f64x2_sqrt, WAQ_V(f64, (waq_f64x2)vsqrtq_f64((float64x2_t)a.f64)))
+#else
+WAQ_V128_UNARY(f32x4_sqrt, WAQ_V128_LANES(f32, 4, sqrtf(a.f32[i])))
+WAQ_V128_UNARY(f64x2_sqrt, WAQ_V128_LANES(f64, 2, sqrt(a.f64[i])))
+#endif
+
+/*
+ * WASM min/max propagate NaN and order -0 below +0.  Each lane takes one of
+ * four disjoint cases: a < b, b < a, equal (where OR/AND of the bits picks
+ * the right zero) or unordered (a + b is a NaN).
+ */
+#define WAQ_FMINMAX(f, i, op, zero) \
+    __extension__({ \
+        __typeof__(a.i) lt_ = a.f < b.f, gt_ = a.f > b.f, eq_ = a.f == b.f; \
+        __typeof__(a.i) nan_ = ~(lt_ | gt_ | eq_); \
+        waq_v128 s_ = WAQ_V(f, a.f + b.f); \
+        WAQ_V(i, ((op ? gt_ : lt_) & a.i) | ((op ? lt_ : gt_) & b.i) | \
+                 (eq_ & (zero)) | (nan_ & s_.i)); \
+    })
+
+WAQ_V128_BINARY(f32x4_min, WAQ_FMINMAX(f32, i32, 0, a.i32 | b.i32))
+WAQ_V128_BINARY(f32x4_max, WAQ_FMINMAX(f32, i32, 1, a.i32 & b.i32))
+WAQ_V128_BINARY(f64x2_min, WAQ_FMINMAX(f64, i64, 0, a.i64 | b.i64))
+WAQ_V128_BINARY(f64x2_max, WAQ_FMINMAX(f64, i64, 1, a.i64 & b.i64))
+
+/* Pseudo-min/max: b < a ? b : a and a < b ? b : a */
+WAQ_V128_BINARY(f32x4_pmin, WAQ_SELECT(i32, b.f32 < a.f32, b.i32, a.i32))
+WAQ_V128_BINARY(f32x4_pmax, WAQ_SELECT(i32, a.f32 < b.f32, b.i32, a.i32))
+WAQ_V128_BINARY(f64x2_pmin, WAQ_SELECT(i64, b.f64 < a.f64, b.i64, a.i64))
+WAQ_V128_BINARY(f64x2_pmax, WAQ_SELECT(i64, a.f64 < b.f64, b.i64, a.i64))
+
+/* Rounding: roundps/roundpd with SSE4.1, frint* on AArch64 */
+#if defined(__aarch64__)
+#define WAQ_ROUND_LANES(f, t, count, fn, neon) WAQ_V(f, (__typeof__(a.f))neon((t)a.f))
+#else
+#define WAQ_ROUND_LANES(f, t, count, fn, neon) WAQ_V128_LANES(f, count, fn(a.f[i]))
+#endif
+
+#define WAQ_V128_ROUNDING(name, mode, fn32, fn64, neon32, neon64) \
+    WAQ_V128_SSE41(1, f32x4_##name, \
+                   WAQ_V(mf, _mm_round_ps(a.mf, (mode) | _MM_FROUND_NO_EXC)), \
+                   WAQ_ROUND_LANES(f32, float32x4_t, 4, fn32, neon32)) \
+    WAQ_V128_SSE41(1, f64x2_##name, \
+                   WAQ_V(md, _mm_round_pd(a.md, (mode) | _MM_FROUND_NO_EXC)), \
+                   WAQ_ROUND_LANES(f64, float64x2_t, 2, fn64, neon64))
+
+WAQ_V128_ROUNDING(ceil, _MM_FROUND_TO_POS_INF, ceilf, ceil, vrndpq_f32, vrndpq_f64)
+WAQ_V128_ROUNDING(floor, _MM_FROUND_TO_NEG_INF, floorf, floor, vrndmq_f32, vrndmq_f64)
+WAQ_V128_ROUNDING(trunc, _MM_FROUND_TO_ZERO, truncf, trunc, vrndq_f32, vrndq_f64)
+WAQ_V128_ROUNDING(nearest, _MM_FROUND_TO_NEAREST_INT, nearbyintf, nearbyint,
+                  vrndnq_f32, vrndnq_f64)
+
+/* ---- Conversions ---- */
+
+WAQ_V128_UNARY(f32x4_convert_i32x4_s, WAQ_V(f32, __builtin_convertvector(a.i32, waq_f32x4)))
+WAQ_V128_UNARY(f32x4_convert_i32x4_u, WAQ_V(f32, __builtin_convertvector(a.u32, waq_f32x4)))
+WAQ_V128_UNARY(f64x2_convert_low_i32x4_s, WAQ_V128_LANES(f64, 2, (double)a.i32[i]))
+WAQ_V128_UNARY(f64x2_convert_low_i32x4_u, WAQ_V128_LANES(f64, 2, (double)a.u32[i]))
+WAQ_V128_UNARY(f64x2_promote_low_f32x4, WAQ_V128_LANES(f64, 2, (double)a.f32[i]))
+WAQ_V128_UNARY(f32x4_demote_f64x2_zero,
+               WAQ_V128_LANES(f32, 4, i < 2 ? (float)a.f64[i] : 0.0f))
+
+/* Saturating truncation: NaN is 0, out-of-range values clamp */
+static inline int32_t waq_trunc_sat_s(double x) {
+    return x != x ? 0 : x <= -2147483648.0 ? INT32_MIN : x >= 2147483647.0 ? INT32_MAX
+                                                                          : (int32_t)x;
+}
+
+static inline uint32_t waq_trunc_sat_u(double x) {
+    return !(x > -1.0) ? 0 : x >= 4294967295.0 ? UINT32_MAX : (uint32_t)x;
+}
+
+#if defined(__x86_64__)
+/* cvttps2dq gives INT32_MIN for NaN and out of range: zero NaN lanes, flip
+ * the positive overflows to INT32_MAX */
+WAQ_V128_UNARY(i32x4_trunc_sat_f32x4_s,
+               WAQ_V(m, _mm_xor_si128(
+                            _mm_and_si128(_mm_cvttps_epi32(a.mf),
+                                          _mm_castps_si128(_mm_cmpord_ps(a.mf, a.mf))),
+                            _mm_castps_si128(_mm_cmpge_ps(a.mf, _mm_set1_ps(2147483648.0f))))))
+#elif defined(__aarch64__)
+/* fcvtzs and fcvtzu saturate and give 0 for NaN, as WASM requires */
+WAQ_V128_UNARY(i32x4_trunc_sat_f32x4_s,
+               WAQ_V(i32, (waq_i32x4)vcvtq_s32_f32((float32x4_t)a.f32)))
+#else
+WAQ_V128_UNARY(i32x4_trunc_sat_f32x4_s, WAQ_V128_LANES(i32, 4, waq_trunc_sat_s(a.f32[i])))
+#endif
+
+#if defined(__aarch64__)
+WAQ_V128_UNARY(i32x4_trunc_sat_f32x4_u,
+               WAQ_V(u32, (waq_u32x4)vcvtq_u32_f32((float32x4_t)a.f32)))
+#else
+WAQ_V128_UNARY(i32x4_trunc_sat_f32x4_u, WAQ_V128_LANES(u32, 4, waq_trunc_sat_u(a.f32[i])))
+#endif
+
+WAQ_V128_UNARY(i32x4_trunc_sat_f64x2_s_zero,
+               WAQ_V128_LANES(i32, 4, i < 2 ? waq_trunc_sat_s(a.f64[i]) : 0))
+WAQ_V128_UNARY(i32x4_trunc_sat_f64x2_u_zero,
+               WAQ_V128_LANES(u32, 4, i < 2 ? waq_trunc_sat_u(a.f64[i]) : 0))
+
+/* ============================================================================
+ * RELAXED SIMD
+ * ============================================================================
+ * Relaxed operations may give any of several results where the exact ones
+ * would cost more (out-of-range indices, NaN, overflow, fusing, the sign of
+ * the i7 operand), so each kernel is the instruction the CPU has for it:
+ * pshufb, blendv, minps, vfmadd, cvttps2dq, pmulhrsw, pmaddubsw and
+ * vpdpbusd on x86-64, and their NEON counterparts on AArch64.  The results
+ * agree with the exact operations wherever those are defined.
+ */
+
+/* A kernel with an FMA version, selected like WAQ_V128_SSE41 */
+#if defined(__x86_64__) && defined(__FMA__)
+#define WAQ_V128_FMA(n, name, fast, generic) WAQ_V128_DEFINE(n, __wasm_##name, fast)
+#elif defined(__x86_64__) && WAQ_IFUNC
+#define WAQ_V128_FMA(n, name, fast, generic) WAQ_V128_IFUNC(n, name, "fma", fast, generic)
+#else
+#define WAQ_V128_FMA(n, name, fast, generic) WAQ_V128_DEFINE(n, __wasm_##name, generic)
+#endif
+
+/* ---- Lane Selection and Swizzle ---- */
+
+/* pshufb zeroes lanes whose index has bit 7 set and wraps the others */
+WAQ_V128_SSE41(2, i8x16_relaxed_swizzle, WAQ_V(m, _mm_shuffle_epi8(a.m, b.m)),
+               waq_swizzle_generic(a, b))
+
+/* Select by the top bit of each mask lane */
+#define WAQ_LANESELECT(lane) WAQ_SELECT(lane, c.lane < 0, a.lane, b.lane)
+
+WAQ_V128_SSE41(3, i8x16_relaxed_laneselect, WAQ_V(m, _mm_blendv_epi8(b.m, a.m, c.m)),
+               WAQ_LANESELECT(i8))
+WAQ_V128_TERNARY(i16x8_relaxed_laneselect, WAQ_LANESELECT(i16))
+WAQ_V128_SSE41(3, i32x4_relaxed_laneselect, WAQ_V(mf, _mm_blendv_ps(b.mf, a.mf, c.mf)),
+               WAQ_LANESELECT(i32))
+WAQ_V128_SSE41(3, i64x2_relaxed_laneselect, WAQ_V(md, _mm_blendv_pd(b.md, a.md, c.md)),
+               WAQ_LANESELECT(i64))
+
+/* ---- Relaxed Min/Max ---- */
+
+/* minps/maxps return b when either lane is NaN or both are zeros */
+#if defined(__x86_64__)
+WAQ_V128_BINARY(f32x4_relaxed_min, WAQ_V(mf, _mm_min_ps(a.mf, b.mf)))
+WAQ_V128_BINARY(f32x4_relaxed_max, WAQ_V(mf, _mm_max_ps(a.mf, b.mf)))
+WAQ_V128_BINARY(f64x2_relaxed_min, WAQ_V(md, _mm_min_pd(a.md, b.md)))
+WAQ_V128_BINARY(f64x2_relaxed_max, WAQ_V(md, _mm_max_pd(a.md, b.md)))
+#elif defined(__aarch64__)
+WAQ_V128_BINARY(f32x4_relaxed_min, WAQ_NEON2(f32, float32x4_t, vminq_f32))
+WAQ_V128_BINARY(f32x4_relaxed_max, WAQ_NEON2(f32, float32x4_t, vmaxq_f32))
+WAQ_V128_BINARY(f64x2_relaxed_min, WAQ_NEON2(f64, float64x2_t, vminq_f64))
+WAQ_V128_BINARY(f64x2_relaxed_max, WAQ_NEON2(f64, float64x2_t, vmaxq_f64))
+#else
+WAQ_V128_BINARY(f32x4_relaxed_min, WAQ_SELECT(i32, a.f32 < b.f32, a.i32, b.i32))
+WAQ_V128_BINARY(f32x4_relaxed_max, WAQ_SELECT(i32, a.f32 > b.f32, a.i32, b.i32))
+WAQ_V128_BINARY(f64x2_relaxed_min, WAQ_SELECT(i64, a.f64 < b.f64, a.i64, b.i64))
+WAQ_V128_BINARY(f64x2_relaxed_max, WAQ_SELECT(i64, a.f64 > b.f64, a.i64, b.i64))
+#endif
+
+/* ---- Fused Multiply-Add ---- */
+
+/* madd is a * b + c and nmadd -(a * b) + c, fused or not */
+#if defined(__aarch64__)
+WAQ_V128_TERNARY(f32x4_relaxed_madd,
+                 WAQ_V(f32, (waq_f32x4)vfmaq_f32((float32x4_t)c.f32, (float32x4_t)a.f32,
+                                                 (float32x4_t)b.f32)))
+WAQ_V128_TERNARY(f32x4_relaxed_nmadd,
+                 WAQ_V(f32, (waq_f32x4)vfmsq_f32((float32x4_t)c.f32, (float32x4_t)a.f32,
+                                                 (float32x4_t)b.f32)))
+WAQ_V128_TERNARY(f64x2_relaxed_madd,
+                 WAQ_V(f64, (waq_f64x2)vfmaq_f64((float64x2_t)c.f64, (float64x2_t)a.f64,
+                                                 (float64x2_t)b.f64)))
+WAQ_V128_TERNARY(f64x2_relaxed_nmadd,
+                 WAQ_V(f64, (waq_f64x2)vfmsq_f64((float64x2_t)c.f64, (float64x2_t)a.f64,
+                                                 (float64x2_t)b.f64)))
+#else
+WAQ_V128_FMA(3, f32x4_relaxed_madd, WAQ_V(mf, _mm_fmadd_ps(a.mf, b.mf, c.mf)),
+             WAQ_V(f32, a.f32 * b.f32 + c.f32))
+WAQ_V128_FMA(3, f32x4_relaxed_nmadd, WAQ_V(mf, _mm_fnmadd_ps(a.mf, b.mf, c.mf)),
+             WAQ_V(f32, c.f32 - a.f32 * b.f32))
+WAQ_V128_FMA(3, f64x2_relaxed_madd, WAQ_V(md, _mm_fmadd_pd(a.md, b.md, c.md)),
+             WAQ_V(f64, a.f64 * b.f64 + c.f64))
+WAQ_V128_FMA(3, f64x2_relaxed_nmadd, WAQ_V(md, _mm_fnmadd_pd(a.md, b.md, c.md)),
+             WAQ_V(f64, c.f64 - a.f64 * b.f64))
+#endif
+
+/* ---- Relaxed Truncations ---- */
+
+#if defined(__x86_64__)
+/* cvttps2dq/cvttpd2dq give INT32_MIN for NaN and out-of-range lanes */
+WAQ_V128_UNARY(i32x4_relaxed_trunc_f32x4_s, WAQ_V(m, _mm_cvttps_epi32(a.mf)))
+WAQ_V128_UNARY(i32x4_relaxed_trunc_f64x2_s_zero, WAQ_V(m, _mm_cvttpd_epi32(a.md)))
+
+/* Clamp NaN and negatives to 0 (maxps returns its second operand for NaN),
+ * convert x and x - 2^31 signed, and saturate from 2^32 up */
+static inline waq_v128 waq_relaxed_trunc_u_sse2(waq_v128 a) {
+    __m128 x = _mm_max_ps(a.mf, _mm_setzero_ps());
+    __m128 high = _mm_cmpge_ps(x, _mm_set1_ps(2147483648.0f));
+    __m128i low = _mm_cvttps_epi32(x);
+    __m128i rest = _mm_cvttps_epi32(_mm_sub_ps(x, _mm_set1_ps(2147483648.0f)));
+    __m128i over = _mm_castps_si128(_mm_cmpge_ps(x, _mm_set1_ps(4294967296.0f)));
+    rest = _mm_and_si128(rest, _mm_castps_si128(high));
+    return WAQ_V(m, _mm_or_si128(_mm_or_si128(low, rest), over));
+}
+
+WAQ_V128_UNARY(i32x4_relaxed_trunc_f32x4_u, waq_relaxed_trunc_u_sse2(a))
+#elif defined(__aarch64__)
+/* fcvtzs and fcvtzu saturate and give 0 for NaN */
+WAQ_V128_UNARY(i32x4_relaxed_trunc_f32x4_s,
+               WAQ_V(i32, (waq_i32x4)vcvtq_s32_f32((float32x4_t)a.f32)))
+WAQ_V128_UNARY(i32x4_relaxed_trunc_f32x4_u,
+               WAQ_V(u32, (waq_u32x4)vcvtq_u32_f32((float32x4_t)a.f32)))
+WAQ_V128_UNARY(i32x4_relaxed_trunc_f64x2_s_zero,
+               WAQ_V128_LANES(i32, 4, i < 2 ? waq_trunc_sat_s(a.f64[i]) : 0))
+#else
+WAQ_V128_UNARY(i32x4_relaxed_trunc_f32x4_s, WAQ_V128_LANES(i32, 4, waq_trunc_sat_s(a.f32[i])))
+WAQ_V128_UNARY(i32x4_relaxed_trunc_f32x4_u, WAQ_V128_LANES(u32, 4, waq_trunc_sat_u(a.f32[i])))
+WAQ_V128_UNARY(i32x4_relaxed_trunc_f64x2_s_zero,
+               WAQ_V128_LANES(i32, 4, i < 2 ? waq_trunc_sat_s(a.f64[i]) : 0))
+#endif
+
+WAQ_V128_UNARY(i32x4_relaxed_trunc_f64x2_u_zero,
+               WAQ_V128_LANES(u32, 4, i < 2 ? waq_trunc_sat_u(a.f64[i]) : 0))
+
 /* ---- Dot Products ---- */
 
-void __wasm_i16x8_relaxed_q15mulr_s(v128_t *result, v128_t *a, v128_t *b) {
-    for (int i = 0; i < 8; i++) {
-        /* Q15 saturating multiply with rounding */
-        int32_t product = (int32_t)a->i16[i] * (int32_t)b->i16[i];
-        int32_t rounded = (product + 0x4000) >> 15;
-        /* Saturate to int16 */
-        if (rounded > 32767) rounded = 32767;
-        if (rounded < -32768) rounded = -32768;
-        result->i16[i] = (int16_t)rounded;
-    }
-}
+/* pmulhrsw gives 0x8000 for -1 * -1 instead of saturating, which is allowed */
+WAQ_V128_SSE41(2, i16x8_relaxed_q15mulr_s, WAQ_V(m, _mm_mulhrs_epi16(a.m, b.m)),
+               waq_q15mulr_generic(a, b))
 
-void __wasm_i16x8_relaxed_dot_i8x16_i7x16_s(v128_t *result, v128_t *a, v128_t *b) {
-    /* Dot product of pairs: i8 x i7 (7-bit treated as signed or unsigned) -> i16 */
-    for (int i = 0; i < 8; i++) {
-        int32_t sum = (int32_t)a->i8[2*i] * (int32_t)b->i8[2*i] +
-                      (int32_t)a->i8[2*i+1] * (int32_t)b->i8[2*i+1];
-        /* Saturate to int16 */
-        if (sum > 32767) sum = 32767;
-        if (sum < -32768) sum = -32768;
-        result->i16[i] = (int16_t)sum;
-    }
+/*
+ * Products of a's signed bytes and b's 7-bit ones, summed in pairs to i16
+ * lanes, and in fours plus c to i32 lanes.  x86-64 only multiplies unsigned
+ * by signed bytes (pmaddubsw, vpdpbusd), so b goes first and a b lane with
+ * bit 7 set counts as 128 or more there, and as negative elsewhere.
+ */
+static inline waq_v128 waq_dot_i8x16_i7x16_generic(waq_v128 a, waq_v128 b) {
+#if defined(__aarch64__)
+    int16x8_t low = vmull_s8(vget_low_s8((int8x16_t)a.i8), vget_low_s8((int8x16_t)b.i8));
+    int16x8_t high = vmull_high_s8((int8x16_t)a.i8, (int8x16_t)b.i8);
+    return WAQ_V(i16, (waq_i16x8)vpaddq_s16(low, high));
+#else
+    return WAQ_V128_LANES(i16, 8, WAQ_CLAMP(a.i8[2 * i] * b.i8[2 * i] +
+                                                a.i8[2 * i + 1] * b.i8[2 * i + 1],
+                                            INT16_MIN, INT16_MAX));
+#endif
 }
 
-void __wasm_i32x4_relaxed_dot_i8x16_i7x16_add_s(v128_t *result, v128_t *a, v128_t *b, v128_t *c) {
-    /* Dot product with accumulate: 4 groups of 4 i8xi7 -> i32, add to c */
-    for (int i = 0; i < 4; i++) {
-        int32_t sum = 0;
-        for (int j = 0; j < 4; j++) {
-            sum += (int32_t)a->i8[4*i+j] * (int32_t)b->i8[4*i+j];
-        }
-        result->i32[i] = sum + c->i32[i];
-    }
+static inline waq_v128 waq_dot_i8x16_i7x16_add_generic(waq_v128 a, waq_v128 b,
+                                                       waq_v128 c) {
+#if defined(__aarch64__) && defined(__ARM_FEATURE_DOTPROD)
+    return WAQ_V(i32, (waq_i32x4)vdotq_s32((int32x4_t)c.i32, (int8x16_t)a.i8,
+                                           (int8x16_t)b.i8));
+#elif defined(__aarch64__)
+    waq_v128 pairs = waq_dot_i8x16_i7x16_generic(a, b);
+    return WAQ_V(i32, (waq_i32x4)vpadalq_s16((int32x4_t)c.i32, (int16x8_t)pairs.i16));
+#else
+    return WAQ_V128_LANES(i32, 4, c.i32[i] + a.i8[4 * i] * b.i8[4 * i] +
+                                      a.i8[4 * i + 1] * b.i8[4 * i + 1] +
+                                      a.i8[4 * i + 2] * b.i8[4 * i + 2] +
+                                      a.i8[4 * i + 3] * b.i8[4 * i + 3]);
+#endif
 }
 
+WAQ_V128_SSE41(2, i16x8_relaxed_dot_i8x16_i7x16_s, WAQ_V(m, _mm_maddubs_epi16(b.m, a.m)),
+               waq_dot_i8x16_i7x16_generic(a, b))
+
+#define WAQ_DOT_ADD_SSSE3(a, b, c) \
+    WAQ_V(m, _mm_add_epi32(_mm_madd_epi16(_mm_maddubs_epi16((b).m, (a).m), \
+                                          _mm_set1_epi16(1)), \
+                           (c).m))
+#define WAQ_DOT_ADD_AVXVNNI(a, b, c) WAQ_V(m, _mm_dpbusd_avx_epi32((c).m, (b).m, (a).m))
+#define WAQ_DOT_ADD_AVX512VNNI(a, b, c) WAQ_V(m, _mm_dpbusd_epi32((c).m, (b).m, (a).m))
+
+/* Int8 inference hinges on this one: vpdpbusd where there is VNNI */
+#if defined(__x86_64__) && defined(__AVXVNNI__)
+WAQ_V128_TERNARY(i32x4_relaxed_dot_i8x16_i7x16_add_s, WAQ_DOT_ADD_AVXVNNI(a, b, c))
+#elif defined(__x86_64__) && defined(__AVX512VNNI__) && defined(__AVX512VL__)
+WAQ_V128_TERNARY(i32x4_relaxed_dot_i8x16_i7x16_add_s, WAQ_DOT_ADD_AVX512VNNI(a, b, c))
+#elif defined(__x86_64__) && WAQ_IFUNC
+__attribute__((target("avxvnni"))) static WAQ_V128_DEFINE(
+    3, waq_dot_add_avxvnni, WAQ_DOT_ADD_AVXVNNI(a, b, c))
+__attribute__((target("avx512vnni,avx512vl"))) static WAQ_V128_DEFINE(
+    3, waq_dot_add_avx512vnni, WAQ_DOT_ADD_AVX512VNNI(a, b, c))
+__attribute__((target("sse4.1"))) static WAQ_V128_DEFINE(
+    3, waq_dot_add_sse41, WAQ_DOT_ADD_SSSE3(a, b, c))
+static WAQ_V128_DEFINE(3, waq_dot_add_generic, waq_dot_i8x16_i7x16_add_generic(a, b, c))
+
+static void (*waq_dot_add_resolve(void)) WAQ_V128_PARAMS3 {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avxvnni"))
+        return waq_dot_add_avxvnni;
+    if (__builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512vl"))
+        return waq_dot_add_avx512vnni;
+    return __builtin_cpu_supports("sse4.1") ? waq_dot_add_sse41 : waq_dot_add_generic;
+}
+
+void __wasm_i32x4_relaxed_dot_i8x16_i7x16_add_s WAQ_V128_PARAMS3
+    __attribute__((ifunc("waq_dot_add_resolve")));
+#elif defined(__x86_64__) && defined(__SSE4_1__)
+WAQ_V128_TERNARY(i32x4_relaxed_dot_i8x16_i7x16_add_s, WAQ_DOT_ADD_SSSE3(a, b, c))
+#else
+WAQ_V128_TERNARY(i32x4_relaxed_dot_i8x16_i7x16_add_s,
+                 waq_dot_i8x16_i7x16_add_generic(a, b, c))
+#endif
+
+/* ---- Deterministic Profile ---- */
+
+/*
+ * With --deterministic the compiler calls the exact operations instead of
+ * the relaxed ones, these dot products (b signed, pairs saturated to i16,
+ * as the spec's deterministic profile has them), and canonicalizes the NaN
+ * lanes of float results in place.
+ */
+#define WAQ_DOT_PAIRS_SSE41(a, b) \
+    _mm_packs_epi32( \
+        _mm_madd_epi16(_mm_cvtepi8_epi16((a).m), _mm_cvtepi8_epi16((b).m)), \
+        _mm_madd_epi16(_mm_cvtepi8_epi16(_mm_srli_si128((a).m, 8)), \
+                       _mm_cvtepi8_epi16(_mm_srli_si128((b).m, 8))))
+
+static inline waq_v128 waq_dot_pairs_generic(waq_v128 a, waq_v128 b) {
+    return WAQ_V128_LANES(i16, 8, WAQ_CLAMP(a.i8[2 * i] * b.i8[2 * i] +
+                                                a.i8[2 * i + 1] * b.i8[2 * i + 1],
+                                            INT16_MIN, INT16_MAX));
+}
+
+static inline waq_v128 waq_dot_add_pairs_generic(waq_v128 a, waq_v128 b, waq_v128 c) {
+    waq_v128 pairs = waq_dot_pairs_generic(a, b);
+    return WAQ_V128_LANES(i32, 4, c.i32[i] + pairs.i16[2 * i] + pairs.i16[2 * i + 1]);
+}
+
+WAQ_V128_SSE41(2, i16x8_dot_i8x16_i7x16_s, WAQ_V(m, WAQ_DOT_PAIRS_SSE41(a, b)),
+               waq_dot_pairs_generic(a, b))
+WAQ_V128_SSE41(3, i32x4_dot_i8x16_i7x16_add_s,
+               WAQ_V(m, _mm_add_epi32(_mm_madd_epi16(WAQ_DOT_PAIRS_SSE41(a, b),
+                                                     _mm_set1_epi16(1)),
+                                      c.m)),
+               waq_dot_add_pairs_generic(a, b, c))
+
+WAQ_V128_UNARY(f32x4_canon_nan, WAQ_SELECT(i32, a.f32 != a.f32,
+                                           (waq_i32x4){0} + WASM_CANONICAL_NAN_F32, a.i32))
+WAQ_V128_UNARY(f64x2_canon_nan,
+               WAQ_SELECT(i64, a.f64 != a.f64,
+                          (waq_i64x2){0} + (int64_t)WASM_CANONICAL_NAN_F64, a.i64))
+
 /* ---- Basic v128 Operations (for completeness) ---- */
 
 void __wasm_v128_load(v128_t *result, void *addr) {
@@ -0,0 +1,84 @@
+"""Builders for the small WASM modules the unit tests compile.
+
+Tests spell function bodies out as bytes; the sections around them come from
+here, so each test module states only the instructions it is about.
+"""
+
+from __future__ import annotations
+
+# Value types
+I32, I64, F32, F64, V128 = 0x7F, 0x7E, 0x7D, 0x7C, 0x7B
+
+
+def leb128(value: int) -> bytes:
+    """Unsigned LEB128 encoding of ``value``."""
+    out = bytearray()
+    while True:
+        byte, value = value & 0x7F, value >> 7
+        out.append(byte | (0x80 if value else 0))
+        if not value:
+            return bytes(out)
+
+
+def func_type(params: list[int], results: list[int]) -> bytes:
+    """A type section entry for ``(params) -> (results)``."""
+    return bytes([0x60, len(params), *params, len(results), *results])
+
+
+I32_TO_I32 = func_type([I32], [I32])
+
+
+def make_module_wasm(
+    types: list[bytes],
+    funcs: list[tuple[int, bytes]],
+    exports: dict[str, int],
+    elements: list[int] | None = None,
+    memory: bool = False,
+    globals_: list[bytes] | None = None,
+    data: dict[int, bytes] | None = None,
+) -> bytes:
+    """A module of ``funcs`` (type index, body) with function ``exports``.
+
+    ``elements`` fills a funcref table one slot longer, from index 0.
+    ``memory`` adds a one-page memory.  ``globals_`` are global entries (type,
+    mutability and init expression).  ``data`` maps memory offsets below 64
+    to the bytes of an active segment there.
+    """
+    type_section = bytes([len(types)]) + b"".join(types)
+    func_section = bytes([len(funcs)]) + bytes(t for t, _ in funcs)
+    export_section = bytes([len(exports)]) + b"".join(
+        bytes([len(name)]) + name.encode() + bytes([0x00, idx])
+        for name, idx in exports.items()
+    )
+    code_section = bytes([len(funcs)]) + b"".join(
+        leb128(len(body)) + body for _, body in funcs
+    )
+
+    sections = [(0x01, type_section), (0x03, func_section)]
+    if elements is not None:
+        sections.append((0x04, bytes([0x01, 0x70, 0x00, len(elements) + 1])))
+    if memory:
+        sections.append((0x05, bytes([0x01, 0x00, 0x01])))
+    if globals_:
+        sections.append((0x06, bytes([len(globals_)]) + b"".join(globals_)))
+    sections.append((0x07, export_section))
+    if elements is not None:
+        segment = bytes([0x00, 0x41, 0x00, 0x0B, len(elements), *elements])
+        sections.append((0x09, bytes([0x01]) + segment))
+    sections.append((0x0A, code_section))
+    if data:
+        segments = b"".join(
+            bytes([0x00, 0x41, offset, 0x0B]) + leb128(len(init)) + init
+            for offset, init in data.items()
+        )
+        sections.append((0x0B, bytes([len(data)]) + segments))
+
+    wasm = bytes([0x00, 0x61, 0x73, 0x6D, 0x01, 0x00, 0x00, 0x00])
+    for section_id, section in sections:
+        wasm += bytes([section_id]) + leb128(len(section)) + section
+    return wasm
+
+
+def make_i32_func_wasm(func_body: bytes) -> bytes:
+    """Wrap a single exported (i32) -> (i32) function body named "f"."""
+    return make_module_wasm([I32_TO_I32], [(0, func_body)], {"f": 0})
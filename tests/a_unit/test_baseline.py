@@ -0,0 +1,357 @@
+"""Unit tests for the baseline x86-64 backend."""
+
+from __future__ import annotations
+
+import platform
+import shutil
+import struct
+import subprocess
+
+import pytest
+
+from waq.compiler.baseline import compile_baseline
+from waq.compiler.baseline.bench import (
+    TARGET_MB_S,
+    main,
+    run_benchmark,
+    synthetic_module,
+)
+from waq.errors import CompileError
+from waq.parser.module import parse_module
+from waq.runtime.library import runtime_library
+
+from .conftest import F64, I32, I32_TO_I32, I64, func_type, make_module_wasm
+
+# Function types
+I32_I32_TO_I32 = func_type([I32, I32], [I32])
+I64_TO_I64 = func_type([I64], [I64])
+F64_F64_TO_F64 = func_type([F64, F64], [F64])
+I32_TO_I32_I32 = func_type([I32], [I32, I32])
+EIGHT_I32_TO_I32 = func_type([I32] * 8, [I32])
+
+needs_x86_64 = pytest.mark.skipif(
+    platform.system() != "Linux"
+    or platform.machine() not in ("x86_64", "AMD64")
+    or shutil.which("gcc") is None
+    or shutil.which("ar") is None,
+    reason="running baseline output needs x86-64 Linux and gcc",
+)
+
+
+def compile_funcs(types, funcs, **kwargs) -> bytes:
+    """Object file for ``funcs``, exported as ``f0``, ``f1``, ..."""
+    exports = {f"f{i}": i for i in range(len(funcs))}
+    return compile_baseline(
+        parse_module(make_module_wasm(types, funcs, exports, **kwargs))
+    )
+
+
+def run(obj: bytes, tmp_path, decls: str, calls: list[str]) -> list[str]:
+    """Link ``obj`` with the runtime and a driver printing each of ``calls``.
+
+    ``calls`` are C expressions converted to ``long long``; doubles are
+    printed through their bits.
+    """
+    (tmp_path / "module.o").write_bytes(obj)
+    prints = "".join(f'printf("%lld\\n", (long long)({call}));' for call in calls)
+    (tmp_path / "main.c").write_text(
+        "#include <stdio.h>\n#include <string.h>\n"
+        "extern void __wasm_memory_init(void);\n"
+        "static long long bits(double d)"
+        " { long long b; memcpy(&b, &d, 8); return b; }\n"
+        f"{decls}\n"
+        f"int main(void) {{ __wasm_memory_init(); {prints} return 0; }}\n"
+    )
+    exe = tmp_path / "program"
+    subprocess.run(
+        [
+            "gcc",
+            "-o",
+            str(exe),
+            str(tmp_path / "module.o"),
+            str(tmp_path / "main.c"),
+            str(runtime_library("gcc")),
+            "-lm",
+        ],
+        capture_output=True,
+        text=True,
+        check=True,
+    )
+    result = subprocess.run([str(exe)], capture_output=True, text=True, timeout=10)
+    assert result.returncode == 0, result.stderr
+    return result.stdout.split()
+
+
+def f64_bits(value: float) -> str:
+    return str(struct.unpack("<q", struct.pack("<d", value))[0])
+
+
+# fmt: off
+# a, b = 0, 1; while (n) { a, b = b, a + b; n-- }; a
+FIB = bytes([
+    0x01, 0x03, 0x7F,
+    0x41, 0x00, 0x21, 0x01, 0x41, 0x01, 0x21, 0x02,
+    0x02, 0x40, 0x03, 0x40,
+    0x20, 0x00, 0x45, 0x0D, 0x01,
+    0x20, 0x01, 0x20, 0x02, 0x6A, 0x21, 0x03,
+    0x20, 0x02, 0x21, 0x01, 0x20, 0x03, 0x21, 0x02,
+    0x20, 0x00, 0x41, 0x01, 0x6B, 0x21, 0x00,
+    0x0C, 0x00,
+    0x0B, 0x0B,
+    0x20, 0x01, 0x0B,
+])
+# n < 2 ? 1 : n * f1(n - 1)
+FACTORIAL = bytes([
+    0x00, 0x20, 0x00, 0x41, 0x02, 0x48,
+    0x04, 0x7F, 0x41, 0x01,
+    0x05, 0x20, 0x00, 0x20, 0x00, 0x41, 0x01, 0x6B, 0x10, 0x01, 0x6C,
+    0x0B, 0x0B,
+])
+# switch (n) { 0: 10, 1: 20, 2: 30, default: 40 } via br_table
+SWITCH = bytes([
+    0x00,
+    0x02, 0x40, 0x02, 0x40, 0x02, 0x40, 0x02, 0x40,
+    0x20, 0x00, 0x0E, 0x03, 0x00, 0x01, 0x02, 0x03,
+    0x0B, 0x41, 0x0A, 0x0F,
+    0x0B, 0x41, 0x14, 0x0F,
+    0x0B, 0x41, 0x1E, 0x0F,
+    0x0B, 0x41, 0x28, 0x0B,
+])
+# n + n + ... with thirteen copies of n live at once
+DEEP_STACK = bytes([0x00, *[0x20, 0x00] * 13, *[0x6A] * 12, 0x0B])
+# (n * 2, n + 1)
+TWO_RESULTS = bytes([
+    0x00, 0x20, 0x00, 0x41, 0x02, 0x6C, 0x20, 0x00, 0x41, 0x01, 0x6A, 0x0B,
+])
+# f0(n) then a - b
+SUBTRACT_RESULTS = bytes([0x00, 0x20, 0x00, 0x10, 0x00, 0x6B, 0x0B])
+# a1 + 2 a2 + ... + 8 a8
+WEIGHTED_SUM = bytes([
+    0x00, 0x20, 0x00,
+    *[b for k in range(1, 8) for b in (0x20, k, 0x41, k + 1, 0x6C, 0x6A)],
+    0x0B,
+])
+# f0(n, 1, 2, 3, 4, 5, 6, 7): two arguments go on the machine stack
+CALL_WEIGHTED_SUM = bytes([
+    0x00, 0x20, 0x00, *[b for k in range(1, 8) for b in (0x41, k)], 0x10, 0x00, 0x0B,
+])
+# rotl(x * 0x100000001, 8) ^ (x >> 3)
+I64_BITS = bytes([
+    0x00, 0x20, 0x00, 0x42, 0x81, 0x80, 0x80, 0x80, 0x10, 0x7E,
+    0x42, 0x08, 0x89, 0x20, 0x00, 0x42, 0x03, 0x88, 0x85, 0x0B,
+])
+# a * b + max(a, b)
+F64_ARITHMETIC = bytes([
+    0x00, 0x20, 0x00, 0x20, 0x01, 0xA2, 0x20, 0x00, 0x20, 0x01, 0xA5, 0xA0, 0x0B,
+])
+# [n] = n * 3; [n + 4] = 0xFFFF; load8_u [n] + load16_s [n + 4]
+MEMORY = bytes([
+    0x00,
+    0x20, 0x00, 0x20, 0x00, 0x41, 0x03, 0x6C, 0x36, 0x02, 0x00,
+    0x20, 0x00, 0x41, 0xFF, 0xFF, 0x03, 0x36, 0x02, 0x04,
+    0x20, 0x00, 0x2D, 0x00, 0x00, 0x20, 0x00, 0x2E, 0x01, 0x04, 0x6A,
+    0x0B,
+])
+# g += n; g
+COUNTER = bytes([0x00, 0x23, 0x00, 0x20, 0x00, 0x6A, 0x24, 0x00, 0x23, 0x00, 0x0B])
+# table[i](7)
+CALL_INDIRECT = bytes([0x00, 0x41, 0x07, 0x20, 0x00, 0x11, 0x00, 0x00, 0x0B])
+# n ? a : b with a = 5, b = 9
+SELECT = bytes([0x00, 0x41, 0x05, 0x41, 0x09, 0x20, 0x00, 0x1B, 0x0B])
+# a / b, a % b (signed)
+DIVIDE = bytes([0x00, 0x20, 0x00, 0x20, 0x01, 0x6D, 0x0B])
+REMAINDER = bytes([0x00, 0x20, 0x00, 0x20, 0x01, 0x6F, 0x0B])
+# i64.trunc_f64_u(f64.convert_i64_u(x))
+UNSIGNED_ROUND_TRIP = bytes([0x00, 0x20, 0x00, 0xBA, 0xB1, 0x0B])
+# n read before an if that may set it: n + (n ? 100 : 0)
+IF_SETS_LOCAL = bytes([
+    0x00, 0x20, 0x00, 0x20, 0x00,
+    0x04, 0x40, 0x41, 0xE4, 0x00, 0x21, 0x00, 0x0B,
+    0x20, 0x00, 0x6A, 0x0B,
+])
+# n read before a tee sets it: (n + 7) * 7
+TEE_OVER_READ = bytes([
+    0x00, 0x20, 0x00, 0x41, 0x07, 0x22, 0x00, 0x6A, 0x20, 0x00, 0x6C, 0x0B,
+])
+# x reinterpreted as f64, then x = 0, then back
+REINTERPRET_THEN_SET = bytes([
+    0x00, 0x20, 0x00, 0xBF, 0x42, 0x00, 0x21, 0x00, 0xBD, 0x0B,
+])
+# fmt: on
+
+
+class TestObject:
+    """The ELF object itself."""
+
+    def test_elf_header(self):
+        obj = compile_funcs([I32_TO_I32], [(0, FIB)])
+        assert obj[:4] == b"\x7fELF"
+        assert obj[4] == 2  # 64-bit
+        assert struct.unpack_from("<HH", obj, 16) == (1, 62)  # ET_REL, x86-64
+
+    def test_symbols(self, tmp_path):
+        if shutil.which("nm") is None:
+            pytest.skip("nm is not installed")
+        obj_path = tmp_path / "module.o"
+        obj_path.write_bytes(
+            compile_funcs([I32_TO_I32], [(0, FIB), (0, FIB)], memory=True)
+        )
+        result = subprocess.run(
+            ["nm", str(obj_path)], capture_output=True, text=True, check=True
+        )
+        symbols = result.stdout
+        assert "T wasm_f0" in symbols
+        assert "T wasm_f1" in symbols
+        assert "T __wasm_memory_init" in symbols
+        assert "U __wasm_memory_grow" in symbols
+
+    def test_unsupported_instruction(self):
+        # An 0xFD (SIMD) instruction
+        body = bytes([0x00, 0xFD, 0x0F, 0x0B])
+        with pytest.raises(CompileError, match="unsupported instruction 0xfd"):
+            compile_funcs([I32_TO_I32], [(0, body)])
+
+    def test_multiple_memories_rejected(self):
+        # Turn the one-page memory section into two memories
+        wasm = make_module_wasm([I32_TO_I32], [(0, FIB)], {"f": 0}, memory=True)
+        wasm = wasm.replace(
+            bytes([0x05, 0x03, 0x01, 0x00, 0x01]),
+            bytes([0x05, 0x05, 0x02, 0x00, 0x01, 0x00, 0x01]),
+        )
+        with pytest.raises(CompileError, match="multiple memories"):
+            compile_baseline(parse_module(wasm))
+
+
+class TestBenchmark:
+    """The compile-speed benchmark."""
+
+    def test_stages(self):
+        size, timings = run_benchmark(functions=4, unroll=1, repeat=1)
+        assert size == len(synthetic_module(4, 1))
+        assert list(timings)[:2] == ["baseline", "qbe:frontend"]
+        assert all(seconds > 0 for seconds in timings.values())
+
+    def test_report_states_target(self, capsys):
+        main(["--functions", "4", "--unroll", "1", "--repeat", "1"])
+        report = capsys.readouterr().out
+        assert f"baseline target: {TARGET_MB_S:.0f} MB/s, measured" in report
+
+
+@needs_x86_64
+class TestExecution:
+    """Baseline objects linked with the runtime and run."""
+
+    def test_loop(self, tmp_path):
+        obj = compile_funcs([I32_TO_I32], [(0, FIB)])
+        output = run(obj, tmp_path, "int wasm_f0(int);", ["wasm_f0(10)", "wasm_f0(30)"])
+        assert output == ["55", "832040"]
+
+    def test_recursion(self, tmp_path):
+        obj = compile_funcs([I32_TO_I32], [(0, FIB), (0, FACTORIAL)])
+        output = run(obj, tmp_path, "int wasm_f1(int);", ["wasm_f1(10)"])
+        assert output == ["3628800"]
+
+    def test_br_table(self, tmp_path):
+        obj = compile_funcs([I32_TO_I32], [(0, SWITCH)])
+        calls = [f"wasm_f0({n})" for n in (0, 1, 2, 3, -1)]
+        output = run(obj, tmp_path, "int wasm_f0(int);", calls)
+        assert output == ["10", "20", "30", "40", "40"]
+
+    def test_register_spills(self, tmp_path):
+        obj = compile_funcs([I32_TO_I32], [(0, DEEP_STACK)])
+        output = run(obj, tmp_path, "int wasm_f0(int);", ["wasm_f0(3)"])
+        assert output == ["39"]
+
+    def test_multi_value_call(self, tmp_path):
+        obj = compile_funcs(
+            [I32_TO_I32_I32, I32_TO_I32], [(0, TWO_RESULTS), (1, SUBTRACT_RESULTS)]
+        )
+        output = run(obj, tmp_path, "int wasm_f1(int);", ["wasm_f1(10)"])
+        assert output == ["9"]
+
+    def test_stack_arguments(self, tmp_path):
+        obj = compile_funcs(
+            [EIGHT_I32_TO_I32, I32_TO_I32], [(0, WEIGHTED_SUM), (1, CALL_WEIGHTED_SUM)]
+        )
+        decls = "int wasm_f0(int, int, int, int, int, int, int, int); int wasm_f1(int);"
+        calls = ["wasm_f0(1, 1, 1, 1, 1, 1, 1, 1)", "wasm_f1(100)"]
+        output = run(obj, tmp_path, decls, calls)
+        expected = 100 + sum(k * (k + 1) for k in range(1, 8))
+        assert output == ["36", str(expected)]
+
+    def test_i64(self, tmp_path):
+        obj = compile_funcs([I64_TO_I64], [(0, I64_BITS)])
+        x = 0x123456789
+        mask = (1 << 64) - 1
+        product = x * 0x100000001 & mask
+        rotated = (product << 8 | product >> 56) & mask
+        expected = rotated ^ x >> 3
+        if expected >= 1 << 63:
+            expected -= 1 << 64
+        decls = "long long wasm_f0(long long);"
+        output = run(obj, tmp_path, decls, [f"wasm_f0({x}LL)"])
+        assert output == [str(expected)]
+
+    def test_f64(self, tmp_path):
+        obj = compile_funcs([F64_F64_TO_F64], [(0, F64_ARITHMETIC)])
+        decls = "double wasm_f0(double, double);"
+        calls = ["bits(wasm_f0(1.5, -2.0))", "bits(wasm_f0(-0.0, 0.0))"]
+        output = run(obj, tmp_path, decls, calls)
+        assert output == [f64_bits(1.5 * -2.0 + 1.5), f64_bits(0.0)]
+
+    def test_memory(self, tmp_path):
+        obj = compile_funcs([I32_TO_I32], [(0, MEMORY)], memory=True)
+        output = run(obj, tmp_path, "int wasm_f0(int);", ["wasm_f0(16)"])
+        assert output == [str(48 - 1)]
+
+    def test_data_segment(self, tmp_path):
+        # load8_u [n + 16] over a "hello" segment at 16
+        body = bytes([0x00, 0x20, 0x00, 0x2D, 0x00, 0x10, 0x0B])
+        obj = compile_funcs([I32_TO_I32], [(0, body)], memory=True, data={16: b"hello"})
+        output = run(obj, tmp_path, "int wasm_f0(int);", ["wasm_f0(1)"])
+        assert output == [str(ord("e"))]
+
+    def test_mutable_global(self, tmp_path):
+        counter = [bytes([0x7F, 0x01, 0x41, 0x05, 0x0B])]
+        obj = compile_funcs([I32_TO_I32], [(0, COUNTER)], globals_=counter)
+        output = run(obj, tmp_path, "int wasm_f0(int);", ["wasm_f0(1)", "wasm_f0(10)"])
+        assert output == ["6", "16"]
+
+    def test_call_indirect(self, tmp_path):
+        add_one = bytes([0x00, 0x20, 0x00, 0x41, 0x01, 0x6A, 0x0B])
+        double = bytes([0x00, 0x20, 0x00, 0x41, 0x01, 0x74, 0x0B])
+        obj = compile_funcs(
+            [I32_TO_I32],
+            [(0, CALL_INDIRECT), (0, add_one), (0, double)],
+            elements=[1, 2],
+        )
+        output = run(obj, tmp_path, "int wasm_f0(int);", ["wasm_f0(0)", "wasm_f0(1)"])
+        assert output == ["8", "14"]
+
+    def test_select(self, tmp_path):
+        obj = compile_funcs([I32_TO_I32], [(0, SELECT)])
+        output = run(obj, tmp_path, "int wasm_f0(int);", ["wasm_f0(1)", "wasm_f0(0)"])
+        assert output == ["5", "9"]
+
+    def test_division(self, tmp_path):
+        obj = compile_funcs([I32_I32_TO_I32], [(0, DIVIDE), (0, REMAINDER)])
+        decls = "int wasm_f0(int, int); int wasm_f1(int, int);"
+        calls = ["wasm_f0(-7, 2)", "wasm_f1(-7, 2)", "wasm_f1(-2147483647 - 1, -1)"]
+        assert run(obj, tmp_path, decls, calls) == ["-3", "-1", "0"]
+
+    def test_unsigned_conversions(self, tmp_path):
+        obj = compile_funcs([I64_TO_I64], [(0, UNSIGNED_ROUND_TRIP)])
+        decls = "unsigned long long wasm_f0(unsigned long long);"
+        big = "(1ULL << 63 | 2048)"
+        calls = ["wasm_f0(1000ULL) == 1000ULL", f"wasm_f0({big}) == {big}"]
+        assert run(obj, tmp_path, decls, calls) == ["1", "1"]
+
+    def test_local_reads_in_place(self, tmp_path):
+        """Values read from a local keep the old value when it's set."""
+        obj = compile_funcs(
+            [I32_TO_I32, I64_TO_I64],
+            [(0, IF_SETS_LOCAL), (0, TEE_OVER_READ), (1, REINTERPRET_THEN_SET)],
+        )
+        decls = "int wasm_f0(int); int wasm_f1(int); long long wasm_f2(long long);"
+        calls = ["wasm_f0(5)", "wasm_f0(0)", "wasm_f1(3)", "wasm_f2(123456789LL)"]
+        assert run(obj, tmp_path, decls, calls) == ["105", "0", "70", "123456789"]
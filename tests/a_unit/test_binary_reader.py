@@ -84,6 +84,15 @@ class TestLEB128:
         reader = BinaryReader(b"\xff\xff\xff\xff\x07")
         assert reader.read_s64_leb128() == 0x7FFFFFFF
 
+    def test_s32_min(self):
+        # INT32_MIN needs all 5 bytes; the sign is in the last one
+        reader = BinaryReader(b"\x80\x80\x80\x80\x78")
+        assert reader.read_s32_leb128() == -0x80000000
+
+    def test_s64_min(self):
+        reader = BinaryReader(b"\x80" * 9 + b"\x7f")
+        assert reader.read_s64_leb128() == -0x8000000000000000
+
 
 class TestFloats:
     """Tests for float reading."""
@@ -3,6 +3,7 @@
 from __future__ import annotations
 
 from waq.compiler import compile_module
+from waq.compiler.instructions.control import _br_table_ranges
 from waq.parser.module import parse_module
 
 
@@ -32,6 +33,8 @@ def make_br_table_3_targets_wasm() -> bytes:
         0x40,  # block
         0x02,
         0x40,  # block
+        0x41,
+        0x00,  # i32.const 0 (default result)
         0x20,
         0x00,  # local.get 0
         # br_table: 3 targets [0, 1, 2] + default 3
@@ -57,8 +60,6 @@ def make_br_table_3_targets_wasm() -> bytes:
         0x0C,
         0x00,  # br 0
         0x0B,  # end (outer)
-        0x41,
-        0x00,  # i32.const 0 (default)
         0x0B,  # end function
     ])
 
@@ -101,6 +102,7 @@ def make_simple_br_table_wasm() -> bytes:
     # block (result i32)
     #   block
     #     block
+    #       i32.const 0
     #       local.get 0
     #       br_table 0 1 2
     #     end (inner: idx=0) -> return 1
@@ -109,8 +111,7 @@ def make_simple_br_table_wasm() -> bytes:
     #   end (middle: idx=1) -> return 2
     #   i32.const 2
     #   br 0
-    # end (outer: default) -> return 0
-    # i32.const 0
+    # end (outer: default carries the i32.const 0 pushed before the index)
     func_body = bytes([
         0x00,  # 0 locals
         0x02,
@@ -119,6 +120,8 @@ def make_simple_br_table_wasm() -> bytes:
         0x40,  # block
         0x02,
         0x40,  # block
+        0x41,
+        0x00,  # i32.const 0 (default result)
         0x20,
         0x00,  # local.get 0
         0x0E,
@@ -137,8 +140,6 @@ def make_simple_br_table_wasm() -> bytes:
         0x0C,
         0x00,  # br 0
         0x0B,  # end
-        0x41,
-        0x00,  # i32.const 0 (default)
         0x0B,  # end function
     ])
 
@@ -171,19 +172,20 @@ class TestBrTable:
         module = parse_module(wasm)
         qbe = compile_module(module)
         output = qbe.emit()
-        # Should have multiple comparison blocks
-        assert "ceqw" in output  # comparison for each case
+        # Should compare the index against range bounds
+        assert "cultw" in output
         # Should have multiple jumps
         assert "jnz" in output or "jmp" in output
 
     def test_br_table_generates_comparisons(self):
-        """Test that br_table generates comparison for each case."""
+        """Test that br_table searches over its three ranges."""
         wasm = make_simple_br_table_wasm()
         module = parse_module(wasm)
         qbe = compile_module(module)
         output = qbe.emit()
-        # br_table with 2 targets should generate at least 2 comparisons
-        assert output.count("ceqw") >= 2
+        # [0], [1], [2..] -> two compares; no separate bounds check
+        assert output.count("cultw") == 2
+        assert "ceqw" not in output
 
     def test_br_table_with_more_targets(self):
         """Test br_table with more branch targets."""
@@ -191,5 +193,50 @@ class TestBrTable:
         module = parse_module(wasm)
         qbe = compile_module(module)
         output = qbe.emit()
-        # br_table with 3 targets should generate at least 3 comparisons
-        assert output.count("ceqw") >= 3
+        # Four ranges -> three compares
+        assert output.count("cultw") == 3
+
+
+def _leb128(value: int) -> bytes:
+    """Encode an unsigned LEB128 integer."""
+    out = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value:
+            out.append(byte | 0x80)
+        else:
+            out.append(byte)
+            return bytes(out)
+
+
+class TestBrTableRanges:
+    """Tests for clustering br_table entries into ranges."""
+
+    def test_adjacent_entries_merge(self):
+        """Runs of the same depth collapse, including into the default."""
+        assert _br_table_ranges([0, 0, 0, 1, 1, 2, 2], 2) == [(0, 0), (3, 1), (5, 2)]
+
+    def test_dense_dispatch_compiles(self):
+        """A large br_table compiles to a search tree, not a linear chain."""
+        n = 64
+        # block x (n+1) { local.get 0; br_table 0..n-1 default n } ... i32.const k
+        body = bytearray([0x00])
+        body += bytes([0x02, 0x40]) * (n + 1)
+        body += bytes([0x20, 0x00, 0x0E, n]) + bytes(range(n)) + bytes([n])
+        for _ in range(n + 1):
+            body += bytes([0x0B])
+        body += bytes([0x41, 0x00, 0x0B])
+
+        code_section = bytes([0x01]) + _leb128(len(body)) + bytes(body)
+        wasm = bytes([0x00, 0x61, 0x73, 0x6D, 0x01, 0x00, 0x00, 0x00])
+        wasm += bytes([0x01, 0x06, 0x01, 0x60, 0x01, 0x7F, 0x01, 0x7F])
+        wasm += bytes([0x03, 0x02, 0x01, 0x00])
+        wasm += bytes([0x0A]) + _leb128(len(code_section)) + code_section
+
+        output = compile_module(parse_module(wasm)).emit()
+        # n + 1 ranges: n compares in total, but each path only ~log2(n)
+        assert output.count("cultw") == n
+        assert "ceqw" not in output
+        # Every index reaches the root compare against the middle range
+        assert f"cultw %p0, {(n + 1) // 2}" in output
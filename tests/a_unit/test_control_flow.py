@@ -947,3 +947,83 @@ class TestIfElseWithResults:
         assert "jnz" in output
         assert "then" in output
         assert "else" in output
+
+
+def _wrap_i32_to_i32(func_body: bytes) -> bytes:
+    """Wrap a single (i32) -> (i32) function body in a module."""
+    code_section = bytes([0x01, len(func_body)]) + func_body
+    return (
+        bytes([
+            0x00,
+            0x61,
+            0x73,
+            0x6D,  # magic
+            0x01,
+            0x00,
+            0x00,
+            0x00,  # version
+            # Type section: (i32) -> (i32)
+            0x01,
+            0x06,
+            0x01,
+            0x60,
+            0x01,
+            0x7F,
+            0x01,
+            0x7F,
+            # Function section
+            0x03,
+            0x02,
+            0x01,
+            0x00,
+            # Code section
+            0x0A,
+            len(code_section),
+        ])
+        + code_section
+    )
+
+
+class TestBranchValues:
+    """Tests for values carried by branches to a block's end."""
+
+    def test_br_if_value_merges_with_phi(self):
+        """A value carried by br_if meets the fallthrough value in a phi."""
+        # block (result i32) { i32.const 1; local.get 0; br_if 0; drop; i32.const 2 }
+        func_body = bytes([
+            0x00,  # 0 locals
+            0x02,
+            0x7F,  # block (result i32)
+            0x41,
+            0x01,  # i32.const 1
+            0x20,
+            0x00,  # local.get 0
+            0x0D,
+            0x00,  # br_if 0
+            0x1A,  # drop
+            0x41,
+            0x02,  # i32.const 2
+            0x0B,  # end block
+            0x0B,  # end
+        ])
+        output = compile_module(parse_module(_wrap_i32_to_i32(func_body))).emit()
+        assert "phi" in output
+
+    def test_code_after_br_is_skipped(self):
+        """Unreachable code after br is not compiled."""
+        # block (result i32) { local.get 0; br 0; f32.add } -- the dead f32.add
+        # would underflow the value stack if it were compiled
+        func_body = bytes([
+            0x00,  # 0 locals
+            0x02,
+            0x7F,  # block (result i32)
+            0x20,
+            0x00,  # local.get 0
+            0x0C,
+            0x00,  # br 0
+            0x92,  # f32.add (dead)
+            0x0B,  # end block
+            0x0B,  # end
+        ])
+        output = compile_module(parse_module(_wrap_i32_to_i32(func_body))).emit()
+        assert "=s add" not in output
@@ -0,0 +1,208 @@
+"""Tests for deterministic execution (waq.compiler.deterministic)."""
+
+from __future__ import annotations
+
+import struct
+
+import pytest
+
+from waq.compiler import compile_module
+from waq.parser.module import parse_module
+
+from .conftest import F32, F64, V128, func_type, make_module_wasm
+from .test_simd import function_body, simd
+
+# Canonical NaN bits, as the IL spells them
+CANONICAL_F32 = str(0x7FC00000)
+CANONICAL_F64 = str(0x7FF8000000000000)
+
+
+def compile_body(
+    params: list[int],
+    result: int,
+    body: bytes,
+    *,
+    deterministic: bool = True,
+    opt_level: int = 0,
+) -> str:
+    wasm = make_module_wasm([func_type(params, [result])], [(0, body)], {"f": 0})
+    output = compile_module(
+        parse_module(wasm), opt_level=opt_level, deterministic=deterministic
+    ).emit()
+    return function_body(output, "wasm_f")
+
+
+def f64_const(value: float) -> bytes:
+    return bytes([0x44]) + struct.pack("<d", value)
+
+
+# local.get 0, local.get 1
+BOTH_PARAMS = bytes([0x00, 0x20, 0x00, 0x20, 0x01])
+
+
+class TestCanonicalization:
+    """Float instructions that may produce a NaN select the canonical one."""
+
+    @pytest.mark.parametrize("opt_level", [0, 2])
+    def test_f64_div(self, opt_level):
+        body = compile_body(
+            [F64, F64], F64, BOTH_PARAMS + bytes([0xA3, 0x0B]), opt_level=opt_level
+        )
+        assert "cuod" in body
+        assert CANONICAL_F64 in body
+
+    def test_f32_add(self):
+        body = compile_body([F32, F32], F32, BOTH_PARAMS + bytes([0x92, 0x0B]))
+        assert "cuos" in body
+        assert CANONICAL_F32 in body
+
+    def test_off_by_default(self):
+        body = compile_body(
+            [F64, F64], F64, BOTH_PARAMS + bytes([0xA3, 0x0B]), deterministic=False
+        )
+        assert "cuod" not in body
+        assert CANONICAL_F64 not in body
+
+    @pytest.mark.parametrize(
+        ("opcode", "helper"), [(0x9F, "__wasm_f64_sqrt"), (0x9C, "__wasm_f64_floor")]
+    )
+    def test_helpers(self, opcode, helper):
+        body = compile_body([F64], F64, bytes([0x00, 0x20, 0x00, opcode, 0x0B]))
+        assert f"call ${helper}(" in body
+        assert CANONICAL_F64 in body
+
+    def test_demote(self):
+        # f32.demote_f64
+        body = compile_body([F64], F32, bytes([0x00, 0x20, 0x00, 0xB6, 0x0B]))
+        assert "truncd" in body
+        assert CANONICAL_F32 in body
+
+    def test_min(self):
+        """min's NaN comes from a float add, which is canonicalized."""
+        body = compile_body([F32, F32], F32, BOTH_PARAMS + bytes([0x96, 0x0B]))
+        assert CANONICAL_F32 in body
+
+    def test_sign_operations_are_left_alone(self):
+        """neg, abs and copysign keep the NaN payload, as WASM requires."""
+        for opcode in (0x99, 0x9A):
+            body = compile_body([F64], F64, bytes([0x00, 0x20, 0x00, opcode, 0x0B]))
+            assert CANONICAL_F64 not in body
+        body = compile_body([F64, F64], F64, BOTH_PARAMS + bytes([0xA6, 0x0B]))
+        assert CANONICAL_F64 not in body
+
+
+class TestRangeAnalysis:
+    """Results proven not to be NaN are left alone."""
+
+    I32 = 0x7F
+
+    def test_converted_integer_plus_constant(self):
+        # f64.convert_i32_s(n) + 1.0
+        body = compile_body(
+            [self.I32],
+            F64,
+            bytes([0x00, 0x20, 0x00, 0xB7]) + f64_const(1.0) + bytes([0xA0, 0x0B]),
+        )
+        assert "add" in body
+        assert CANONICAL_F64 not in body
+
+    def test_sqrt(self):
+        # f64.sqrt(f64.convert_i32_u(n)); with convert_i32_s, negative n give NaN
+        for convert, canonicalized in ((0xB8, False), (0xB7, True)):
+            code = bytes([0x00, 0x20, 0x00, convert, 0x9F, 0x0B])
+            body = compile_body([self.I32], F64, code)
+            assert (CANONICAL_F64 in body) == canonicalized
+
+    def test_product_plus_infinity(self):
+        """x * y is a number for finite x and y, but may be infinite."""
+        # convert_u(n) * convert_u(n) + inf, then - inf
+        convert = bytes([0x20, 0x00, 0xB8])
+        body = compile_body(
+            [self.I32],
+            F64,
+            bytes([0x00])
+            + convert
+            + convert
+            + bytes([0xA2])
+            + f64_const(float("inf"))
+            + bytes([0xA0])
+            + f64_const(float("inf"))
+            + bytes([0xA1, 0x0B]),
+        )
+        # Both addends are non-negative; only the subtraction can be inf - inf
+        assert body.count(CANONICAL_F64) == 1
+
+    def test_division_by_constant(self):
+        # convert(n) / 2.0 is a number, convert(n) / 0.0 may be 0 / 0
+        convert = bytes([0x00, 0x20, 0x00, 0xB7])
+        body = compile_body(
+            [self.I32], F64, convert + f64_const(2.0) + bytes([0xA3, 0x0B])
+        )
+        assert CANONICAL_F64 not in body
+        body = compile_body(
+            [self.I32], F64, convert + f64_const(0.0) + bytes([0xA3, 0x0B])
+        )
+        assert CANONICAL_F64 in body
+
+    def test_loop_keeps_facts(self):
+        """A loop-carried sum of non-negative values is never a NaN."""
+        # local x f64; loop { x = x + convert_u(n); br_if 0 n }; x
+        body = bytes([0x01, 0x01, F64])
+        body += bytes([0x03, 0x40])  # loop
+        body += bytes([0x20, 0x01, 0x20, 0x00, 0xB8, 0xA0, 0x21, 0x01])
+        body += bytes([0x20, 0x00, 0x0D, 0x00, 0x0B])  # br_if 0 n; end
+        body += bytes([0x20, 0x01, 0x0B])
+        for opt_level in (0, 2):
+            output = compile_body([self.I32], F64, body, opt_level=opt_level)
+            assert CANONICAL_F64 not in output
+
+
+class TestRelaxedSimd:
+    """Relaxed SIMD takes the deterministic profile's results."""
+
+    V128_TERNARY = [V128, V128, V128]
+
+    def compile_v128(self, params: list[int], sub_opcode: int, **kwargs) -> str:
+        gets = b"".join(bytes([0x20, i]) for i in range(len(params)))
+        return compile_body(
+            params, V128, b"\x00" + gets + simd(sub_opcode) + b"\x0b", **kwargs
+        )
+
+    def test_madd_is_unfused(self):
+        body = self.compile_v128(self.V128_TERNARY, 0x105)
+        assert "call $__wasm_f32x4_mul(" in body
+        assert "call $__wasm_f32x4_add(" in body
+        assert "call $__wasm_f32x4_canon_nan(" in body
+        assert "relaxed" not in body
+
+    def test_nmadd_subtracts(self):
+        body = self.compile_v128(self.V128_TERNARY, 0x108)
+        assert "call $__wasm_f64x2_mul(" in body
+        assert "call $__wasm_f64x2_sub(" in body
+
+    @pytest.mark.parametrize(
+        ("sub_opcode", "params", "kernel"),
+        [
+            (0x100, [V128, V128], "i8x16_swizzle"),
+            (0x101, [V128], "i32x4_trunc_sat_f32x4_s"),
+            (0x10B, [V128, V128, V128], "v128_bitselect"),
+            (0x10F, [V128, V128], "f64x2_min"),
+            (0x111, [V128, V128], "i16x8_q15mulr_sat_s"),
+            (0x112, [V128, V128], "i16x8_dot_i8x16_i7x16_s"),
+            (0x113, [V128, V128, V128], "i32x4_dot_i8x16_i7x16_add_s"),
+        ],
+    )
+    def test_exact_kernels(self, sub_opcode, params, kernel):
+        body = self.compile_v128(params, sub_opcode)
+        assert f"call $__wasm_{kernel}(" in body
+        assert "relaxed" not in body
+        relaxed = self.compile_v128(params, sub_opcode, deterministic=False)
+        assert "relaxed" in relaxed
+
+    def test_float_lanes_are_canonicalized(self):
+        # f32x4.div
+        body = self.compile_v128([V128, V128], 0xE7)
+        assert "call $__wasm_f32x4_canon_nan(" in body
+        # f32x4.neg only flips signs
+        body = self.compile_v128([V128], 0xE1)
+        assert "canon_nan" not in body
@@ -4,6 +4,7 @@ from __future__ import annotations
 
 from waq.compiler import compile_module
 from waq.parser.module import parse_module
+from waq.parser.types import ValueType
 
 
 def make_try_catch_wasm() -> bytes:
@@ -12,12 +13,15 @@ def make_try_catch_wasm() -> bytes:
     () -> (i32)
     Returns 1 if exception caught, 0 otherwise.
     """
-    # Type section: () -> (i32)
-    type_section = bytes([0x01, 0x60, 0x00, 0x01, 0x7F])
+    # Type section: () -> (i32), (i32) -> ()
+    type_section = bytes([0x02, 0x60, 0x00, 0x01, 0x7F, 0x60, 0x01, 0x7F, 0x00])
 
     # Function section
     func_section = bytes([0x01, 0x00])
 
+    # Tag section: tag 0 carries an i32 (type 1)
+    tag_section = bytes([0x01, 0x00, 0x01])
+
     # Export section
     export_section = bytes([0x01, 0x09]) + b"try_catch" + bytes([0x00, 0x00])
 
@@ -31,7 +35,7 @@ def make_try_catch_wasm() -> bytes:
         0x0F,  # return (no exception)
         0x07,
         0x00,  # catch tag 0
-        0x1A,  # drop (exception value)
+        0x1A,  # drop (exception payload)
         0x41,
         0x01,  # i32.const 1
         0x0F,  # return (caught exception)
@@ -45,6 +49,7 @@ def make_try_catch_wasm() -> bytes:
     wasm = bytes([0x00, 0x61, 0x73, 0x6D, 0x01, 0x00, 0x00, 0x00])
     wasm += bytes([0x01, len(type_section)]) + type_section
     wasm += bytes([0x03, len(func_section)]) + func_section
+    wasm += bytes([0x0D, len(tag_section)]) + tag_section
     wasm += bytes([0x07, len(export_section)]) + export_section
     wasm += bytes([0x0A, len(code_section)]) + code_section
 
@@ -63,6 +68,9 @@ def make_throw_wasm() -> bytes:
     # Function section
     func_section = bytes([0x01, 0x00])
 
+    # Tag section: tag 0 has no payload
+    tag_section = bytes([0x01, 0x00, 0x00])
+
     # Export section
     export_section = bytes([0x01, 0x05]) + b"throw" + bytes([0x00, 0x00])
 
@@ -78,6 +86,7 @@ def make_throw_wasm() -> bytes:
     wasm = bytes([0x00, 0x61, 0x73, 0x6D, 0x01, 0x00, 0x00, 0x00])
     wasm += bytes([0x01, len(type_section)]) + type_section
     wasm += bytes([0x03, len(func_section)]) + func_section
+    wasm += bytes([0x0D, len(tag_section)]) + tag_section
     wasm += bytes([0x07, len(export_section)]) + export_section
     wasm += bytes([0x0A, len(code_section)]) + code_section
 
@@ -136,9 +145,15 @@ class TestTryCatch:
         module = parse_module(wasm)
         qbe = compile_module(module)
         output = qbe.emit()
-        # Should contain exception handler calls
+        # Handler is armed with _setjmp in the compiled frame
         assert "__wasm_push_exception_handler" in output
-        assert "__wasm_get_exception" in output
+        assert "call $_setjmp" in output
+        # Tag switch: tag 0 is delivered as setjmp result 1
+        assert "ceqw" in output
+        # The catch loads the typed i32 payload
+        assert "loadw" in output
+        # Unmatched tags propagate to the enclosing handler
+        assert "__wasm_rethrow" in output
 
 
 class TestThrow:
@@ -179,6 +194,9 @@ def make_rethrow_wasm() -> bytes:
     # Function section
     func_section = bytes([0x01, 0x00])
 
+    # Tag section: tag 0 has no payload
+    tag_section = bytes([0x01, 0x00, 0x00])
+
     # Export section
     export_section = bytes([0x01, 0x07]) + b"rethrow" + bytes([0x00, 0x00])
 
@@ -200,6 +218,7 @@ def make_rethrow_wasm() -> bytes:
     wasm = bytes([0x00, 0x61, 0x73, 0x6D, 0x01, 0x00, 0x00, 0x00])
     wasm += bytes([0x01, len(type_section)]) + type_section
     wasm += bytes([0x03, len(func_section)]) + func_section
+    wasm += bytes([0x0D, len(tag_section)]) + tag_section
     wasm += bytes([0x07, len(export_section)]) + export_section
     wasm += bytes([0x0A, len(code_section)]) + code_section
 
@@ -218,9 +237,14 @@ def make_delegate_wasm() -> bytes:
     # Function section
     func_section = bytes([0x01, 0x00])
 
+    # Tag section: tag 0 has no payload
+    tag_section = bytes([0x01, 0x00, 0x00])
+
     # Export section: name length = 8 for "delegate"
     export_name = b"delegate"
-    export_section = bytes([0x01, len(export_name)]) + export_name + bytes([0x00, 0x00])
+    export_section = (
+        bytes([0x01, len(export_name)]) + export_name + bytes([0x00, 0x00])
+    )
 
     # Code section: try with delegate
     func_body = bytes([
@@ -237,6 +261,7 @@ def make_delegate_wasm() -> bytes:
     wasm = bytes([0x00, 0x61, 0x73, 0x6D, 0x01, 0x00, 0x00, 0x00])
     wasm += bytes([0x01, len(type_section)]) + type_section
     wasm += bytes([0x03, len(func_section)]) + func_section
+    wasm += bytes([0x0D, len(tag_section)]) + tag_section
     wasm += bytes([0x07, len(export_section)]) + export_section
     wasm += bytes([0x0A, len(code_section)]) + code_section
 
@@ -267,3 +292,181 @@ class TestDelegate:
         # Delegate uses try body label and pushes exception handler
         assert "__wasm_push_exception_handler" in output
         assert "try" in output
+
+
+def _wrap_module(
+    types: bytes, tags: bytes, func_body: bytes, export_name: bytes = b"f"
+) -> bytes:
+    """Wrap a single function (type 0) with the given types and tags."""
+    wasm = bytes([0x00, 0x61, 0x73, 0x6D, 0x01, 0x00, 0x00, 0x00])
+    wasm += bytes([0x01, len(types)]) + types
+    wasm += bytes([0x03, 0x02, 0x01, 0x00])
+    wasm += bytes([0x0D, len(tags)]) + tags
+    export_section = (
+        bytes([0x01, len(export_name)]) + export_name + bytes([0x00, 0x00])
+    )
+    wasm += bytes([0x07, len(export_section)]) + export_section
+    code_section = bytes([0x01, len(func_body)]) + func_body
+    wasm += bytes([0x0A, len(code_section)]) + code_section
+    return wasm
+
+
+class TestTagSection:
+    """Tests for parsing the tag section."""
+
+    def test_tags_parsed(self):
+        """Tag section entries record their signature type index."""
+        types = bytes([0x02, 0x60, 0x00, 0x00, 0x60, 0x02, 0x7F, 0x7C, 0x00])
+        tags = bytes([0x02, 0x00, 0x00, 0x00, 0x01])
+        func_body = bytes([0x00, 0x0B])
+        module = parse_module(_wrap_module(types, tags, func_body))
+        assert [tag.type_idx for tag in module.tags] == [0, 1]
+        assert module.get_tag_type(1).params == (ValueType.I32, ValueType.F64)
+
+
+class TestTypedPayloads:
+    """Tests for typed exception payloads."""
+
+    def test_throw_stores_payload(self):
+        """throw stores each operand into the handler's payload slots."""
+        # () -> (), tag 0: (i32, f64)
+        types = bytes([0x02, 0x60, 0x00, 0x00, 0x60, 0x02, 0x7F, 0x7C, 0x00])
+        tags = bytes([0x01, 0x00, 0x01])
+        func_body = bytes([
+            0x00,
+            0x41, 0x07,  # i32.const 7
+            0x44, 0, 0, 0, 0, 0, 0, 0xF0, 0x3F,  # f64.const 1.0
+            0x08, 0x00,  # throw 0
+            0x0B,
+        ])
+        module = parse_module(_wrap_module(types, tags, func_body))
+        output = compile_module(module).emit()
+        assert "call $__wasm_exception_payload(w 0)" in output
+        assert "storew" in output
+        assert "stored" in output
+        assert "add" in output  # second slot at offset 8
+        assert "call $__wasm_throw(w 0)" in output
+
+    def test_catch_dispatches_on_tag(self):
+        """Each catch clause gets its own arm of the tag switch."""
+        # () -> (i64), tag 0: (i64), tag 1: (f32)
+        types = bytes([
+            0x03,
+            0x60, 0x00, 0x01, 0x7E,
+            0x60, 0x01, 0x7E, 0x00,
+            0x60, 0x01, 0x7D, 0x00,
+        ])
+        tags = bytes([0x02, 0x00, 0x01, 0x00, 0x02])
+        func_body = bytes([
+            0x00,
+            0x06, 0x7E,  # try (result i64)
+            0x42, 0x00,  # i64.const 0
+            0x07, 0x00,  # catch 0 -> i64 on stack
+            0x07, 0x01,  # catch 1 -> f32 on stack
+            0x1A,  # drop
+            0x42, 0x01,  # i64.const 1
+            0x0B,  # end try
+            0x0B,
+        ])
+        module = parse_module(_wrap_module(types, tags, func_body))
+        output = compile_module(module).emit()
+        assert "ceqw" in output and ", 1\n" in output and ", 2\n" in output
+        assert "loadl" in output
+        assert "loads" in output
+        # The three arms merge with a phi
+        assert "phi" in output
+
+    def test_return_pops_handler(self):
+        """Returning from inside a try body pops its handler."""
+        output = compile_module(parse_module(make_catch_all_wasm())).emit()
+        body = output.split("\n@try_body", 1)[1].split("\n@", 1)[0]
+        assert "__wasm_pop_exception_handler" in body
+
+    def test_locals_stay_in_memory(self):
+        """Functions with a try keep locals in one frame slot."""
+        types = bytes([0x01, 0x60, 0x00, 0x00])
+        tags = bytes([0x01, 0x00, 0x00])
+        func_body = bytes([
+            0x01, 0x02, 0x7F,  # 2 i32 locals
+            0x06, 0x40,  # try
+            0x41, 0x01, 0x21, 0x00,  # local.set 0
+            0x19,  # catch_all
+            0x0B,
+            0x0B,
+        ])
+        module = parse_module(_wrap_module(types, tags, func_body))
+        output = compile_module(module).emit()
+        assert "%locals_frame =l alloc8 16" in output
+        assert "%local_addr1 =l add %locals_frame, 8" in output
+
+
+class TestTryTable:
+    """Tests for try_table, exnref and throw_ref."""
+
+    # () -> (i32), tag 0: (i32)
+    TYPES = bytes([0x02, 0x60, 0x00, 0x01, 0x7F, 0x60, 0x01, 0x7F, 0x00])
+    TAGS = bytes([0x01, 0x00, 0x01])
+
+    def test_local_throw_is_a_branch(self):
+        """A throw caught by an enclosing try_table becomes a plain jump."""
+        func_body = bytes([
+            0x00,
+            0x02, 0x7F,  # block (result i32)
+            0x1F, 0x40, 0x01, 0x00, 0x00, 0x00,  # try_table (catch 0 0)
+            0x41, 0x2A,  # i32.const 42
+            0x08, 0x00,  # throw 0
+            0x0B,  # end try_table
+            0x41, 0x00,  # i32.const 0
+            0x0B,  # end block
+            0x0B,
+        ])
+        output = compile_module(
+            parse_module(_wrap_module(self.TYPES, self.TAGS, func_body))
+        ).emit()
+        assert "__wasm_throw" not in output
+        assert "_setjmp" not in output
+        assert "phi" in output
+
+    def test_call_arms_handler(self):
+        """A call inside try_table may throw, so the handler is armed."""
+        func_body = bytes([
+            0x00,
+            0x02, 0x7F,  # block (result i32)
+            0x1F, 0x40, 0x01, 0x00, 0x00, 0x00,  # try_table (catch 0 0)
+            0x10, 0x00,  # call 0
+            0x1A,  # drop
+            0x0B,  # end try_table
+            0x41, 0x00,  # i32.const 0
+            0x0B,  # end block
+            0x0B,
+        ])
+        output = compile_module(
+            parse_module(_wrap_module(self.TYPES, self.TAGS, func_body))
+        ).emit()
+        assert "__wasm_push_exception_handler" in output
+        assert "_setjmp" in output
+        assert "__wasm_pop_exception_handler" in output
+        # The catch trampoline tests for tag 0 (code 1)
+        assert "ceqw" in output
+
+    def test_catch_all_ref_and_throw_ref(self):
+        """catch_all_ref boxes the exception and throw_ref rethrows it."""
+        # () -> (), tag 0: ()
+        types = bytes([0x01, 0x60, 0x00, 0x00])
+        tags = bytes([0x01, 0x00, 0x00])
+        func_body = bytes([
+            0x00,
+            0x02, 0x69,  # block (result exnref)
+            0x1F, 0x40, 0x01, 0x03, 0x00,  # try_table (catch_all_ref 0)
+            0x10, 0x00,  # call 0
+            0x0B,  # end try_table
+            0x0F,  # return
+            0x0B,  # end block
+            0x0A,  # throw_ref
+            0x0B,
+        ])
+        output = compile_module(
+            parse_module(_wrap_module(types, tags, func_body))
+        ).emit()
+        assert "__wasm_exn_new" in output
+        assert "__wasm_throw_ref" in output
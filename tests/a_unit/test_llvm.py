@@ -0,0 +1,166 @@
+"""Unit tests for the LLVM IR backend."""
+
+from __future__ import annotations
+
+import shutil
+import subprocess
+
+import pytest
+
+from waq.compiler import compile_module
+from waq.compiler.llvm import emit_llvm
+from waq.parser.module import parse_module
+
+from .conftest import I32_TO_I32, make_module_wasm
+from .test_exceptions import make_try_catch_wasm
+
+MEMORY_TAGS = "!tbaa !3, !alias.scope !8, !noalias !9"
+FRAME_TAGS = "!tbaa !4, !alias.scope !9, !noalias !8"
+
+
+def lower(wasm: bytes, opt_level: int = 2, target: str = "amd64_sysv") -> str:
+    ll = emit_llvm(compile_module(parse_module(wasm), opt_level=opt_level), target)
+    assemble(ll)
+    return ll
+
+
+def lower_i32(body: bytes, locals_: bytes = b"\x00", **kwargs) -> str:
+    """LLVM IR of a module whose exported ``f`` is ``(i32) -> i32``."""
+    module_kwargs = {k: kwargs.pop(k) for k in ("memory", "globals_") if k in kwargs}
+    wasm = make_module_wasm(
+        [I32_TO_I32], [(0, locals_ + body + b"\x0b")], {"f": 0}, **module_kwargs
+    )
+    return lower(wasm, **kwargs)
+
+
+def function_body(ll: str, name: str) -> str:
+    """The lines of ``@name``'s definition."""
+    start = ll.index(f" @{name}(")
+    return ll[start : ll.index("\n}", start)]
+
+
+def assemble(ll: str) -> None:
+    """Check ``ll`` with llvm-as, where it's installed."""
+    if shutil.which("llvm-as") is None:
+        return
+    # LLVM 14 wants opaque pointers asked for; later versions default to them
+    for flags in (["-opaque-pointers"], []):
+        result = subprocess.run(
+            ["llvm-as", *flags, "-o", "/dev/null", "-"],
+            input=ll,
+            capture_output=True,
+            text=True,
+        )
+        if result.returncode == 0:
+            return
+    raise AssertionError(result.stderr)
+
+
+class TestModule:
+    """Module-level output: triple, data and declarations."""
+
+    @pytest.mark.parametrize(
+        ("target", "triple"),
+        [("amd64_sysv", "x86_64-unknown-linux-gnu"), ("arm64_apple", "arm64-apple")],
+    )
+    def test_target_triple(self, target, triple):
+        ll = lower(b"\x00asm\x01\x00\x00\x00", target=target)
+        assert f'target triple = "{triple}' in ll
+
+    def test_global_is_internal_data(self):
+        # (global (mut i32) (i32.const 5)); global.set 0 (global.get 0 + n)
+        ll = lower_i32(
+            bytes([0x23, 0x00, 0x20, 0x00, 0x6A, 0x24, 0x00, 0x23, 0x00]),
+            globals_=[bytes([0x7F, 0x01, 0x41, 0x05, 0x0B])],
+        )
+        assert (
+            '@__wasm_global_0 = internal global <{ [4 x i8] }> <{ [4 x i8] c"\\05'
+            in ll
+        )
+        body = function_body(ll, "wasm_f")
+        assert f"store i32 %t1, ptr @__wasm_global_0, align 4, {FRAME_TAGS}" in body
+
+    def test_trap_functions_are_noreturn(self):
+        ll = lower_i32(bytes([0x20, 0x00, 0x20, 0x00, 0x6D]))
+        assert "declare void @__wasm_trap_div_by_zero() noreturn" in ll
+
+
+class TestMemory:
+    """Linear memory accesses are GEPs off the base, tagged apart from the frame."""
+
+    def test_load_is_gep_with_memory_tags(self):
+        # i32.load (local.get 0)
+        body = function_body(
+            lower_i32(bytes([0x20, 0x00, 0x28, 0x02, 0x00]), memory=True), "wasm_f"
+        )
+        assert "load ptr, ptr @__wasm_memory, align 8, " + FRAME_TAGS in body
+        assert "getelementptr i8, ptr %t0, i64 %t1" in body
+        # Nothing is known about the alignment of a WASM address
+        assert f"load i32, ptr %t2, align 1, {MEMORY_TAGS}" in body
+        assert "ptrtoint" not in body
+
+    def test_store_has_memory_tags(self):
+        # i32.store (local.get 0) (local.get 0); i32.const 0
+        body = function_body(
+            lower_i32(
+                bytes([0x20, 0x00, 0x20, 0x00, 0x36, 0x02, 0x00, 0x41, 0x00]),
+                memory=True,
+            ),
+            "wasm_f",
+        )
+        assert f"store i32 %p0, ptr %t2, align 1, {MEMORY_TAGS}" in body
+
+
+class TestArithmetic:
+    """Instructions whose LLVM counterparts are undefined where WASM's aren't."""
+
+    def test_division_traps_first(self):
+        # i32.div_s n n
+        body = function_body(lower_i32(bytes([0x20, 0x00, 0x20, 0x00, 0x6D])), "wasm_f")
+        checks = ("icmp eq i32 %p0, 0", "icmp eq i32 %p0, -2147483648")
+        assert all(body.index(check) < body.index("sdiv") for check in checks)
+        assert "call void @__wasm_trap_div_by_zero()\n  unreachable" in body
+        assert "call void @__wasm_trap_integer_overflow()\n  unreachable" in body
+
+    def test_remainder_by_minus_one_is_zero(self):
+        # i32.rem_s n n divides by 1 where n is -1, and never traps on overflow
+        body = function_body(lower_i32(bytes([0x20, 0x00, 0x20, 0x00, 0x6F])), "wasm_f")
+        assert "select i1 %.3, i32 1, i32 %p0" in body
+        assert "srem i32 %p0, %.4" in body
+        assert "__wasm_trap_integer_overflow" not in body
+
+    def test_shift_count_is_masked(self):
+        # i32.shl n n
+        body = function_body(lower_i32(bytes([0x20, 0x00, 0x20, 0x00, 0x74])), "wasm_f")
+        assert "%.1 = and i32 %p0, 31" in body
+        assert "shl i32 %p0, %.1" in body
+
+    def test_float_to_int_is_frozen(self):
+        # i32.trunc_f32_s (f32.convert_i32_s n): in range, so never checked
+        body = function_body(lower_i32(bytes([0x20, 0x00, 0xB2, 0xA8])), "wasm_f")
+        assert "%.1 = fptosi float %t0 to i32" in body
+        assert "%t1 = freeze i32 %.1" in body
+
+
+class TestControlFlow:
+    """Phis and the frame of functions that catch exceptions."""
+
+    def test_loop_counter_is_a_phi(self):
+        # local i; loop i = i + 1; br_if 0 (i < n) end; i
+        ll = lower_i32(
+            bytes([0x03, 0x40, 0x20, 0x01, 0x41, 0x01, 0x6A, 0x22, 0x01])
+            + bytes([0x20, 0x00, 0x48, 0x0D, 0x00, 0x0B, 0x20, 0x01]),
+            locals_=bytes([0x01, 0x01, 0x7F]),
+        )
+        body = function_body(ll, "wasm_f")
+        phi = next(line for line in body.splitlines() if " = phi i32 " in line)
+        # One incoming value from before the loop and one from its back edge
+        assert phi.count("[ ") == 2
+
+    def test_setjmp_function_has_volatile_frame(self):
+        ll = lower(make_try_catch_wasm())
+        body = function_body(ll, "wasm_try_catch")
+        assert "call i32 @_setjmp(i64 %t1) #0" in body
+        assert "load volatile i32, ptr %t0" in body
+        assert "declare i32 @_setjmp(i64) #0" in ll
+        assert "attributes #0 = { returns_twice }" in ll
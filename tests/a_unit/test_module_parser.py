@@ -11,7 +11,7 @@ from waq.parser.module import (
     WasmModule,
     parse_module,
 )
-from waq.parser.types import FuncType, ValueType
+from waq.parser.types import FieldType, FuncType, StructType, ValueType
 
 
 class TestModuleValidation:
@@ -549,3 +549,30 @@ class TestModuleMethods:
         module = WasmModule()
         name = module.get_func_name(5)
         assert name == "func_5"
+
+    def test_canonical_type_ids(self):
+        """Structurally equal types share an id; ids start at 1."""
+        module = WasmModule()
+        module.types = [
+            FuncType((ValueType.I32,), (ValueType.I32,)),
+            FuncType((), ()),
+            FuncType((ValueType.I32,), (ValueType.I32,)),
+            FuncType((ValueType.I64,), (ValueType.I32,)),
+        ]
+        assert module.canonical_type_ids() == [1, 2, 1, 3]
+
+    def test_canonical_type_ids_through_references(self):
+        """References to equivalent types make types equivalent."""
+        module = WasmModule()
+        module.types = [
+            FuncType((), ()),
+            FuncType((), ()),
+            StructType((FieldType(0, False),)),
+            StructType((FieldType(1, False),)),
+            StructType((FieldType(4, False),)),
+            StructType((FieldType(5, False),)),
+        ]
+        ids = module.canonical_type_ids()
+        assert ids[2] == ids[3]
+        assert ids[4] == ids[5]  # Self-references
+        assert ids[4] != ids[2]
@@ -368,7 +368,9 @@ class TestI32Bitwise:
         module = parse_module(wasm)
         qbe = compile_module(module)
         output = qbe.emit()
-        assert "__wasm_i32_rotl" in output
+        assert "call" not in output
+        assert "shl %p0, %p1" in output
+        assert "or" in output
 
     def test_i32_rotr(self):
         """Test i32.rotr instruction."""
@@ -376,7 +378,9 @@ class TestI32Bitwise:
         module = parse_module(wasm)
         qbe = compile_module(module)
         output = qbe.emit()
-        assert "__wasm_i32_rotr" in output
+        assert "call" not in output
+        assert "shr %p0, %p1" in output
+        assert "or" in output
 
 
 class TestI32Comparisons:
@@ -584,7 +588,8 @@ class TestI64Unary:
         module = parse_module(wasm)
         qbe = compile_module(module)
         output = qbe.emit()
-        assert "__wasm_i64_rotl" in output
+        assert "call" not in output
+        assert "=l shl %p0, %p1" in output
 
     def test_i64_rotr(self):
         """Test i64.rotr instruction."""
@@ -592,7 +597,8 @@ class TestI64Unary:
         module = parse_module(wasm)
         qbe = compile_module(module)
         output = qbe.emit()
-        assert "__wasm_i64_rotr" in output
+        assert "call" not in output
+        assert "=l shr %p0, %p1" in output
 
 
 class TestConstants:
@@ -1025,7 +1031,8 @@ class TestF32Unary:
         module = parse_module(wasm)
         qbe = compile_module(module)
         output = qbe.emit()
-        assert "__wasm_f32_abs" in output
+        assert "call" not in output
+        assert "and %t0, 2147483647" in output
 
     def test_f32_neg(self):
         """Test f32.neg instruction."""
@@ -1117,7 +1124,9 @@ class TestF32Arithmetic:
         module = parse_module(wasm)
         qbe = compile_module(module)
         output = qbe.emit()
-        assert "__wasm_f32_min" in output
+        assert "call" not in output
+        assert "cles %p0, %p1" in output
+        assert "cuos %p0, %p1" in output
 
     def test_f32_max(self):
         """Test f32.max instruction."""
@@ -1125,7 +1134,9 @@ class TestF32Arithmetic:
         module = parse_module(wasm)
         qbe = compile_module(module)
         output = qbe.emit()
-        assert "__wasm_f32_max" in output
+        assert "call" not in output
+        assert "cges %p0, %p1" in output
+        assert "cuos %p0, %p1" in output
 
     def test_f32_copysign(self):
         """Test f32.copysign instruction."""
@@ -1133,7 +1144,8 @@ class TestF32Arithmetic:
         module = parse_module(wasm)
         qbe = compile_module(module)
         output = qbe.emit()
-        assert "__wasm_f32_copysign" in output
+        assert "call" not in output
+        assert "and %t1, -2147483648" in output
 
 
 class TestF64Comparisons:
@@ -1197,7 +1209,8 @@ class TestF64Unary:
         module = parse_module(wasm)
         qbe = compile_module(module)
         output = qbe.emit()
-        assert "__wasm_f64_abs" in output
+        assert "call" not in output
+        assert "and %t0, 9223372036854775807" in output
 
     def test_f64_neg(self):
         """Test f64.neg instruction."""
@@ -1289,7 +1302,9 @@ class TestF64Arithmetic:
         module = parse_module(wasm)
         qbe = compile_module(module)
         output = qbe.emit()
-        assert "__wasm_f64_min" in output
+        assert "call" not in output
+        assert "=l cled %p0, %p1" in output
+        assert "=l cuod %p0, %p1" in output
 
     def test_f64_max(self):
         """Test f64.max instruction."""
@@ -1297,7 +1312,9 @@ class TestF64Arithmetic:
         module = parse_module(wasm)
         qbe = compile_module(module)
         output = qbe.emit()
-        assert "__wasm_f64_max" in output
+        assert "call" not in output
+        assert "=l cged %p0, %p1" in output
+        assert "=l cuod %p0, %p1" in output
 
     def test_f64_copysign(self):
         """Test f64.copysign instruction."""
@@ -1305,7 +1322,8 @@ class TestF64Arithmetic:
         module = parse_module(wasm)
         qbe = compile_module(module)
         output = qbe.emit()
-        assert "__wasm_f64_copysign" in output
+        assert "call" not in output
+        assert "and %t1, -9223372036854775808" in output
 
 
 class TestFloatConstants:
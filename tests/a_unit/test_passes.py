@@ -0,0 +1,587 @@
+"""Unit tests for the optimization pass manager."""
+
+from __future__ import annotations
+
+import re
+
+import pytest
+
+from waq.compiler import compile_module
+from waq.compiler.passes import PassManager
+from waq.parser.module import parse_module
+
+from .conftest import (
+    I32,
+    I32_TO_I32,
+    I64,
+    func_type,
+    make_i32_func_wasm,
+    make_module_wasm,
+)
+
+
+def compile_body(func_body: bytes, opt_level: int, *, lto: bool = False) -> str:
+    wasm_module = parse_module(make_i32_func_wasm(func_body))
+    return compile_module(wasm_module, opt_level=opt_level, lto=lto).emit()
+
+
+# fmt: off
+# (local $x i32)
+# x = n; block { br 0; <dead> }; x
+COPY_AND_DEAD_CODE = bytes([
+    0x01, 0x01, 0x7F,  # 1 local: i32
+    0x20, 0x00, 0x21, 0x01,  # x = n
+    0x02, 0x40,  # block
+    0x0C, 0x00,  # br 0
+    0x0B,  # end
+    0x20, 0x01,  # local.get x
+    0x0B,
+])
+
+# if (n) { x = 1 } else { x = 1 }; x
+SAME_VALUE_BOTH_ARMS = bytes([
+    0x01, 0x01, 0x7F,
+    0x20, 0x00,
+    0x04, 0x40,
+    0x41, 0x01, 0x21, 0x01,
+    0x05,
+    0x41, 0x01, 0x21, 0x01,
+    0x0B,
+    0x20, 0x01,
+    0x0B,
+])
+# fmt: on
+
+
+class TestPassManager:
+    """Pipeline selection by optimization level."""
+
+    def test_o0_runs_nothing(self):
+        assert PassManager(0).passes == []
+
+    def test_levels_are_cumulative(self):
+        o1 = {p.name for p in PassManager(1).passes}
+        o2 = {p.name for p in PassManager(2).passes}
+        assert o1
+        assert o1 <= o2
+
+    def test_disabled_pass(self):
+        manager = PassManager(2, disabled=frozenset({"copyprop"}))
+        assert "copyprop" not in {p.name for p in manager.passes}
+
+    def test_invalid_level(self):
+        with pytest.raises(ValueError, match="optimization level"):
+            PassManager(7)
+
+    def test_o0_is_unoptimized(self):
+        output = compile_body(COPY_AND_DEAD_CODE, 0)
+        assert "copy" in output
+
+
+class TestCleanups:
+    """The -O1 cleanup passes."""
+
+    def test_copies_are_forwarded(self):
+        output = compile_body(COPY_AND_DEAD_CODE, 1)
+        assert "copy" not in output
+        assert "ret %p0" in output
+
+    def test_phi_of_equal_constants_is_removed(self):
+        """Both arms assign 1: the merge phi collapses to the constant."""
+        output = compile_body(SAME_VALUE_BOTH_ARMS, 1)
+        assert " phi " not in output
+        assert "ret 1" in output
+
+    def test_unreachable_blocks_are_removed(self):
+        """Both arms return, so nothing reaches the block after the if."""
+        # fmt: off
+        body = bytes([
+            0x00,
+            0x20, 0x00,  # local.get 0
+            0x04, 0x40,  # if
+            0x41, 0x01, 0x0F,  # return 1
+            0x05,  # else
+            0x41, 0x02, 0x0F,  # return 2
+            0x0B,  # end
+            0x41, 0x03,  # i32.const 3
+            0x0B,
+        ])
+        # fmt: on
+        assert "@if_end" in compile_body(body, 0)
+        output = compile_body(body, 1)
+        assert "@if_end" not in output
+        assert "ret 3" not in output
+
+
+class TestConstantFolding:
+    """Folding, dead temporaries and block merging at -O1."""
+
+    def test_arithmetic_chain_folds(self):
+        # (2 + 3) * 4
+        # fmt: off
+        body = bytes([
+            0x00,
+            0x41, 0x02, 0x41, 0x03, 0x6A,  # 2 + 3
+            0x41, 0x04, 0x6C,  # * 4
+            0x0B,
+        ])
+        # fmt: on
+        output = compile_body(body, 1)
+        assert "ret 20" in output
+        assert "add" not in output
+        assert "mul" not in output
+
+    def test_wraps_at_32_bits(self):
+        # 0x7fffffff + 1
+        # fmt: off
+        body = bytes([
+            0x00,
+            0x41, 0xFF, 0xFF, 0xFF, 0xFF, 0x07,  # i32.const 0x7fffffff
+            0x41, 0x01, 0x6A,  # + 1
+            0x0B,
+        ])
+        # fmt: on
+        assert "ret -2147483648" in compile_body(body, 1)
+
+    def test_unsigned_comparison(self):
+        # -1 >u 5
+        body = bytes([0x00, 0x41, 0x7F, 0x41, 0x05, 0x4B, 0x0B])
+        assert "ret 1" in compile_body(body, 1)
+
+    def test_division_by_zero_is_kept(self):
+        """A constant division that traps must still trap at run time."""
+        body = bytes([0x00, 0x41, 0x07, 0x41, 0x00, 0x6D, 0x0B])
+        output = compile_body(body, 1)
+        assert "div 7, 0" in output
+
+    def test_identity(self):
+        # n * 1 + 0
+        body = bytes([0x00, 0x20, 0x00, 0x41, 0x01, 0x6C, 0x41, 0x00, 0x6A, 0x0B])
+        output = compile_body(body, 1)
+        assert "ret %p0" in output
+
+    def test_dead_temporaries_are_removed(self):
+        # drop(n + 5); n
+        body = bytes([0x00, 0x20, 0x00, 0x41, 0x05, 0x6A, 0x1A, 0x20, 0x00, 0x0B])
+        output = compile_body(body, 1)
+        assert "add" not in output
+
+    def test_constant_branch_is_folded(self):
+        # if (1) { return n } ; 7
+        # fmt: off
+        body = bytes([
+            0x00,
+            0x41, 0x01,
+            0x04, 0x40, 0x20, 0x00, 0x0F, 0x0B,
+            0x41, 0x07,
+            0x0B,
+        ])
+        # fmt: on
+        output = compile_body(body, 1)
+        assert "jnz" not in output
+        assert "ret 7" not in output
+
+    def test_blocks_are_merged(self):
+        """Nested blocks and br_if trampolines collapse into few blocks."""
+        # block { block { br_if 1 (n) } }; n
+        # fmt: off
+        body = bytes([
+            0x00,
+            0x02, 0x40, 0x02, 0x40,
+            0x20, 0x00, 0x0D, 0x01,
+            0x0B, 0x0B,
+            0x20, 0x00,
+            0x0B,
+        ])
+        # fmt: on
+        output = compile_body(body, 1)
+        function = output.split("}")[0]
+        assert function.count("\n@") == 1
+        assert "br_if_branch" not in output
+
+
+class TestRuntimeInlining:
+    """Inlining the IL versions of runtime helpers under --lto."""
+
+    # i31.get_s(ref.i31(n))
+    I31_ROUND_TRIP = bytes([0x00, 0x20, 0x00, 0xFB, 0x1C, 0xFB, 0x1D, 0x0B])
+
+    # if (n) { n = i32.trunc_sat_f32_s(f32(n)) }; n
+    # fmt: off
+    TRUNC_SAT_IN_IF = bytes([
+        0x00,
+        0x20, 0x00,
+        0x04, 0x40,
+        0x20, 0x00, 0xB2, 0xFC, 0x00, 0x21, 0x00,
+        0x0B,
+        0x20, 0x00,
+        0x0B,
+    ])
+    # fmt: on
+
+    def test_only_with_lto(self):
+        assert "runtime-inline" not in {p.name for p in PassManager(2).passes}
+        assert "runtime-inline" in {p.name for p in PassManager(1, lto=True).passes}
+
+    def test_calls_kept_without_lto(self):
+        output = compile_body(self.I31_ROUND_TRIP, 1)
+        assert "call $__wasm_ref_i31" in output
+        assert "call $__wasm_i31_get_s" in output
+
+    def test_calls_kept_at_o0(self):
+        output = compile_body(self.I31_ROUND_TRIP, 0, lto=True)
+        assert "call $__wasm_ref_i31" in output
+
+    def test_straight_line_helpers(self):
+        """Single-block helpers merge into the caller's block."""
+        output = compile_body(self.I31_ROUND_TRIP, 1, lto=True)
+        assert "call" not in output
+        assert "=w shl %p0, 1" in output
+        assert "=w sar " in output
+        function = output.split("}")[0]
+        assert function.count("\n@") == 1
+
+    def test_branching_helper(self):
+        """The returns of a multi-block helper meet in a phi after the call."""
+        output = compile_body(self.TRUNC_SAT_IN_IF, 1, lto=True)
+        assert "call" not in output
+        assert "=w stosi" in output
+        assert "2147483647" in output
+        assert "-2147483648" in output
+        # Two inlined blocks return constants, one the conversion
+        assert " phi " in output
+
+
+class TestFunctionInlining:
+    """Inlining calls between the module's functions at -O2."""
+
+    I32_TO_I32_I32 = func_type([I32], [I32, I32])
+
+    # n + 1
+    ADD_ONE = bytes([0x00, 0x20, 0x00, 0x41, 0x01, 0x6A, 0x0B])
+    # f0(n) + f0(n)
+    # fmt: off
+    CALL_TWICE = bytes([
+        0x00, 0x20, 0x00, 0x10, 0x00, 0x20, 0x00, 0x10, 0x00, 0x6A, 0x0B,
+    ])
+    # fmt: on
+    # f0(n)
+    CALL_ONCE = bytes([0x00, 0x20, 0x00, 0x10, 0x00, 0x0B])
+
+    def compile(self, funcs, exports, opt_level=2, types=None):
+        wasm = make_module_wasm(types or [I32_TO_I32], funcs, exports)
+        return compile_module(parse_module(wasm), opt_level=opt_level).emit()
+
+    def test_leaf_inlined_and_removed(self):
+        output = self.compile([(0, self.ADD_ONE), (0, self.CALL_TWICE)], {"f": 1})
+        assert "call" not in output
+        assert "$__wasm_func_0" not in output
+        assert output.count("add %p0, 1") == 2
+
+    def test_exported_callee_is_kept(self):
+        output = self.compile(
+            [(0, self.ADD_ONE), (0, self.CALL_TWICE)], {"g": 0, "f": 1}
+        )
+        assert "call" not in output
+        assert "function w $wasm_g(" in output
+
+    def test_not_at_o1(self):
+        output = self.compile(
+            [(0, self.ADD_ONE), (0, self.CALL_TWICE)], {"f": 1}, opt_level=1
+        )
+        assert "call $__wasm_func_0" in output
+
+    def test_single_call_site_non_leaf(self):
+        """A function called once moves into its caller even if it calls."""
+        # f0 calls the exported f2 (too big to inline, so not a leaf);
+        # f1 calls f0 once
+        big = bytes([0x00, *([0x20, 0x00, 0x41, 0x03, 0x6C, 0x21, 0x00] * 30)])
+        big += bytes([0x20, 0x00, 0x0B])
+        callee = bytes([0x00, 0x20, 0x00, 0x10, 0x02, 0x41, 0x01, 0x6A, 0x0B])
+        output = self.compile(
+            [(0, callee), (0, self.CALL_ONCE), (0, big)], {"f": 1, "h": 2}
+        )
+        assert "$__wasm_func_0" not in output
+        assert "call $__wasm_func_0" not in output
+        assert "call $wasm_h" in output
+
+    def test_recursive_not_inlined(self):
+        # f0(n) = f0(n); f1 calls it once
+        recursive = bytes([0x00, 0x20, 0x00, 0x10, 0x00, 0x0B])
+        output = self.compile([(0, recursive), (0, self.CALL_ONCE)], {"f": 1})
+        assert "call $__wasm_func_0" in output
+
+    def test_multi_value(self):
+        """Extra results go through the caller's out-parameter slot."""
+        # f0(n) = (n, n + 1); f1(n) = f0(n).0 - f0(n).1
+        pair = bytes([0x00, 0x20, 0x00, 0x20, 0x00, 0x41, 0x01, 0x6A, 0x0B])
+        sub = bytes([0x00, 0x20, 0x00, 0x10, 0x00, 0x6B, 0x0B])
+        types = [I32_TO_I32, self.I32_TO_I32_I32]
+        output = self.compile([(1, pair), (0, sub)], {"f": 1}, types=types)
+        assert "call" not in output
+        assert "alloc4 4" in output
+        assert "storew" in output
+        assert "loadw" in output
+
+
+class TestDevirtualization:
+    """Direct calls for call_indirect through an immutable table at -O2."""
+
+    # fmt: off
+    TYPES = [
+        I32_TO_I32,
+        func_type([I32, I32], [I32]),
+        func_type([I64], [I32]),
+    ]
+    # Table: [n + 1, n * 2, wrap (i64)]
+    TARGETS = [
+        (0, bytes([0x00, 0x20, 0x00, 0x41, 0x01, 0x6A, 0x0B])),
+        (0, bytes([0x00, 0x20, 0x00, 0x41, 0x02, 0x6C, 0x0B])),
+        (2, bytes([0x00, 0x20, 0x00, 0xA7, 0x0B])),
+    ]
+    # table[i & 1](n)
+    MASKED = bytes([
+        0x00, 0x20, 0x00, 0x20, 0x01, 0x41, 0x01, 0x71, 0x11, 0x00, 0x00, 0x0B,
+    ])
+    # table[0] = ref.func 1; returns 0
+    TABLE_SET = bytes([
+        0x00, 0x41, 0x00, 0xD2, 0x01, 0x26, 0x00, 0x41, 0x00, 0x0B,
+    ])
+    # fmt: on
+
+    @staticmethod
+    def constant(index: int) -> bytes:
+        """table[index](n)"""
+        return bytes([0x00, 0x20, 0x00, 0x41, index, 0x11, 0x00, 0x00, 0x0B])
+
+    def compile(self, caller, extra=(), opt_level=2):
+        funcs = [*self.TARGETS, (1, caller), *extra]
+        wasm = make_module_wasm(self.TYPES, funcs, {"f": 3}, elements=[0, 1, 2])
+        output = compile_module(parse_module(wasm), opt_level=opt_level).emit()
+        return output.split("function w $wasm_f(")[1].split("}")[0]
+
+    def test_constant_index(self):
+        body = self.compile(self.constant(1))
+        assert "$__wasm_table" not in body
+        assert "__wasm_trap" not in body
+        assert "mul %p0, 2" in body  # The direct call was then inlined
+
+    def test_masked_index(self):
+        body = self.compile(self.MASKED)
+        assert "add %p0, 1" in body
+        assert "mul %p0, 2" in body
+        # Values the analysis did not cover still go through the checks
+        assert "loadl $__wasm_table" in body
+
+    def test_signature_mismatch_still_traps(self):
+        body = self.compile(self.constant(2))
+        assert "call $__wasm_func_2" not in body
+        assert "call $__wasm_trap_indirect_call(w " in body
+
+    def test_empty_slot_still_traps(self):
+        body = self.compile(self.constant(3))
+        assert "loadl $__wasm_table" in body
+
+    def test_not_with_table_writes(self):
+        body = self.compile(self.constant(1), extra=[(0, self.TABLE_SET)])
+        assert "loadl $__wasm_table" in body
+        assert "call $__wasm_func_1" not in body
+
+    def test_not_at_o1(self):
+        body = self.compile(self.constant(1), opt_level=1)
+        assert "loadl $__wasm_table" in body
+
+
+class TestLoopInvariantCodeMotion:
+    """Hoisting of loop-invariant instructions at -O2."""
+
+    TYPES = [func_type([I32, I32], [I32])]
+
+    @staticmethod
+    def loop(body: bytes) -> bytes:
+        """f(n, k): do { acc += body; n -= 1 } while (n); return acc"""
+        # fmt: off
+        return bytes([
+            0x01, 0x01, 0x7F,
+            0x03, 0x40,
+            0x20, 0x02, *body, 0x6A, 0x21, 0x02,
+            0x20, 0x00, 0x41, 0x01, 0x6B, 0x22, 0x00, 0x0D, 0x00,
+            0x0B,
+            0x20, 0x02, 0x0B,
+        ])
+        # fmt: on
+
+    # i32.load (k * 12)
+    LOAD = bytes([0x20, 0x01, 0x41, 0x0C, 0x6C, 0x28, 0x02, 0x00])
+    # memory.size; drop
+    MEMORY_SIZE = bytes([0x3F, 0x00, 0x1A])
+
+    def compile(self, body, opt_level=2):
+        wasm = make_module_wasm(
+            self.TYPES, [(0, self.loop(body))], {"f": 0}, memory=True
+        )
+        output = compile_module(parse_module(wasm), opt_level=opt_level).emit()
+        body = output.split("function w $wasm_f(")[1].split("}")[0]
+        before, loop = body.split("\n@loop")
+        return before, loop
+
+    def test_hoists_address_and_base(self):
+        before, loop = self.compile(self.LOAD)
+        assert "mul %p1, 12" in before
+        assert "extuw" in before
+        assert "loadl $__wasm_memory" in before
+        # The load itself reads memory the loop could write
+        assert "loadw" in loop
+
+    def test_not_across_calls(self):
+        """A call can grow memory, which moves its base."""
+        before, loop = self.compile(self.LOAD + self.MEMORY_SIZE)
+        assert "mul %p1, 12" in before
+        assert "loadl $__wasm_memory" in loop
+
+    def test_not_at_o1(self):
+        before, loop = self.compile(self.LOAD, opt_level=1)
+        assert "mul %p1, 12" in loop
+        assert "loadl $__wasm_memory" in loop
+
+    def test_division_stays(self):
+        """A division the loop may not reach could trap if hoisted."""
+        # 100 / k
+        before, loop = self.compile(bytes([0x41, 0xE4, 0x00, 0x20, 0x01, 0x6D]))
+        assert "div 100, %p1" in loop
+
+
+
+class TestStrengthReduction:
+    """Rewriting of address arithmetic on induction variables at -O2."""
+
+    TYPES = [I32_TO_I32]
+
+    @staticmethod
+    def loop(test: bytes) -> bytes:
+        """f(n): i = 0; do { a[i] += a[i + 1]; i += 1 } while (test(i)); return 0"""
+        # fmt: off
+        return bytes([
+            0x01, 0x01, 0x7F,
+            0x03, 0x40,
+            0x20, 0x01, 0x41, 0x04, 0x6C,
+            0x20, 0x01, 0x41, 0x04, 0x6C, 0x28, 0x02, 0x00,
+            0x20, 0x01, 0x41, 0x04, 0x6C, 0x28, 0x02, 0x04,
+            0x6A, 0x36, 0x02, 0x00,
+            0x20, 0x01, 0x41, 0x01, 0x6A, 0x22, 0x01, *test, 0x0D, 0x00,
+            0x0B,
+            0x41, 0x00, 0x0B,
+        ])
+        # fmt: on
+
+    # i < 100
+    BELOW_100 = bytes([0x41, 0xE4, 0x00, 0x48])
+    # i != 100
+    NOT_100 = bytes([0x41, 0xE4, 0x00, 0x47])
+    # i < n
+    BELOW_N = bytes([0x20, 0x00, 0x48])
+
+    def compile(self, test, opt_level=2):
+        wasm = make_module_wasm(
+            self.TYPES, [(0, self.loop(test))], {"f": 0}, memory=True
+        )
+        output = compile_module(parse_module(wasm), opt_level=opt_level).emit()
+        body = output.split("function w $wasm_f(")[1].split("}")[0]
+        return body.split("\n@loop")[1]
+
+    @pytest.mark.parametrize("test", [BELOW_100, NOT_100], ids=["lt", "ne"])
+    def test_pointer_induction_variable(self, test):
+        loop = self.compile(test)
+        assert re.search(r"=l phi @\S+ %t\d+, @\S+ %iv", loop)
+        assert "extuw" not in loop
+        assert "mul" not in loop
+        # One pointer serves all three accesses
+        assert loop.count("=l phi") == 1
+
+    def test_unbounded_keeps_extension(self):
+        """Without a known trip count the 32-bit offset may wrap."""
+        loop = self.compile(self.BELOW_N)
+        assert "=w phi @entry 0, @loop0 %iv" in loop
+        assert "extuw" in loop
+        assert "mul" not in loop
+
+    def test_not_at_o1(self):
+        loop = self.compile(self.BELOW_100, opt_level=1)
+        assert "mul" in loop
+        assert "%iv" not in loop
+
+
+class TestGlobals:
+    """Folding immutable globals and promoting mutable ones to temporaries."""
+
+    TYPES = [I32_TO_I32]
+    # (global $sp (mut i32) (i32.const 1024)) (global $k i32 (i32.const 12))
+    GLOBALS = [
+        bytes([0x7F, 0x01, 0x41, 0x80, 0x08, 0x0B]),
+        bytes([0x7F, 0x00, 0x41, 0x0C, 0x0B]),
+    ]
+    SP = "$__wasm_global_0"
+
+    # sp -= 16
+    PROLOGUE = bytes([0x23, 0x00, 0x41, 0x10, 0x6B, 0x24, 0x00])
+    # sp += 16
+    EPILOGUE = bytes([0x23, 0x00, 0x41, 0x10, 0x6A, 0x24, 0x00])
+    # i32.store (sp) n; drop (i32.load offset=4 (sp))
+    # fmt: off
+    FRAME_ACCESS = bytes([
+        0x23, 0x00, 0x20, 0x00, 0x36, 0x02, 0x00,
+        0x23, 0x00, 0x28, 0x02, 0x04, 0x1A,
+    ])
+    # do { sp += 1; n -= 1 } while (n)
+    LOOP = bytes([
+        0x03, 0x40,
+        0x23, 0x00, 0x41, 0x01, 0x6A, 0x24, 0x00,
+        0x20, 0x00, 0x41, 0x01, 0x6B, 0x22, 0x00, 0x0D, 0x00,
+        0x0B,
+    ])
+    # fmt: on
+    # memory.size; drop -- a runtime call
+    CALL = bytes([0x3F, 0x00, 0x1A])
+
+    def compile(self, body, opt_level=2):
+        """Compile f(n) { body; return k }."""
+        func = bytes([0x00, *body, 0x23, 0x01, 0x0B])
+        wasm = make_module_wasm(
+            self.TYPES, [(0, func)], {"f": 0}, memory=True, globals_=self.GLOBALS
+        )
+        output = compile_module(parse_module(wasm), opt_level=opt_level).emit()
+        return output.split("function w $wasm_f(")[1].split("}")[0]
+
+    def test_immutable_global_folds(self):
+        body = self.compile(b"", opt_level=1)
+        assert "ret 12" in body
+        assert "$__wasm_global_1" not in body
+
+    def test_stack_pointer_in_temporary(self):
+        body = self.compile(self.PROLOGUE + self.FRAME_ACCESS + self.EPILOGUE)
+        assert body.count(f"loadw {self.SP}") == 1
+        assert body.count(f", {self.SP}") == 1
+        assert body.index(f", {self.SP}") > body.index("storew %p0")
+
+    def test_not_at_o1(self):
+        body = self.compile(
+            self.PROLOGUE + self.FRAME_ACCESS + self.EPILOGUE, opt_level=1
+        )
+        assert body.count(f"loadw {self.SP}") == 4
+
+    def test_written_back_around_calls(self):
+        """The callee sees the current value and may set a new one."""
+        body = self.compile(
+            self.PROLOGUE + self.FRAME_ACCESS + self.CALL + self.EPILOGUE
+        )
+        before, after = body.split(" call ")
+        assert before.count(f", {self.SP}") == 1
+        assert after.count(f"loadw {self.SP}") == 1
+        assert after.count(f", {self.SP}") == 1
+
+    def test_loop_without_calls_writes_back_once(self):
+        body = self.compile(self.LOOP)
+        before, loop = body.split("\n@loop")
+        loop, after = loop.split("\n@", 1)
+        assert self.SP not in loop
+        assert f", {self.SP}" in after
@@ -0,0 +1,218 @@
+"""Tests for profile-guided optimization (waq.compiler.profile)."""
+
+from __future__ import annotations
+
+import re
+
+import pytest
+
+from waq.compiler import compile_module
+from waq.compiler.profile import load_profile
+from waq.errors import ProfileError
+from waq.parser.module import parse_module
+
+from .conftest import I32_TO_I32, make_module_wasm
+from .test_table_instructions import make_mixed_table_wasm
+
+# n + 1
+ADD_ONE = bytes([0x00, 0x20, 0x00, 0x41, 0x01, 0x6A, 0x0B])
+# if n then f0(n) else 0 -- f0 is called from the if block
+# fmt: off
+CALL_IF = bytes([
+    0x00, 0x20, 0x00, 0x04, 0x7F, 0x20, 0x00, 0x10, 0x00, 0x05, 0x41, 0x00,
+    0x0B, 0x0B,
+])
+# fmt: on
+
+
+def counter_names(output: str) -> list[list[str]]:
+    """The counters described by an instrumented module's ``$__wasm_prof_names``."""
+    data = output.split("data $__wasm_prof_names = {")[1].split("}")[0]
+    text = bytes(int(n) for n in re.findall(r"\b\d+\b", data)).rstrip(b"\0")
+    return [line.split("\t") for line in text.decode().splitlines()]
+
+
+def write_profile(path, output: str, counts) -> None:
+    """Write the profile an instrumented run of ``output`` would have.
+
+    ``counts(fields)`` gives each counter's value; an ``i`` counter gives a
+    ``{table index: calls}`` histogram.
+    """
+    lines = ["waqprof 1"]
+    for fields in counter_names(output):
+        value = counts(fields)
+        if fields[0] == "i":
+            site = "\t".join(fields[1:])
+            lines += [f"i\t{site}\t{index}\t{n}" for index, n in value.items()]
+        else:
+            lines.append("\t".join([*fields, str(value)]))
+    path.write_text("\n".join(lines) + "\n")
+
+
+def function_body(output: str, name: str) -> str:
+    return output.split(f" ${name}(")[1].split("}")[0]
+
+
+class TestLoadProfile:
+    def test_sums_runs(self, tmp_path):
+        run = (
+            "waqprof 1\nf\tf\t7\tentry\t2\nb\tf\t@b\t1\n"
+            "e\tf\tentry\t1\ni\tf\tok\t3\t2\n"
+        )
+        (tmp_path / "a.waqprof").write_text(run)
+        (tmp_path / "b.waqprof").write_text(run)
+        profile = load_profile([tmp_path / "a.waqprof", tmp_path / "b.waqprof"])
+        fp = profile["f"]
+        assert fp.checksum == 7
+        assert fp.calls == 4
+        assert fp.blocks == {"entry": 4, "@b": 2}
+        assert fp.branches == {"entry": 2}
+        assert fp.targets == {"ok": {3: 4}}
+        assert profile["g"] is None
+
+    @pytest.mark.parametrize(
+        "text",
+        [
+            "",
+            "waqprof 0\n",
+            "waqprof 1\nb\tf\tentry\t1\n",
+            "waqprof 1\nf\tf\t7\tentry\tmany\n",
+            "waqprof 1\nf\tf\t7\n",
+            "waqprof 1\nf\tf\t7\tentry\t1\nx\tf\n",
+        ],
+    )
+    def test_malformed(self, tmp_path, text):
+        path = tmp_path / "bad.waqprof"
+        path.write_text(text)
+        with pytest.raises(ProfileError):
+            load_profile([path])
+
+    def test_runs_of_different_builds(self, tmp_path):
+        (tmp_path / "a.waqprof").write_text("waqprof 1\nf\tf\t7\tentry\t1\n")
+        (tmp_path / "b.waqprof").write_text("waqprof 1\nf\tf\t8\tentry\t1\n")
+        with pytest.raises(ProfileError, match="differs"):
+            load_profile([tmp_path / "a.waqprof", tmp_path / "b.waqprof"])
+
+
+class TestInstrumentation:
+    def test_counters(self):
+        wasm = make_mixed_table_wasm()
+        output = compile_module(parse_module(wasm), instrument=True).emit()
+        assert "data $__wasm_prof_counters" in output
+        assert "call $__wasm_prof_register(l $__wasm_prof_counters, " in output
+        assert "call $__wasm_prof_icall(" in output
+        assert " cnew " in output
+
+        names = counter_names(output)
+        kinds = {(fields[0], fields[1]) for fields in names}
+        assert ("f", "wasm_call") in kinds
+        assert ("e", "wasm_call") in kinds
+        assert ("i", "wasm_call") in kinds
+
+    def test_not_by_default(self):
+        output = compile_module(parse_module(make_mixed_table_wasm())).emit()
+        assert "__wasm_prof" not in output
+
+    def test_instrumented_optimized_build(self):
+        """Counters survive the passes, which must not fold them away."""
+        wasm = make_mixed_table_wasm()
+        output = compile_module(parse_module(wasm), opt_level=2, instrument=True)
+        assert "call $__wasm_prof_icall(" in output.emit()
+
+
+class TestProfileUse:
+    def compile_with_profile(self, tmp_path, wasm, counts, opt_level=2):
+        instrumented = compile_module(parse_module(wasm), instrument=True).emit()
+        path = tmp_path / "default.waqprof"
+        write_profile(path, instrumented, counts)
+        profile = load_profile([path])
+        return compile_module(
+            parse_module(wasm), opt_level=opt_level, profile=profile
+        ).emit()
+
+    def test_devirtualizes_hot_target(self, tmp_path):
+        """A mutable table: the code pointer is compared with the hot target."""
+
+        def counts(fields):
+            return {0: 50, 1: 1} if fields[0] == "i" else 51
+
+        output = self.compile_with_profile(tmp_path, make_mixed_table_wasm(), counts)
+        body = function_body(output, "wasm_call")
+        assert "ceql" in body
+        assert "$__wasm_func_0" in body
+        assert "add %p0, 1" in body  # The direct call was then inlined
+        # Any other target still goes through the checked indirect call
+        assert "__wasm_trap_indirect_call" in body
+
+    def test_rare_targets_not_devirtualized(self, tmp_path):
+        def counts(fields):
+            return {0: 1, 1: 50} if fields[0] == "i" else 51
+
+        output = self.compile_with_profile(tmp_path, make_mixed_table_wasm(), counts)
+        # Index 1 has the wrong signature, index 0 too few calls
+        assert "ceql" not in function_body(output, "wasm_call")
+
+    def test_cold_blocks_last(self, tmp_path):
+        def counts(fields):
+            if fields[0] == "i":
+                return {0: 10}
+            return 0 if "oob" in fields[2] or "bad" in fields[2] else 10
+
+        output = self.compile_with_profile(
+            tmp_path, make_mixed_table_wasm(), counts, opt_level=1
+        )
+        labels = re.findall(r"^@(\S+)", function_body(output, "wasm_call"), re.M)
+        cold = [i for i, label in enumerate(labels) if "oob" in label or "bad" in label]
+        assert cold == list(range(len(labels) - len(cold), len(labels)))
+
+    def test_stale_profile_ignored(self, tmp_path):
+        def counts(fields):
+            if fields[0] == "i":
+                return {0: 10}
+            return 0 if "oob" in fields[2] or "bad" in fields[2] else 10
+
+        instrumented = compile_module(
+            parse_module(make_mixed_table_wasm()), instrument=True
+        ).emit()
+        path = tmp_path / "default.waqprof"
+        write_profile(path, instrumented, counts)
+        text = path.read_text()
+        path.write_text(re.sub(r"^(f\twasm_call\t)\d+", r"\g<1>1", text, flags=re.M))
+        output = compile_module(
+            parse_module(make_mixed_table_wasm()),
+            opt_level=1,
+            profile=load_profile([path]),
+        ).emit()
+        baseline = compile_module(
+            parse_module(make_mixed_table_wasm()), opt_level=1
+        ).emit()
+        assert function_body(output, "wasm_call") == function_body(
+            baseline, "wasm_call"
+        )
+
+    def test_hot_call_site_inlines_larger_callee(self, tmp_path):
+        # f0 is too big for a leaf and exported, so only a hot call inlines it
+        big = bytes([0x00, *([0x20, 0x00, 0x41, 0x03, 0x6C, 0x21, 0x00] * 30)])
+        big += bytes([0x20, 0x00, 0x41, 0x01, 0x6A, 0x0B])
+        wasm = make_module_wasm(
+            [I32_TO_I32], [(0, big), (0, CALL_IF)], {"g": 0, "f": 1}
+        )
+
+        baseline = compile_module(parse_module(wasm), opt_level=2).emit()
+        assert "call $wasm_g" in function_body(baseline, "wasm_f")
+
+        output = self.compile_with_profile(tmp_path, wasm, lambda fields: 100)
+        assert "call $wasm_g" not in function_body(output, "wasm_f")
+
+    def test_cold_call_site_not_inlined(self, tmp_path):
+        wasm = make_module_wasm(
+            [I32_TO_I32], [(0, ADD_ONE), (0, CALL_IF)], {"g": 0, "f": 1}
+        )
+        baseline = compile_module(parse_module(wasm), opt_level=2).emit()
+        assert "call $wasm_g" not in function_body(baseline, "wasm_f")
+
+        # f was called, but never with a nonzero n
+        output = self.compile_with_profile(
+            tmp_path, wasm, lambda fields: 5 if fields[0] == "f" else 0
+        )
+        assert "call $wasm_g" in function_body(output, "wasm_f")
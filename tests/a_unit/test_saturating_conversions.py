@@ -180,3 +180,11 @@ class TestI64SaturatingConversions:
         qbe = compile_module(module)
         output = qbe.emit()
         assert "__wasm_i64_trunc_sat_f64_u" in output
+
+    def test_inlined_with_lto(self):
+        """--lto inlines the clamping and the plain conversion."""
+        module = parse_module(make_i64_trunc_sat_f64_u_wasm())
+        output = compile_module(module, opt_level=1, lto=True).emit()
+        assert "call" not in output
+        assert "cuod" in output
+        assert "=l dtoui" in output
@@ -0,0 +1,162 @@
+"""Unit tests for fixed-width SIMD (v128) instructions."""
+
+from __future__ import annotations
+
+import struct
+
+import pytest
+
+from waq.compiler import compile_module
+from waq.errors import CompileError
+from waq.parser.code import iter_instructions
+from waq.parser.module import parse_module
+
+from .conftest import I32_TO_I32, V128, func_type, leb128, make_module_wasm
+
+
+def simd(sub_opcode: int, *immediates: int) -> bytes:
+    """A 0xFD-prefixed instruction with byte-sized immediates."""
+    return bytes([0xFD]) + leb128(sub_opcode) + bytes(immediates)
+
+
+def v128_const(*lanes: int) -> bytes:
+    """v128.const of four i32 lanes."""
+    return simd(0x0C) + struct.pack("<4i", *lanes)
+
+
+def compile_funcs(types, funcs, opt_level=0, memory=False, globals_=None) -> str:
+    wasm = make_module_wasm(types, funcs, {"f": 0}, memory=memory, globals_=globals_)
+    return compile_module(parse_module(wasm), opt_level=opt_level).emit()
+
+
+def function_body(output: str, name: str) -> str:
+    """The IL of function ``$name``, from its parameter list to its last line."""
+    for function in output.split("function ")[1:]:
+        if function.split("(")[0].endswith(f"${name}"):
+            return function.split("(", 1)[1].split("\n}")[0]
+    raise AssertionError(f"no function ${name}")
+
+
+class TestDecoding:
+    """0xFD immediates are decoded so bodies can be walked."""
+
+    def test_const_and_lane_immediates(self):
+        code = v128_const(1, 2, 3, 4) + simd(0x1B, 2) + bytes([0x0B])
+        const, extract, end = iter_instructions(code)
+        assert (const.opcode, const.sub_opcode) == (0xFD, 0x0C)
+        assert const.immediates == (struct.pack("<4i", 1, 2, 3, 4),)
+        assert (extract.sub_opcode, extract.immediates) == (0x1B, (2,))
+        assert end.opcode == 0x0B
+
+    def test_shuffle_and_lane_memory_access(self):
+        # i8x16.shuffle takes 16 lane bytes; v128.load8_lane a memarg and a lane
+        code = simd(0x0D, *range(16)) + simd(0x54, 0x00, 0x04, 7) + simd(0xAE)
+        shuffle, load_lane, add = iter_instructions(code)
+        assert shuffle.immediates == (bytes(range(16)),)
+        assert load_lane.immediates == (0, 4, 7)
+        assert (add.sub_opcode, add.immediates) == (0xAE, ())
+
+
+class TestCodegen:
+    """v128 values live in 16-byte stack slots, operated on by runtime kernels."""
+
+    V128_TO_V128 = func_type([V128], [V128])
+
+    def compile_i32(self, body: bytes, locals_: bytes = b"\x00", **kwargs) -> str:
+        output = compile_funcs(
+            [I32_TO_I32], [(0, locals_ + body + b"\x0b")], **kwargs
+        )
+        return function_body(output, "wasm_f")
+
+    def test_const_is_two_stores_into_a_slot(self):
+        # i32x4.extract_lane 0 (v128.const 1 2 3 4)
+        body = self.compile_i32(v128_const(1, 2, 3, 4) + simd(0x1B, 0))
+        assert "=l alloc16 16" in body
+        assert f"storel {2 << 32 | 1}, " in body
+        assert f"storel {4 << 32 | 3}, " in body
+        assert "loadw" in body
+
+    def test_arithmetic_calls_kernel(self):
+        # i32x4.extract_lane 1 (i32x4.add (i32x4.splat n) (i32x4.splat n))
+        splat = bytes([0x20, 0x00]) + simd(0x11)
+        body = self.compile_i32(splat + splat + simd(0xAE) + simd(0x1B, 1))
+        assert "call $__wasm_i32x4_splat(l %" in body
+        assert "call $__wasm_i32x4_add(l %" in body
+        assert body.count("alloc16 16") == 3
+
+    def test_replace_lane_copies_then_stores(self):
+        # i32x4.extract_lane 3 (i32x4.replace_lane 3 (v128.const 0 0 0 0) n)
+        body = self.compile_i32(
+            v128_const(0, 0, 0, 0)
+            + bytes([0x20, 0x00])
+            + simd(0x1C, 3)
+            + simd(0x1B, 3)
+        )
+        assert "storew %p0, " in body
+        assert ", 12\n" in body
+
+    def test_local_is_copied_in_and_out(self):
+        """local.get copies the slot, so a later local.set can't alias it."""
+        # local v; v = splat(n); v = v + v; extract_lane 0 v
+        body = self.compile_i32(
+            bytes([0x20, 0x00])
+            + simd(0x11)
+            + bytes([0x21, 0x01, 0x20, 0x01, 0x20, 0x01])
+            + simd(0xAE)
+            + bytes([0x21, 0x01, 0x20, 0x01])
+            + simd(0x1B, 0),
+            locals_=bytes([0x01, 0x01, V128]),
+            opt_level=2,
+        )
+        assert "%local_addr1 =l alloc16 16" in body
+        assert body.count("loadl %local_addr1") == 3
+
+    @pytest.mark.parametrize("opt_level", [0, 2])
+    def test_params_and_results(self, opt_level):
+        # f(n) = extract_lane 0 (g (splat n)); g(v) = v
+        f = bytes([0x00, 0x20, 0x00]) + simd(0x11) + bytes([0x10, 0x01])
+        f += simd(0x1B, 0) + b"\x0b"
+        g = bytes([0x00, 0x20, 0x00, 0x0B])
+        output = compile_funcs(
+            [I32_TO_I32, self.V128_TO_V128],
+            [(0, f), (1, g)],
+            opt_level=opt_level,
+        )
+        callee = function_body(output, "__wasm_func_1")
+        assert "function l $__wasm_func_1(l %p0)" in output
+        # The result goes to the calling thread's buffer
+        assert "=l call $__wasm_v128_result()" in callee
+        assert "ret %" in callee
+        if opt_level == 0:
+            # The caller copies the thread's result out before anything else
+            caller = function_body(output, "wasm_f")
+            call = caller.index("call $__wasm_func_1(")
+            assert "alloc16 16" in caller[call:]
+
+    def test_memory_load_and_store(self):
+        # v128.store (0) (v128.load offset=16 (0)); i32.const 0
+        body = self.compile_i32(
+            bytes([0x41, 0x00, 0x41, 0x00])
+            + simd(0x00, 0x04, 0x10)
+            + simd(0x0B, 0x04, 0x00)
+            + bytes([0x41, 0x00]),
+            memory=True,
+        )
+        assert body.count("loadl $__wasm_memory") == 2
+        # Into the loaded value's slot, then out to memory
+        assert body.count("storel") == 4
+
+    def test_global_data(self):
+        # (global v128 (v128.const -1 0 0 1)); extract_lane 3 (global.get 0)
+        glob = bytes([V128, 0x00]) + v128_const(-1, 0, 0, 1) + b"\x0b"
+        output = compile_funcs(
+            [I32_TO_I32],
+            [(0, bytes([0x00, 0x23, 0x00]) + simd(0x1B, 3) + b"\x0b")],
+            globals_=[glob],
+        )
+        assert "data $__wasm_global_0 = { l 4294967295 4294967296 }" in output
+        assert "loadl $__wasm_global_0" in function_body(output, "wasm_f")
+
+    def test_unhandled_sub_opcode(self):
+        with pytest.raises(CompileError, match="unhandled 0xFD sub-opcode"):
+            self.compile_i32(simd(0x200))
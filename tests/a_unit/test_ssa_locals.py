@@ -0,0 +1,113 @@
+"""Unit tests for SSA construction of locals."""
+
+from __future__ import annotations
+
+from waq.compiler import compile_module
+from waq.parser.module import parse_module
+
+from .conftest import make_i32_func_wasm
+
+
+def compile_body(func_body: bytes) -> str:
+    return compile_module(parse_module(make_i32_func_wasm(func_body))).emit()
+
+
+# fmt: off
+# (local $s i32) (local $i i32)
+# i = 1
+# loop { s += i; i += 1; br_if 0 (i <= n) }
+# s
+SUM_LOOP = bytes([
+    0x01, 0x02, 0x7F,  # 2 locals: i32
+    0x41, 0x01, 0x21, 0x02,  # i = 1
+    0x03, 0x40,  # loop
+    0x20, 0x01, 0x20, 0x02, 0x6A, 0x21, 0x01,  # s += i
+    0x20, 0x02, 0x41, 0x01, 0x6A, 0x22, 0x02,  # i += 1 (tee)
+    0x20, 0x00, 0x4C,  # i <= n
+    0x0D, 0x00,  # br_if 0
+    0x0B,  # end loop
+    0x20, 0x01,  # local.get s
+    0x0B,
+])
+# fmt: on
+
+
+class TestSSALocals:
+    """Locals are compiled to QBE temporaries instead of stack slots."""
+
+    def test_straight_line_has_no_slots(self):
+        # fmt: off
+        body = bytes([
+            0x01, 0x01, 0x7F,  # 1 local: i32
+            0x20, 0x00, 0x41, 0x02, 0x6C, 0x21, 0x01,  # x = n * 2
+            0x20, 0x01,  # local.get x
+            0x0B,
+        ])
+        # fmt: on
+        output = compile_body(body)
+        assert "alloc" not in output
+        assert "store" not in output
+        assert "load" not in output
+
+    def test_loop_header_phis(self):
+        """A loop gets a header phi for each local it assigns."""
+        output = compile_body(SUM_LOOP)
+        assert "alloc" not in output
+        assert output.count(" phi ") == 2
+        assert "@loop" in output
+
+    def test_unassigned_local_has_no_loop_phi(self):
+        """The parameter is read but never written in the loop."""
+        output = compile_body(SUM_LOOP)
+        assert "phi @entry %p0" not in output
+
+    def test_if_else_merges_with_phi(self):
+        # fmt: off
+        body = bytes([
+            0x01, 0x01, 0x7F,  # 1 local: i32
+            0x20, 0x00,  # local.get n
+            0x04, 0x40,  # if
+            0x41, 0x07, 0x21, 0x01,  # x = 7
+            0x05,  # else
+            0x41, 0x09, 0x21, 0x01,  # x = 9
+            0x0B,  # end
+            0x20, 0x01,  # local.get x
+            0x0B,
+        ])
+        # fmt: on
+        output = compile_body(body)
+        assert output.count(" phi ") == 1
+        assert "alloc" not in output
+
+    def test_if_without_else_merges_entry_value(self):
+        """The implicit else edge carries the local's value from before the if."""
+        # fmt: off
+        body = bytes([
+            0x00,
+            0x20, 0x00,  # local.get n
+            0x04, 0x40,  # if
+            0x41, 0x05, 0x21, 0x00,  # n = 5
+            0x0B,  # end
+            0x20, 0x00,  # local.get n
+            0x0B,
+        ])
+        # fmt: on
+        output = compile_body(body)
+        assert output.count(" phi ") == 1
+        assert "%p0" in output.split(" phi ")[1].splitlines()[0]
+
+    def test_try_keeps_memory_locals(self):
+        """longjmp does not restore SSA temporaries, so try bodies use slots."""
+        # fmt: off
+        body = bytes([
+            0x00,
+            0x06, 0x40,  # try
+            0x41, 0x01, 0x21, 0x00,  # n = 1
+            0x19,  # catch_all
+            0x0B,  # end
+            0x20, 0x00,  # local.get n
+            0x0B,
+        ])
+        # fmt: on
+        output = compile_body(body)
+        assert "locals_frame" in output
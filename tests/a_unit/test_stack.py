@@ -72,6 +72,21 @@ class TestValueStack:
         assert values[1].name == "t2"
         assert stack.depth == 1
 
+    def test_pop_n_zero(self):
+        stack = ValueStack()
+        stack.new_temp(ValueType.I32)
+        assert stack.pop_n(0) == []
+        assert stack.depth == 1
+
+    def test_peek_n(self):
+        stack = ValueStack()
+        stack.new_temp(ValueType.I32)  # %t0
+        stack.new_temp(ValueType.I32)  # %t1
+
+        values = stack.peek_n(2)
+        assert [v.name for v in values] == ["t0", "t1"]
+        assert stack.depth == 2
+
     def test_pop_n_underflow(self):
         stack = ValueStack()
         stack.new_temp(ValueType.I32)
@@ -5,6 +5,8 @@ from __future__ import annotations
 from waq.compiler import compile_module
 from waq.parser.module import parse_module
 
+from .conftest import I32, I32_TO_I32, I64, func_type, make_module_wasm
+
 
 def make_simple_call_indirect_wasm() -> bytes:
     """Create simpler WASM for call_indirect test.
@@ -71,6 +73,34 @@ def make_simple_call_indirect_wasm() -> bytes:
     return wasm
 
 
+def make_mixed_table_wasm() -> bytes:
+    """A table holding functions of different signatures.
+
+    - types 0 and 1: (i32) -> i32, equivalent; type 2: (i64) -> i32
+    - func 0 (type 1): n + 1
+    - func 1 (type 2): wrap(n)
+    - func 2 "call" (i32 n, i32 idx) -> i32: call_indirect type 0 on table[idx]
+    - func 3 "set" (i32 idx): table[idx] = ref.func 1
+    - table of 3 slots; elements [func 0, func 1] at 0, slot 2 null
+    """
+    types = [
+        I32_TO_I32,
+        I32_TO_I32,
+        func_type([I64], [I32]),
+        func_type([I32, I32], [I32]),
+        func_type([I32], []),
+    ]
+    # fmt: off
+    funcs = [
+        (1, bytes([0x00, 0x20, 0x00, 0x41, 0x01, 0x6A, 0x0B])),
+        (2, bytes([0x00, 0x20, 0x00, 0xA7, 0x0B])),
+        (3, bytes([0x00, 0x20, 0x00, 0x20, 0x01, 0x11, 0x00, 0x00, 0x0B])),
+        (4, bytes([0x00, 0x20, 0x00, 0xD2, 0x01, 0x26, 0x00, 0x0B])),
+    ]
+    # fmt: on
+    return make_module_wasm(types, funcs, {"call": 2, "set": 3}, elements=[0, 1])
+
+
 class TestCallIndirect:
     """Tests for call_indirect instruction."""
 
@@ -91,8 +121,32 @@ class TestCallIndirect:
         module = parse_module(wasm)
         qbe = compile_module(module)
         output = qbe.emit()
-        # Should multiply index by 8 (pointer size)
-        assert "mul" in output.lower() or "8" in output
+        # Slots are 16-byte (code pointer, signature id) pairs
+        assert "shl" in output and ", 4\n" in output
+        assert "loadl $__wasm_table\n" in output
+
+    def test_call_indirect_checks_bounds_and_signature(self):
+        """The index and the slot's signature id are checked inline."""
+        output = compile_module(parse_module(make_mixed_table_wasm())).emit()
+        assert "loaduw $__wasm_table_size" in output
+        assert "cultw" in output
+        assert "call $__wasm_trap_undefined_element()" in output
+        assert "ceqw" in output
+        assert "call $__wasm_trap_indirect_call(w " in output
+        assert "call $__wasm_table_get" not in output
+
+    def test_equivalent_types_share_signature_id(self):
+        """A function of type 1 is stored with the id call_indirect 0 expects."""
+        output = compile_module(parse_module(make_mixed_table_wasm())).emit()
+        assert "call $__wasm_table_set(w 0, w 0, l $__wasm_func_0, w 1)" in output
+        assert "call $__wasm_table_set(w 0, w 1, l $__wasm_func_1, w 2)" in output
+        assert ", 1\n" in output.split("function w $wasm_call")[1].split("}")[0]
+
+    def test_table_set_looks_up_signature(self):
+        """table.set stores the id of the function the funcref points to."""
+        output = compile_module(parse_module(make_mixed_table_wasm())).emit()
+        assert "call $__wasm_funcref_sig(l " in output
+        assert "function w $__wasm_funcref_sig(l %ref)" in output
 
 
 class TestElementSection:
@@ -116,3 +170,9 @@ class TestElementSection:
         assert len(module.tables) == 1
         table = module.tables[0]
         assert table.limits.min == 1
+
+    def test_active_segment_initializes_table(self):
+        """The initializer passes the table index and signature id, like table.set."""
+        module = parse_module(make_simple_call_indirect_wasm())
+        output = compile_module(module).emit()
+        assert "call $__wasm_table_set(w 0, w 0, l $__wasm_func_0, w 1)" in output
@@ -216,6 +216,15 @@ class TestTableGet:
         output = qbe.emit()
         assert "__wasm_table_get" in output
 
+    def test_table_get_inlined_with_lto(self):
+        """--lto replaces the helper call with a bounds check and a load."""
+        module = parse_module(make_table_get_wasm())
+        output = compile_module(module, opt_level=1, lto=True).emit()
+        assert "call $__wasm_table_get" not in output
+        assert "loaduw $__wasm_table_size" in output
+        assert "loadl $__wasm_table\n" in output
+        assert "call $__wasm_trap_out_of_bounds()" in output
+
 
 class TestTableSet:
     """Tests for table.set instruction."""
@@ -2,9 +2,17 @@
 
 from __future__ import annotations
 
+import warnings
+
+import pytest
+
 from waq.compiler import compile_module
+from waq.errors import CompileWarning
 from waq.parser.module import parse_module
 
+from .conftest import make_module_wasm
+from .test_simd import function_body
+
 
 def make_self_tail_call_wasm() -> bytes:
     """Create WASM with self-recursive tail call (simple countdown).
@@ -200,6 +208,97 @@ def make_return_call_indirect_wasm() -> bytes:
     return wasm
 
 
+def make_mutual_tail_call_wasm() -> bytes:
+    """Create WASM with two functions that tail-call each other.
+
+    (func $even (param $n i32) (result i32)
+      (if (i32.eqz (local.get $n)) (then (return (i32.const 1))))
+      (return_call $odd (i32.sub (local.get $n) (i32.const 1))))
+
+    (func $odd (param $n i32) (result i32)
+      (if (i32.eqz (local.get $n)) (then (return (i32.const 0))))
+      (return_call $even (i32.sub (local.get $n) (i32.const 1))))
+    """
+    # fmt: off
+    type_section = bytes([0x01, 0x60, 0x01, 0x7F, 0x01, 0x7F])
+    func_section = bytes([0x02, 0x00, 0x00])
+    export_section = (
+        bytes([0x02, 0x04]) + b"even" + bytes([0x00, 0x00])
+        + bytes([0x03]) + b"odd" + bytes([0x00, 0x01])
+    )
+
+    def body(other: int, base: int) -> bytes:
+        return bytes([
+            0x00,
+            0x20, 0x00, 0x45,  # i32.eqz (n)
+            0x04, 0x40,  # if
+            0x41, base, 0x0F,  # return base
+            0x0B,
+            0x20, 0x00, 0x41, 0x01, 0x6B,  # n - 1
+            0x12, other,  # return_call other
+            0x0B,
+        ])
+
+    even, odd = body(1, 1), body(0, 0)
+    code_section = bytes([0x02, len(even)]) + even + bytes([len(odd)]) + odd
+
+    wasm = bytes([0x00, 0x61, 0x73, 0x6D, 0x01, 0x00, 0x00, 0x00])
+    wasm += bytes([0x01, len(type_section)]) + type_section
+    wasm += bytes([0x03, len(func_section)]) + func_section
+    wasm += bytes([0x07, len(export_section)]) + export_section
+    wasm += bytes([0x0A, len(code_section)]) + code_section
+    # fmt: on
+
+    return wasm
+
+
+def make_mixed_signature_tail_call_wasm() -> bytes:
+    """Create WASM with a tail-call cycle between different signatures.
+
+    (func $a (param $n i32) (param $x f64) (result i32)
+      (if (i32.eqz (local.get $n)) (then (return (i32.trunc_f64_s (local.get $x)))))
+      (return_call $b (i64.extend_i32_s (local.get $n))))
+
+    (func $b (param $m i64) (result i32)
+      (return_call $a (i32.sub (i32.wrap_i64 (local.get $m)) (i32.const 1))
+                      (f64.convert_i64_s (local.get $m))))
+    """
+    # fmt: off
+    type_section = bytes([
+        0x02,
+        0x60, 0x02, 0x7F, 0x7C, 0x01, 0x7F,  # (i32, f64) -> i32
+        0x60, 0x01, 0x7E, 0x01, 0x7F,  # (i64) -> i32
+    ])
+    func_section = bytes([0x02, 0x00, 0x01])
+    export_section = bytes([0x01, 0x01]) + b"a" + bytes([0x00, 0x00])
+    a = bytes([
+        0x00,
+        0x20, 0x00, 0x45, 0x04, 0x40,  # if (n == 0)
+        0x20, 0x01, 0xAA, 0x0F,  # return i32.trunc_f64_s(x)
+        0x0B,
+        0x20, 0x00, 0xAC,  # i64.extend_i32_s(n)
+        0x12, 0x01,  # return_call b
+        0x0B,
+    ])
+    b = bytes([
+        0x00,
+        0x20, 0x00, 0xA7, 0x41, 0x01, 0x6B,  # i32.wrap_i64(m) - 1
+        0x20, 0x00, 0xB9,  # f64.convert_i64_s(m)
+        0x12, 0x00,  # return_call a
+        0x0B,
+    ])
+    code_section = bytes([0x02, len(a)]) + a + bytes([len(b)]) + b
+
+    wasm = bytes([0x00, 0x61, 0x73, 0x6D, 0x01, 0x00, 0x00, 0x00])
+    wasm += bytes([0x01, len(type_section)]) + type_section
+    wasm += bytes([0x03, len(func_section)]) + func_section
+    wasm += bytes([0x07, len(export_section)]) + export_section
+    wasm += bytes([0x0A, len(code_section)]) + code_section
+    # fmt: on
+
+    return wasm
+
+
 class TestReturnCall:
     """Tests for return_call instruction (0x12)."""
 
@@ -209,8 +308,10 @@ class TestReturnCall:
         module = parse_module(wasm)
         qbe = compile_module(module)
         output = qbe.emit()
-        # Self-tail-call should optimize to a loop (jmp @entry)
-        assert "jmp @entry" in output
+        # Self-tail-call should optimize to a loop back to the top of the body
+        assert "jmp @tail_entry" in output
+        # The parameters become phis at the loop header
+        assert "phi @entry %p0" in output
         # Should NOT have a recursive call to the same function
         assert output.count("call $countdown") == 0
 
@@ -224,6 +325,33 @@ class TestReturnCall:
         assert "call $" in output
         assert "ret" in output
 
+    def test_mutual_tail_calls_share_a_frame(self):
+        """A tail-call cycle is merged into one function with jumps."""
+        module = parse_module(make_mutual_tail_call_wasm())
+        output = compile_module(module).emit()
+        assert "function w $__wasm_tail_group_0(w %sel, w %w0)" in output
+        group = output.split("$__wasm_tail_group_0(w %sel")[1].split("\n}")[0]
+        assert "call" not in group
+        assert "jmp @m1.head" in group
+        assert "jmp @m0.head" in group
+        # The exports stay callable under their own names
+        assert "call $__wasm_tail_group_0(w 0, w %p0)" in output
+        assert "call $__wasm_tail_group_0(w 1, w %p0)" in output
+
+    def test_mixed_signatures_use_parameter_slots(self):
+        """Members pass their parameters in slots shared by class."""
+        module = parse_module(make_mixed_signature_tail_call_wasm())
+        output = compile_module(module).emit()
+        assert "$__wasm_tail_group_0(w %sel, w %w0, l %l0, d %d0)" in output
+        assert "%m0.p1 =d phi" in output
+        assert "%m1.p0 =l phi" in output
+
+    def test_plain_tail_call_not_merged(self):
+        """A tail call that is not part of a cycle stays call + ret."""
+        module = parse_module(make_non_self_tail_call_wasm())
+        output = compile_module(module).emit()
+        assert "__wasm_tail_group" not in output
+
 
 class TestReturnCallIndirect:
     """Tests for return_call_indirect instruction (0x13)."""
@@ -232,7 +360,9 @@ class TestReturnCallIndirect:
         """Test that return_call_indirect compiles."""
         wasm = make_return_call_indirect_wasm()
         module = parse_module(wasm)
-        qbe = compile_module(module)
+        # impl never tail-calls back, so there is no group to jump within
+        with pytest.warns(CompileWarning, match="indirect tail call"):
+            qbe = compile_module(module)
         output = qbe.emit()
         # Should load from table and do indirect call
         assert "__wasm_table" in output
@@ -291,7 +421,133 @@ class TestReturnCallRef:
         # fmt: on
 
         module = parse_module(wasm)
-        qbe = compile_module(module)
+        with pytest.warns(CompileWarning, match="indirect tail call"):
+            qbe = compile_module(module)
         output = qbe.emit()
         # Should have indirect call via function reference
         assert "ret" in output
+
+
+# (i32) -> i32 and (i32) -> (i32, i32)
+I32_TO_I32 = bytes([0x60, 0x01, 0x7F, 0x01, 0x7F])
+I32_TO_I32_I32 = bytes([0x60, 0x01, 0x7F, 0x02, 0x7F, 0x7F])
+
+
+def countdown(locals_: bytes, base: bytes, call: bytes) -> bytes:
+    """``if n == 0 return base``, then ``call`` with ``n - 1`` on the stack."""
+    # fmt: off
+    return locals_ + bytes([
+        0x20, 0x00, 0x45, 0x04, 0x40,  # if (n == 0)
+        *base, 0x0F,  # return base
+        0x0B,
+        0x20, 0x00, 0x41, 0x01, 0x6B,  # n - 1
+        *call,
+        0x0B,
+    ])
+    # fmt: on
+
+
+def compile_quietly(wasm: bytes) -> str:
+    """Compile ``wasm``, failing on any CompileWarning."""
+    with warnings.catch_warnings():
+        warnings.simplefilter("error", CompileWarning)
+        return compile_module(parse_module(wasm)).emit()
+
+
+class TestTailCallGroups:
+    """Tail-call cycles through stack slots, handlers and tables."""
+
+    def test_stack_slots_are_allocated_once(self):
+        """Members with memory locals merge; the slots move to the entry."""
+        # A v128 local lives in a stack slot
+        v128_local = bytes([0x01, 0x01, 0x7B])
+        even = countdown(v128_local, [0x41, 0x01], [0x12, 0x01])
+        odd = countdown(v128_local, [0x41, 0x00], [0x12, 0x00])
+        wasm = make_module_wasm([I32_TO_I32], [(0, even), (0, odd)], {"even": 0})
+        group = function_body(compile_quietly(wasm), "__wasm_tail_group_0")
+        entry, members = group.split("\n@m0.head\n")
+        assert entry.count(" alloc") == 2
+        assert " alloc" not in members
+        assert "jmp @m1.head" in members
+        assert "jmp @m0.head" in members
+
+    def test_multi_value_results_pass_through(self):
+        """A multi-value tail call hands on the caller's out-parameters."""
+        even = countdown(b"\x00", [0x41, 0x01, 0x41, 0x02], [0x12, 0x01])
+        odd = countdown(b"\x00", [0x41, 0x00, 0x41, 0x02], [0x12, 0x00])
+        wasm = make_module_wasm([I32_TO_I32_I32], [(0, even), (0, odd)], {"even": 0})
+        output = compile_quietly(wasm)
+        assert "$__wasm_tail_group_0(w %sel, w %w0, l %l0)" in output
+        group = function_body(output, "__wasm_tail_group_0")
+        assert "call" not in group
+        assert " alloc" not in group
+
+    def test_members_with_handlers(self):
+        """A member with a try block (and so a _setjmp) is merged too."""
+        # try { call 2 } catch_all {}, before the countdown
+        handler = bytes([0x00, 0x06, 0x40, 0x10, 0x02, 0x19, 0x0B])
+        even = countdown(handler, [0x41, 0x01], [0x12, 0x01])
+        odd = countdown(b"\x00", [0x41, 0x00], [0x12, 0x00])
+        nothing = bytes([0x60, 0x00, 0x00])
+        wasm = make_module_wasm(
+            [I32_TO_I32, nothing],
+            [(0, even), (0, odd), (1, bytes([0x00, 0x0B]))],
+            {"even": 0},
+        )
+        group = function_body(compile_quietly(wasm), "__wasm_tail_group_0")
+        entry, members = group.split("\n@m0.head\n")
+        assert "call $_setjmp(" in members
+        assert " alloc" in entry
+        assert " alloc" not in members
+        assert "jmp @m0.head" in members
+
+    def test_indirect_cycle(self):
+        """return_call_indirect jumps to the member its slot holds."""
+        # return_call_indirect (type 0) through slot 1 and slot 0
+        even = countdown(b"\x00", [0x41, 0x01], [0x41, 0x01, 0x13, 0x00, 0x00])
+        odd = countdown(b"\x00", [0x41, 0x00], [0x41, 0x00, 0x13, 0x00, 0x00])
+        wasm = make_module_wasm(
+            [I32_TO_I32], [(0, even), (0, odd)], {"even": 0}, elements=[0, 1]
+        )
+        group = function_body(compile_quietly(wasm), "__wasm_tail_group_0")
+        assert "ceql" in group
+        assert ", @m1.head, @" in group
+        assert ", @m0.head, @" in group
+        # Other slots still get the call
+        assert group.count("call %") == 2
+
+    def test_indirect_self_call(self):
+        """A function that tail-calls itself through the table is a group."""
+        func = countdown(b"\x00", [0x41, 0x00], [0x41, 0x00, 0x13, 0x00, 0x00])
+        wasm = make_module_wasm([I32_TO_I32], [(0, func)], {"f": 0}, elements=[0])
+        output = compile_quietly(wasm)
+        assert "$__wasm_tail_group_0(w %sel, w %w0)" in output
+        group = function_body(output, "__wasm_tail_group_0")
+        assert "ceql %m0." in group
+        assert ", @m0.head, @" in group
+        assert "call $__wasm_tail_group_0(w 0, w %p0)" in output
+
+    def test_call_ref_cycle(self):
+        """return_call_ref to a member's funcref jumps too."""
+        # ref.func 1 / ref.func 0, return_call_ref (type 0)
+        even = countdown(b"\x00", [0x41, 0x01], [0xD2, 0x01, 0x15, 0x00])
+        odd = countdown(b"\x00", [0x41, 0x00], [0xD2, 0x00, 0x15, 0x00])
+        wasm = make_module_wasm([I32_TO_I32], [(0, even), (0, odd)], {"even": 0})
+        group = function_body(compile_quietly(wasm), "__wasm_tail_group_0")
+        assert ", @m1.head, @" in group
+        assert ", @m0.head, @" in group
+
+    def test_tail_call_to_import_is_reported(self):
+        """A return_call that stays a call gets a CompileWarning."""
+        # fmt: off
+        wasm = bytes([0x00, 0x61, 0x73, 0x6D, 0x01, 0x00, 0x00, 0x00])
+        wasm += bytes([0x01, 0x06, 0x01, *I32_TO_I32])
+        wasm += bytes([0x02, 0x09, 0x01, 0x03]) + b"env" + bytes([0x01]) + b"g"
+        wasm += bytes([0x00, 0x00])
+        wasm += bytes([0x03, 0x02, 0x01, 0x00])
+        wasm += bytes([0x07, 0x05, 0x01, 0x01]) + b"f" + bytes([0x00, 0x01])
+        body = bytes([0x00, 0x20, 0x00, 0x12, 0x00, 0x0B])
+        wasm += bytes([0x0A, len(body) + 2, 0x01, len(body)]) + body
+        # fmt: on
+        with pytest.warns(CompileWarning, match="imported"):
+            compile_module(parse_module(wasm))
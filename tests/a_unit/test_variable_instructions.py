@@ -347,6 +347,39 @@ class TestGlobals:
         assert "__wasm_global_0" in output
         assert "loadl" in output  # Load long for i64
 
+    def test_mutable_globals_reset_by_init(self):
+        """__wasm_memory_init restores mutable globals (for reinstantiation)."""
+        # Globals: mut i64 = 1000, immutable i32 = 100; no functions
+        wasm = bytes([
+            0x00,
+            0x61,
+            0x73,
+            0x6D,  # magic
+            0x01,
+            0x00,
+            0x00,
+            0x00,  # version
+            # Global section
+            0x06,
+            0x0C,
+            0x02,
+            0x7E,
+            0x01,
+            0x42,
+            0xE8,
+            0x07,
+            0x0B,  # mut i64 = 1000
+            0x7F,
+            0x00,
+            0x41,
+            0x64,
+            0x0B,  # i32 = 100
+        ])
+        output = compile_module(parse_module(wasm)).emit()
+        init = output.split("$__wasm_memory_init()")[1]
+        assert "storel 1000, $__wasm_global_0" in init
+        assert "__wasm_global_1" not in init
+
 
 class TestLocalsWithDifferentTypes:
     """Tests for locals with different value types."""
@@ -498,3 +531,99 @@ class TestLocalsWithDifferentTypes:
         qbe = compile_module(module)
         output = qbe.emit()
         assert "add" in output
+
+
+def make_globals_wasm(
+    globals_: list[bytes],
+    get: int,
+    imports: list[bytes] = (),
+    data_offset: bytes | None = None,
+) -> bytes:
+    """A module with ``globals_`` whose exported f() returns ``global.get get``.
+
+    ``imports`` are global import descriptions (type and mutability) from
+    ``env``, named ``g0``, ``g1``...; ``data_offset`` adds a one-page memory
+    and an active data segment "hi" at that offset expression.
+    """
+
+    def section(section_id: int, *entries: bytes) -> bytes:
+        body = bytes([len(entries)]) + b"".join(entries)
+        return bytes([section_id, len(body)]) + body
+
+    wasm = bytes([0x00, 0x61, 0x73, 0x6D, 0x01, 0x00, 0x00, 0x00])
+    wasm += section(0x01, bytes([0x60, 0x00, 0x01, 0x7F]))
+    if imports:
+        wasm += section(
+            0x02,
+            *(
+                b"\x03env" + bytes([2]) + f"g{i}".encode() + b"\x03" + desc
+                for i, desc in enumerate(imports)
+            ),
+        )
+    wasm += section(0x03, b"\x00")
+    if data_offset is not None:
+        wasm += section(0x05, b"\x00\x01")
+    wasm += section(0x06, *globals_)
+    wasm += section(0x07, b"\x01f\x00\x00")
+    wasm += section(0x0A, bytes([0x04, 0x00, 0x23, get, 0x0B]))
+    if data_offset is not None:
+        wasm += section(0x0B, b"\x00" + data_offset + b"\x02hi")
+    return wasm
+
+
+class TestConstantExpressions:
+    """Global initializers and segment offsets (extended constant expressions)."""
+
+    # (global i32 (i32.add (i32.mul (i32.const 10) (i32.const 4)) (i32.const 2)))
+    EXTENDED = bytes([0x7F, 0x00, 0x41, 0x0A, 0x41, 0x04, 0x6C, 0x41, 0x02, 0x6A, 0x0B])
+    # (global i32 (global.get 0) (i32.const 16) (i32.add))
+    IMPORTED_PLUS_16 = bytes([0x7F, 0x00, 0x23, 0x00, 0x41, 0x10, 0x6A, 0x0B])
+    IMMUTABLE_I32 = bytes([0x7F, 0x00])
+
+    def test_extended_const_evaluated(self):
+        output = compile_module(parse_module(make_globals_wasm([self.EXTENDED], 0)))
+        assert "data $__wasm_global_0 = { w 42 }" in output.emit()
+
+    def test_wraps_like_wasm(self):
+        # i32.const 0x7fffffff; i32.const 1; i32.add
+        glob = bytes([0x7F, 0x00, 0x41, 0xFF, 0xFF, 0xFF, 0xFF, 0x07, 0x41, 0x01, 0x6A])
+        wasm = make_globals_wasm([glob + b"\x0b"], 0)
+        assert "w -2147483648" in compile_module(parse_module(wasm)).emit()
+
+    def test_immutable_global_propagated(self):
+        wasm = make_globals_wasm([self.EXTENDED], 0)
+        output = compile_module(parse_module(wasm), opt_level=1).emit()
+        body = output.split("function w $wasm_f()")[1].split("}")[0]
+        assert "ret 42" in body
+
+    def test_imported_global_is_link_time_symbol(self):
+        wasm = make_globals_wasm([self.EXTENDED], 0, imports=[self.IMMUTABLE_I32])
+        output = compile_module(parse_module(wasm), opt_level=1).emit()
+        body = output.split("function w $wasm_f()")[1].split("}")[0]
+        assert "loadw $g0" in body
+        assert "data $g0" not in output
+
+    def test_initializer_reading_import_runs_at_instantiation(self):
+        wasm = make_globals_wasm(
+            [self.IMPORTED_PLUS_16], 1, imports=[self.IMMUTABLE_I32]
+        )
+        output = compile_module(parse_module(wasm), opt_level=1).emit()
+        init = output.split("$__wasm_memory_init()")[1].split("}")[0]
+        assert "loadw $g0" in init
+        assert "add %global_0_0, 16" in init
+        assert "storew %global_0_1, $__wasm_global_1" in init
+        # Its value is not known at compile time
+        body = output.split("function w $wasm_f()")[1].split("}")[0]
+        assert "loadw $__wasm_global_1" in body
+
+    def test_data_offset_from_import(self):
+        # (i32.add (global.get 0) (i32.const 8))
+        offset = bytes([0x23, 0x00, 0x41, 0x08, 0x6A, 0x0B])
+        wasm = make_globals_wasm(
+            [self.EXTENDED], 1, imports=[self.IMMUTABLE_I32], data_offset=offset
+        )
+        output = compile_module(parse_module(wasm)).emit()
+        init = output.split("$__wasm_memory_init()")[1].split("}")[0]
+        assert "loadw $g0" in init
+        assert "extuw" in init
+        assert "call $memcpy" in init
@@ -0,0 +1,344 @@
+"""Integration tests for the prebuilt runtime library."""
+
+from __future__ import annotations
+
+import platform
+import shutil
+import signal
+import subprocess
+
+import pytest
+
+from waq.runtime.bench import CONFIGURATIONS, run_benchmark
+from waq.runtime.library import cache_dir, runtime_library
+
+needs_cc = pytest.mark.skipif(
+    shutil.which("gcc") is None or shutil.which("ar") is None,
+    reason="gcc and ar are required to build the runtime",
+)
+
+
+class TestCacheDir:
+    """Tests for locating the cache directory."""
+
+    def test_override(self, monkeypatch, tmp_path):
+        """WAQ_CACHE_DIR takes precedence."""
+        monkeypatch.setenv("WAQ_CACHE_DIR", str(tmp_path))
+        assert cache_dir() == tmp_path
+
+    def test_xdg(self, monkeypatch, tmp_path):
+        """XDG_CACHE_HOME is honoured on non-macOS systems."""
+        monkeypatch.delenv("WAQ_CACHE_DIR", raising=False)
+        monkeypatch.setenv("XDG_CACHE_HOME", str(tmp_path))
+        monkeypatch.setattr("sys.platform", "linux")
+        assert cache_dir() == tmp_path / "waq"
+
+
+@pytest.fixture(scope="module")
+def cache(tmp_path_factory):
+    """A cache directory shared by the module, so each flag set builds once."""
+    path = tmp_path_factory.mktemp("waq_cache")
+    with pytest.MonkeyPatch.context() as monkeypatch:
+        monkeypatch.setenv("WAQ_CACHE_DIR", str(path))
+        yield path
+
+
+@needs_cc
+@pytest.mark.usefixtures("cache")
+class TestRuntimeLibrary:
+    """Tests for building and reusing libwaq_rt.a."""
+
+    def test_builds_archive(self, cache):
+        """The archive is built into the cache and exports the helpers."""
+        library = runtime_library("gcc")
+        assert library.parent == cache
+        assert library.name.startswith("libwaq_rt-")
+        symbols = subprocess.run(
+            ["nm", str(library)], capture_output=True, text=True, check=True
+        ).stdout
+        assert "__wasm_memory_grow" in symbols
+
+    def test_reused(self):
+        """A second request returns the cached archive without rebuilding."""
+        first = runtime_library("gcc")
+        mtime = first.stat().st_mtime_ns
+        assert runtime_library("gcc") == first
+        assert first.stat().st_mtime_ns == mtime
+
+    def test_flags_in_key(self):
+        """Different flag sets get different archives."""
+        assert runtime_library("gcc") != runtime_library("gcc", ["-DWAQ_NO_IFUNC"])
+
+    def test_function_sections(self):
+        """Helpers are in their own sections so the linker can drop them."""
+        library = runtime_library("gcc")
+        headers = subprocess.run(
+            ["objdump", "-h", str(library)], capture_output=True, text=True, check=True
+        ).stdout
+        assert ".text.__wasm_memory_grow" in headers
+
+
+# Calls a few SIMD kernels, including SSE4.1-dispatched ones, and prints lanes
+SIMD_DRIVER = r"""
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef struct { uint8_t bytes[16]; } __attribute__((aligned(16))) v128_t;
+
+void __wasm_i32x4_mul(v128_t *, const v128_t *, const v128_t *);
+void __wasm_i8x16_abs(v128_t *, const v128_t *);
+void __wasm_f32x4_min(v128_t *, const v128_t *, const v128_t *);
+void __wasm_i16x8_narrow_i32x4_u(v128_t *, const v128_t *, const v128_t *);
+int32_t __wasm_i8x16_bitmask(const v128_t *);
+void __wasm_i32x4_relaxed_dot_i8x16_i7x16_add_s(v128_t *, const v128_t *,
+                                                const v128_t *, const v128_t *);
+void __wasm_f32x4_relaxed_madd(v128_t *, const v128_t *, const v128_t *,
+                               const v128_t *);
+void __wasm_i8x16_relaxed_swizzle(v128_t *, const v128_t *, const v128_t *);
+void __wasm_i16x8_dot_i8x16_i7x16_s(v128_t *, const v128_t *, const v128_t *);
+void __wasm_f32x4_canon_nan(v128_t *, const v128_t *);
+
+int main(void) {
+    int32_t i[4] = {-3, 7, 65536, 100000}, w[4];
+    float f[4] = {1.0f, -0.0f, NAN, 2.0f}, g[4] = {0.5f, 0.0f, 1.0f, NAN}, h[4];
+    int8_t b[16] = {-128, -1, 0, 1, 127, -5, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    uint16_t n[8];
+    v128_t x, y, r;
+    memcpy(&x, i, 16);
+    __wasm_i32x4_mul(&r, &x, &x);
+    memcpy(w, &r, 16);
+    printf("%d %d %d %d\n", w[0], w[1], w[2], w[3]);
+    __wasm_i16x8_narrow_i32x4_u(&r, &x, &x);
+    memcpy(n, &r, 16);
+    printf("%u %u %u %u\n", n[0], n[1], n[2], n[3]);
+    memcpy(&x, b, 16);
+    __wasm_i8x16_abs(&r, &x);
+    printf("%d %d %d\n", (int8_t)r.bytes[0], r.bytes[1], r.bytes[5]);
+    printf("%d\n", __wasm_i8x16_bitmask(&x));
+    memcpy(&x, f, 16);
+    memcpy(&y, g, 16);
+    __wasm_f32x4_min(&r, &x, &y);
+    memcpy(h, &r, 16);
+    printf("%g %g %g %g\n", h[0], h[1], h[2], h[3]);
+    /* Relaxed operations where their result is exact */
+    int8_t s[16] = {-128, 127, -1, 2, 0, 0, 0, 0, 5, 5, 5, 5, 1, 2, 3, 4};
+    int8_t u[16] = {127, 127, 1, 0, 9, 9, 9, 9, 3, 0, 0, 0, 1, 1, 1, 1};
+    memcpy(&x, s, 16);
+    memcpy(&y, u, 16);
+    memcpy(&r, i, 16);
+    __wasm_i32x4_relaxed_dot_i8x16_i7x16_add_s(&r, &x, &y, &r);
+    memcpy(w, &r, 16);
+    printf("%d %d %d %d\n", w[0], w[1], w[2], w[3]);
+    __wasm_i8x16_relaxed_swizzle(&r, &x, &y);
+    printf("%d %d\n", (int8_t)r.bytes[2], r.bytes[8]);
+    memcpy(&x, f, 16);
+    memcpy(&y, g, 16);
+    __wasm_f32x4_relaxed_madd(&r, &x, &x, &y);
+    memcpy(h, &r, 16);
+    printf("%g %g\n", h[0], h[1]);
+    /* --deterministic: b signed, saturated pairs; canonical NaN lanes */
+    memcpy(&x, s, 16);
+    __wasm_i16x8_dot_i8x16_i7x16_s(&r, &x, &x);
+    memcpy(n, &r, 16);
+    printf("%d %d %d\n", (int16_t)n[0], (int16_t)n[1], (int16_t)n[4]);
+    memset(&x, 0x80, 16);
+    __wasm_i16x8_dot_i8x16_i7x16_s(&r, &x, &x);
+    memcpy(n, &r, 16);
+    printf("%d\n", (int16_t)n[0]);
+    f[0] = -NAN;
+    memcpy(&x, f, 16);
+    __wasm_f32x4_canon_nan(&r, &x);
+    memcpy(w, &r, 16);
+    printf("%08x %08x %08x\n", w[0], w[1], w[2]);
+    return 0;
+}
+"""
+
+
+@needs_cc
+@pytest.mark.usefixtures("cache")
+class TestSimdKernels:
+    """The v128 kernels give Wasm results with and without CPU dispatch."""
+
+    @pytest.mark.parametrize("cflags", [[], ["-DWAQ_NO_IFUNC"], ["-msse4.1"]])
+    def test_kernels(self, tmp_path, cflags):
+        if cflags == ["-msse4.1"] and platform.machine() != "x86_64":
+            pytest.skip("x86-64 only")
+        library = runtime_library("gcc", cflags)
+        driver = tmp_path / "driver.c"
+        driver.write_text(SIMD_DRIVER)
+        exe = tmp_path / "driver"
+        subprocess.run(
+            ["gcc", str(driver), str(library), "-lm", "-o", str(exe)], check=True
+        )
+        output = subprocess.run(
+            [str(exe)], capture_output=True, text=True, check=True
+        ).stdout
+        assert output.splitlines() == [
+            "9 49 0 1410065408",
+            "0 7 65535 65535",
+            "-128 1 5",
+            "35",
+            "0.5 -0 nan nan",
+            "-131 7 65551 100010",
+            "127 2",
+            "1.5 0",
+            "32513 5 50",
+            "32767",
+            "7fc00000 80000000 7fc00000",
+        ]
+
+    def test_benchmark(self):
+        """The microbenchmark times every kernel in every configuration."""
+        kernels = [("i8x16_relaxed_swizzle", 2), ("f32x4_relaxed_madd", 3)]
+        results = run_benchmark(iterations=1000, kernels=kernels)
+        assert list(results) == [config for config, _ in CONFIGURATIONS]
+        for timings in results.values():
+            assert sorted(timings) == sorted(name for name, _ in kernels)
+            assert all(ns >= 0 for ns in timings.values())
+
+
+# Runs exports behind the instance boundary; argv[1] picks what the host does
+BOUNDARY_DRIVER = r"""
+#include <setjmp.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int32_t __wasm_invoke(void (*)(void *), void *);
+void __wasm_instance_reset(void);
+const char *__wasm_trap_message(int32_t);
+int32_t __wasm_memory_grow(int32_t);
+uint8_t *__wasm_memory_base(void);
+void __wasm_trap_unreachable(void);
+void __wasm_throw(int32_t);
+
+/* What a compiled module would emit: one page, a counter at 16 */
+void __wasm_memory_init(void) { __wasm_memory_grow(1); }
+
+static void count_and_trap(void *arg) {
+    int32_t *counter = (int32_t *)(__wasm_memory_base() + 16);
+    *counter += 1;
+    *(int32_t *)arg = *counter;
+    __wasm_trap_unreachable();
+}
+
+static void throw_uncaught(void *arg) {
+    (void)arg;
+    __wasm_throw(0);
+}
+
+static __attribute__((noinline)) int recurse(int depth) {
+    volatile char frame[256];
+    frame[0] = (char)depth;
+    return recurse(depth + 1) + frame[0];
+}
+
+static void exhaust_stack(void *arg) { *(int *)arg = recurse(0); }
+
+static void report(const char *what, int32_t code) {
+    printf("%s %d %s\n", what, code, code ? __wasm_trap_message(code) : "ok");
+}
+
+static sigjmp_buf host_env;
+
+static void host_handler(int sig) { siglongjmp(host_env, sig); }
+
+static void fault_outside(void) {
+    volatile int32_t *null = NULL;
+    *null = 1;
+}
+
+int main(int argc, char **argv) {
+    int32_t seen = 0;
+    if (argc > 1 && strcmp(argv[1], "host") == 0) {
+        /* The host's own alternate stack and SIGSEGV handler come first */
+        static char host_stack[1 << 16];
+        stack_t ss = {.ss_sp = host_stack, .ss_size = sizeof(host_stack)};
+        sigaltstack(&ss, NULL);
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = host_handler;
+        sa.sa_flags = SA_ONSTACK | SA_NODEFER;
+        sigaction(SIGSEGV, &sa, NULL);
+
+        report("stack", __wasm_invoke(exhaust_stack, &seen));
+        sigaltstack(NULL, &ss);
+        printf("altstack %s\n", ss.ss_sp == host_stack ? "kept" : "replaced");
+        int sig = sigsetjmp(host_env, 1);
+        if (sig == 0) fault_outside();
+        printf("host %s\n", sig == SIGSEGV ? "handled" : "missed");
+        return 0;
+    }
+    __wasm_memory_init();
+    report("trap", __wasm_invoke(count_and_trap, &seen));
+    printf("counter %d\n", seen);
+    __wasm_invoke(count_and_trap, &seen);
+    printf("counter %d\n", seen);
+    __wasm_instance_reset();
+    __wasm_memory_init();
+    __wasm_invoke(count_and_trap, &seen);
+    printf("counter %d\n", seen);
+    report("throw", __wasm_invoke(throw_uncaught, &seen));
+    report("stack", __wasm_invoke(exhaust_stack, &seen));
+    fflush(stdout);
+    if (argc > 1 && strcmp(argv[1], "unhandled") == 0) fault_outside();
+    return 0;
+}
+"""
+
+
+@needs_cc
+@pytest.mark.usefixtures("cache")
+class TestInstanceBoundary:
+    """Tests for __wasm_invoke() and __wasm_instance_reset() from a C host."""
+
+    @pytest.fixture
+    def driver(self, tmp_path):
+        source = tmp_path / "driver.c"
+        source.write_text(BOUNDARY_DRIVER)
+        binary = tmp_path / "driver"
+        # -O0 keeps the recursion a real call chain
+        subprocess.run(
+            ["gcc", "-O0", str(source), str(runtime_library("gcc")), "-lm"]
+            + ["-o", str(binary)],
+            check=True,
+        )
+        return binary
+
+    def run(self, driver, mode: str) -> subprocess.CompletedProcess:
+        return subprocess.run(
+            [str(driver), mode], capture_output=True, text=True, check=False
+        )
+
+    def test_traps_and_reset(self, driver):
+        """Traps come back as codes, and a reset instance starts afresh."""
+        result = self.run(driver, "boundary")
+        assert result.returncode == 0, result.stderr
+        assert result.stdout.splitlines() == [
+            "trap 1 unreachable",
+            "counter 1",
+            "counter 2",
+            "counter 1",
+            "throw 8 uncaught exception",
+            "stack 10 memory fault",
+        ]
+
+    def test_host_handlers_kept(self, driver):
+        """The host's SIGSEGV handler and alternate stack survive a call."""
+        result = self.run(driver, "host")
+        assert result.returncode == 0, result.stderr
+        assert result.stdout.splitlines() == [
+            "stack 10 memory fault",
+            "altstack kept",
+            "host handled",
+        ]
+
+    def test_fault_outside_boundary(self, driver):
+        """Without a host handler a fault outside a call still kills."""
+        result = self.run(driver, "unhandled")
+        assert result.returncode == -signal.SIGSEGV
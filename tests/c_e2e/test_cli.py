@@ -6,7 +6,7 @@ from pathlib import Path
 
 import pytest
 
-from waq.cli import main
+from waq.cli import main, runtime_cflags
 
 
 class TestCLIBasic:
@@ -115,6 +115,26 @@ class TestCLICompilation:
         # Exported functions are prefixed with wasm_ to avoid C symbol conflicts
         assert "$wasm_f" in content
 
+    def test_compile_warnings(self, tmp_path, capsys):
+        """Compile warnings are printed, and the output is still written."""
+        # f(n) = return_call g(n), g imported
+        # fmt: off
+        wasm = bytes([0x00, 0x61, 0x73, 0x6D, 0x01, 0x00, 0x00, 0x00])
+        wasm += bytes([0x01, 0x06, 0x01, 0x60, 0x01, 0x7F, 0x01, 0x7F])
+        wasm += bytes([0x02, 0x09, 0x01, 0x03]) + b"env" + bytes([0x01]) + b"g"
+        wasm += bytes([0x00, 0x00])
+        wasm += bytes([0x03, 0x02, 0x01, 0x00])
+        wasm += bytes([0x07, 0x05, 0x01, 0x01]) + b"f" + bytes([0x00, 0x01])
+        wasm += bytes([0x0A, 0x08, 0x01, 0x06, 0x00, 0x20, 0x00, 0x12, 0x00, 0x0B])
+        # fmt: on
+        wasm_file = tmp_path / "tail.wasm"
+        wasm_file.write_bytes(wasm)
+        output_file = tmp_path / "output.ssa"
+        result = main([str(wasm_file), "-o", str(output_file)])
+        assert result == 0
+        assert output_file.exists()
+        assert "Warning: $wasm_f: tail call to the imported" in capsys.readouterr().err
+
     def test_default_output_name(self, minimal_wasm):
         """Test that default output has .ssa extension."""
         result = main([str(minimal_wasm)])
@@ -165,6 +185,107 @@ class TestCLITargets:
         assert output_file.exists()
 
 
+class TestCLIOptimization:
+    """Tests for optimization levels."""
+
+    @pytest.fixture
+    def minimal_wasm(self, tmp_path):
+        """Create a minimal WASM file."""
+        wasm_file = tmp_path / "test.wasm"
+        wasm_file.write_bytes(b"\x00asm\x01\x00\x00\x00")
+        return wasm_file
+
+    @pytest.mark.parametrize("level", ["-O0", "-O1", "-O2"])
+    def test_optimization_levels(self, minimal_wasm, tmp_path, level):
+        """Test compilation at each optimization level."""
+        output_file = tmp_path / "output.ssa"
+        result = main([str(minimal_wasm), "-o", str(output_file), level])
+        assert result == 0
+        assert output_file.exists()
+
+    def test_invalid_level(self, minimal_wasm):
+        """Test that unknown optimization levels are rejected."""
+        with pytest.raises(SystemExit) as exc:
+            main([str(minimal_wasm), "-O3"])
+        assert exc.value.code != 0
+
+    def test_lto(self, minimal_wasm, tmp_path):
+        """Test compilation with runtime helper inlining."""
+        output_file = tmp_path / "output.ssa"
+        result = main([str(minimal_wasm), "-o", str(output_file), "--lto"])
+        assert result == 0
+        assert output_file.exists()
+
+    def test_lto_needs_optimization(self, minimal_wasm):
+        """Test that --lto is rejected at -O0, where it would do nothing."""
+        with pytest.raises(SystemExit) as exc:
+            main([str(minimal_wasm), "--lto", "-O0"])
+        assert exc.value.code != 0
+
+    def test_deterministic(self, minimal_wasm, tmp_path):
+        """Test compilation with canonical NaNs."""
+        output_file = tmp_path / "output.ssa"
+        result = main([str(minimal_wasm), "-o", str(output_file), "--deterministic"])
+        assert result == 0
+        assert output_file.exists()
+
+    def test_instrument(self, minimal_wasm, tmp_path):
+        """Test that an instrumented build registers its counters."""
+        output_file = tmp_path / "output.ssa"
+        result = main([str(minimal_wasm), "-o", str(output_file), "--instrument=pgo"])
+        assert result == 0
+        assert "$__wasm_prof_register" in output_file.read_text()
+
+    def test_profile_use(self, minimal_wasm, tmp_path):
+        """Test compilation with several profiles."""
+        profiles = []
+        for name in ("a.waqprof", "b.waqprof"):
+            profiles += ["--profile-use", str(tmp_path / name)]
+            (tmp_path / name).write_text("waqprof 1\n")
+        output_file = tmp_path / "output.ssa"
+        result = main([str(minimal_wasm), "-o", str(output_file), "-O2", *profiles])
+        assert result == 0
+
+    def test_bad_profile(self, minimal_wasm, tmp_path, capsys):
+        """Test that a malformed profile is reported."""
+        profile = tmp_path / "bad.waqprof"
+        profile.write_text("not a profile\n")
+        result = main([str(minimal_wasm), "--profile-use", str(profile)])
+        assert result == 1
+        assert "Profile error" in capsys.readouterr().err
+
+
+class TestCLICpu:
+    """Tests for the runtime CPU model."""
+
+    @pytest.fixture
+    def minimal_wasm(self, tmp_path):
+        """Create a minimal WASM file."""
+        wasm_file = tmp_path / "test.wasm"
+        wasm_file.write_bytes(b"\x00asm\x01\x00\x00\x00")
+        return wasm_file
+
+    @pytest.mark.parametrize("option", ["--cpu=native", "-mcpu=native"])
+    def test_cpu_option(self, minimal_wasm, tmp_path, option):
+        """Test that both spellings of the CPU option are accepted."""
+        output_file = tmp_path / "output.ssa"
+        result = main([str(minimal_wasm), "-o", str(output_file), option])
+        assert result == 0
+
+    def test_invalid_cpu(self, minimal_wasm):
+        """Test that unknown CPU models are rejected."""
+        with pytest.raises(SystemExit) as exc:
+            main([str(minimal_wasm), "--cpu", "pentium"])
+        assert exc.value.code != 0
+
+    def test_runtime_cflags(self):
+        """Test the C flags used to build the runtime."""
+        assert runtime_cflags("amd64_sysv", "baseline") == []
+        assert runtime_cflags("amd64_sysv", "native") == ["-march=native"]
+        assert runtime_cflags("arm64_apple", "native") == ["-mcpu=native"]
+        assert runtime_cflags("rv64", "native") == []
+
+
 class TestCLIEmitFormats:
     """Tests for different emit formats."""
 
@@ -224,6 +345,138 @@ class TestCLIEmitFormats:
             assert proc.returncode == 0
             assert proc.stdout.strip() == "55"  # fib(10) = 55
 
+    def test_emit_llvm(self, minimal_wasm, tmp_path):
+        """Test LLVM IR output format."""
+        output_file = tmp_path / "output.ll"
+        result = main([
+            str(minimal_wasm),
+            "-o",
+            str(output_file),
+            "--emit",
+            "llvm",
+            "-t",
+            "arm64",
+        ])
+        assert result == 0
+        content = output_file.read_text()
+        assert 'target triple = "aarch64-unknown-linux-gnu"' in content
+
+    def test_emit_llvm_default_output_name(self, minimal_wasm):
+        """Test that LLVM IR output defaults to a .ll file."""
+        result = main([str(minimal_wasm), "--emit", "llvm"])
+        assert result == 0
+        assert minimal_wasm.with_suffix(".ll").exists()
+
+    def test_llvm_backend_obj(self, minimal_wasm, tmp_path):
+        """Test obj output through the LLVM backend."""
+        output_file = tmp_path / "output.o"
+        result = main([
+            str(minimal_wasm),
+            "-o",
+            str(output_file),
+            "--emit",
+            "obj",
+            "--backend",
+            "llvm",
+        ])
+        # May fail if clang not installed, which is acceptable
+        if result == 0:
+            assert output_file.stat().st_size > 0
+
+    def test_llvm_backend_exe(self, tmp_path):
+        """Test exe output through the LLVM backend with fibonacci example."""
+        import subprocess
+
+        fixtures_dir = Path(__file__).parent.parent / "fixtures"
+        wat_file = fixtures_dir / "fibonacci.wat"
+        if not wat_file.exists():
+            pytest.skip("fibonacci.wat fixture not found")
+
+        output_file = tmp_path / "fibonacci"
+        result = main([
+            str(wat_file),
+            "-o",
+            str(output_file),
+            "--emit",
+            "exe",
+            "--backend",
+            "llvm",
+        ])
+        # May fail if clang/wat2wasm not installed
+        if result == 0:
+            proc = subprocess.run(
+                [str(output_file)], capture_output=True, text=True, timeout=5
+            )
+            assert proc.returncode == 0
+            assert proc.stdout.strip() == "55"  # fib(10) = 55
+
+    def test_baseline_backend_obj(self, minimal_wasm, tmp_path):
+        """Test obj output straight from the baseline backend."""
+        output_file = tmp_path / "output.o"
+        result = main([
+            str(minimal_wasm),
+            "-o",
+            str(output_file),
+            "--emit",
+            "obj",
+            "--backend",
+            "baseline",
+            "-t",
+            "amd64_sysv",
+        ])
+        assert result == 0
+        assert output_file.read_bytes()[:4] == b"\x7fELF"
+
+    def test_baseline_backend_exe(self, tmp_path):
+        """Test exe output through the baseline backend with fibonacci example."""
+        import subprocess
+
+        fixtures_dir = Path(__file__).parent.parent / "fixtures"
+        wat_file = fixtures_dir / "fibonacci.wat"
+        if not wat_file.exists():
+            pytest.skip("fibonacci.wat fixture not found")
+
+        output_file = tmp_path / "fibonacci"
+        result = main([
+            str(wat_file),
+            "-o",
+            str(output_file),
+            "--emit",
+            "exe",
+            "--backend",
+            "baseline",
+            "-t",
+            "amd64_sysv",
+        ])
+        # May fail if wat2wasm/gcc not installed
+        if result == 0:
+            proc = subprocess.run(
+                [str(output_file)], capture_output=True, text=True, timeout=5
+            )
+            assert proc.returncode == 0
+            assert proc.stdout.strip() == "55"  # fib(10) = 55
+
+    @pytest.mark.parametrize(
+        "extra",
+        [
+            ["--emit", "asm"],
+            ["--emit", "obj", "-t", "arm64"],
+            ["--emit", "obj", "--lto"],
+            ["--emit", "obj", "--deterministic"],
+        ],
+    )
+    def test_baseline_backend_rejected(self, minimal_wasm, extra):
+        """Test that the baseline backend refuses what it can't produce."""
+        with pytest.raises(SystemExit) as exc:
+            main([str(minimal_wasm), "--backend", "baseline", *extra])
+        assert exc.value.code != 0
+
+    def test_invalid_backend(self, minimal_wasm):
+        """Test that unknown backends are rejected."""
+        with pytest.raises(SystemExit) as exc:
+            main([str(minimal_wasm), "--backend", "gcc"])
+        assert exc.value.code != 0
+
 
 class TestCLIErrors:
     """Tests for CLI error handling."""